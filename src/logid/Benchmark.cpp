@@ -0,0 +1,133 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include "Benchmark.h"
+#include "backend/Error.h"
+#include "backend/hidpp20/Device.h"
+#include "backend/hidpp20/Error.h"
+#include "backend/hidpp20/features/Root.h"
+#include "backend/hidpp20/features/FeatureSet.h"
+#include "util/thread.h"
+
+using namespace logid;
+using namespace logid::backend;
+using namespace std::chrono;
+
+std::chrono::nanoseconds Benchmark::Result::percentile(double p) const
+{
+    if(rtt.empty())
+        return nanoseconds(0);
+    auto rank = (std::size_t)(p / 100 * (rtt.size() - 1) + 0.5);
+    return rtt[std::min(rank, rtt.size() - 1)];
+}
+
+Benchmark::Benchmark(const std::string& path, hidpp::DeviceIndex index) :
+    _device (std::make_unique<hidpp20::Device>(path, index))
+{
+    _device->listen();
+}
+
+Benchmark::~Benchmark()
+{
+    _device->stopListening();
+}
+
+Benchmark::Result Benchmark::run(Request request, std::size_t concurrency,
+        std::size_t requests)
+{
+    Result result{};
+    result.request = request;
+    result.concurrency = concurrency;
+
+    // Looked up before timing, FeatureSet asks Root for its index
+    hidpp20::Root root(_device.get());
+    hidpp20::FeatureSet feature_set(_device.get());
+
+    std::mutex result_lock;
+    std::atomic<std::size_t> next(0);
+    auto sender = [&]() {
+        std::vector<nanoseconds> rtt;
+        std::size_t timeouts = 0, errors = 0;
+        while(next++ < requests) {
+            auto start = steady_clock::now();
+            backend::Failure failure;
+            if(request == Ping) {
+                auto response = root.tryGetVersion();
+                if(!response)
+                    failure = response.failure();
+            } else if(request == FeatureCount) {
+                auto response = feature_set.tryGetFeatureCount();
+                if(!response)
+                    failure = response.failure();
+            } else {
+                try {
+                    feature_set.getFeatures();
+                } catch(backend::TimeoutError& e) {
+                    failure = backend::Failure(backend::Failure::Timeout, 0);
+                } catch(hidpp20::Error& e) {
+                    failure = backend::Failure(backend::Failure::Hidpp20Error,
+                            e.code());
+                }
+            }
+            auto end = steady_clock::now();
+
+            if(failure.kind() == backend::Failure::Timeout)
+                timeouts++;
+            else if(failure)
+                errors++;
+            else
+                rtt.push_back(end - start);
+        }
+
+        std::lock_guard<std::mutex> lock(result_lock);
+        result.rtt.insert(result.rtt.end(), rtt.begin(), rtt.end());
+        result.timeouts += timeouts;
+        result.errors += errors;
+    };
+
+    std::vector<std::unique_ptr<thread>> threads;
+    auto start = steady_clock::now();
+    for(std::size_t i = 0; i < concurrency; i++) {
+        threads.push_back(std::make_unique<thread>(sender));
+        threads.back()->run();
+    }
+    for(auto& t : threads)
+        t->wait();
+    result.wall_time = steady_clock::now() - start;
+
+    result.requests = requests;
+    std::sort(result.rtt.begin(), result.rtt.end());
+    return result;
+}
+
+const char* Benchmark::requestName(Request request)
+{
+    switch(request) {
+    case Ping:
+        return "ping";
+    case FeatureCount:
+        return "feature_count";
+    case FeatureTable:
+        return "feature_table";
+    default:
+        return "unknown";
+    }
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_BENCHMARK_H
+#define LOGID_BENCHMARK_H
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include "backend/hidpp/defs.h"
+
+// Requests sent at every concurrency level
+#define LOGID_BENCH_REQUESTS 1000
+// Concurrency doubles from 1 up to this
+#define LOGID_BENCH_MAX_CONCURRENCY 8
+
+namespace logid
+{
+    namespace backend {
+    namespace hidpp20 {
+        class Device;
+    }}
+
+    /* Sends harmless requests to a device through the same request layer
+     * the daemon uses, to measure its round trip times. Requests are
+     * synchronous, concurrency is the number of threads sending them.
+     * Timeouts follow io_timeout and the retry settings of the config.
+     */
+    class Benchmark
+    {
+    public:
+        enum Request
+        {
+            Ping,           // Root GetProtocolVersion
+            FeatureCount,   // FeatureSet GetFeatureCount
+            FeatureTable    // Every FeatureSet GetFeature, pipelined
+        };
+
+        struct Result
+        {
+            Request request;
+            std::size_t concurrency;
+            std::size_t requests;
+            std::size_t timeouts;
+            std::size_t errors;
+            std::chrono::nanoseconds wall_time;
+            // Of the requests that were answered, sorted
+            std::vector<std::chrono::nanoseconds> rtt;
+
+            std::chrono::nanoseconds percentile(double p) const;
+        };
+
+        Benchmark(const std::string& path, backend::hidpp::DeviceIndex index);
+        ~Benchmark();
+
+        Result run(Request request, std::size_t concurrency,
+                std::size_t requests);
+
+        static const char* requestName(Request request);
+    private:
+        std::unique_ptr<backend::hidpp20::Device> _device;
+    };
+}
+
+#endif //LOGID_BENCHMARK_H
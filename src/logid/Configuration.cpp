@@ -16,21 +16,134 @@
  *
  */
 
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <sstream>
 #include <utility>
 #include <vector>
 #include <map>
 
 #include "Configuration.h"
+#include "InputDevice.h"
 #include "util/log.h"
 
 using namespace logid;
 using namespace libconfig;
 using namespace std::chrono;
 
+std::shared_ptr<Configuration> logid::global_config;
+
+namespace
+{
+    bool settingIs(const Setting& setting, const char* name,
+            const std::string& value)
+    {
+        std::string str;
+        if(!setting.lookupValue(name, str))
+            return false;
+        std::transform(str.begin(), str.end(), str.begin(), ::tolower);
+        return str == value;
+    }
+
+    // Invalid codes are skipped here, the action reports them when parsed
+    void addCode(const Setting& code, uint (*from_name)(const std::string&),
+            std::set<uint>& codes)
+    {
+        if(code.getType() == Setting::TypeInt) {
+            codes.insert((int)code);
+        } else if(code.getType() == Setting::TypeString) {
+            try {
+                codes.insert(from_name((const char*)code));
+            } catch(InputDevice::InvalidEventCode& e) { }
+        }
+    }
+
+    /* Finds the key and axis codes used by Keypress actions and Axis
+     * gestures anywhere below setting, wherever they are nested. */
+    void collectInputCodes(const Setting& setting, std::set<uint>& keys,
+            std::set<uint>& axes)
+    {
+        if(setting.isGroup()) {
+            if(settingIs(setting, "type", "keypress") &&
+               setting.exists("keys")) {
+                auto& codes = setting["keys"];
+                if(codes.isArray() || codes.isList()) {
+                    for(int i = 0; i < codes.getLength(); i++)
+                        addCode(codes[i], InputDevice::toKeyCode, keys);
+                }
+            }
+            if(settingIs(setting, "mode", "axis") && setting.exists("axis"))
+                addCode(setting["axis"], InputDevice::toAxisCode, axes);
+        }
+
+        if(setting.isAggregate()) {
+            for(int i = 0; i < setting.getLength(); i++)
+                collectInputCodes(setting[i], keys, axes);
+        }
+    }
+
+    /* profiles is a group of named groups, each holding device settings
+     * that replace the device's own while the profile is selected. */
+    void loadProfiles(const Setting& profiles,
+            Configuration::DeviceSettings& settings)
+    {
+        if(!profiles.isGroup()) {
+            logPrintf(WARN, "Line %d: profiles must be a group, ignoring.",
+                    profiles.getSourceLine());
+            return;
+        }
+
+        for(int i = 0; i < profiles.getLength(); i++) {
+            Setting& profile = profiles[i];
+            if(!profile.isGroup()) {
+                logPrintf(WARN, "Line %d: profile %s must be a group, "
+                                "ignoring.", profile.getSourceLine(),
+                                profile.getName());
+                continue;
+            }
+
+            auto overlay = std::make_shared<Configuration::DeviceSettings>();
+            overlay->document = settings.document;
+            overlay->settings = settings.settings;
+            for(int j = 0; j < profile.getLength(); j++)
+                overlay->settings[profile[j].getName()] = &profile[j];
+            settings.profiles.emplace(profile.getName(), std::move(overlay));
+        }
+    }
+
+    // FNV-1a of the config text, stable across runs unlike std::hash
+    std::string configHash(const std::string& config_file)
+    {
+        std::ifstream file(config_file);
+        std::stringstream text;
+        text << file.rdbuf();
+        if(!file)
+            return "";
+
+        // Included files are not hashed, such configs are not cached
+        auto contents = text.str();
+        if(contents.find("@include") != std::string::npos)
+            return "";
+
+        uint64_t hash = 0xcbf29ce484222325;
+        for(unsigned char c : contents) {
+            hash ^= c;
+            hash *= 0x100000001b3;
+        }
+        char hex[17];
+        snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)hash);
+        return hex;
+    }
+}
+
 Configuration::Configuration(const std::string& config_file)
 {
     try {
-        _config.readFile(config_file.c_str());
+        _config->readFile(config_file.c_str());
     } catch(const FileIOException &e) {
         logPrintf(ERROR, "I/O Error while reading %s: %s", config_file.c_str(),
                 e.what());
@@ -41,18 +154,66 @@ Configuration::Configuration(const std::string& config_file)
         throw e;
     }
 
-    const Setting &root = _config.getRoot();
+    Setting &root = _config->getRoot();
 
+    /* workers may either be a fixed count or a group, e.g.
+     * workers: { min: 2; max: 8; wait: 5; linger: 30000; };
+     * with wait and linger in milliseconds, see workqueue.h.
+     */
     try {
         auto& worker_count = root["workers"];
         if(worker_count.getType() == Setting::TypeInt) {
-            _worker_threads = worker_count;
-            if(_worker_threads < 0)
-                logPrintf(WARN, "Line %d: workers cannot be negative.",
+            int workers = worker_count;
+            if(workers < 1) {
+                logPrintf(WARN, "Line %d: workers must be at least 1.",
                         worker_count.getSourceLine());
+            } else {
+                _worker_scaling.min = workers;
+                _worker_scaling.max = workers;
+            }
+        } else if(worker_count.isGroup()) {
+            int min = _worker_scaling.min, max = -1;
+            if(worker_count.exists("min")) {
+                auto& min_setting = worker_count["min"];
+                if(min_setting.getType() == Setting::TypeInt &&
+                   (int)min_setting >= 1)
+                    min = min_setting;
+                else
+                    logPrintf(WARN, "Line %d: min must be at least 1.",
+                            min_setting.getSourceLine());
+            }
+            if(worker_count.exists("max")) {
+                auto& max_setting = worker_count["max"];
+                if(max_setting.getType() == Setting::TypeInt &&
+                   (int)max_setting >= min)
+                    max = max_setting;
+                else
+                    logPrintf(WARN, "Line %d: max must be an integer no "
+                                    "less than min.",
+                                    max_setting.getSourceLine());
+            }
+            _worker_scaling.min = min;
+            _worker_scaling.max = max < 0 ? std::max<int>(min,
+                    _worker_scaling.max) : max;
+            if(worker_count.exists("wait")) {
+                auto& wait = worker_count["wait"];
+                if(wait.getType() == Setting::TypeInt && (int)wait > 0)
+                    _worker_scaling.wait = milliseconds((int)wait);
+                else
+                    logPrintf(WARN, "Line %d: wait must be a positive "
+                                    "integer.", wait.getSourceLine());
+            }
+            if(worker_count.exists("linger")) {
+                auto& linger = worker_count["linger"];
+                if(linger.getType() == Setting::TypeInt && (int)linger >= 0)
+                    _worker_scaling.linger = milliseconds((int)linger);
+                else
+                    logPrintf(WARN, "Line %d: linger must be a non-negative "
+                                    "integer.", linger.getSourceLine());
+            }
         } else {
-            logPrintf(WARN, "Line %d: workers must be an integer.",
-                    worker_count.getSourceLine());
+            logPrintf(WARN, "Line %d: workers must be an integer or a "
+                            "group.", worker_count.getSourceLine());
         }
     } catch(const SettingNotFoundException& e) {
         // Ignore
@@ -73,30 +234,636 @@ Configuration::Configuration(const std::string& config_file)
         // Ignore
     }
 
+    try {
+        auto& window = root["request_window"];
+        if(window.getType() == Setting::TypeInt && (int)window >= 0)
+            _request_window = window;
+        else
+            logPrintf(WARN, "Line %d: request_window must be a non-negative "
+                            "integer.", window.getSourceLine());
+    } catch(const SettingNotFoundException& e) {
+        // Ignore
+    }
+
+    try {
+        auto& window = root["slot_window"];
+        if(window.getType() == Setting::TypeInt && (int)window >= 0)
+            _slot_window = window;
+        else
+            logPrintf(WARN, "Line %d: slot_window must be a non-negative "
+                            "integer.", window.getSourceLine());
+    } catch(const SettingNotFoundException& e) {
+        // Ignore
+    }
+
+    /* Retries of writes and busy responses, either a retry count or a
+     * group, e.g. retry: { count: 3; delay: 10; max_delay: 250; };
+     */
+    try {
+        auto& retry = root["retry"];
+        if(retry.getType() == Setting::TypeInt) {
+            if((int)retry >= 0)
+                _retry.count = retry;
+            else
+                logPrintf(WARN, "Line %d: retry cannot be negative.",
+                        retry.getSourceLine());
+        } else if(retry.isGroup()) {
+            if(retry.exists("count")) {
+                auto& count = retry["count"];
+                if(count.getType() == Setting::TypeInt && (int)count >= 0)
+                    _retry.count = count;
+                else
+                    logPrintf(WARN, "Line %d: count must be a non-negative "
+                                    "integer.", count.getSourceLine());
+            }
+            if(retry.exists("delay")) {
+                auto& delay = retry["delay"];
+                if(delay.getType() == Setting::TypeInt && (int)delay > 0)
+                    _retry.delay = milliseconds((int)delay);
+                else
+                    logPrintf(WARN, "Line %d: delay must be a positive "
+                                    "integer.", delay.getSourceLine());
+            }
+            if(retry.exists("max_delay")) {
+                auto& max_delay = retry["max_delay"];
+                if(max_delay.getType() == Setting::TypeInt &&
+                   (int)max_delay > 0)
+                    _retry.max_delay = milliseconds((int)max_delay);
+                else
+                    logPrintf(WARN, "Line %d: max_delay must be a positive "
+                                    "integer.", max_delay.getSourceLine());
+            }
+        } else {
+            logPrintf(WARN, "Line %d: retry must be an integer or a group.",
+                    retry.getSourceLine());
+        }
+    } catch(const SettingNotFoundException& e) {
+        // Ignore
+    }
+
+    /* reactor may either be a boolean or a group, e.g.
+     * reactor: { enabled: true; max_events: 16; shards: 4; cpus: [2, 3];
+     *            io_uring: true; };
+     */
+    try {
+        auto& reactor = root["reactor"];
+        if(reactor.getType() == Setting::TypeBoolean) {
+            _reactor = reactor;
+        } else if(reactor.isGroup()) {
+            _reactor = true;
+            if(reactor.exists("enabled")) {
+                auto& enabled = reactor["enabled"];
+                if(enabled.getType() == Setting::TypeBoolean)
+                    _reactor = enabled;
+                else
+                    logPrintf(WARN, "Line %d: enabled must be a boolean.",
+                            enabled.getSourceLine());
+            }
+            if(reactor.exists("max_events")) {
+                auto& max_events = reactor["max_events"];
+                if(max_events.getType() == Setting::TypeInt &&
+                   (int)max_events > 0)
+                    _reactor_events = max_events;
+                else
+                    logPrintf(WARN, "Line %d: max_events must be a positive "
+                                    "integer.", max_events.getSourceLine());
+            }
+            if(reactor.exists("shards")) {
+                auto& shards = reactor["shards"];
+                if(shards.getType() == Setting::TypeInt && (int)shards > 0)
+                    _reactor_shards = shards;
+                else
+                    logPrintf(WARN, "Line %d: shards must be a positive "
+                                    "integer.", shards.getSourceLine());
+            }
+            if(reactor.exists("io_uring")) {
+                auto& io_uring = reactor["io_uring"];
+                if(io_uring.getType() == Setting::TypeBoolean)
+                    _reactor_uring = io_uring;
+                else
+                    logPrintf(WARN, "Line %d: io_uring must be a boolean.",
+                            io_uring.getSourceLine());
+            }
+            if(reactor.exists("cpus")) {
+                auto& cpus = reactor["cpus"];
+                if(cpus.getType() == Setting::TypeInt) {
+                    _reactor_cpus.push_back(cpus);
+                } else if(cpus.isArray() || cpus.isList()) {
+                    for(int i = 0; i < cpus.getLength(); i++) {
+                        if(cpus[i].getType() == Setting::TypeInt)
+                            _reactor_cpus.push_back(cpus[i]);
+                        else
+                            logPrintf(WARN, "Line %d: cpus must be "
+                                            "integers.",
+                                            cpus[i].getSourceLine());
+                    }
+                } else {
+                    logPrintf(WARN, "Line %d: cpus must be an integer or an "
+                                    "array.", cpus.getSourceLine());
+                }
+            }
+        } else {
+            logPrintf(WARN, "Line %d: reactor must be a boolean or a group.",
+                    reactor.getSourceLine());
+        }
+    } catch(const SettingNotFoundException& e) {
+        // Ignore
+    }
+
+    // An empty string disables the feature table cache
+    try {
+        auto& feature_cache = root["feature_cache"];
+        if(feature_cache.getType() == Setting::TypeString)
+            _feature_cache = (const char*)feature_cache;
+        else
+            logPrintf(WARN, "Line %d: feature_cache must be a string.",
+                    feature_cache.getSourceLine());
+    } catch(const SettingNotFoundException& e) {
+        // Ignore
+    }
+
+    // An empty string disables the built-in model database
+    try {
+        auto& model_database = root["model_database"];
+        if(model_database.getType() == Setting::TypeString)
+            _model_database = (const char*)model_database;
+        else
+            logPrintf(WARN, "Line %d: model_database must be a string.",
+                    model_database.getSourceLine());
+    } catch(const SettingNotFoundException& e) {
+        // Ignore
+    }
+
+    // An empty string disables the warm restart snapshot
+    try {
+        auto& snapshot = root["snapshot"];
+        if(snapshot.getType() == Setting::TypeString)
+            _snapshot = (const char*)snapshot;
+        else
+            logPrintf(WARN, "Line %d: snapshot must be a string.",
+                    snapshot.getSourceLine());
+    } catch(const SettingNotFoundException& e) {
+        // Ignore
+    }
+
+    // An empty string (the default) disables the control socket
+    try {
+        auto& control_socket = root["control_socket"];
+        if(control_socket.getType() == Setting::TypeString)
+            _control_socket = (const char*)control_socket;
+        else
+            logPrintf(WARN, "Line %d: control_socket must be a string.",
+                    control_socket.getSourceLine());
+    } catch(const SettingNotFoundException& e) {
+        // Ignore
+    }
+
+    // An octal string, e.g. "0660", as libconfig has no octal integers
+    try {
+        auto& mode = root["control_socket_mode"];
+        char* end = nullptr;
+        unsigned long value = 0;
+        if(mode.getType() == Setting::TypeString)
+            value = std::strtoul((const char*)mode, &end, 8);
+        if(end && !*end && end != (const char*)mode && value <= 0777)
+            _control_socket_mode = value;
+        else
+            logPrintf(WARN, "Line %d: control_socket_mode must be an octal "
+                    "string.", mode.getSourceLine());
+    } catch(const SettingNotFoundException& e) {
+        // Ignore
+    }
+
+    try {
+        auto& group = root["control_socket_group"];
+        if(group.getType() == Setting::TypeString)
+            _control_socket_group = (const char*)group;
+        else
+            logPrintf(WARN, "Line %d: control_socket_group must be a string.",
+                    group.getSourceLine());
+    } catch(const SettingNotFoundException& e) {
+        // Ignore
+    }
+
+    // An empty string keeps control socket clients from starting traces
+    try {
+        auto& trace_dir = root["trace_dir"];
+        if(trace_dir.getType() == Setting::TypeString)
+            _trace_dir = (const char*)trace_dir;
+        else
+            logPrintf(WARN, "Line %d: trace_dir must be a string.",
+                    trace_dir.getSourceLine());
+    } catch(const SettingNotFoundException& e) {
+        // Ignore
+    }
+
+    // An empty string (the default) disables the status page
+    try {
+        auto& status_page = root["status_page"];
+        if(status_page.getType() == Setting::TypeString)
+            _status_page = (const char*)status_page;
+        else
+            logPrintf(WARN, "Line %d: status_page must be a string.",
+                    status_page.getSourceLine());
+    } catch(const SettingNotFoundException& e) {
+        // Ignore
+    }
+
+    // An empty string (the default) disables the metrics textfile
+    try {
+        auto& metrics_file = root["metrics_file"];
+        if(metrics_file.getType() == Setting::TypeString)
+            _metrics_file = (const char*)metrics_file;
+        else
+            logPrintf(WARN, "Line %d: metrics_file must be a string.",
+                    metrics_file.getSourceLine());
+    } catch(const SettingNotFoundException& e) {
+        // Ignore
+    }
+
+    try {
+        auto& latency_tracing = root["latency_tracing"];
+        if(latency_tracing.getType() == Setting::TypeBoolean)
+            _latency_tracing = latency_tracing;
+        else
+            logPrintf(WARN, "Line %d: latency_tracing must be a boolean.",
+                    latency_tracing.getSourceLine());
+    } catch(const SettingNotFoundException& e) {
+        // Ignore
+    }
+
+    try {
+        auto& lock_profiling = root["lock_profiling"];
+        if(lock_profiling.getType() == Setting::TypeBoolean)
+            _lock_profiling = lock_profiling;
+        else
+            logPrintf(WARN, "Line %d: lock_profiling must be a boolean.",
+                    lock_profiling.getSourceLine());
+    } catch(const SettingNotFoundException& e) {
+        // Ignore
+    }
+
+    // Drops reports other than HID++ and DJ as soon as they are read
+    try {
+        auto& filter_reports = root["filter_reports"];
+        if(filter_reports.getType() == Setting::TypeBoolean)
+            _filter_reports = filter_reports;
+        else
+            logPrintf(WARN, "Line %d: filter_reports must be a boolean.",
+                    filter_reports.getSourceLine());
+    } catch(const SettingNotFoundException& e) {
+        // Ignore
+    }
+
+    // How long a hidraw node must stay added before it is probed
+    try {
+        auto& debounce = root["hotplug_debounce"];
+        milliseconds value(-1);
+        if(debounce.getType() == Setting::TypeFloat)
+            value = duration_cast<milliseconds>(
+                    duration<double, std::milli>(debounce));
+        else if(debounce.isNumber())
+            value = milliseconds((int)debounce);
+
+        if(value.count() >= 0)
+            _hotplug_debounce = value;
+        else
+            logPrintf(WARN, "Line %d: hotplug_debounce must be a "
+                            "non-negative number.", debounce.getSourceLine());
+    } catch(const SettingNotFoundException& e) {
+        // Ignore
+    }
+
+    /* Motion that waited this long while the listener was behind goes
+     * after other events, 0 keeps the order reports were read in */
+    try {
+        auto& max_age = root["motion_max_age"];
+        milliseconds value(-1);
+        if(max_age.getType() == Setting::TypeFloat)
+            value = duration_cast<milliseconds>(
+                    duration<double, std::milli>(max_age));
+        else if(max_age.isNumber())
+            value = milliseconds((int)max_age);
+
+        if(value.count() >= 0)
+            _motion_max_age = value;
+        else
+            logPrintf(WARN, "Line %d: motion_max_age must be a "
+                            "non-negative number.", max_age.getSourceLine());
+    } catch(const SettingNotFoundException& e) {
+        // Ignore
+    }
+
+    /* Milliseconds an event handler may run on the listener before it is
+     * moved to a worker, 0 keeps all of them there */
+    try {
+        auto& budget = root["handler_budget"];
+        microseconds value(-1);
+        if(budget.getType() == Setting::TypeFloat)
+            value = duration_cast<microseconds>(
+                    duration<double, std::milli>(budget));
+        else if(budget.isNumber())
+            value = milliseconds((int)budget);
+
+        if(value.count() >= 0)
+            _handler_budget = value;
+        else
+            logPrintf(WARN, "Line %d: handler_budget must be a "
+                            "non-negative number.", budget.getSourceLine());
+    } catch(const SettingNotFoundException& e) {
+        // Ignore
+    }
+
+    // Shutdown exits regardless once this has passed
+    try {
+        auto& timeout = root["shutdown_timeout"];
+        milliseconds value(-1);
+        if(timeout.getType() == Setting::TypeFloat)
+            value = duration_cast<milliseconds>(
+                    duration<double, std::milli>(timeout));
+        else if(timeout.isNumber())
+            value = milliseconds((int)timeout);
+
+        if(value.count() > 0)
+            _shutdown_timeout = value;
+        else
+            logPrintf(WARN, "Line %d: shutdown_timeout must be a positive "
+                            "number.", timeout.getSourceLine());
+    } catch(const SettingNotFoundException& e) {
+        // Ignore
+    }
+
+    /* Startup probing, e.g.
+     * enumeration: { concurrency: 4; timeout: 5000; };
+     */
+    try {
+        auto& enumeration = root["enumeration"];
+        if(enumeration.isGroup()) {
+            if(enumeration.exists("concurrency")) {
+                auto& concurrency = enumeration["concurrency"];
+                if(concurrency.getType() == Setting::TypeInt &&
+                   (int)concurrency > 0)
+                    _enumeration_concurrency = concurrency;
+                else
+                    logPrintf(WARN, "Line %d: concurrency must be a positive "
+                                    "integer.", concurrency.getSourceLine());
+            }
+            if(enumeration.exists("timeout")) {
+                auto& timeout = enumeration["timeout"];
+                if(timeout.getType() == Setting::TypeFloat)
+                    _enumeration_timeout = duration_cast<milliseconds>(
+                            duration<double, std::milli>(timeout));
+                else if(timeout.isNumber())
+                    _enumeration_timeout = milliseconds((int)timeout);
+                else
+                    logPrintf(WARN, "Line %d: timeout must be a number.",
+                            timeout.getSourceLine());
+            }
+        } else {
+            logPrintf(WARN, "Line %d: enumeration must be a group.",
+                    enumeration.getSourceLine());
+        }
+    } catch(const SettingNotFoundException& e) {
+        // Ignore
+    }
+
+    /* Stalled event dispatch, e.g.
+     * watchdog: { threshold: 250; offload: true; };
+     * A threshold of 0 disables the watchdog.
+     */
+    try {
+        auto& watchdog = root["watchdog"];
+        if(watchdog.isGroup()) {
+            if(watchdog.exists("threshold")) {
+                auto& threshold = watchdog["threshold"];
+                milliseconds value(-1);
+                if(threshold.getType() == Setting::TypeFloat)
+                    value = duration_cast<milliseconds>(
+                            duration<double, std::milli>(threshold));
+                else if(threshold.isNumber())
+                    value = milliseconds((int)threshold);
+
+                if(value.count() >= 0)
+                    _watchdog_threshold = value;
+                else
+                    logPrintf(WARN, "Line %d: threshold must be a "
+                                    "non-negative number.",
+                                    threshold.getSourceLine());
+            }
+            if(watchdog.exists("offload")) {
+                auto& offload = watchdog["offload"];
+                if(offload.getType() == Setting::TypeBoolean)
+                    _watchdog_offload = offload;
+                else
+                    logPrintf(WARN, "Line %d: offload must be a boolean.",
+                            offload.getSourceLine());
+            }
+        } else {
+            logPrintf(WARN, "Line %d: watchdog must be a group.",
+                    watchdog.getSourceLine());
+        }
+    } catch(const SettingNotFoundException& e) {
+        // Ignore
+    }
+
+    /* realtime may either be a boolean or a group, e.g.
+     * realtime: { policy: "fifo"; priority: 10; cpus: [2, 3];
+     *             lock_memory: true; };
+     */
+    try {
+        auto& rt = root["realtime"];
+        if(rt.getType() == Setting::TypeBoolean) {
+            _realtime = rt;
+        } else if(rt.isGroup()) {
+            _realtime = true;
+            if(rt.exists("enabled")) {
+                auto& enabled = rt["enabled"];
+                if(enabled.getType() == Setting::TypeBoolean)
+                    _realtime = enabled;
+                else
+                    logPrintf(WARN, "Line %d: enabled must be a boolean.",
+                            enabled.getSourceLine());
+            }
+            if(rt.exists("policy")) {
+                auto& policy = rt["policy"];
+                if(settingIs(rt, "policy", "fifo"))
+                    _realtime_settings.policy = realtime::FIFO;
+                else if(settingIs(rt, "policy", "rr"))
+                    _realtime_settings.policy = realtime::RoundRobin;
+                else if(settingIs(rt, "policy", "other"))
+                    _realtime_settings.policy = realtime::Other;
+                else
+                    logPrintf(WARN, "Line %d: policy must be \"fifo\", "
+                                    "\"rr\" or \"other\".",
+                                    policy.getSourceLine());
+            }
+            if(rt.exists("priority")) {
+                auto& priority = rt["priority"];
+                if(priority.getType() == Setting::TypeInt)
+                    _realtime_settings.priority = priority;
+                else
+                    logPrintf(WARN, "Line %d: priority must be an integer.",
+                            priority.getSourceLine());
+            }
+            if(rt.exists("cpus")) {
+                auto& cpus = rt["cpus"];
+                if(cpus.getType() == Setting::TypeInt) {
+                    _realtime_settings.cpus.push_back(cpus);
+                } else if(cpus.isArray() || cpus.isList()) {
+                    for(int i = 0; i < cpus.getLength(); i++) {
+                        if(cpus[i].getType() == Setting::TypeInt)
+                            _realtime_settings.cpus.push_back(cpus[i]);
+                        else
+                            logPrintf(WARN, "Line %d: cpus must be "
+                                            "integers.",
+                                            cpus[i].getSourceLine());
+                    }
+                } else {
+                    logPrintf(WARN, "Line %d: cpus must be an integer or an "
+                                    "array.", cpus.getSourceLine());
+                }
+            }
+            if(rt.exists("lock_memory")) {
+                auto& lock_memory = rt["lock_memory"];
+                if(lock_memory.getType() == Setting::TypeBoolean)
+                    _realtime_settings.lock_memory = lock_memory;
+                else
+                    logPrintf(WARN, "Line %d: lock_memory must be a "
+                                    "boolean.", lock_memory.getSourceLine());
+            }
+        } else {
+            logPrintf(WARN, "Line %d: realtime must be a boolean or a group.",
+                    rt.getSourceLine());
+        }
+    } catch(const SettingNotFoundException& e) {
+        // Ignore
+    }
+
+    /* battery_mode may either be a boolean or a group, e.g.
+     * battery_mode: { timer_slack: 5000; tick: 1000; };
+     * with timer_slack in microseconds and tick in milliseconds.
+     */
+    try {
+        auto& battery = root["battery_mode"];
+        if(battery.getType() == Setting::TypeBoolean) {
+            _battery_mode = battery;
+        } else if(battery.isGroup()) {
+            _battery_mode = true;
+            if(battery.exists("enabled")) {
+                auto& enabled = battery["enabled"];
+                if(enabled.getType() == Setting::TypeBoolean)
+                    _battery_mode = enabled;
+                else
+                    logPrintf(WARN, "Line %d: enabled must be a boolean.",
+                            enabled.getSourceLine());
+            }
+            if(battery.exists("timer_slack")) {
+                auto& slack = battery["timer_slack"];
+                if(slack.getType() == Setting::TypeInt && (int)slack >= 0)
+                    _power_settings.timer_slack = microseconds((int)slack);
+                else
+                    logPrintf(WARN, "Line %d: timer_slack must be a "
+                                    "non-negative integer.",
+                                    slack.getSourceLine());
+            }
+            if(battery.exists("tick")) {
+                auto& tick = battery["tick"];
+                if(tick.getType() == Setting::TypeInt && (int)tick >= 0)
+                    _power_settings.tick = milliseconds((int)tick);
+                else
+                    logPrintf(WARN, "Line %d: tick must be a non-negative "
+                                    "integer.", tick.getSourceLine());
+            }
+        } else {
+            logPrintf(WARN, "Line %d: battery_mode must be a boolean or a "
+                            "group.", battery.getSourceLine());
+        }
+    } catch(const SettingNotFoundException& e) {
+        // Ignore
+    }
+
+    auto config_hash = configHash(config_file);
+    bool codes_cached = _readInputCodes(config_hash);
+
     try {
         auto& devices = root["devices"];
 
         for(int i = 0; i < devices.getLength(); i++) {
-            const Setting& device = devices[i];
+            Setting& device = devices[i];
             std::string name;
-            try {
-                if(!device.lookupValue("name", name)) {
-                    logPrintf(WARN, "Line %d: 'name' must be a string, skipping"
-                                    " device.", device["name"].getSourceLine());
+            int pid = -1;
+            int64_t serial = -1;
+            if(device.exists("name") && !device.lookupValue("name", name)) {
+                logPrintf(WARN, "Line %d: 'name' must be a string, skipping"
+                                " device.", device["name"].getSourceLine());
+                continue;
+            }
+            if(device.exists("pid")) {
+                auto& pid_setting = device["pid"];
+                if(pid_setting.getType() != Setting::TypeInt ||
+                   (int)pid_setting < 0 || (int)pid_setting > 0xffff) {
+                    logPrintf(WARN, "Line %d: pid must be a 16-bit integer, "
+                                    "skipping device.",
+                                    pid_setting.getSourceLine());
                     continue;
                 }
-            } catch(SettingNotFoundException &e) {
-                logPrintf(WARN, "Line %d: Missing name field, skipping device."
-                        , device.getSourceLine());
+                pid = pid_setting;
+            }
+            if(device.exists("serial")) {
+                // Hex serials above 0x7fffffff are read as negative ints
+                auto& serial_setting = device["serial"];
+                if(serial_setting.getType() == Setting::TypeInt)
+                    serial = (uint32_t)(int)serial_setting;
+                else if(serial_setting.getType() == Setting::TypeInt64)
+                    serial = (long long)serial_setting;
+                if(serial <= 0 || serial > UINT32_MAX) {
+                    logPrintf(WARN, "Line %d: serial must be a non-zero "
+                                    "32-bit integer, skipping device.",
+                                    serial_setting.getSourceLine());
+                    continue;
+                }
+            }
+            if(name.empty() && pid < 0 && serial < 0) {
+                logPrintf(WARN, "Line %d: Missing name, pid or serial, "
+                                "skipping device.", device.getSourceLine());
                 continue;
             }
-            _device_paths.insert({name, device.getPath()});
+            // Earlier entries win, as they always have for names
+            if((name.empty() || _devices.count(name)) &&
+               (pid < 0 || _devices_by_pid.count(pid)) &&
+               (serial < 0 || _devices_by_serial.count(serial)))
+                continue;
+
+            /* Index the device's settings once here so that devices do
+             * not walk the tree by path every time they start. */
+            auto settings = std::make_shared<DeviceSettings>();
+            settings->document = _config;
+            for(int j = 0; j < device.getLength(); j++) {
+                Setting& setting = device[j];
+                if(setting.getName() &&
+                   std::string(setting.getName()) != "profiles")
+                    settings->settings.emplace(setting.getName(), &setting);
+            }
+            if(device.exists("profiles"))
+                loadProfiles(device["profiles"], *settings);
+            if(!name.empty())
+                _devices.emplace(name, settings);
+            if(pid >= 0)
+                _devices_by_pid.emplace(pid, settings);
+            if(serial >= 0)
+                _devices_by_serial.emplace(serial, settings);
+
+            if(!codes_cached)
+                collectInputCodes(device, _input_keys, _input_axes);
         }
     }
     catch(const SettingNotFoundException &e) {
         logPrintf(WARN, "No devices listed in config file.");
     }
 
+    if(!codes_cached)
+        _writeInputCodes(config_hash);
+
     try {
         auto& ignore = root.lookup("ignore");
         if(ignore.getType() == libconfig::Setting::TypeInt) {
@@ -136,43 +903,419 @@ Configuration::Configuration(const std::string& config_file)
             // Ignore
         }
     }
+
+    // Receivers the built-in table does not know yet, e.g. new Bolt PIDs
+    try {
+        auto& receivers = root.lookup("receivers");
+        if(receivers.getType() == Setting::TypeInt) {
+            _receivers.insert((int)receivers);
+        } else if(receivers.isList() || receivers.isArray()) {
+            for(int i = 0; i < receivers.getLength(); i++) {
+                if(receivers[i].getType() == Setting::TypeInt)
+                    _receivers.insert((int)receivers[i]);
+                else
+                    logPrintf(WARN, "Line %d: receivers must refer to "
+                                    "receiver PIDs",
+                                    receivers[i].getSourceLine());
+            }
+        } else {
+            logPrintf(WARN, "Line %d: receivers must be an integer or an "
+                            "array.", receivers.getSourceLine());
+        }
+    } catch(const SettingNotFoundException& e) {
+        // Ignore
+    }
+}
+
+std::string Configuration::_inputCodesPath() const
+{
+    return _feature_cache + "/input_codes";
+}
+
+/* One line with the logid version and config hash, then the key codes
+ * and the axis codes on a line each. */
+bool Configuration::_readInputCodes(const std::string& config_hash)
+{
+    if(_feature_cache.empty() || config_hash.empty())
+        return false;
+
+    std::ifstream file(_inputCodesPath());
+    std::string version, hash;
+    if(!(file >> version >> hash) || version != LOGIOPS_VERSION ||
+            hash != config_hash)
+        return false;
+
+    std::set<uint> keys, axes;
+    std::string line;
+    std::getline(file, line);
+    for(auto codes : {&keys, &axes}) {
+        if(!std::getline(file, line))
+            return false;
+        std::istringstream fields(line);
+        uint code;
+        while(fields >> code)
+            codes->insert(code);
+    }
+
+    _input_keys = std::move(keys);
+    _input_axes = std::move(axes);
+    return true;
+}
+
+void Configuration::_writeInputCodes(const std::string& config_hash) const
+{
+    if(_feature_cache.empty() || config_hash.empty())
+        return;
+
+    auto path = _inputCodesPath();
+    auto tmp_path = path + ".tmp";
+    {
+        std::ofstream file(tmp_path);
+        if(!file) {
+            LOGID_LOG(DEBUG, "Could not write %s", tmp_path.c_str());
+            return;
+        }
+        file << LOGIOPS_VERSION << " " << config_hash << "\n";
+        for(auto codes : {&_input_keys, &_input_axes}) {
+            for(auto code : *codes)
+                file << code << " ";
+            file << "\n";
+        }
+    }
+    if(-1 == std::rename(tmp_path.c_str(), path.c_str()))
+        std::remove(tmp_path.c_str());
 }
 
-libconfig::Setting& Configuration::getSetting(const std::string& path)
+std::shared_ptr<const Configuration::DeviceSettings> Configuration::getDevice(
+        const std::string& name) const
 {
-    return _config.lookup(path);
+    std::lock_guard<std::mutex> lock(_devices_lock);
+    auto it = _devices.find(name);
+    if(it == _devices.end())
+        return nullptr;
+    return it->second;
 }
 
-std::string Configuration::getDevice(const std::string& name)
+std::shared_ptr<const Configuration::DeviceSettings> Configuration::getDevice(
+        uint16_t pid, const std::function<uint32_t()>& serial,
+        const std::function<std::string()>& name) const
 {
-    auto it = _device_paths.find(name);
-    if(it == _device_paths.end())
-        throw DeviceNotFound(name);
-    else
-        return it->second;
+    bool by_serial, by_name;
+    {
+        std::lock_guard<std::mutex> lock(_devices_lock);
+        auto it = _devices_by_pid.find(pid);
+        if(it != _devices_by_pid.end() && _devices_by_serial.empty())
+            return it->second;
+        by_serial = !_devices_by_serial.empty();
+        by_name = !_devices.empty();
+    }
+
+    // Asking for the serial or name may take a round trip, not held locked
+    if(by_serial) {
+        auto unit = serial();
+        std::lock_guard<std::mutex> lock(_devices_lock);
+        auto it = _devices_by_serial.find(unit);
+        if(unit && it != _devices_by_serial.end())
+            return it->second;
+        auto pid_it = _devices_by_pid.find(pid);
+        if(pid_it != _devices_by_pid.end())
+            return pid_it->second;
+    }
+
+    return by_name ? getDevice(name()) : nullptr;
 }
 
 bool Configuration::isIgnored(uint16_t pid) const
 {
+    std::lock_guard<std::mutex> lock(_devices_lock);
     return _ignore_list.find(pid) != _ignore_list.end();
 }
 
-Configuration::DeviceNotFound::DeviceNotFound(std::string name) :
-    _name (std::move(name))
+bool Configuration::isReceiver(uint16_t pid) const
 {
+    return _receivers.find(pid) != _receivers.end();
 }
 
-const char * Configuration::DeviceNotFound::what() const noexcept
+void Configuration::reloadDevices(const Configuration& config)
 {
-    return _name.c_str();
+    std::unique_lock<std::mutex> lock(_devices_lock, std::defer_lock);
+    std::unique_lock<std::mutex> config_lock(config._devices_lock,
+            std::defer_lock);
+    std::lock(lock, config_lock);
+    _devices = config._devices;
+    _devices_by_pid = config._devices_by_pid;
+    _devices_by_serial = config._devices_by_serial;
+    _ignore_list = config._ignore_list;
+    _input_keys = config._input_keys;
+    _input_axes = config._input_axes;
+}
+
+std::set<uint> Configuration::inputKeys() const
+{
+    std::lock_guard<std::mutex> lock(_devices_lock);
+    return _input_keys;
+}
+
+std::set<uint> Configuration::inputAxes() const
+{
+    std::lock_guard<std::mutex> lock(_devices_lock);
+    return _input_axes;
+}
+
+bool Configuration::equal(const Setting* a, const Setting* b)
+{
+    // Profiles share the settings they do not override
+    if(!a || !b || a == b)
+        return a == b;
+
+    if(a->getType() != b->getType())
+        return false;
+
+    switch(a->getType()) {
+    case Setting::TypeInt:
+        return (int)*a == (int)*b;
+    case Setting::TypeInt64:
+        return (long long)*a == (long long)*b;
+    case Setting::TypeFloat:
+        return (double)*a == (double)*b;
+    case Setting::TypeBoolean:
+        return (bool)*a == (bool)*b;
+    case Setting::TypeString:
+        return std::string((const char*)*a) == (const char*)*b;
+    case Setting::TypeGroup:
+    case Setting::TypeArray:
+    case Setting::TypeList:
+        if(a->getLength() != b->getLength())
+            return false;
+        for(int i = 0; i < a->getLength(); i++) {
+            const Setting& child_a = (*a)[i];
+            const Setting& child_b = (*b)[i];
+            auto name_a = child_a.getName(), name_b = child_b.getName();
+            if((name_a || name_b) && (!name_a || !name_b ||
+                    std::string(name_a) != name_b))
+                return false;
+            if(!equal(&child_a, &child_b))
+                return false;
+        }
+        return true;
+    default:
+        return true;
+    }
+}
+
+std::size_t Configuration::hash(const Setting* setting)
+{
+    if(!setting)
+        return 0;
+
+    auto combine = [](std::size_t seed, std::size_t value) {
+        return seed ^ (value + 0x9e3779b9 + (seed << 6) + (seed >> 2));
+    };
+
+    std::size_t h = std::hash<int>()(setting->getType());
+    switch(setting->getType()) {
+    case Setting::TypeInt:
+        return combine(h, std::hash<int>()(*setting));
+    case Setting::TypeInt64:
+        return combine(h, std::hash<long long>()(*setting));
+    case Setting::TypeFloat:
+        return combine(h, std::hash<double>()(*setting));
+    case Setting::TypeBoolean:
+        return combine(h, std::hash<bool>()(*setting));
+    case Setting::TypeString:
+        return combine(h, std::hash<std::string>()(
+                (const char*)*setting));
+    case Setting::TypeGroup:
+    case Setting::TypeArray:
+    case Setting::TypeList:
+        for(int i = 0; i < setting->getLength(); i++) {
+            const Setting& child = (*setting)[i];
+            if(child.getName())
+                h = combine(h, std::hash<std::string>()(child.getName()));
+            h = combine(h, hash(&child));
+        }
+        return h;
+    default:
+        return h;
+    }
 }
 
 int Configuration::workerCount() const
 {
-    return _worker_threads;
+    return _worker_scaling.max;
+}
+
+const workqueue::scaling& Configuration::workerScaling() const
+{
+    return _worker_scaling;
 }
 
 std::chrono::milliseconds Configuration::ioTimeout() const
 {
     return _io_timeout;
 }
+
+const backoff::settings& Configuration::retrySettings() const
+{
+    return _retry;
+}
+
+int Configuration::requestWindow() const
+{
+    return _request_window;
+}
+
+int Configuration::slotWindow() const
+{
+    return _slot_window;
+}
+
+bool Configuration::reactorEnabled() const
+{
+    return _reactor;
+}
+
+int Configuration::reactorEvents() const
+{
+    return _reactor_events;
+}
+
+int Configuration::reactorShards() const
+{
+    return _reactor_shards;
+}
+
+const std::vector<int>& Configuration::reactorCpus() const
+{
+    return _reactor_cpus;
+}
+
+bool Configuration::reactorUring() const
+{
+    return _reactor_uring;
+}
+
+void Configuration::setFeatureCache(const std::string& path)
+{
+    _feature_cache = path;
+}
+
+const std::string& Configuration::featureCache() const
+{
+    return _feature_cache;
+}
+
+const std::string& Configuration::modelDatabase() const
+{
+    return _model_database;
+}
+
+const std::string& Configuration::snapshot() const
+{
+    return _snapshot;
+}
+
+const std::string& Configuration::controlSocket() const
+{
+    return _control_socket;
+}
+
+int Configuration::controlSocketMode() const
+{
+    return _control_socket_mode;
+}
+
+const std::string& Configuration::controlSocketGroup() const
+{
+    return _control_socket_group;
+}
+
+const std::string& Configuration::traceDir() const
+{
+    return _trace_dir;
+}
+
+const std::string& Configuration::statusPage() const
+{
+    return _status_page;
+}
+
+const std::string& Configuration::metricsFile() const
+{
+    return _metrics_file;
+}
+
+bool Configuration::latencyTracing() const
+{
+    return _latency_tracing;
+}
+
+bool Configuration::lockProfiling() const
+{
+    return _lock_profiling;
+}
+
+bool Configuration::filterReports() const
+{
+    return _filter_reports;
+}
+
+std::chrono::milliseconds Configuration::hotplugDebounce() const
+{
+    return _hotplug_debounce;
+}
+
+std::chrono::milliseconds Configuration::motionMaxAge() const
+{
+    return _motion_max_age;
+}
+
+std::chrono::microseconds Configuration::handlerBudget() const
+{
+    return _handler_budget;
+}
+
+int Configuration::enumerationConcurrency() const
+{
+    return _enumeration_concurrency;
+}
+
+std::chrono::milliseconds Configuration::enumerationTimeout() const
+{
+    return _enumeration_timeout;
+}
+
+std::chrono::milliseconds Configuration::shutdownTimeout() const
+{
+    return _shutdown_timeout;
+}
+
+std::chrono::milliseconds Configuration::watchdogThreshold() const
+{
+    return _watchdog_threshold;
+}
+
+bool Configuration::watchdogOffload() const
+{
+    return _watchdog_offload;
+}
+
+bool Configuration::realtimeEnabled() const
+{
+    return _realtime;
+}
+
+const realtime::settings& Configuration::realtimeSettings() const
+{
+    return _realtime_settings;
+}
+
+bool Configuration::batteryMode() const
+{
+    return _battery_mode;
+}
+
+const power::settings& Configuration::powerSettings() const
+{
+    return _power_settings;
+}
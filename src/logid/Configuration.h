@@ -23,10 +23,42 @@
 #include <libconfig.h++>
 #include <memory>
 #include <chrono>
+#include <functional>
 #include <set>
+#include <mutex>
+#include <unordered_map>
+#include "util/power.h"
+#include "util/realtime.h"
+#include "util/watchdog.h"
+#include "util/backoff.h"
+#include "util/workqueue.h"
 
 #define LOGID_DEFAULT_IO_TIMEOUT std::chrono::seconds(2)
+// Requests in flight per hidraw node before the rest wait by priority
+#define LOGID_DEFAULT_REQUEST_WINDOW 8
+/* Of those, what one device index of the node may hold while others have
+ * requests waiting or in flight, e.g. a receiver slot */
+#define LOGID_DEFAULT_SLOT_WINDOW 3
 #define LOGID_DEFAULT_WORKER_COUNT 4
+#define LOGID_DEFAULT_REACTOR_EVENTS 16
+#define LOGID_DEFAULT_FEATURE_CACHE "/var/cache/logid"
+// Set by the build to where models/ is installed
+#ifndef LOGID_DEFAULT_MODEL_DATABASE
+#define LOGID_DEFAULT_MODEL_DATABASE "/usr/share/logid/models"
+#endif
+// Under /run so that it does not outlive the hidraw numbering of this boot
+#define LOGID_DEFAULT_SNAPSHOT "/run/logid.snapshot"
+#define LOGID_DEFAULT_TRACE_DIR "/var/log/logid"
+// Anyone may read the control socket, see ControlSocket for writes
+#define LOGID_DEFAULT_CONTROL_SOCKET_MODE 0666
+#define LOGID_DEFAULT_HOTPLUG_DEBOUNCE std::chrono::milliseconds(100)
+#define LOGID_DEFAULT_ENUMERATION_CONCURRENCY 4
+#define LOGID_DEFAULT_ENUMERATION_TIMEOUT std::chrono::seconds(5)
+#define LOGID_DEFAULT_SHUTDOWN_TIMEOUT std::chrono::seconds(1)
+// Motion events waiting longer than this are dropped under backlog
+#define LOGID_DEFAULT_MOTION_MAX_AGE std::chrono::milliseconds(50)
+// Event handlers taking longer are run off the listener from then on
+#define LOGID_DEFAULT_HANDLER_BUDGET std::chrono::microseconds(5000)
 
 namespace logid
 {
@@ -35,27 +67,157 @@ namespace logid
     public:
         explicit Configuration(const std::string& config_file);
         Configuration() = default;
-        libconfig::Setting& getSetting(const std::string& path);
-        std::string getDevice(const std::string& name);
-        bool isIgnored(uint16_t pid) const;
 
-        class DeviceNotFound : public std::exception
+        /* The top-level settings of a device, indexed by name and by the
+         * pid and serial it may give instead of or next to the name */
+        struct DeviceSettings
         {
-        public:
-            explicit DeviceNotFound(std::string name);
-            const char* what() const noexcept override;
-        private:
-            std::string _name;
+            // Keeps the settings alive after the config is reloaded
+            std::shared_ptr<libconfig::Config> document;
+            std::map<std::string, libconfig::Setting*> settings;
+            /* The device's settings with those of each of its profiles
+             * laid over them, built once when the config is read so that
+             * switching profiles only compares settings. */
+            std::map<std::string, std::shared_ptr<const DeviceSettings>>
+                profiles;
         };
 
+        // Null if the device is not configured
+        std::shared_ptr<const DeviceSettings> getDevice(
+                const std::string& name) const;
+        /* Matches by serial, then PID, then name. serial and name are only
+         * called if no entry before them matched and entries of their kind
+         * exist, so a device matched by PID skips asking for the others. */
+        std::shared_ptr<const DeviceSettings> getDevice(uint16_t pid,
+                const std::function<uint32_t()>& serial,
+                const std::function<std::string()>& name) const;
+        bool isIgnored(uint16_t pid) const;
+        // PIDs listed under receivers, on top of the known ones
+        bool isReceiver(uint16_t pid) const;
+
+        // Key and axis codes the configured actions can send
+        std::set<uint> inputKeys() const;
+        std::set<uint> inputAxes() const;
+
+        /* Takes the device settings, ignore list and input codes of a
+         * newly read config. Other options only take effect on restart. */
+        void reloadDevices(const Configuration& config);
+
+        // Compares two settings by value, either may be null
+        static bool equal(const libconfig::Setting* a,
+                const libconfig::Setting* b);
+        // Settings that are equal() hash the same, null hashes to 0
+        static std::size_t hash(const libconfig::Setting* setting);
+
         std::chrono::milliseconds ioTimeout() const;
+        const backoff::settings& retrySettings() const;
+        // 0 if requests are never held back
+        int requestWindow() const;
+        // 0 if a device index may take the whole request window
+        int slotWindow() const;
+        // The most workers that may run
         int workerCount() const;
+        const workqueue::scaling& workerScaling() const;
+        bool reactorEnabled() const;
+        int reactorEvents() const;
+        int reactorShards() const;
+        const std::vector<int>& reactorCpus() const;
+        // Reactors read and write with io_uring where the kernel allows
+        bool reactorUring() const;
+        const std::string& featureCache() const;
+        // Lets --plan keep the configured cache untouched
+        void setFeatureCache(const std::string& path);
+        /* Read-only feature tables and capabilities of known models, in
+         * the format of the feature cache. Empty if disabled. */
+        const std::string& modelDatabase() const;
+        const std::string& snapshot() const;
+        const std::string& controlSocket() const;
+        int controlSocketMode() const;
+        // Its members may send write commands, empty if only root may
+        const std::string& controlSocketGroup() const;
+        // Where control socket clients may start timelines, empty if never
+        const std::string& traceDir() const;
+        const std::string& statusPage() const;
+        const std::string& metricsFile() const;
+        bool latencyTracing() const;
+        bool lockProfiling() const;
+        bool filterReports() const;
+        std::chrono::milliseconds hotplugDebounce() const;
+        // 0 if stale motion is never put behind other events
+        std::chrono::milliseconds motionMaxAge() const;
+        // 0 if event handlers always run on the listener
+        std::chrono::microseconds handlerBudget() const;
+        int enumerationConcurrency() const;
+        std::chrono::milliseconds enumerationTimeout() const;
+        std::chrono::milliseconds shutdownTimeout() const;
+        // 0 if the watchdog is disabled
+        std::chrono::milliseconds watchdogThreshold() const;
+        bool watchdogOffload() const;
+        bool realtimeEnabled() const;
+        const realtime::settings& realtimeSettings() const;
+        bool batteryMode() const;
+        const power::settings& powerSettings() const;
     private:
-        std::map<std::string, std::string> _device_paths;
+        /* The key and axis codes found in a config are kept in the feature
+         * cache directory, keyed by logid version and config hash, so that
+         * an unchanged config skips walking every action for them. */
+        std::string _inputCodesPath() const;
+        bool _readInputCodes(const std::string& config_hash);
+        void _writeInputCodes(const std::string& config_hash) const;
+
+        std::map<std::string, std::shared_ptr<const DeviceSettings>> _devices;
+        std::unordered_map<uint16_t, std::shared_ptr<const DeviceSettings>>
+            _devices_by_pid;
+        std::unordered_map<uint32_t, std::shared_ptr<const DeviceSettings>>
+            _devices_by_serial;
         std::set<uint16_t> _ignore_list;
+        std::set<uint16_t> _receivers;
+        std::set<uint> _input_keys;
+        std::set<uint> _input_axes;
         std::chrono::milliseconds _io_timeout = LOGID_DEFAULT_IO_TIMEOUT;
-        int _worker_threads = LOGID_DEFAULT_WORKER_COUNT;
-        libconfig::Config _config;
+        backoff::settings _retry;
+        int _request_window = LOGID_DEFAULT_REQUEST_WINDOW;
+        int _slot_window = LOGID_DEFAULT_SLOT_WINDOW;
+        workqueue::scaling _worker_scaling = workqueue::scaling{
+                LOGID_DEFAULT_WORKER_COUNT, LOGID_DEFAULT_WORKER_COUNT};
+        bool _reactor = false;
+        int _reactor_events = LOGID_DEFAULT_REACTOR_EVENTS;
+        int _reactor_shards = 1;
+        std::vector<int> _reactor_cpus;
+        bool _reactor_uring = false;
+        std::string _feature_cache = LOGID_DEFAULT_FEATURE_CACHE;
+        std::string _model_database = LOGID_DEFAULT_MODEL_DATABASE;
+        std::string _snapshot = LOGID_DEFAULT_SNAPSHOT;
+        std::string _control_socket;
+        int _control_socket_mode = LOGID_DEFAULT_CONTROL_SOCKET_MODE;
+        std::string _control_socket_group;
+        std::string _trace_dir = LOGID_DEFAULT_TRACE_DIR;
+        std::string _status_page;
+        std::string _metrics_file;
+        bool _latency_tracing = false;
+        bool _lock_profiling = false;
+        bool _filter_reports = false;
+        std::chrono::milliseconds _hotplug_debounce =
+                LOGID_DEFAULT_HOTPLUG_DEBOUNCE;
+        std::chrono::milliseconds _motion_max_age =
+                LOGID_DEFAULT_MOTION_MAX_AGE;
+        std::chrono::microseconds _handler_budget =
+                LOGID_DEFAULT_HANDLER_BUDGET;
+        int _enumeration_concurrency = LOGID_DEFAULT_ENUMERATION_CONCURRENCY;
+        std::chrono::milliseconds _enumeration_timeout =
+                LOGID_DEFAULT_ENUMERATION_TIMEOUT;
+        std::chrono::milliseconds _shutdown_timeout =
+                LOGID_DEFAULT_SHUTDOWN_TIMEOUT;
+        std::chrono::milliseconds _watchdog_threshold =
+                LOGID_DEFAULT_WATCHDOG_THRESHOLD;
+        bool _watchdog_offload = false;
+        bool _realtime = false;
+        realtime::settings _realtime_settings;
+        bool _battery_mode = false;
+        power::settings _power_settings;
+        std::shared_ptr<libconfig::Config> _config =
+                std::make_shared<libconfig::Config>();
+        mutable std::mutex _devices_lock;
     };
 
     extern std::shared_ptr<Configuration> global_config;
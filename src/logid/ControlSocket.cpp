@@ -0,0 +1,613 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <system_error>
+#include "ControlSocket.h"
+#include "Device.h"
+#include "DeviceManager.h"
+#include "backend/hidpp/Report.h"
+#include "backend/raw/RawDevice.h"
+#include "features/Battery.h"
+#include "features/DPI.h"
+#include "features/HiresScroll.h"
+#include "features/ReportRate.h"
+#include "features/Lighting.h"
+#include "features/SmartShift.h"
+#include "util/log.h"
+#include "util/metrics.h"
+#include "util/task.h"
+#include "util/timeline.h"
+
+extern "C"
+{
+#include <fcntl.h>
+#include <grp.h>
+#include <poll.h>
+#include <pwd.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+}
+
+using namespace logid;
+using namespace logid::backend;
+
+ControlSocket::ControlSocket(const std::string& path) : _path (path),
+    _group (-1)
+{
+    auto& group_name = global_config->controlSocketGroup();
+    if(!group_name.empty()) {
+        group group_entry{}, *found = nullptr;
+        std::vector<char> buffer(4096);
+        int err = ::getgrnam_r(group_name.c_str(), &group_entry,
+                buffer.data(), buffer.size(), &found);
+        if(!found)
+            throw std::system_error(err ? err : ENOENT,
+                    std::system_category(), "control socket group " +
+                    group_name + " not found");
+        _group = found->gr_gid;
+    }
+
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if(_path.size() >= sizeof(address.sun_path))
+        throw std::system_error(ENAMETOOLONG, std::system_category(),
+                "control socket path too long");
+    std::strcpy(address.sun_path, _path.c_str());
+
+    _fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if(_fd == -1)
+        throw std::system_error(errno, std::system_category(),
+                "control socket creation failed");
+
+    /* A socket left behind by a previous instance would fail the bind.
+     * Nobody can connect before listen, so the mode is set in between. */
+    ::unlink(_path.c_str());
+    if(-1 == ::bind(_fd, (sockaddr*)&address, sizeof(address)) ||
+       -1 == ::chmod(_path.c_str(), global_config->controlSocketMode()) ||
+       (_group != (gid_t)-1 && -1 == ::chown(_path.c_str(), -1, _group)) ||
+       -1 == ::listen(_fd, LOGID_CONTROL_MAX_CLIENTS)) {
+        int err = errno;
+        ::close(_fd);
+        ::unlink(_path.c_str());
+        throw std::system_error(err, std::system_category(),
+                "control socket bind failed");
+    }
+
+    if(-1 == ::pipe2(_pipe, O_CLOEXEC)) {
+        int err = errno;
+        ::close(_fd);
+        ::unlink(_path.c_str());
+        throw std::system_error(err, std::system_category(),
+                "control socket pipe open failed");
+    }
+
+    _thread = std::make_unique<thread>([this]() { _run(); },
+            [](std::exception& e) {
+        logPrintf(WARN, "Control socket stopped: %s", e.what());
+    });
+    _thread->run();
+}
+
+ControlSocket::~ControlSocket()
+{
+    char c = 0;
+    if(-1 == ::write(_pipe[1], &c, sizeof(c)))
+        logPrintf(ERROR, "Failed to stop the control socket: %s",
+                strerror(errno));
+    _thread->wait();
+
+    for(auto& client : _clients)
+        _close(*client.output);
+    ::close(_fd);
+    ::close(_pipe[0]);
+    ::close(_pipe[1]);
+    ::unlink(_path.c_str());
+}
+
+void ControlSocket::_run()
+{
+    thread::setName("control");
+    std::vector<pollfd> fds;
+    while(true) {
+        fds.clear();
+        fds.push_back({_pipe[0], POLLIN, 0});
+        fds.push_back({_fd, POLLIN, 0});
+        for(auto& client : _clients)
+            fds.push_back({client.output->fd, POLLIN, 0});
+
+        if(-1 == ::poll(fds.data(), fds.size(), -1)) {
+            if(errno == EINTR)
+                continue;
+            throw std::system_error(errno, std::system_category(),
+                    "control socket poll failed");
+        }
+
+        if(fds[0].revents)
+            return;
+
+        // Clients accepted below are polled from the next round on
+        for(std::size_t i = fds.size() - 1; i >= 2; i--) {
+            auto& client = _clients[i - 2];
+            if(fds[i].revents && !_read(client)) {
+                _close(*client.output);
+                _clients.erase(_clients.begin() + (i - 2));
+            }
+        }
+
+        if(fds[1].revents & POLLIN) {
+            int fd = ::accept4(_fd, nullptr, nullptr,
+                    SOCK_CLOEXEC | SOCK_NONBLOCK);
+            if(fd != -1) {
+                if(_clients.size() < LOGID_CONTROL_MAX_CLIENTS)
+                    _clients.push_back({std::make_shared<Output>(fd),
+                            std::string(), _mayWrite(fd)});
+                else
+                    ::close(fd);
+            }
+        }
+    }
+}
+
+bool ControlSocket::_mayWrite(int fd) const
+{
+    ucred peer{};
+    socklen_t length = sizeof(peer);
+    if(-1 == ::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &length))
+        return false;
+    if(peer.uid == 0 || peer.uid == ::geteuid())
+        return true;
+    if(_group == (gid_t)-1)
+        return false;
+    if(peer.gid == _group)
+        return true;
+
+    // Supplementary groups are not part of the credentials
+    passwd user{}, *found = nullptr;
+    std::vector<char> buffer(4096);
+    if(::getpwuid_r(peer.uid, &user, buffer.data(), buffer.size(), &found) ||
+       !found)
+        return false;
+    std::vector<gid_t> groups(64);
+    int count = groups.size();
+    if(-1 == ::getgrouplist(found->pw_name, found->pw_gid, groups.data(),
+            &count)) {
+        groups.resize(count);
+        if(-1 == ::getgrouplist(found->pw_name, found->pw_gid, groups.data(),
+                &count))
+            return false;
+    }
+    groups.resize(count);
+    return std::find(groups.begin(), groups.end(), _group) != groups.end();
+}
+
+bool ControlSocket::_read(Client& client)
+{
+    char buffer[LOGID_CONTROL_MAX_LINE];
+    ssize_t length = ::recv(client.output->fd, buffer, sizeof(buffer), 0);
+    if(length == -1)
+        return errno == EAGAIN || errno == EINTR;
+    if(length == 0)
+        return false;
+
+    client.buffer.append(buffer, length);
+    std::size_t end;
+    while((end = client.buffer.find('\n')) != std::string::npos) {
+        auto response = _command(client.buffer.substr(0, end), client);
+        client.buffer.erase(0, end + 1);
+        if(!response.empty() && !_send(*client.output, response + "\n"))
+            return false;
+    }
+
+    return client.buffer.size() < LOGID_CONTROL_MAX_LINE;
+}
+
+bool ControlSocket::_send(Output& output, const std::string& response)
+{
+    std::lock_guard<std::mutex> lock(output.lock);
+    if(output.fd == -1)
+        return false;
+    /* Responses are tiny next to the socket buffer, a client that lets
+     * it fill up is not reading them. */
+    ssize_t sent = ::send(output.fd, response.data(), response.size(),
+            MSG_NOSIGNAL | MSG_DONTWAIT);
+    return sent == (ssize_t)response.size();
+}
+
+void ControlSocket::_close(Output& output)
+{
+    std::lock_guard<std::mutex> lock(output.lock);
+    ::close(output.fd);
+    output.fd = -1;
+}
+
+std::string ControlSocket::_command(const std::string& line, Client& client)
+{
+    std::istringstream stream(line);
+    std::vector<std::string> args;
+    std::string arg;
+    while(stream >> arg)
+        args.push_back(arg);
+
+    if(args.empty())
+        return "error empty request\n";
+
+    if(args[0] == "list")
+        return _list();
+    if(args[0] == "metrics")
+        return metrics::prometheus();
+
+    if((args[0] == "set" || args[0] == "profile" || args[0] == "trace" ||
+        args[0] == "hidpp") && !client.writer)
+        return "error permission denied\n";
+    if(args[0] == "trace" && args.size() >= 2)
+        return _trace(args);
+    if(args[0] == "profile" && args.size() >= 2)
+        return _profile(args);
+    if(args[0] == "hidpp" && args.size() >= 3)
+        return _hidpp(args, client.output);
+
+    if((args[0] == "get" || args[0] == "set") && args.size() >= 2) {
+        auto device = _find(args[1]);
+        if(!device)
+            return "error no such device\n";
+        if(args[0] == "get")
+            return _get(*device);
+        return _set(device, args);
+    }
+
+    return "error invalid request\n";
+}
+
+std::string ControlSocket::_hidpp(const std::vector<std::string>& args,
+        const std::shared_ptr<Output>& output)
+{
+    auto raw_device = device_manager ? device_manager->rawDevice(args[1]) :
+            nullptr;
+    if(!raw_device)
+        return "error no such device\n";
+
+    // The report may be split over several arguments
+    std::string hex;
+    for(std::size_t i = 2; i < args.size(); i++)
+        hex += args[i];
+    std::vector<uint8_t> report;
+    for(std::size_t i = 0; i + 1 < hex.size(); i += 2) {
+        char* end = nullptr;
+        auto byte = hex.substr(i, 2);
+        report.push_back(std::strtoul(byte.c_str(), &end, 16));
+        if(*end)
+            return "error invalid report\n";
+    }
+    if(hex.size() % 2 ||
+       !((report.size() == hidpp::Offset::Parameters +
+          hidpp::ShortParamLength && report[0] == hidpp::ReportType::Short) ||
+         (report.size() == hidpp::Offset::Parameters +
+          hidpp::LongParamLength && report[0] == hidpp::ReportType::Long)))
+        return "error invalid report\n";
+
+    /* HID++ 1.0 sub IDs for register access start at 0x80, below that is
+     * a 2.0 feature index whose function byte holds the software ID. Only
+     * devices logid manages can hand one out, a client's own ID could
+     * collide with one logid is using, e.g. while it probes the device. */
+    uint8_t sw_id = 0;
+    bool remapped = false;
+    if(report[hidpp::Offset::Feature] < 0x80) {
+        for(auto& device : device_manager->devices()) {
+            if(device->path() == args[1] &&
+               device->index() == report[hidpp::Offset::DeviceIndex]) {
+                sw_id = report[hidpp::Offset::Function] & 0x0f;
+                report[hidpp::Offset::Function] = (report[
+                        hidpp::Offset::Function] & 0xf0) |
+                        device->hidpp20().nextSoftwareId();
+                remapped = true;
+                break;
+            }
+        }
+        if(!remapped)
+            return "error device not managed\n";
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(output->lock);
+        if(output->in_flight >= LOGID_CONTROL_MAX_HIDPP)
+            return "error too many requests\n";
+        output->in_flight++;
+    }
+    auto done = [output]() {
+        std::lock_guard<std::mutex> lock(output->lock);
+        output->in_flight--;
+    };
+
+    try {
+        raw_device->sendReportAsync(report,
+                [output, done, sw_id, remapped](
+                        const std::vector<uint8_t>& response) {
+            done();
+            auto restored = response;
+            // Errors carry the function byte one further
+            auto function = restored[hidpp::Offset::Feature] == 0xff ?
+                    hidpp::Offset::Parameters : hidpp::Offset::Function;
+            if(remapped && restored.size() > function)
+                restored[function] = (restored[function] & 0xf0) | sw_id;
+            std::string text;
+            char byte[3];
+            for(auto b : restored) {
+                snprintf(byte, sizeof(byte), "%02x", b);
+                text += byte;
+            }
+            _send(*output, text + "\n\n");
+        }, [output, done](std::exception& e) {
+            done();
+            _send(*output, std::string("error ") + e.what() + "\n\n");
+        });
+    } catch(std::exception& e) {
+        done();
+        return std::string("error ") + e.what() + "\n";
+    }
+    return "";
+}
+
+std::string ControlSocket::_trace(const std::vector<std::string>& args)
+{
+    if(args[1] == "stop") {
+        timeline::stop();
+        return "ok\n";
+    }
+    // Clients never choose the path, logid writes it as root
+    if(args[1] != "start" || args.size() > 2)
+        return "error invalid request\n";
+    if(global_config->traceDir().empty())
+        return "error tracing disabled\n";
+
+    std::string path;
+    try {
+        path = timeline::startIn(global_config->traceDir());
+    } catch(std::system_error& e) {
+        return std::string("error ") + e.what() + "\n";
+    }
+    return "file=" + path + "\n";
+}
+
+std::string ControlSocket::_profile(const std::vector<std::string>& args)
+{
+    std::string profile = args[1] == "default" ? "" : args[1];
+    std::vector<std::shared_ptr<Device>> devices;
+    if(args.size() > 2) {
+        auto device = _find(args[2]);
+        if(!device)
+            return "error no such device\n";
+        if(DeviceConfig(global_config, device.get(), profile).profile() !=
+           profile)
+            return "error no such profile\n";
+        devices.push_back(device);
+    } else if(device_manager) {
+        devices = device_manager->devices();
+    }
+
+    // Devices switch in parallel, each reloads only what differs
+    for(auto& device : devices) {
+        task::spawn(task::Interactive, [device, profile]() {
+            if(!device->setProfile(profile))
+                device->setProfile("");
+        },
+                [path=device->path(), index=device->index()](
+                        std::exception& e) {
+            logPrintf(WARN, "%s:%d: Profile switch failed: %s",
+                    path.c_str(), index, e.what());
+        });
+    }
+    return "ok\n";
+}
+
+std::string ControlSocket::_list()
+{
+    std::string response;
+    if(!device_manager)
+        return response;
+    for(auto& device : device_manager->devices())
+        response += device->path() + ":" + std::to_string(device->index()) +
+                " " + device->name() + "\n";
+    return response;
+}
+
+std::string ControlSocket::_get(Device& device)
+{
+    std::ostringstream response;
+    char pid[5];
+    snprintf(pid, sizeof(pid), "%04x", device.pid());
+    response << "name=" << device.name() << "\n";
+    response << "pid=" << pid << "\n";
+    response << "awake=" << (device.awake() ? "true" : "false") << "\n";
+    auto profile = device.profile();
+    response << "profile=" << (profile.empty() ? "default" : profile) << "\n";
+
+    // Features nothing has used yet are not probed just to be read back
+    auto dpi = device.getFeature<features::DPI>(false);
+    if(dpi) {
+        uint16_t value;
+        for(uint8_t sensor = 0; dpi->cachedDPI(value, sensor); sensor++)
+            response << "dpi" << (int)sensor << "=" << value << "\n";
+    }
+
+    auto smartshift = device.getFeature<features::SmartShift>(false);
+    hidpp20::SmartShift::SmartshiftStatus status{};
+    if(smartshift && smartshift->cachedStatus(status)) {
+        response << "smartshift=" << (status.active ? "on" : "off") << "\n";
+        response << "smartshift_threshold=" << (int)status.autoDisengage <<
+                "\n";
+    }
+
+    auto hires = device.getFeature<features::HiresScroll>(false);
+    uint8_t mode;
+    if(hires && hires->cachedMode(mode)) {
+        response << "hires=" << (mode & hidpp20::HiresScroll::HiRes ?
+                "on" : "off") << "\n";
+        response << "invert=" << (mode & hidpp20::HiresScroll::Inverted ?
+                "on" : "off") << "\n";
+        response << "target=" << (mode & hidpp20::HiresScroll::Target ?
+                "on" : "off") << "\n";
+    }
+
+    auto report_rate = device.getFeature<features::ReportRate>(false);
+    uint16_t rate;
+    if(report_rate && report_rate->cachedRate(rate))
+        response << "report_rate=" << rate << "\n";
+
+    auto battery = device.getFeature<features::Battery>(false);
+    if(battery) {
+        auto state = battery->state();
+        if(state.valid) {
+            const char* charging = "discharging";
+            if(state.charging == features::Battery::Charging)
+                charging = "charging";
+            else if(state.charging == features::Battery::Full)
+                charging = "full";
+            else if(state.charging == features::Battery::Error)
+                charging = "error";
+            response << "battery=" << (int)state.level << "\n";
+            response << "charging=" << charging << "\n";
+        }
+    }
+
+    return response.str();
+}
+
+std::string ControlSocket::_set(const std::shared_ptr<Device>& device,
+        const std::vector<std::string>& args)
+{
+    if(args.size() < 4)
+        return "error invalid request\n";
+    auto& setting = args[2];
+    auto& value = args[3];
+
+    std::function<void()> write;
+    // Writes to an asleep device wait for its wakeup, keyed per setting
+    std::string key = "control/" + setting;
+    if(setting == "dpi") {
+        auto dpi = device->getFeature<features::DPI>();
+        if(!dpi)
+            return "error unsupported\n";
+        char* end = nullptr;
+        unsigned long dpi_value = std::strtoul(value.c_str(), &end, 10);
+        unsigned long sensor = 0;
+        if(args.size() > 4)
+            sensor = std::strtoul(args[4].c_str(), &end, 10);
+        if(*end || dpi_value == 0 || dpi_value > UINT16_MAX ||
+           sensor > UINT8_MAX)
+            return "error invalid value\n";
+        write = [dpi, dpi_value, sensor]() {
+            dpi->setDPI(dpi_value, sensor);
+        };
+        key += "/" + std::to_string(sensor);
+    } else if(setting == "smartshift") {
+        auto smartshift = device->getFeature<features::SmartShift>();
+        if(!smartshift)
+            return "error unsupported\n";
+        if(value == "toggle") {
+            // Toggles do not replace each other, so they are not deferred
+            key.clear();
+            write = [smartshift]() { smartshift->toggleActive(); };
+        } else if(value == "on" || value == "off") {
+            hidpp20::SmartShift::SmartshiftStatus status{};
+            status.setActive = true;
+            status.active = value == "on";
+            write = [smartshift, status]() { smartshift->setStatus(status); };
+        } else {
+            return "error invalid value\n";
+        }
+    } else if(setting == "hires") {
+        auto hires = device->getFeature<features::HiresScroll>();
+        if(!hires)
+            return "error unsupported\n";
+        if(value != "on" && value != "off")
+            return "error invalid value\n";
+        bool on = value == "on";
+        write = [hires, on]() {
+            uint8_t mode = hires->getMode();
+            if(on)
+                mode |= hidpp20::HiresScroll::HiRes;
+            else
+                mode &= ~hidpp20::HiresScroll::HiRes;
+            hires->setMode(mode);
+        };
+    } else if(setting == "report_rate") {
+        auto report_rate = device->getFeature<features::ReportRate>();
+        if(!report_rate)
+            return "error unsupported\n";
+        char* end = nullptr;
+        unsigned long rate = std::strtoul(value.c_str(), &end, 10);
+        if(*end || rate == 0 || rate > 1000)
+            return "error invalid value\n";
+        write = [report_rate, rate]() { report_rate->setRate(rate); };
+    } else if(setting == "lighting") {
+        auto lighting = device->getFeature<features::Lighting>();
+        if(!lighting)
+            return "error unsupported\n";
+        features::Lighting::Frame frame;
+        for(std::size_t i = 3; i < args.size(); i++) {
+            char* end = nullptr;
+            unsigned long zone = std::strtoul(args[i].c_str(), &end, 10);
+            if(*end != '=' || zone > UINT8_MAX)
+                return "error invalid value\n";
+            const char* color_begin = end + 1;
+            unsigned long color = std::strtoul(color_begin, &end, 16);
+            if(*end || end - color_begin != 6)
+                return "error invalid value\n";
+            frame[zone] = {(uint8_t)(color >> 16), (uint8_t)(color >> 8),
+                    (uint8_t)color};
+        }
+        // Frames are rate limited and merged rather than deferred
+        key.clear();
+        write = [lighting, frame]() { lighting->setFrame(frame); };
+    } else {
+        return "error invalid setting\n";
+    }
+
+    // The device keeps itself alive until the write is done
+    task::spawn(task::Interactive, [device, write, key]() {
+        if(key.empty())
+            write();
+        else
+            device->whenAwake(key, write);
+    },
+            [path=device->path(), index=device->index()](std::exception& e) {
+        logPrintf(WARN, "%s:%d: Control socket write failed: %s",
+                path.c_str(), index, e.what());
+    });
+
+    return "ok\n";
+}
+
+std::shared_ptr<Device> ControlSocket::_find(const std::string& id)
+{
+    if(!device_manager)
+        return nullptr;
+    for(auto& device : device_manager->devices()) {
+        if(device->path() + ":" + std::to_string(device->index()) == id)
+            return device;
+    }
+    return nullptr;
+}
@@ -0,0 +1,145 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_CONTROLSOCKET_H
+#define LOGID_CONTROLSOCKET_H
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "util/thread.h"
+
+extern "C"
+{
+#include <sys/types.h>
+}
+
+#define LOGID_CONTROL_MAX_CLIENTS 16
+// Longer request lines close the connection
+#define LOGID_CONTROL_MAX_LINE 256
+// HID++ requests a client may have waiting for a response
+#define LOGID_CONTROL_MAX_HIDPP 8
+
+namespace logid
+{
+    class Device;
+
+    /* Line based Unix socket for status tools. Reads are answered from the
+     * state logid already mirrors and never send a request to a device,
+     * values that are not mirrored are left out. Writes are queued on the
+     * workqueue and go through the same feature setters as actions.
+     *
+     *   list                              one "<path>:<index> <name>" per
+     *                                     device
+     *   metrics                           Prometheus text format
+     *   get <path>:<index>                "key=value" lines
+     *   set <path>:<index> dpi <dpi> [sensor]
+     *   set <path>:<index> smartshift on|off|toggle
+     *   set <path>:<index> hires on|off
+     *   set <path>:<index> report_rate <Hz>
+     *   set <path>:<index> lighting <zone>=<rrggbb> [...]
+     *                                     changes the color of each zone
+     *                                     on the next frame
+     *   profile <name> [<path>:<index>]   switch to a device profile,
+     *                                     "default" for the device's own
+     *                                     settings. Without a device every
+     *                                     device switches, those without
+     *                                     the profile use their own
+     *                                     settings.
+     *   trace start                       record a timeline, see timeline.h,
+     *                                     into a new file in trace_dir,
+     *                                     answered with "file=<path>"
+     *   trace stop
+     *   hidpp <path> <hex>                send a raw HID++ report, e.g.
+     *                                     "hidpp /dev/hidraw3 10ff8100
+     *                                     000000", answered with the
+     *                                     response in hex
+     *
+     * Every response ends with an empty line, failures are a single
+     * "error <reason>" line.
+     *
+     * The socket gets control_socket_mode and control_socket_group.
+     * set, profile, trace and hidpp are refused with "error permission
+     * denied" unless the client runs as root, as logid's user or in
+     * control_socket_group, so a socket readable by status tools does not
+     * hand them the devices.
+     *
+     * HID++ requests let other tools share logid's I/O path instead of
+     * opening the node themselves, where their responses and logid's
+     * would be mistaken for each other. They are sent like logid's own,
+     * HID++ 2.0 requests get one of the device's software IDs, and the
+     * client's is restored in the response. Those to a device index logid
+     * does not manage are refused, as no ID is free there. Responses come
+     * back in the order devices answer, which may differ from the order
+     * of the requests. Notifications are not passed on.
+     */
+    class ControlSocket
+    {
+    public:
+        explicit ControlSocket(const std::string& path);
+        ~ControlSocket();
+    private:
+        /* Shared with HID++ requests in flight, whose responses are sent
+         * from the I/O thread. fd is -1 once the client disconnected. */
+        struct Output
+        {
+            explicit Output(int fd) : fd (fd) { }
+            std::mutex lock;
+            int fd;
+            int in_flight = 0;
+        };
+
+        struct Client
+        {
+            std::shared_ptr<Output> output;
+            std::string buffer;
+            // Whether write commands are accepted, from SO_PEERCRED
+            bool writer;
+        };
+
+        void _run();
+        bool _mayWrite(int fd) const;
+        // False if the client should be disconnected
+        bool _read(Client& client);
+        // Responses to HID++ requests are sent later, returns "" for those
+        std::string _command(const std::string& line, Client& client);
+        // False if the client is not reading its responses
+        static bool _send(Output& output, const std::string& response);
+        static void _close(Output& output);
+
+        static std::string _list();
+        static std::string _trace(const std::vector<std::string>& args);
+        static std::string _profile(const std::vector<std::string>& args);
+        static std::string _hidpp(const std::vector<std::string>& args,
+                const std::shared_ptr<Output>& output);
+        static std::string _get(Device& device);
+        static std::string _set(const std::shared_ptr<Device>& device,
+                const std::vector<std::string>& args);
+        static std::shared_ptr<Device> _find(const std::string& id);
+
+        std::string _path;
+        // control_socket_group, -1 if none
+        gid_t _group;
+        int _fd;
+        int _pipe[2];
+        std::vector<Client> _clients;
+        std::unique_ptr<thread> _thread;
+    };
+}
+
+#endif //LOGID_CONTROLSOCKET_H
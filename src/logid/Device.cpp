@@ -16,23 +16,67 @@
  *
  */
 
+#include <algorithm>
+#include "util/alloc.h"
 #include "util/log.h"
+#include "util/timeline.h"
 #include "features/DPI.h"
 #include "Device.h"
 #include "Receiver.h"
 #include "features/SmartShift.h"
 #include "features/RemapButton.h"
 #include "backend/hidpp20/features/Reset.h"
+#include "backend/hidpp20/features/Root.h"
+#include "backend/hidpp10/Error.h"
+#include "backend/hidpp20/Error.h"
+#include "backend/Error.h"
 #include "features/HiresScroll.h"
 #include "features/DeviceStatus.h"
 #include "features/ThumbWheel.h"
+#include "features/Battery.h"
+#include "features/ReportRate.h"
+#include "features/BusyPoll.h"
+#include "features/Lighting.h"
+#include "features/GKeys.h"
+#include "features/Crown.h"
+#include "features/Touchpad.h"
+
+#define LOGID_WAKEUP_RETRIES 6
+#define LOGID_WAKEUP_RETRY_DELAY std::chrono::milliseconds(5)
 
 using namespace logid;
 using namespace logid::backend;
 
+namespace
+{
+    /* Features are set up in this order, on wakeups too. Diversions come
+     * first, so that the first press after a device wakes up is already
+     * remapped, then what changes how input feels. */
+    const features::FeatureSlot setup_order[] = {
+        features::RemapButtonSlot,
+        features::GKeysSlot,
+        features::DPISlot,
+        features::HiresScrollSlot,
+        features::ThumbWheelSlot,
+        features::CrownSlot,
+        features::TouchpadSlot,
+        features::SmartShiftSlot,
+        features::ReportRateSlot,
+        features::BusyPollSlot,
+        features::LightingSlot,
+        features::DeviceStatusSlot,
+        features::BatterySlot
+    };
+    static_assert(sizeof(setup_order) / sizeof(setup_order[0]) ==
+            features::FeatureSlotCount, "every feature slot needs an order");
+}
+
 Device::Device(std::string path, backend::hidpp::DeviceIndex index) :
     _hidpp20 (path, index), _path (std::move(path)), _index (index),
-    _config (global_config, this), _receiver (nullptr)
+    _config (global_config, this), _receiver (nullptr),
+    _initialized (false), _wakeup_stopped (false), _waking (false),
+        _wakeup_resumed (false), _wakeup_epoch (0), _awake (true),
+    _deferring (false), _deferred_count (0)
 {
     _init();
 }
@@ -40,39 +84,155 @@ Device::Device(std::string path, backend::hidpp::DeviceIndex index) :
 Device::Device(const std::shared_ptr<backend::raw::RawDevice>& raw_device,
         hidpp::DeviceIndex index) : _hidpp20(raw_device, index), _path
         (raw_device->hidrawPath()), _index (index),
-        _config (global_config, this), _receiver (nullptr)
+        _config (global_config, this), _receiver (nullptr),
+        _initialized (false), _wakeup_stopped (false), _waking (false),
+        _wakeup_resumed (false), _wakeup_epoch (0), _awake (true),
+        _deferring (false), _deferred_count (0)
 {
     _init();
 }
 
 Device::Device(Receiver* receiver, hidpp::DeviceIndex index) : _hidpp20
     (receiver->rawReceiver(), index), _path (receiver->path()), _index (index),
-        _config (global_config, this), _receiver (receiver)
+        _config (global_config, this), _receiver (receiver),
+        _initialized (false), _wakeup_stopped (false), _waking (false),
+        _wakeup_resumed (false), _wakeup_epoch (0), _awake (true),
+        _deferring (false), _deferred_count (0)
 {
     _init();
 }
 
-void Device::_init()
+Device::Device(const std::shared_ptr<backend::raw::RawDevice>& raw_device,
+        hidpp::DeviceIndex index, const Snapshot::DeviceEntry& entry) :
+        _hidpp20 (raw_device, index, entry.state),
+        _path (raw_device->hidrawPath()), _index (index),
+        _config (global_config, this), _receiver (nullptr),
+        _initialized (false), _wakeup_stopped (false), _waking (false),
+        _wakeup_resumed (false), _wakeup_epoch (0), _awake (true),
+        _deferring (false), _deferred_count (0)
+{
+    _init(&entry);
+}
+
+Device::Device(Receiver* receiver, hidpp::DeviceIndex index,
+        const Snapshot::DeviceEntry& entry) :
+        _hidpp20 (receiver->rawReceiver(), index, entry.state),
+        _path (receiver->path()), _index (index),
+        _config (global_config, this), _receiver (receiver),
+        _initialized (false), _wakeup_stopped (false), _waking (false),
+        _wakeup_resumed (false), _wakeup_epoch (0), _awake (true),
+        _deferring (false), _deferred_count (0)
 {
+    _init(&entry);
+}
+
+void Device::_init(const Snapshot::DeviceEntry* restored)
+{
+    alloc::scope scope(alloc::Device);
+    _metrics = metrics::device(_path + ":" + std::to_string(_index));
     logPrintf(INFO, "Device found: %s on %s:%d", name().c_str(),
             hidpp20().devicePath().c_str(), _index);
+    if(!_config.configured())
+        logPrintf(INFO, "Device %s not configured, using default config.",
+                name().c_str());
+
+    _probed.fill(false);
+    for(auto& published : _published)
+        published = false;
 
     _addFeature<features::DPI>("dpi");
     _addFeature<features::SmartShift>("smartshift");
     _addFeature<features::HiresScroll>("hiresscroll");
-    _addFeature<features::RemapButton>("remapbutton");
-    _addFeature<features::DeviceStatus>("devicestatus");
+    _addFeature<features::RemapButton>("buttons");
+    _addFeature<features::DeviceStatus>();
     _addFeature<features::ThumbWheel>("thumbwheel");
+    _addFeature<features::Battery>();
+    _addFeature<features::ReportRate>("report_rate");
+    _addFeature<features::Lighting>("lighting");
+    _addFeature<features::GKeys>("gkeys");
+    _addFeature<features::Crown>("crown");
+    _addFeature<features::Touchpad>("touchpad");
+    _addFeature<features::BusyPoll>("busy_poll");
+
+    /* Button diversions and DPI are set up before listening, so remaps
+     * work straight away. The other features and saving what was learned
+     * are left to a background task. */
+    {
+        timeline::span span("device", "features", _path, _index);
+        for(auto slot : {features::RemapButtonSlot, features::GKeysSlot,
+                features::DPISlot})
+            if(_wantsFeature(slot))
+                _getFeature(slot, true);
+    }
 
     _makeResetMechanism();
-    reset();
 
-    for(auto& feature: _features) {
-        feature.second->configure();
-        feature.second->listen();
+    // The previous run left the device configured with the same settings
+    _restored = restored && _hidpp20.restored() &&
+            restored->config_hash == _config.hash();
+    if(_restored)
+        LOGID_LOG(DEBUG, "%s:%d restored from snapshot.", _path.c_str(),
+                _index);
+    else
+        reset();
+
+    auto start = std::chrono::steady_clock::now();
+    {
+        timeline::span span("device", "configure", _path, _index);
+        alloc::scope features(alloc::Feature);
+        std::lock_guard<std::recursive_mutex> lock(_feature_lock);
+        for(auto& feature : _loadedFeatures()) {
+            if(_restored)
+                feature->reconfigure();
+            else
+                feature->configure();
+            feature->listen();
+        }
+        _initialized = true;
+        for(int i = 0; i < features::FeatureSlotCount; i++) {
+            if(_probed[i])
+                _published[i].store(true, std::memory_order_release);
+        }
     }
+    _metrics->configure.record(std::chrono::steady_clock::now() - start);
 
     _hidpp20.listen();
+
+    /* Features set up in the background add their event handlers while
+     * events are already dispatched, hidpp::Device publishes its handler
+     * tables as snapshots for this. */
+    _background_setup = task::spawnAfter(std::chrono::milliseconds(0),
+            [this]() { _setUpBackground(); },
+            [path=_path, index=_index](std::exception& e) {
+        logPrintf(WARN, "%s:%d: Error while setting up: %s", path.c_str(),
+                index, e.what());
+    }, task::Background);
+}
+
+bool Device::_wantsFeature(features::FeatureSlot slot) const
+{
+    // Features the config does not mention wait until something uses them
+    auto& factory = _feature_factories[slot];
+    return factory.make && (factory.setting.empty() ||
+            _config.getSetting(factory.setting));
+}
+
+void Device::_setUpBackground()
+{
+    alloc::scope scope(alloc::Device);
+    {
+        // Keeps a config reload from swapping _config meanwhile
+        std::lock_guard<std::mutex> lock(_configure_lock);
+        timeline::span span("device", "background", _path, _index);
+        // Made after _init, so each is configured as it is made
+        for(auto slot : setup_order) {
+            if(_wantsFeature(slot))
+                _getFeature(slot, true);
+        }
+    }
+
+    // Capabilities queried while setting up are reused on reconnect
+    _hidpp20.saveCapabilities();
 }
 
 std::string Device::name()
@@ -85,20 +245,364 @@ uint16_t Device::pid()
     return _hidpp20.pid();
 }
 
+const std::string& Device::path() const
+{
+    return _path;
+}
+
+hidpp::DeviceIndex Device::index() const
+{
+    return _index;
+}
+
+bool Device::awake() const
+{
+    return _awake;
+}
+
 void Device::sleep()
 {
+    _awake = false;
+    {
+        std::lock_guard<std::mutex> lock(_deferred_lock);
+        _deferring = true;
+    }
     logPrintf(INFO, "%s:%d fell asleep.", _path.c_str(), _index);
 }
 
+void Device::whenAwake(const std::string& setting, std::function<void()> write)
+{
+    {
+        std::lock_guard<std::mutex> lock(_deferred_lock);
+        if(_deferring) {
+            _deferred[setting] = {_deferred_count++, std::move(write)};
+            return;
+        }
+    }
+    write();
+}
+
+void Device::_flushDeferred()
+{
+    std::vector<std::pair<std::string, DeferredWrite>> deferred;
+    {
+        std::lock_guard<std::mutex> lock(_deferred_lock);
+        deferred.assign(_deferred.begin(), _deferred.end());
+        _deferred.clear();
+        _deferring = false;
+    }
+    if(deferred.empty())
+        return;
+
+    std::sort(deferred.begin(), deferred.end(), [](
+            const std::pair<std::string, DeferredWrite>& a,
+            const std::pair<std::string, DeferredWrite>& b) {
+        return a.second.order < b.second.order;
+    });
+
+    LOGID_LOG(DEBUG, "%s:%d: Applying %zu changes made while asleep.",
+            _path.c_str(), _index, deferred.size());
+    for(auto& write : deferred) {
+        try {
+            write.second.write();
+        } catch(std::exception& e) {
+            logPrintf(WARN, "%s:%d: Error while applying %s: %s",
+                    _path.c_str(), _index, write.first.c_str(), e.what());
+        }
+    }
+}
+
+Device::~Device()
+{
+    std::shared_ptr<timer> retry;
+    {
+        std::lock_guard<std::mutex> lock(_wakeup_lock);
+        _wakeup_stopped = true;
+        retry = std::move(_wakeup_retry);
+    }
+    if(retry)
+        retry->cancel();
+    // Waits for the background setup if it is running
+    if(_background_setup)
+        _background_setup->cancel();
+}
+
 void Device::wakeup()
+{
+    _wakeup(false);
+}
+
+void Device::resume()
+{
+    _wakeup(true);
+}
+
+void Device::_wakeup(bool resumed)
 {
     logPrintf(INFO, "%s:%d woke up.", _path.c_str(), _index);
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    _awake = true;
+
+    {
+        std::lock_guard<std::mutex> lock(_wakeup_lock);
+        _wakeup_epoch++;
+        // A resume only skips reconfiguring if nothing else woke it up
+        if(_waking) {
+            _wakeup_resumed = _wakeup_resumed && resumed;
+            LOGID_LOG(DEBUG, "%s:%d is already waking up.", _path.c_str(),
+                    _index);
+            return;
+        }
+        _waking = true;
+        _wakeup_resumed = resumed;
+    }
+
+    _wakeupAttempt(0, LOGID_WAKEUP_RETRY_DELAY,
+            std::chrono::steady_clock::now());
+}
+
+void Device::reload()
+{
+    std::lock_guard<std::mutex> lock(_configure_lock);
+    auto profile = _config.profile();
+    DeviceConfig config(global_config, this, profile);
+    if(config.profile() != profile)
+        logPrintf(INFO, "%s:%d: Profile %s was removed, using the device's "
+                        "own settings.", _path.c_str(), _index,
+                        profile.c_str());
+    _applyConfig(config, INFO);
+}
 
+void Device::powerChanged()
+{
+    // Asleep devices are reconfigured on wakeup, with the mode in effect
+    std::lock_guard<std::mutex> lock(_configure_lock);
+    if(!_awake)
+        return;
+    for(auto& feature : _loadedFeatures()) {
+        try {
+            feature->powerChanged();
+        } catch(std::exception& e) {
+            logPrintf(WARN, "%s:%d: Error while switching battery mode: %s",
+                    _path.c_str(), _index, e.what());
+        }
+    }
+}
+
+bool Device::setProfile(const std::string& profile)
+{
+    std::lock_guard<std::mutex> lock(_configure_lock);
+    if(_config.profile() == profile)
+        return true;
+    DeviceConfig config(global_config, this, profile);
+    if(config.profile() != profile)
+        return false;
+    _applyConfig(config, DEBUG);
+    return true;
+}
+
+std::string Device::profile()
+{
+    std::lock_guard<std::mutex> lock(_configure_lock);
+    return _config.profile();
+}
+
+void Device::_applyConfig(const DeviceConfig& config, LogLevel level)
+{
+    std::vector<std::pair<features::FeatureSlot,
+            std::shared_ptr<features::DeviceFeature>>> changed;
+    // Features that were not needed before, made with the new config
+    std::vector<features::FeatureSlot> added;
+    for(int i = 0; i < features::FeatureSlotCount; i++) {
+        auto slot = static_cast<features::FeatureSlot>(i);
+        auto& setting = _feature_factories[slot].setting;
+        if(setting.empty())
+            continue;
+        auto new_setting = config.getSetting(setting);
+        if(Configuration::equal(_config.getSetting(setting), new_setting))
+            continue;
+        auto feature = _getFeature(slot, false);
+        if(feature)
+            changed.emplace_back(slot, feature);
+        else if(new_setting)
+            added.push_back(slot);
+    }
+
+    _config = config;
+    if(changed.empty() && added.empty())
+        return;
+
+    // Asleep devices pick the new settings up on their next wakeup
+    if(!_awake) {
+        for(auto& feature : changed)
+            whenAwake(_feature_factories[feature.first].name,
+                    [feature=feature.second]() { feature->reload(); });
+        for(auto slot : added)
+            whenAwake(_feature_factories[slot].name,
+                    [this, slot]() { _getFeature(slot, true); });
+        return;
+    }
+
+    logPrintf(level, "%s:%d: Reloading %zu features.", _path.c_str(), _index,
+            changed.size() + added.size());
+    auto start = std::chrono::steady_clock::now();
+    for(auto& feature : changed) {
+        try {
+            feature.second->reload();
+        } catch(std::exception& e) {
+            logPrintf(WARN, "%s:%d: Error while reloading a feature: %s",
+                    _path.c_str(), _index, e.what());
+        }
+    }
+    for(auto slot : added) {
+        try {
+            _getFeature(slot, true);
+        } catch(std::exception& e) {
+            logPrintf(WARN, "%s:%d: Error while adding %s: %s",
+                    _path.c_str(), _index, _feature_factories[slot].name,
+                    e.what());
+        }
+    }
+    _metrics->configure.record(std::chrono::steady_clock::now() - start);
+}
+
+void Device::_wakeupAttempt(int attempt, std::chrono::milliseconds delay,
+        std::chrono::steady_clock::time_point start)
+{
+    bool done;
+    try {
+        done = _wakeupStep(attempt, delay, start);
+    } catch(...) {
+        _endWakeup();
+        throw;
+    }
+    if(done)
+        _endWakeup();
+}
+
+void Device::_endWakeup()
+{
+    std::lock_guard<std::mutex> lock(_wakeup_lock);
+    _waking = false;
+}
+
+bool Device::_wakeupStep(int attempt, std::chrono::milliseconds delay,
+        std::chrono::steady_clock::time_point start)
+{
+    alloc::scope scope(alloc::Device);
+    timeline::span span("device", "wakeup", _path, _index);
+    bool ready;
+    {
+        // Devices that keep timing out are only probed on a backoff
+        circuit_breaker::attempt probe(_metrics->health);
+        if(!probe) {
+            LOGID_LOG(DEBUG, "%s:%d keeps failing, not waking it up yet.",
+                    _path.c_str(), _index);
+            return true;
+        }
+        ready = _ready();
+        if(ready)
+            probe.succeeded();
+    }
+
+    if(!ready) {
+        // A device that just woke up may not answer straight away
+        if(attempt + 1 >= LOGID_WAKEUP_RETRIES) {
+            logPrintf(WARN, "%s:%d did not respond after waking up.",
+                    _path.c_str(), _index);
+            return true;
+        }
+
+        std::lock_guard<std::mutex> lock(_wakeup_lock);
+        if(_wakeup_stopped)
+            return true;
+        _wakeup_retry = task::spawnAfter(delay,
+                [this, attempt, delay, start]() {
+            _wakeupAttempt(attempt + 1, delay * 2, start);
+        }, [path=_path, index=_index](std::exception& e) {
+            logPrintf(WARN, "%s:%d: Error while waking up: %s",
+                    path.c_str(), index, e.what());
+        }, task::Interactive);
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(_configure_lock);
+    uint64_t epoch;
+    bool resumed;
+    {
+        std::lock_guard<std::mutex> wakeup_lock(_wakeup_lock);
+        epoch = _wakeup_epoch;
+        resumed = _wakeup_resumed;
+        _wakeup_resumed = true;
+    }
+
+    // Wakeups from before this point are covered by this configuration
+    while(true) {
+        _configureAwake(resumed, start);
+
+        std::lock_guard<std::mutex> wakeup_lock(_wakeup_lock);
+        if(_wakeup_epoch == epoch) {
+            _waking = false;
+            return false;
+        }
+        LOGID_LOG(DEBUG, "%s:%d woke up again while being configured.",
+                _path.c_str(), _index);
+        epoch = _wakeup_epoch;
+        resumed = _wakeup_resumed;
+        _wakeup_resumed = true;
+    }
+}
+
+void Device::_configureAwake(bool resumed,
+        std::chrono::steady_clock::time_point start)
+{
+    if(resumed && _stateSurvived()) {
+        LOGID_LOG(DEBUG, "%s:%d kept its state, skipping reconfiguration.",
+                _path.c_str(), _index);
+        _flushDeferred();
+        _metrics->wakeup.record(std::chrono::steady_clock::now() - start);
+        return;
+    }
+
+    auto configure_start = std::chrono::steady_clock::now();
     reset();
 
-    for(auto& feature: _features)
-        feature.second->configure();
+    for(auto& feature : _loadedFeatures())
+        feature->reconfigure();
+    _flushDeferred();
+
+    auto now = std::chrono::steady_clock::now();
+    timeline::complete("device", "configure", configure_start, now, _path,
+            _index);
+    _metrics->configure.record(now - configure_start);
+    _metrics->wakeup.record(now - start);
+}
+
+bool Device::_ready()
+{
+    // Only fails on timeouts and error responses
+    hidpp20::Root root(&_hidpp20);
+    return root.tryGetVersion().ok();
+}
+
+bool Device::_stateSurvived()
+{
+    bool survived = false;
+    try {
+        for(auto& feature : _loadedFeatures()) {
+            switch(feature->checkMirror()) {
+            case features::DeviceFeature::Lost:
+                return false;
+            case features::DeviceFeature::Survived:
+                survived = true;
+                break;
+            case features::DeviceFeature::NotMirrored:
+                break;
+            }
+        }
+    } catch(std::exception& e) {
+        return false;
+    }
+    return survived;
 }
 
 void Device::reset()
@@ -106,8 +610,20 @@ void Device::reset()
     if(_reset_mechanism)
         (*_reset_mechanism)();
     else
-        logPrintf(DEBUG, "%s:%d tried to reset, but no reset mechanism was "
+        LOGID_LOG(DEBUG, "%s:%d tried to reset, but no reset mechanism was "
                          "available.", _path.c_str(), _index);
+
+    for(auto& feature : _loadedFeatures())
+        feature->invalidate();
+}
+
+Snapshot::DeviceEntry Device::snapshot()
+{
+    Snapshot::DeviceEntry entry;
+    entry.state = _hidpp20.state();
+    std::lock_guard<std::mutex> lock(_configure_lock);
+    entry.config_hash = _config.hash();
+    return entry;
 }
 
 DeviceConfig& Device::config()
@@ -120,14 +636,69 @@ hidpp20::Device& Device::hidpp20()
     return _hidpp20;
 }
 
+std::shared_ptr<features::DeviceFeature> Device::_getFeature(
+        features::FeatureSlot slot, bool load)
+{
+    if(_published[slot].load(std::memory_order_acquire))
+        return _features[slot];
+
+    // Also reached by features that a feature being set up uses
+    std::lock_guard<std::recursive_mutex> lock(_feature_lock);
+    if(_probed[slot])
+        return _features[slot];
+
+    auto& factory = _feature_factories[slot];
+    if(!load || !factory.make)
+        return nullptr;
+
+    alloc::scope scope(alloc::Feature);
+    std::shared_ptr<features::DeviceFeature> feature;
+    try {
+        feature = factory.make();
+    } catch(features::UnsupportedFeature& e) {
+        // Only if the feature's constructor finds more than supported() did
+    }
+    _features[slot] = feature;
+    _probed[slot] = true;
+
+    // Made on first use, listen() adds handlers while events are dispatched
+    if(feature && _initialized) {
+        try {
+            if(_restored)
+                feature->reconfigure();
+            else
+                feature->configure();
+            feature->listen();
+        } catch(std::exception& e) {
+            logPrintf(WARN, "%s:%d: Error while setting up %s: %s",
+                    _path.c_str(), _index, factory.name, e.what());
+        }
+    }
+    if(_initialized)
+        _published[slot].store(true, std::memory_order_release);
+
+    return feature;
+}
+
+std::vector<std::shared_ptr<features::DeviceFeature>>
+        Device::_loadedFeatures()
+{
+    std::lock_guard<std::recursive_mutex> lock(_feature_lock);
+    std::vector<std::shared_ptr<features::DeviceFeature>> loaded;
+    for(auto slot : setup_order) {
+        if(_features[slot])
+            loaded.push_back(_features[slot]);
+    }
+    return loaded;
+}
+
 void Device::_makeResetMechanism()
 {
     try {
-        hidpp20::Reset reset(&_hidpp20);
+        auto reset = std::make_shared<hidpp20::Reset>(&_hidpp20);
         _reset_mechanism = std::make_unique<std::function<void()>>(
-                [dev=&this->_hidpp20]{
-                    hidpp20::Reset reset(dev);
-                        reset.reset(reset.getProfile());
+                [reset]{
+                    reset->reset(reset->getProfile());
                 });
     } catch(hidpp20::UnsupportedFeature& e) {
         // Reset unsupported, ignore.
@@ -135,17 +706,48 @@ void Device::_makeResetMechanism()
 }
 
 DeviceConfig::DeviceConfig(const std::shared_ptr<Configuration>& config, Device*
-    device) : _device (device), _config (config)
+    device, const std::string& profile) : _device (device), _config (config)
 {
-    try {
-        _root_setting = config->getDevice(device->name());
-    } catch(Configuration::DeviceNotFound& e) {
-        logPrintf(INFO, "Device %s not configured, using default config.",
-                device->name().c_str());
+    auto& hidpp = device->hidpp20();
+    _settings = config->getDevice(device->pid(),
+            [&hidpp]() { return hidpp.unitId(); },
+            [device]() { return device->name(); });
+    if(_settings && !profile.empty()) {
+        auto it = _settings->profiles.find(profile);
+        if(it != _settings->profiles.end()) {
+            _settings = it->second;
+            _profile = profile;
+        }
     }
 }
 
-libconfig::Setting& DeviceConfig::getSetting(const std::string& path)
+const std::string& DeviceConfig::profile() const
+{
+    return _profile;
+}
+
+bool DeviceConfig::configured() const
+{
+    return _settings != nullptr;
+}
+
+std::size_t DeviceConfig::hash() const
+{
+    if(!_settings)
+        return 0;
+    std::size_t h = 0;
+    for(auto& setting : _settings->settings)
+        h = h * 31 + (std::hash<std::string>()(setting.first) ^
+                Configuration::hash(setting.second));
+    return h;
+}
+
+libconfig::Setting* DeviceConfig::getSetting(const std::string& name) const
 {
-    return _config->getSetting(_root_setting + '/' + path);
+    if(!_settings)
+        return nullptr;
+    auto it = _settings->settings.find(name);
+    if(it == _settings->settings.end())
+        return nullptr;
+    return it->second;
 }
@@ -19,11 +19,20 @@
 #ifndef LOGID_DEVICE_H
 #define LOGID_DEVICE_H
 
+#include <array>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <vector>
 #include "backend/hidpp/defs.h"
 #include "backend/hidpp20/Device.h"
 #include "features/DeviceFeature.h"
 #include "Configuration.h"
+#include "Snapshot.h"
 #include "util/log.h"
+#include "util/metrics.h"
+#include "util/timer_wheel.h"
 
 namespace logid
 {
@@ -33,13 +42,22 @@ namespace logid
     class DeviceConfig
     {
     public:
+        /* Uses the settings of profile if the device has such a profile,
+         * and its own settings otherwise. */
         DeviceConfig(const std::shared_ptr<Configuration>& config, Device*
-        device);
-        libconfig::Setting& getSetting(const std::string& path);
+        device, const std::string& profile="");
+        // Null if the device does not set it
+        libconfig::Setting* getSetting(const std::string& name) const;
+        bool configured() const;
+        // The profile in use, empty for the device's own settings
+        const std::string& profile() const;
+        // Changes whenever any of the device's settings change
+        std::size_t hash() const;
     private:
         Device* _device;
-        std::string _root_setting;
+        std::shared_ptr<const Configuration::DeviceSettings> _settings;
         std::shared_ptr<Configuration> _config;
+        std::string _profile;
     };
 
     /* TODO: Implement HID++ 1.0 support
@@ -53,56 +71,180 @@ namespace logid
         Device(const std::shared_ptr<backend::raw::RawDevice>& raw_device,
                 backend::hidpp::DeviceIndex index);
         Device(Receiver* receiver, backend::hidpp::DeviceIndex index);
+        /* Restores a device from a snapshot. If the config did not change
+         * since, the device is not reset and only lost state is written. */
+        Device(const std::shared_ptr<backend::raw::RawDevice>& raw_device,
+                backend::hidpp::DeviceIndex index,
+                const Snapshot::DeviceEntry& entry);
+        Device(Receiver* receiver, backend::hidpp::DeviceIndex index,
+                const Snapshot::DeviceEntry& entry);
+        ~Device();
 
         std::string name();
         uint16_t pid();
+        const std::string& path() const;
+        backend::hidpp::DeviceIndex index() const;
+        // False between sleep() and the next wakeup()
+        bool awake() const;
 
         DeviceConfig& config();
         backend::hidpp20::Device& hidpp20();
 
+        // Retries on a timer until the device answers
         void wakeup();
+        /* Used instead of wakeup() after a system resume, skips the reset
+         * and reconfiguration if the device kept the state features mirror.
+         */
+        void resume();
         void sleep();
 
+        /* Binds to the device's settings in global_config and reloads the
+         * features whose settings changed. */
+        void reload();
+        // Tells the features that battery mode started or ended
+        void powerChanged();
+
+        /* Switches to one of the device's profiles, or back to its own
+         * settings if profile is empty. Only features whose settings differ
+         * between the two are reloaded. False if there is no such profile.
+         */
+        bool setProfile(const std::string& profile);
+        std::string profile();
+
         void reset();
 
+        /* Runs write straight away unless the device is asleep, in which
+         * case it runs once the next wakeup reconfigured the device. A
+         * write deferred under the same setting replaces the earlier one. */
+        void whenAwake(const std::string& setting, std::function<void()> write);
+
+        Snapshot::DeviceEntry snapshot();
+
+        /* Features are made the first time something needs them, either
+         * the device's config or a consumer such as an action. Null if the
+         * device does not support it, or if load is false and it was not
+         * made yet. */
         template<typename T>
-        std::shared_ptr<T> getFeature(std::string name) {
-            auto it = _features.find(name);
-            if(it == _features.end())
-                return nullptr;
-            try {
-                return std::dynamic_pointer_cast<T>(it->second);
-            } catch(std::bad_cast& e) {
-                logPrintf(ERROR, "bad_cast while getting device feature %s: %s",
-                                 name.c_str(), e.what());
-                return nullptr;
-            }
+        std::shared_ptr<T> getFeature(bool load=true) {
+            return std::static_pointer_cast<T>(_getFeature(
+                    features::feature_slot<T>::slot(), load));
         }
 
     private:
-        void _init();
+        void _init(const Snapshot::DeviceEntry* restored=nullptr);
 
-        /* Adds a feature without calling an error if unsupported */
+        /* Registers a feature without probing the device. setting is the
+         * device setting the feature reads, features without one are made
+         * on startup. */
         template<typename T>
-        void _addFeature(std::string name)
+        void _addFeature(const char* setting = nullptr)
         {
-            try {
-                _features.emplace(name, std::make_shared<T>(this));
-            } catch (features::UnsupportedFeature& e) {
-            }
+            auto& factory = _feature_factories[
+                    features::feature_slot<T>::slot()];
+            factory.name = features::feature_slot<T>::name();
+            factory.make = [this]() -> std::shared_ptr<features::DeviceFeature> {
+                auto supported = T::supported(this);
+                if(!supported) {
+                    if(supported.failure().kind() !=
+                       backend::Failure::UnsupportedFeature)
+                        supported.failure().raise();
+                    return nullptr;
+                }
+                return std::make_shared<T>(this);
+            };
+            if(setting)
+                factory.setting = setting;
         }
 
+        struct FeatureFactory
+        {
+            const char* name = nullptr;
+            // Empty if the feature was not registered
+            std::function<std::shared_ptr<features::DeviceFeature>()> make;
+            std::string setting;
+        };
+
+        std::shared_ptr<features::DeviceFeature> _getFeature(
+                features::FeatureSlot slot, bool load);
+        // The features made so far in setup order, without unsupported ones
+        std::vector<std::shared_ptr<features::DeviceFeature>> _loadedFeatures();
+
         backend::hidpp20::Device _hidpp20;
         std::string _path;
         backend::hidpp::DeviceIndex _index;
-        std::map<std::string, std::shared_ptr<features::DeviceFeature>>
-            _features;
+        std::array<FeatureFactory, features::FeatureSlotCount>
+            _feature_factories;
+        // Unsupported features are kept as null so they are probed once
+        std::array<std::shared_ptr<features::DeviceFeature>,
+            features::FeatureSlotCount> _features;
+        // Guarded by _feature_lock, slots are never written once probed
+        std::array<bool, features::FeatureSlotCount> _probed;
+        /* Set once a probed feature is set up, lets getFeature() skip the
+         * lock for features that exist. */
+        std::array<std::atomic<bool>, features::FeatureSlotCount> _published;
+        // Recursive since making a feature may make the ones it uses
+        std::recursive_mutex _feature_lock;
         DeviceConfig _config;
+        // Serializes wakeup reconfiguration, config reloads and profiles
+        std::mutex _configure_lock;
+        // Reloads the features whose settings differ in config
+        void _applyConfig(const DeviceConfig& config, LogLevel level);
 
         Receiver* _receiver;
+        // Features made after _init are configured straight away
+        bool _initialized;
+        // The snapshot showed the device set up, features only fix changes
+        bool _restored = false;
+        bool _wantsFeature(features::FeatureSlot slot) const;
+        // Sets up the features _init left out, on a background task
+        void _setUpBackground();
+        std::shared_ptr<timer> _background_setup;
 
         void _makeResetMechanism();
         std::unique_ptr<std::function<void()>> _reset_mechanism;
+
+        void _wakeup(bool resumed);
+        bool _ready();
+        // False if any feature lost its state or none could tell
+        bool _stateSurvived();
+        void _wakeupAttempt(int attempt, std::chrono::milliseconds delay,
+                std::chrono::steady_clock::time_point start);
+        /* False if a retry was scheduled or the wakeup already ended,
+         * true if it still has to be ended. */
+        bool _wakeupStep(int attempt, std::chrono::milliseconds delay,
+                std::chrono::steady_clock::time_point start);
+        void _endWakeup();
+        void _configureAwake(bool resumed,
+                std::chrono::steady_clock::time_point start);
+        std::mutex _wakeup_lock;
+        bool _wakeup_stopped;
+        /* Triggers that arrive while a wakeup is in progress only bump
+         * _wakeup_epoch. The wakeup in progress covers those that came
+         * before it started configuring and configures once more for
+         * those that came after, so one configuration runs at a time
+         * and at most one is queued. Guarded by _wakeup_lock. */
+        bool _waking;
+        // False if any trigger covered was a wakeup rather than a resume
+        bool _wakeup_resumed;
+        uint64_t _wakeup_epoch;
+        std::atomic<bool> _awake;
+
+        // Runs the writes deferred while the device was asleep
+        void _flushDeferred();
+        std::mutex _deferred_lock;
+        // Set from sleep() until the deferred writes were flushed
+        bool _deferring;
+        struct DeferredWrite
+        {
+            // Writes run in the order they were last deferred
+            std::size_t order;
+            std::function<void()> write;
+        };
+        std::map<std::string, DeferredWrite> _deferred;
+        std::size_t _deferred_count;
+
+        std::shared_ptr<metrics::device_stats> _metrics;
+        std::shared_ptr<timer> _wakeup_retry;
     };
 }
 
@@ -16,66 +16,128 @@
  *
  */
 
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
 #include <thread>
 #include <sstream>
 
 #include "DeviceManager.h"
 #include "Receiver.h"
 #include "util/log.h"
+#include "util/timeline.h"
 #include "backend/hidpp10/Error.h"
 #include "backend/Error.h"
+#include "backend/hidpp/Device.h"
+
+extern "C"
+{
+#include <sys/stat.h>
+}
 
 using namespace logid;
 using namespace logid::backend;
 
-void DeviceManager::addDevice(std::string path)
+std::unique_ptr<DeviceManager> logid::device_manager;
+
+void DeviceManager::addDevice(std::shared_ptr<raw::RawDevice> raw_device)
 {
     bool defaultExists = true;
     bool isReceiver = false;
+    std::string path = raw_device->hidrawPath();
+    timeline::span span("device", "probe", path);
 
     // Check if device is ignored before continuing
-    {
-        raw::RawDevice raw_dev(path);
-        if(global_config->isIgnored(raw_dev.productId())) {
-            logPrintf(DEBUG, "%s: Device 0x%04x ignored.",
-                  path.c_str(), raw_dev.productId());
-            return;
-        }
+    if(global_config->isIgnored(raw_device->productId())) {
+        LOGID_LOG(DEBUG, "%s: Device 0x%04x ignored.",
+              path.c_str(), raw_device->productId());
+        return;
     }
 
-    try {
-        hidpp::Device device(path, hidpp::DefaultDevice);
-        isReceiver = device.version() == std::make_tuple(1, 0);
-    } catch(hidpp10::Error &e) {
-        if(e.code() != hidpp10::Error::UnknownDevice)
-            throw;
-    } catch(hidpp::Device::InvalidDevice &e) { // Ignore
-        defaultExists = false;
-    } catch(std::system_error &e) {
-        logPrintf(WARN, "I/O error on %s: %s, skipping device.",
-                path.c_str(), e.what());
+    Snapshot::Node node;
+    bool restored = _snapshot.take(path, node) &&
+            node.vid == raw_device->vendorId() &&
+            node.pid == raw_device->productId();
+    if(restored && !node.receiver && _restoreDevice(raw_device, node))
         return;
-    } catch (TimeoutError &e) {
-        logPrintf(WARN, "Device %s timed out.", path.c_str());
-        defaultExists = false;
+
+    /* Known receivers, and those the snapshot recorded, are set up
+     * without probing index 0xff first. */
+    auto pid = raw_device->productId();
+    if((restored && node.receiver) || global_config->isReceiver(pid) ||
+       (raw_device->vendorId() == LOGID_LOGITECH_VENDOR &&
+        dj::Receiver::isKnownReceiver(pid)))
+        isReceiver = true;
+
+    if(!isReceiver) {
+        if(_learnedIndex(*raw_device) == hidpp::CordedDevice) {
+            try {
+                auto version = hidpp::Device::probe(raw_device,
+                        hidpp::CordedDevice);
+                if(version && std::get<0>(*version) >= 2) {
+                    auto device = std::make_shared<Device>(raw_device,
+                            hidpp::CordedDevice);
+                    _registerDevice(path, device);
+                    return;
+                }
+            } catch(std::exception& e) {
+                LOGID_LOG(DEBUG, "%s did not answer as corded: %s",
+                        path.c_str(), e.what());
+            }
+        }
+
+        try {
+            auto version = hidpp::Device::probe(raw_device,
+                    hidpp::DefaultDevice);
+            auto& failure = version.failure();
+            switch(failure.kind()) {
+            case Failure::None:
+                isReceiver = *version == std::make_tuple(1, 0);
+                break;
+            case Failure::Hidpp10Error:
+                if(failure.code() != hidpp10::Error::UnknownDevice)
+                    failure.raise();
+                break;
+            case Failure::InvalidDevice: // Ignore
+                defaultExists = false;
+                break;
+            case Failure::Timeout:
+                logPrintf(WARN, "Device %s timed out.", path.c_str());
+                defaultExists = false;
+                break;
+            default:
+                failure.raise();
+            }
+        } catch(std::system_error &e) {
+            logPrintf(WARN, "I/O error on %s: %s, skipping device.",
+                    path.c_str(), e.what());
+            return;
+        }
     }
 
     if(isReceiver) {
         logPrintf(INFO, "Detected receiver at %s", path.c_str());
-        auto receiver = std::make_shared<Receiver>(path);
+        auto receiver = std::make_shared<Receiver>(raw_device);
+        if(restored && node.receiver)
+            receiver->restore(std::move(node.devices));
         receiver->run();
-        _receivers.emplace(path, receiver);
+        if(!_receivers.insert(path, receiver))
+            logPrintf(WARN, "%s: Receiver is already registered.",
+                    path.c_str());
     } else {
          /* TODO: Can non-receivers only contain 1 device?
          * If the device exists, it is guaranteed to be an HID++ 2.0 device */
         if(defaultExists) {
-            auto device = std::make_shared<Device>(path, hidpp::DefaultDevice);
-            _devices.emplace(path,  device);
+            auto device = std::make_shared<Device>(raw_device,
+                    hidpp::DefaultDevice);
+            _learnIndex(*raw_device, hidpp::DefaultDevice);
+            _registerDevice(path, device);
         } else {
             try {
-                auto device = std::make_shared<Device>(path,
+                auto device = std::make_shared<Device>(raw_device,
                         hidpp::CordedDevice);
-                _devices.emplace(path, device);
+                _learnIndex(*raw_device, hidpp::CordedDevice);
+                _registerDevice(path, device);
             } catch(hidpp10::Error &e) {
                 if(e.code() != hidpp10::Error::UnknownDevice)
                     throw;
@@ -93,18 +155,208 @@ void DeviceManager::addDevice(std::string path)
     }
 }
 
-void DeviceManager::removeDevice(std::string path)
+hidpp::DeviceIndex DeviceManager::_learnedIndex(
+        const raw::RawDevice& raw_device)
 {
-    auto receiver = _receivers.find(path);
+    std::lock_guard<std::mutex> lock(_indices_lock);
+    _loadIndices();
+    auto it = _indices.find(std::make_tuple(raw_device.busType(),
+            raw_device.vendorId(), raw_device.productId(),
+            raw_device.interfaceNumber()));
+    if(it == _indices.end())
+        return hidpp::DefaultDevice;
+    return it->second;
+}
 
-    if(receiver != _receivers.end()) {
-        _receivers.erase(receiver);
-        logPrintf(INFO, "Receiver on %s disconnected", path.c_str());
-    } else {
-        auto device = _devices.find(path);
-        if(device != _devices.end()) {
-            _devices.erase(device);
-            logPrintf(INFO, "Device on %s disconnected", path.c_str());
+void DeviceManager::_learnIndex(const raw::RawDevice& raw_device,
+        hidpp::DeviceIndex index)
+{
+    std::lock_guard<std::mutex> lock(_indices_lock);
+    _loadIndices();
+    auto& learned = _indices[std::make_tuple(raw_device.busType(),
+            raw_device.vendorId(), raw_device.productId(),
+            raw_device.interfaceNumber())];
+    if(learned == index)
+        return;
+    learned = index;
+    _saveIndices();
+}
+
+// One "bus vid pid interface index" line per device, _indices_lock is held
+void DeviceManager::_loadIndices()
+{
+    if(_indices_loaded)
+        return;
+    _indices_loaded = true;
+
+    if(global_config->featureCache().empty())
+        return;
+
+    std::ifstream file(global_config->featureCache() + "/indices");
+    unsigned int bus, vid, pid, index;
+    int interface;
+    while(file >> std::hex >> bus >> vid >> pid >> std::dec >> interface >>
+            index)
+        _indices[std::make_tuple(bus, vid, pid, interface)] =
+                static_cast<hidpp::DeviceIndex>(index);
+}
+
+void DeviceManager::_saveIndices()
+{
+    auto& dir = global_config->featureCache();
+    if(dir.empty())
+        return;
+
+    if(-1 == ::mkdir(dir.c_str(), 0755) && errno != EEXIST)
+        return;
+
+    auto path = dir + "/indices";
+    auto tmp_path = path + ".tmp";
+    {
+        std::ofstream file(tmp_path);
+        if(!file) {
+            LOGID_LOG(DEBUG, "Could not write %s", tmp_path.c_str());
+            return;
         }
+        for(auto& index : _indices)
+            file << std::hex << std::get<0>(index.first) << " " <<
+                std::get<1>(index.first) << " " << std::get<2>(index.first) <<
+                std::dec << " " << std::get<3>(index.first) << " " <<
+                (int)index.second << std::endl;
     }
+
+    if(-1 == std::rename(tmp_path.c_str(), path.c_str()))
+        std::remove(tmp_path.c_str());
+}
+
+bool DeviceManager::_restoreDevice(
+        const std::shared_ptr<raw::RawDevice>& raw_device,
+        const Snapshot::Node& node)
+{
+    if(node.devices.size() != 1)
+        return false;
+
+    auto& entry = *node.devices.begin();
+    std::shared_ptr<Device> device;
+    try {
+        device = std::make_shared<Device>(raw_device, entry.first,
+                entry.second);
+    } catch(std::exception& e) {
+        LOGID_LOG(DEBUG, "%s: Could not restore device: %s",
+                raw_device->hidrawPath().c_str(), e.what());
+        return false;
+    }
+
+    _learnIndex(*raw_device, entry.first);
+    _registerDevice(raw_device->hidrawPath(), device);
+    return true;
+}
+
+void DeviceManager::_registerDevice(const std::string& path,
+        std::shared_ptr<Device> device)
+{
+    if(!_devices.insert(path, std::move(device)))
+        logPrintf(WARN, "%s: Device is already registered.", path.c_str());
+}
+
+void DeviceManager::restore(const std::string& path)
+{
+    _snapshot.read(path);
+    // Only good for the next start
+    std::remove(path.c_str());
+}
+
+void DeviceManager::saveSnapshot(const std::string& path)
+{
+    auto devices = _devices.entries();
+    auto receivers = _receivers.entries();
+
+    Snapshot snapshot;
+    for(auto& device : devices) {
+        Snapshot::Node node;
+        auto& raw_device = device.second->hidpp20().rawDevice();
+        node.vid = raw_device->vendorId();
+        node.pid = raw_device->productId();
+        node.devices.emplace(device.second->index(),
+                device.second->snapshot());
+        snapshot.add(device.first, std::move(node));
+    }
+    for(auto& receiver : receivers)
+        snapshot.add(receiver.first, receiver.second->snapshot());
+
+    snapshot.write(path);
+}
+
+void DeviceManager::addSimulatedDevice(
+        std::shared_ptr<raw::SimulatedDevice> device)
+{
+    {
+        std::lock_guard<std::mutex> lock(_simulated_lock);
+        _simulated.push_back(device);
+    }
+    addDevice(device->rawDevice());
+}
+
+void DeviceManager::removeDevice(std::string path)
+{
+    // Torn down once taken out of the registry
+    if(auto receiver = _receivers.take(path))
+        logPrintf(INFO, "Receiver on %s disconnected", path.c_str());
+    else if(auto device = _devices.take(path))
+        logPrintf(INFO, "Device on %s disconnected", path.c_str());
+}
+
+void DeviceManager::cancelRequests()
+{
+    for(auto& device : _devices.entries())
+        device.second->hidpp20().rawDevice()->cancelRequests();
+    for(auto& receiver : _receivers.entries())
+        receiver.second->rawReceiver()->rawDevice()->cancelRequests();
+}
+
+void DeviceManager::powerChanged()
+{
+    for(auto& device : devices())
+        device->powerChanged();
+}
+
+std::vector<std::shared_ptr<Device>> DeviceManager::devices()
+{
+    std::vector<std::shared_ptr<Device>> devices;
+    std::vector<std::shared_ptr<Receiver>> receivers;
+    for(auto& device : _devices.entries())
+        devices.push_back(device.second);
+    for(auto& receiver : _receivers.entries())
+        receivers.push_back(receiver.second);
+
+    for(auto& receiver : receivers) {
+        auto paired = receiver->devices();
+        devices.insert(devices.end(), paired.begin(), paired.end());
+    }
+    return devices;
+}
+
+std::shared_ptr<raw::RawDevice> DeviceManager::rawDevice(
+        const std::string& path)
+{
+    if(auto device = _devices.get(path))
+        return device->hidpp20().rawDevice();
+    if(auto receiver = _receivers.get(path))
+        return receiver->rawReceiver()->rawDevice();
+    return nullptr;
+}
+
+void DeviceManager::reload()
+{
+    std::vector<std::shared_ptr<Device>> devices;
+    std::vector<std::shared_ptr<Receiver>> receivers;
+    for(auto& device : _devices.entries())
+        devices.push_back(device.second);
+    for(auto& receiver : _receivers.entries())
+        receivers.push_back(receiver.second);
+
+    for(auto& device : devices)
+        device->reload();
+    for(auto& receiver : receivers)
+        receiver->reload();
 }
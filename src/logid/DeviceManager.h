@@ -20,13 +20,17 @@
 #define LOGID_DEVICEMANAGER_H
 
 #include <map>
+#include <tuple>
 #include <thread>
 #include <mutex>
 
 #include "backend/raw/DeviceMonitor.h"
+#include "backend/raw/SimulatedDevice.h"
 #include "backend/hidpp/Device.h"
 #include "Device.h"
 #include "Receiver.h"
+#include "Snapshot.h"
+#include "util/registry.h"
 
 namespace logid
 {
@@ -35,13 +39,65 @@ namespace logid
     {
     public:
         DeviceManager() = default;
+
+        /* Simulated devices are kept alive as long as the manager, they
+         * may be added from several threads at once. */
+        void addSimulatedDevice(
+                std::shared_ptr<backend::raw::SimulatedDevice> device);
+
+        // Applies global_config to every device, called after a reload
+        void reload();
+        // See Device::powerChanged
+        void powerChanged();
+
+        // Fails the requests in flight on every node, see shutdown()
+        void cancelRequests();
+
+        // Every device, including those paired to receivers
+        std::vector<std::shared_ptr<Device>> devices();
+        // The node of a device or receiver, null if path is not managed
+        std::shared_ptr<backend::raw::RawDevice> rawDevice(
+                const std::string& path);
+
+        // Devices found on the snapshot's nodes skip probing, call before run()
+        void restore(const std::string& path);
+        void saveSnapshot(const std::string& path);
     protected:
-        void addDevice(std::string path) override;
+        void addDevice(std::shared_ptr<backend::raw::RawDevice> raw_device)
+            override;
         void removeDevice(std::string path) override;
     private:
+        /* The index a device answered on last time, keyed by bus, vid, pid
+         * and interface and kept in the feature cache directory. Devices
+         * that answered as corded skip the default index probe. */
+        backend::hidpp::DeviceIndex _learnedIndex(
+                const backend::raw::RawDevice& raw_device);
+        void _learnIndex(const backend::raw::RawDevice& raw_device,
+                backend::hidpp::DeviceIndex index);
+        void _loadIndices();
+        void _saveIndices();
+
+        // Keeps the device already registered on path, if any
+        void _registerDevice(const std::string& path,
+                std::shared_ptr<Device> device);
+
+        // False if the device has to be probed as usual
+        bool _restoreDevice(const std::shared_ptr<backend::raw::RawDevice>&
+                raw_device, const Snapshot::Node& node);
+
+        std::mutex _simulated_lock;
+        std::vector<std::shared_ptr<backend::raw::SimulatedDevice>>
+            _simulated;
+        /* Keyed by hidraw path. DeviceMonitor orders the add and remove
+         * of a node, different nodes are set up in parallel. */
+        registry<Device> _devices;
+        registry<Receiver> _receivers;
+        Snapshot _snapshot;
 
-        std::map<std::string, std::shared_ptr<Device>> _devices;
-        std::map<std::string, std::shared_ptr<Receiver>> _receivers;
+        typedef std::tuple<uint32_t, uint16_t, uint16_t, int> IndexKey;
+        std::mutex _indices_lock;
+        bool _indices_loaded = false;
+        std::map<IndexKey, backend::hidpp::DeviceIndex> _indices;
     };
 
     extern std::unique_ptr<DeviceManager> device_manager;
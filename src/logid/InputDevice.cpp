@@ -16,9 +16,20 @@
  *
  */
 
+#include <algorithm>
+#include <array>
 #include <system_error>
+#include <cassert>
+#include <cstring>
+#include <thread>
+#include <unistd.h>
+#include <sys/uio.h>
 
 #include "InputDevice.h"
+#include "util/log.h"
+#include "util/latency.h"
+#include "util/realtime.h"
+#include "util/probes.h"
 
 extern "C"
 {
@@ -28,6 +39,22 @@ extern "C"
 
 using namespace logid;
 
+std::unique_ptr<InputDevice> logid::virtual_input;
+
+namespace
+{
+    /* Frames are opened by event handlers, so they are kept per thread.
+     * events keeps its capacity from one frame to the next. */
+    struct PendingFrame
+    {
+        InputDevice* device = nullptr;
+        std::size_t depth = 0;
+        std::vector<input_event> events;
+    };
+
+    thread_local PendingFrame pending_frame;
+}
+
 InputDevice::InvalidEventCode::InvalidEventCode(const std::string& name) :
         _what ("Invalid event code " + name)
 {
@@ -38,30 +65,161 @@ const char* InputDevice::InvalidEventCode::what() const noexcept
     return _what.c_str();
 }
 
-InputDevice::InputDevice(const char* name)
+InputDevice::Frame::Frame(InputDevice& device) : _device (device)
 {
-    device = libevdev_new();
-    libevdev_set_name(device, name);
+    _device.beginFrame();
+}
 
-    ///TODO: Is it really a good idea to enable all events?
-    libevdev_enable_event_type(device, EV_KEY);
-    for(unsigned int i = 0; i < KEY_CNT; i++)
-        libevdev_enable_event_code(device, EV_KEY, i, nullptr);
-    libevdev_enable_event_type(device, EV_REL);
-    for(unsigned int i = 0; i < REL_CNT; i++)
-        libevdev_enable_event_code(device, EV_REL, i, nullptr);
+InputDevice::Frame::~Frame()
+{
+    _device.commitFrame();
+}
 
-    int err = libevdev_uinput_create_from_device(device,
-            LIBEVDEV_UINPUT_OPEN_MANAGED, &ui_device);
+InputDevice::InputDevice(const char* name, const std::set<uint>& keys,
+        const std::set<uint>& axes) : _name (name), _output_count (0),
+        _output_queue (LOGID_INPUT_QUEUE_SIZE), _output_run (true)
+{
+    for(auto& output : _key_outputs)
+        output.store(0, std::memory_order_relaxed);
+    for(auto& output : _axis_outputs)
+        output.store(0, std::memory_order_relaxed);
+    for(auto& held : _held_keys)
+        held.store(false, std::memory_order_relaxed);
 
-    if(err != 0)
-        throw std::system_error(-err, std::generic_category());
+    enable(keys, axes);
+
+    _output_thread = std::make_unique<thread>([this]() { _runOutput(); });
+    _output_thread->run();
 }
 
 InputDevice::~InputDevice()
 {
-    libevdev_uinput_destroy(ui_device);
-    libevdev_free(device);
+    // Queued frames are still written before the devices go away
+    stop();
+
+    for(std::size_t i = 0; i < _output_count; i++) {
+        libevdev_uinput_destroy(_outputs[i].uinput);
+        libevdev_free(_outputs[i].device);
+    }
+}
+
+void InputDevice::enable(const std::set<uint>& keys,
+        const std::set<uint>& axes)
+{
+    std::lock_guard<std::mutex> lock(_enable_lock);
+
+    std::vector<uint> new_keys, new_axes;
+    for(auto key : keys)
+        if(key < KEY_CNT && !_key_outputs[key].load())
+            new_keys.push_back(key);
+    for(auto axis : axes) {
+        if(axis < REL_CNT && !_axis_outputs[axis].load())
+            new_axes.push_back(axis);
+        // Hi-res axes are always sent along with their low-res axis
+        int low_res_axis = getLowResAxis(axis);
+        if(low_res_axis != -1 && !_axis_outputs[low_res_axis].load())
+            new_axes.push_back(low_res_axis);
+    }
+    std::sort(new_axes.begin(), new_axes.end());
+    new_axes.erase(std::unique(new_axes.begin(), new_axes.end()),
+            new_axes.end());
+
+    // The first output is created even if nothing is configured yet
+    if(new_keys.empty() && new_axes.empty() && _output_count)
+        return;
+
+    if(_output_count == LOGID_INPUT_MAX_OUTPUTS) {
+        logPrintf(WARN, "Too many virtual input devices, %d new key(s) and "
+                        "%d new axes will be ignored.", (int)new_keys.size(),
+                        (int)new_axes.size());
+        return;
+    }
+
+    _createOutput(new_keys, new_axes);
+}
+
+void InputDevice::_createOutput(const std::vector<uint>& keys,
+        const std::vector<uint>& axes)
+{
+    const std::size_t index = _output_count;
+    const bool catch_all = index == LOGID_INPUT_MAX_OUTPUTS - 1;
+
+    Output output{};
+    output.device = libevdev_new();
+    libevdev_set_name(output.device, _name.c_str());
+
+    if(catch_all) {
+        libevdev_enable_event_type(output.device, EV_KEY);
+        for(unsigned int i = 0; i < KEY_CNT; i++)
+            libevdev_enable_event_code(output.device, EV_KEY, i, nullptr);
+        libevdev_enable_event_type(output.device, EV_REL);
+        for(unsigned int i = 0; i < REL_CNT; i++)
+            libevdev_enable_event_code(output.device, EV_REL, i, nullptr);
+    } else {
+        if(!keys.empty())
+            libevdev_enable_event_type(output.device, EV_KEY);
+        for(auto key : keys)
+            libevdev_enable_event_code(output.device, EV_KEY, key, nullptr);
+        if(!axes.empty())
+            libevdev_enable_event_type(output.device, EV_REL);
+        for(auto axis : axes)
+            libevdev_enable_event_code(output.device, EV_REL, axis, nullptr);
+    }
+
+    int err = libevdev_uinput_create_from_device(output.device,
+            LIBEVDEV_UINPUT_OPEN_MANAGED, &output.uinput);
+
+    if(err != 0) {
+        libevdev_free(output.device);
+        throw std::system_error(-err, std::generic_category());
+    }
+
+    _outputs[index] = output;
+    _output_count = index + 1;
+
+    // Publishing the route makes the output visible to senders
+    const auto route = (uint8_t)(index + 1);
+    if(catch_all) {
+        for(auto& key : _key_outputs)
+            if(!key.load(std::memory_order_relaxed))
+                key.store(route, std::memory_order_release);
+        for(auto& axis : _axis_outputs)
+            if(!axis.load(std::memory_order_relaxed))
+                axis.store(route, std::memory_order_release);
+    } else {
+        for(auto key : keys)
+            _key_outputs[key].store(route, std::memory_order_release);
+        for(auto axis : axes)
+            _axis_outputs[axis].store(route, std::memory_order_release);
+    }
+
+    if(index)
+        logPrintf(INFO, "Added virtual input device %d with %d key(s) and "
+                        "%d axes", (int)index, (int)keys.size(),
+                        (int)axes.size());
+    else
+        LOGID_LOG(DEBUG, "Created virtual input device with %d key(s) and "
+                         "%d axes", (int)keys.size(), (int)axes.size());
+}
+
+void InputDevice::beginFrame()
+{
+    assert(!pending_frame.depth || pending_frame.device == this);
+    pending_frame.device = this;
+    pending_frame.depth++;
+}
+
+void InputDevice::commitFrame()
+{
+    assert(pending_frame.depth && pending_frame.device == this);
+    if(--pending_frame.depth)
+        return;
+
+    pending_frame.device = nullptr;
+    if(!pending_frame.events.empty()) {
+        _queueFrame(pending_frame.events.data(), pending_frame.events.size());
+        pending_frame.events.clear();
+    }
 }
 
 void InputDevice::moveAxis(uint axis, int movement)
@@ -79,6 +237,55 @@ void InputDevice::releaseKey(uint code)
     _sendEvent(EV_KEY, code, 0);
 }
 
+void InputDevice::sendEvents(const std::vector<input_event>& events)
+{
+    if(events.empty())
+        return;
+
+    for(auto& event : events) {
+        // Enabling a missed code goes through the slow path
+        if(_outputFor(event.type, event.code) == -1) {
+            Frame frame(*this);
+            for(auto& e : events)
+                _sendEvent(e.type, e.code, e.value);
+            return;
+        }
+    }
+
+    latency::mark(latency::Action);
+    for(auto& event : events)
+        if(event.type == EV_KEY)
+            _held_keys[event.code].store(event.value != 0,
+                    std::memory_order_relaxed);
+
+    if(pending_frame.depth)
+        pending_frame.events.insert(pending_frame.events.end(),
+                events.begin(), events.end());
+    else
+        _queueFrame(events.data(), events.size());
+}
+
+void InputDevice::releaseKeys()
+{
+    Frame frame(*this);
+    for(uint code = 0; code < KEY_CNT; code++)
+        if(_held_keys[code].load(std::memory_order_relaxed))
+            releaseKey(code);
+}
+
+void InputDevice::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(_output_lock);
+        if(!_output_run)
+            return;
+        _output_run = false;
+    }
+    _output_cv.notify_one();
+    if(_output_thread)
+        _output_thread->wait();
+}
+
 uint InputDevice::toKeyCode(const std::string& name)
 {
     return _toEventCode(EV_KEY, name);
@@ -105,6 +312,18 @@ int InputDevice::getLowResAxis(const uint axis_code)
     return -1;
 }
 
+std::vector<input_event> InputDevice::keyEvents(
+        const std::vector<uint>& codes, int value)
+{
+    std::vector<input_event> events(codes.size());
+    for(std::size_t i = 0; i < codes.size(); i++) {
+        events[i].type = EV_KEY;
+        events[i].code = codes[i];
+        events[i].value = value;
+    }
+    return events;
+}
+
 uint InputDevice::_toEventCode(uint type, const std::string& name)
 {
     int code = libevdev_event_code_from_name(type, name.c_str());
@@ -115,8 +334,184 @@ uint InputDevice::_toEventCode(uint type, const std::string& name)
     return code;
 }
 
+int InputDevice::_outputFor(uint type, uint code) const
+{
+    uint8_t route = 0;
+    if(type == EV_KEY && code < KEY_CNT)
+        route = _key_outputs[code].load(std::memory_order_acquire);
+    else if(type == EV_REL && code < REL_CNT)
+        route = _axis_outputs[code].load(std::memory_order_acquire);
+    return (int)route - 1;
+}
+
 void InputDevice::_sendEvent(uint type, uint code, int value)
 {
-    libevdev_uinput_write_event(ui_device, type, code, value);
-    libevdev_uinput_write_event(ui_device, EV_SYN, SYN_REPORT, 0);
-}
\ No newline at end of file
+    latency::mark(latency::Action);
+
+    // Codes the config scan missed still work, at the cost of an output
+    if(_outputFor(type, code) == -1) {
+        try {
+            if(type == EV_KEY)
+                enable({code}, {});
+            else
+                enable({}, {code});
+        } catch(std::system_error& e) {
+            logPrintf(WARN, "Could not enable event code %d: %s", code,
+                      e.what());
+        }
+        if(_outputFor(type, code) == -1)
+            return;
+    }
+
+    input_event event{};
+    event.type = type;
+    event.code = code;
+    event.value = value;
+    if(type == EV_KEY)
+        _held_keys[code].store(value != 0, std::memory_order_relaxed);
+
+    if(pending_frame.depth)
+        pending_frame.events.push_back(event);
+    else
+        _queueFrame(&event, 1);
+}
+
+void InputDevice::OutputFrame::push(const input_event& event)
+{
+    if(count < events.size() && spill.empty()) {
+        events[count++] = event;
+        return;
+    }
+    if(spill.empty())
+        spill.assign(events.begin(), events.begin() + count);
+    spill.push_back(event);
+    count++;
+}
+
+input_event* InputDevice::OutputFrame::data()
+{
+    return spill.empty() ? events.data() : spill.data();
+}
+
+void InputDevice::_queueFrame(const input_event* events, std::size_t count)
+{
+    input_event syn{};
+    syn.type = EV_SYN;
+    syn.code = SYN_REPORT;
+
+    OutputFrame frame;
+    frame.output = _outputFor(events[0].type, events[0].code);
+    bool split = false;
+    for(std::size_t i = 0; i < count; i++)
+        split |= _outputFor(events[i].type, events[i].code) !=
+                (int)frame.output;
+
+    if(!split) {
+        for(std::size_t i = 0; i < count; i++)
+            frame.push(events[i]);
+        frame.push(syn);
+        _pushFrame(std::move(frame));
+    } else {
+        // Each output gets its own frame, events keep their order in it
+        for(std::size_t i = 0; i < _output_count; i++) {
+            OutputFrame part;
+            part.output = i;
+            for(std::size_t j = 0; j < count; j++)
+                if(_outputFor(events[j].type, events[j].code) == (int)i)
+                    part.push(events[j]);
+            if(!part.count)
+                continue;
+            part.push(syn);
+            _pushFrame(std::move(part));
+        }
+    }
+
+    latency::mark(latency::Write);
+}
+
+void InputDevice::_pushFrame(OutputFrame&& frame)
+{
+    // Nothing would drain the queue
+    if(!_output_run)
+        return;
+
+    // The output thread is the only consumer, wait for it if it falls behind
+    while(!_output_queue.push(std::move(frame))) {
+        _output_cv.notify_one();
+        std::this_thread::yield();
+    }
+
+    // Taking the lock orders this push against a consumer about to sleep
+    { std::lock_guard<std::mutex> lock(_output_lock); }
+    _output_cv.notify_one();
+}
+
+void InputDevice::_runOutput()
+{
+    thread::setName("output");
+    realtime::promote();
+    std::vector<OutputFrame> frames;
+    frames.reserve(LOGID_INPUT_WRITE_BATCH);
+
+    while(true) {
+        {
+            std::unique_lock<std::mutex> lock(_output_lock);
+            _output_cv.wait(lock, [this]() {
+                return !_output_run || !_output_queue.empty();
+            });
+            if(!_output_run && _output_queue.empty())
+                return;
+        }
+
+        OutputFrame frame;
+        while(frames.size() < LOGID_INPUT_WRITE_BATCH &&
+              _output_queue.pop(frame))
+            frames.push_back(std::move(frame));
+
+        // One writev per run of frames going to the same output
+        std::size_t first = 0;
+        for(std::size_t i = 1; i <= frames.size(); i++) {
+            if(i == frames.size() || frames[i].output != frames[first].output) {
+                _writeFrames(frames, first, i);
+                first = i;
+            }
+        }
+        frames.clear();
+    }
+}
+
+void InputDevice::_writeFrames(std::vector<OutputFrame>& frames,
+        std::size_t first, std::size_t last)
+{
+    /* uinput handles each iovec as its own write, so every frame is still
+     * injected atomically with its SYN_REPORT. */
+    std::array<iovec, LOGID_INPUT_WRITE_BATCH> iov{};
+    std::size_t count = last - first, next = 0;
+    for(std::size_t i = 0; i < count; i++) {
+        auto& frame = frames[first + i];
+        iov[i].iov_base = frame.data();
+        iov[i].iov_len = frame.count * sizeof(input_event);
+    }
+
+    int fd = libevdev_uinput_get_fd(_outputs[frames[first].output].uinput);
+    while(next < count) {
+        ssize_t ret = ::writev(fd, iov.data() + next, (int)(count - next));
+        LOGID_PROBE3(uinput__write, fd, count - next, ret);
+        if(ret < 0) {
+            if(errno == EINTR)
+                continue;
+            logPrintf(WARN, "Failed to write to uinput device: %s",
+                      strerror(errno));
+            return;
+        }
+
+        // Skip whatever was written, a short write resumes mid-frame
+        auto written = (std::size_t)ret;
+        while(next < count && written >= iov[next].iov_len)
+            written -= iov[next++].iov_len;
+        if(next < count) {
+            iov[next].iov_base = (char*)iov[next].iov_base + written;
+            iov[next].iov_len -= written;
+        }
+    }
+}
@@ -19,7 +19,16 @@
 #ifndef LOGID_INPUTDEVICE_H
 #define LOGID_INPUTDEVICE_H
 
+#include <array>
+#include <atomic>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+#include "util/mpsc_queue.h"
+#include "util/thread.h"
 
 extern "C"
 {
@@ -27,8 +36,25 @@ extern "C"
 #include <libevdev/libevdev-uinput.h>
 }
 
+// Committed frames waiting for the output thread
+#define LOGID_INPUT_QUEUE_SIZE 1024
+// Frames handed to a single writev call
+#define LOGID_INPUT_WRITE_BATCH 64
+// uinput devices created for codes added after startup, the last enables all
+#define LOGID_INPUT_MAX_OUTPUTS 8
+// Events a queued frame holds inline, SYN_REPORT included
+#define LOGID_INPUT_FRAME_EVENTS 8
+
 namespace logid
 {
+    /* Events are written by a dedicated output thread. Listener threads
+     * only build frames and queue them, so a slow uinput write never holds
+     * up HID++ reads and frames from different devices never interleave.
+     *
+     * Only the key and axis codes the config refers to are enabled. Codes
+     * added later get a secondary uinput device rather than recreating the
+     * first one, so keys held on it stay held.
+     */
     class InputDevice
     {
     public:
@@ -40,24 +66,98 @@ namespace logid
         private:
             const std::string _what;
         };
-        explicit InputDevice(const char *name);
+
+        /* Events sent while a frame is open on the calling thread are
+         * queued and written together with a single SYN_REPORT once the
+         * outermost frame is committed.
+         */
+        class Frame
+        {
+        public:
+            explicit Frame(InputDevice& device);
+            ~Frame();
+        private:
+            InputDevice& _device;
+        };
+
+        InputDevice(const char *name, const std::set<uint>& keys,
+                const std::set<uint>& axes);
         ~InputDevice();
 
+        // Makes sure every code can be sent, creating an output if needed
+        void enable(const std::set<uint>& keys, const std::set<uint>& axes);
+
+        void beginFrame();
+        void commitFrame();
+
         void moveAxis(uint axis, int movement);
         void pressKey(uint code);
         void releaseKey(uint code);
+        // Sends events built ahead of time, e.g. by keyEvents(), as a frame
+        void sendEvents(const std::vector<input_event>& events);
+
+        // Releases every key that is still pressed, in one frame
+        void releaseKeys();
+        /* Writes the queued frames and stops the output thread, events
+         * sent afterwards are dropped. */
+        void stop();
 
         static uint toKeyCode(const std::string& name);
         static uint toAxisCode(const std::string& name);
         static int getLowResAxis(uint axis_code);
+        // An EV_KEY event for each code with the given value, in order
+        static std::vector<input_event> keyEvents(
+                const std::vector<uint>& codes, int value);
 
     private:
+        struct Output
+        {
+            libevdev* device;
+            libevdev_uinput* uinput;
+        };
+
+        /* Frames that fit are stored in the queue itself, so sending one
+         * does not allocate. Only larger ones, e.g. macros, spill. */
+        struct OutputFrame
+        {
+            std::size_t output = 0;
+            std::size_t count = 0;
+            std::array<input_event, LOGID_INPUT_FRAME_EVENTS> events;
+            std::vector<input_event> spill;
+
+            void push(const input_event& event);
+            input_event* data();
+        };
+
         void _sendEvent(uint type, uint code, int value);
+        void _queueFrame(const input_event* events, std::size_t count);
+        void _pushFrame(OutputFrame&& frame);
+        // Index of the output that has this code enabled, or -1
+        int _outputFor(uint type, uint code) const;
+        void _createOutput(const std::vector<uint>& keys,
+                const std::vector<uint>& axes);
+
+        void _runOutput();
+        void _writeFrames(std::vector<OutputFrame>& frames,
+                std::size_t first, std::size_t last);
 
         static uint _toEventCode(uint type, const std::string& name);
 
-        libevdev* device;
-        libevdev_uinput* ui_device{};
+        const std::string _name;
+
+        std::mutex _enable_lock;
+        std::array<Output, LOGID_INPUT_MAX_OUTPUTS> _outputs{};
+        std::atomic<std::size_t> _output_count;
+        // Output index + 1 for each enabled code, 0 if it is not enabled
+        std::array<std::atomic<uint8_t>, KEY_CNT> _key_outputs;
+        std::array<std::atomic<uint8_t>, REL_CNT> _axis_outputs;
+        std::array<std::atomic<bool>, KEY_CNT> _held_keys;
+
+        mpsc_queue<OutputFrame> _output_queue;
+        std::mutex _output_lock;
+        std::condition_variable _output_cv;
+        std::atomic<bool> _output_run;
+        std::unique_ptr<thread> _output_thread;
     };
 
     extern std::unique_ptr<InputDevice> virtual_input;
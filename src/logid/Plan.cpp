@@ -0,0 +1,297 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <sstream>
+#include <system_error>
+#include <thread>
+#include "Plan.h"
+#include "Configuration.h"
+#include "DeviceManager.h"
+#include "logid.h"
+#include "backend/hidpp/defs.h"
+#include "backend/hidpp/Report.h"
+#include "backend/hidpp10/Error.h"
+#include "backend/hidpp20/Error.h"
+#include "backend/hidpp20/feature_defs.h"
+#include "backend/raw/Capture.h"
+#include "util/log.h"
+
+extern "C"
+{
+#include <dirent.h>
+#include <unistd.h>
+}
+
+#define LOGID_PLAN_CAPTURE_SIZE (16 << 20)
+
+using namespace logid;
+using namespace logid::backend;
+using namespace std::chrono;
+
+namespace
+{
+    uint64_t now()
+    {
+        return duration_cast<nanoseconds>(
+                steady_clock::now().time_since_epoch()).count();
+    }
+
+    bool isHidpp(const std::vector<uint8_t>& data)
+    {
+        return data.size() > hidpp::Offset::Parameters &&
+                (data[0] == hidpp::Report::Type::Short ||
+                 data[0] == hidpp::Report::Type::Long);
+    }
+
+    // The feature/sub ID and function/address a response answers
+    std::pair<uint8_t, uint8_t> answers(const std::vector<uint8_t>& data)
+    {
+        if(data[hidpp::Offset::SubID] == hidpp10::ErrorID ||
+           data[hidpp::Offset::Feature] == hidpp20::ErrorID)
+            return {data[hidpp::Offset::Address],
+                    data[hidpp::Offset::Parameters]};
+        return {data[hidpp::Offset::SubID], data[hidpp::Offset::Address]};
+    }
+}
+
+Plan::Plan(const std::string& spec)
+{
+    // rtt only matters to the estimates, the rest goes to simulate()
+    std::istringstream options(spec);
+    std::string option;
+    while(std::getline(options, option, ',')) {
+        if(option.compare(0, 4, "rtt=") == 0) {
+            _rtt = microseconds(std::strtoul(option.c_str() + 4, nullptr,
+                    10));
+            continue;
+        }
+        if(!_spec.empty())
+            _spec += ",";
+        _spec += option;
+    }
+
+    char dir[] = "/tmp/logid-plan.XXXXXX";
+    if(!::mkdtemp(dir))
+        throw std::system_error(errno, std::system_category(),
+                "mkdtemp failed");
+    _dir = dir;
+}
+
+Plan::~Plan()
+{
+    if(DIR* dir = ::opendir(_dir.c_str())) {
+        while(auto entry = ::readdir(dir)) {
+            if(std::strcmp(entry->d_name, ".") &&
+               std::strcmp(entry->d_name, ".."))
+                ::unlink((_dir + "/" + entry->d_name).c_str());
+        }
+        ::closedir(dir);
+    }
+    ::rmdir(_dir.c_str());
+}
+
+const char* Plan::phaseName(Phase phase)
+{
+    switch(phase) {
+    case ColdStartup:
+        return "startup, empty cache";
+    case CachedStartup:
+        return "startup, cached";
+    case Wakeup:
+        return "wakeup";
+    default:
+        return "unknown";
+    }
+}
+
+void Plan::run()
+{
+    global_config->setFeatureCache(_dir);
+    auto capture_path = _dir + "/capture";
+    raw::global_capture = std::make_shared<raw::Capture>(capture_path,
+            LOGID_PLAN_CAPTURE_SIZE);
+
+    std::array<uint64_t, PhaseCount + 1> bounds{};
+    for(auto phase : {ColdStartup, CachedStartup}) {
+        bounds[phase] = now();
+        device_manager = std::make_unique<DeviceManager>();
+        _settle(simulate(_spec));
+
+        for(auto& device : device_manager->devices()) {
+            auto& plan = _devices[{device->path(), device->index()}];
+            plan.name = device->name();
+            if(plan.features.empty())
+                plan.features = device->hidpp20().featureTable();
+        }
+
+        if(phase == CachedStartup) {
+            bounds[Wakeup] = now();
+            auto devices = device_manager->devices();
+            for(auto& device : devices)
+                device->sleep();
+            for(auto& device : devices)
+                device->wakeup();
+            _settle(0);
+        }
+
+        device_manager.reset();
+    }
+    bounds[PhaseCount] = now();
+
+    raw::global_capture.reset();
+    _analyze(bounds);
+}
+
+void Plan::_settle(std::size_t expected)
+{
+    auto deadline = steady_clock::now() + LOGID_PLAN_TIMEOUT;
+    auto done = [expected]() {
+        auto devices = device_manager->devices();
+        if(expected)
+            return devices.size() >= expected;
+        for(auto& device : devices)
+            if(!device->awake())
+                return false;
+        return true;
+    };
+    while(!done() && steady_clock::now() < deadline)
+        std::this_thread::sleep_for(milliseconds(1));
+    if(!done())
+        logPrintf(WARN, "Plan timed out waiting for devices, the plan is "
+                        "incomplete.");
+    std::this_thread::sleep_for(LOGID_PLAN_SETTLE);
+}
+
+void Plan::_analyze(const std::array<uint64_t, PhaseCount + 1>& bounds)
+{
+    auto records = raw::Capture::read(_dir + "/capture");
+
+    typedef std::pair<std::string, uint8_t> DeviceKey;
+    std::map<DeviceKey, std::multiset<std::pair<uint8_t, uint8_t>>> pending;
+    int phase = ColdStartup;
+    for(auto& record : records) {
+        if(!isHidpp(record.data))
+            continue;
+        while(phase < PhaseCount - 1 &&
+              record.timestamp >= bounds[phase + 1]) {
+            phase++;
+            pending.clear();
+        }
+
+        DeviceKey key(record.path,
+                record.data[hidpp::Offset::DeviceIndex]);
+        auto& in_flight = pending[key];
+        if(record.direction == raw::Capture::Out) {
+            auto& plan = _devices[key];
+            if(in_flight.empty())
+                plan.round_trips[phase]++;
+            plan.requests[phase].push_back(record.data);
+            in_flight.emplace(record.data[hidpp::Offset::SubID],
+                    record.data[hidpp::Offset::Address]);
+        } else {
+            auto it = in_flight.find(answers(record.data));
+            if(it != in_flight.end())
+                in_flight.erase(it);
+        }
+    }
+}
+
+std::string Plan::_describe(const DevicePlan& device,
+        const std::vector<uint8_t>& request) const
+{
+    char text[64];
+    uint8_t sub_id = request[hidpp::Offset::SubID];
+    uint8_t address = request[hidpp::Offset::Address];
+    if(device.features.empty()) {
+        snprintf(text, sizeof(text), "sub 0x%02x reg 0x%02x", sub_id,
+                address);
+    } else {
+        auto feature = device.features.find(sub_id);
+        const char* name = feature == device.features.end() ? nullptr :
+                hidpp20::FeatureID::name(feature->second);
+        if(name)
+            snprintf(text, sizeof(text), "%s fn %d", name, address >> 4);
+        else
+            snprintf(text, sizeof(text), "feature 0x%02x fn %d", sub_id,
+                    address >> 4);
+    }
+
+    std::string description = text;
+    // Trailing zeroes are padding
+    auto end = request.end();
+    while(end > request.begin() + hidpp::Offset::Parameters && !*(end - 1))
+        --end;
+    for(auto it = request.begin() + hidpp::Offset::Parameters; it != end;
+            ++it) {
+        snprintf(text, sizeof(text), " %02x", *it);
+        description += text;
+    }
+    return description;
+}
+
+void Plan::print() const
+{
+    auto ms = [this](std::size_t count) {
+        return count * duration<double, std::milli>(_rtt).count();
+    };
+
+    for(auto& entry : _devices) {
+        auto& device = entry.second;
+        printf("%s:%d %s\n", entry.first.first.c_str(), entry.first.second,
+               device.name.empty() ? "(receiver)" : device.name.c_str());
+
+        for(int i = 0; i < PhaseCount; i++) {
+            auto phase = static_cast<Phase>(i);
+            auto& requests = device.requests[phase];
+            printf("  %s: %zu requests in %zu round trips, %.1f ms "
+                   "serialized, %.1f ms pipelined at %.1f ms RTT\n",
+                   phaseName(phase), requests.size(),
+                   device.round_trips[phase], ms(requests.size()),
+                   ms(device.round_trips[phase]),
+                   duration<double, std::milli>(_rtt).count());
+            for(auto& request : requests)
+                printf("    %s\n", _describe(device, request).c_str());
+
+            if(phase != CachedStartup)
+                continue;
+
+            // Requests the first startup sent that the cached one did not
+            std::map<std::string, int> cached;
+            for(auto& request : device.requests[ColdStartup])
+                cached[_describe(device, request)]++;
+            for(auto& request : requests)
+                cached[_describe(device, request)]--;
+            int total = 0;
+            for(auto& request : cached)
+                total += std::max(request.second, 0);
+            if(!total)
+                continue;
+            printf("  answered from the cache: %d requests\n", total);
+            for(auto& request : cached) {
+                if(request.second > 0)
+                    printf("    %s x%d\n", request.first.c_str(),
+                           request.second);
+            }
+        }
+    }
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_PLAN_H
+#define LOGID_PLAN_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Round trip time the estimates assume unless the spec sets rtt
+#define LOGID_PLAN_DEFAULT_RTT std::chrono::microseconds(1000)
+// Longest a phase may take before the plan moves on
+#define LOGID_PLAN_TIMEOUT std::chrono::seconds(10)
+// Left for requests that follow the last device being set up
+#define LOGID_PLAN_SETTLE std::chrono::milliseconds(200)
+
+namespace logid
+{
+    /* Sets up simulated devices with the loaded config and records every
+     * request they are sent, so nothing is written to a real device.
+     * Startup runs twice on fresh devices, first with an empty feature
+     * cache and then with the one the first run left, and is followed by
+     * a sleep and wakeup of every device. The cache lives in a temporary
+     * directory, the configured one is neither read nor written.
+     */
+    class Plan
+    {
+    public:
+        enum Phase
+        {
+            ColdStartup,
+            CachedStartup,
+            Wakeup,
+            PhaseCount
+        };
+
+        struct DevicePlan
+        {
+            std::string name;
+            std::array<std::vector<std::vector<uint8_t>>, PhaseCount>
+                requests;
+            // Requests sent while none of the device's were in flight
+            std::array<std::size_t, PhaseCount> round_trips{};
+            // Feature IDs by index, empty for HID++ 1.0 devices
+            std::map<uint8_t, uint16_t> features;
+        };
+
+        /* spec is that of --simulate, plus rtt=us for the estimates. The
+         * device name in the config can be given with name=. */
+        explicit Plan(const std::string& spec);
+        ~Plan();
+
+        void run();
+        void print() const;
+
+        static const char* phaseName(Phase phase);
+    private:
+        // Waits for expected devices, or for all to be awake if 0
+        void _settle(std::size_t expected);
+        void _analyze(const std::array<uint64_t, PhaseCount + 1>& bounds);
+        std::string _describe(const DevicePlan& device,
+                const std::vector<uint8_t>& request) const;
+
+        std::string _spec;
+        std::chrono::microseconds _rtt = LOGID_PLAN_DEFAULT_RTT;
+        std::string _dir;
+        // Keyed by path and device index
+        std::map<std::pair<std::string, uint8_t>, DevicePlan> _devices;
+    };
+}
+
+#endif //LOGID_PLAN_H
@@ -16,8 +16,12 @@
  *
  */
 
+#include <algorithm>
 #include "Receiver.h"
 #include "util/log.h"
+#include "util/strand.h"
+#include "util/suspend.h"
+#include "util/timeline.h"
 #include "backend/hidpp10/Error.h"
 #include "backend/hidpp20/Error.h"
 #include "backend/Error.h"
@@ -26,38 +30,102 @@ using namespace logid;
 using namespace logid::backend;
 
 Receiver::Receiver(const std::string& path) :
-    dj::ReceiverMonitor(path), _path (path)
+    dj::ReceiverMonitor(path), _path (path),
+    _resume_lane (std::make_shared<strand>(task::Interactive)),
+    _resume_queued (0), _resume_input (0)
 {
+    _listenResume();
+}
+
+Receiver::Receiver(const std::shared_ptr<raw::RawDevice>& raw_device) :
+    dj::ReceiverMonitor(raw_device), _path (raw_device->hidrawPath()),
+    _resume_lane (std::make_shared<strand>(task::Interactive)),
+    _resume_queued (0), _resume_input (0)
+{
+    _listenResume();
+}
+
+Receiver::~Receiver()
+{
+    receiver()->rawDevice()->removeEventHandler("RESUME_INPUT");
 }
 
 void Receiver::addDevice(hidpp::DeviceConnectionEvent event)
 {
-    std::unique_lock<std::mutex> lock(_devices_change);
+    std::unique_lock<std::mutex> slot_lock(_slotLock(event.index));
+    timeline::span span("device", "addDevice", _path, event.index);
+    // Outlives the try block so that error responses count as answers
+    std::shared_ptr<metrics::device_stats> stats;
+    std::unique_ptr<circuit_breaker::attempt> attempt;
     try {
+        // Timeout checks do not carry a PID, the slot table has it
+        if(event.fromTimeoutCheck)
+            event.pid = receiver()->getPairingInfo(event.index).pid;
+
         // Check if device is ignored before continuing
         if(global_config->isIgnored(event.pid)) {
-            logPrintf(DEBUG, "%s:%d: Device 0x%04x ignored.",
+            LOGID_LOG(DEBUG, "%s:%d: Device 0x%04x ignored.",
                       _path.c_str(), event.index, event.pid);
             return;
         }
 
-        auto dev = _devices.find(event.index);
-        if(dev != _devices.end()) {
-            if(event.linkEstablished)
-                dev->second->wakeup();
-            else
-                dev->second->sleep();
+        std::shared_ptr<Device> existing;
+        Snapshot::DeviceEntry restored;
+        bool has_restored = false;
+        {
+            std::lock_guard<profiled_mutex> lock(_devices_change);
+            auto dev = _devices.find(event.index);
+            if(dev != _devices.end())
+                existing = dev->second;
+            auto entry = _restored.find(event.index);
+            if(event.linkEstablished && entry != _restored.end()) {
+                restored = std::move(entry->second);
+                has_restored = true;
+                _restored.erase(entry);
+            }
+        }
+
+        if(existing) {
+            if(event.linkEstablished && suspend::resuming())
+                _queueResume(event.index);
+            else if(event.linkEstablished)
+                existing->wakeup();
+            else {
+                _cancelResume(event.index);
+                existing->sleep();
+            }
             return;
         }
 
         if(!event.linkEstablished)
             return;
 
+        // Devices that keep timing out are only probed on a backoff
+        stats = metrics::device(_path + ":" + std::to_string(event.index));
+        attempt.reset(new circuit_breaker::attempt(stats->health));
+        if(!*attempt) {
+            LOGID_LOG(DEBUG, "%s:%d keeps failing, not initializing it yet.",
+                    _path.c_str(), event.index);
+            waitForInput(event.index);
+            return;
+        }
+
+        // Only HID++ 2.0 devices are snapshotted
+        if(has_restored) {
+            auto device = std::make_shared<Device>(this, event.index,
+                    restored);
+            attempt->succeeded();
+            std::lock_guard<profiled_mutex> lock(_devices_change);
+            _devices.emplace(event.index, device);
+            return;
+        }
+
         hidpp::Device hidpp_device(receiver(), event);
 
         auto version = hidpp_device.version();
 
         if(std::get<0>(version) < 2) {
+            attempt->succeeded();
             logPrintf(INFO, "Unsupported HID++ 1.0 device on %s:%d connected.",
                     _path.c_str(), event.index);
             return;
@@ -65,28 +133,169 @@ void Receiver::addDevice(hidpp::DeviceConnectionEvent event)
 
         std::shared_ptr<Device> device = std::make_shared<Device>(this,
                 event.index);
+        attempt->succeeded();
 
+        std::lock_guard<profiled_mutex> lock(_devices_change);
         _devices.emplace(event.index, device);
 
     } catch(hidpp10::Error &e) {
+        if(attempt)
+            attempt->succeeded();
         logPrintf(ERROR,
                        "Caught HID++ 1.0 error while trying to initialize "
                        "%s:%d: %s", _path.c_str(), event.index, e.what());
     } catch(hidpp20::Error &e) {
+        if(attempt)
+            attempt->succeeded();
         logPrintf(ERROR, "Caught HID++ 2.0 error while trying to initialize "
                           "%s:%d: %s", _path.c_str(), event.index, e.what());
     } catch(TimeoutError &e) {
         if(!event.fromTimeoutCheck)
-            logPrintf(DEBUG, "%s:%d timed out, waiting for input from device to"
+            LOGID_LOG(DEBUG, "%s:%d timed out, waiting for input from device to"
                              " initialize.", _path.c_str(), event.index);
         waitForDevice(event.index);
+    } catch(hidpp::Device::InvalidDevice &e) {
+        if(e.code() != hidpp::Device::InvalidDevice::Asleep)
+            throw;
+        LOGID_LOG(DEBUG, "%s:%d went to sleep, waiting for input from device "
+                         "to initialize.", _path.c_str(), event.index);
+        waitForDevice(event.index);
     }
 }
 
 void Receiver::removeDevice(hidpp::DeviceIndex index)
 {
-    std::unique_lock<std::mutex> lock(_devices_change);
-    _devices.erase(index);
+    std::unique_lock<std::mutex> slot_lock(_slotLock(index));
+    std::shared_ptr<Device> device;
+    {
+        std::lock_guard<profiled_mutex> lock(_devices_change);
+        auto it = _devices.find(index);
+        if(it == _devices.end())
+            return;
+        device = std::move(it->second);
+        _devices.erase(it);
+    }
+    // The device is torn down outside of _devices_change
+}
+
+void Receiver::reload()
+{
+    for(auto& device : devices())
+        device->reload();
+}
+
+std::vector<std::shared_ptr<Device>> Receiver::devices()
+{
+    std::vector<std::shared_ptr<Device>> devices;
+    std::lock_guard<profiled_mutex> lock(_devices_change);
+    for(auto& device : _devices)
+        devices.push_back(device.second);
+    return devices;
+}
+
+void Receiver::restore(std::map<hidpp::DeviceIndex,
+        Snapshot::DeviceEntry> devices)
+{
+    std::lock_guard<profiled_mutex> lock(_devices_change);
+    _restored = std::move(devices);
+}
+
+Snapshot::Node Receiver::snapshot()
+{
+    Snapshot::Node node;
+    node.receiver = true;
+    node.vid = receiver()->rawDevice()->vendorId();
+    node.pid = receiver()->rawDevice()->productId();
+    for(auto& device : devices())
+        node.devices.emplace(device->index(), device->snapshot());
+    return node;
+}
+
+std::mutex& Receiver::_slotLock(hidpp::DeviceIndex index)
+{
+    std::lock_guard<profiled_mutex> lock(_devices_change);
+    return _slot_locks[index];
+}
+
+void Receiver::_queueResume(hidpp::DeviceIndex index)
+{
+    if(index < hidpp::WirelessDevice1 || index > hidpp::WirelessDevice6)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(_resume_lock);
+        uint8_t bit = 1 << index;
+        if(_resume_queued.fetch_or(bit) & bit)
+            return;
+        _resume_queue.push_back(index);
+    }
+
+    // One run per queued slot, each picks whichever slot should go next
+    _resume_lane->post([this]() { _resumeNext(); });
+}
+
+void Receiver::_resumeNext()
+{
+    hidpp::DeviceIndex index;
+    {
+        std::lock_guard<std::mutex> lock(_resume_lock);
+        if(_resume_queue.empty())
+            return;
+        auto next = _resume_queue.begin();
+        auto input = _resume_input.load();
+        for(auto it = _resume_queue.begin(); it != _resume_queue.end(); it++) {
+            if(input & (1 << *it)) {
+                next = it;
+                break;
+            }
+        }
+        index = *next;
+        _resume_queue.erase(next);
+        uint8_t bit = 1 << index;
+        _resume_queued &= ~bit;
+        _resume_input &= ~bit;
+    }
+
+    std::shared_ptr<Device> device;
+    {
+        std::lock_guard<profiled_mutex> lock(_devices_change);
+        auto it = _devices.find(index);
+        if(it != _devices.end())
+            device = it->second;
+    }
+
+    // Slot events still run on their own strand, keep them out
+    std::lock_guard<std::mutex> slot_lock(_slotLock(index));
+    if(device)
+        device->resume();
+}
+
+void Receiver::_cancelResume(hidpp::DeviceIndex index)
+{
+    if(index < hidpp::WirelessDevice1 || index > hidpp::WirelessDevice6)
+        return;
+
+    std::lock_guard<std::mutex> lock(_resume_lock);
+    uint8_t bit = 1 << index;
+    if(!(_resume_queued.fetch_and(~bit) & bit))
+        return;
+    _resume_input &= ~bit;
+    _resume_queue.erase(std::find(_resume_queue.begin(), _resume_queue.end(),
+            index));
+}
+
+void Receiver::_listenResume()
+{
+    auto handler = std::make_shared<raw::RawEventHandler>();
+    handler->condition = [this](std::vector<uint8_t>& report) {
+        auto index = report[dj::Offset::DeviceIndex];
+        return index <= hidpp::WirelessDevice6 &&
+            (_resume_queued.load(std::memory_order_relaxed) & (1 << index));
+    };
+    handler->callback = [this](std::vector<uint8_t>& report) {
+        _resume_input |= (1 << report[dj::Offset::DeviceIndex]);
+    };
+    receiver()->rawDevice()->addEventHandler("RESUME_INPUT", handler);
 }
 
 const std::string& Receiver::path() const
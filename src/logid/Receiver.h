@@ -19,9 +19,12 @@
 #ifndef LOGID_RECEIVER_H
 #define LOGID_RECEIVER_H
 
+#include <atomic>
+#include <deque>
 #include <string>
 #include "backend/dj/ReceiverMonitor.h"
 #include "Device.h"
+#include "util/profiled_mutex.h"
 
 namespace logid
 {
@@ -29,15 +32,51 @@ namespace logid
     {
     public:
         explicit Receiver(const std::string& path);
+        explicit Receiver(
+                const std::shared_ptr<backend::raw::RawDevice>& raw_device);
+        ~Receiver();
         const std::string& path() const;
         std::shared_ptr<backend::dj::Receiver> rawReceiver();
+
+        // Reloads the config of every paired device
+        void reload();
+        std::vector<std::shared_ptr<Device>> devices();
+
+        /* Slots restored from a snapshot skip probing when they connect,
+         * must be called before run(). */
+        void restore(std::map<backend::hidpp::DeviceIndex,
+                Snapshot::DeviceEntry> devices);
+        Snapshot::Node snapshot();
     protected:
         void addDevice(backend::hidpp::DeviceConnectionEvent event) override;
         void removeDevice(backend::hidpp::DeviceIndex index) override;
     private:
-        std::mutex _devices_change;
+        /* Slots are initialized concurrently, each under its own lock.
+         * _devices_change only guards the maps themselves. */
+        std::mutex& _slotLock(backend::hidpp::DeviceIndex index);
+
+        /* After a system resume, every slot reconnects at once. Wakeups
+         * then run one at a time on _resume_lane so their requests do not
+         * contend for the receiver, devices that sent a report first. */
+        void _queueResume(backend::hidpp::DeviceIndex index);
+        void _resumeNext();
+        // The slot disconnected before its turn
+        void _cancelResume(backend::hidpp::DeviceIndex index);
+        void _listenResume();
+
+        profiled_mutex _devices_change{"Receiver::_devices_change"};
+        std::map<backend::hidpp::DeviceIndex, std::mutex> _slot_locks;
         std::map<backend::hidpp::DeviceIndex, std::shared_ptr<Device>> _devices;
+        // Used once, by the first connection of each slot
+        std::map<backend::hidpp::DeviceIndex, Snapshot::DeviceEntry> _restored;
         std::string _path;
+
+        std::shared_ptr<strand> _resume_lane;
+        std::mutex _resume_lock;
+        std::deque<backend::hidpp::DeviceIndex> _resume_queue;
+        // One bit per queued slot, and per queued slot that sent a report
+        std::atomic<uint8_t> _resume_queued;
+        std::atomic<uint8_t> _resume_input;
     };
 }
 
@@ -0,0 +1,198 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include "Snapshot.h"
+#include "util/log.h"
+
+#define LOGID_SNAPSHOT_HEADER "logid-snapshot 1"
+
+using namespace logid;
+using namespace logid::backend;
+
+namespace
+{
+    void writeBytes(std::ostream& out, const std::vector<uint8_t>& bytes)
+    {
+        const char* digits = "0123456789abcdef";
+        for(auto byte : bytes)
+            out << digits[byte >> 4] << digits[byte & 0xf];
+    }
+
+    bool readBytes(const std::string& hex, std::vector<uint8_t>& bytes)
+    {
+        if(hex.size() % 2)
+            return false;
+        bytes.clear();
+        for(std::size_t i = 0; i < hex.size(); i += 2) {
+            auto digits = hex.substr(i, 2);
+            char* end;
+            auto byte = std::strtoul(digits.c_str(), &end, 16);
+            if(*end)
+                return false;
+            bytes.push_back(byte);
+        }
+        return true;
+    }
+}
+
+/* One "node path receiver vid pid" line per hidraw node, followed by a
+ * "device index major minor pid config_hash complete name" line per
+ * device and that device's "firmware fingerprint", "feature id index" and
+ * "response request response" lines. */
+void Snapshot::read(const std::string& path)
+{
+    std::ifstream file(path);
+    if(!file)
+        return;
+
+    std::string line;
+    if(!std::getline(file, line) || line != LOGID_SNAPSHOT_HEADER) {
+        LOGID_LOG(DEBUG, "%s is not a snapshot, ignoring.", path.c_str());
+        return;
+    }
+
+    std::map<std::string, Node> nodes;
+    Node* node = nullptr;
+    DeviceEntry* device = nullptr;
+    while(std::getline(file, line)) {
+        std::istringstream fields(line);
+        std::string type;
+        fields >> type;
+
+        bool valid = false;
+        if(type == "node") {
+            std::string node_path;
+            unsigned int receiver, vid, pid;
+            if(fields >> node_path >> receiver >> std::hex >> vid >> pid) {
+                node = &nodes[node_path];
+                node->receiver = receiver;
+                node->vid = vid;
+                node->pid = pid;
+                device = nullptr;
+                valid = true;
+            }
+        } else if(type == "device" && node) {
+            unsigned int index, major, minor, pid, complete;
+            std::size_t config_hash;
+            if(fields >> index >> major >> minor >> std::hex >> pid >>
+                    std::dec >> config_hash >> complete) {
+                device = &node->devices[
+                        static_cast<hidpp::DeviceIndex>(index)];
+                device->state.identity.version = std::make_tuple(major, minor);
+                device->state.identity.pid = pid;
+                device->state.features_complete = complete;
+                device->config_hash = config_hash;
+                fields.get();
+                std::getline(fields, device->state.identity.name);
+                valid = true;
+            }
+        } else if(type == "firmware" && device) {
+            valid = static_cast<bool>(fields >> device->state.firmware);
+        } else if(type == "feature" && device) {
+            unsigned int feature_id, index;
+            if(fields >> std::hex >> feature_id >> std::dec >> index) {
+                device->state.features[feature_id] = index;
+                valid = true;
+            }
+        } else if(type == "response" && device) {
+            std::string request, response;
+            std::vector<uint8_t> key, value;
+            if(fields >> request >> response && readBytes(request, key) &&
+               readBytes(response, value) && key.size() >= 2) {
+                device->state.capabilities[std::move(key)] = std::move(value);
+                valid = true;
+            }
+        }
+
+        if(!valid) {
+            logPrintf(WARN, "%s is corrupt, ignoring it.", path.c_str());
+            return;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(_lock);
+    _nodes = std::move(nodes);
+}
+
+bool Snapshot::take(const std::string& path, Node& node)
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    auto it = _nodes.find(path);
+    if(it == _nodes.end())
+        return false;
+    node = std::move(it->second);
+    _nodes.erase(it);
+    return true;
+}
+
+void Snapshot::add(const std::string& path, Node node)
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    _nodes[path] = std::move(node);
+}
+
+void Snapshot::write(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    auto tmp_path = path + ".tmp";
+    {
+        std::ofstream file(tmp_path);
+        if(!file) {
+            logPrintf(WARN, "Could not write %s", tmp_path.c_str());
+            return;
+        }
+
+        file << LOGID_SNAPSHOT_HEADER << std::endl;
+        for(auto& node : _nodes) {
+            file << "node " << node.first << " " << node.second.receiver <<
+                std::hex << " " << node.second.vid << " " <<
+                node.second.pid << std::dec << std::endl;
+            for(auto& device : node.second.devices) {
+                auto& state = device.second.state;
+                file << "device " << (int)device.first << " " <<
+                    (int)std::get<0>(state.identity.version) << " " <<
+                    (int)std::get<1>(state.identity.version) << " " <<
+                    std::hex << state.identity.pid << std::dec << " " <<
+                    device.second.config_hash << " " <<
+                    state.features_complete << " " <<
+                    state.identity.name << std::endl;
+                if(!state.firmware.empty())
+                    file << "firmware " << state.firmware << std::endl;
+                for(auto& feature : state.features)
+                    file << "feature " << std::hex << feature.first <<
+                        std::dec << " " << (int)feature.second << std::endl;
+                for(auto& response : state.capabilities) {
+                    file << "response ";
+                    writeBytes(file, response.first);
+                    file << " ";
+                    writeBytes(file, response.second);
+                    file << std::endl;
+                }
+            }
+        }
+    }
+
+    if(-1 == std::rename(tmp_path.c_str(), path.c_str())) {
+        logPrintf(WARN, "Could not write %s", path.c_str());
+        std::remove(tmp_path.c_str());
+    }
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_SNAPSHOT_H
+#define LOGID_SNAPSHOT_H
+
+#include <map>
+#include <mutex>
+#include <string>
+#include "backend/hidpp20/Device.h"
+
+namespace logid
+{
+    /* What a running logid knows about its devices, written on shutdown
+     * and read back on startup so that a restart does not probe and
+     * enumerate every hidraw node again. Each device is still checked
+     * with one version request before anything here is trusted.
+     */
+    class Snapshot
+    {
+    public:
+        struct DeviceEntry
+        {
+            backend::hidpp20::Device::State state;
+            // Hash of the device settings that were last applied
+            std::size_t config_hash = 0;
+        };
+
+        struct Node
+        {
+            bool receiver = false;
+            uint16_t vid = 0;
+            uint16_t pid = 0;
+            // Paired devices of a receiver, or the device on the node
+            std::map<backend::hidpp::DeviceIndex, DeviceEntry> devices;
+        };
+
+        // Leaves the snapshot empty if the file is missing or unreadable
+        void read(const std::string& path);
+
+        /* Removes and returns the node of a hidraw path, false if there
+         * is none. Later hotplugs of the same path are probed as usual. */
+        bool take(const std::string& path, Node& node);
+        void add(const std::string& path, Node node);
+
+        void write(const std::string& path);
+    private:
+        std::mutex _lock;
+        std::map<std::string, Node> _nodes;
+    };
+}
+
+#endif //LOGID_SNAPSHOT_H
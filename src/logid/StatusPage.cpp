@@ -0,0 +1,178 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <system_error>
+#include "StatusPage.h"
+#include "Device.h"
+#include "DeviceManager.h"
+#include "features/Battery.h"
+#include "features/DPI.h"
+#include "features/HiresScroll.h"
+#include "features/ReportRate.h"
+#include "features/SmartShift.h"
+#include "util/log.h"
+#include "util/metrics.h"
+#include "util/task.h"
+#include "util/timer_wheel.h"
+
+extern "C"
+{
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+}
+
+using namespace logid;
+using namespace logid::backend;
+using namespace std::chrono;
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t) &&
+              ATOMIC_INT_LOCK_FREE == 2,
+              "The sequence must be a plain 32-bit word for readers");
+
+constexpr uint32_t StatusPage::Magic;
+constexpr std::size_t StatusPage::Size;
+
+StatusPage::StatusPage(const std::string& path) : _path (path)
+{
+    // Readers still mapping a previous page keep their own copy of it
+    ::unlink(_path.c_str());
+    int fd = ::open(_path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC,
+            0644);
+    if(fd == -1)
+        throw std::system_error(errno, std::system_category(),
+                "status page open failed");
+
+    if(-1 == ::ftruncate(fd, Size)) {
+        int err = errno;
+        ::close(fd);
+        ::unlink(_path.c_str());
+        throw std::system_error(err, std::system_category(),
+                "status page truncate failed");
+    }
+
+    _page = ::mmap(nullptr, Size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(_page == MAP_FAILED) {
+        int err = errno;
+        ::unlink(_path.c_str());
+        throw std::system_error(err, std::system_category(),
+                "status page mmap failed");
+    }
+
+    _header = new(_page) Header();
+    _header->magic = Magic;
+    _header->version = LOGID_STATUS_PAGE_VERSION;
+    _header->entry_size = sizeof(Entry);
+    _header->count = 0;
+    _entries = reinterpret_cast<Entry*>(static_cast<char*>(_page) +
+            sizeof(Header));
+
+    _timer = task::spawnEvery(LOGID_STATUS_PAGE_INTERVAL,
+            [this]() { _update(); },
+            [path](std::exception& e) {
+        logPrintf(WARN, "Could not update status page %s: %s", path.c_str(),
+                e.what());
+    }, task::Background);
+}
+
+StatusPage::~StatusPage()
+{
+    _timer->cancel();
+    ::munmap(_page, Size);
+    ::unlink(_path.c_str());
+}
+
+void StatusPage::_update()
+{
+    std::array<Entry, LOGID_STATUS_PAGE_DEVICES> entries{};
+    uint32_t count = 0;
+    if(device_manager) {
+        for(auto& device : device_manager->devices()) {
+            if(count == entries.size())
+                break;
+            _fill(entries[count++], *device);
+        }
+    }
+
+    // Unchanged state leaves the sequence alone, readers need not retry
+    if(count == _header->count &&
+       !std::memcmp(entries.data(), _entries, count * sizeof(Entry)))
+        return;
+
+    // Only this timer writes, so the sequence needs no read-modify-write
+    auto sequence = _header->sequence.load(std::memory_order_relaxed);
+    _header->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(_entries, entries.data(), sizeof(entries));
+    _header->count = count;
+    _header->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+void StatusPage::_fill(Entry& entry, Device& device)
+{
+    std::strncpy(entry.path, device.path().c_str(), sizeof(entry.path) - 1);
+    std::strncpy(entry.name, device.name().c_str(), sizeof(entry.name) - 1);
+    entry.pid = device.pid();
+    entry.index = device.index();
+    if(device.awake())
+        entry.flags |= Awake;
+
+    // Features nothing has used yet are not probed just to be exported
+    auto dpi = device.getFeature<features::DPI>(false);
+    if(dpi && dpi->cachedDPI(entry.dpi))
+        entry.flags |= DPIValid;
+
+    auto smartshift = device.getFeature<features::SmartShift>(false);
+    hidpp20::SmartShift::SmartshiftStatus status{};
+    if(smartshift && smartshift->cachedStatus(status)) {
+        entry.flags |= SmartShiftValid;
+        if(status.active)
+            entry.flags |= SmartShiftActive;
+        entry.smartshift_threshold = status.autoDisengage;
+    }
+
+    auto hires = device.getFeature<features::HiresScroll>(false);
+    if(hires && hires->cachedMode(entry.hires_mode))
+        entry.flags |= HiresValid;
+
+    auto report_rate = device.getFeature<features::ReportRate>(false);
+    if(report_rate && report_rate->cachedRate(entry.report_rate))
+        entry.flags |= ReportRateValid;
+
+    auto battery = device.getFeature<features::Battery>(false);
+    if(battery) {
+        auto state = battery->state();
+        if(state.valid) {
+            entry.flags |= BatteryValid;
+            entry.battery_level = state.level;
+            entry.battery_state = state.charging;
+        }
+    }
+
+    auto stats = metrics::device(device.path() + ":" +
+            std::to_string(device.index()));
+    entry.health = stats->health.state();
+    entry.rtt_us = duration_cast<microseconds>(stats->rtt.smoothed()).count();
+    entry.rtt_variance_us = duration_cast<microseconds>(
+            stats->rtt.variance()).count();
+}
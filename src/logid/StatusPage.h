@@ -0,0 +1,119 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_STATUSPAGE_H
+#define LOGID_STATUSPAGE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#define LOGID_STATUS_PAGE_VERSION 1
+#define LOGID_STATUS_PAGE_DEVICES 32
+// How often the page is compared against the mirrored state
+#define LOGID_STATUS_PAGE_INTERVAL std::chrono::milliseconds(250)
+
+namespace logid
+{
+    class Device;
+    class timer;
+
+    /* The state the control socket's get reports, kept in a file for
+     * clients to mmap read-only, so polling it costs logid nothing. Only
+     * mirrored values are exported, like get, nothing is read from a
+     * device to fill the page. It is only written when something changed.
+     *
+     * The page is a Header followed by count Entries. Writes are guarded
+     * by a sequence lock, readers copy the entries and retry until they
+     * saw the same even sequence before and after the copy:
+     *
+     *   do {
+     *       s = atomic_load_acquire(&header->sequence);
+     *       copy entries
+     *       atomic_thread_fence(acquire);
+     *   } while(s & 1 || s != atomic_load_relaxed(&header->sequence));
+     *
+     * A new logid replaces the file rather than reusing it, readers should
+     * reopen it if its inode has changed. Fields are only ever added to
+     * the end of Entry, entry_size tells readers where the next one starts.
+     */
+    class StatusPage
+    {
+    public:
+        static constexpr uint32_t Magic = 0x5453474c; // "LGST"
+
+        enum Flags : uint32_t
+        {
+            Awake = 1<<0,
+            BatteryValid = 1<<1,
+            DPIValid = 1<<2,
+            SmartShiftValid = 1<<3,
+            SmartShiftActive = 1<<4,
+            HiresValid = 1<<5,
+            ReportRateValid = 1<<6
+        };
+
+        struct Header
+        {
+            uint32_t magic;
+            uint16_t version;
+            uint16_t entry_size;
+            // Odd while the entries are being written
+            std::atomic<uint32_t> sequence;
+            uint32_t count;
+        };
+
+        // Strings are NUL terminated, values are valid if their flag is set
+        struct Entry
+        {
+            char path[64];
+            char name[32];
+            uint16_t pid;
+            uint8_t index;
+            uint8_t battery_level;          // Percent
+            uint32_t flags;
+            uint16_t dpi;                   // First sensor
+            uint16_t report_rate;           // Hz
+            uint8_t smartshift_threshold;
+            uint8_t hires_mode;             // hidpp20::HiresScroll::Mode
+            uint8_t battery_state;          // features::Battery::ChargeState
+            uint8_t health;                 // circuit_breaker::State
+            uint32_t rtt_us;                // Smoothed request RTT
+            uint32_t rtt_variance_us;
+        };
+
+        static constexpr std::size_t Size = sizeof(Header) +
+                LOGID_STATUS_PAGE_DEVICES * sizeof(Entry);
+
+        explicit StatusPage(const std::string& path);
+        ~StatusPage();
+    private:
+        void _update();
+        static void _fill(Entry& entry, Device& device);
+
+        std::string _path;
+        void* _page;
+        Header* _header;
+        Entry* _entries;
+        std::shared_ptr<timer> _timer;
+    };
+}
+
+#endif //LOGID_STATUSPAGE_H
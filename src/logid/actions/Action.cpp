@@ -18,6 +18,7 @@
 
 #include <algorithm>
 #include "Action.h"
+#include "../util/arena.h"
 #include "../util/log.h"
 #include "KeypressAction.h"
 #include "ToggleSmartShift.h"
@@ -27,6 +28,7 @@
 #include "CycleDPI.h"
 #include "ChangeDPI.h"
 #include "ChangeHostAction.h"
+#include "CommandAction.h"
 
 using namespace logid;
 using namespace logid::actions;
@@ -53,21 +55,23 @@ std::shared_ptr<Action> Action::makeAction(Device *device, libconfig::Setting
         std::transform(type.begin(), type.end(), type.begin(), ::tolower);
 
         if(type == "keypress")
-            return std::make_shared<KeypressAction>(device, setting);
+            return arena::make<KeypressAction>(device, setting);
         else if(type == "togglesmartshift")
-            return std::make_shared<ToggleSmartShift>(device);
+            return arena::make<ToggleSmartShift>(device);
         else if(type == "togglehiresscroll")
-            return std::make_shared<ToggleHiresScroll>(device);
+            return arena::make<ToggleHiresScroll>(device);
         else if(type == "gestures")
-            return std::make_shared<GestureAction>(device, setting);
+            return arena::make<GestureAction>(device, setting);
         else if(type == "cycledpi")
-            return std::make_shared<CycleDPI>(device, setting);
+            return arena::make<CycleDPI>(device, setting);
         else if(type == "changedpi")
-            return std::make_shared<ChangeDPI>(device, setting);
+            return arena::make<ChangeDPI>(device, setting);
         else if(type == "none")
-            return std::make_shared<NullAction>(device);
+            return arena::make<NullAction>(device);
         else if(type == "changehost")
-            return std::make_shared<ChangeHostAction>(device, setting);
+            return arena::make<ChangeHostAction>(device, setting);
+        else if(type == "command")
+            return arena::make<CommandAction>(device, setting);
         else
             throw InvalidAction(type);
 
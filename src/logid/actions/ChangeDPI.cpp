@@ -27,7 +27,7 @@ using namespace logid::actions;
 ChangeDPI::ChangeDPI(Device *device, libconfig::Setting &setting) :
     Action(device), _config(device, setting)
 {
-    _dpi = _device->getFeature<features::DPI>("dpi");
+    _dpi = _device->getFeature<features::DPI>();
     if(!_dpi)
         logPrintf(WARN, "%s:%d: DPI feature not found, cannot use "
                         "ChangeDPI action.",
@@ -39,7 +39,7 @@ void ChangeDPI::press()
 {
     _pressed = true;
     if(_dpi) {
-        task::spawn([this]{
+        task::spawn(task::Interactive, [this]{
             try {
                 uint16_t last_dpi = _dpi->getDPI(_config.sensor());
                 _dpi->setDPI(last_dpi + _config.interval(), _config.sensor());
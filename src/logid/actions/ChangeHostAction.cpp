@@ -19,13 +19,14 @@
 #include "ChangeHostAction.h"
 #include "../Device.h"
 #include "../backend/hidpp20/features/ReprogControls.h"
-#include "../util/task.h"
 
 using namespace logid::actions;
 using namespace logid::backend;
 
 ChangeHostAction::ChangeHostAction(Device *device, libconfig::Setting&
-config) : Action(device), _config (device, config)
+config) : Action(device), _config (device, config),
+    _host_info (std::make_shared<state_mirror<
+            hidpp20::ChangeHost::HostInfo>>())
 {
     try {
         _change_host = std::make_shared<hidpp20::ChangeHost>(&device->hidpp20());
@@ -33,7 +34,18 @@ config) : Action(device), _config (device, config)
         logPrintf(WARN, "%s:%d: ChangeHost feature not supported, "
                         "ChangeHostAction will not work.", device->hidpp20()
                         .devicePath().c_str(), device->hidpp20().deviceIndex());
+        return;
     }
+
+    // An asleep device is asked again on the first release
+    _change_host->getHostInfo([host_info=_host_info](
+            hidpp20::ChangeHost::HostInfo info) {
+        host_info->set(info);
+    }, [dev=_device](std::exception& e) {
+        LOGID_LOG(DEBUG, "%s:%d: Could not get host info: %s",
+                dev->hidpp20().devicePath().c_str(),
+                dev->hidpp20().deviceIndex(), e.what());
+    });
 }
 
 void ChangeHostAction::press()
@@ -43,14 +55,39 @@ void ChangeHostAction::press()
 
 void ChangeHostAction::release()
 {
-    if(_change_host) {
-        task::spawn([this] {
-            auto host_info = _change_host->getHostInfo();
-            auto next_host = _config.nextHost(host_info);
-            if(next_host != host_info.currentHost)
+    if(!_change_host)
+        return;
+
+    /* setHost does not wait for a response, the device drops the link
+     * instead. Writes sent before it are already on their way and the
+     * device answers them in order, so nothing needs to be waited for. */
+    hidpp20::ChangeHost::HostInfo info{};
+    if(_host_info->peek(info)) {
+        auto next_host = _config.nextHost(info);
+        if(next_host != info.currentHost) {
+            try {
                 _change_host->setHost(next_host);
-        });
+            } catch(std::exception& e) {
+                logPrintf(WARN, "%s:%d: Could not change host: %s",
+                        _device->hidpp20().devicePath().c_str(),
+                        _device->hidpp20().deviceIndex(), e.what());
+            }
+        }
+        return;
     }
+
+    // No worker waits for the host info, setHost does not wait either
+    _change_host->getHostInfo([this, host_info=_host_info](
+            hidpp20::ChangeHost::HostInfo info) {
+        host_info->set(info);
+        auto next_host = _config.nextHost(info);
+        if(next_host != info.currentHost)
+            _change_host->setHost(next_host);
+    }, [dev=_device](std::exception& e) {
+        logPrintf(WARN, "%s:%d: Could not change host: %s",
+                dev->hidpp20().devicePath().c_str(),
+                dev->hidpp20().deviceIndex(), e.what());
+    });
 }
 
 uint8_t ChangeHostAction::reprogFlags() const
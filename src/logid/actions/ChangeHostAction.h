@@ -21,6 +21,7 @@
 #include <libconfig.h++>
 #include "Action.h"
 #include "../backend/hidpp20/features/ChangeHost.h"
+#include "../util/state_mirror.h"
 
 namespace logid {
 namespace actions
@@ -48,6 +49,12 @@ namespace actions
     protected:
         std::shared_ptr<backend::hidpp20::ChangeHost> _change_host;
         Config _config;
+        /* Fetched when the action is made so that a release only sends
+         * setHost. The host we are on and the host count do not change
+         * while we can talk to the device, a re-paired device is set up
+         * again. Shared with requests that may outlive the action. */
+        std::shared_ptr<state_mirror<backend::hidpp20::ChangeHost::HostInfo>>
+            _host_info;
     };
 }}
 
@@ -0,0 +1,89 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "CommandAction.h"
+#include "../util/log.h"
+#include "../util/spawner.h"
+#include "../backend/hidpp20/features/ReprogControls.h"
+
+using namespace logid::actions;
+using namespace logid::backend;
+
+CommandAction::CommandAction(Device* device, libconfig::Setting& config) :
+    Action(device), _config (device, config)
+{
+}
+
+void CommandAction::press()
+{
+    _pressed = true;
+    if(!_config.message().empty())
+        spawner::run(_config.message());
+}
+
+void CommandAction::release()
+{
+    _pressed = false;
+}
+
+uint8_t CommandAction::reprogFlags() const
+{
+    return hidpp20::ReprogControls::TemporaryDiverted;
+}
+
+CommandAction::Config::Config(Device* device, libconfig::Setting& config) :
+    Action::Config(device)
+{
+    std::vector<std::string> argv;
+    try {
+        auto& command = config.lookup("command");
+        if(command.getType() == libconfig::Setting::TypeString) {
+            argv = {"/bin/sh", "-c", command.c_str()};
+        } else if(command.isArray() || command.isList()) {
+            for(int i = 0; i < command.getLength(); i++) {
+                if(command[i].getType() != libconfig::Setting::TypeString) {
+                    logPrintf(WARN, "Line %d: command arguments must be "
+                                    "strings, skipping.",
+                                    command[i].getSourceLine());
+                    return;
+                }
+                argv.emplace_back(command[i].c_str());
+            }
+        } else {
+            logPrintf(WARN, "Line %d: command must be a string or a list "
+                            "of strings, skipping.", command.getSourceLine());
+            return;
+        }
+    } catch(libconfig::SettingNotFoundException& e) {
+        logPrintf(WARN, "Line %d: command is a required field, skipping.",
+                config.getSourceLine());
+        return;
+    }
+
+    _message = spawner::message(argv);
+    if(_message.empty())
+        logPrintf(WARN, "Line %d: command is empty or too long, skipping.",
+                config.getSourceLine());
+    else if(!spawner::running())
+        logPrintf(WARN, "Line %d: the command helper is not running, "
+                        "command will not work.", config.getSourceLine());
+}
+
+const std::string& CommandAction::Config::message() const
+{
+    return _message;
+}
@@ -28,7 +28,7 @@ using namespace libconfig;
 CycleDPI::CycleDPI(Device* device, libconfig::Setting& setting) :
     Action (device), _config (device, setting)
 {
-    _dpi = _device->getFeature<features::DPI>("dpi");
+    _dpi = _device->getFeature<features::DPI>();
     if(!_dpi)
         logPrintf(WARN, "%s:%d: DPI feature not found, cannot use "
                         "CycleDPI action.",
@@ -40,7 +40,7 @@ void CycleDPI::press()
 {
     _pressed = true;
     if(_dpi && !_config.empty()) {
-        task::spawn([this](){
+        task::spawn(task::Interactive, [this](){
             uint16_t dpi = _config.nextDPI();
             try {
                 _dpi->setDPI(dpi, _config.sensor());
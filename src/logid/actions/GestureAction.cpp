@@ -16,7 +16,14 @@
  *
  */
 #include <algorithm>
+#include <cmath>
+#include <cstdlib>
 #include "GestureAction.h"
+#include "gesture/AxisGesture.h"
+#include "gesture/IntervalGesture.h"
+#include "gesture/NullGesture.h"
+#include "gesture/ReleaseGesture.h"
+#include "gesture/ThresholdGesture.h"
 #include "../Device.h"
 #include "../backend/hidpp20/features/ReprogControls.h"
 
@@ -24,6 +31,31 @@ using namespace logid::actions;
 using namespace logid;
 using namespace logid::backend;
 
+namespace
+{
+    // Every gesture type is final, so these are direct calls
+    void moveGesture(Gesture& gesture, int16_t delta)
+    {
+        switch(gesture.type()) {
+        case Gesture::Axis:
+            static_cast<AxisGesture&>(gesture).move(delta);
+            break;
+        case Gesture::Interval:
+            static_cast<IntervalGesture&>(gesture).move(delta);
+            break;
+        case Gesture::Release:
+            static_cast<ReleaseGesture&>(gesture).move(delta);
+            break;
+        case Gesture::Threshold:
+            static_cast<ThresholdGesture&>(gesture).move(delta);
+            break;
+        case Gesture::Null:
+            static_cast<NullGesture&>(gesture).move(delta);
+            break;
+        }
+    }
+}
+
 GestureAction::Direction GestureAction::toDirection(std::string direction)
 {
     std::transform(direction.begin(), direction.end(), direction.begin(),
@@ -55,7 +87,7 @@ GestureAction::Direction GestureAction::toDirection(int16_t x, int16_t y)
 }
 
 GestureAction::GestureAction(Device* dev, libconfig::Setting& config) :
-    Action (dev), _config (dev, config)
+    Action (dev), _x (0), _y (0), _committed (None), _config (dev, config)
 {
 }
 
@@ -63,35 +95,45 @@ void GestureAction::press()
 {
     _pressed = true;
     _x = 0, _y = 0;
+    _committed = None;
     for(auto& gesture : _config.gestures())
-        gesture.second->press();
+        if(gesture)
+            gesture->press();
 }
 
 void GestureAction::release()
 {
     _pressed = false;
+    if(_committed != None) {
+        // The others were released on commit
+        _config.gestures()[_committed]->release(true);
+        _committed = None;
+        return;
+    }
+
     bool threshold_met = false;
 
     auto d = toDirection(_x, _y);
-    auto primary_gesture = _config.gestures().find(d);
-    if(primary_gesture != _config.gestures().end()) {
-        threshold_met = primary_gesture->second->metThreshold();
-        primary_gesture->second->release(true);
+    auto& primary_gesture = _config.gestures()[d];
+    if(primary_gesture) {
+        threshold_met = primary_gesture->metThreshold();
+        primary_gesture->release(true);
     }
 
-    for(auto& gesture : _config.gestures()) {
-        if(gesture.first == d)
+    for(int i = 0; i < DirectionCount; i++) {
+        auto& gesture = _config.gestures()[i];
+        if(i == d || !gesture)
             continue;
         if(!threshold_met) {
-            if(gesture.second->metThreshold()) {
+            if(gesture->metThreshold()) {
                 // If the primary gesture did not meet its threshold, use the
                 // secondary one.
                 threshold_met = true;
-                gesture.second->release(true);
+                gesture->release(true);
                 break;
             }
         } else {
-            gesture.second->release(false);
+            gesture->release(false);
         }
     }
 
@@ -105,69 +147,52 @@ void GestureAction::release()
 
 void GestureAction::move(int16_t x, int16_t y)
 {
-    auto new_x = _x + x, new_y = _y + y;
-
-    if(abs(x) > 0) {
-        if(_x < 0 && new_x >= 0) { // Left -> Origin/Right
-            auto left = _config.gestures().find(Left);
-            if(left != _config.gestures().end())
-                left->second->move(_x);
-            if(new_x) { // Ignore to origin
-                auto right = _config.gestures().find(Right);
-                if(right != _config.gestures().end())
-                    right->second->move(new_x);
-            }
-        } else if(_x > 0 && new_x <= 0) { // Right -> Origin/Left
-            auto right = _config.gestures().find(Right);
-            if(right != _config.gestures().end())
-                right->second->move(-_x);
-            if(new_x) { // Ignore to origin
-                auto left = _config.gestures().find(Left);
-                if(left != _config.gestures().end())
-                    left->second->move(-new_x);
-            }
-        } else if(new_x < 0) { // Origin/Left to Left
-            auto left = _config.gestures().find(Left);
-            if(left != _config.gestures().end())
-                left->second->move(-x);
-        } else if(new_x > 0) { // Origin/Right to Right
-            auto right = _config.gestures().find(Right);
-            if(right != _config.gestures().end())
-                right->second->move(x);
-        }
-    }
+    int new_x = _x + x, new_y = _y + y;
 
-    if(abs(y) > 0) {
-        if(_y > 0 && new_y <= 0) { // Up -> Origin/Down
-            auto up = _config.gestures().find(Up);
-            if(up != _config.gestures().end())
-                up->second->move(_y);
-            if(new_y) { // Ignore to origin
-                auto down = _config.gestures().find(Down);
-                if(down != _config.gestures().end())
-                    down->second->move(new_y);
-            }
-        } else if(_y < 0 && new_y >= 0) { // Down -> Origin/Up
-            auto down = _config.gestures().find(Down);
-            if(down != _config.gestures().end())
-                down->second->move(-_y);
-            if(new_y) { // Ignore to origin
-                auto up = _config.gestures().find(Up);
-                if(up != _config.gestures().end())
-                    up->second->move(-new_y);
-            }
-        } else if(new_y < 0) { // Origin/Up to Up
-            auto up = _config.gestures().find(Up);
-            if(up != _config.gestures().end())
-                up->second->move(-y);
-        } else if(new_y > 0) {// Origin/Down to Down
-            auto down = _config.gestures().find(Down);
-            if(down != _config.gestures().end())
-                down->second->move(y);
-        }
-    }
+    /* Each direction moves by how far its half of the axis changed, so
+     * crossing the origin retreats one gesture and advances the other.
+     */
+    _move(Left, std::max(-new_x, 0) - std::max(-_x, 0));
+    _move(Right, std::max(new_x, 0) - std::max(int(_x), 0));
+    _move(Up, std::max(-new_y, 0) - std::max(-_y, 0));
+    _move(Down, std::max(new_y, 0) - std::max(int(_y), 0));
 
     _x = new_x; _y = new_y;
+
+    if(_config.earlyCommit() && _committed == None)
+        _tryCommit();
+}
+
+void GestureAction::_move(Direction d, int delta)
+{
+    if(_committed != None && _committed != d)
+        return;
+
+    auto& gesture = _config.gestures()[d];
+    if(delta && gesture)
+        moveGesture(*gesture, delta);
+}
+
+void GestureAction::_tryCommit()
+{
+    auto d = toDirection(_x, _y);
+    auto& gesture = _config.gestures()[d];
+    if(!gesture || !gesture->metThreshold())
+        return;
+
+    bool horizontal = d == Left || d == Right;
+    int along = std::abs(horizontal ? _x : _y);
+    int across = std::abs(horizontal ? _y : _x);
+    if(across > along * _config.commitSlope())
+        return;
+
+    _committed = d;
+    gesture->commit();
+    for(int i = 0; i < DirectionCount; i++) {
+        auto& other = _config.gestures()[i];
+        if(i != d && other)
+            other->release(false);
+    }
 }
 
 uint8_t GestureAction::reprogFlags() const
@@ -177,8 +202,39 @@ uint8_t GestureAction::reprogFlags() const
 }
 
 GestureAction::Config::Config(Device* device, libconfig::Setting &root) :
-    Action::Config(device)
+    Action::Config(device), _early_commit (false),
+    _commit_slope (std::tan(LOGID_GESTURE_DEFAULT_COMMIT_ANGLE * M_PI / 180))
 {
+    try {
+        auto& early_commit = root.lookup("early_commit");
+        if(early_commit.getType() == libconfig::Setting::TypeBoolean)
+            _early_commit = early_commit;
+        else
+            logPrintf(WARN, "Line %d: early_commit must be a boolean, "
+                            "ignoring.", early_commit.getSourceLine());
+    } catch(libconfig::SettingNotFoundException& e) {
+        // Ignore
+    }
+
+    try {
+        auto& commit_angle = root.lookup("commit_angle");
+        double angle = -1;
+        if(commit_angle.getType() == libconfig::Setting::TypeFloat)
+            angle = commit_angle;
+        else if(commit_angle.isNumber())
+            angle = (int)commit_angle;
+
+        if(angle > 0 && angle <= 45)
+            _commit_slope = std::tan(angle * M_PI / 180);
+        else
+            logPrintf(WARN, "Line %d: commit_angle must be a number above 0 "
+                            "and up to 45, setting to default (%d).",
+                            commit_angle.getSourceLine(),
+                            LOGID_GESTURE_DEFAULT_COMMIT_ANGLE);
+    } catch(libconfig::SettingNotFoundException& e) {
+        // Ignore
+    }
+
     try {
         auto& gestures = root.lookup("gestures");
 
@@ -219,7 +275,7 @@ GestureAction::Config::Config(Device* device, libconfig::Setting &root) :
                 continue;
             }
 
-            if(_gestures.find(d) != _gestures.end() || (d == None && _none_action)) {
+            if(_gestures[d] || (d == None && _none_action)) {
                 logPrintf(WARN, "Line %d: Gesture is already defined for "
                                 "this direction, duplicate ignored.",
                           gestures[i].getSourceLine());
@@ -265,8 +321,7 @@ GestureAction::Config::Config(Device* device, libconfig::Setting &root) :
             }
 
             try {
-                _gestures.emplace(d, Gesture::makeGesture(_device,
-                        gestures[i]));
+                _gestures[d] = Gesture::makeGesture(_device, gestures[i]);
             } catch(InvalidGesture& e) {
                 logPrintf(WARN, "Line %d: Invalid gesture: %s",
                         gestures[i].getSourceLine(), e.what());
@@ -279,8 +334,7 @@ GestureAction::Config::Config(Device* device, libconfig::Setting &root) :
     }
 }
 
-std::map<GestureAction::Direction, std::shared_ptr<Gesture>>&
-    GestureAction::Config::gestures()
+GestureAction::Config::GestureTable& GestureAction::Config::gestures()
 {
     return _gestures;
 }
@@ -288,4 +342,14 @@ std::map<GestureAction::Direction, std::shared_ptr<Gesture>>&
 std::shared_ptr<Action> GestureAction::Config::noneAction()
 {
     return _none_action;
-}
\ No newline at end of file
+}
+
+bool GestureAction::Config::earlyCommit() const
+{
+    return _early_commit;
+}
+
+double GestureAction::Config::commitSlope() const
+{
+    return _commit_slope;
+}
@@ -18,14 +18,17 @@
 #ifndef LOGID_ACTION_GESTUREACTION_H
 #define LOGID_ACTION_GESTUREACTION_H
 
-#include <map>
+#include <array>
 #include <libconfig.h++>
 #include "Action.h"
 #include "gesture/Gesture.h"
 
+// Furthest the movement may be from a direction's axis to commit early
+#define LOGID_GESTURE_DEFAULT_COMMIT_ANGLE 30
+
 namespace logid {
 namespace actions {
-    class GestureAction : public Action
+    class GestureAction final : public Action
     {
     public:
         enum Direction
@@ -34,7 +37,8 @@ namespace actions {
             Up,
             Down,
             Left,
-            Right
+            Right,
+            DirectionCount
         };
         static Direction toDirection(std::string direction);
         static Direction toDirection(int16_t x, int16_t y);
@@ -50,16 +54,34 @@ namespace actions {
         class Config : public Action::Config
         {
         public:
+            // Indexed by direction, null where no gesture is set
+            typedef std::array<std::shared_ptr<Gesture>, DirectionCount>
+                    GestureTable;
+
             Config(Device* device, libconfig::Setting& root);
-            std::map<Direction, std::shared_ptr<Gesture>>& gestures();
+            GestureTable& gestures();
             std::shared_ptr<Action> noneAction();
+            /* Commits to a direction while the button is still held, as
+             * soon as its gesture met its threshold and the movement is
+             * within the commit angle of its axis. */
+            bool earlyCommit() const;
+            // tan() of the commit angle
+            double commitSlope() const;
         protected:
-            std::map<Direction, std::shared_ptr<Gesture>> _gestures;
+            GestureTable _gestures;
             std::shared_ptr<Action> _none_action;
+            bool _early_commit;
+            double _commit_slope;
         };
 
     protected:
+        // Moves the gesture of d by delta, if there is one
+        void _move(Direction d, int delta);
+        void _tryCommit();
+
         int16_t _x, _y;
+        // The direction committed to early, later movement only goes to it
+        Direction _committed;
         Config _config;
     };
 }}
@@ -31,15 +31,13 @@ KeypressAction::KeypressAction(Device *device, libconfig::Setting& config) :
 void KeypressAction::press()
 {
     _pressed = true;
-    for(auto& key : _config.keys())
-        virtual_input->pressKey(key);
+    virtual_input->sendEvents(_config.pressEvents());
 }
 
 void KeypressAction::release()
 {
     _pressed = false;
-    for(auto& key : _config.keys())
-        virtual_input->releaseKey(key);
+    virtual_input->sendEvents(_config.releaseEvents());
 }
 
 uint8_t KeypressAction::reprogFlags() const
@@ -47,6 +45,11 @@ uint8_t KeypressAction::reprogFlags() const
     return hidpp20::ReprogControls::TemporaryDiverted;
 }
 
+const std::vector<uint>& KeypressAction::keys() const
+{
+    return _config.keys();
+}
+
 KeypressAction::Config::Config(Device* device, libconfig::Setting& config) :
     Action::Config(device)
 {
@@ -66,7 +69,7 @@ KeypressAction::Config::Config(Device* device, libconfig::Setting& config) :
                     _keys.push_back(key);
                 } else if(key.getType() == libconfig::Setting::TypeString) {
                     try {
-                        _keys.push_back(virtual_input->toKeyCode(key));
+                        _keys.push_back(InputDevice::toKeyCode(key));
                     } catch(InputDevice::InvalidEventCode& e) {
                         logPrintf(WARN, "Line %d: Invalid keycode %s, skipping."
                             , key.getSourceLine(), key.c_str());
@@ -81,9 +84,26 @@ KeypressAction::Config::Config(Device* device, libconfig::Setting& config) :
         logPrintf(WARN, "Line %d: keys is a required field, skipping.",
                 config.getSourceLine());
     }
+
+    _press_events = InputDevice::keyEvents(_keys, 1);
+    _release_events = InputDevice::keyEvents(_keys, 0);
 }
 
 std::vector<uint>& KeypressAction::Config::keys()
 {
     return _keys;
-}
\ No newline at end of file
+}
+
+const std::vector<uint>& KeypressAction::Config::keys() const
+{
+    return _keys;
+}
+const std::vector<input_event>& KeypressAction::Config::pressEvents() const
+{
+    return _press_events;
+}
+
+const std::vector<input_event>& KeypressAction::Config::releaseEvents() const
+{
+    return _release_events;
+}
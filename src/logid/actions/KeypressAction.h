@@ -20,6 +20,7 @@
 
 #include <vector>
 #include <libconfig.h++>
+#include <linux/input.h>
 #include "Action.h"
 
 namespace logid {
@@ -33,14 +34,21 @@ namespace actions {
         virtual void release();
 
         virtual uint8_t reprogFlags() const;
+        const std::vector<uint>& keys() const;
 
         class Config : public Action::Config
         {
         public:
             explicit Config(Device* device, libconfig::Setting& root);
             std::vector<uint>& keys();
+            const std::vector<uint>& keys() const;
+            // Built once so a shortcut goes out as a single frame
+            const std::vector<input_event>& pressEvents() const;
+            const std::vector<input_event>& releaseEvents() const;
         protected:
             std::vector<uint> _keys;
+            std::vector<input_event> _press_events;
+            std::vector<input_event> _release_events;
         };
     protected:
         Config _config;
@@ -25,12 +25,12 @@ using namespace logid::backend;
 
 ToggleHiresScroll::ToggleHiresScroll(Device *dev) : Action (dev)
 {
-    _hires_scroll = _device->getFeature<features::HiresScroll>("hiresscroll");
+    _hires_scroll = _device->getFeature<features::HiresScroll>();
     if(!_hires_scroll)
         logPrintf(WARN, "%s:%d: HiresScroll feature not found, cannot use "
                         "ToggleHiresScroll action.",
                   _device->hidpp20().devicePath().c_str(),
-                  _device->hidpp20().devicePath().c_str());
+                  _device->hidpp20().deviceIndex());
 }
 
 void ToggleHiresScroll::press()
@@ -38,10 +38,8 @@ void ToggleHiresScroll::press()
     _pressed = true;
     if(_hires_scroll)
     {
-        task::spawn([hires=this->_hires_scroll](){
-            auto mode = hires->getMode();
-            mode ^= backend::hidpp20::HiresScroll::HiRes;
-            hires->setMode(mode);
+        task::spawn(task::Interactive, [hires=this->_hires_scroll](){
+            hires->toggleMode(backend::hidpp20::HiresScroll::HiRes);
         });
     }
 }
@@ -25,7 +25,7 @@ using namespace logid::backend;
 
 ToggleSmartShift::ToggleSmartShift(Device *dev) : Action (dev)
 {
-    _smartshift = _device->getFeature<features::SmartShift>("smartshift");
+    _smartshift = _device->getFeature<features::SmartShift>();
     if(!_smartshift)
         logPrintf(WARN, "%s:%d: SmartShift feature not found, cannot use "
                         "ToggleSmartShift action.",
@@ -37,11 +37,8 @@ void ToggleSmartShift::press()
 {
     _pressed = true;
     if(_smartshift) {
-        task::spawn([ss=this->_smartshift](){
-            auto status = ss->getStatus();
-            status.setActive = true;
-            status.active = !status.active;
-            ss->setStatus(status);
+        task::spawn(task::Interactive, [ss=this->_smartshift](){
+            ss->toggleActive();
         });
     }
 }
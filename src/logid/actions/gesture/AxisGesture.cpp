@@ -15,7 +15,6 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  *
  */
-#include <cmath>
 #include "AxisGesture.h"
 #include "../../InputDevice.h"
 #include "../../util/log.h"
@@ -23,15 +22,18 @@
 using namespace logid::actions;
 
 AxisGesture::AxisGesture(Device *device, libconfig::Setting &root) :
-    Gesture (device), _config (device, root)
+    Gesture (device, Axis), _config (device, root),
+    _lowres_accumulator (1, 120, axis_accumulator::Nearest)
 {
+    _hires_accumulator.setMultiplier(_config.multiplier(), _gainScale());
 }
 
 void AxisGesture::press(bool init_threshold)
 {
     _axis = init_threshold ? _config.threshold() : 0;
-    _axis_remainder = 0;
-    _hires_remainder = 0;
+    _hires_accumulator.reset();
+    _lowres_accumulator.reset();
+    _last_move = {};
 }
 
 void AxisGesture::release(bool primary)
@@ -44,44 +46,31 @@ void AxisGesture::move(int16_t axis)
 {
     int16_t new_axis = _axis+axis;
     int low_res_axis = InputDevice::getLowResAxis(_config.axis());
-    int hires_remainder = _hires_remainder;
+
+    // The gain follows the time since the last report
+    uint32_t gain = 1;
+    auto& acceleration = _config.acceleration();
+    if(!acceleration.flat()) {
+        auto now = std::chrono::steady_clock::now();
+        gain = acceleration.gain(accel_curve::speed(axis, now - _last_move));
+        _last_move = now;
+    }
 
     if(new_axis > _config.threshold()) {
-        double move = axis;
+        int move = axis;
         if(_axis < _config.threshold())
             move = new_axis - _config.threshold();
-        bool negative_multiplier = _config.multiplier() < 0;
-        if(negative_multiplier)
-            move *= -_config.multiplier();
-        else
-            move *= _config.multiplier();
-
-        double move_floor = floor(move);
-        _axis_remainder = move - move_floor;
-        if(_axis_remainder >= 1) {
-            double int_remainder = floor(_axis_remainder);
-            move_floor += int_remainder;
-            _axis_remainder -= int_remainder;
-        }
+        move *= gain;
 
-        if(negative_multiplier)
-            move_floor = -move_floor;
-
-        if(low_res_axis != -1) {
-            int lowres_movement = 0, hires_movement = move_floor;
+        int hires_movement = _hires_accumulator.feed(move);
+        if(hires_movement) {
             virtual_input->moveAxis(_config.axis(), hires_movement);
-            hires_remainder += hires_movement;
-            if(abs(hires_remainder) >= 60) {
-                lowres_movement = hires_remainder/120;
-                if(lowres_movement == 0)
-                    lowres_movement = hires_remainder > 0 ? 1 : -1;
-                hires_remainder -= lowres_movement*120;
-                virtual_input->moveAxis(low_res_axis, lowres_movement);
+            if(low_res_axis != -1) {
+                int lowres_movement = _lowres_accumulator.feed(
+                        hires_movement);
+                if(lowres_movement)
+                    virtual_input->moveAxis(low_res_axis, lowres_movement);
             }
-
-            _hires_remainder = hires_remainder;
-        } else {
-            virtual_input->moveAxis(_config.axis(), move_floor);
         }
     }
     _axis = new_axis;
@@ -92,9 +81,17 @@ bool AxisGesture::metThreshold() const
     return _axis >= _config.threshold();
 }
 
-void AxisGesture::setHiresMultiplier(double multiplier)
+void AxisGesture::setHiresMultiplier(int multiplier)
 {
     _config.setHiresMultiplier(multiplier);
+    _hires_accumulator.setMultiplier(_config.multiplier(),
+                                     _config.hiresMultiplier() * _gainScale());
+}
+
+int64_t AxisGesture::_gainScale() const
+{
+    return _config.acceleration().flat() ? 1 :
+        1 << LOGID_ACCEL_FRACTION_BITS;
 }
 
 AxisGesture::Config::Config(Device *device, libconfig::Setting &setting) :
@@ -106,7 +103,7 @@ AxisGesture::Config::Config(Device *device, libconfig::Setting &setting) :
             _axis = axis;
         } else if(axis.getType() == libconfig::Setting::TypeString) {
             try {
-                _axis = virtual_input->toAxisCode(axis);
+                _axis = InputDevice::toAxisCode(axis);
             } catch(InputDevice::InvalidEventCode& e) {
                 logPrintf(WARN, "Line %d: Invalid axis %s, skipping."
                         , axis.getSourceLine(), axis.c_str());
@@ -138,6 +135,39 @@ AxisGesture::Config::Config(Device *device, libconfig::Setting &setting) :
         // Ignore
     }
 
+    /* A list of [speed, gain] pairs, speeds in input units per second,
+     * e.g. acceleration: [[0, 1.0], [500, 1.0], [2000, 4.0]]; */
+    try {
+        auto& acceleration = setting.lookup("acceleration");
+        std::vector<std::pair<double, double>> points;
+        bool valid = acceleration.isList() || acceleration.isArray();
+        for(int i = 0; valid && i < acceleration.getLength(); i++) {
+            auto& point = acceleration[i];
+            valid = (point.isArray() || point.isList()) &&
+                    point.getLength() == 2 && point[0].isNumber() &&
+                    point[1].isNumber();
+            if(!valid)
+                break;
+            double speed = point[0].getType() ==
+                    libconfig::Setting::TypeFloat ? (double)point[0] :
+                    (int)point[0];
+            double gain = point[1].getType() ==
+                    libconfig::Setting::TypeFloat ? (double)point[1] :
+                    (int)point[1];
+            valid = speed >= 0 && gain >= 0 &&
+                    (points.empty() || speed > points.back().first);
+            points.emplace_back(speed, gain);
+        }
+        if(valid)
+            _acceleration = accel_curve(points);
+        else
+            logPrintf(WARN, "Line %d: acceleration must be a list of "
+                            "[speed, gain] pairs with rising speeds, "
+                            "ignoring.", acceleration.getSourceLine());
+    } catch(libconfig::SettingNotFoundException& e) {
+        // Ignore
+    }
+
     if(InputDevice::getLowResAxis(_axis) != -1)
         _multiplier *= 120;
 }
@@ -152,20 +182,26 @@ double AxisGesture::Config::multiplier() const
     return _multiplier;
 }
 
+int AxisGesture::Config::hiresMultiplier() const
+{
+    return _hires_multiplier;
+}
+
+const logid::accel_curve& AxisGesture::Config::acceleration() const
+{
+    return _acceleration;
+}
+
 bool AxisGesture::wheelCompatibility() const
 {
     return true;
 }
 
-void AxisGesture::Config::setHiresMultiplier(double multiplier)
+void AxisGesture::Config::setHiresMultiplier(int multiplier)
 {
-    if(_hires_multiplier == multiplier || multiplier == 0)
+    // Only axes with a low-res counterpart are reported in hi-res units
+    if(multiplier <= 0 || InputDevice::getLowResAxis(_axis) == -1)
         return;
 
-    if(InputDevice::getLowResAxis(_axis) != -1) {
-        _multiplier *= _hires_multiplier;
-        _multiplier /= multiplier;
-    }
-
     _hires_multiplier = multiplier;
 }
\ No newline at end of file
@@ -18,12 +18,15 @@
 #ifndef LOGID_ACTION_AXISGESTURE_H
 #define LOGID_ACTION_AXISGESTURE_H
 
+#include <chrono>
 #include "Gesture.h"
+#include "../../util/accel_curve.h"
+#include "../../util/axis_accumulator.h"
 
 namespace logid {
     namespace actions
     {
-        class AxisGesture : public Gesture
+        class AxisGesture final : public Gesture
         {
         public:
             AxisGesture(Device* device, libconfig::Setting& root);
@@ -35,7 +38,7 @@ namespace logid {
             virtual bool wheelCompatibility() const;
             virtual bool metThreshold() const;
 
-            void setHiresMultiplier(double multiplier);
+            void setHiresMultiplier(int multiplier);
 
             class Config : public Gesture::Config
             {
@@ -43,18 +46,27 @@ namespace logid {
                 Config(Device* device, libconfig::Setting& setting);
                 unsigned int axis() const;
                 double multiplier() const;
-                void setHiresMultiplier(double multiplier);
+                int hiresMultiplier() const;
+                void setHiresMultiplier(int multiplier);
+                // Gain by speed of the input, flat if not configured
+                const accel_curve& acceleration() const;
             private:
                 unsigned int _axis;
                 double _multiplier = 1;
-                double _hires_multiplier = 1;
+                int _hires_multiplier = 1;
+                accel_curve _acceleration;
             };
 
         protected:
+            // Movement is scaled by a gain with fractional bits if accelerated
+            int64_t _gainScale() const;
+
             int16_t _axis;
-            double _axis_remainder;
-            int _hires_remainder;
             Config _config;
+            std::chrono::steady_clock::time_point _last_move;
+            // Device units to hi-res units, then hi-res units to detents
+            axis_accumulator _hires_accumulator;
+            axis_accumulator _lowres_accumulator;
         };
     }}
 
@@ -18,6 +18,7 @@
 
 #include <algorithm>
 #include "Gesture.h"
+#include "../../util/arena.h"
 #include "../../util/log.h"
 #include "ReleaseGesture.h"
 #include "ThresholdGesture.h"
@@ -28,7 +29,7 @@
 
 using namespace logid::actions;
 
-Gesture::Gesture(Device *device) : _device (device)
+Gesture::Gesture(Device *device, Type type) : _device (device), _type (type)
 {
 }
 
@@ -82,31 +83,31 @@ std::shared_ptr<Gesture> Gesture::makeGesture(Device *device,
             logPrintf(WARN, "Line %d: Gesture mode must be a string,"
                             "defaulting to OnRelease.",
                       gesture_mode.getSourceLine());
-            return std::make_shared<ReleaseGesture>(device, setting);
+            return arena::make<ReleaseGesture>(device, setting);
         }
 
         std::string type = gesture_mode;
         std::transform(type.begin(), type.end(), type.begin(), ::tolower);
 
         if(type == "onrelease")
-            return std::make_shared<ReleaseGesture>(device, setting);
+            return arena::make<ReleaseGesture>(device, setting);
         else if(type == "onthreshold")
-            return std::make_shared<ThresholdGesture>(device, setting);
+            return arena::make<ThresholdGesture>(device, setting);
         else if(type == "oninterval" || type == "onfewpixels")
-            return std::make_shared<IntervalGesture>(device, setting);
+            return arena::make<IntervalGesture>(device, setting);
         else if(type == "axis")
-            return std::make_shared<AxisGesture>(device, setting);
+            return arena::make<AxisGesture>(device, setting);
         else if(type == "nopress")
-            return std::make_shared<NullGesture>(device, setting);
+            return arena::make<NullGesture>(device, setting);
         else {
             logPrintf(WARN, "Line %d: Unknown gesture mode %s, defaulting to "
                             "OnRelease.", gesture_mode.getSourceLine(),
                       (const char*)gesture_mode);
-            return std::make_shared<ReleaseGesture>(device, setting);
+            return arena::make<ReleaseGesture>(device, setting);
         }
 
     } catch(libconfig::SettingNotFoundException& e) {
-        return std::make_shared<ReleaseGesture>(device, setting);
+        return arena::make<ReleaseGesture>(device, setting);
     }
 }
 
@@ -42,9 +42,30 @@ namespace actions
     class Gesture
     {
     public:
+        /* The set of gestures is closed, GestureAction moves them through
+         * a switch on this so that the per report calls are direct. */
+        enum Type
+        {
+            Axis,
+            Interval,
+            Release,
+            Threshold,
+            Null
+        };
+        Type type() const
+        {
+            return _type;
+        }
+
         virtual void press(bool init_threshold=false) = 0;
         virtual void release(bool primary=false) = 0;
         virtual void move(int16_t axis) = 0;
+        /* Called once an early committing GestureAction is sure of the
+         * direction. Gestures that fire once fire now instead of on
+         * release, others keep following the movement. */
+        virtual void commit()
+        {
+        }
 
         virtual bool wheelCompatibility() const = 0;
         virtual bool metThreshold() const = 0;
@@ -66,8 +87,10 @@ namespace actions
                 libconfig::Setting& setting);
 
     protected:
-        explicit Gesture(Device* device);
+        Gesture(Device* device, Type type);
         Device* _device;
+    private:
+        const Type _type;
     };
 }}
 
@@ -15,20 +15,22 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  *
  */
+#include <algorithm>
 #include "IntervalGesture.h"
 #include "../../util/log.h"
 
 using namespace logid::actions;
 
 IntervalGesture::IntervalGesture(Device *device, libconfig::Setting &root) :
-    Gesture (device), _config (device, root)
+    Gesture (device, Interval), _config (device, root),
+    _intervals (1, _config.interval(), axis_accumulator::Floor)
 {
 }
 
 void IntervalGesture::press(bool init_threshold)
 {
     _axis = init_threshold ? _config.threshold() : 0;
-    _interval_pass_count = 0;
+    _intervals.reset();
 }
 
 void IntervalGesture::release(bool primary)
@@ -39,17 +41,14 @@ void IntervalGesture::release(bool primary)
 
 void IntervalGesture::move(int16_t axis)
 {
+    int old_axis = std::max(_axis - _config.threshold(), 0);
     _axis += axis;
-    if(_axis < _config.threshold())
-        return;
+    int new_axis = std::max(_axis - _config.threshold(), 0);
 
-    int16_t new_interval_count = (_axis - _config.threshold())/
-            _config.interval();
-    if(new_interval_count > _interval_pass_count) {
+    for(int i = _intervals.feed(new_axis - old_axis); i > 0; i--) {
         _config.action()->press();
         _config.action()->release();
     }
-    _interval_pass_count = new_interval_count;
 }
 
 bool IntervalGesture::wheelCompatibility() const
@@ -86,8 +85,15 @@ IntervalGesture::Config::Config(Device *device, libconfig::Setting &setting) :
         } catch(libconfig::SettingNotFoundException& e) {
             logPrintf(WARN, "Line %d: interval is a required field, skipping.",
                       setting.getSourceLine());
+            throw InvalidGesture();
         }
     }
+
+    if(_interval <= 0) {
+        logPrintf(WARN, "Line %d: interval must be positive, skipping.",
+                  setting.getSourceLine());
+        throw InvalidGesture();
+    }
 }
 
 int16_t IntervalGesture::Config::interval() const
@@ -19,11 +19,12 @@
 #define LOGID_ACTION_INTERVALGESTURE_H
 
 #include "Gesture.h"
+#include "../../util/axis_accumulator.h"
 
 namespace logid {
 namespace actions
 {
-    class IntervalGesture : public Gesture
+    class IntervalGesture final : public Gesture
     {
     public:
         IntervalGesture(Device* device, libconfig::Setting& root);
@@ -41,13 +42,14 @@ namespace actions
             Config(Device* device, libconfig::Setting& setting);
             int16_t interval() const;
         private:
-            int16_t _interval;
+            int16_t _interval = 0;
         };
 
     protected:
         int16_t _axis;
-        int16_t _interval_pass_count;
         Config _config;
+        // Counts intervals passed beyond the threshold
+        axis_accumulator _intervals;
     };
 }}
 
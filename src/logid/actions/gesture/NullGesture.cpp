@@ -20,7 +20,7 @@
 using namespace logid::actions;
 
 NullGesture::NullGesture(Device *device, libconfig::Setting& setting) :
-    Gesture (device), _config (device, setting, false)
+    Gesture (device, Null), _config (device, setting, false)
 {
 }
 
@@ -23,7 +23,7 @@
 namespace logid {
 namespace actions
 {
-    class NullGesture : public Gesture
+    class NullGesture final : public Gesture
     {
     public:
         NullGesture(Device* device, libconfig::Setting& setting);
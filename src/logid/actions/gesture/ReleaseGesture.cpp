@@ -20,21 +20,20 @@
 using namespace logid::actions;
 
 ReleaseGesture::ReleaseGesture(Device *device, libconfig::Setting &root) :
-    Gesture (device), _config (device, root)
+    Gesture (device, Release), _config (device, root)
 {
 }
 
 void ReleaseGesture::press(bool init_threshold)
 {
     _axis = init_threshold ? _config.threshold() : 0;
+    _fired = false;
 }
 
 void ReleaseGesture::release(bool primary)
 {
-    if(metThreshold() && primary) {
-        _config.action()->press();
-        _config.action()->release();
-    }
+    if(metThreshold() && primary)
+        _fire();
 }
 
 void ReleaseGesture::move(int16_t axis)
@@ -42,6 +41,21 @@ void ReleaseGesture::move(int16_t axis)
     _axis += axis;
 }
 
+void ReleaseGesture::commit()
+{
+    if(metThreshold())
+        _fire();
+}
+
+void ReleaseGesture::_fire()
+{
+    if(_fired)
+        return;
+    _fired = true;
+    _config.action()->press();
+    _config.action()->release();
+}
+
 bool ReleaseGesture::wheelCompatibility() const
 {
     return false;
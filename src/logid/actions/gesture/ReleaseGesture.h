@@ -23,7 +23,7 @@
 namespace logid {
 namespace actions
 {
-    class ReleaseGesture : public Gesture
+    class ReleaseGesture final : public Gesture
     {
     public:
         ReleaseGesture(Device* device, libconfig::Setting& root);
@@ -31,12 +31,17 @@ namespace actions
         virtual void press(bool init_threshold=false);
         virtual void release(bool primary=false);
         virtual void move(int16_t axis);
+        virtual void commit();
 
         virtual bool wheelCompatibility() const;
         virtual bool metThreshold() const;
 
     protected:
+        void _fire();
+
         int16_t _axis;
+        // Fired on commit, so release does not fire again
+        bool _fired = false;
         Gesture::Config _config;
     };
 }}
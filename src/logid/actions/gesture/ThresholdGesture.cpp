@@ -20,7 +20,7 @@
 using namespace logid::actions;
 
 ThresholdGesture::ThresholdGesture(Device *device, libconfig::Setting &root) :
-    Gesture (device), _config (device, root)
+    Gesture (device, Threshold), _config (device, root)
 {
 }
 
@@ -23,7 +23,7 @@
 namespace logid {
 namespace actions
 {
-    class ThresholdGesture : public Gesture
+    class ThresholdGesture final : public Gesture
     {
     public:
         ThresholdGesture(Device* device, libconfig::Setting& root);
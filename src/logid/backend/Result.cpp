@@ -0,0 +1,47 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "Result.h"
+#include "Error.h"
+#include "hidpp/Device.h"
+#include "hidpp10/Error.h"
+#include "hidpp20/Error.h"
+#include "hidpp20/Feature.h"
+
+using namespace logid::backend;
+
+void Failure::raise() const
+{
+    switch(_kind) {
+    case Timeout:
+        throw TimeoutError();
+    case Hidpp10Error:
+        throw hidpp10::Error(_code);
+    case Hidpp20Error:
+        throw hidpp20::Error(_code);
+    case UnsupportedFeature:
+        throw hidpp20::UnsupportedFeature(_code);
+    case InvalidDevice:
+        throw hidpp::Device::InvalidDevice(
+                static_cast<hidpp::Device::InvalidDevice::Reason>(_code));
+    default:
+        // Results without a value always carry a failure
+        assert(false);
+        throw std::logic_error("Result has no value");
+    }
+}
@@ -0,0 +1,220 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_BACKEND_RESULT_H
+#define LOGID_BACKEND_RESULT_H
+
+#include <cassert>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace logid {
+namespace backend {
+    /* Why a request failed. Probing and configuring fail often enough
+     * (asleep devices, HID++ 1.0 probes, missing features) that they use
+     * these instead of exceptions, the throwing API is built on top.
+     */
+    class Failure
+    {
+    public:
+        enum Kind : uint8_t
+        {
+            None,
+            Timeout,
+            Hidpp10Error,
+            Hidpp20Error,
+            UnsupportedFeature,
+            InvalidDevice
+        };
+
+        Failure() : _kind (None), _code (0)
+        {
+        }
+
+        // code is the error code, feature ID or InvalidDevice::Reason
+        Failure(Kind kind, uint16_t code) : _kind (kind), _code (code)
+        {
+        }
+
+        Kind kind() const noexcept
+        {
+            return _kind;
+        }
+
+        uint16_t code() const noexcept
+        {
+            return _code;
+        }
+
+        bool is(Kind kind, uint16_t code) const noexcept
+        {
+            return _kind == kind && _code == code;
+        }
+
+        explicit operator bool() const noexcept
+        {
+            return _kind != None;
+        }
+
+        // Throws what the throwing API throws for this failure
+        [[noreturn]] void raise() const;
+    private:
+        Kind _kind;
+        uint16_t _code;
+    };
+
+    template<typename T>
+    class Result
+    {
+    public:
+        Result(T value) : _ok (true)
+        {
+            new (&_value) T(std::move(value));
+        }
+
+        Result(Failure failure) : _ok (false), _failure (failure)
+        {
+            assert(failure);
+        }
+
+        Result(const Result& other) : _ok (other._ok),
+            _failure (other._failure)
+        {
+            if(_ok)
+                new (&_value) T(*other._get());
+        }
+
+        Result(Result&& other) noexcept(
+                std::is_nothrow_move_constructible<T>::value) :
+            _ok (other._ok), _failure (other._failure)
+        {
+            if(_ok)
+                new (&_value) T(std::move(*other._get()));
+        }
+
+        Result& operator=(Result other)
+        {
+            if(_ok)
+                _get()->~T();
+            _ok = other._ok;
+            _failure = other._failure;
+            if(_ok)
+                new (&_value) T(std::move(*other._get()));
+            return *this;
+        }
+
+        ~Result()
+        {
+            if(_ok)
+                _get()->~T();
+        }
+
+        bool ok() const noexcept
+        {
+            return _ok;
+        }
+
+        explicit operator bool() const noexcept
+        {
+            return _ok;
+        }
+
+        const Failure& failure() const noexcept
+        {
+            return _failure;
+        }
+
+        // Raises the failure if there is no value
+        T& value()
+        {
+            if(!_ok)
+                _failure.raise();
+            return *_get();
+        }
+
+        T& operator*()
+        {
+            assert(_ok);
+            return *_get();
+        }
+
+        T* operator->()
+        {
+            assert(_ok);
+            return _get();
+        }
+    private:
+        T* _get()
+        {
+            return reinterpret_cast<T*>(&_value);
+        }
+
+        const T* _get() const
+        {
+            return reinterpret_cast<const T*>(&_value);
+        }
+
+        bool _ok;
+        Failure _failure;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type _value;
+    };
+
+    template<>
+    class Result<void>
+    {
+    public:
+        Result() = default;
+
+        Result(Failure failure) : _failure (failure)
+        {
+        }
+
+        // Keeps only whether a request succeeded
+        template<typename T>
+        Result(const Result<T>& other) : _failure (other.failure())
+        {
+        }
+
+        bool ok() const noexcept
+        {
+            return !_failure;
+        }
+
+        explicit operator bool() const noexcept
+        {
+            return ok();
+        }
+
+        const Failure& failure() const noexcept
+        {
+            return _failure;
+        }
+
+        void value() const
+        {
+            if(_failure)
+                _failure.raise();
+        }
+    private:
+        Failure _failure;
+    };
+}}
+
+#endif //LOGID_BACKEND_RESULT_H
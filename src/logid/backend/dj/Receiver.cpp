@@ -45,11 +45,25 @@ InvalidReceiver::Reason InvalidReceiver::code() const noexcept
 }
 
 Receiver::Receiver(std::string path) :
-    _raw_device (std::make_shared<raw::RawDevice>(std::move(path))),
+    Receiver(std::make_shared<raw::RawDevice>(std::move(path)))
+{
+}
+
+Receiver::Receiver(std::shared_ptr<raw::RawDevice> raw_device) :
+    _raw_device (std::move(raw_device)),
     _hidpp10_device (_raw_device, hidpp::DefaultDevice)
 {
     if(!supportsDjReports(_raw_device->reportDescriptor()))
         throw InvalidReceiver(InvalidReceiver::NoDJReports);
+
+    for(auto& link : _links)
+        link = Link::Unknown;
+
+    /* Only our writes change the notification flags, the connection state
+     * changes with every (dis)connection and is dropped in _updateSlot.
+     * Pairing info is kept parsed per slot instead. */
+    _hidpp10_device.cacheRegister(EnableHidppNotifications, true);
+    _hidpp10_device.cacheRegister(ConnectionState);
 }
 
 void Receiver::enumerateDj()
@@ -152,9 +166,32 @@ std::map<hidpp::DeviceIndex, uint8_t> Receiver::getDeviceActivity()
     return device_activity;
 }
 
+Receiver::Link Receiver::link(hidpp::DeviceIndex index) const
+{
+    if(!_isSlot(index))
+        return Link::Unknown;
+    return _links[index].load(std::memory_order_relaxed);
+}
+
+void Receiver::linkActive(hidpp::DeviceIndex index)
+{
+    // Called for every report, only write when the link was lost
+    if(link(index) == Link::Lost)
+        _links[index] = Link::Established;
+}
+
 struct Receiver::PairingInfo
     Receiver::getPairingInfo(hidpp::DeviceIndex index)
 {
+    uint32_t generation = 0;
+    if(_isSlot(index)) {
+        std::lock_guard<std::mutex> lock(_slots_lock);
+        auto& slot = _slots[index];
+        if(slot.has_pairing)
+            return slot.pairing;
+        generation = slot.generation;
+    }
+
     std::vector<uint8_t> request(1);
     request[0] = index;
     request[0] += 0x1f;
@@ -169,12 +206,30 @@ struct Receiver::PairingInfo
     info.pid |= (response[3] << 8);
     info.deviceType = static_cast<DeviceType::DeviceType>(response[7]);
 
+    if(_isSlot(index)) {
+        std::lock_guard<std::mutex> lock(_slots_lock);
+        auto& slot = _slots[index];
+        if(slot.generation == generation) {
+            slot.pairing = info;
+            slot.has_pairing = true;
+        }
+    }
+
     return info;
 }
 
 struct Receiver::ExtendedPairingInfo
     Receiver::getExtendedPairingInfo(hidpp::DeviceIndex index)
 {
+    uint32_t generation = 0;
+    if(_isSlot(index)) {
+        std::lock_guard<std::mutex> lock(_slots_lock);
+        auto& slot = _slots[index];
+        if(slot.has_extended_pairing)
+            return slot.extended_pairing;
+        generation = slot.generation;
+    }
+
     std::vector<uint8_t> request(1);
     request[0] = index;
     request[0] += 0x2f;
@@ -197,11 +252,29 @@ struct Receiver::ExtendedPairingInfo
     else
         info.powerSwitchLocation = static_cast<PowerSwitchLocation>(psl);
 
+    if(_isSlot(index)) {
+        std::lock_guard<std::mutex> lock(_slots_lock);
+        auto& slot = _slots[index];
+        if(slot.generation == generation) {
+            slot.extended_pairing = info;
+            slot.has_extended_pairing = true;
+        }
+    }
+
     return info;
 }
 
 std::string Receiver::getDeviceName(hidpp::DeviceIndex index)
 {
+    uint32_t generation = 0;
+    if(_isSlot(index)) {
+        std::lock_guard<std::mutex> lock(_slots_lock);
+        auto& slot = _slots[index];
+        if(slot.has_name)
+            return slot.name;
+        generation = slot.generation;
+    }
+
     std::vector<uint8_t> request(1);
     request[0] = index;
     request[0] += 0x3f;
@@ -216,6 +289,15 @@ std::string Receiver::getDeviceName(hidpp::DeviceIndex index)
     for(std::size_t i = 0; i < size; i++)
         name[i] = response[i + 2];
 
+    if(_isSlot(index)) {
+        std::lock_guard<std::mutex> lock(_slots_lock);
+        auto& slot = _slots[index];
+        if(slot.generation == generation) {
+            slot.name = name;
+            slot.has_name = true;
+        }
+    }
+
     return name;
 }
 
@@ -259,11 +341,67 @@ void Receiver::_handleDjEvent(Report& report)
 
 void Receiver::_handleHidppEvent(hidpp::Report &report)
 {
+    _updateSlot(report);
+
     for(auto& handler : _hidpp_event_handlers)
         if(handler.second->condition(report))
             handler.second->callback(report);
 }
 
+bool Receiver::isKnownReceiver(uint16_t pid)
+{
+    switch(pid) {
+    case 0xc52b: // Unifying
+    case 0xc532:
+    case 0xc534: // Nano
+    case 0xc539: // Lightspeed
+    case 0xc53a:
+    case 0xc53d:
+    case 0xc53f:
+    case 0xc541:
+    case 0xc545:
+    case 0xc547:
+    case 0xc548: // Bolt
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool Receiver::_isSlot(hidpp::DeviceIndex index)
+{
+    return index >= hidpp::WirelessDevice1 && index <= hidpp::WirelessDevice6;
+}
+
+void Receiver::_updateSlot(hidpp::Report& report)
+{
+    auto index = report.deviceIndex();
+    if(!_isSlot(index) || (report.subId() != DeviceConnection &&
+            report.subId() != DeviceDisconnection))
+        return;
+
+    // Before any handler runs, it may talk to the device straight away
+    if(report.subId() == DeviceConnection)
+        _links[index] = deviceConnectionEvent(report).linkEstablished ?
+                Link::Established : Link::Lost;
+    else
+        _links[index] = Link::Unknown;
+    _hidpp10_device.invalidateRegister(ConnectionState);
+
+    std::lock_guard<std::mutex> lock(_slots_lock);
+    auto& slot = _slots[index];
+    // A connection from the device that is paired keeps the slot
+    if(report.subId() == DeviceConnection && (!slot.has_pairing ||
+            slot.pairing.pid == deviceConnectionEvent(report).pid))
+        return;
+
+    slot.generation++;
+    slot.has_pairing = false;
+    slot.has_extended_pairing = false;
+    slot.has_name = false;
+    slot.name.clear();
+}
+
 void Receiver::addDjEventHandler(const std::string& nickname,
         const std::shared_ptr<EventHandler>& handler)
 {
@@ -329,8 +467,7 @@ void Receiver::listen()
     if(!_raw_device->isListening())
         _raw_device->listenAsync();
 
-    if(_raw_device->eventHandlers().find("RECV_HIDPP") ==
-        _raw_device->eventHandlers().end()) {
+    if(!_raw_device->eventHandlers().count("RECV_HIDPP")) {
         // Pass all HID++ events on DefaultDevice to handleHidppEvent
         std::shared_ptr<raw::RawEventHandler> hidpp_handler =
                 std::make_shared<raw::RawEventHandler>();
@@ -347,8 +484,7 @@ void Receiver::listen()
         _raw_device->addEventHandler("RECV_HIDPP", hidpp_handler);
     }
 
-    if(_raw_device->eventHandlers().find("RECV_DJ") ==
-       _raw_device->eventHandlers().end()) {
+    if(!_raw_device->eventHandlers().count("RECV_DJ")) {
         // Pass all DJ events with device index to handleDjEvent
         std::shared_ptr<raw::RawEventHandler> dj_handler =
                 std::make_shared<raw::RawEventHandler>();
@@ -371,7 +507,7 @@ void Receiver::stopListening()
     _raw_device->removeEventHandler("RECV_HIDPP");
     _raw_device->removeEventHandler("RECV_DJ");
 
-    if(_raw_device->eventHandlers().empty())
+    if(!_raw_device->hasEventHandlers())
         _raw_device->stopListener();
 }
 
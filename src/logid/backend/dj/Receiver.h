@@ -19,7 +19,10 @@
 #ifndef LOGID_BACKEND_DJ_RECEIVER_H
 #define LOGID_BACKEND_DJ_RECEIVER_H
 
+#include <array>
+#include <atomic>
 #include <cstdint>
+#include <mutex>
 #include "../raw/RawDevice.h"
 #include "Report.h"
 #include "../hidpp/Report.h"
@@ -53,6 +56,7 @@ namespace dj
     {
     public:
         explicit Receiver(std::string path);
+        explicit Receiver(std::shared_ptr<raw::RawDevice> raw_device);
 
         enum DjEvents : uint8_t
         {
@@ -118,6 +122,18 @@ namespace dj
 
         std::map<hidpp::DeviceIndex, uint8_t> getDeviceActivity();
 
+        enum class Link : uint8_t
+        {
+            Unknown,
+            Established,
+            Lost
+        };
+        /* Link state of a slot as the receiver last reported it. Requests
+         * to a device whose link is lost fail without waiting for a
+         * timeout, any report from the device shows it is up again. */
+        Link link(hidpp::DeviceIndex index) const;
+        void linkActive(hidpp::DeviceIndex index);
+
         struct PairingInfo
         {
             uint8_t destinationId;
@@ -150,12 +166,19 @@ namespace dj
             PowerSwitchLocation powerSwitchLocation;
         };
 
+        /* Pairing info and device names only change when a slot is
+         * paired, they are read once per slot and then served from the
+         * slot table. */
         struct PairingInfo getPairingInfo(hidpp::DeviceIndex index);
         struct ExtendedPairingInfo getExtendedPairingInfo(hidpp::DeviceIndex
                 index);
 
         std::string getDeviceName(hidpp::DeviceIndex index);
 
+        /* Unifying, Nano, Lightspeed and Bolt receivers by Logitech PID,
+         * these need no probe to tell them from devices. */
+        static bool isKnownReceiver(uint16_t pid);
+
         static hidpp::DeviceIndex deviceDisconnectionEvent(
                 const hidpp::Report& report);
         static hidpp::DeviceConnectionEvent deviceConnectionEvent(
@@ -184,6 +207,27 @@ namespace dj
         void _handleDjEvent(dj::Report& report);
         void _handleHidppEvent(hidpp::Report& report);
 
+        struct Slot
+        {
+            // Bumped whenever the slot is invalidated
+            uint32_t generation = 0;
+            bool has_pairing = false;
+            struct PairingInfo pairing {};
+            bool has_extended_pairing = false;
+            struct ExtendedPairingInfo extended_pairing {};
+            bool has_name = false;
+            std::string name;
+        };
+
+        static bool _isSlot(hidpp::DeviceIndex index);
+        // Drops slots that were unpaired or paired to another device
+        void _updateSlot(hidpp::Report& report);
+
+        std::mutex _slots_lock;
+        std::array<Slot, hidpp::WirelessDevice6 + 1> _slots;
+        // Link of each slot, read on every request
+        std::array<std::atomic<Link>, hidpp::WirelessDevice6 + 1> _links;
+
         std::map<std::string, std::shared_ptr<EventHandler>>
                 _dj_event_handlers;
         std::map<std::string, std::shared_ptr<hidpp::EventHandler>>
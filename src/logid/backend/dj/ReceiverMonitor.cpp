@@ -18,16 +18,31 @@
 
 #include "ReceiverMonitor.h"
 #include "../../util/task.h"
+#include "../../util/timer_wheel.h"
+#include "../../util/strand.h"
 #include "../../util/log.h"
 
 #include <utility>
 #include <cassert>
 
+#define LOGID_WAIT_DEVICE_RETRIES 5
+#define LOGID_WAIT_DEVICE_FALLBACK std::chrono::seconds(1)
+
 using namespace logid::backend::dj;
+using namespace logid;
+
+ReceiverMonitor::ReceiverMonitor(std::string path) : ReceiverMonitor(
+        std::make_shared<raw::RawDevice>(std::move(path)))
+{
+}
 
-ReceiverMonitor::ReceiverMonitor(std::string path) : _receiver (
-        std::make_shared<Receiver>(std::move(path)))
+ReceiverMonitor::ReceiverMonitor(std::shared_ptr<raw::RawDevice> raw_device) :
+    _receiver (std::make_shared<Receiver>(std::move(raw_device))),
+    _waiting (0), _idle (0)
 {
+    for(auto& slot : _events)
+        slot.executor = std::make_shared<strand>(task::Interactive);
+
     assert(_receiver->hidppEventHandlers().find("RECVMON") ==
         _receiver->hidppEventHandlers().end());
     assert(_receiver->djEventHandlers().find("RECVMON") ==
@@ -59,76 +74,242 @@ void ReceiverMonitor::run()
         };
 
         event_handler->callback = [this](hidpp::Report &report) -> void {
-            /* Running in a new thread prevents deadlocks since the
+            /* Running on a strand prevents deadlocks since the
              * receiver may be enumerating.
              */
-            task::spawn({[this, report]() {
-                if (report.subId() == Receiver::DeviceConnection)
-                    this->addDevice(this->_receiver->deviceConnectionEvent
-                    (report));
-                else if (report.subId() == Receiver::DeviceDisconnection)
-                    this->removeDevice(this->_receiver->
-                            deviceDisconnectionEvent(report));
-            }}, {[report, path=this->_receiver->rawDevice()->hidrawPath()]
-            (std::exception& e) {
-                if(report.subId() == Receiver::DeviceConnection)
-                    logPrintf(ERROR, "Failed to add device %d to receiver "
-                                      "on %s: %s", report.deviceIndex(),
-                                      path.c_str(), e.what());
-                else if(report.subId() == Receiver::DeviceDisconnection)
-                    logPrintf(ERROR, "Failed to remove device %d from "
-                                      "receiver on %s: %s", report.deviceIndex()
-                                      ,path.c_str(), e.what());
-            }});
+            _queueEvent(report);
         };
 
         _receiver->addHidppEventHandler("RECVMON", event_handler);
     }
 
+    if(!_receiver->rawDevice()->eventHandlers().count("RECVMON_WAIT")) {
+        auto wait_handler = std::make_shared<raw::RawEventHandler>();
+        wait_handler->condition = [this](std::vector<uint8_t>& report) {
+            auto index = report[Offset::DeviceIndex];
+            return index <= hidpp::WirelessDevice6 &&
+                (_waiting.load(std::memory_order_relaxed) & (1 << index));
+        };
+        wait_handler->callback = [this](std::vector<uint8_t>& report) {
+            _retryDevice(static_cast<hidpp::DeviceIndex>(
+                    report[Offset::DeviceIndex]));
+        };
+        _receiver->rawDevice()->addEventHandler("RECVMON_WAIT", wait_handler);
+    }
+
     enumerate();
 }
 
 void ReceiverMonitor::stop()
 {
     _receiver->removeHidppEventHandler("RECVMON");
+    _receiver->rawDevice()->removeEventHandler("RECVMON_WAIT");
+    for(uint8_t i = hidpp::WirelessDevice1; i <= hidpp::WirelessDevice6; i++)
+        _stopWaiting(static_cast<hidpp::DeviceIndex>(i));
 
     _receiver->stopListening();
 }
 
 void ReceiverMonitor::enumerate()
 {
+    uint8_t idle = 0;
+    try {
+        for(auto& slot : _receiver->getDeviceActivity()) {
+            if(!slot.second)
+                idle |= (1 << slot.first);
+        }
+    } catch(std::exception& e) {
+        // Receivers without the register initialize every linked slot
+        LOGID_LOG(DEBUG, "%s: could not read device activity: %s",
+                _receiver->rawDevice()->hidrawPath().c_str(), e.what());
+    }
+    _idle = idle;
+
     _receiver->enumerateHidpp();
 }
 
-void ReceiverMonitor::waitForDevice(hidpp::DeviceIndex index)
+void ReceiverMonitor::_queueEvent(const hidpp::Report& report)
 {
-    std::string nickname = "WAIT_DEV_" + std::to_string(index);
-    auto handler = std::make_shared<raw::RawEventHandler>();
-    handler->condition = [index](std::vector<uint8_t>& report)->bool {
-        return report[Offset::DeviceIndex] == index;
-    };
-
-    handler->callback = [this, index, nickname](std::vector<uint8_t>& report) {
-        (void)report; // Suppress unused warning
-
-        hidpp::DeviceConnectionEvent event{};
-        event.withPayload = false;
-        event.linkEstablished = true;
-        event.index = index;
-        event.fromTimeoutCheck = true;
-
-        task::spawn({[this, event, nickname]() {
-                _receiver->rawDevice()->removeEventHandler(nickname);
-                this->addDevice(event);
-        }}, {[path=_receiver->rawDevice()->hidrawPath(), event]
-        (std::exception& e) {
+    auto index = report.deviceIndex();
+    if(index < hidpp::WirelessDevice1 || index > hidpp::WirelessDevice6) {
+        task::spawn(task::Interactive, [this, report]() {
+            _handleEvent(report);
+        });
+        return;
+    }
+
+    std::shared_ptr<strand> slot_strand;
+    {
+        std::lock_guard<std::mutex> lock(_events_lock);
+        auto& slot = _events[index];
+        if(report.subId() == Receiver::DeviceDisconnection)
+            slot.pending.clear();
+        else if(!slot.pending.empty() &&
+                slot.pending.back().subId() == Receiver::DeviceConnection)
+            slot.pending.pop_back();
+        slot.pending.push_back(report);
+
+        if(slot.scheduled)
+            return;
+        slot.scheduled = true;
+        slot_strand = slot.executor;
+    }
+
+    slot_strand->post([this, index]() { _handleEvents(index); });
+}
+
+void ReceiverMonitor::_handleEvents(hidpp::DeviceIndex index)
+{
+    while(true) {
+        std::vector<hidpp::Report> next;
+        {
+            std::lock_guard<std::mutex> lock(_events_lock);
+            auto& slot = _events[index];
+            if(slot.pending.empty()) {
+                slot.scheduled = false;
+                return;
+            }
+            next.push_back(slot.pending.front());
+            slot.pending.erase(slot.pending.begin());
+        }
+
+        _handleEvent(next.front());
+    }
+}
+
+void ReceiverMonitor::_handleEvent(const hidpp::Report& report)
+{
+    try {
+        _stopWaiting(report.deviceIndex());
+        if(report.subId() == Receiver::DeviceConnection) {
+            auto event = _receiver->deviceConnectionEvent(report);
+            if(_deferIdle(event))
+                return;
+            this->addDevice(event);
+        } else if(report.subId() == Receiver::DeviceDisconnection) {
+            if(report.deviceIndex() <= hidpp::WirelessDevice6)
+                _idle &= ~(1 << report.deviceIndex());
+            this->removeDevice(_receiver->deviceDisconnectionEvent(report));
+        }
+    } catch(std::exception& e) {
+        auto path = _receiver->rawDevice()->hidrawPath();
+        if(report.subId() == Receiver::DeviceConnection)
             logPrintf(ERROR, "Failed to add device %d to receiver "
-                             "on %s: %s", event.index,
-                             path.c_str(), e.what());
-        }});
-    };
+                              "on %s: %s", report.deviceIndex(),
+                              path.c_str(), e.what());
+        else if(report.subId() == Receiver::DeviceDisconnection)
+            logPrintf(ERROR, "Failed to remove device %d from "
+                              "receiver on %s: %s", report.deviceIndex()
+                              ,path.c_str(), e.what());
+    }
+}
+
+bool ReceiverMonitor::_deferIdle(const hidpp::DeviceConnectionEvent& event)
+{
+    if(event.index < hidpp::WirelessDevice1 ||
+       event.index > hidpp::WirelessDevice6)
+        return false;
 
-    _receiver->rawDevice()->addEventHandler(nickname, handler);
+    // Only the first connection event after enumerating is deferred
+    uint8_t bit = 1 << event.index;
+    if(!(_idle.fetch_and(~bit) & bit) || !event.linkEstablished)
+        return false;
+
+    LOGID_LOG(DEBUG, "%s:%d had no activity, waiting for input from device "
+                     "to initialize.",
+              _receiver->rawDevice()->hidrawPath().c_str(), event.index);
+    waitForInput(event.index);
+    return true;
+}
+
+void ReceiverMonitor::waitForDevice(hidpp::DeviceIndex index)
+{
+    if(index < hidpp::WirelessDevice1 || index > hidpp::WirelessDevice6)
+        return;
+
+    std::lock_guard<std::mutex> lock(_wait_lock);
+    auto& wait = _wait[index];
+    if(wait.attempts >= LOGID_WAIT_DEVICE_RETRIES) {
+        logPrintf(WARN, "%s:%d did not respond after %d attempts, waiting "
+                        "for it to reconnect.",
+                  _receiver->rawDevice()->hidrawPath().c_str(), index,
+                  wait.attempts);
+        return;
+    }
+
+    auto delay = LOGID_WAIT_DEVICE_FALLBACK * (1 << wait.attempts);
+    wait.attempts++;
+    _receiver->rawDevice()->stats().add(metrics::Retries);
+    _waiting |= (1 << index);
+    wait.fallback = task::spawnAfter(
+            std::chrono::duration_cast<std::chrono::milliseconds>(delay),
+            [this, index]() { _retryDevice(index); },
+            [](std::exception& e) { ExceptionHandler::Default(e); },
+            task::Background);
+}
+
+void ReceiverMonitor::waitForInput(hidpp::DeviceIndex index)
+{
+    if(index < hidpp::WirelessDevice1 || index > hidpp::WirelessDevice6)
+        return;
+    _waiting |= (1 << index);
+}
+
+void ReceiverMonitor::_retryDevice(hidpp::DeviceIndex index)
+{
+    // Only the first report or the fallback timer retries
+    uint8_t bit = 1 << index;
+    if(!(_waiting.fetch_and(~bit) & bit))
+        return;
+
+    std::shared_ptr<strand> slot_strand;
+    {
+        std::lock_guard<std::mutex> lock(_events_lock);
+        slot_strand = _events[index].executor;
+    }
+    slot_strand->post([this, index]() { _addWaiting(index); });
+}
+
+void ReceiverMonitor::_addWaiting(hidpp::DeviceIndex index)
+{
+    std::shared_ptr<timer> fallback;
+    {
+        std::lock_guard<std::mutex> lock(_wait_lock);
+        fallback = std::move(_wait[index].fallback);
+    }
+    if(fallback)
+        fallback->cancel();
+
+    hidpp::DeviceConnectionEvent event{};
+    event.withPayload = false;
+    event.linkEstablished = true;
+    event.index = index;
+    event.fromTimeoutCheck = true;
+
+    try {
+        this->addDevice(event);
+    } catch(std::exception& e) {
+        logPrintf(ERROR, "Failed to add device %d to receiver on %s: %s",
+                  index, _receiver->rawDevice()->hidrawPath().c_str(),
+                  e.what());
+    }
+}
+
+void ReceiverMonitor::_stopWaiting(hidpp::DeviceIndex index)
+{
+    if(index < hidpp::WirelessDevice1 || index > hidpp::WirelessDevice6)
+        return;
+
+    _waiting &= ~(1 << index);
+
+    std::shared_ptr<timer> fallback;
+    {
+        std::lock_guard<std::mutex> lock(_wait_lock);
+        _wait[index].attempts = 0;
+        fallback = std::move(_wait[index].fallback);
+    }
+    if(fallback)
+        fallback->cancel();
 }
 
 std::shared_ptr<Receiver> ReceiverMonitor::receiver() const
@@ -19,11 +19,21 @@
 #ifndef LOGID_BACKEND_DJ_RECEIVERMONITOR_H
 #define LOGID_BACKEND_DJ_RECEIVERMONITOR_H
 
+#include <array>
+#include <atomic>
 #include <cstdint>
+#include <mutex>
 #include <string>
+#include <vector>
 #include "Receiver.h"
 #include "../hidpp/defs.h"
 
+namespace logid
+{
+    class timer;
+    class strand;
+}
+
 namespace logid {
 namespace backend {
 namespace dj
@@ -33,6 +43,7 @@ namespace dj
     {
     public:
         explicit ReceiverMonitor(std::string path);
+        explicit ReceiverMonitor(std::shared_ptr<raw::RawDevice> raw_device);
         ~ReceiverMonitor();
 
         void enumerate();
@@ -43,7 +54,13 @@ namespace dj
         virtual void addDevice(hidpp::DeviceConnectionEvent event) = 0;
         virtual void removeDevice(hidpp::DeviceIndex index) = 0;
 
+        /* Retries adding a device that timed out once it sends a report,
+         * or after a backoff if it stays silent. Gives up after
+         * LOGID_WAIT_DEVICE_RETRIES attempts until it connects again.
+         */
         void waitForDevice(hidpp::DeviceIndex index);
+        // Retries adding a device on its next report only
+        void waitForInput(hidpp::DeviceIndex index);
 
         // Internal methods for derived class
         void _pair(uint8_t timeout = 0);
@@ -53,7 +70,45 @@ namespace dj
 
         std::shared_ptr<Receiver> receiver() const;
     private:
+        /* Connection events for a slot run in order on its strand. Queued
+         * connection events collapse into the latest one and a
+         * disconnection drops everything queued before it.
+         */
+        void _queueEvent(const hidpp::Report& report);
+        void _handleEvents(hidpp::DeviceIndex index);
+        void _handleEvent(const hidpp::Report& report);
+
+        /* Slots without activity at enumeration are likely asleep, they
+         * initialize on their first report instead of timing out. */
+        bool _deferIdle(const hidpp::DeviceConnectionEvent& event);
+
+        void _retryDevice(hidpp::DeviceIndex index);
+        void _addWaiting(hidpp::DeviceIndex index);
+        void _stopWaiting(hidpp::DeviceIndex index);
+
         std::shared_ptr<Receiver> _receiver;
+
+        // One bit per slot, tested for every report of the receiver
+        std::atomic<uint8_t> _waiting;
+        // Slots whose activity counter was zero when enumerating
+        std::atomic<uint8_t> _idle;
+
+        struct WaitState
+        {
+            int attempts = 0;
+            std::shared_ptr<timer> fallback;
+        };
+        std::mutex _wait_lock;
+        std::array<WaitState, hidpp::WirelessDevice6 + 1> _wait;
+
+        struct SlotEvents
+        {
+            std::shared_ptr<strand> executor;
+            std::vector<hidpp::Report> pending;
+            bool scheduled = false;
+        };
+        std::mutex _events_lock;
+        std::array<SlotEvents, hidpp::WirelessDevice6 + 1> _events;
     };
 
 }}}
@@ -36,7 +36,7 @@ namespace dj
         static constexpr uint8_t Parameters = 3;
     }
 
-    bool supportsDjReports(std::vector<uint8_t>&& rdesc);
+    bool supportsDjReports(const std::vector<uint8_t>& rdesc);
     class Report
     {
     public:
@@ -17,18 +17,37 @@
  */
 
 #include <cassert>
+#include <thread>
 #include <utility>
 #include "../../util/thread.h"
+#include "../../util/latency.h"
+#include "../../util/log.h"
+#include "../../util/task.h"
+#include "../../util/backoff.h"
+#include "../../Configuration.h"
 #include "Device.h"
 #include "Report.h"
 #include "../hidpp20/features/Root.h"
 #include "../hidpp20/features/DeviceName.h"
 #include "../hidpp20/Error.h"
 #include "../hidpp10/Error.h"
+#include "../Error.h"
 #include "../dj/Receiver.h"
 
 using namespace logid::backend;
 using namespace logid::backend::hidpp;
+using namespace std::chrono;
+
+namespace
+{
+    // The device whose events this thread is dispatching, if any
+    thread_local const void* dispatching_device = nullptr;
+    // The device whose offloaded handler this thread is running, if any
+    thread_local const void* offloaded_device = nullptr;
+}
+
+std::mutex Device::_names_lock;
+std::map<std::tuple<uint16_t, uint32_t>, std::string> Device::_names;
 
 const char* Device::InvalidDevice::what() const noexcept
 {
@@ -88,11 +107,51 @@ Device::Device(std::shared_ptr<dj::Receiver> receiver,
     _init();
 }
 
+Device::Device(std::shared_ptr<raw::RawDevice> raw_device, DeviceIndex index,
+        const Identity& identity) : _raw_device (std::move(raw_device)),
+        _receiver (nullptr), _path (_raw_device->hidrawPath()), _index (index)
+{
+    _init(&identity);
+}
+
+Device::Device(std::shared_ptr<dj::Receiver> receiver, DeviceIndex index,
+        const Identity& identity) : _raw_device (receiver->rawDevice()),
+        _receiver (receiver), _path (receiver->rawDevice()->hidrawPath()),
+        _index (index)
+{
+    // Only asks the receiver, the device could have been re-paired
+    _pid = receiver->getPairingInfo(_index).pid;
+    _init(&identity);
+}
+
+Device::Device(std::shared_ptr<raw::RawDevice> raw_device, DeviceIndex index,
+        Probe) : _raw_device (std::move(raw_device)), _receiver (nullptr),
+        _path (_raw_device->hidrawPath()), _index (index), _listening (false),
+        _software_id (LOGID_HIDPP_SOFTWARE_ID_MIN)
+{
+    _supported_reports = getSupportedReports(_raw_device->vendorId(),
+            _raw_device->productId(), _raw_device->reportDescriptor());
+}
+
+Result<std::tuple<uint8_t, uint8_t>> Device::probe(
+        std::shared_ptr<raw::RawDevice> raw_device, DeviceIndex index)
+{
+    Device device(std::move(raw_device), index, Probe());
+    if(!device._supported_reports)
+        return Failure(Failure::InvalidDevice, InvalidDevice::NoHIDPPReport);
+    return device._probeVersion();
+}
+
 std::string Device::devicePath() const
 {
     return _path;
 }
 
+const std::shared_ptr<raw::RawDevice>& Device::rawDevice() const
+{
+    return _raw_device;
+}
+
 DeviceIndex Device::deviceIndex() const
 {
     return _index;
@@ -103,84 +162,299 @@ std::tuple<uint8_t, uint8_t> Device::version() const
     return _version;
 }
 
-void Device::_init()
+void Device::_init(const Identity* known)
 {
     _listening = false;
-    _supported_reports = getSupportedReports(_raw_device->reportDescriptor());
+    _software_id = LOGID_HIDPP_SOFTWARE_ID_MIN;
+    _handler_budget = global_config->handlerBudget();
+    _supported_reports = getSupportedReports(_raw_device->vendorId(),
+            _raw_device->productId(), _raw_device->reportDescriptor());
     if(!_supported_reports)
         throw InvalidDevice(InvalidDevice::NoHIDPPReport);
 
-    try {
-        hidpp20::EssentialRoot root(this);
-        _version = root.getVersion();
-    } catch(hidpp10::Error &e) {
-        // Valid HID++ 1.0 devices should send an InvalidSubID error
-        if(e.code() != hidpp10::Error::InvalidSubID)
-            throw;
+    _version = _probeVersion().value();
 
-        // HID++ 2.0 is not supported, assume HID++ 1.0
-        _version = std::make_tuple(1, 0);
+    if(!_receiver)
+        _pid = _raw_device->productId();
+
+    if(known && known->version == _version && known->pid == _pid) {
+        _name = known->name;
+        _restored = true;
+        return;
     }
 
-    if(!_receiver) {
-        _pid = _raw_device->productId();
-        if(std::get<0>(_version) >= 2) {
-            try {
-                hidpp20::EssentialDeviceName deviceName(this);
-                _name = deviceName.getName();
-            } catch(hidpp20::UnsupportedFeature &e) {
-                _name = _raw_device->name();
-            }
-        } else {
-            _name = _raw_device->name();
-        }
-    } else {
-        if(std::get<0>(_version) >= 2) {
-            try {
-                hidpp20::EssentialDeviceName deviceName(this);
-                _name = deviceName.getName();
-            } catch(hidpp20::UnsupportedFeature &e) {
-                _name = _receiver->getDeviceName(_index);
-            }
-        } else {
-            _name = _receiver->getDeviceName(_index);
+    if(std::get<0>(_version) < 2) {
+        _name = _receiver ? _receiver->getDeviceName(_index) :
+                _raw_device->name();
+        return;
+    }
+
+    auto unit = std::make_tuple(_pid, unitId());
+    {
+        std::lock_guard<std::mutex> lock(_names_lock);
+        auto it = _names.find(unit);
+        if(it != _names.end()) {
+            _name = it->second;
+            return;
         }
     }
+
+    try {
+        hidpp20::EssentialDeviceName deviceName(this);
+        _name = deviceName.getName();
+    } catch(hidpp20::UnsupportedFeature &e) {
+        _name = _receiver ? _receiver->getDeviceName(_index) :
+                _raw_device->name();
+    }
+
+    std::lock_guard<std::mutex> lock(_names_lock);
+    _names[unit] = _name;
+}
+
+/* Units of one model share their name, the serial only guards against
+ * trusting a name across a re-pairing. Reading the unit ID of a direct
+ * device would cost more round trips than the name. */
+uint32_t Device::unitId()
+{
+    std::call_once(_unit_id_once, [this]() {
+        if(!_receiver)
+            return;
+        try {
+            _unit_id = _receiver->getExtendedPairingInfo(_index).serialNumber;
+        } catch(hidpp10::Error& e) {
+            // Left at 0
+        }
+    });
+    return _unit_id;
+}
+
+Result<std::tuple<uint8_t, uint8_t>> Device::_probeVersion()
+{
+    hidpp20::EssentialRoot root(this);
+    auto version = root.tryGetVersion();
+
+    // Valid HID++ 1.0 devices should send an InvalidSubID error
+    if(!version && version.failure().is(Failure::Hidpp10Error,
+            hidpp10::Error::InvalidSubID))
+        // HID++ 2.0 is not supported, assume HID++ 1.0
+        return std::tuple<uint8_t, uint8_t>(1, 0);
+
+    return version;
 }
 
 Device::~Device()
 {
     if(_listening)
-        _raw_device->removeEventHandler("DEV_" + std::to_string(_index));
+        _raw_device->removeDeviceEventHandler(_index);
+    _waitForOffloaded(true);
 }
 
 void Device::addEventHandler(const std::string& nickname,
         const std::shared_ptr<EventHandler>& handler)
 {
-    assert(_event_handlers.find(nickname) == _event_handlers.end());
-
-    _event_handlers.emplace(nickname, handler);
+    _updateEventHandlers([&nickname, &handler](EventHandlers& handlers) {
+        assert(handlers.named.find(nickname) == handlers.named.end());
+        handlers.named.emplace(nickname, handler);
+    }, false);
 }
 
 void Device::removeEventHandler(const std::string& nickname)
 {
-    _event_handlers.erase(nickname);
+    _updateEventHandlers([&nickname](EventHandlers& handlers) {
+        handlers.named.erase(nickname);
+    }, true);
+    _waitForOffloaded();
+}
+
+std::map<std::string, std::shared_ptr<EventHandler>> Device::eventHandlers()
+{
+    return std::atomic_load(&_event_handlers)->named;
 }
 
-const std::map<std::string, std::shared_ptr<EventHandler>>&
-    Device::eventHandlers()
+void Device::addEventHandler(uint8_t feature_index, uint8_t function,
+        const std::function<void(Report&)>& handler, bool motion)
 {
-    return _event_handlers;
+    uint16_t key = (feature_index << 4) | (function & 0x0f);
+    auto feature_handler =
+            std::make_shared<const std::function<void(Report&)>>(handler);
+    _updateEventHandlers([key, &feature_handler](EventHandlers& handlers) {
+        assert(handlers.features.find(key) == handlers.features.end());
+        handlers.features.emplace(key, std::move(feature_handler));
+    }, false);
+    if(motion)
+        _raw_device->setMotionEvent(_index, feature_index, function, true);
+}
+
+void Device::removeEventHandler(uint8_t feature_index, uint8_t function)
+{
+    uint16_t key = (feature_index << 4) | (function & 0x0f);
+    _updateEventHandlers([key](EventHandlers& handlers) {
+        handlers.features.erase(key);
+    }, true);
+    _raw_device->setMotionEvent(_index, feature_index, function, false);
+    _waitForOffloaded();
+}
+
+void Device::_updateEventHandlers(
+        const std::function<void(EventHandlers&)>& update,
+        bool wait_for_readers)
+{
+    {
+        std::lock_guard<std::mutex> lock(_event_handler_lock);
+        auto handlers = std::make_shared<EventHandlers>(
+                *std::atomic_load(&_event_handlers));
+        update(*handlers);
+        std::atomic_store(&_event_handlers,
+                std::shared_ptr<const EventHandlers>(std::move(handlers)));
+    }
+
+    if(wait_for_readers && dispatching_device != this)
+        _handler_readers.synchronize();
 }
 
 void Device::handleEvent(Report& report)
 {
-    for(auto& handler : _event_handlers)
-        if(handler.second->condition(report))
-            handler.second->callback(report);
+    if(_receiver)
+        _receiver->linkActive(_index);
+
+    if(_offloaded.load(std::memory_order_relaxed)) {
+        _offload(report);
+        return;
+    }
+
+    auto outer = dispatching_device;
+    dispatching_device = this;
+    std::string slow_handler;
+    try {
+        _dispatch(report, _handler_budget.count() != 0, slow_handler);
+    } catch(...) {
+        dispatching_device = outer;
+        throw;
+    }
+    dispatching_device = outer;
+
+    if(!slow_handler.empty()) {
+        _offloaded.store(true, std::memory_order_relaxed);
+        _raw_device->stats().add(metrics::Offloaded);
+        logPrintf(WARN, "%s:%d: %s event handler ran longer than %lld us, "
+                        "running this device's handlers off the listener "
+                        "from now on.", _path.c_str(), _index,
+                slow_handler.c_str(), (long long)_handler_budget.count());
+    }
 }
 
-Report Device::sendReport(Report& report)
+void Device::_dispatch(Report& report, bool timed, std::string& slow_handler)
+{
+    read_epoch::guard reading(_handler_readers);
+    auto handlers = std::atomic_load(&_event_handlers);
+    auto feature = handlers->features.find((report.feature() << 4) |
+            report.function());
+    if(feature != handlers->features.end()) {
+        latency::mark(latency::Dispatch);
+        if(_runHandler(*feature->second, report, timed) &&
+           slow_handler.empty())
+            slow_handler = "feature " + std::to_string(report.feature()) +
+                    " function " + std::to_string(report.function());
+    }
+
+    for(auto& named : handlers->named) {
+        if(named.second->condition(report) &&
+           _runHandler(named.second->callback, report, timed) &&
+           slow_handler.empty())
+            slow_handler = named.first;
+    }
+}
+
+bool Device::_runHandler(const std::function<void(Report&)>& handler,
+        Report& report, bool timed)
+{
+    if(!timed) {
+        handler(report);
+        return false;
+    }
+
+    auto start = steady_clock::now();
+    handler(report);
+    return steady_clock::now() - start > _handler_budget;
+}
+
+void Device::_offload(Report& report)
+{
+    if(!_event_strand)
+        _event_strand = std::make_shared<strand>(task::Interactive);
+
+    bool post;
+    {
+        std::lock_guard<std::mutex> lock(_offload_lock);
+        auto capacity = _offload_queue.size();
+        if(_offload_size == capacity) {
+            std::vector<Report> grown;
+            grown.reserve(capacity ? capacity * 2 : LOGID_HIDPP_OFFLOAD_QUEUE);
+            for(std::size_t i = 0; i < _offload_size; i++)
+                grown.push_back(_offload_queue[
+                        (_offload_head + i) % capacity]);
+            // Slots past the queued events are overwritten before use
+            while(grown.size() < grown.capacity())
+                grown.push_back(report);
+            _offload_queue.swap(grown);
+            _offload_head = 0;
+            capacity = _offload_queue.size();
+        }
+        _offload_queue[(_offload_head + _offload_size) % capacity] = report;
+        _offload_size++;
+        _offload_queued++;
+        post = !_offload_draining;
+        _offload_draining = true;
+    }
+
+    // One drain runs per burst of events, not one task per event
+    if(post)
+        _event_strand->post([this]() { _drainOffloaded(); });
+}
+
+void Device::_drainOffloaded()
+{
+    dispatching_device = this;
+    offloaded_device = this;
+    std::string slow_handler;
+
+    std::unique_lock<std::mutex> lock(_offload_lock);
+    while(_offload_size) {
+        Report event = _offload_queue[_offload_head];
+        _offload_head = (_offload_head + 1) % _offload_queue.size();
+        _offload_size--;
+        lock.unlock();
+
+        try {
+            _dispatch(event, false, slow_handler);
+        } catch(std::exception& e) {
+            ExceptionHandler::Default(e);
+        }
+
+        lock.lock();
+        _offload_handled++;
+        _offload_done.notify_all();
+    }
+    dispatching_device = nullptr;
+    offloaded_device = nullptr;
+
+    // Last use of this, the destructor may be waiting for it
+    _offload_draining = false;
+    _offload_done.notify_all();
+}
+
+void Device::_waitForOffloaded(bool stopped)
+{
+    if(offloaded_device == this)
+        return;
+    std::unique_lock<std::mutex> lock(_offload_lock);
+    auto queued = _offload_queued;
+    _offload_done.wait(lock, [this, queued, stopped]() {
+        return _offload_handled >= queued && !(stopped && _offload_draining);
+    });
+}
+
+void Device::_fitReport(Report& report)
 {
     switch(report.type())
     {
@@ -192,38 +466,171 @@ Report Device::sendReport(Report& report)
         /* Report can be truncated, but that isn't a good idea. */
         assert(_supported_reports & HIDPP_REPORT_LONG_SUPPORTED);
     }
+}
 
-    auto raw_response = _raw_device->sendReport(report.rawReport());
-
-    Report response(raw_response);
+void Device::_checkError(Report& response)
+{
+    auto failure = _responseError(response);
+    if(failure)
+        failure.raise();
+}
 
+Failure Device::_responseError(Report& response)
+{
     Report::Hidpp10Error hidpp10_error{};
     if(response.isError10(&hidpp10_error))
-        throw hidpp10::Error(hidpp10_error.error_code);
+        return Failure(Failure::Hidpp10Error, hidpp10_error.error_code);
 
     Report::Hidpp20Error hidpp20_error{};
     if(response.isError20(&hidpp20_error))
-        throw hidpp20::Error(hidpp20_error.error_code);
+        return Failure(Failure::Hidpp20Error, hidpp20_error.error_code);
 
-    return response;
+    return Failure();
 }
 
-void Device::sendReportNoResponse(Report &report)
+Report Device::sendReport(Report& report)
 {
-    switch(report.type())
-    {
-    case Report::Type::Short:
-        if(!(_supported_reports & HIDPP_REPORT_SHORT_SUPPORTED))
-            report.setType(Report::Type::Long);
-        break;
-    case Report::Type::Long:
-        /* Report can be truncated, but that isn't a good idea. */
-        assert(_supported_reports & HIDPP_REPORT_LONG_SUPPORTED);
+    return trySendReport(report).value();
+}
+
+Result<Report> Device::trySendReport(Report& report)
+{
+    return _trySendReport(report, 0);
+}
+
+bool Device::_busy(const Failure& failure)
+{
+    return failure.is(Failure::Hidpp10Error, hidpp10::Error::Busy) ||
+        failure.is(Failure::Hidpp20Error, hidpp20::Error::Busy);
+}
+
+bool Device::_asleep() const
+{
+    return _receiver && _receiver->link(_index) == dj::Receiver::Link::Lost;
+}
+
+Result<Report> Device::_trySendReport(Report& report, int retry)
+{
+    // Would only time out
+    if(_asleep())
+        return Failure(Failure::InvalidDevice, InvalidDevice::Asleep);
+
+    _fitReport(report);
+    auto& retries = global_config->retrySettings();
+    for(;; retry++) {
+        std::vector<uint8_t> raw_response;
+        // The raw layer still throws on timeouts
+        try {
+            raw_response = _raw_device->sendReport(report.rawReport());
+        } catch(TimeoutError& e) {
+            return Failure(Failure::Timeout, 0);
+        }
+
+        Report response(raw_response);
+        auto failure = _responseError(response);
+        if(_busy(failure) && retry < retries.count) {
+            _raw_device->stats().add(metrics::Retries);
+            std::this_thread::sleep_for(backoff::delay(retries, retry));
+            continue;
+        }
+        if(failure)
+            return failure;
+        return response;
     }
+}
+
+std::future<Report> Device::sendReportAsync(Report& report)
+{
+    if(_asleep())
+        throw InvalidDevice(InvalidDevice::Asleep);
+
+    _fitReport(report);
+    auto raw_response = _raw_device->sendReportAsync(report.rawReport());
+    return std::async(std::launch::deferred,
+            [this, report, raw_response=std::move(raw_response)]() mutable {
+        Report response(raw_response.get());
+        auto failure = _responseError(response);
+        // Whoever waits on the future blocks anyway, retry synchronously
+        if(_busy(failure) && global_config->retrySettings().count > 0) {
+            std::this_thread::sleep_for(
+                    backoff::delay(global_config->retrySettings(), 0));
+            return _trySendReport(report, 1).value();
+        }
+        if(failure)
+            failure.raise();
+        return response;
+    });
+}
+
+void Device::sendReportAsync(Report& report,
+        const std::function<void(Report&)>& on_response,
+        const std::function<void(std::exception&)>& on_error)
+{
+    if(_asleep())
+        throw InvalidDevice(InvalidDevice::Asleep);
+
+    _fitReport(report);
+    _sendReportAsync(_raw_device, std::make_shared<Report>(report),
+            on_response, on_error, 0);
+}
+
+void Device::_sendReportAsync(
+        const std::shared_ptr<raw::RawDevice>& raw_device,
+        const std::shared_ptr<Report>& report,
+        const std::function<void(Report&)>& on_response,
+        const std::function<void(std::exception&)>& on_error, int retry)
+{
+    raw_device->sendReportAsync(report->rawReport(),
+            [raw_device, report, on_response, on_error, retry](
+                    const std::vector<uint8_t>& raw_response) {
+        Report response(raw_response);
+        auto failure = _responseError(response);
+        auto& retries = global_config->retrySettings();
+        if(_busy(failure) && retry < retries.count) {
+            // Off the I/O thread, through the timer wheel
+            raw_device->stats().add(metrics::Retries);
+            task::spawnAfter(backoff::delay(retries, retry),
+                    [raw_device, report, on_response, on_error, retry]() {
+                try {
+                    _sendReportAsync(raw_device, report, on_response,
+                            on_error, retry + 1);
+                } catch(std::exception& e) {
+                    on_error(e);
+                }
+            }, [](std::exception& e) { ExceptionHandler::Default(e); },
+                    task::Interactive);
+            return;
+        }
+
+        try {
+            if(failure)
+                failure.raise();
+        } catch(std::exception& e) {
+            on_error(e);
+            return;
+        }
+        on_response(response);
+    }, on_error);
+}
 
+void Device::sendReportNoResponse(Report &report)
+{
+    _fitReport(report);
     _raw_device->sendReportNoResponse(report.rawReport());
 }
 
+uint8_t Device::nextSoftwareId()
+{
+    uint8_t sw_id = _software_id.load();
+    uint8_t next;
+    do {
+        next = sw_id >= LOGID_HIDPP_SOFTWARE_ID_MAX ?
+                LOGID_HIDPP_SOFTWARE_ID_MIN : sw_id + 1;
+    } while(!_software_id.compare_exchange_weak(sw_id, next));
+
+    return sw_id;
+}
+
 std::string Device::name() const
 {
     return _name;
@@ -234,35 +641,38 @@ uint16_t Device::pid() const
     return _pid;
 }
 
+Device::Identity Device::identity() const
+{
+    return {_version, _pid, _name};
+}
+
+bool Device::restored() const
+{
+    return _restored;
+}
+
 void Device::listen()
 {
     if(!_raw_device->isListening())
         _raw_device->listenAsync();
 
     // Pass all HID++ events with device index to this device.
-    auto handler = std::make_shared<raw::RawEventHandler>();
-    handler->condition = [index=this->_index](std::vector<uint8_t>& report)
-            ->bool {
-        return (report[Offset::Type] == Report::Type::Short ||
-                report[Offset::Type] == Report::Type::Long) &&
-               (report[Offset::DeviceIndex] == index);
-    };
-    handler->callback = [this](std::vector<uint8_t>& report)->void {
+    _raw_device->addDeviceEventHandler(_index,
+            [this](std::vector<uint8_t>& report)->void {
         Report _report(report);
         this->handleEvent(_report);
-    };
-
-    _raw_device->addEventHandler("DEV_" + std::to_string(_index), handler);
+    });
     _listening = true;
 }
 
 void Device::stopListening()
 {
     if(_listening)
-        _raw_device->removeEventHandler("DEV_" + std::to_string(_index));
+        _raw_device->removeDeviceEventHandler(_index);
+    _waitForOffloaded();
 
     _listening = false;
 
-    if(!_raw_device->eventHandlers().empty())
+    if(_raw_device->hasEventHandlers())
         _raw_device->stopListener();
 }
\ No newline at end of file
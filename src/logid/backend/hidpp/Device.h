@@ -19,14 +19,26 @@
 #ifndef LOGID_BACKEND_HIDPP_DEVICE_H
 #define LOGID_BACKEND_HIDPP_DEVICE_H
 
+#include <chrono>
 #include <string>
 #include <memory>
 #include <functional>
 #include <map>
+#include <unordered_map>
+#include <future>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include "../raw/RawDevice.h"
+#include "../Result.h"
+#include "../../util/read_epoch.h"
+#include "../../util/strand.h"
 #include "Report.h"
 #include "defs.h"
 
+// Offloaded events a device queues before the queue grows
+#define LOGID_HIDPP_OFFLOAD_QUEUE 16
+
 namespace logid {
 namespace backend {
 namespace dj
@@ -68,14 +80,41 @@ namespace hidpp
                 hidpp::DeviceConnectionEvent event);
         Device(std::shared_ptr<dj::Receiver> receiver,
                 DeviceIndex index);
+
+        /* What a previous run learned about a device. A device made from
+         * it only asks for its version and keeps the rest if the version
+         * and PID still match, otherwise it is set up as usual. */
+        struct Identity
+        {
+            std::tuple<uint8_t, uint8_t> version;
+            uint16_t pid;
+            std::string name;
+        };
+        Device(std::shared_ptr<raw::RawDevice> raw_device,
+                DeviceIndex index, const Identity& identity);
+        Device(std::shared_ptr<dj::Receiver> receiver,
+                DeviceIndex index, const Identity& identity);
         ~Device();
 
+        /* Only checks that index answers and returns its protocol
+         * version, HID++ 1.0 receivers answer 1.0. */
+        static Result<std::tuple<uint8_t, uint8_t>> probe(
+                std::shared_ptr<raw::RawDevice> raw_device,
+                DeviceIndex index);
+
         std::string devicePath() const;
+        const std::shared_ptr<raw::RawDevice>& rawDevice() const;
         DeviceIndex deviceIndex() const;
         std::tuple<uint8_t, uint8_t> version() const;
 
         std::string name() const;
         uint16_t pid() const;
+        /* Serial number the receiver paired, 0 for direct devices. Read
+         * once, on first use. */
+        uint32_t unitId();
+        Identity identity() const;
+        // True if the identity given on construction still matched
+        bool restored() const;
 
         void listen(); // Runs asynchronously
         void stopListening();
@@ -83,15 +122,63 @@ namespace hidpp
         void addEventHandler(const std::string& nickname,
                 const std::shared_ptr<EventHandler>& handler);
         void removeEventHandler(const std::string& nickname);
-        const std::map<std::string, std::shared_ptr<EventHandler>>&
-            eventHandlers();
+        std::map<std::string, std::shared_ptr<EventHandler>> eventHandlers();
+
+        /* Events from a single feature function are looked up by
+         * (feature index, function) before any named handler is tested.
+         * Stale motion events may be put behind others under backlog, see
+         * raw::RawDevice::setMotionEvent.
+         *
+         * Handlers run on the listener until one takes longer than
+         * handler_budget. From then on all events of this device are
+         * queued and dispatched in order off the listener, so they keep
+         * their order across handlers. Removing a handler waits for the
+         * events queued before it. */
+        void addEventHandler(uint8_t feature_index, uint8_t function,
+                const std::function<void(Report&)>& handler,
+                bool motion=false);
+        void removeEventHandler(uint8_t feature_index, uint8_t function);
 
         Report sendReport(Report& report);
+        // Same as sendReport, error responses and timeouts are returned
+        Result<Report> trySendReport(Report& report);
+        std::future<Report> sendReportAsync(Report& report);
+        /* Completes from the I/O thread, error responses go to on_error.
+         * See raw::RawDevice::sendReportAsync. */
+        void sendReportAsync(Report& report,
+                const std::function<void(Report&)>& on_response,
+                const std::function<void(std::exception&)>& on_error);
         void sendReportNoResponse(Report& report);
 
+        uint8_t nextSoftwareId();
+
         void handleEvent(Report& report);
     private:
-        void _init();
+        struct Probe
+        {
+        };
+        Device(std::shared_ptr<raw::RawDevice> raw_device, DeviceIndex index,
+                Probe);
+
+        void _init(const Identity* known=nullptr);
+        Result<std::tuple<uint8_t, uint8_t>> _probeVersion();
+        void _fitReport(Report& report);
+        // Throws the error carried by an error response
+        static void _checkError(Report& response);
+        // The receiver reported the link to this device as lost
+        bool _asleep() const;
+        static Failure _responseError(Report& response);
+        // Busy responses are retried after a backoff, see backoff.h
+        static bool _busy(const Failure& failure);
+        Result<Report> _trySendReport(Report& report, int retry);
+        /* Holds on to the raw device rather than this, a retry may
+         * outlive the device. */
+        static void _sendReportAsync(
+                const std::shared_ptr<raw::RawDevice>& raw_device,
+                const std::shared_ptr<Report>& report,
+                const std::function<void(Report&)>& on_response,
+                const std::function<void(std::exception&)>& on_error,
+                int retry);
 
         std::shared_ptr<raw::RawDevice> _raw_device;
         std::shared_ptr<dj::Receiver> _receiver;
@@ -102,10 +189,69 @@ namespace hidpp
         std::tuple<uint8_t, uint8_t> _version;
         uint16_t _pid;
         std::string _name;
+        bool _restored = false;
+        std::once_flag _unit_id_once;
+        uint32_t _unit_id = 0;
 
         std::atomic<bool> _listening;
+        std::atomic<uint8_t> _software_id;
+
+        /* Published as an immutable snapshot like raw::RawDevice's, so
+         * that handlers may be added and removed while events are
+         * dispatched. Writers copy, modify and swap it in under
+         * _event_handler_lock. */
+        struct EventHandlers
+        {
+            std::map<std::string, std::shared_ptr<EventHandler>> named;
+            std::unordered_map<uint16_t,
+                std::shared_ptr<const std::function<void(Report&)>>> features;
+        };
+        std::shared_ptr<const EventHandlers> _event_handlers =
+            std::make_shared<const EventHandlers>();
+        std::mutex _event_handler_lock;
+        // Dispatches enter before loading the snapshot
+        read_epoch _handler_readers;
+        /* A removed handler may still run from the old snapshot, waiting
+         * for it is skipped on the thread dispatching it. */
+        void _updateEventHandlers(
+                const std::function<void(EventHandlers&)>& update,
+                bool wait_for_readers);
+
+        /* Runs every handler of the event, timed while on the listener.
+         * Names the first that ran longer than the budget in slow_handler.
+         */
+        void _dispatch(Report& report, bool timed, std::string& slow_handler);
+        // True if the handler ran longer than the budget
+        bool _runHandler(const std::function<void(Report&)>& handler,
+                Report& report, bool timed);
+        // Copies the event into _offload_queue, allocating only to grow it
+        void _offload(Report& report);
+        void _drainOffloaded();
+        /* Returns once the events queued before the call ran, and with
+         * stopped once the drain no longer touches this. Called from an
+         * offloaded handler of this device it returns at once, the events
+         * behind it could never run. */
+        void _waitForOffloaded(bool stopped=false);
+        std::chrono::microseconds _handler_budget{0};
+        // Set by the listener once, see handleEvent
+        std::atomic<bool> _offloaded{false};
+        // Only touched by the listener, made on the first offload
+        std::shared_ptr<strand> _event_strand;
+        std::mutex _offload_lock;
+        std::condition_variable _offload_done;
+        // A ring of _offload_size events from _offload_head
+        std::vector<Report> _offload_queue;
+        std::size_t _offload_head = 0;
+        std::size_t _offload_size = 0;
+        // A drain is posted to _event_strand while events are queued
+        bool _offload_draining = false;
+        uint64_t _offload_queued = 0;
+        uint64_t _offload_handled = 0;
 
-        std::map<std::string, std::shared_ptr<EventHandler>> _event_handlers;
+        /* Names by (PID, unit ID), a unit that reconnects or wakes up
+         * keeps its name without asking for it again. */
+        static std::mutex _names_lock;
+        static std::map<std::tuple<uint16_t, uint32_t>, std::string> _names;
     };
 } } }
 
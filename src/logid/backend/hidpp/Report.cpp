@@ -19,6 +19,9 @@
 #include <array>
 #include <algorithm>
 #include <cassert>
+#include <map>
+#include <mutex>
+#include <tuple>
 #include "Report.h"
 #include "../hidpp10/Error.h"
 #include "../hidpp20/Error.h"
@@ -84,26 +87,77 @@ static const std::array<uint8_t, 22> LongReportDesc2 = {
         0xC0			// End Collection
 };
 
-uint8_t hidpp::getSupportedReports(std::vector<uint8_t>&& rdesc)
+namespace
 {
+    struct Signature
+    {
+        const std::array<uint8_t, 22>& descriptor;
+        uint8_t report;
+    };
+
+    // All signatures start with the same Collection (Application) item
+    const std::array<Signature, 4> Signatures = {{
+        {ShortReportDesc, HIDPP_REPORT_SHORT_SUPPORTED},
+        {ShortReportDesc2, HIDPP_REPORT_SHORT_SUPPORTED},
+        {LongReportDesc, HIDPP_REPORT_LONG_SUPPORTED},
+        {LongReportDesc2, HIDPP_REPORT_LONG_SUPPORTED}
+    }};
+
+    typedef std::tuple<uint16_t, uint16_t, std::size_t, uint64_t>
+            DescriptorKey;
+
+    std::mutex classified_lock;
+    std::map<DescriptorKey, uint8_t> classified;
+
+    uint64_t descriptorHash(const std::vector<uint8_t>& rdesc)
+    {
+        // FNV-1a
+        uint64_t hash = 0xcbf29ce484222325;
+        for(auto byte : rdesc) {
+            hash ^= byte;
+            hash *= 0x100000001b3;
+        }
+        return hash;
+    }
+}
+
+uint8_t hidpp::getSupportedReports(const std::vector<uint8_t>& rdesc)
+{
+    static constexpr uint8_t AllReports = HIDPP_REPORT_SHORT_SUPPORTED |
+            HIDPP_REPORT_LONG_SUPPORTED;
+    const std::size_t length = ShortReportDesc.size();
     uint8_t ret = 0;
 
-    auto it = std::search(rdesc.begin(), rdesc.end(),
-            ShortReportDesc.begin(), ShortReportDesc.end());
-    if(it == rdesc.end())
-        it = std::search(rdesc.begin(), rdesc.end(),
-                ShortReportDesc2.begin(), ShortReportDesc2.end());
-    if(it != rdesc.end())
-        ret |= HIDPP_REPORT_SHORT_SUPPORTED;
-
-    it = std::search(rdesc.begin(), rdesc.end(),
-            LongReportDesc.begin(), LongReportDesc.end());
-    if(it == rdesc.end())
-        it = std::search(rdesc.begin(), rdesc.end(),
-                LongReportDesc2.begin(), LongReportDesc2.end());
-    if(it != rdesc.end())
-        ret |= HIDPP_REPORT_LONG_SUPPORTED;
+    // Signatures are only compared where their first byte matches
+    for(std::size_t i = 0; i + length <= rdesc.size() && ret != AllReports;
+            i++) {
+        if(rdesc[i] != ShortReportDesc[0])
+            continue;
+        for(auto& signature : Signatures) {
+            if(!(ret & signature.report) && std::equal(
+                    signature.descriptor.begin(), signature.descriptor.end(),
+                    rdesc.begin() + i))
+                ret |= signature.report;
+        }
+    }
+
+    return ret;
+}
+
+uint8_t hidpp::getSupportedReports(uint16_t vid, uint16_t pid,
+        const std::vector<uint8_t>& rdesc)
+{
+    DescriptorKey key(vid, pid, rdesc.size(), descriptorHash(rdesc));
+    {
+        std::lock_guard<std::mutex> lock(classified_lock);
+        auto it = classified.find(key);
+        if(it != classified.end())
+            return it->second;
+    }
 
+    auto ret = getSupportedReports(rdesc);
+    std::lock_guard<std::mutex> lock(classified_lock);
+    classified.emplace(key, ret);
     return ret;
 }
 
@@ -118,65 +172,33 @@ const char *Report::InvalidReportLength::what() const noexcept
 }
 
 Report::Report(Report::Type type, DeviceIndex device_index,
-        uint8_t sub_id, uint8_t address)
+        uint8_t sub_id, uint8_t address) : _data {}
 {
-    switch(type) {
-    case Type::Short:
-        _data.resize(HeaderLength + ShortParamLength);
-        break;
-    case Type::Long:
-        _data.resize(HeaderLength + LongParamLength);
-        break;
-    default:
-        throw InvalidReportID();
-    }
-
-    _data[Offset::Type] = type;
+    setType(type);
     _data[Offset::DeviceIndex] = device_index;
     _data[Offset::SubID] = sub_id;
     _data[Offset::Address] = address;
 }
 
 Report::Report(Report::Type type, DeviceIndex device_index,
-        uint8_t feature_index, uint8_t function, uint8_t sw_id)
+        uint8_t feature_index, uint8_t function, uint8_t sw_id) : _data {}
 {
     assert(function <= 0x0f);
     assert(sw_id <= 0x0f);
 
-    switch(type) {
-    case Type::Short:
-        _data.resize(HeaderLength + ShortParamLength);
-        break;
-    case Type::Long:
-        _data.resize(HeaderLength + LongParamLength);
-        break;
-    default:
-        throw InvalidReportID();
-    }
-
-    _data[Offset::Type] = type;
+    setType(type);
     _data[Offset::DeviceIndex] = device_index;
     _data[Offset::Feature] = feature_index;
     _data[Offset::Function] = (function & 0x0f) << 4 |
             (sw_id & 0x0f);
 }
 
-Report::Report(const std::vector<uint8_t>& data) :
-    _data (data)
+Report::Report(const std::vector<uint8_t>& data) : _data {}
 {
-    _data.resize(HeaderLength + LongParamLength);
-
     // Truncating data is entirely valid here.
-    switch(_data[Offset::Type]) {
-    case Type::Short:
-        _data.resize(HeaderLength + ShortParamLength);
-        break;
-    case Type::Long:
-        _data.resize(HeaderLength + LongParamLength);
-        break;
-    default:
-        throw InvalidReportID();
-    }
+    std::copy(data.begin(), data.begin() + std::min(data.size(),
+            _data.size()), _data.begin());
+    setType(static_cast<Report::Type>(_data[Offset::Type]));
 }
 
 Report::Type Report::type() const
@@ -188,10 +210,10 @@ void Report::setType(Report::Type type)
 {
     switch(type) {
     case Type::Short:
-        _data.resize(HeaderLength + ShortParamLength);
+        _length = HeaderLength + ShortParamLength;
         break;
     case Type::Long:
-        _data.resize(HeaderLength + LongParamLength);
+        _length = HeaderLength + LongParamLength;
         break;
     default:
         throw InvalidReportID();
@@ -262,29 +284,29 @@ void Report::setAddress(uint8_t address)
     _data[Offset::Address] = address;
 }
 
-std::vector<uint8_t>::iterator Report::paramBegin()
+Report::Data::iterator Report::paramBegin()
 {
     return _data.begin() + Offset::Parameters;
 }
 
-std::vector<uint8_t>::iterator Report::paramEnd()
+Report::Data::iterator Report::paramEnd()
 {
-    return _data.end();
+    return _data.begin() + _length;
 }
 
-std::vector<uint8_t>::const_iterator Report::paramBegin() const
+Report::Data::const_iterator Report::paramBegin() const
 {
     return _data.begin() + Offset::Parameters;
 }
 
-std::vector<uint8_t>::const_iterator Report::paramEnd() const
+Report::Data::const_iterator Report::paramEnd() const
 {
-    return _data.end();
+    return _data.begin() + _length;
 }
 
 void Report::setParams(const std::vector<uint8_t>& _params)
 {
-    assert(_params.size() <= _data.size()-HeaderLength);
+    assert(_params.size() <= _length-HeaderLength);
 
     for(std::size_t i = 0; i < _params.size(); i++)
         _data[Offset::Parameters + i] = _params[i];
@@ -20,6 +20,7 @@
 #define LOGID_BACKEND_HIDPP_REPORT_H
 
 #include <cstdint>
+#include <array>
 #include "../raw/RawDevice.h"
 #include "defs.h"
 
@@ -32,7 +33,10 @@ namespace logid {
 namespace backend {
 namespace hidpp
 {
-    uint8_t getSupportedReports(std::vector<uint8_t>&& rdesc);
+    uint8_t getSupportedReports(const std::vector<uint8_t>& rdesc);
+    // Memoized by vendor, product and a hash of the descriptor
+    uint8_t getSupportedReports(uint16_t vid, uint16_t pid,
+            const std::vector<uint8_t>& rdesc);
 
     namespace Offset
     {
@@ -96,10 +100,12 @@ namespace hidpp
         uint8_t address() const;
         void setAddress(uint8_t address);
 
-        std::vector<uint8_t>::iterator paramBegin();
-        std::vector<uint8_t>::iterator paramEnd();
-        std::vector<uint8_t>::const_iterator paramBegin() const;
-        std::vector<uint8_t>::const_iterator paramEnd() const;
+        typedef std::array<uint8_t, MaxDataLength> Data;
+
+        Data::iterator paramBegin();
+        Data::iterator paramEnd();
+        Data::const_iterator paramBegin() const;
+        Data::const_iterator paramEnd() const;
         void setParams(const std::vector<uint8_t>& _params);
 
         struct Hidpp10Error
@@ -114,11 +120,17 @@ namespace hidpp
         };
         bool isError20(Hidpp20Error* error);
 
-        std::vector<uint8_t> rawReport () const { return _data; }
+        std::vector<uint8_t> rawReport () const
+        {
+            return std::vector<uint8_t>(_data.begin(), _data.begin() + _length);
+        }
 
         static constexpr std::size_t HeaderLength = 4;
     private:
-        std::vector<uint8_t> _data;
+        /* Reports are stored inline so that building one from an event
+         * does not allocate. */
+        Data _data;
+        std::size_t _length;
     };
 }}}
 
@@ -19,7 +19,10 @@
 #ifndef LOGID_BACKEND_HIDPP_DEFS_H
 #define LOGID_BACKEND_HIDPP_DEFS_H
 
-#define LOGID_HIDPP_SOFTWARE_ID 0
+/* Requests rotate through software IDs 1-15 so that several may be in
+ * flight at once. 0 is left for notifications sent by the device. */
+#define LOGID_HIDPP_SOFTWARE_ID_MIN 1
+#define LOGID_HIDPP_SOFTWARE_ID_MAX 15
 
 #include <cstdint>
 
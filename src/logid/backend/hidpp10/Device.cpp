@@ -49,8 +49,27 @@ std::vector<uint8_t> Device::getRegister(uint8_t address,
 
     uint8_t sub_id = type == hidpp::Report::Type::Short ?
             GetRegisterShort : GetRegisterLong;
-
-    return accessRegister(sub_id, address, params);
+    auto key = std::make_tuple(sub_id, params);
+
+    uint32_t generation;
+    {
+        std::lock_guard<std::mutex> lock(_registers_lock);
+        auto it = _registers.find(address);
+        if(it == _registers.end())
+            return accessRegister(sub_id, address, params);
+        auto value = it->second.values.find(key);
+        if(value != it->second.values.end())
+            return value->second;
+        generation = it->second.generation;
+    }
+
+    auto response = accessRegister(sub_id, address, params);
+
+    std::lock_guard<std::mutex> lock(_registers_lock);
+    auto& reg = _registers[address];
+    if(reg.generation == generation)
+        reg.values[key] = response;
+    return response;
 }
 
 std::vector<uint8_t> Device::setRegister(uint8_t address,
@@ -62,7 +81,42 @@ std::vector<uint8_t> Device::setRegister(uint8_t address,
     uint8_t sub_id = type == hidpp::Report::Type::Short ?
                      SetRegisterShort : SetRegisterLong;
 
-    return accessRegister(sub_id, address, params);
+    // Also invalidated after, reads that overlap the write are not kept
+    invalidateRegister(address);
+    auto response = accessRegister(sub_id, address, params);
+
+    std::lock_guard<std::mutex> lock(_registers_lock);
+    auto it = _registers.find(address);
+    if(it == _registers.end())
+        return response;
+    it->second.generation++;
+    it->second.values.clear();
+    if(it->second.write_through) {
+        std::vector<uint8_t> value(params);
+        value.resize(type == hidpp::Report::Type::Short ?
+                hidpp::ShortParamLength : hidpp::LongParamLength);
+        uint8_t get_id = type == hidpp::Report::Type::Short ?
+                GetRegisterShort : GetRegisterLong;
+        it->second.values[std::make_tuple(get_id, std::vector<uint8_t>())] =
+                std::move(value);
+    }
+    return response;
+}
+
+void Device::cacheRegister(uint8_t address, bool write_through)
+{
+    std::lock_guard<std::mutex> lock(_registers_lock);
+    _registers[address].write_through = write_through;
+}
+
+void Device::invalidateRegister(uint8_t address)
+{
+    std::lock_guard<std::mutex> lock(_registers_lock);
+    auto it = _registers.find(address);
+    if(it == _registers.end())
+        return;
+    it->second.generation++;
+    it->second.values.clear();
 }
 
 std::vector<uint8_t> Device::accessRegister(uint8_t sub_id, uint8_t address,
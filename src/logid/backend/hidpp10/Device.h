@@ -19,6 +19,9 @@
 #ifndef LOGID_BACKEND_HIDPP10_DEVICE_H
 #define LOGID_BACKEND_HIDPP10_DEVICE_H
 
+#include <map>
+#include <mutex>
+#include <tuple>
 #include "../hidpp/Device.h"
 
 namespace logid {
@@ -39,9 +42,32 @@ namespace hidpp10
 
         std::vector<uint8_t> setRegister(uint8_t address,
                 const std::vector<uint8_t>& params, hidpp::Report::Type type);
+
+        /* Reads of address are answered from memory after the first, until
+         * it is written or invalidated. With write_through, a write also
+         * becomes the value of the parameterless read of the register,
+         * which only holds for registers that read back what was written.
+         * The owner must invalidate the register on any notification that
+         * changes it behind our back.
+         */
+        void cacheRegister(uint8_t address, bool write_through=false);
+        void invalidateRegister(uint8_t address);
     private:
         std::vector<uint8_t> accessRegister(uint8_t sub_id,
                 uint8_t address, const std::vector<uint8_t>& params);
+
+        struct CachedRegister
+        {
+            bool write_through = false;
+            // Bumped on invalidation, a read that raced it is not stored
+            uint32_t generation = 0;
+            // Values by get sub ID and params
+            std::map<std::tuple<uint8_t, std::vector<uint8_t>>,
+                    std::vector<uint8_t>> values;
+        };
+
+        std::mutex _registers_lock;
+        std::map<uint8_t, CachedRegister> _registers;
     };
 }}}
 
@@ -16,68 +16,868 @@
  *
  */
 
+#include <algorithm>
 #include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
 
 #include "Device.h"
+#include "Error.h"
+#include "Feature.h"
+#include "feature_defs.h"
+#include "features/Root.h"
+#include "features/FeatureSet.h"
 #include "../hidpp/defs.h"
+#include "../../Configuration.h"
+#include "../../util/log.h"
+#include "../../util/registry.h"
 
+extern "C"
+{
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+using namespace logid::backend;
 using namespace logid::backend::hidpp20;
 
+namespace
+{
+    // DeviceFwVersion (0x0003), entity 0 is the running firmware
+    const uint8_t GetFwInfo = 1;
+
+    // What every device of one model and protocol version has in common
+    struct ModelTables
+    {
+        // See Device::_firmwareOf
+        std::string firmware;
+        std::shared_ptr<const std::map<uint16_t, uint8_t>> features;
+        std::shared_ptr<const std::map<std::vector<uint8_t>,
+                std::vector<uint8_t>>> capabilities;
+    };
+
+    logid::registry<ModelTables> model_tables;
+
+    // Neither the root feature nor failed lookups, both at 0, are counted
+    std::size_t featureCount(const std::map<uint16_t, uint8_t>& features)
+    {
+        std::size_t count = 0;
+        for(auto& feature : features)
+            if(feature.second)
+                count++;
+        return count;
+    }
+
+    /* A header line of the protocol version, feature count and firmware
+     * (see Device::_firmwareOf), followed by one "feature_id index" pair
+     * per line. */
+    bool readFeatureTable(std::istream& file, unsigned int& major,
+            unsigned int& minor, unsigned int& count, std::string& firmware,
+            std::map<uint16_t, uint8_t>& features)
+    {
+        std::string header, extra;
+        if(!std::getline(file, header))
+            return false;
+        std::istringstream fields(header);
+        if(!(fields >> major >> minor >> count >> firmware) || fields >> extra)
+            return false;
+
+        unsigned int feature_id, index;
+        while(file >> std::hex >> feature_id >> std::dec >> index)
+            features[feature_id] = index;
+        // A truncated table would otherwise pass the firmware check
+        return features.find(FeatureID::FEATURE_SET) != features.end() &&
+            featureCount(features) == count;
+    }
+
+    /* Devices of one model share their cache files, so each writer gets
+     * its own temporary file and the last rename wins. */
+    bool replaceFile(const std::string& path, const std::string& contents)
+    {
+        std::string tmp_path = path + ".XXXXXX";
+        int fd = ::mkstemp(&tmp_path[0]);
+        if(fd == -1) {
+            LOGID_LOG(logid::DEBUG, "Could not write %s: %s", path.c_str(),
+                    strerror(errno));
+            return false;
+        }
+
+        bool written = ::fchmod(fd, 0644) == 0;
+        for(std::size_t offset = 0; written && offset < contents.size();) {
+            auto ret = ::write(fd, contents.data() + offset,
+                    contents.size() - offset);
+            if(ret == -1 && errno == EINTR)
+                continue;
+            written = ret > 0;
+            offset += written ? ret : 0;
+        }
+        written = ::close(fd) == 0 && written;
+
+        if(!written || -1 == std::rename(tmp_path.c_str(), path.c_str())) {
+            std::remove(tmp_path.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    std::string hex(const std::vector<uint8_t>& bytes)
+    {
+        static const char digits[] = "0123456789abcdef";
+        std::string text;
+        for(auto byte : bytes) {
+            text += digits[byte >> 4];
+            text += digits[byte & 0xf];
+        }
+        return text;
+    }
+}
+
 Device::Device(std::string path, hidpp::DeviceIndex index)
     : hidpp::Device(path, index)
 {
     assert(std::get<0>(version()) >= 2);
+    _loadFeatureTable();
 }
 
 Device::Device(std::shared_ptr<raw::RawDevice> raw_device, hidpp::DeviceIndex index)
         : hidpp::Device(raw_device, index)
 {
     assert(std::get<0>(version()) >= 2);
+    _loadFeatureTable();
 }
 
 Device::Device(std::shared_ptr<dj::Receiver> receiver, hidpp::DeviceIndex index)
     : hidpp::Device(receiver, index)
 {
     assert(std::get<0>(version()) >= 2);
+    _loadFeatureTable();
 }
 
-std::vector<uint8_t> Device::callFunction(uint8_t feature_index,
+Device::Device(std::shared_ptr<raw::RawDevice> raw_device,
+        hidpp::DeviceIndex index, const State& state)
+        : hidpp::Device(std::move(raw_device), index, state.identity)
+{
+    assert(std::get<0>(version()) >= 2);
+    _restoreFeatureTable(state);
+}
+
+Device::Device(std::shared_ptr<dj::Receiver> receiver,
+        hidpp::DeviceIndex index, const State& state)
+        : hidpp::Device(std::move(receiver), index, state.identity)
+{
+    assert(std::get<0>(version()) >= 2);
+    _restoreFeatureTable(state);
+}
+
+Device::State Device::state()
+{
+    State state;
+    state.identity = identity();
+    {
+        std::lock_guard<std::mutex> lock(_feature_lock);
+        state.features = *_feature_indices;
+        state.features_complete = _feature_table_complete;
+        state.firmware = _firmware;
+    }
+    std::lock_guard<std::mutex> lock(_capability_lock);
+    state.capabilities = *_shared_capabilities;
+    for(auto& capability : _capabilities)
+        state.capabilities[capability.first] = capability.second;
+    return state;
+}
+
+logid::backend::hidpp::Report Device::_makeRequest(uint8_t feature_index,
         uint8_t function, std::vector<uint8_t>& params)
+{
+    return _makeRequest(feature_index, function, params.data(),
+            params.size());
+}
+
+logid::backend::hidpp::Report Device::_makeRequest(uint8_t feature_index,
+        uint8_t function, const uint8_t* params, std::size_t length)
 {
     hidpp::Report::Type type;
 
-    assert(params.size() <= hidpp::LongParamLength);
-    if(params.size() <= hidpp::ShortParamLength)
+    assert(length <= hidpp::LongParamLength);
+    if(length <= hidpp::ShortParamLength)
         type = hidpp::Report::Type::Short;
-    else if(params.size() <= hidpp::LongParamLength)
+    else if(length <= hidpp::LongParamLength)
         type = hidpp::Report::Type::Long;
     else
         throw hidpp::Report::InvalidReportID();
 
     hidpp::Report request(type, deviceIndex(), feature_index, function,
-            LOGID_HIDPP_SOFTWARE_ID);
-    std::copy(params.begin(), params.end(), request.paramBegin());
+            nextSoftwareId());
+    std::copy(params, params + length, request.paramBegin());
+
+    return request;
+}
+
+std::vector<uint8_t> Device::callFunction(uint8_t feature_index,
+        uint8_t function, std::vector<uint8_t>& params)
+{
+    return tryCallFunction(feature_index, function, params).value();
+}
+
+Result<std::vector<uint8_t>> Device::tryCallFunction(uint8_t feature_index,
+        uint8_t function, std::vector<uint8_t>& params)
+{
+    _forgetShared(feature_index);
+    return _callFunction(feature_index, function, params);
+}
+
+Result<std::vector<uint8_t>> Device::_callFunction(uint8_t feature_index,
+        uint8_t function, std::vector<uint8_t>& params)
+{
+    auto request = _makeRequest(feature_index, function, params);
+    auto response = this->trySendReport(request);
+    if(!response)
+        return response.failure();
+    return std::vector<uint8_t>(response->paramBegin(), response->paramEnd());
+}
+
+std::future<std::vector<uint8_t>> Device::callFunctionAsync(
+        uint8_t feature_index, uint8_t function, std::vector<uint8_t>& params)
+{
+    _forgetShared(feature_index);
+    auto request = _makeRequest(feature_index, function, params);
+    auto response = this->sendReportAsync(request);
+    return std::async(std::launch::deferred,
+            [response=std::move(response)]() mutable {
+        auto report = response.get();
+        return std::vector<uint8_t>(report.paramBegin(), report.paramEnd());
+    });
+}
 
-    auto response = this->sendReport(request);
-    return std::vector<uint8_t>(response.paramBegin(), response.paramEnd());
+void Device::callFunctionAsync(uint8_t feature_index, uint8_t function,
+        std::vector<uint8_t>& params,
+        const std::function<void(std::vector<uint8_t>&)>& on_response,
+        const std::function<void(std::exception&)>& on_error)
+{
+    _forgetShared(feature_index);
+    auto request = _makeRequest(feature_index, function, params);
+    this->sendReportAsync(request, [on_response](hidpp::Report& response) {
+        std::vector<uint8_t> results(response.paramBegin(),
+                response.paramEnd());
+        on_response(results);
+    }, on_error);
 }
 
 void Device::callFunctionNoResponse(uint8_t feature_index, uint8_t function,
         std::vector<uint8_t> &params)
 {
-    hidpp::Report::Type type;
-
-    assert(params.size() <= hidpp::LongParamLength);
-    if(params.size() <= hidpp::ShortParamLength)
-        type = hidpp::Report::Type::Short;
-    else if(params.size() <= hidpp::LongParamLength)
-        type = hidpp::Report::Type::Long;
-    else
-        throw hidpp::Report::InvalidReportID();
+    _forgetShared(feature_index);
+    auto request = _makeRequest(feature_index, function, params);
+    this->sendReportNoResponse(request);
+}
 
-    hidpp::Report request(type, deviceIndex(), feature_index, function,
-                          LOGID_HIDPP_SOFTWARE_ID);
-    std::copy(params.begin(), params.end(), request.paramBegin());
+Result<hidpp::Report> Device::tryCallReport(uint8_t feature_index,
+        uint8_t function, const uint8_t* params, std::size_t length)
+{
+    _forgetShared(feature_index);
+    auto request = _makeRequest(feature_index, function, params, length);
+    return this->trySendReport(request);
+}
 
+void Device::callReportNoResponse(uint8_t feature_index, uint8_t function,
+        const uint8_t* params, std::size_t length)
+{
+    _forgetShared(feature_index);
+    auto request = _makeRequest(feature_index, function, params, length);
     this->sendReportNoResponse(request);
-}
\ No newline at end of file
+}
+
+Result<std::vector<uint8_t>> Device::tryCallShared(uint8_t feature_index,
+        uint8_t function, std::vector<uint8_t>& params)
+{
+    std::vector<uint8_t> key = {feature_index, function};
+    key.insert(key.end(), params.begin(), params.end());
+
+    std::promise<Result<std::vector<uint8_t>>> promise;
+    std::unique_lock<std::mutex> lock(_shared_lock);
+    auto it = _shared_calls.find(key);
+    if(it != _shared_calls.end()) {
+        auto call = it->second;
+        lock.unlock();
+        return call.get();
+    }
+    _shared_calls.emplace(key, promise.get_future().share());
+    lock.unlock();
+
+    /* May drop a newer call after _forgetShared, which only means its
+     * readers stop being joined early. */
+    auto forget = [this, &key]() {
+        std::lock_guard<std::mutex> lock(_shared_lock);
+        _shared_calls.erase(key);
+    };
+
+    try {
+        auto result = _callFunction(feature_index, function, params);
+        // Readers that come later send their own request
+        forget();
+        promise.set_value(result);
+        return result;
+    } catch(...) {
+        forget();
+        promise.set_exception(std::current_exception());
+        throw;
+    }
+}
+
+void Device::_forgetShared(uint8_t feature_index)
+{
+    std::lock_guard<std::mutex> lock(_shared_lock);
+    if(_shared_calls.empty())
+        return;
+    // Still answered, but no new reader joins them
+    auto begin = _shared_calls.lower_bound({feature_index});
+    auto end = _shared_calls.lower_bound({(uint8_t)(feature_index + 1)});
+    if(feature_index == 0xff)
+        end = _shared_calls.end();
+    _shared_calls.erase(begin, end);
+}
+
+uint8_t Device::featureIndex(uint16_t feature_id)
+{
+    return tryFeatureIndex(feature_id).value();
+}
+
+Result<uint8_t> Device::tryFeatureIndex(uint16_t feature_id)
+{
+    if(feature_id == FeatureID::ROOT)
+        return (uint8_t)FeatureID::ROOT;
+
+    Failure unsupported(Failure::UnsupportedFeature, feature_id);
+    {
+        std::lock_guard<std::mutex> lock(_feature_lock);
+        auto it = _feature_indices->find(feature_id);
+        if(it != _feature_indices->end()) {
+            // 0 if not found
+            if(!it->second)
+                return unsupported;
+            return it->second;
+        }
+        if(_feature_table_complete)
+            return unsupported;
+    }
+
+    std::vector<uint8_t> params(2);
+    params[0] = (feature_id >> 8) & 0xff;
+    params[1] = feature_id & 0xff;
+
+    uint8_t index;
+    auto response = tryCallFunction(FeatureID::ROOT, Root::GetFeature, params);
+    if(response) {
+        index = (*response)[0];
+    } else {
+        if(!response.failure().is(Failure::Hidpp20Error,
+                Error::InvalidFeatureIndex))
+            return response.failure();
+        index = 0;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_feature_lock);
+        auto features = std::make_shared<FeatureMap>(*_feature_indices);
+        (*features)[feature_id] = index;
+        _feature_indices = std::move(features);
+    }
+
+    if(!index)
+        return unsupported;
+
+    return index;
+}
+
+std::map<uint8_t, uint16_t> Device::featureTable()
+{
+    std::map<uint8_t, uint16_t> table;
+    {
+        std::lock_guard<std::mutex> lock(_feature_lock);
+        if(_feature_table_complete) {
+            // Index 0 is either the root feature or a failed lookup
+            for(auto& feature : *_feature_indices)
+                if(feature.second || feature.first == FeatureID::ROOT)
+                    table[feature.second] = feature.first;
+            return table;
+        }
+    }
+
+    FeatureSet feature_set(this);
+    table = feature_set.getFeatures();
+    FeatureMap enumerated;
+    for(auto& feature : table)
+        enumerated[feature.second] = feature.first;
+    auto firmware = _firmwareOf(enumerated);
+
+    std::lock_guard<std::mutex> lock(_feature_lock);
+    auto features = std::make_shared<FeatureMap>(*_feature_indices);
+    for(auto& feature : enumerated)
+        (*features)[feature.first] = feature.second;
+    _feature_indices = std::move(features);
+    _feature_table_complete = true;
+    _firmware = std::move(firmware);
+    return table;
+}
+
+bool Device::refreshFeatureTable()
+{
+    std::lock_guard<std::mutex> lock(_feature_lock);
+    if(!_feature_table_cached)
+        return false;
+
+    logPrintf(WARN, "%s:%d: Cached feature table is stale, discarding.",
+            devicePath().c_str(), deviceIndex());
+
+    _feature_indices = std::make_shared<const FeatureMap>();
+    _feature_table_complete = false;
+    _feature_table_cached = false;
+    _firmware.clear();
+    std::remove(_featureTablePath().c_str());
+    model_tables.take(_modelKey());
+
+    // Cached responses are keyed by the stale feature indices
+    {
+        std::lock_guard<std::mutex> capability_lock(_capability_lock);
+        _shared_capabilities = std::make_shared<const CapabilityMap>();
+        _capabilities.clear();
+        _capabilities_dirty = false;
+    }
+    std::remove(_capabilitiesPath().c_str());
+
+    return true;
+}
+
+bool Device::cachedResponse(uint8_t feature_index, uint8_t function,
+        const std::vector<uint8_t>& params, std::vector<uint8_t>& response)
+{
+    std::vector<uint8_t> key = {feature_index, function};
+    key.insert(key.end(), params.begin(), params.end());
+
+    std::lock_guard<std::mutex> lock(_capability_lock);
+    auto it = _capabilities.find(key);
+    if(it != _capabilities.end()) {
+        response = it->second;
+        return true;
+    }
+    auto shared = _shared_capabilities->find(key);
+    if(shared == _shared_capabilities->end())
+        return false;
+    response = shared->second;
+    return true;
+}
+
+void Device::cacheResponse(uint8_t feature_index, uint8_t function,
+        const std::vector<uint8_t>& params,
+        const std::vector<uint8_t>& response)
+{
+    std::vector<uint8_t> key = {feature_index, function};
+    key.insert(key.end(), params.begin(), params.end());
+
+    std::lock_guard<std::mutex> lock(_capability_lock);
+    _capabilities[std::move(key)] = response;
+    _capabilities_dirty = true;
+}
+
+/* Same header as the feature table, then one "request response" pair of
+ * hex strings per line. */
+void Device::saveCapabilities()
+{
+    std::string header;
+    {
+        std::lock_guard<std::mutex> lock(_feature_lock);
+        // Responses are only reusable alongside a feature table on disk
+        if(global_config->featureCache().empty() ||
+           !_feature_table_complete || _firmware.empty())
+            return;
+        header = _featureTableHeader();
+    }
+
+    _publishModelTables();
+
+    std::lock_guard<std::mutex> lock(_capability_lock);
+    if(!_capabilities_dirty)
+        return;
+
+    std::ostringstream file;
+    file << header << std::endl;
+    for(auto& capability : *_shared_capabilities)
+        file << hex(capability.first) << " " << hex(capability.second) <<
+            std::endl;
+
+    if(replaceFile(_capabilitiesPath(), file.str()))
+        _capabilities_dirty = false;
+}
+
+void Device::_readCapabilities(const std::string& path)
+{
+    std::ifstream file(path);
+    if(!file)
+        return;
+
+    std::string header;
+    std::getline(file, header);
+    {
+        std::lock_guard<std::mutex> lock(_feature_lock);
+        if(header != _featureTableHeader())
+            return;
+    }
+
+    auto read_bytes = [](const std::string& hex, std::vector<uint8_t>& bytes) {
+        if(hex.size() % 2)
+            return false;
+        bytes.clear();
+        for(std::size_t i = 0; i < hex.size(); i += 2) {
+            auto digits = hex.substr(i, 2);
+            char* end;
+            auto byte = std::strtoul(digits.c_str(), &end, 16);
+            if(*end)
+                return false;
+            bytes.push_back(byte);
+        }
+        return true;
+    };
+
+    CapabilityMap capabilities;
+    std::string line;
+    while(std::getline(file, line)) {
+        std::istringstream fields(line);
+        std::string request, response;
+        std::vector<uint8_t> key, value;
+        if(!(fields >> request >> response) || !read_bytes(request, key) ||
+           !read_bytes(response, value) || key.size() < 2)
+            return;
+        capabilities[std::move(key)] = std::move(value);
+    }
+
+    std::lock_guard<std::mutex> lock(_capability_lock);
+    _shared_capabilities = std::make_shared<const CapabilityMap>(
+            std::move(capabilities));
+    _capabilities.clear();
+    _capabilities_dirty = false;
+}
+
+std::string Device::_capabilitiesPath() const
+{
+    char pid_str[5];
+    snprintf(pid_str, sizeof(pid_str), "%04x", pid());
+    return global_config->featureCache() + "/" + pid_str + ".capabilities";
+}
+
+std::string Device::_featureTableHeader() const
+{
+    return std::to_string((int)std::get<0>(version())) + " " +
+        std::to_string((int)std::get<1>(version())) + " " +
+        std::to_string(featureCount(*_feature_indices)) + " " + _firmware;
+}
+
+std::string Device::_askFirmware(uint16_t feature_id, uint8_t index)
+{
+    std::vector<uint8_t> params(feature_id == FeatureID::FW_VERSION ? 1 : 0);
+    try {
+        if(feature_id == FeatureID::FW_VERSION)
+            return hex(callFunction(index, GetFwInfo, params));
+        return std::to_string(callFunction(index,
+                FeatureSet::GetFeatureCount, params)[0]);
+    } catch(Error& e) {
+        // The index belongs to another feature on this firmware
+        return {};
+    }
+}
+
+std::string Device::_firmwareOf(const FeatureMap& features)
+{
+    auto fw_version = features.find(FeatureID::FW_VERSION);
+    if(fw_version == features.end() || !fw_version->second)
+        return "-";
+    return _askFirmware(FeatureID::FW_VERSION, fw_version->second);
+}
+
+bool Device::_matchesFirmware(const FeatureMap& features, unsigned int count,
+        const std::string& firmware, FirmwareAnswers& answers)
+{
+    if(firmware.empty())
+        return false;
+    bool versioned = firmware != "-";
+    uint16_t feature_id = versioned ? FeatureID::FW_VERSION :
+            FeatureID::FEATURE_SET;
+    auto feature = features.find(feature_id);
+    if(feature == features.end() || !feature->second)
+        return false;
+
+    auto key = std::make_pair(feature_id, feature->second);
+    auto answer = answers.find(key);
+    if(answer == answers.end())
+        answer = answers.emplace(key, _askFirmware(feature_id,
+                feature->second)).first;
+    return !answer->second.empty() && answer->second ==
+            (versioned ? firmware : std::to_string(count));
+}
+
+std::string Device::_featureTablePath() const
+{
+    char pid_str[5];
+    snprintf(pid_str, sizeof(pid_str), "%04x", pid());
+    return global_config->featureCache() + "/" + pid_str + ".features";
+}
+
+// Treated like a table read from disk, stale indices are refreshed
+void Device::_restoreFeatureTable(const State& state)
+{
+    if(!restored() || state.features.empty()) {
+        _loadFeatureTable();
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_feature_lock);
+        _feature_indices = std::make_shared<const FeatureMap>(state.features);
+        _feature_table_complete = state.features_complete;
+        _feature_table_cached = true;
+        // Empty for snapshots of older versions, nothing is then shared
+        _firmware = state.firmware;
+    }
+    std::lock_guard<std::mutex> lock(_capability_lock);
+    _shared_capabilities = std::make_shared<const CapabilityMap>(
+            state.capabilities);
+    _capabilities.clear();
+    _capabilities_dirty = false;
+}
+
+std::string Device::_modelKey() const
+{
+    char key[16];
+    snprintf(key, sizeof(key), "%04x %d %d", pid(), std::get<0>(version()),
+            std::get<1>(version()));
+    return key;
+}
+
+bool Device::_adoptModelTables()
+{
+    auto tables = model_tables.get(_modelKey());
+    if(!tables)
+        return false;
+
+    // The same check as for a table read from disk
+    FirmwareAnswers answers;
+    if(!_matchesFirmware(*tables->features, featureCount(*tables->features),
+            tables->firmware, answers))
+        return false;
+
+    {
+        std::lock_guard<std::mutex> lock(_feature_lock);
+        _feature_indices = tables->features;
+        _feature_table_complete = true;
+        _feature_table_cached = true;
+        _firmware = tables->firmware;
+    }
+    std::lock_guard<std::mutex> lock(_capability_lock);
+    _shared_capabilities = tables->capabilities;
+    _capabilities.clear();
+    _capabilities_dirty = false;
+    return true;
+}
+
+/* Folds the responses this device learned into the shared ones, along
+ * with those other devices of the model published in the meantime. */
+void Device::_publishModelTables()
+{
+    std::lock_guard<std::mutex> lock(_feature_lock);
+    if(!_feature_table_complete || _firmware.empty())
+        return;
+
+    auto key = _modelKey();
+    auto published = model_tables.get(key);
+    std::lock_guard<std::mutex> capability_lock(_capability_lock);
+    if(published && published->firmware == _firmware &&
+       *published->features == *_feature_indices &&
+       published->capabilities != _shared_capabilities) {
+        auto merged = std::make_shared<CapabilityMap>(
+                *published->capabilities);
+        for(auto& capability : *_shared_capabilities)
+            merged->insert(capability);
+        _shared_capabilities = std::move(merged);
+    }
+    if(!_capabilities.empty()) {
+        auto merged = std::make_shared<CapabilityMap>(*_shared_capabilities);
+        for(auto& capability : _capabilities)
+            (*merged)[capability.first] = capability.second;
+        _shared_capabilities = std::move(merged);
+        _capabilities.clear();
+    }
+
+    auto tables = std::make_shared<ModelTables>();
+    tables->firmware = _firmware;
+    tables->features = _feature_indices;
+    tables->capabilities = _shared_capabilities;
+    model_tables.assign(key, std::move(tables));
+}
+
+void Device::_loadFeatureTable()
+{
+    try {
+        if(_adoptModelTables())
+            return;
+    } catch(std::exception& e) {
+        LOGID_LOG(DEBUG, "%s:%d: Could not adopt model tables: %s",
+                devicePath().c_str(), deviceIndex(), e.what());
+    }
+
+    bool caching = !global_config->featureCache().empty();
+    auto path = _featureTablePath();
+
+    try {
+        if(caching && _readFeatureTable(path)) {
+            _readCapabilities(_capabilitiesPath());
+            _publishModelTables();
+            return;
+        }
+
+        // Responses cached for another firmware cannot be trusted
+        if(caching) {
+            std::remove(path.c_str());
+            std::remove(_capabilitiesPath().c_str());
+        }
+
+        if(_readModelDatabase()) {
+            _publishModelTables();
+            return;
+        }
+
+        if(!caching)
+            return;
+
+        auto features = featureTable();
+        if(logEnabled(DEBUG)) {
+            for(auto& feature : features)
+                LOGID_LOG(DEBUG, "%s:%d: feature 0x%04x at index %d",
+                        devicePath().c_str(), deviceIndex(), feature.second,
+                        feature.first);
+        }
+
+        _writeFeatureTable(path);
+        _publishModelTables();
+    } catch(std::exception& e) {
+        LOGID_LOG(DEBUG, "%s:%d: Could not load feature table: %s",
+                devicePath().c_str(), deviceIndex(), e.what());
+        std::lock_guard<std::mutex> lock(_feature_lock);
+        _feature_table_complete = false;
+        _feature_table_cached = false;
+    }
+}
+
+// See readFeatureTable for the format
+bool Device::_readFeatureTable(const std::string& path)
+{
+    std::ifstream file(path);
+    if(!file)
+        return false;
+
+    unsigned int major, minor, count;
+    std::string firmware;
+    FeatureMap features;
+    if(!readFeatureTable(file, major, minor, count, firmware, features))
+        return false;
+
+    if(std::make_tuple(major, minor) != std::make_tuple(
+            (unsigned int)std::get<0>(version()),
+            (unsigned int)std::get<1>(version())))
+        return false;
+
+    // Make sure the table still belongs to this firmware
+    FirmwareAnswers answers;
+    if(!_matchesFirmware(features, count, firmware, answers))
+        return false;
+
+    std::lock_guard<std::mutex> lock(_feature_lock);
+    _feature_indices = std::make_shared<const FeatureMap>(
+            std::move(features));
+    _feature_table_complete = true;
+    _feature_table_cached = true;
+    _firmware = std::move(firmware);
+
+    return true;
+}
+
+/* Entries are named <pid>[-firmware].features and .capabilities, in the
+ * format of the cache. Each firmware check is asked once per index, so
+ * telling the firmware apart is usually a single request. */
+bool Device::_readModelDatabase()
+{
+    auto& database = global_config->modelDatabase();
+    if(database.empty())
+        return false;
+    DIR* dir = ::opendir(database.c_str());
+    if(!dir)
+        return false;
+
+    char pid_str[5];
+    snprintf(pid_str, sizeof(pid_str), "%04x", pid());
+    const std::string suffix = ".features";
+    std::vector<std::string> names;
+    while(auto entry = ::readdir(dir)) {
+        std::string name = entry->d_name;
+        // <pid>.features has nothing between the PID and the suffix
+        if(name.size() >= 4 + suffix.size() && !name.compare(0, 4, pid_str) &&
+           (name[4] == '.' || name[4] == '-') &&
+           !name.compare(name.size() - suffix.size(), suffix.size(), suffix))
+            names.push_back(name.substr(0, name.size() - suffix.size()));
+    }
+    ::closedir(dir);
+    std::sort(names.begin(), names.end());
+
+    FirmwareAnswers answers;
+    for(auto& name : names) {
+        auto stem = database + "/" + name;
+        std::ifstream file(stem + suffix);
+        unsigned int major, minor, count;
+        std::string firmware;
+        FeatureMap features;
+        if(!readFeatureTable(file, major, minor, count, firmware, features) ||
+           std::make_tuple(major, minor) != std::make_tuple(
+                (unsigned int)std::get<0>(version()),
+                (unsigned int)std::get<1>(version())) ||
+           !_matchesFirmware(features, count, firmware, answers))
+            continue;
+
+        LOGID_LOG(DEBUG, "%s:%d: Using the feature table of %s",
+                devicePath().c_str(), deviceIndex(), name.c_str());
+        {
+            std::lock_guard<std::mutex> lock(_feature_lock);
+            _feature_indices = std::make_shared<const FeatureMap>(
+                    std::move(features));
+            _feature_table_complete = true;
+            _feature_table_cached = true;
+            _firmware = std::move(firmware);
+        }
+        _readCapabilities(stem + ".capabilities");
+        return true;
+    }
+    return false;
+}
+
+void Device::_writeFeatureTable(const std::string& path)
+{
+    if(-1 == ::mkdir(global_config->featureCache().c_str(), 0755) &&
+        errno != EEXIST) {
+        LOGID_LOG(DEBUG, "Could not create %s: %s",
+                global_config->featureCache().c_str(), strerror(errno));
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(_feature_lock);
+    if(_firmware.empty())
+        return;
+
+    std::ostringstream file;
+    file << _featureTableHeader() << std::endl;
+    for(auto& feature : *_feature_indices)
+        file << std::hex << feature.first << " " << std::dec <<
+            (int)feature.second << std::endl;
+
+    replaceFile(path, file.str());
+}
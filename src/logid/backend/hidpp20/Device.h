@@ -21,6 +21,10 @@
 
 #include "../hidpp/Device.h"
 #include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <map>
 
 namespace logid {
 namespace backend {
@@ -33,13 +37,157 @@ namespace hidpp20 {
         Device(std::shared_ptr<dj::Receiver> receiver, hidpp::DeviceIndex
             index);
 
+        /* Everything setting up the device would otherwise read from it,
+         * see hidpp::Device::Identity. The feature table and responses are
+         * only used if the identity matched. */
+        struct State
+        {
+            hidpp::Device::Identity identity;
+            std::map<uint16_t, uint8_t> features;
+            bool features_complete;
+            // See _firmwareOf, empty if unknown
+            std::string firmware;
+            std::map<std::vector<uint8_t>, std::vector<uint8_t>> capabilities;
+        };
+        Device(std::shared_ptr<raw::RawDevice> raw_device,
+                hidpp::DeviceIndex index, const State& state);
+        Device(std::shared_ptr<dj::Receiver> receiver,
+                hidpp::DeviceIndex index, const State& state);
+        State state();
+
         std::vector<uint8_t> callFunction(uint8_t feature_index,
                 uint8_t function,
                 std::vector<uint8_t>& params);
+        Result<std::vector<uint8_t>> tryCallFunction(uint8_t feature_index,
+                uint8_t function,
+                std::vector<uint8_t>& params);
+
+        std::future<std::vector<uint8_t>> callFunctionAsync(
+                uint8_t feature_index, uint8_t function,
+                std::vector<uint8_t>& params);
+        // Does not block, handlers run as for hidpp::Device::sendReportAsync
+        void callFunctionAsync(uint8_t feature_index, uint8_t function,
+                std::vector<uint8_t>& params,
+                const std::function<void(std::vector<uint8_t>&)>& on_response,
+                const std::function<void(std::exception&)>& on_error);
 
         void callFunctionNoResponse(uint8_t feature_index,
                 uint8_t function,
                 std::vector<uint8_t>& params);
+
+        /* Same as tryCallFunction and callFunctionNoResponse for requests
+         * of a fixed size, the response is the report itself. Neither
+         * allocates, see function.h. */
+        Result<hidpp::Report> tryCallReport(uint8_t feature_index,
+                uint8_t function, const uint8_t* params, std::size_t length);
+        void callReportNoResponse(uint8_t feature_index, uint8_t function,
+                const uint8_t* params, std::size_t length);
+
+        /* For reads without side effects: identical calls that are in
+         * flight at once share one request and its response. Any other
+         * call to the feature keeps later reads from joining those sent
+         * before it. */
+        Result<std::vector<uint8_t>> tryCallShared(uint8_t feature_index,
+                uint8_t function,
+                std::vector<uint8_t>& params);
+
+        /* Feature indices are looked up through Root.GetFeature once and
+         * remembered. When a feature cache directory is configured, the
+         * whole feature table is enumerated once per device model and
+         * read back from disk afterwards. Models in the built-in database
+         * are not enumerated even the first time. */
+        uint8_t featureIndex(uint16_t feature_id);
+        // Unsupported features fail with Failure::UnsupportedFeature
+        Result<uint8_t> tryFeatureIndex(uint16_t feature_id);
+
+        /* Every feature of the device keyed by index, enumerated in one
+         * pipelined batch unless the whole table is already known. */
+        std::map<uint8_t, uint16_t> featureTable();
+
+        /* Discards a feature table read from disk, returns false if the
+         * current table was not read from disk. */
+        bool refreshFeatureTable();
+
+        /* Responses to requests that only depend on the model and its
+         * firmware, e.g. capabilities and control lists. They are kept
+         * next to the feature table and trusted as long as it is. */
+        bool cachedResponse(uint8_t feature_index, uint8_t function,
+                const std::vector<uint8_t>& params,
+                std::vector<uint8_t>& response);
+        void cacheResponse(uint8_t feature_index, uint8_t function,
+                const std::vector<uint8_t>& params,
+                const std::vector<uint8_t>& response);
+        // Writes newly cached responses to disk
+        void saveCapabilities();
+    private:
+        typedef std::map<uint16_t, uint8_t> FeatureMap;
+        typedef std::map<std::vector<uint8_t>, std::vector<uint8_t>>
+            CapabilityMap;
+
+        /* Devices of the same model and protocol version share the feature
+         * table and cached responses in memory once one of them has read
+         * or enumerated them. Returns false if there was nothing to
+         * share or this firmware has a different feature count. */
+        bool _adoptModelTables();
+        void _publishModelTables();
+        std::string _modelKey() const;
+
+        void _loadFeatureTable();
+        void _restoreFeatureTable(const State& state);
+        bool _readFeatureTable(const std::string& path);
+        void _writeFeatureTable(const std::string& path);
+        std::string _featureTablePath() const;
+        /* Protocol version, feature count and firmware, _feature_lock
+         * must be held */
+        std::string _featureTableHeader() const;
+
+        /* Tables are tied to a firmware by the GetFwInfo(0) answer of
+         * 0x0003 in hex, or "-" on devices without it, whose tables fall
+         * back to matching the feature count. */
+        typedef std::map<std::pair<uint16_t, uint8_t>, std::string>
+            FirmwareAnswers;
+        // Empty if the request failed
+        std::string _askFirmware(uint16_t feature_id, uint8_t index);
+        std::string _firmwareOf(const FeatureMap& features);
+        /* One request, unless answers already holds it, tells whether
+         * this device runs the firmware a table was read from. */
+        bool _matchesFirmware(const FeatureMap& features, unsigned int count,
+                const std::string& firmware, FirmwareAnswers& answers);
+
+        // Tables shipped with logid, see Configuration::modelDatabase()
+        bool _readModelDatabase();
+        void _readCapabilities(const std::string& path);
+        std::string _capabilitiesPath() const;
+
+        std::mutex _feature_lock;
+        // Possibly shared with devices of the same model, copied on write
+        std::shared_ptr<const FeatureMap> _feature_indices =
+            std::make_shared<const FeatureMap>();
+        bool _feature_table_complete = false;
+        bool _feature_table_cached = false;
+        // Of a complete table, empty while unknown
+        std::string _firmware;
+
+        std::mutex _capability_lock;
+        /* Keyed by feature index, function and parameters. Those shared
+         * with the model are looked up after this device's own. */
+        std::shared_ptr<const CapabilityMap> _shared_capabilities =
+            std::make_shared<const CapabilityMap>();
+        CapabilityMap _capabilities;
+        bool _capabilities_dirty = false;
+
+        hidpp::Report _makeRequest(uint8_t feature_index, uint8_t function,
+                std::vector<uint8_t>& params);
+        hidpp::Report _makeRequest(uint8_t feature_index, uint8_t function,
+                const uint8_t* params, std::size_t length);
+
+        typedef std::shared_future<Result<std::vector<uint8_t>>> SharedCall;
+        std::mutex _shared_lock;
+        // Keyed like _capabilities
+        std::map<std::vector<uint8_t>, SharedCall> _shared_calls;
+        void _forgetShared(uint8_t feature_index);
+        Result<std::vector<uint8_t>> _callFunction(uint8_t feature_index,
+                uint8_t function, std::vector<uint8_t>& params);
     };
 }}}
 
@@ -22,10 +22,54 @@
 #include "features/Root.h"
 #include "Error.h"
 
+using namespace logid::backend;
 using namespace logid::backend::hidpp20;
 
 std::vector<uint8_t> EssentialFeature::callFunction(uint8_t function_id,
         std::vector<uint8_t>& params)
+{
+    return tryCallFunction(function_id, params).value();
+}
+
+Result<std::vector<uint8_t>> EssentialFeature::tryCallFunction(
+        uint8_t function_id, std::vector<uint8_t>& params)
+{
+    auto request = _makeRequest(function_id, params);
+    auto response = _device->trySendReport(request);
+    if(!response)
+        return response.failure();
+    return std::vector<uint8_t>(response->paramBegin(), response->paramEnd());
+}
+
+std::vector<std::vector<uint8_t>> EssentialFeature::callFunctions(
+        uint8_t function_id, std::vector<std::vector<uint8_t>>& params)
+{
+    std::vector<std::future<hidpp::Report>> pending;
+    for(auto& request_params : params) {
+        auto request = _makeRequest(function_id, request_params);
+        pending.push_back(_device->sendReportAsync(request));
+    }
+
+    // Wait for every response before throwing the first error
+    std::vector<std::vector<uint8_t>> responses;
+    std::exception_ptr error;
+    for(auto& response : pending) {
+        try {
+            auto report = response.get();
+            responses.emplace_back(report.paramBegin(), report.paramEnd());
+        } catch(std::exception& e) {
+            if(!error)
+                error = std::current_exception();
+        }
+    }
+    if(error)
+        std::rethrow_exception(error);
+
+    return responses;
+}
+
+hidpp::Report EssentialFeature::_makeRequest(uint8_t function_id,
+        std::vector<uint8_t>& params)
 {
     hidpp::Report::Type type;
 
@@ -38,11 +82,9 @@ std::vector<uint8_t> EssentialFeature::callFunction(uint8_t function_id,
         throw hidpp::Report::InvalidReportID();
 
     hidpp::Report request(type, _device->deviceIndex(), _index, function_id,
-                          LOGID_HIDPP_SOFTWARE_ID);
+                          _device->nextSoftwareId());
     std::copy(params.begin(), params.end(), request.paramBegin());
-
-    auto response = _device->sendReport(request);
-    return std::vector<uint8_t>(response.paramBegin(), response.paramEnd());
+    return request;
 }
 
 EssentialFeature::EssentialFeature(hidpp::Device* dev, uint16_t _id) :
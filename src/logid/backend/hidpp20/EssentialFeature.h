@@ -41,7 +41,16 @@ namespace hidpp20
         EssentialFeature(hidpp::Device* dev, uint16_t _id);
         std::vector<uint8_t> callFunction(uint8_t function_id,
                 std::vector<uint8_t>& params);
+        Result<std::vector<uint8_t>> tryCallFunction(uint8_t function_id,
+                std::vector<uint8_t>& params);
+        /* Every request is sent before waiting for the first response,
+         * meant for the few requests a name or similar read takes. */
+        std::vector<std::vector<uint8_t>> callFunctions(uint8_t function_id,
+                std::vector<std::vector<uint8_t>>& params);
     private:
+        hidpp::Report _makeRequest(uint8_t function_id,
+                std::vector<uint8_t>& params);
+
         hidpp::Device* _device;
         uint8_t _index;
     };
@@ -21,6 +21,7 @@
 #include "feature_defs.h"
 #include "features/Root.h"
 
+using namespace logid::backend;
 using namespace logid::backend::hidpp20;
 
 const char* UnsupportedFeature::what() const noexcept
@@ -36,7 +37,71 @@ uint16_t UnsupportedFeature::code() const noexcept
 std::vector<uint8_t> Feature::callFunction(uint8_t function_id,
         std::vector<uint8_t>& params)
 {
-    return _device->callFunction(_index, function_id, params);
+    return tryCallFunction(function_id, params).value();
+}
+
+Result<std::vector<uint8_t>> Feature::tryCallFunction(uint8_t function_id,
+        std::vector<uint8_t>& params)
+{
+    auto response = _device->tryCallFunction(_index, function_id, params);
+    if(response || !response.failure().is(Failure::Hidpp20Error,
+            Error::InvalidFeatureIndex))
+        return response;
+
+    /* A stale cached feature table may leave this feature at the
+     * wrong index, look it up again and retry if it moved. */
+    _device->refreshFeatureTable();
+    auto index = _device->tryFeatureIndex(getID());
+    if(!index || *index == _index)
+        return response;
+    _index = *index;
+
+    return _device->tryCallFunction(_index, function_id, params);
+}
+
+Result<hidpp::Report> Feature::_tryCallReport(uint8_t function_id,
+        const uint8_t* params, std::size_t length)
+{
+    auto response = _device->tryCallReport(_index, function_id, params,
+            length);
+    if(response || !response.failure().is(Failure::Hidpp20Error,
+            Error::InvalidFeatureIndex))
+        return response;
+
+    // The index may be stale, see tryCallFunction
+    _device->refreshFeatureTable();
+    auto index = _device->tryFeatureIndex(getID());
+    if(!index || *index == _index)
+        return response;
+    _index = *index;
+
+    return _device->tryCallReport(_index, function_id, params, length);
+}
+
+std::future<std::vector<uint8_t>> Feature::callFunctionAsync(
+        uint8_t function_id, std::vector<uint8_t>& params)
+{
+    return _device->callFunctionAsync(_index, function_id, params);
+}
+
+void Feature::callFunctionAsync(uint8_t function_id,
+        std::vector<uint8_t>& params,
+        const std::function<void(std::vector<uint8_t>&)>& on_response,
+        const std::function<void(std::exception&)>& on_error)
+{
+    _device->callFunctionAsync(_index, function_id, params, on_response,
+            on_error);
+}
+
+Transaction Feature::transaction()
+{
+    return Transaction(_device);
+}
+
+std::size_t Feature::callFunction(Transaction& transaction,
+        uint8_t function_id, std::vector<uint8_t>& params)
+{
+    return transaction.add(_index, function_id, params);
 }
 
 void Feature::callFunctionNoResponse(uint8_t function_id,
@@ -45,30 +110,61 @@ void Feature::callFunctionNoResponse(uint8_t function_id,
     _device->callFunctionNoResponse(_index, function_id, params);
 }
 
-Feature::Feature(Device* dev, uint16_t _id) : _device (dev)
+std::vector<uint8_t> Feature::callFunctionCached(uint8_t function_id,
+        std::vector<uint8_t>& params)
 {
-    _index = hidpp20::FeatureID::ROOT;
-
-    if(_id)
-    {
-        std::vector<uint8_t> getFunc_req(2);
-        getFunc_req[0] = (_id >> 8) & 0xff;
-        getFunc_req[1] = _id & 0xff;
-
-        try {
-            auto getFunc_resp = this->callFunction(Root::GetFeature,
-                    getFunc_req);
-            _index = getFunc_resp[0];
-        } catch(Error& e) {
-            if(e.code() == Error::InvalidFeatureIndex)
-                throw UnsupportedFeature(_id);
-            throw e;
-        }
-
-        // 0 if not found
-        if(!_index)
-            throw UnsupportedFeature(_id);
+    std::vector<uint8_t> response;
+    if(_device->cachedResponse(_index, function_id, params, response))
+        return response;
+
+    response = callFunction(function_id, params);
+    _device->cacheResponse(_index, function_id, params, response);
+    return response;
+}
+
+std::vector<uint8_t> Feature::callFunctionShared(uint8_t function_id,
+        std::vector<uint8_t>& params)
+{
+    auto response = _device->tryCallShared(_index, function_id, params);
+    if(response || !response.failure().is(Failure::Hidpp20Error,
+            Error::InvalidFeatureIndex))
+        return response.value();
+
+    // The index may be stale, see tryCallFunction
+    return callFunction(function_id, params);
+}
+
+std::vector<std::vector<uint8_t>> Feature::callFunctionsCached(
+        uint8_t function_id, std::vector<std::vector<uint8_t>>& params)
+{
+    std::vector<std::vector<uint8_t>> responses(params.size());
+    std::vector<std::size_t> missing;
+    for(std::size_t i = 0; i < params.size(); i++)
+        if(!_device->cachedResponse(_index, function_id, params[i],
+                responses[i]))
+            missing.push_back(i);
+
+    if(missing.empty())
+        return responses;
+
+    auto requests = transaction();
+    for(auto i : missing)
+        callFunction(requests, function_id, params[i]);
+    requests.commit();
+
+    for(std::size_t i = 0; i < missing.size(); i++) {
+        auto& params_i = params[missing[i]];
+        responses[missing[i]] = requests.response(i);
+        _device->cacheResponse(_index, function_id, params_i,
+                responses[missing[i]]);
     }
+
+    return responses;
+}
+
+Feature::Feature(Device* dev, uint16_t _id) : _device (dev)
+{
+    _index = _device->featureIndex(_id);
 }
 
 uint8_t Feature::featureIndex()
@@ -21,6 +21,8 @@
 
 #include <cstdint>
 #include "Device.h"
+#include "Transaction.h"
+#include "function.h"
 
 namespace logid {
 namespace backend {
@@ -43,14 +45,83 @@ namespace hidpp20 {
         uint8_t featureIndex();
     protected:
         explicit Feature(Device* dev, uint16_t _id);
+
+        // Calls the function that F describes, see function.h
+        template<typename F>
+        Result<typename F::response> tryCall(const typename F::request& request)
+        {
+            typename F::request_params params;
+            F::encode(request, params);
+            auto response = _tryCallReport(F::number, params.data(),
+                    F::request_params::length);
+            if(!response)
+                return response.failure();
+            if(response->paramEnd() - response->paramBegin() <
+               (std::ptrdiff_t)F::response_params::length)
+                throw hidpp::Report::InvalidReportLength();
+            return F::decode(typename F::response_params(
+                    &*response->paramBegin()));
+        }
+
+        template<typename F>
+        typename F::response call(const typename F::request& request)
+        {
+            return tryCall<F>(request).value();
+        }
+
+        template<typename F>
+        void callNoResponse(const typename F::request& request)
+        {
+            typename F::request_params params;
+            F::encode(request, params);
+            _device->callReportNoResponse(_index, F::number, params.data(),
+                    F::request_params::length);
+        }
+
         std::vector<uint8_t> callFunction(uint8_t function_id,
             std::vector<uint8_t>& params);
+        Result<std::vector<uint8_t>> tryCallFunction(uint8_t function_id,
+            std::vector<uint8_t>& params);
+        std::future<std::vector<uint8_t>> callFunctionAsync(
+            uint8_t function_id, std::vector<uint8_t>& params);
+        void callFunctionAsync(uint8_t function_id,
+            std::vector<uint8_t>& params,
+            const std::function<void(std::vector<uint8_t>&)>& on_response,
+            const std::function<void(std::exception&)>& on_error);
+        Transaction transaction();
+        // Returns the request number within the transaction
+        std::size_t callFunction(Transaction& transaction,
+            uint8_t function_id, std::vector<uint8_t>& params);
         void callFunctionNoResponse(uint8_t function_id,
             std::vector<uint8_t>& params);
+        /* For requests that only depend on the model and firmware, the
+         * response is kept in the device's capability cache. */
+        std::vector<uint8_t> callFunctionCached(uint8_t function_id,
+            std::vector<uint8_t>& params);
+        // Concurrent identical reads share one request, see tryCallShared
+        std::vector<uint8_t> callFunctionShared(uint8_t function_id,
+            std::vector<uint8_t>& params);
+        // Uncached requests of the batch are sent in one transaction
+        std::vector<std::vector<uint8_t>> callFunctionsCached(
+            uint8_t function_id, std::vector<std::vector<uint8_t>>& params);
     private:
+        Result<hidpp::Report> _tryCallReport(uint8_t function_id,
+            const uint8_t* params, std::size_t length);
+
         Device* _device;
         uint8_t _index;
     };
+
+    /* Makes feature T unless the device does not have it. Only errors from
+     * T's constructor itself are thrown. */
+    template<typename T>
+    Result<std::shared_ptr<T>> makeFeature(Device* dev)
+    {
+        auto index = dev->tryFeatureIndex(T::ID);
+        if(!index)
+            return index.failure();
+        return std::make_shared<T>(dev);
+    }
 }}}
 
 #endif //LOGID_BACKEND_HIDPP20_FEATURE_H
\ No newline at end of file
@@ -0,0 +1,85 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <cassert>
+#include "Transaction.h"
+#include "Device.h"
+
+using namespace logid::backend::hidpp20;
+
+Transaction::Transaction(Device* device) : _device (device), _sent (0),
+    _done (0)
+{
+}
+
+std::size_t Transaction::add(uint8_t feature_index, uint8_t function,
+        std::vector<uint8_t>& params)
+{
+    Request request{};
+    request.feature_index = feature_index;
+    request.function = function;
+    request.params = params;
+    _requests.push_back(std::move(request));
+
+    _send();
+    return _requests.size() - 1;
+}
+
+void Transaction::commit()
+{
+    while(_done < _requests.size()) {
+        auto& request = _requests[_done];
+        if(request.pending.valid()) {
+            try {
+                request.response = request.pending.get();
+            } catch(std::exception& e) {
+                request.error = std::current_exception();
+            }
+        }
+        _done++;
+        _send();
+    }
+}
+
+const std::vector<uint8_t>& Transaction::response(std::size_t request) const
+{
+    assert(request < _done);
+    if(_requests[request].error)
+        std::rethrow_exception(_requests[request].error);
+    return _requests[request].response;
+}
+
+std::size_t Transaction::size() const
+{
+    return _requests.size();
+}
+
+void Transaction::_send()
+{
+    while(_sent < _requests.size() &&
+            _sent - _done < LOGID_TRANSACTION_WINDOW) {
+        auto& request = _requests[_sent];
+        try {
+            request.pending = _device->callFunctionAsync(
+                    request.feature_index, request.function, request.params);
+        } catch(std::exception& e) {
+            request.error = std::current_exception();
+        }
+        _sent++;
+    }
+}
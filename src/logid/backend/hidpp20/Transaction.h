@@ -0,0 +1,74 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_BACKEND_HIDPP20_TRANSACTION_H
+#define LOGID_BACKEND_HIDPP20_TRANSACTION_H
+
+#include <cstdint>
+#include <exception>
+#include <future>
+#include <vector>
+
+#define LOGID_TRANSACTION_WINDOW 8
+
+namespace logid {
+namespace backend {
+namespace hidpp20
+{
+    class Device;
+
+    /* Queues several function calls and pipelines them onto the wire,
+     * keeping up to LOGID_TRANSACTION_WINDOW requests in flight. Responses
+     * are resolved together by commit(), errors are kept per request.
+     */
+    class Transaction
+    {
+    public:
+        explicit Transaction(Device* device);
+
+        // Returns the request number to pass to response()
+        std::size_t add(uint8_t feature_index, uint8_t function,
+                std::vector<uint8_t>& params);
+
+        // Waits for every queued request
+        void commit();
+
+        // Throws the error of the request, if it failed
+        const std::vector<uint8_t>& response(std::size_t request) const;
+
+        std::size_t size() const;
+    private:
+        struct Request
+        {
+            uint8_t feature_index;
+            uint8_t function;
+            std::vector<uint8_t> params;
+            std::future<std::vector<uint8_t>> pending;
+            std::vector<uint8_t> response;
+            std::exception_ptr error;
+        };
+
+        void _send();
+
+        Device* _device;
+        std::vector<Request> _requests;
+        std::size_t _sent;
+        std::size_t _done;
+    };
+}}}
+
+#endif //LOGID_BACKEND_HIDPP20_TRANSACTION_H
@@ -0,0 +1,203 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "feature_defs.h"
+
+using namespace logid::backend::hidpp20;
+
+const char* FeatureID::name(uint16_t feature_id)
+{
+    switch(feature_id) {
+    case FeatureID::ROOT:
+        return "ROOT";
+    case FeatureID::FEATURE_SET:
+        return "FEATURE_SET";
+    case FeatureID::FEATURE_INFO:
+        return "FEATURE_INFO";
+    case FeatureID::FW_VERSION:
+        return "FW_VERSION";
+    case FeatureID::DEVICE_NAME:
+        return "DEVICE_NAME";
+    case FeatureID::DEVICE_GROUPS:
+        return "DEVICE_GROUPS";
+    case FeatureID::DEVICE_FRIENDLY_NAME:
+        return "DEVICE_FRIENDLY_NAME";
+    case FeatureID::RESET:
+        return "RESET";
+    case FeatureID::CRYPTO_IDENTIFIER:
+        return "CRYPTO_IDENTIFIER";
+    case FeatureID::DFUCONTROL:
+        return "DFUCONTROL";
+    case FeatureID::DFUCONTROL_V2:
+        return "DFUCONTROL_V2";
+    case FeatureID::DFUCONTROL_V3:
+        return "DFUCONTROL_V3";
+    case FeatureID::DFU:
+        return "DFU";
+    case FeatureID::BATTERY_STATUS:
+        return "BATTERY_STATUS";
+    case FeatureID::BATTERY_VOLTAGE:
+        return "BATTERY_VOLTAGE";
+    case FeatureID::CHARGING_CONTROL:
+        return "CHARGING_CONTROL";
+    case FeatureID::LED_CONTROL:
+        return "LED_CONTROL";
+    case FeatureID::GENERIC_TEST:
+        return "GENERIC_TEST";
+    case FeatureID::DEVICE_RESET:
+        return "DEVICE_RESET";
+    case FeatureID::OOB_STATE:
+        return "OOB_STATE";
+    case FeatureID::CONFIGURABLE_DEVICE_PROPERTIES:
+        return "CONFIGURABLE_DEVICE_PROPERTIES";
+    case FeatureID::CHANGE_HOST:
+        return "CHANGE_HOST";
+    case FeatureID::HOSTS_INFO:
+        return "HOSTS_INFO";
+    case FeatureID::BACKLIGHT:
+        return "BACKLIGHT";
+    case FeatureID::BACKLIGHT_V2:
+        return "BACKLIGHT_V2";
+    case FeatureID::BACKLIGHT_V3:
+        return "BACKLIGHT_V3";
+    case FeatureID::PRESENTER_CONTROL:
+        return "PRESENTER_CONTROL";
+    case FeatureID::SENSOR_3D:
+        return "SENSOR_3D";
+    case FeatureID::REPROG_CONTROLS:
+        return "REPROG_CONTROLS";
+    case FeatureID::REPROG_CONTROLS_V2:
+        return "REPROG_CONTROLS_V2";
+    case FeatureID::REPROG_CONTROLS_V2_2:
+        return "REPROG_CONTROLS_V2_2";
+    case FeatureID::REPROG_CONTROLS_V3:
+        return "REPROG_CONTROLS_V3";
+    case FeatureID::REPROG_CONTROLS_V4:
+        return "REPROG_CONTROLS_V4";
+    case FeatureID::PERSISTENT_REMAPPABLE_ACTION:
+        return "PERSISTENT_REMAPPABLE_ACTION";
+    case FeatureID::WIRELESS_DEVICE_STATUS:
+        return "WIRELESS_DEVICE_STATUS";
+    case FeatureID::ENABLE_HIDDEN_FEATURE:
+        return "ENABLE_HIDDEN_FEATURE";
+    case FeatureID::FIRMWARE_PROPERTIES:
+        return "FIRMWARE_PROPERTIES";
+    case FeatureID::ADC_MEASUREMENT:
+        return "ADC_MEASUREMENT";
+    case FeatureID::LEFT_RIGHT_SWAP:
+        return "LEFT_RIGHT_SWAP";
+    case FeatureID::SWAP_BUTTON:
+        return "SWAP_BUTTON";
+    case FeatureID::POINTER_AXES_ORIENTATION:
+        return "POINTER_AXES_ORIENTATION";
+    case FeatureID::VERTICAL_SCROLLING:
+        return "VERTICAL_SCROLLING";
+    case FeatureID::SMART_SHIFT:
+        return "SMART_SHIFT";
+    case FeatureID::HIRES_SCROLLING:
+        return "HIRES_SCROLLING";
+    case FeatureID::HIRES_SCROLLING_V2:
+        return "HIRES_SCROLLING_V2";
+    case FeatureID::LORES_SCROLLING:
+        return "LORES_SCROLLING";
+    case FeatureID::THUMB_WHEEL:
+        return "THUMB_WHEEL";
+    case FeatureID::MOUSE_POINTER:
+        return "MOUSE_POINTER";
+    case FeatureID::ADJUSTABLE_DPI:
+        return "ADJUSTABLE_DPI";
+    case FeatureID::ANGLE_SNAPPING:
+        return "ANGLE_SNAPPING";
+    case FeatureID::SURFACE_TUNING:
+        return "SURFACE_TUNING";
+    case FeatureID::HYBRID_TRACKING:
+        return "HYBRID_TRACKING";
+    case FeatureID::FN_INVERSION:
+        return "FN_INVERSION";
+    case FeatureID::FN_INVERSION_V2:
+        return "FN_INVERSION_V2";
+    case FeatureID::FN_INVERSION_V3:
+        return "FN_INVERSION_V3";
+    case FeatureID::ENCRYPTION:
+        return "ENCRYPTION";
+    case FeatureID::LOCK_KEY_STATE:
+        return "LOCK_KEY_STATE";
+    case FeatureID::SOLAR_DASHBOARD:
+        return "SOLAR_DASHBOARD";
+    case FeatureID::KEYBOARD_LAYOUT:
+        return "KEYBOARD_LAYOUT";
+    case FeatureID::KEYBOARD_DISABLE:
+        return "KEYBOARD_DISABLE";
+    case FeatureID::DISABLE_KEYS:
+        return "DISABLE_KEYS";
+    case FeatureID::MULTIPLATFORM:
+        return "MULTIPLATFORM";
+    case FeatureID::MULTIPLATFORM_V2:
+        return "MULTIPLATFORM_V2";
+    case FeatureID::KEYBOARD_LAYOUT_V2:
+        return "KEYBOARD_LAYOUT_V2";
+    case FeatureID::CROWN:
+        return "CROWN";
+    case FeatureID::TOUCHPAD_FW:
+        return "TOUCHPAD_FW";
+    case FeatureID::TOUCHPAD_SW:
+        return "TOUCHPAD_SW";
+    case FeatureID::TOUCHPAD_FW_WIN8:
+        return "TOUCHPAD_FW_WIN8";
+    case FeatureID::TOUCHMOUSE_RAW:
+        return "TOUCHMOUSE_RAW";
+    case FeatureID::GESTURE:
+        return "GESTURE";
+    case FeatureID::GESTURE_V2:
+        return "GESTURE_V2";
+    case FeatureID::G_KEY:
+        return "G_KEY";
+    case FeatureID::M_KEY:
+        return "M_KEY";
+    case FeatureID::BRIGHTNESS_CONTROL:
+        return "BRIGHTNESS_CONTROL";
+    case FeatureID::REPORT_RATE:
+        return "REPORT_RATE";
+    case FeatureID::RGB_EFFECTS:
+        return "RGB_EFFECTS";
+    case FeatureID::RGB_EFFECTS_V2:
+        return "RGB_EFFECTS_V2";
+    case FeatureID::PER_KEY_LIGHTING:
+        return "PER_KEY_LIGHTING";
+    case FeatureID::PER_KEY_LIGHTING_V2:
+        return "PER_KEY_LIGHTING_V2";
+    case FeatureID::MODE_STATUS:
+        return "MODE_STATUS";
+    case FeatureID::MOUSE_BUTTON_SPY:
+        return "MOUSE_BUTTON_SPY";
+    case FeatureID::LATENCY_MONITORING:
+        return "LATENCY_MONITORING";
+    case FeatureID::GAMING_ATTACHMENTS:
+        return "GAMING_ATTACHMENTS";
+    case FeatureID::FORCE_FEEDBACK:
+        return "FORCE_FEEDBACK";
+    case FeatureID::SIDETONE:
+        return "SIDETONE";
+    case FeatureID::EQUALIZER:
+        return "EQUALIZER";
+    case FeatureID::HEADSET_OUT:
+        return "HEADSET_OUT";
+    default:
+        return nullptr;
+    }
+}
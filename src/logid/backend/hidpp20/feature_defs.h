@@ -50,6 +50,7 @@ namespace hidpp20 {
             DFU = 0xd000,
             BATTERY_STATUS = 0x1000,
             BATTERY_VOLTAGE = 0x1001,
+            UNIFIED_BATTERY = 0x1004,
             CHARGING_CONTROL = 0x1010,
             LED_CONTROL = 0x1300,
             GENERIC_TEST = 0x1800,
@@ -125,6 +126,9 @@ namespace hidpp20 {
             EQUALIZER = 0x8310,
             HEADSET_OUT = 0x8320
         };
+
+        // Returns the enumerator name, or nullptr for unknown features
+        const char* name(uint16_t feature_id);
     }
 
 }}}
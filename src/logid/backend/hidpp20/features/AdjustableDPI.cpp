@@ -26,17 +26,42 @@ AdjustableDPI::AdjustableDPI(Device* dev) : Feature(dev, ID)
 uint8_t AdjustableDPI::getSensorCount()
 {
     std::vector<uint8_t> params(0);
-    auto response = callFunction(GetSensorCount, params);
+    auto response = callFunctionCached(GetSensorCount, params);
     return response[0];
 }
 
 AdjustableDPI::SensorDPIList AdjustableDPI::getSensorDPIList(uint8_t sensor)
 {
-    SensorDPIList dpi_list{};
     std::vector<uint8_t> params(1);
     params[0] = sensor;
-    auto response = callFunction(GetSensorDPIList, params);
+    return sensorDPIList(callFunctionCached(GetSensorDPIList, params));
+}
+
+std::vector<AdjustableDPI::SensorDPIList> AdjustableDPI::getSensorDPILists(
+        uint8_t first, uint8_t count)
+{
+    std::vector<std::vector<uint8_t>> params;
+    for(uint8_t i = 0; i < count; i++)
+        params.push_back({(uint8_t)(first + i)});
+
+    std::vector<SensorDPIList> lists;
+    for(auto& response : callFunctionsCached(GetSensorDPIList, params))
+        lists.push_back(sensorDPIList(response));
+    return lists;
+}
+
+std::size_t AdjustableDPI::getSensorDPIList(Transaction& transaction,
+        uint8_t sensor)
+{
+    std::vector<uint8_t> params(1);
+    params[0] = sensor;
+    return callFunction(transaction, GetSensorDPIList, params);
+}
 
+AdjustableDPI::SensorDPIList AdjustableDPI::sensorDPIList(
+        const std::vector<uint8_t>& response)
+{
+    SensorDPIList dpi_list{};
     dpi_list.dpiStep = false;
     for(std::size_t i = 1; i < response.size(); i+=2) {
         uint16_t dpi = response[i + 1];
@@ -58,7 +83,7 @@ uint16_t AdjustableDPI::getDefaultSensorDPI(uint8_t sensor)
 {
     std::vector<uint8_t> params(1);
     params[0] = sensor;
-    auto response = callFunction(GetSensorDPI, params);
+    auto response = callFunctionShared(GetSensorDPI, params);
 
     uint16_t default_dpi = response[4];
     default_dpi |= (response[3] << 8);
@@ -70,7 +95,7 @@ uint16_t AdjustableDPI::getSensorDPI(uint8_t sensor)
 {
     std::vector<uint8_t> params(1);
     params[0] = sensor;
-    auto response = callFunction(GetSensorDPI, params);
+    auto response = callFunctionShared(GetSensorDPI, params);
 
     uint16_t dpi = response[2];
     dpi |= (response[1] << 8);
@@ -79,10 +104,21 @@ uint16_t AdjustableDPI::getSensorDPI(uint8_t sensor)
 }
 
 void AdjustableDPI::setSensorDPI(uint8_t sensor, uint16_t dpi)
+{
+    call<SetSensorDPIFunction>({sensor, dpi});
+}
+
+void AdjustableDPI::setSensorDPINoResponse(uint8_t sensor, uint16_t dpi)
+{
+    callNoResponse<SetSensorDPIFunction>({sensor, dpi});
+}
+
+void AdjustableDPI::setSensorDPI(Transaction& transaction, uint8_t sensor,
+        uint16_t dpi)
 {
     std::vector<uint8_t> params(3);
     params[0] = sensor;
     params[1] = (dpi >> 8);
     params[2] = (dpi & 0xFF);
-    callFunction(SetSensorDPI, params);
-}
\ No newline at end of file
+    callFunction(transaction, SetSensorDPI, params);
+}
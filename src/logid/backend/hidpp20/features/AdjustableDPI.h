@@ -38,6 +38,26 @@ namespace hidpp20
             SetSensorDPI = 3
         };
 
+        struct SetSensorDPIFunction : function_desc<SetSensorDPI, 3, 0>
+        {
+            struct request
+            {
+                uint8_t sensor;
+                uint16_t dpi;
+            };
+            typedef no_response response;
+
+            static void encode(const request& r, request_params& params)
+            {
+                params.u8<0>(r.sensor);
+                params.be16<1>(r.dpi);
+            }
+            static response decode(const response_params&)
+            {
+                return {};
+            }
+        };
+
         AdjustableDPI(Device* dev);
 
         uint8_t getSensorCount();
@@ -49,11 +69,22 @@ namespace hidpp20
             uint16_t dpiStep;
         };
         SensorDPIList getSensorDPIList(uint8_t sensor);
+        // Lists of sensors first to first+count-1, fetched in one transaction
+        std::vector<SensorDPIList> getSensorDPILists(uint8_t first,
+                uint8_t count);
+        // Returns the request number, see sensorDPIList()
+        std::size_t getSensorDPIList(Transaction& transaction, uint8_t sensor);
+        static SensorDPIList sensorDPIList(
+                const std::vector<uint8_t>& response);
 
         uint16_t getDefaultSensorDPI(uint8_t sensor);
         uint16_t getSensorDPI(uint8_t sensor);
 
         void setSensorDPI(uint8_t sensor, uint16_t dpi);
+        // Does not wait for the device to acknowledge the change
+        void setSensorDPINoResponse(uint8_t sensor, uint16_t dpi);
+        void setSensorDPI(Transaction& transaction, uint8_t sensor,
+                uint16_t dpi);
     };
 }}}
 
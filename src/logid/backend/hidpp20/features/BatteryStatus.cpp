@@ -0,0 +1,49 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <cassert>
+#include "BatteryStatus.h"
+
+using namespace logid::backend::hidpp20;
+
+BatteryStatus::BatteryStatus(Device* dev) : Feature(dev, ID)
+{
+}
+
+BatteryStatus::BatteryLevel BatteryStatus::getBatteryLevel()
+{
+    std::vector<uint8_t> params(0);
+    auto response = callFunctionShared(GetBatteryLevelStatus, params);
+    return _parseLevel(response.data());
+}
+
+BatteryStatus::BatteryLevel BatteryStatus::batteryStatusEvent(
+        const hidpp::Report& report)
+{
+    assert(report.function() == BatteryStatusBroadcast);
+    return _parseLevel(&(*report.paramBegin()));
+}
+
+BatteryStatus::BatteryLevel BatteryStatus::_parseLevel(const uint8_t* params)
+{
+    BatteryLevel level{};
+    level.level = params[0];
+    level.nextLevel = params[1];
+    level.status = static_cast<Status>(params[2]);
+    return level;
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_BACKEND_HIDPP20_FEATURE_BATTERYSTATUS_H
+#define LOGID_BACKEND_HIDPP20_FEATURE_BATTERYSTATUS_H
+
+#include "../Feature.h"
+#include "../feature_defs.h"
+
+namespace logid {
+namespace backend {
+namespace hidpp20
+{
+    class BatteryStatus : public Feature
+    {
+    public:
+        static constexpr uint16_t ID = FeatureID::BATTERY_STATUS;
+        virtual uint16_t getID() { return ID; }
+
+        enum Function : uint8_t
+        {
+            GetBatteryLevelStatus = 0,
+            GetBatteryCapability = 1
+        };
+
+        enum Event : uint8_t
+        {
+            BatteryStatusBroadcast = 0
+        };
+
+        enum Status : uint8_t
+        {
+            Discharging = 0,
+            Recharging = 1,
+            AlmostFull = 2,
+            Full = 3,
+            SlowRecharge = 4,
+            InvalidBatteryType = 5,
+            ThermalError = 6,
+            ChargingError = 7
+        };
+
+        explicit BatteryStatus(Device* dev);
+
+        struct BatteryLevel
+        {
+            // Percent, 0 if the device does not report a level
+            uint8_t level;
+            uint8_t nextLevel;
+            Status status;
+        };
+
+        BatteryLevel getBatteryLevel();
+
+        static BatteryLevel batteryStatusEvent(const hidpp::Report& report);
+    private:
+        static BatteryLevel _parseLevel(const uint8_t* params);
+    };
+}}}
+
+#endif //LOGID_BACKEND_HIDPP20_FEATURE_BATTERYSTATUS_H
@@ -27,8 +27,22 @@ ChangeHost::ChangeHost(Device *dev) : Feature(dev, ID), _host_count (0)
 ChangeHost::HostInfo ChangeHost::getHostInfo()
 {
     std::vector<uint8_t> params(0);
-    auto response = callFunction(GetHostInfo, params);
+    return _parseHostInfo(callFunctionShared(GetHostInfo, params));
+}
+
+void ChangeHost::getHostInfo(const std::function<void(HostInfo)>& on_info,
+        const std::function<void(std::exception&)>& on_error)
+{
+    std::vector<uint8_t> params(0);
+    callFunctionAsync(GetHostInfo, params,
+            [this, on_info](std::vector<uint8_t>& response) {
+        on_info(_parseHostInfo(response));
+    }, on_error);
+}
 
+ChangeHost::HostInfo ChangeHost::_parseHostInfo(
+        const std::vector<uint8_t>& response)
+{
     HostInfo info{};
     info.hostCount = response[0];
     info.currentHost = response[1];
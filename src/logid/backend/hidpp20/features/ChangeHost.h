@@ -18,6 +18,7 @@
 #ifndef LOGID_BACKEND_HIDPP20_FEATURE_CHANGEHOST_H
 #define LOGID_BACKEND_HIDPP20_FEATURE_CHANGEHOST_H
 
+#include <atomic>
 #include "../feature_defs.h"
 #include "../Feature.h"
 
@@ -48,12 +49,17 @@ namespace hidpp20
         };
 
         HostInfo getHostInfo();
+        // on_info runs on the I/O thread
+        void getHostInfo(const std::function<void(HostInfo)>& on_info,
+                const std::function<void(std::exception&)>& on_error);
         void setHost(uint8_t host);
 
         std::vector<uint8_t> getCookies();
         void setCookie(uint8_t host, uint8_t cookie);
     private:
-        uint8_t _host_count;
+        HostInfo _parseHostInfo(const std::vector<uint8_t>& response);
+
+        std::atomic<uint8_t> _host_count;
     };
 }}}
 
@@ -16,40 +16,28 @@
  *
  */
 
-#ifndef MUTEX_QUEUE_H
-#define MUTEX_QUEUE_H
+#include <cassert>
+#include "Crown.h"
 
-#include <queue>
-#include <mutex>
+using namespace logid::backend::hidpp20;
 
-template<typename data>
-class mutex_queue
+Crown::Crown(Device* dev) : Feature(dev, ID)
 {
-public:
-    mutex_queue<data>() = default;
-    bool empty()
-    {
-        std::lock_guard<std::mutex> lock(_mutex);
-        return _queue.empty();
-    }
-    data& front()
-    {
-        std::lock_guard<std::mutex> lock(_mutex);
-        return _queue.front();
-    }
-    void push(const data& _data)
-    {
-        std::lock_guard<std::mutex> lock(_mutex);
-        _queue.push(_data);
-    }
-    void pop()
-    {
-        std::lock_guard<std::mutex> lock(_mutex);
-        _queue.pop();
-    }
-private:
-    std::queue<data> _queue;
-    std::mutex _mutex;
-};
+}
 
-#endif //MUTEX_QUEUE_H
\ No newline at end of file
+void Crown::setMode(Reporting reporting, Rotation rotation)
+{
+    std::vector<uint8_t> params(2);
+    params[0] = reporting;
+    params[1] = rotation;
+    callFunction(SetMode, params);
+}
+
+Crown::CrownEvent Crown::crownEvent(hidpp::Report& report)
+{
+    assert(report.function() == Event);
+    CrownEvent event{};
+    event.rotation = (int8_t)report.paramBegin()[1];
+    event.ratchet = (int8_t)report.paramBegin()[2];
+    return event;
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_BACKEND_HIDPP20_FEATURE_CROWN_H
+#define LOGID_BACKEND_HIDPP20_FEATURE_CROWN_H
+
+#include "../feature_defs.h"
+#include "../Feature.h"
+
+namespace logid {
+namespace backend {
+namespace hidpp20
+{
+    // The crown of the Craft keyboard
+    class Crown : public Feature
+    {
+    public:
+        static const uint16_t ID = FeatureID::CROWN;
+        virtual uint16_t getID() { return ID; }
+
+        enum Function {
+            GetInfo = 0,
+            GetMode = 1,
+            SetMode = 2
+        };
+
+        enum Event {
+            Event = 0
+        };
+
+        enum Reporting : uint8_t
+        {
+            Native = 1,
+            Diverted = 2
+        };
+
+        enum Rotation : uint8_t
+        {
+            Unchanged = 0,
+            FreeSpin = 1,
+            Ratchet = 2
+        };
+
+        struct CrownEvent
+        {
+            // Steps turned, and ratchet notches passed
+            int8_t rotation;
+            int8_t ratchet;
+        };
+
+        explicit Crown(Device* dev);
+
+        void setMode(Reporting reporting, Rotation rotation);
+        static CrownEvent crownEvent(hidpp::Report& report);
+    };
+}}}
+
+#endif //LOGID_BACKEND_HIDPP20_FEATURE_CROWN_H
@@ -34,22 +34,24 @@ uint8_t DeviceName::getNameLength()
     return response[0];
 }
 
+// Each request reads up to LongParamLength bytes from an offset
 std::string _getName(uint8_t length,
-        const std::function<std::vector<uint8_t>(std::vector<uint8_t>)>& fcall)
+        const std::function<std::vector<std::vector<uint8_t>>(
+                std::vector<std::vector<uint8_t>>&)>& fcall)
 {
-    uint8_t function_calls = length/hidpp::LongParamLength;
-    if(length % hidpp::LongParamLength)
-        function_calls++;
-    std::vector<uint8_t> params(1);
-    std::string name;
+    std::vector<std::vector<uint8_t>> params;
+    for(std::size_t offset = 0; offset < length;
+            offset += hidpp::LongParamLength)
+        params.push_back({static_cast<uint8_t>(offset)});
+
+    auto sections = fcall(params);
 
-    for(uint8_t i = 0; i < function_calls; i++) {
-        params[0] = i*hidpp::LongParamLength;
-        auto name_section = fcall(params);
+    std::string name;
+    for(std::size_t i = 0; i < sections.size(); i++) {
         for(std::size_t j = 0; j < hidpp::LongParamLength; j++) {
-            if(params[0] + j >= length)
+            if(params[i][0] + j >= length)
                 return name;
-            name += name_section[j];
+            name += sections[i][j];
         }
     }
 
@@ -59,8 +61,16 @@ std::string _getName(uint8_t length,
 std::string DeviceName::getName()
 {
     return _getName(getNameLength(), [this]
-    (std::vector<uint8_t> params)->std::vector<uint8_t> {
-        return this->callFunction(Function::GetDeviceName, params);
+    (std::vector<std::vector<uint8_t>>& params) {
+        auto requests = transaction();
+        for(auto& section : params)
+            callFunction(requests, Function::GetDeviceName, section);
+        requests.commit();
+
+        std::vector<std::vector<uint8_t>> sections;
+        for(std::size_t i = 0; i < params.size(); i++)
+            sections.push_back(requests.response(i));
+        return sections;
     });
 }
 
@@ -80,7 +90,8 @@ uint8_t EssentialDeviceName::getNameLength()
 std::string EssentialDeviceName::getName()
 {
     return _getName(getNameLength(), [this]
-    (std::vector<uint8_t> params)->std::vector<uint8_t> {
-        return this->callFunction(DeviceName::Function::GetDeviceName, params);
+    (std::vector<std::vector<uint8_t>>& params) {
+        return this->callFunctions(DeviceName::Function::GetDeviceName,
+                params);
     });
 }
\ No newline at end of file
@@ -17,6 +17,7 @@
  */
 #include "FeatureSet.h"
 
+using namespace logid::backend;
 using namespace logid::backend::hidpp20;
 
 FeatureSet::FeatureSet(Device *device) : Feature(device, ID)
@@ -24,10 +25,18 @@ FeatureSet::FeatureSet(Device *device) : Feature(device, ID)
 }
 
 uint8_t FeatureSet::getFeatureCount()
+{
+    return tryGetFeatureCount().value();
+}
+
+Result<uint8_t> FeatureSet::tryGetFeatureCount()
 {
     std::vector<uint8_t> params(0);
-    auto response = callFunction(GetFeatureCount, params);
-    return response[0];
+    auto response = tryCallFunction(GetFeatureCount, params);
+    if(!response)
+        return response.failure();
+
+    return (*response)[0];
 }
 
 uint16_t FeatureSet::getFeature(uint8_t feature_index)
@@ -44,8 +53,19 @@ uint16_t FeatureSet::getFeature(uint8_t feature_index)
 std::map<uint8_t, uint16_t> FeatureSet::getFeatures()
 {
     uint8_t feature_count = getFeatureCount();
+    auto lookup = transaction();
+    std::vector<uint8_t> params(1);
+    // The count does not include the root feature at index 0
+    for(unsigned int i = 0; i <= feature_count; i++) {
+        params[0] = i;
+        callFunction(lookup, GetFeature, params);
+    }
+    lookup.commit();
+
     std::map<uint8_t, uint16_t> features;
-    for(uint8_t i = 0; i < feature_count; i++)
-        features[i] = getFeature(i);
+    for(unsigned int i = 0; i <= feature_count; i++) {
+        auto& response = lookup.response(i);
+        features[i] = (response[0] << 8) | response[1];
+    }
     return features;
 }
\ No newline at end of file
@@ -40,7 +40,9 @@ namespace hidpp20
         explicit FeatureSet(Device* device);
 
         uint8_t getFeatureCount();
+        Result<uint8_t> tryGetFeatureCount();
         uint16_t getFeature(uint8_t feature_index);
+        // Keyed by index, the lookups are pipelined in one transaction
         std::map<uint8_t, uint16_t> getFeatures();
     };
 }}}
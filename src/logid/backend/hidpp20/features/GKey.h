@@ -0,0 +1,57 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_BACKEND_HIDPP20_FEATURE_GKEY_H
+#define LOGID_BACKEND_HIDPP20_FEATURE_GKEY_H
+
+#include "../feature_defs.h"
+#include "../Feature.h"
+
+namespace logid {
+namespace backend {
+namespace hidpp20
+{
+    // G1 is bit 0 of the bitmap of pressed keys
+    class GKey : public Feature
+    {
+    public:
+        static const uint16_t ID = FeatureID::G_KEY;
+        virtual uint16_t getID() { return ID; }
+
+        static constexpr uint8_t MaxKeys = 32;
+
+        enum Function {
+            GetCount = 0,
+            SetSoftwareControl = 2
+        };
+
+        enum Event {
+            KeyEvent = 0
+        };
+
+        explicit GKey(Device* dev);
+
+        uint8_t getCount();
+        // Diverts every G key to software, or gives them back
+        void setSoftwareControl(bool enabled);
+
+        static uint32_t keyEvent(hidpp::Report& report);
+    };
+}}}
+
+#endif //LOGID_BACKEND_HIDPP20_FEATURE_GKEY_H
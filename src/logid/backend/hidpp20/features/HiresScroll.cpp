@@ -27,7 +27,7 @@ HiresScroll::HiresScroll(Device *device) : Feature(device, ID)
 HiresScroll::Capabilities HiresScroll::getCapabilities()
 {
     std::vector<uint8_t> params(0);
-    auto response = callFunction(GetCapabilities, params);
+    auto response = callFunctionCached(GetCapabilities, params);
 
     Capabilities capabilities{};
     capabilities.multiplier = response[0];
@@ -38,7 +38,7 @@ HiresScroll::Capabilities HiresScroll::getCapabilities()
 uint8_t HiresScroll::getMode()
 {
     std::vector<uint8_t> params(0);
-    auto response = callFunction(GetMode, params);
+    auto response = callFunctionShared(GetMode, params);
     return response[0];
 }
 
@@ -49,10 +49,17 @@ void HiresScroll::setMode(uint8_t mode)
     callFunction(SetMode, params);
 }
 
+void HiresScroll::setModeNoResponse(uint8_t mode)
+{
+    std::vector<uint8_t> params(1);
+    params[0] = mode;
+    callFunctionNoResponse(SetMode, params);
+}
+
 bool HiresScroll::getRatchetState()
 {
     std::vector<uint8_t> params(0);
-    auto response = callFunction(GetRatchetState, params);
+    auto response = callFunctionShared(GetRatchetState, params);
     return params[0];
 }
 
@@ -83,6 +83,8 @@ namespace hidpp20
         Capabilities getCapabilities();
         uint8_t getMode();
         void setMode(uint8_t mode);
+        // Does not wait for the device to acknowledge the change
+        void setModeNoResponse(uint8_t mode);
         bool getRatchetState();
 
         static WheelStatus wheelMovementEvent(const hidpp::Report& report);
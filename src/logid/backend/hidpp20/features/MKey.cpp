@@ -0,0 +1,48 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <cassert>
+#include "MKey.h"
+
+using namespace logid::backend::hidpp20;
+
+constexpr uint8_t MKey::MaxKeys;
+
+MKey::MKey(Device* dev) : Feature(dev, ID)
+{
+}
+
+uint8_t MKey::getCount()
+{
+    std::vector<uint8_t> params(0);
+    auto response = callFunctionCached(GetCount, params);
+    return response[0];
+}
+
+void MKey::setLEDs(uint8_t leds)
+{
+    std::vector<uint8_t> params(1);
+    params[0] = leds;
+    callFunction(SetLEDs, params);
+}
+
+uint8_t MKey::keyEvent(hidpp::Report& report)
+{
+    assert(report.function() == KeyEvent);
+    return report.paramBegin()[0];
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <cassert>
+#include "PerKeyLighting.h"
+
+using namespace logid::backend::hidpp20;
+
+constexpr std::size_t PerKeyLighting::IndividualZones;
+constexpr std::size_t PerKeyLighting::SingleValueZones;
+
+PerKeyLighting::PerKeyLighting(Device* dev) : Feature(dev, ID)
+{
+}
+
+void PerKeyLighting::setIndividualZones(Transaction& transaction,
+        const std::vector<std::pair<uint8_t, Color>>& zones)
+{
+    assert(zones.size() <= IndividualZones);
+    std::vector<uint8_t> params(zones.size() * 4);
+    for(std::size_t i = 0; i < zones.size(); i++) {
+        params[i*4] = zones[i].first;
+        params[i*4 + 1] = zones[i].second.r;
+        params[i*4 + 2] = zones[i].second.g;
+        params[i*4 + 3] = zones[i].second.b;
+    }
+    callFunction(transaction, SetIndividualZones, params);
+}
+
+void PerKeyLighting::setZonesSingleValue(Transaction& transaction,
+        Color color, const std::vector<uint8_t>& zones)
+{
+    assert(zones.size() <= SingleValueZones);
+    std::vector<uint8_t> params(3 + zones.size());
+    params[0] = color.r;
+    params[1] = color.g;
+    params[2] = color.b;
+    std::copy(zones.begin(), zones.end(), params.begin() + 3);
+    callFunction(transaction, SetZonesSingleValue, params);
+}
+
+void PerKeyLighting::frameEnd(Transaction& transaction)
+{
+    // Not persisted, shown straight away
+    std::vector<uint8_t> params(5);
+    callFunction(transaction, FrameEnd, params);
+}
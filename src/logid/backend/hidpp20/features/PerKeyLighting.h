@@ -0,0 +1,84 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_BACKEND_HIDPP20_FEATURE_PERKEYLIGHTING_H
+#define LOGID_BACKEND_HIDPP20_FEATURE_PERKEYLIGHTING_H
+
+#include <tuple>
+#include "../feature_defs.h"
+#include "../Feature.h"
+
+namespace logid {
+namespace backend {
+namespace hidpp20
+{
+    /* Zones are the device's key IDs. Colors written are only shown
+     * once the frame is ended. */
+    class PerKeyLighting : public Feature
+    {
+    public:
+        static const uint16_t ID = FeatureID::PER_KEY_LIGHTING_V2;
+        virtual uint16_t getID() { return ID; }
+
+        enum Function {
+            GetInfo = 0,
+            SetIndividualZones = 1,
+            SetConsecutiveZones = 2,
+            SetRangeZones = 5,
+            SetZonesSingleValue = 6,
+            FrameEnd = 7
+        };
+
+        // Zones a single report of each kind sets
+        static constexpr std::size_t IndividualZones = 4;
+        static constexpr std::size_t SingleValueZones = 13;
+
+        struct Color
+        {
+            uint8_t r;
+            uint8_t g;
+            uint8_t b;
+
+            bool operator==(const Color& other) const
+            {
+                return r == other.r && g == other.g && b == other.b;
+            }
+            bool operator!=(const Color& other) const
+            {
+                return !(*this == other);
+            }
+            bool operator<(const Color& other) const
+            {
+                return std::make_tuple(r, g, b) <
+                    std::make_tuple(other.r, other.g, other.b);
+            }
+        };
+
+        explicit PerKeyLighting(Device* dev);
+
+        // Up to IndividualZones zones, each with its own color
+        void setIndividualZones(Transaction& transaction,
+                const std::vector<std::pair<uint8_t, Color>>& zones);
+        // Up to SingleValueZones zones set to the same color
+        void setZonesSingleValue(Transaction& transaction, Color color,
+                const std::vector<uint8_t>& zones);
+        void frameEnd(Transaction& transaction);
+    };
+}}}
+
+#endif //LOGID_BACKEND_HIDPP20_FEATURE_PERKEYLIGHTING_H
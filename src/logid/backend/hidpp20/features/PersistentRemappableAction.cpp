@@ -0,0 +1,50 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "PersistentRemappableAction.h"
+
+using namespace logid::backend::hidpp20;
+
+PersistentRemappableAction::PersistentRemappableAction(Device* dev) :
+    Feature(dev, ID)
+{
+}
+
+void PersistentRemappableAction::setMapping(Transaction& transaction,
+        uint16_t cid, const Mapping& mapping)
+{
+    std::vector<uint8_t> params(7);
+    params[0] = cid >> 8;
+    params[1] = cid & 0xff;
+    params[2] = AllHosts;
+    params[3] = mapping.type;
+    params[4] = mapping.value >> 8;
+    params[5] = mapping.value & 0xff;
+    params[6] = mapping.modifiers;
+    callFunction(transaction, SetMapping, params);
+}
+
+void PersistentRemappableAction::resetMapping(Transaction& transaction,
+        uint16_t cid)
+{
+    std::vector<uint8_t> params(3);
+    params[0] = cid >> 8;
+    params[1] = cid & 0xff;
+    params[2] = AllHosts;
+    callFunction(transaction, ResetMapping, params);
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_BACKEND_HIDPP20_FEATURE_PERSISTENTREMAPPABLEACTION_H
+#define LOGID_BACKEND_HIDPP20_FEATURE_PERSISTENTREMAPPABLEACTION_H
+
+#include "../feature_defs.h"
+#include "../Feature.h"
+
+namespace logid {
+namespace backend {
+namespace hidpp20
+{
+    // Mappings are kept by the device across power cycles and hosts
+    class PersistentRemappableAction : public Feature
+    {
+    public:
+        static const uint16_t ID = FeatureID::PERSISTENT_REMAPPABLE_ACTION;
+        virtual uint16_t getID() { return ID; }
+
+        enum Function {
+            GetCapabilities = 0,
+            GetCount = 1,
+            GetCidInfo = 2,
+            GetMapping = 3,
+            SetMapping = 4,
+            ResetMapping = 5
+        };
+
+        enum ActionType : uint8_t {
+            Empty = 0x00,
+            Key = 0x01,
+            Mouse = 0x02,
+            XDisplacement = 0x03,
+            YDisplacement = 0x04,
+            VScroll = 0x05,
+            HScroll = 0x06,
+            Consumer = 0x07
+        };
+
+        // Modifier bits of Key mappings
+        enum Modifier : uint8_t {
+            LeftCtrl = 1<<0,
+            LeftShift = 1<<1,
+            LeftAlt = 1<<2,
+            LeftMeta = 1<<3,
+            RightCtrl = 1<<4,
+            RightShift = 1<<5,
+            RightAlt = 1<<6,
+            RightMeta = 1<<7
+        };
+
+        // Applies to all hosts rather than a single one
+        static const uint8_t AllHosts = 0xff;
+
+        struct Mapping
+        {
+            ActionType type;
+            // A HID usage for Key and Consumer, a button mask for Mouse
+            uint16_t value;
+            uint8_t modifiers;
+        };
+
+        explicit PersistentRemappableAction(Device* dev);
+
+        void setMapping(Transaction& transaction, uint16_t cid,
+                const Mapping& mapping);
+        // The control goes back to its default action
+        void resetMapping(Transaction& transaction, uint16_t cid);
+    };
+}}}
+
+#endif //LOGID_BACKEND_HIDPP20_FEATURE_PERSISTENTREMAPPABLEACTION_H
@@ -0,0 +1,51 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ReportRate.h"
+
+using namespace logid::backend::hidpp20;
+
+ReportRate::ReportRate(Device* dev) : Feature(dev, ID)
+{
+}
+
+uint8_t ReportRate::getReportRateList()
+{
+    std::vector<uint8_t> params(0);
+    auto response = callFunctionCached(GetReportRateList, params);
+    return response[0];
+}
+
+uint8_t ReportRate::getReportRate()
+{
+    std::vector<uint8_t> params(0);
+    auto response = callFunctionShared(GetReportRate, params);
+    return response[0];
+}
+
+void ReportRate::setReportRate(uint8_t rate)
+{
+    call<SetReportRateFunction>(rate);
+}
+
+void ReportRate::setReportRate(Transaction& transaction, uint8_t rate)
+{
+    std::vector<uint8_t> params(1);
+    params[0] = rate;
+    callFunction(transaction, SetReportRate, params);
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_BACKEND_HIDPP20_FEATURE_REPORTRATE_H
+#define LOGID_BACKEND_HIDPP20_FEATURE_REPORTRATE_H
+
+#include "../feature_defs.h"
+#include "../Feature.h"
+
+namespace logid {
+namespace backend {
+namespace hidpp20
+{
+    // Rates are report intervals in milliseconds
+    class ReportRate : public Feature
+    {
+    public:
+        static const uint16_t ID = FeatureID::REPORT_RATE;
+        virtual uint16_t getID() { return ID; }
+
+        enum Function {
+            GetReportRateList = 0,
+            GetReportRate = 1,
+            SetReportRate = 2
+        };
+
+        struct SetReportRateFunction : function_desc<SetReportRate, 1, 0>
+        {
+            typedef uint8_t request;
+            typedef no_response response;
+
+            static void encode(const request& rate, request_params& params)
+            {
+                params.u8<0>(rate);
+            }
+            static response decode(const response_params&)
+            {
+                return {};
+            }
+        };
+
+        explicit ReportRate(Device* dev);
+
+        // Bit n is set if a rate of n+1 ms is supported
+        uint8_t getReportRateList();
+        uint8_t getReportRate();
+        void setReportRate(uint8_t rate);
+        void setReportRate(Transaction& transaction, uint8_t rate);
+    };
+}}}
+
+#endif //LOGID_BACKEND_HIDPP20_FEATURE_REPORTRATE_H
@@ -21,6 +21,8 @@
 
 using namespace logid::backend::hidpp20;
 
+constexpr std::size_t ReprogControls::MaxDivertedButtons;
+
 #define DEFINE_REPROG(x, base) \
 x::x(Device* dev) : base(dev, ID) \
 { \
@@ -30,9 +32,12 @@ x::x(Device* dev, uint16_t _id) : base(dev, _id) \
 }
 
 #define MAKE_REPROG(x, dev) \
-try { \
-    return std::make_shared<x>(dev); \
-} catch(UnsupportedFeature &e) {\
+{ \
+    auto index = dev->tryFeatureIndex(x::ID); \
+    if(index) \
+        return std::make_shared<x>(dev); \
+    if(index.failure().kind() != logid::backend::Failure::UnsupportedFeature) \
+        index.failure().raise(); \
 }
 
 // Define all of the ReprogControls versions
@@ -56,17 +61,21 @@ std::shared_ptr<ReprogControls> ReprogControls::autoVersion(Device *dev)
 uint8_t ReprogControls::getControlCount()
 {
     std::vector<uint8_t> params(0);
-    auto response = callFunction(GetControlCount, params);
+    auto response = callFunctionCached(GetControlCount, params);
     return response[0];
 }
 
 ReprogControls::ControlInfo ReprogControls::getControlInfo(uint8_t index)
 {
     std::vector<uint8_t> params(1);
-    ControlInfo info{};
     params[0] = index;
-    auto response = callFunction(GetControlInfo, params);
+    return _controlInfo(callFunctionCached(GetControlInfo, params));
+}
 
+ReprogControls::ControlInfo ReprogControls::_controlInfo(
+        const std::vector<uint8_t>& response)
+{
+    ControlInfo info{};
     info.controlID = response[1];
     info.controlID |= response[0] << 8;
     info.taskID = response[3];
@@ -85,8 +94,13 @@ void ReprogControls::initCidMap()
     if(_cids_initialized)
         return;
     uint8_t controls = getControlCount();
-    for(uint8_t i = 0; i < controls; i++) {
-        auto info = getControlInfo(i);
+
+    std::vector<std::vector<uint8_t>> params;
+    for(uint8_t i = 0; i < controls; i++)
+        params.push_back({i});
+
+    for(auto& response : callFunctionsCached(GetControlInfo, params)) {
+        auto info = _controlInfo(response);
         _cids.emplace(info.controlID, info);
     }
     _cids_initialized = true;
@@ -134,17 +148,26 @@ void ReprogControls::setControlReporting(uint8_t cid, ControlInfo info)
     (void)cid; (void)info; // Suppress unused warnings
 }
 
-std::set<uint16_t> ReprogControls::divertedButtonEvent(
+void ReprogControls::setControlReporting(Transaction& transaction,
+        uint8_t cid, ControlInfo info)
+{
+    (void)transaction; (void)cid; (void)info;
+}
+
+ReprogControls::DivertedButtons ReprogControls::divertedButtonEvent(
         const hidpp::Report& report)
 {
     assert(report.function() == DivertedButtonEvent);
-    std::set<uint16_t> buttons;
-    uint8_t cids = std::distance(report.paramBegin(), report.paramEnd())/2;
-    for(uint8_t i = 0; i < cids; i++) {
+    DivertedButtons buttons{};
+    std::size_t cids = std::distance(report.paramBegin(),
+            report.paramEnd())/2;
+    if(cids > MaxDivertedButtons)
+        cids = MaxDivertedButtons;
+    for(std::size_t i = 0; i < cids; i++) {
         uint16_t cid = report.paramBegin()[2*i + 1];
         cid |= report.paramBegin()[2*i] << 8;
         if(cid)
-            buttons.insert(cid);
+            buttons.cids[buttons.count++] = cid;
         else
             break;
     }
@@ -166,11 +189,25 @@ ReprogControls::Move ReprogControls::divertedRawXYEvent(const hidpp::Report
 ReprogControls::ControlInfo ReprogControlsV4::getControlReporting(uint16_t cid)
 {
     std::vector<uint8_t> params(2);
-    ControlInfo info{};
     params[0] = (cid >> 8) & 0xff;
     params[1] = cid & 0xff;
-    auto response = callFunction(GetControlReporting, params);
+    return controlReporting(callFunctionShared(GetControlReporting,
+            params));
+}
 
+std::size_t ReprogControlsV4::getControlReporting(Transaction& transaction,
+        uint16_t cid)
+{
+    std::vector<uint8_t> params(2);
+    params[0] = (cid >> 8) & 0xff;
+    params[1] = cid & 0xff;
+    return callFunction(transaction, GetControlReporting, params);
+}
+
+ReprogControls::ControlInfo ReprogControlsV4::controlReporting(
+        const std::vector<uint8_t>& response)
+{
+    ControlInfo info{};
     info.controlID = response[1];
     info.controlID |= response[0] << 8;
     info.flags = response[2];
@@ -186,4 +223,16 @@ void ReprogControlsV4::setControlReporting(uint8_t cid, ControlInfo info)
     params[3] = (info.controlID >> 8) & 0xff;
     params[4] = info.controlID & 0xff;
     callFunction(SetControlReporting, params);
-}
\ No newline at end of file
+}
+
+void ReprogControlsV4::setControlReporting(Transaction& transaction,
+        uint8_t cid, ControlInfo info)
+{
+    std::vector<uint8_t> params(5);
+    params[0] = (cid >> 8) & 0xff;
+    params[1] = cid & 0xff;
+    params[2] = info.flags;
+    params[3] = (info.controlID >> 8) & 0xff;
+    params[4] = info.controlID & 0xff;
+    callFunction(transaction, SetControlReporting, params);
+}
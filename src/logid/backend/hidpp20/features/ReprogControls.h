@@ -18,6 +18,7 @@
 #ifndef LOGID_BACKEND_HIDPP20_FEATURE_REPROGCONTROLS_H
 #define LOGID_BACKEND_HIDPP20_FEATURE_REPROGCONTROLS_H
 
+#include <array>
 #include <map>
 
 #include "../feature_defs.h"
@@ -104,8 +105,18 @@ namespace hidpp20
 
         // Only controlId (for remap) and flags will be read
         virtual void setControlReporting(uint8_t cid, ControlInfo info);
+        virtual void setControlReporting(Transaction& transaction,
+                uint8_t cid, ControlInfo info);
 
-        static std::set<uint16_t> divertedButtonEvent(const hidpp::Report&
+        // A long report has room for eight CIDs, zero terminates the list
+        static constexpr std::size_t MaxDivertedButtons = 8;
+        struct DivertedButtons
+        {
+            std::array<uint16_t, MaxDivertedButtons> cids;
+            std::size_t count;
+        };
+
+        static DivertedButtons divertedButtonEvent(const hidpp::Report&
             report);
 
         static Move divertedRawXYEvent(const hidpp::Report& report);
@@ -113,6 +124,7 @@ namespace hidpp20
         static std::shared_ptr<ReprogControls> autoVersion(Device *dev);
     protected:
         ReprogControls(Device* dev, uint16_t _id);
+        static ControlInfo _controlInfo(const std::vector<uint8_t>& response);
         std::map<uint16_t, ControlInfo> _cids;
         bool _cids_initialized = false;
         std::mutex _cids_populating;
@@ -160,8 +172,15 @@ namespace hidpp20
         bool supportsRawXY() override { return true; }
 
         ControlInfo getControlReporting(uint16_t cid) override;
+        // Returns the request number, see controlReporting()
+        std::size_t getControlReporting(Transaction& transaction,
+                uint16_t cid);
+        static ControlInfo controlReporting(
+                const std::vector<uint8_t>& response);
 
         void setControlReporting(uint8_t cid, ControlInfo info) override;
+        void setControlReporting(Transaction& transaction, uint8_t cid,
+                ControlInfo info) override;
 
         explicit ReprogControlsV4(Device* dev);
     protected:
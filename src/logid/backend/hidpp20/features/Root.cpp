@@ -19,6 +19,7 @@
 #include "Root.h"
 #include "../Error.h"
 
+using namespace logid::backend;
 using namespace logid::backend::hidpp20;
 
 Root::Root(Device* dev) : Feature(dev, ID)
@@ -63,11 +64,18 @@ feature_info Root::getFeature(uint16_t feature_id)
 }
 
 std::tuple<uint8_t, uint8_t> Root::getVersion()
+{
+    return tryGetVersion().value();
+}
+
+Result<std::tuple<uint8_t, uint8_t>> Root::tryGetVersion()
 {
     std::vector<uint8_t> params(0);
-    auto response = this->callFunction(Function::Ping, params);
+    auto response = this->tryCallFunction(Function::Ping, params);
+    if(!response)
+        return response.failure();
 
-    return std::make_tuple(response[0], response[1]);
+    return std::make_tuple((*response)[0], (*response)[1]);
 }
 
 EssentialRoot::EssentialRoot(hidpp::Device* dev) : EssentialFeature(dev, ID)
@@ -88,9 +96,16 @@ feature_info EssentialRoot::getFeature(uint16_t feature_id)
 }
 
 std::tuple<uint8_t, uint8_t> EssentialRoot::getVersion()
+{
+    return tryGetVersion().value();
+}
+
+Result<std::tuple<uint8_t, uint8_t>> EssentialRoot::tryGetVersion()
 {
     std::vector<uint8_t> params(0);
-    auto response = this->callFunction(Root::Function::Ping, params);
+    auto response = this->tryCallFunction(Root::Function::Ping, params);
+    if(!response)
+        return response.failure();
 
-    return std::make_tuple(response[0], response[1]);
+    return std::make_tuple((*response)[0], (*response)[1]);
 }
\ No newline at end of file
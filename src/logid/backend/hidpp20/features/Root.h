@@ -43,6 +43,7 @@ namespace hidpp20
 
         feature_info getFeature (uint16_t feature_id);
         std::tuple<uint8_t, uint8_t> getVersion();
+        Result<std::tuple<uint8_t, uint8_t>> tryGetVersion();
 
         enum FeatureFlag : uint8_t
         {
@@ -62,6 +63,7 @@ namespace hidpp20
 
         feature_info getFeature(uint16_t feature_id);
         std::tuple<uint8_t, uint8_t> getVersion();
+        Result<std::tuple<uint8_t, uint8_t>> tryGetVersion();
     };
 }}}
 
@@ -27,7 +27,7 @@ SmartShift::SmartshiftStatus SmartShift::getStatus()
 {
     std::vector<uint8_t> params(0);
     SmartshiftStatus status{};
-    auto response = callFunction(GetStatus, params);
+    auto response = callFunctionShared(GetStatus, params);
     status.active = response[0]-1;
     status.autoDisengage = response[1];
     status.defaultAutoDisengage = response[2];
@@ -36,12 +36,10 @@ SmartShift::SmartshiftStatus SmartShift::getStatus()
 
 void SmartShift::setStatus(SmartshiftStatus status)
 {
-    std::vector<uint8_t> params(3);
-    if(status.setActive)
-        params[0] = status.active + 1;
-    if(status.setAutoDisengage)
-        params[1] = status.autoDisengage;
-    if(status.setDefaultAutoDisengage)
-        params[2] = status.defaultAutoDisengage;
-    callFunction(SetStatus, params);
-}
\ No newline at end of file
+    call<SetStatusFunction>(status);
+}
+
+void SmartShift::setStatusNoResponse(SmartshiftStatus status)
+{
+    callNoResponse<SetStatusFunction>(status);
+}
@@ -46,8 +46,31 @@ namespace hidpp20
             bool setActive, setAutoDisengage, setDefaultAutoDisengage;
         };
 
+        // Fields whose set flag is clear are left as they are
+        struct SetStatusFunction : function_desc<SetStatus, 3, 0>
+        {
+            typedef SmartshiftStatus request;
+            typedef no_response response;
+
+            static void encode(const request& status, request_params& params)
+            {
+                if(status.setActive)
+                    params.u8<0>(status.active + 1);
+                if(status.setAutoDisengage)
+                    params.u8<1>(status.autoDisengage);
+                if(status.setDefaultAutoDisengage)
+                    params.u8<2>(status.defaultAutoDisengage);
+            }
+            static response decode(const response_params&)
+            {
+                return {};
+            }
+        };
+
         SmartshiftStatus getStatus();
         void setStatus(SmartshiftStatus status);
+        // Does not wait for the device to acknowledge the change
+        void setStatusNoResponse(SmartshiftStatus status);
     };
 }}}
 
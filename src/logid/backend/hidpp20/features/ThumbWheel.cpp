@@ -29,7 +29,7 @@ ThumbWheel::ThumbwheelInfo ThumbWheel::getInfo()
 {
     std::vector<uint8_t> params(0), response;
     ThumbwheelInfo info{};
-    response = callFunction(GetInfo, params);
+    response = callFunctionCached(GetInfo, params);
 
     info.nativeRes = response[1];
     info.nativeRes |= (response[0] << 8);
@@ -47,7 +47,7 @@ ThumbWheel::ThumbwheelStatus ThumbWheel::getStatus()
 {
     std::vector<uint8_t> params(0), response;
     ThumbwheelStatus status{};
-    response = callFunction(GetStatus, params);
+    response = callFunctionShared(GetStatus, params);
 
     status.diverted = response[0];
     status.inverted = response[1] & 1;
@@ -57,16 +57,7 @@ ThumbWheel::ThumbwheelStatus ThumbWheel::getStatus()
 
 ThumbWheel::ThumbwheelStatus ThumbWheel::setStatus(bool divert, bool invert)
 {
-    std::vector<uint8_t> params(2), response;
-    ThumbwheelStatus status{};
-    params[0] = divert;
-    params[1] = invert;
-
-    response = callFunction(SetReporting, params);
-    status.diverted = response[0];
-    status.inverted = response[1] & 1;
-
-    return status;
+    return call<SetReportingFunction>({divert, invert});
 }
 
 ThumbWheel::ThumbwheelEvent ThumbWheel::thumbwheelEvent(hidpp::Report& report)
@@ -81,6 +81,30 @@ namespace hidpp20
             uint8_t flags;
         };
 
+        struct SetReportingFunction : function_desc<SetReporting, 2, 2>
+        {
+            struct request
+            {
+                bool divert;
+                bool invert;
+            };
+            // The status the device switched to
+            typedef ThumbwheelStatus response;
+
+            static void encode(const request& r, request_params& params)
+            {
+                params.u8<0>(r.divert);
+                params.u8<1>(r.invert);
+            }
+            static response decode(const response_params& params)
+            {
+                response status{};
+                status.diverted = params.u8<0>();
+                status.inverted = params.u8<1>() & 1;
+                return status;
+            }
+        };
+
         ThumbwheelInfo getInfo();
         ThumbwheelStatus getStatus();
 
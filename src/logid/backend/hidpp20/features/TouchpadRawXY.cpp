@@ -0,0 +1,84 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <cassert>
+#include "TouchpadRawXY.h"
+
+using namespace logid::backend::hidpp20;
+
+constexpr std::size_t TouchpadRawXY::FingersPerReport;
+
+namespace
+{
+    void decodeFinger(const uint8_t* data, TouchpadRawXY::Finger& finger)
+    {
+        finger.x = (data[0] & 0x3f) << 8 | data[1];
+        finger.y = (data[2] & 0x3f) << 8 | data[3];
+        finger.contactType = data[0] >> 6;
+        finger.touching = data[2] >> 6;
+        finger.z = data[4];
+        finger.area = data[5];
+        finger.id = data[6] >> 4;
+    }
+}
+
+TouchpadRawXY::TouchpadRawXY(Device* dev) : Feature(dev, ID)
+{
+}
+
+TouchpadRawXY::RawInfo TouchpadRawXY::getRawInfo()
+{
+    std::vector<uint8_t> params(0);
+    auto response = callFunctionCached(GetRawInfo, params);
+
+    RawInfo info{};
+    info.xSize = response[0] << 8 | response[1];
+    info.ySize = response[2] << 8 | response[3];
+    info.zRange = response[4];
+    info.areaRange = response[5];
+    info.maxContacts = response[7];
+    info.origin = response[8];
+    // Reported in units per inch
+    info.resolution = (response[13] << 8 | response[14]) * 10 / 254;
+    return info;
+}
+
+void TouchpadRawXY::setRawReportState(bool raw)
+{
+    std::vector<uint8_t> params(1);
+    params[0] = raw ? 0x05 : 0x00;
+    callFunction(SetRawReportState, params);
+}
+
+TouchpadRawXY::RawXY TouchpadRawXY::rawXYEvent(hidpp::Report& report)
+{
+    assert(report.function() == RawXYEvent);
+    auto data = &*report.paramBegin();
+
+    RawXY event{};
+    event.timestamp = data[0] << 8 | data[1];
+    event.endOfFrame = data[8] & 0x01;
+    event.spurious = data[8] & 0x02;
+    event.button = data[8] & 0x04;
+    event.fingerCount = data[15] & 0x0f;
+    if(event.fingerCount) {
+        decodeFinger(data + 2, event.fingers[0]);
+        decodeFinger(data + 9, event.fingers[1]);
+    }
+    return event;
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_BACKEND_HIDPP20_FEATURE_TOUCHPADRAWXY_H
+#define LOGID_BACKEND_HIDPP20_FEATURE_TOUCHPADRAWXY_H
+
+#include <array>
+#include "../feature_defs.h"
+#include "../Feature.h"
+
+namespace logid {
+namespace backend {
+namespace hidpp20
+{
+    /* Raw contacts of touch surfaces such as the T650 and T651. A frame
+     * with more than FingersPerReport contacts spans several reports,
+     * the last one has endOfFrame set. */
+    class TouchpadRawXY : public Feature
+    {
+    public:
+        static const uint16_t ID = FeatureID::TOUCHMOUSE_RAW;
+        virtual uint16_t getID() { return ID; }
+
+        enum Function {
+            GetRawInfo = 0,
+            GetRawReportState = 1,
+            SetRawReportState = 2
+        };
+
+        enum Event {
+            RawXYEvent = 0
+        };
+
+        static constexpr std::size_t FingersPerReport = 2;
+
+        struct RawInfo
+        {
+            uint16_t xSize;
+            uint16_t ySize;
+            uint8_t zRange;
+            uint8_t areaRange;
+            uint8_t maxContacts;
+            uint8_t origin;
+            // Units per mm
+            uint16_t resolution;
+        };
+
+        struct Finger
+        {
+            uint16_t x;
+            uint16_t y;
+            uint8_t z;
+            uint8_t area;
+            // 0 if the slot holds no contact
+            uint8_t id;
+            uint8_t contactType;
+            bool touching;
+        };
+
+        struct RawXY
+        {
+            uint16_t timestamp;
+            bool endOfFrame;
+            bool spurious;
+            bool button;
+            uint8_t fingerCount;
+            std::array<Finger, FingersPerReport> fingers;
+        };
+
+        explicit TouchpadRawXY(Device* dev);
+
+        RawInfo getRawInfo();
+        /* Raw reports replace the pointer movement the device sends by
+         * itself, enhanced sensor settings filter out palms and noise. */
+        void setRawReportState(bool raw);
+
+        static RawXY rawXYEvent(hidpp::Report& report);
+    };
+}}}
+
+#endif //LOGID_BACKEND_HIDPP20_FEATURE_TOUCHPADRAWXY_H
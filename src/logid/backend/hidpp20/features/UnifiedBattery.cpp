@@ -0,0 +1,60 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <cassert>
+#include "UnifiedBattery.h"
+
+using namespace logid::backend::hidpp20;
+
+UnifiedBattery::UnifiedBattery(Device* dev) : Feature(dev, ID)
+{
+}
+
+UnifiedBattery::Capabilities UnifiedBattery::getCapabilities()
+{
+    std::vector<uint8_t> params(0);
+    auto response = callFunctionCached(GetCapabilities, params);
+    Capabilities capabilities{};
+    capabilities.levels = response[0];
+    capabilities.flags = response[1];
+    return capabilities;
+}
+
+UnifiedBattery::Status UnifiedBattery::getStatus()
+{
+    std::vector<uint8_t> params(0);
+    auto response = callFunctionShared(GetStatus, params);
+    return _parseStatus(response.data());
+}
+
+UnifiedBattery::Status UnifiedBattery::statusEvent(
+        const hidpp::Report& report)
+{
+    assert(report.function() == BatteryStatusEvent);
+    return _parseStatus(&(*report.paramBegin()));
+}
+
+UnifiedBattery::Status UnifiedBattery::_parseStatus(const uint8_t* params)
+{
+    Status status{};
+    status.stateOfCharge = params[0];
+    status.level = static_cast<Level>(params[1]);
+    status.chargingStatus = static_cast<ChargingStatus>(params[2]);
+    status.externalPower = static_cast<ExternalPower>(params[3]);
+    return status;
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_BACKEND_HIDPP20_FEATURE_UNIFIEDBATTERY_H
+#define LOGID_BACKEND_HIDPP20_FEATURE_UNIFIEDBATTERY_H
+
+#include "../Feature.h"
+#include "../feature_defs.h"
+
+namespace logid {
+namespace backend {
+namespace hidpp20
+{
+    class UnifiedBattery : public Feature
+    {
+    public:
+        static constexpr uint16_t ID = FeatureID::UNIFIED_BATTERY;
+        virtual uint16_t getID() { return ID; }
+
+        enum Function : uint8_t
+        {
+            GetCapabilities = 0,
+            GetStatus = 1
+        };
+
+        enum Event : uint8_t
+        {
+            BatteryStatusEvent = 0
+        };
+
+        enum Level : uint8_t
+        {
+            Critical = 1,
+            Low = 1<<1,
+            Good = 1<<2,
+            Full = 1<<3
+        };
+
+        enum Flags : uint8_t
+        {
+            Rechargeable = 1,
+            StateOfCharge = 1<<1
+        };
+
+        enum ChargingStatus : uint8_t
+        {
+            Discharging = 0,
+            Charging = 1,
+            SlowCharging = 2,
+            ChargeComplete = 3,
+            ChargingError = 4
+        };
+
+        enum ExternalPower : uint8_t
+        {
+            NoPower = 0,
+            Wired = 1,
+            Wireless = 2
+        };
+
+        explicit UnifiedBattery(Device* dev);
+
+        struct Capabilities
+        {
+            // Bitmask of Level
+            uint8_t levels;
+            uint8_t flags;
+        };
+
+        struct Status
+        {
+            // Percent, only valid with the StateOfCharge flag
+            uint8_t stateOfCharge;
+            Level level;
+            ChargingStatus chargingStatus;
+            ExternalPower externalPower;
+        };
+
+        Capabilities getCapabilities();
+        Status getStatus();
+
+        static Status statusEvent(const hidpp::Report& report);
+    private:
+        static Status _parseStatus(const uint8_t* params);
+    };
+}}}
+
+#endif //LOGID_BACKEND_HIDPP20_FEATURE_UNIFIEDBATTERY_H
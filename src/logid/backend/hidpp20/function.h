@@ -0,0 +1,120 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_BACKEND_HIDPP20_FUNCTION_H
+#define LOGID_BACKEND_HIDPP20_FUNCTION_H
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include "../hidpp/defs.h"
+
+namespace logid {
+namespace backend {
+namespace hidpp20
+{
+    /* Fixed-size parameters of a request or response, kept inline. Field
+     * offsets are template arguments, so a field past the end of the
+     * layout does not compile.
+     */
+    template<std::size_t Length>
+    class params
+    {
+    public:
+        static_assert(Length <= hidpp::LongParamLength,
+                "HID++ 2.0 reports carry at most 16 parameter bytes");
+        static constexpr std::size_t length = Length;
+
+        params() : _data {}
+        {
+        }
+
+        explicit params(const uint8_t* data) : _data {}
+        {
+            std::copy(data, data + Length, _data.begin());
+        }
+
+        template<std::size_t Offset>
+        uint8_t u8() const
+        {
+            static_assert(Offset < Length, "Field past the end of params");
+            return _data[Offset];
+        }
+
+        template<std::size_t Offset>
+        void u8(uint8_t value)
+        {
+            static_assert(Offset < Length, "Field past the end of params");
+            _data[Offset] = value;
+        }
+
+        // HID++ is big-endian
+        template<std::size_t Offset>
+        uint16_t be16() const
+        {
+            static_assert(Offset + 2 <= Length, "Field past the end of params");
+            return (_data[Offset] << 8) | _data[Offset + 1];
+        }
+
+        template<std::size_t Offset>
+        void be16(uint16_t value)
+        {
+            static_assert(Offset + 2 <= Length, "Field past the end of params");
+            _data[Offset] = value >> 8;
+            _data[Offset + 1] = value & 0xff;
+        }
+
+        const uint8_t* data() const
+        {
+            return _data.data();
+        }
+    private:
+        std::array<uint8_t, Length> _data;
+    };
+
+    template<std::size_t Length>
+    constexpr std::size_t params<Length>::length;
+
+    /* Describes function Number of a feature and the length of its request
+     * and response. Descriptors derive from it and add a request and a
+     * response struct, with
+     *     static void encode(const request&, request_params&);
+     *     static response decode(const response_params&);
+     * Feature::call<Descriptor>() then needs no heap allocation.
+     */
+    template<uint8_t Number, std::size_t RequestLength,
+            std::size_t ResponseLength>
+    struct function_desc
+    {
+        static constexpr uint8_t number = Number;
+        typedef params<RequestLength> request_params;
+        typedef params<ResponseLength> response_params;
+    };
+
+    template<uint8_t Number, std::size_t RequestLength,
+            std::size_t ResponseLength>
+    constexpr uint8_t function_desc<Number, RequestLength,
+            ResponseLength>::number;
+
+    // For functions that answer with nothing of interest
+    struct no_response
+    {
+    };
+}}}
+
+#endif //LOGID_BACKEND_HIDPP20_FUNCTION_H
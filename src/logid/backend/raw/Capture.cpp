@@ -0,0 +1,205 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "Capture.h"
+
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CAPTURE_MAGIC "LOGIDCAP"
+#define CAPTURE_VERSION 1
+
+using namespace logid::backend::raw;
+
+std::shared_ptr<Capture> logid::backend::raw::global_capture;
+
+constexpr std::size_t Capture::MaxPaths;
+constexpr std::size_t Capture::PathLength;
+constexpr std::size_t Capture::MaxReportLength;
+constexpr uint16_t Capture::UnknownPath;
+
+Capture::InvalidCapture::InvalidCapture(const std::string& what) : _what (what)
+{
+}
+
+const char* Capture::InvalidCapture::what() const noexcept
+{
+    return _what.c_str();
+}
+
+Capture::Capture(const std::string& file, std::size_t size)
+{
+    if(size < sizeof(FileHeader) + sizeof(FileRecord))
+        throw InvalidCapture("capture size too small");
+    uint64_t capacity = (size - sizeof(FileHeader))/sizeof(FileRecord);
+    _size = sizeof(FileHeader) + capacity*sizeof(FileRecord);
+
+    _fd = ::open(file.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(_fd < 0)
+        throw InvalidCapture(file + ": " + strerror(errno));
+    if(::ftruncate(_fd, _size) < 0) {
+        int err = errno;
+        ::close(_fd);
+        throw InvalidCapture(file + ": " + strerror(err));
+    }
+
+    void* map = ::mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_SHARED,
+            _fd, 0);
+    if(map == MAP_FAILED) {
+        int err = errno;
+        ::close(_fd);
+        throw InvalidCapture(file + ": " + strerror(err));
+    }
+
+    // ftruncate zero-fills, so every record starts out unwritten
+    _header = static_cast<FileHeader*>(map);
+    memcpy(_header->magic, CAPTURE_MAGIC, sizeof(_header->magic));
+    _header->version = CAPTURE_VERSION;
+    _header->record_size = sizeof(FileRecord);
+    _header->capacity = capacity;
+    _header->next.store(0, std::memory_order_relaxed);
+    _header->path_count = 0;
+    _records = reinterpret_cast<FileRecord*>(_header + 1);
+}
+
+Capture::~Capture()
+{
+    ::msync(_header, _size, MS_ASYNC);
+    ::munmap(_header, _size);
+    ::close(_fd);
+}
+
+uint16_t Capture::pathId(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(_path_lock);
+    for(uint32_t i = 0; i < _header->path_count; i++) {
+        if(strncmp(_header->paths[i], path.c_str(), PathLength-1) == 0)
+            return i;
+    }
+
+    if(_header->path_count >= MaxPaths)
+        return UnknownPath;
+
+    uint32_t id = _header->path_count;
+    strncpy(_header->paths[id], path.c_str(), PathLength-1);
+    _header->paths[id][PathLength-1] = '\0';
+    _header->path_count = id + 1;
+    return id;
+}
+
+void Capture::record(uint16_t path_id, Direction direction,
+        const uint8_t* data, std::size_t length)
+{
+    uint64_t index = _header->next.fetch_add(1, std::memory_order_relaxed);
+    FileRecord& record = _records[index % _header->capacity];
+
+    record.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    record.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    record.path = path_id;
+    record.direction = direction;
+    record.length = std::min(length, MaxReportLength);
+    memcpy(record.data, data, record.length);
+
+    record.sequence.store(index + 1, std::memory_order_release);
+}
+
+bool Capture::isCapture(const std::string& file)
+{
+    int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+        return false;
+    char magic[sizeof(FileHeader::magic)];
+    bool ret = ::read(fd, magic, sizeof(magic)) == sizeof(magic) &&
+            memcmp(magic, CAPTURE_MAGIC, sizeof(magic)) == 0;
+    ::close(fd);
+    return ret;
+}
+
+std::vector<Capture::Record> Capture::read(const std::string& file)
+{
+    int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+        throw InvalidCapture(file + ": " + strerror(errno));
+
+    struct stat st = {};
+    if(::fstat(fd, &st) < 0 ||
+            (std::size_t)st.st_size < sizeof(FileHeader)) {
+        ::close(fd);
+        throw InvalidCapture(file + ": not a capture file");
+    }
+
+    std::size_t size = st.st_size;
+    void* map = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(map == MAP_FAILED)
+        throw InvalidCapture(file + ": " + strerror(errno));
+
+    auto header = static_cast<const FileHeader*>(map);
+    if(memcmp(header->magic, CAPTURE_MAGIC, sizeof(header->magic)) != 0 ||
+            header->version != CAPTURE_VERSION ||
+            header->record_size != sizeof(FileRecord) ||
+            sizeof(FileHeader) + header->capacity*sizeof(FileRecord) > size) {
+        ::munmap(map, size);
+        throw InvalidCapture(file + ": unsupported capture format");
+    }
+
+    std::vector<std::string> paths;
+    for(uint32_t i = 0; i < header->path_count && i < MaxPaths; i++)
+        paths.emplace_back(header->paths[i],
+                strnlen(header->paths[i], PathLength));
+
+    auto records = reinterpret_cast<const FileRecord*>(header + 1);
+    std::vector<std::pair<uint64_t, Record>> found;
+    for(uint64_t i = 0; i < header->capacity; i++) {
+        const FileRecord& r = records[i];
+        uint64_t sequence = r.sequence.load(std::memory_order_acquire);
+        if(sequence == 0)
+            continue;
+        Record record;
+        record.timestamp = r.timestamp;
+        record.path = r.path < paths.size() ? paths[r.path] : "?";
+        record.direction = r.direction == Out ? Out : In;
+        record.data.assign(r.data, r.data +
+            std::min<std::size_t>(r.length, MaxReportLength));
+        // Skip records overwritten while we were copying them
+        if(r.sequence.load(std::memory_order_acquire) != sequence)
+            continue;
+        found.emplace_back(sequence, std::move(record));
+    }
+    ::munmap(map, size);
+
+    std::sort(found.begin(), found.end(),
+        [](const std::pair<uint64_t, Record>& a,
+            const std::pair<uint64_t, Record>& b) {
+            return a.first < b.first;
+        });
+
+    std::vector<Record> ret;
+    ret.reserve(found.size());
+    for(auto& r : found)
+        ret.push_back(std::move(r.second));
+    return ret;
+}
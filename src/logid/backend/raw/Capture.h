@@ -0,0 +1,110 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_BACKEND_RAW_CAPTURE_H
+#define LOGID_BACKEND_RAW_CAPTURE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace logid {
+namespace backend {
+namespace raw
+{
+    /* Binary trace of every report read or written by a RawDevice. Fixed
+     * size records are written into a memory-mapped ring file, so the
+     * newest records overwrite the oldest once the file is full.
+     */
+    class Capture
+    {
+    public:
+        enum Direction : uint8_t
+        {
+            In = 0,
+            Out = 1
+        };
+
+        struct Record
+        {
+            uint64_t timestamp; // Monotonic, in nanoseconds
+            std::string path;
+            Direction direction;
+            std::vector<uint8_t> data;
+        };
+
+        class InvalidCapture : public std::exception
+        {
+        public:
+            explicit InvalidCapture(const std::string& what);
+            const char* what() const noexcept override;
+        private:
+            std::string _what;
+        };
+
+        Capture(const std::string& file, std::size_t size);
+        ~Capture();
+
+        uint16_t pathId(const std::string& path);
+        void record(uint16_t path_id, Direction direction,
+                const uint8_t* data, std::size_t length);
+
+        static bool isCapture(const std::string& file);
+        // Records still in the ring, oldest first
+        static std::vector<Record> read(const std::string& file);
+
+        static constexpr std::size_t MaxPaths = 64;
+        static constexpr std::size_t PathLength = 64;
+        static constexpr std::size_t MaxReportLength = 32;
+        static constexpr uint16_t UnknownPath = 0xffff;
+
+        struct FileHeader
+        {
+            char magic[8];
+            uint32_t version;
+            uint32_t record_size;
+            uint64_t capacity;
+            std::atomic<uint64_t> next;
+            uint32_t path_count;
+            char paths[MaxPaths][PathLength];
+        };
+
+        struct FileRecord
+        {
+            // 0 while being written, otherwise the write index + 1
+            std::atomic<uint64_t> sequence;
+            uint64_t timestamp;
+            uint16_t path;
+            uint8_t direction;
+            uint8_t length;
+            uint8_t data[MaxReportLength];
+        };
+    private:
+        int _fd;
+        std::size_t _size;
+        FileHeader* _header;
+        FileRecord* _records;
+        std::mutex _path_lock;
+    };
+
+    extern std::shared_ptr<Capture> global_capture;
+}}}
+
+#endif //LOGID_BACKEND_RAW_CAPTURE_H
@@ -19,10 +19,12 @@
 #include "DeviceMonitor.h"
 #include "../../util/task.h"
 #include "../../util/log.h"
+#include "../../util/reactor.h"
+#include "../../Configuration.h"
 #include "RawDevice.h"
 #include "../hidpp/Device.h"
 
-#include <thread>
+#include <cstdio>
 #include <system_error>
 
 extern "C"
@@ -33,7 +35,8 @@ extern "C"
 
 using namespace logid::backend::raw;
 
-DeviceMonitor::DeviceMonitor()
+DeviceMonitor::DeviceMonitor() : _generation (0),
+    _tagged (_ruleInstalled())
 {
     if(-1 == pipe(_pipe))
         throw std::system_error(errno, std::system_category(),
@@ -70,6 +73,13 @@ void DeviceMonitor::run()
         throw std::system_error (-ret, std::system_category(),
                 "udev_monitor_filter_add_match_subsystem_devtype");
 
+    if(_tagged) {
+        ret = udev_monitor_filter_add_match_tag(monitor, LOGID_UDEV_TAG);
+        if(0 != ret)
+            throw std::system_error(-ret, std::system_category(),
+                    "udev_monitor_filter_add_match_tag");
+    }
+
     ret = udev_monitor_enable_receiving(monitor);
     if(0 != ret)
         throw std::system_error(-ret, std::system_category(),
@@ -80,6 +90,20 @@ void DeviceMonitor::run()
     int fd = udev_monitor_get_fd(monitor);
 
     _run_monitor = true;
+
+    if(global_reactors) {
+        // Let a reactor thread watch the monitor, block until stopped
+        auto shard = global_reactors->acquire("udev");
+        shard->add(fd, [this, monitor]() {
+            _receiveDevice(monitor);
+        });
+        std::unique_lock<std::mutex> stop_lock(_stop_lock);
+        _stop_cv.wait(stop_lock, [this]{ return !_run_monitor; });
+        shard->remove(fd);
+        global_reactors->release("udev");
+        return;
+    }
+
     while (_run_monitor) {
         fd_set fds;
         FD_ZERO(&fds);
@@ -94,36 +118,8 @@ void DeviceMonitor::run()
                     "udev_monitor select");
         }
 
-        if (FD_ISSET(fd, &fds)) {
-            struct udev_device *device = udev_monitor_receive_device(monitor);
-            std::string action = udev_device_get_action(device);
-            std::string devnode = udev_device_get_devnode(device);
-
-            if (action == "add")
-                task::spawn([this, name=devnode]() {
-                    // Wait for device to initialise
-                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
-                    auto supported_reports = backend::hidpp::getSupportedReports(
-                            RawDevice::getReportDescriptor(name));
-                    if(supported_reports)
-                        this->addDevice(name);
-                    else
-                        logPrintf(DEBUG, "Unsupported device %s ignored",
-                                  name.c_str());
-                }, [name=devnode](std::exception& e){
-                    logPrintf(WARN, "Error adding device %s: %s",
-                              name.c_str(), e.what());
-                });
-            else if (action == "remove")
-                task::spawn([this, name=devnode]() {
-                    this->removeDevice(name);
-                }, [name=devnode](std::exception& e){
-                    logPrintf(WARN, "Error removing device %s: %s",
-                               name.c_str(), e.what());
-                });
-
-            udev_device_unref (device);
-        }
+        if (FD_ISSET(fd, &fds))
+            _receiveDevice(monitor);
         if (FD_ISSET(_pipe[0], &fds)) {
             char c;
             if (-1 == read(_pipe[0], &c, sizeof (char)))
@@ -134,14 +130,229 @@ void DeviceMonitor::run()
     }
 }
 
+void DeviceMonitor::_receiveDevice(struct udev_monitor* monitor)
+{
+    struct udev_device *device = udev_monitor_receive_device(monitor);
+    std::string action = udev_device_get_action(device);
+    std::string devnode = udev_device_get_devnode(device);
+
+    if (action == "add") {
+        if(_isCandidate(device))
+            _nodeEvent(devnode, true, global_config->hotplugDebounce());
+    } else if (action == "remove")
+        _nodeEvent(devnode, false, std::chrono::milliseconds(0));
+
+    udev_device_unref (device);
+}
+
+bool DeviceMonitor::_isCandidate(struct udev_device* device)
+{
+    // HID_ID is bus:vendor:product, nodes that do not tell are probed
+    auto hid = udev_device_get_parent_with_subsystem_devtype(device, "hid",
+            nullptr);
+    const char* hid_id = hid ? udev_device_get_property_value(hid, "HID_ID")
+            : nullptr;
+    unsigned int bus, vendor, product;
+    if(!hid_id || sscanf(hid_id, "%x:%x:%x", &bus, &vendor, &product) != 3)
+        return true;
+
+    return vendor == LOGID_LOGITECH_VENDOR;
+}
+
+bool DeviceMonitor::_ruleInstalled()
+{
+    for(auto dir : {"/etc/udev/rules.d", "/run/udev/rules.d",
+                    "/usr/lib/udev/rules.d", "/lib/udev/rules.d",
+                    LOGID_UDEV_RULES_DIR}) {
+        if(::access((std::string(dir) + "/" + LOGID_UDEV_RULE).c_str(),
+                F_OK) == 0)
+            return true;
+    }
+    return false;
+}
+
+uint64_t DeviceMonitor::_nodeChanged(const std::string& path, bool added)
+{
+    std::lock_guard<std::mutex> lock(_nodes_lock);
+    auto& node = _nodes[path];
+    if(!node)
+        node = std::make_shared<Node>();
+    auto generation = node->generation = ++_generation;
+    node->added = added;
+    if(!added)
+        node->removed = generation;
+
+    return generation;
+}
+
+void DeviceMonitor::_nodeEvent(const std::string& path, bool added,
+        std::chrono::milliseconds delay)
+{
+    auto generation = _nodeChanged(path, added);
+
+    auto settle = [this, path, generation]() {
+        _settle(path, generation);
+    };
+    auto handler = [path, added](std::exception& e) {
+        logPrintf(WARN, "Error %s device %s: %s", added ? "adding" :
+                "removing", path.c_str(), e.what());
+    };
+
+    if(delay.count() > 0)
+        task::spawnAfter(delay, settle, handler, task::Background);
+    else
+        task::spawn(added ? task::Background : task::Normal, settle, handler);
+}
+
+bool DeviceMonitor::_settle(const std::string& path, uint64_t generation)
+{
+    std::shared_ptr<Node> node;
+    {
+        std::lock_guard<std::mutex> lock(_nodes_lock);
+        auto it = _nodes.find(path);
+        if(it == _nodes.end())
+            return false;
+        node = it->second;
+    }
+
+    std::lock_guard<std::mutex> node_lock(node->lock);
+
+    bool current, added;
+    uint64_t removed;
+    {
+        std::lock_guard<std::mutex> lock(_nodes_lock);
+        current = node->generation == generation;
+        added = node->added;
+        removed = node->removed;
+    }
+
+    // A removed node is dropped even if it was added again since
+    if(node->present && removed > node->present) {
+        node->present = 0;
+        this->removeDevice(path);
+    }
+
+    if(!current)
+        return false;
+
+    if(!added) {
+        std::lock_guard<std::mutex> lock(_nodes_lock);
+        if(node->generation == generation)
+            _nodes.erase(path);
+        return false;
+    }
+
+    // Added twice, or the node went away before its turn
+    if(node->present || ::access(path.c_str(), F_OK) != 0)
+        return false;
+
+    auto device = _probeDevice(path);
+    if(!device)
+        return false;
+
+    {
+        std::lock_guard<std::mutex> lock(_nodes_lock);
+        if(node->removed > generation) {
+            LOGID_LOG(DEBUG, "%s was removed while probing, ignoring it",
+                    path.c_str());
+            return false;
+        }
+    }
+
+    node->present = generation;
+    this->addDevice(device);
+    return true;
+}
+
+std::shared_ptr<RawDevice> DeviceMonitor::_probeDevice(
+        const std::string& path)
+{
+    auto device = std::make_shared<RawDevice>(path);
+    if(backend::hidpp::getSupportedReports(device->vendorId(),
+            device->productId(), device->reportDescriptor()))
+        return device;
+
+    LOGID_LOG(DEBUG, "Unsupported device %s ignored", path.c_str());
+    return nullptr;
+}
+
 void DeviceMonitor::stop()
 {
-    _run_monitor = false;
+    {
+        std::lock_guard<std::mutex> stop_lock(_stop_lock);
+        _run_monitor = false;
+    }
+    _stop_cv.notify_all();
     std::lock_guard<std::mutex> lock(_running);
 }
 
 void DeviceMonitor::enumerate()
 {
+    auto start = std::chrono::steady_clock::now();
+    auto enumeration = std::make_shared<Enumeration>();
+    std::size_t node_count = 0;
+
+    /* Nodes that were there before the rule was installed are untagged
+     * until udev is triggered again, so an empty result is not trusted */
+    if(_tagged)
+        node_count = _scan(*enumeration, true);
+    if(enumeration->nodes.empty())
+        node_count = _scan(*enumeration, false);
+
+    // A fixed number of tasks share the nodes
+    auto timeout = global_config->enumerationTimeout();
+    auto runners = std::min<std::size_t>(enumeration->nodes.size(),
+            global_config->enumerationConcurrency());
+    for(std::size_t i = 0; i < runners; i++) {
+        task::spawn(task::Background, [this, enumeration, start]() {
+            std::size_t i;
+            while((i = enumeration->next++) < enumeration->nodes.size()) {
+                auto& node = enumeration->nodes[i];
+                bool ready = false;
+                try {
+                    ready = _settle(node.first, node.second);
+                } catch(std::exception& e) {
+                    logPrintf(WARN, "Error adding device %s: %s",
+                            node.first.c_str(), e.what());
+                }
+
+                std::lock_guard<std::mutex> lock(enumeration->lock);
+                if(ready)
+                    enumeration->ready++;
+                if(++enumeration->done < enumeration->nodes.size())
+                    continue;
+                if(enumeration->timed_out)
+                    logPrintf(INFO, "Enumeration finished after %ld ms, "
+                                    "%zu devices found", _elapsed(start),
+                            enumeration->ready);
+                enumeration->done_cv.notify_all();
+            }
+        });
+    }
+
+    std::unique_lock<std::mutex> lock(enumeration->lock);
+    if(enumeration->done_cv.wait_until(lock, start + timeout, [enumeration]() {
+        return enumeration->done == enumeration->nodes.size();
+    })) {
+        logPrintf(INFO, "Found %zu devices on %zu of %zu hidraw nodes in "
+                        "%ld ms", enumeration->ready,
+                        enumeration->nodes.size(), node_count,
+                        _elapsed(start));
+    } else {
+        enumeration->timed_out = true;
+        logPrintf(WARN, "Enumeration timed out after %ld ms with %zu "
+                        "devices found, %zu of %zu nodes are still probed "
+                        "in the background", _elapsed(start),
+                        enumeration->ready,
+                        enumeration->nodes.size() - enumeration->done,
+                        enumeration->nodes.size());
+    }
+}
+
+std::size_t DeviceMonitor::_scan(Enumeration& enumeration, bool tagged)
+{
+    std::size_t node_count = 0;
+
     int ret;
     struct udev_enumerate* udev_enum = udev_enumerate_new(_udev_context);
     ret = udev_enumerate_add_match_subsystem(udev_enum, "hidraw");
@@ -149,6 +360,13 @@ void DeviceMonitor::enumerate()
         throw std::system_error(-ret, std::system_category(),
                 "udev_enumerate_add_match_subsystem");
 
+    if(tagged) {
+        ret = udev_enumerate_add_match_tag(udev_enum, LOGID_UDEV_TAG);
+        if(0 != ret)
+            throw std::system_error(-ret, std::system_category(),
+                    "udev_enumerate_add_match_tag");
+    }
+
     ret = udev_enumerate_scan_devices(udev_enum);
     if(0 != ret)
         throw std::system_error(-ret, std::system_category(),
@@ -164,22 +382,21 @@ void DeviceMonitor::enumerate()
         if(!device)
             throw std::runtime_error("udev_device_new_from_syspath failed");
 
-        std::string devnode = udev_device_get_devnode(device);
+        node_count++;
+        if(_isCandidate(device)) {
+            std::string devnode = udev_device_get_devnode(device);
+            enumeration.nodes.emplace_back(devnode,
+                    _nodeChanged(devnode, true));
+        }
         udev_device_unref(device);
-
-        task::spawn([this, name=devnode]() {
-            auto supported_reports = backend::hidpp::getSupportedReports(
-                    RawDevice::getReportDescriptor(name));
-            if(supported_reports)
-                this->addDevice(name);
-            else
-                logPrintf(DEBUG, "Unsupported device %s ignored",
-                          name.c_str());
-        }, [name=devnode](std::exception& e){
-            logPrintf(WARN, "Error adding device %s: %s",
-                      name.c_str(), e.what());
-        });
     }
 
     udev_enumerate_unref(udev_enum);
-}
\ No newline at end of file
+    return node_count;
+}
+
+long DeviceMonitor::_elapsed(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start).count();
+}
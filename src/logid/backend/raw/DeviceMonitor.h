@@ -20,8 +20,21 @@
 #define LOGID_BACKEND_RAW_DEVICEMONITOR_H
 
 #include <string>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <vector>
+
+#define LOGID_LOGITECH_VENDOR 0x046d
+// Set by 70-logid.rules on the hidraw nodes of Logitech devices
+#define LOGID_UDEV_TAG "logid"
+#define LOGID_UDEV_RULE "70-logid.rules"
+#ifndef LOGID_UDEV_RULES_DIR
+#define LOGID_UDEV_RULES_DIR "/usr/lib/udev/rules.d"
+#endif
 
 extern "C"
 {
@@ -32,22 +45,84 @@ namespace logid {
 namespace backend {
 namespace raw
 {
+    class RawDevice;
+
     class DeviceMonitor
     {
     public:
+        /* Probes the hidraw nodes that exist already, blocks until they
+         * are all set up or the enumeration timeout passes.
+         */
         void enumerate();
         void run();
         void stop();
     protected:
         DeviceMonitor();
         ~DeviceMonitor();
-        virtual void addDevice(std::string device) = 0;
+        /* The node is opened once and handed over, already known to
+         * support HID++ reports. */
+        virtual void addDevice(std::shared_ptr<RawDevice> device) = 0;
         virtual void removeDevice(std::string device) = 0;
     private:
+        /* udev events for a hidraw node are coalesced: adds are only
+         * probed once the node stayed added for the debounce window, and
+         * every event makes earlier pending or running probes stale.
+         */
+        struct Node
+        {
+            // Serializes settling the node, guards present
+            std::mutex lock;
+            // Guarded by _nodes_lock
+            uint64_t generation = 0;
+            uint64_t removed = 0; // Generation of the last remove
+            bool added = false;
+            // Generation handed to addDevice(), 0 if none
+            uint64_t present = 0;
+        };
+
+        void _receiveDevice(struct udev_monitor* monitor);
+        // Skips nodes of other vendors without opening them
+        static bool _isCandidate(struct udev_device* device);
+        // Returns the generation of the event
+        uint64_t _nodeChanged(const std::string& path, bool added);
+        void _nodeEvent(const std::string& path, bool added,
+                std::chrono::milliseconds delay);
+        // True if the node was handed to addDevice()
+        bool _settle(const std::string& path, uint64_t generation);
+        // Null if the node does not support HID++
+        std::shared_ptr<RawDevice> _probeDevice(const std::string& path);
+
+        // Startup probes, shared with the tasks running them
+        struct Enumeration
+        {
+            std::vector<std::pair<std::string, uint64_t>> nodes;
+            std::atomic<std::size_t> next {0};
+            std::mutex lock;
+            std::condition_variable done_cv;
+            std::size_t done = 0;
+            std::size_t ready = 0;
+            bool timed_out = false;
+        };
+        static long _elapsed(std::chrono::steady_clock::time_point start);
+
+        /* With the rule installed, udev only wakes the monitor for tagged
+         * nodes. Otherwise every hidraw node is checked against sysfs. */
+        static bool _ruleInstalled();
+        // Queues the candidate nodes, returns how many were seen
+        std::size_t _scan(Enumeration& enumeration, bool tagged);
+
+        std::mutex _nodes_lock;
+        // Shared by all nodes so that stale generations never match
+        uint64_t _generation;
+        std::map<std::string, std::shared_ptr<Node>> _nodes;
+
         struct udev* _udev_context;
+        bool _tagged;
         int _pipe[2];
         std::atomic<bool> _run_monitor;
         std::mutex _running;
+        std::mutex _stop_lock;
+        std::condition_variable _stop_cv;
     };
 }}}
 
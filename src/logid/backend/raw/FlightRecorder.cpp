@@ -0,0 +1,86 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <cstring>
+#include "FlightRecorder.h"
+#include "../../util/log.h"
+
+using namespace logid;
+using namespace logid::backend::raw;
+using namespace std::chrono;
+
+constexpr std::size_t FlightRecorder::MaxReportLength;
+
+FlightRecorder::FlightRecorder() : _entries (LOGID_FLIGHT_RECORDER_SIZE),
+    _next (0), _count (0)
+{
+}
+
+void FlightRecorder::record(bool out, const uint8_t* data,
+        std::size_t length)
+{
+    auto now = steady_clock::now();
+    length = std::min(length, MaxReportLength);
+
+    std::lock_guard<std::mutex> lock(_lock);
+    auto& entry = _entries[_next];
+    entry.time = now;
+    entry.out = out;
+    entry.length = (uint8_t)length;
+    memcpy(entry.data.data(), data, length);
+    _next = (_next + 1) % _entries.size();
+    if(_count < _entries.size())
+        _count++;
+}
+
+void FlightRecorder::dump(const std::string& path, const char* reason)
+{
+    static const char hex[] = "0123456789abcdef";
+    auto now = steady_clock::now();
+
+    // Copied out so that logging does not hold back the I/O thread
+    std::vector<Entry> entries;
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        if(_last_dump != steady_clock::time_point() &&
+           now - _last_dump < LOGID_FLIGHT_RECORDER_INTERVAL)
+            return;
+        _last_dump = now;
+        std::size_t first = (_next + _entries.size() - _count) %
+                _entries.size();
+        for(std::size_t i = 0; i < _count; i++)
+            entries.push_back(_entries[(first + i) % _entries.size()]);
+    }
+
+    logPrintf(WARN, "%s: %s, last %zu reports:", path.c_str(), reason,
+            entries.size());
+    for(auto& entry : entries) {
+        char data[MaxReportLength * 3 + 1];
+        std::size_t pos = 0;
+        for(std::size_t i = 0; i < entry.length; i++) {
+            data[pos++] = hex[entry.data[i] >> 4];
+            data[pos++] = hex[entry.data[i] & 0xf];
+            data[pos++] = ' ';
+        }
+        data[pos ? pos - 1 : 0] = '\0';
+        logPrintf(WARN, "%s: %9.3f ms %s %s", path.c_str(),
+                duration<double, std::milli>(entry.time - now).count(),
+                entry.out ? "OUT:" : "IN: ", data);
+    }
+}
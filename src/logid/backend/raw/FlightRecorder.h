@@ -0,0 +1,71 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_BACKEND_RAW_FLIGHTRECORDER_H
+#define LOGID_BACKEND_RAW_FLIGHTRECORDER_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Reports kept by each RawDevice
+#define LOGID_FLIGHT_RECORDER_SIZE 64
+// A device dumps its recorder at most this often
+#define LOGID_FLIGHT_RECORDER_INTERVAL std::chrono::seconds(10)
+
+namespace logid {
+namespace backend {
+namespace raw
+{
+    /* The last reports read and written by a RawDevice, kept in memory
+     * that is allocated once. Unlike RAWREPORT logging or a Capture it is
+     * always on, and is only logged when a request times out or fails.
+     */
+    class FlightRecorder
+    {
+    public:
+        // DJ long reports, the longest a RawDevice reads
+        static constexpr std::size_t MaxReportLength = 32;
+
+        FlightRecorder();
+
+        void record(bool out, const uint8_t* data, std::size_t length);
+        /* Logs the recorded reports, oldest first. Dumps within
+         * LOGID_FLIGHT_RECORDER_INTERVAL of the last one are skipped. */
+        void dump(const std::string& path, const char* reason);
+    private:
+        struct Entry
+        {
+            std::chrono::steady_clock::time_point time;
+            bool out;
+            uint8_t length;
+            std::array<uint8_t, MaxReportLength> data;
+        };
+
+        std::mutex _lock;
+        std::vector<Entry> _entries;
+        std::size_t _next;
+        std::size_t _count;
+        std::chrono::steady_clock::time_point _last_dump;
+    };
+}}}
+
+#endif //LOGID_BACKEND_RAW_FLIGHTRECORDER_H
@@ -21,23 +21,39 @@
 #include "../hidpp/defs.h"
 #include "../dj/defs.h"
 #include "../../util/log.h"
+#include "../../util/alloc.h"
 #include "../hidpp/Report.h"
 #include "../../Configuration.h"
 #include "../../util/thread.h"
 #include "../../util/task.h"
 #include "../../util/workqueue.h"
+#include "../../util/reactor.h"
+#include "../../util/realtime.h"
+#include "../../util/timer_wheel.h"
+#include "../../util/backoff.h"
+#include "../../util/probes.h"
+#include "../../util/timeline.h"
+#include "../../util/strand.h"
+#include "Capture.h"
 
 #include <string>
+#include <stdexcept>
 #include <system_error>
 #include <utility>
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
 
-#define MAX_DATA_LENGTH 32
+#define MAX_DATA_LENGTH LOGID_REPORT_SLOT_SIZE
+#define LOGID_REQUEST_POOL_SIZE 16
 
 extern "C"
 {
 #include <cassert>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <sys/ioctl.h>
 #include <linux/hidraw.h>
 }
@@ -46,6 +62,12 @@ using namespace logid::backend::raw;
 using namespace logid::backend;
 using namespace std::chrono;
 
+namespace
+{
+    // The device whose events this thread dispatches off the I/O thread
+    thread_local const void* offloaded_device = nullptr;
+}
+
 bool RawDevice::supportedReport(uint8_t id, uint8_t length)
 {
     switch(id) {
@@ -65,7 +87,9 @@ bool RawDevice::supportedReport(uint8_t id, uint8_t length)
 }
 
 RawDevice::RawDevice(std::string path) : _path (std::move(path)),
-    _continue_listen (false), _continue_respond (false)
+    _continue_listen (false), _reactor_listening (false),
+    _event_handlers (std::make_shared<const EventHandlers>()),
+    _handler_readers (std::make_shared<read_epoch>())
 {
     int ret;
 
@@ -83,6 +107,17 @@ RawDevice::RawDevice(std::string path) : _path (std::move(path)),
     }
     _vid = devinfo.vendor;
     _pid = devinfo.product;
+    _bus = devinfo.bustype;
+
+    // USB paths end in /inputN, N being the interface number
+    char phys_buf[256];
+    if(-1 != (ret = ::ioctl(_fd, HIDIOCGRAWPHYS(sizeof(phys_buf)), phys_buf))
+            && ret > 0) {
+        std::string phys(phys_buf, strnlen(phys_buf, ret));
+        auto input = phys.rfind("/input");
+        if(input != std::string::npos)
+            _interface = std::atoi(phys.c_str() + input + 6);
+    }
 
     char name_buf[256];
     if (-1 == (ret = ::ioctl(_fd, HIDIOCGRAWNAME(sizeof(name_buf)), name_buf)
@@ -94,8 +129,43 @@ RawDevice::RawDevice(std::string path) : _path (std::move(path)),
     }
     _name.assign(name_buf, ret - 1);
 
+    // The HID device is the parent of the hidraw node in sysfs
+    auto node = _path.substr(_path.rfind('/') + 1);
+    char driver_buf[PATH_MAX];
+    ret = ::readlink(("/sys/class/hidraw/" + node + "/device/driver")
+            .c_str(), driver_buf, sizeof(driver_buf) - 1);
+    if(ret > 0) {
+        std::string driver(driver_buf, ret);
+        _driver = driver.substr(driver.rfind('/') + 1);
+    }
+
     _rdesc = getReportDescriptor(_fd);
 
+    _init();
+}
+
+RawDevice::RawDevice(int fd, std::string path, uint16_t vid, uint16_t pid,
+        std::string name, std::vector<uint8_t> rdesc) : _path (std::move(path)),
+    _fd (fd), _vid (vid), _pid (pid), _name (std::move(name)),
+    _rdesc (std::move(rdesc)), _continue_listen (false),
+    _reactor_listening (false),
+    _event_handlers (std::make_shared<const EventHandlers>()),
+    _handler_readers (std::make_shared<read_epoch>())
+{
+    _init();
+}
+
+void RawDevice::_init()
+{
+    // Reports are drained until a read would block
+    int flags = ::fcntl(_fd, F_GETFL);
+    if(flags == -1 || -1 == ::fcntl(_fd, F_SETFL, flags | O_NONBLOCK)) {
+        int err = errno;
+        close(_fd);
+        throw std::system_error(err, std::system_category(),
+                "RawDevice fcntl failed");
+    }
+
     if (-1 == ::pipe(_pipe)) {
         int err = errno;
         close(_fd);
@@ -104,10 +174,84 @@ RawDevice::RawDevice(std::string path) : _path (std::move(path)),
     }
 
     _continue_listen = false;
+    _latency = latency::device(_path);
+    _metrics = metrics::rawDevice(_path);
+
+    _pending_reports.reserve(LOGID_REQUEST_POOL_SIZE);
+    _request_pool.reserve(LOGID_REQUEST_POOL_SIZE);
+    _batch_report.reserve(MAX_DATA_LENGTH);
+    _capture_path = global_capture ? global_capture->pathId(_path) :
+            Capture::UnknownPath;
+    _flight = std::make_shared<FlightRecorder>();
+
+    _watchdog = watchdog::watch([path=_path, counters=_metrics,
+            flight=_flight](nanoseconds stalled) {
+        counters->add(metrics::Stalls);
+        logPrintf(WARN, "%s: event dispatch stalled for %lld ms",
+                path.c_str(), (long long)duration_cast<milliseconds>(
+                stalled).count());
+        flight->dump(path, "Event dispatch stalled");
+    });
+    if(_watchdog && global_config->watchdogOffload()) {
+        _event_lane = std::make_shared<strand>(task::Interactive);
+        _lane_watchdog = watchdog::watch([path=_path, counters=_metrics](
+                nanoseconds stalled) {
+            counters->add(metrics::Stalls);
+            logPrintf(WARN, "%s: offloaded event dispatch stalled for %lld ms",
+                    path.c_str(), (long long)duration_cast<milliseconds>(
+                    stalled).count());
+        });
+    }
+    _filter_reports = global_config->filterReports();
+    _motion_max_age = global_config->motionMaxAge();
+    _motion_events = std::make_shared<const std::vector<uint32_t>>();
+}
+
+bool RawDevice::_isHidppReport(const uint8_t* report, std::size_t length)
+{
+    if(length == 0)
+        return false;
+    return report[0] == hidpp::ReportType::Short ||
+        report[0] == hidpp::ReportType::Long ||
+        report[0] == dj::ReportType::Short ||
+        report[0] == dj::ReportType::Long;
+}
+
+void RawDevice::_traceReport(bool out, const std::vector<uint8_t>& report)
+{
+    // Every report passes through here, read or written
+    if(out)
+        LOGID_PROBE3(report__send, _fd, report.data(), report.size());
+    else
+        LOGID_PROBE3(report__read, _fd, report.data(), report.size());
+    _metrics->add(out ? metrics::ReportsOut : metrics::ReportsIn);
+    _flight->record(out, report.data(), report.size());
+    if(logEnabled(RAWREPORT))
+        logReport(_path, out ? "OUT:" : "IN: ", report.data(),
+                report.size());
+    if(global_capture)
+        global_capture->record(_capture_path, out ? Capture::Out :
+            Capture::In, report.data(), report.size());
 }
 
 RawDevice::~RawDevice()
 {
+    if(_reactor_listening)
+        _reactor->remove(_fd);
+    if(_reactor)
+        global_reactors->release(_path);
+
+    // Outstanding callback requests must not time out on a dead device
+    std::vector<std::shared_ptr<timer>> timeouts;
+    {
+        std::lock_guard<std::mutex> lock(_pending_lock);
+        for(auto& pending : _pending_reports)
+            if(pending->timeout)
+                timeouts.push_back(std::move(pending->timeout));
+    }
+    for(auto& timeout : timeouts)
+        timeout->cancel();
+
     if(_fd != -1)
     {
         ::close(_fd);
@@ -115,6 +259,12 @@ RawDevice::~RawDevice()
         ::close(_pipe[1]);
     }
 }
+
+logid::metrics::counters& RawDevice::stats()
+{
+    return *_metrics;
+}
+
 std::string RawDevice::hidrawPath() const
 {
     return _path;
@@ -135,6 +285,21 @@ uint16_t RawDevice::productId() const
     return _pid;
 }
 
+uint32_t RawDevice::busType() const
+{
+    return _bus;
+}
+
+int RawDevice::interfaceNumber() const
+{
+    return _interface;
+}
+
+const std::string& RawDevice::kernelDriver() const
+{
+    return _driver;
+}
+
 std::vector<uint8_t> RawDevice::getReportDescriptor(std::string path)
 {
     int fd = ::open(path.c_str(), O_RDWR);
@@ -165,243 +330,1290 @@ std::vector<uint8_t> RawDevice::getReportDescriptor(int fd)
     return std::vector<uint8_t>(rdesc.value, rdesc.value + rdesc.size);
 }
 
-std::vector<uint8_t> RawDevice::reportDescriptor() const
+const std::vector<uint8_t>& RawDevice::reportDescriptor() const
 {
     return _rdesc;
 }
 
 std::vector<uint8_t> RawDevice::sendReport(const std::vector<uint8_t>& report)
 {
-    /* If the listener will stop, handle I/O manually.
-     * Otherwise, push to queue and wait for result. */
-    if(_continue_listen) {
-        std::mutex send_report;
-        std::unique_lock<std::mutex> lock(send_report);
-        std::condition_variable cv;
-        bool top_of_queue = false;
-        auto task = std::make_shared<std::packaged_task<std::vector<uint8_t>()>>
-                ( [this, report, &cv, &top_of_queue] () {
-            top_of_queue = true;
-            cv.notify_all();
-            return this->_respondToReport(report);
-        });
-        auto f = task->get_future();
-        _io_queue.push(task);
-        interruptRead(false); // Alert listener to prioritise
-        cv.wait(lock, [&top_of_queue]{ return top_of_queue; });
-        auto status = f.wait_for(global_config->ioTimeout());
-        if(status == std::future_status::timeout) {
-            _continue_respond = false;
-            interruptRead();
-            return f.get(); // Expecting an error, but it could work
-        }
-        return f.get();
-    }
-    else {
-        std::vector<uint8_t> response;
-        std::exception_ptr _exception;
-        std::shared_ptr<task> t = std::make_shared<task>(
-                [this, report, &response]() {
-                    response = _respondToReport(report);
-        }, [&_exception](std::exception& e) {
-                    try {
-                        throw e;
-                    } catch(std::exception& e) {
-                        _exception = std::make_exception_ptr(e);
-                    }
-                });
-        global_workqueue->queue(t);
-        t->waitStart();
-        auto status = t->waitFor(global_config->ioTimeout());
-        if(_exception)
-            std::rethrow_exception(_exception);
-        if(status == std::future_status::timeout) {
-            _continue_respond = false;
-            interruptRead();
-            t->wait();
-            if(_exception)
-                std::rethrow_exception(_exception);
-            throw TimeoutError();
-        } else
-            return response;
+    /* A callback on the I/O thread cannot wait for the listener to
+     * read its response, read it synchronously instead. */
+    if(_onIOThread())
+        return _respondToReport(report);
+
+    if(_continue_listen || _reactor_listening)
+        return _waitForResponse(_queueRequest(report));
+
+    return _respondToReport(report);
+}
+
+std::future<std::vector<uint8_t>> RawDevice::sendReportAsync(
+        const std::vector<uint8_t>& report)
+{
+    // Without a listener, responses can only be read synchronously
+    if(_onIOThread() || !(_continue_listen || _reactor_listening)) {
+        std::promise<std::vector<uint8_t>> response;
+        try {
+            response.set_value(sendReport(report));
+        } catch(...) {
+            response.set_exception(std::current_exception());
+        }
+        return response.get_future();
+    }
+
+    /* Driven by the timer wheel like any callback request, so a future
+     * dropped without get() still frees its window slot on time. */
+    auto response = std::make_shared<std::promise<std::vector<uint8_t>>>();
+    auto future = response->get_future();
+    _queueRequest(report, [response](const std::vector<uint8_t>& report) {
+        response->set_value(report);
+    }, [response](std::exception& e) {
+        auto timeout = dynamic_cast<TimeoutError*>(&e);
+        auto error = dynamic_cast<std::system_error*>(&e);
+        if(timeout)
+            response->set_exception(std::make_exception_ptr(*timeout));
+        else if(error)
+            response->set_exception(std::make_exception_ptr(*error));
+        else
+            response->set_exception(std::make_exception_ptr(
+                    std::runtime_error(e.what())));
+    });
+    return future;
+}
+
+void RawDevice::sendReportAsync(const std::vector<uint8_t>& report,
+        const ResponseHandler& on_response, const ErrorHandler& on_error)
+{
+    if(!(_continue_listen || _reactor_listening)) {
+        task::spawn(task::Interactive, [this, report, on_response]() {
+            on_response(sendReport(report));
+        }, on_error);
+        return;
     }
+
+    _queueRequest(report, on_response, on_error);
 }
 
 // DJ commands are not systematically acknowledged, do not expect a result.
 void RawDevice::sendReportNoResponse(const std::vector<uint8_t>& report)
 {
-    /* If the listener will stop, handle I/O manually.
-     * Otherwise, push to queue and wait for result. */
-    if(_continue_listen) {
-        auto task = std::make_shared<std::packaged_task<std::vector<uint8_t>()>>
-                ([this, report]() {
-            this->_sendReport(report);
-            return std::vector<uint8_t>();
-        });
-        auto f = task->get_future();
-        _io_queue.push(task);
-        f.get();
+    _sendReport(report);
+}
+
+RawDevice::PendingReport::PendingReport() : attempts (0), rtt (nullptr),
+    error (0), state (Waiting), sequence (0)
+{
+    request.reserve(MAX_DATA_LENGTH);
+    response.reserve(MAX_DATA_LENGTH);
+}
+
+std::shared_ptr<RawDevice::PendingReport> RawDevice::_queueRequest(
+        const std::vector<uint8_t>& report, const ResponseHandler& on_response,
+        const ErrorHandler& on_error, bool admitted)
+{
+    auto& rtt = _rtt(report[1]);
+    auto io_timeout = nanoseconds(global_config->ioTimeout());
+    std::shared_ptr<PendingReport> pending;
+    uint64_t sequence;
+    {
+        std::unique_lock<std::mutex> lock(_pending_lock);
+        if(admitted) {
+            _admitted--;
+            _admitted_slots[report[1]]--;
+        } else if(!_enterWindow(lock, report, on_response, on_error))
+            return nullptr;
+
+        if(_request_pool.empty()) {
+            pending = std::make_shared<PendingReport>();
+        } else {
+            pending = std::move(_request_pool.back());
+            _request_pool.pop_back();
+        }
+
+        // No one else holds a pooled request, no need for pending->lock
+        pending->request.assign(report.begin(), report.end());
+        pending->state = PendingReport::Waiting;
+        auto timeout = rtt.timeout(io_timeout);
+        pending->sent = steady_clock::now();
+        pending->retry = pending->sent + timeout;
+        pending->deadline = pending->sent + rtt.budget(io_timeout);
+        pending->attempts = 0;
+        pending->rtt = &rtt;
+        pending->error = 0;
+        sequence = ++pending->sequence;
+        if(on_response) {
+            pending->on_response = on_response;
+            pending->on_error = on_error;
+            pending->timeout = task::spawnAfter(
+                    duration_cast<milliseconds>(timeout),
+                    [this, pending, sequence]() {
+                _expireAsync(pending, sequence);
+            }, [](std::exception& e) { ExceptionHandler::Default(e); },
+                    task::Interactive);
+        }
+        _pending_reports.push_back(pending);
     }
-    else
-        _sendReport(report);
+    _metrics->add(metrics::Requests);
+
+    int error = _writeReport(report);
+    if(error && _transientError(error) &&
+       global_config->retrySettings().count > 0) {
+        _retryWrite(pending, sequence, 0);
+    } else if(error) {
+        std::shared_ptr<timer> timeout;
+        std::system_error e(error, std::system_category(),
+                "_sendReport write failed");
+        {
+            std::lock_guard<std::mutex> lock(_pending_lock);
+            auto it = std::find(_pending_reports.begin(),
+                    _pending_reports.end(), pending);
+            // A callback request may have timed out already
+            if(it == _pending_reports.end())
+                throw e;
+            _pending_reports.erase(it);
+            timeout = std::move(pending->timeout);
+            pending->on_response = nullptr;
+            pending->on_error = nullptr;
+        }
+        if(timeout)
+            timeout->cancel();
+        _releaseRequest(pending);
+        _admitWaiting();
+        throw e;
+    }
+
+    return pending;
+}
+
+std::vector<uint8_t> RawDevice::_waitForResponse(
+        const std::shared_ptr<PendingReport>& pending)
+{
+    std::unique_lock<std::mutex> lock(pending->lock);
+    auto waiting = [&pending]() {
+        return pending->state != PendingReport::Waiting;
+    };
+
+    while(pending->retry < pending->deadline &&
+          !pending->done.wait_until(lock, pending->retry, waiting)) {
+        lock.unlock();
+        std::vector<uint8_t> request;
+        {
+            std::lock_guard<std::mutex> pending_lock(_pending_lock);
+            auto it = std::find(_pending_reports.begin(),
+                    _pending_reports.end(), pending);
+            if(it == _pending_reports.end())
+                pending->retry = pending->deadline;
+            else if(_retryRequest(*pending, steady_clock::now()))
+                request = pending->request;
+        }
+        if(!request.empty())
+            _resendRequest(request);
+        lock.lock();
+    }
+
+    if(!pending->done.wait_until(lock, pending->deadline, waiting)) {
+        lock.unlock();
+        {
+            std::lock_guard<std::mutex> pending_lock(_pending_lock);
+            auto it = std::find(_pending_reports.begin(),
+                    _pending_reports.end(), pending);
+            if(it != _pending_reports.end()) {
+                _pending_reports.erase(it);
+                _abandonRequest(*pending, steady_clock::now());
+                pending->state = PendingReport::TimedOut;
+            }
+        }
+        _admitWaiting();
+        // Otherwise, the response arrived while timing out
+        lock.lock();
+        pending->done.wait(lock, waiting);
+    }
+
+    auto state = pending->state;
+    int error = pending->error;
+    std::vector<uint8_t> response;
+    if(state == PendingReport::Done)
+        response = pending->response;
+    lock.unlock();
+
+    _releaseRequest(pending);
+    if(state == PendingReport::TimedOut) {
+        _metrics->add(metrics::Timeouts);
+        _flight->dump(_path, "Request timed out");
+        throw TimeoutError();
+    } else if(state == PendingReport::Failed) {
+        if(error != ECANCELED)
+            _flight->dump(_path, "Request could not be written");
+        throw std::system_error(error, std::system_category(),
+                "_sendReport write failed");
+    }
+    return response;
+}
+
+void RawDevice::cancelRequests()
+{
+    std::vector<std::shared_ptr<PendingReport>> callbacks;
+    std::deque<WaitingRequest> waiting;
+    {
+        std::lock_guard<std::mutex> lock(_pending_lock);
+        for(auto& pending : _pending_reports) {
+            if(pending->on_response)
+                callbacks.push_back(pending);
+            else
+                _completeRequest(*pending, PendingReport::Failed, nullptr,
+                        ECANCELED);
+        }
+        _pending_reports.clear();
+
+        for(auto& request : _waiting) {
+            if(request.admitted) {
+                *request.error = ECANCELED;
+                *request.admitted = true;
+            }
+        }
+        std::swap(waiting, _waiting);
+        _waiting_count = 0;
+        _window_turn.notify_all();
+    }
+
+    for(auto& pending : callbacks)
+        _completeAsync(pending, nullptr, ECANCELED);
+    for(auto& request : waiting) {
+        if(request.on_error) {
+            std::system_error e(ECANCELED, std::system_category(),
+                    "_sendReport write failed");
+            request.on_error(e);
+        }
+    }
+}
+
+bool RawDevice::_enterWindow(std::unique_lock<std::mutex>& lock,
+        const std::vector<uint8_t>& report,
+        const ResponseHandler& on_response, const ErrorHandler& on_error)
+{
+    auto window = static_cast<std::size_t>(global_config->requestWindow());
+    // Synchronous readers free the window themselves, they cannot wait
+    if(!window || _onIOThread() || !(_continue_listen || _reactor_listening))
+        return true;
+
+    /* Waiting requests are let through as soon as they may be, those left
+     * are held back by their index, which is no reason to hold this one. */
+    uint8_t index = report[1];
+    std::size_t total = _pending_reports.size() + _admitted;
+    if(total < window) {
+        SlotLoad load{}, waiting{};
+        _slotLoad(load);
+        for(auto& request : _waiting)
+            waiting[request.index]++;
+        if(_slotAdmissible(index, load, total, waiting))
+            return true;
+    }
+
+    _metrics->add(metrics::Deferred);
+    WaitingRequest request{task::current(), steady_clock::now(), index,
+                           nullptr, nullptr, {}, nullptr, nullptr};
+    if(on_response) {
+        request.report = report;
+        request.on_response = on_response;
+        request.on_error = on_error;
+        _waiting.push_back(std::move(request));
+        _waiting_count++;
+        return false;
+    }
+
+    bool admitted = false;
+    int error = 0;
+    request.admitted = &admitted;
+    request.error = &error;
+    _waiting.push_back(std::move(request));
+    _waiting_count++;
+
+    lock.unlock();
+    if(global_workqueue)
+        global_workqueue->blocking();
+    lock.lock();
+    _window_turn.wait(lock, [&admitted]() { return admitted; });
+    if(error)
+        throw std::system_error(error, std::system_category(),
+                "_sendReport write failed");
+    _admitted--;
+    _admitted_slots[index]--;
+    return true;
+}
+
+void RawDevice::_slotLoad(SlotLoad& load) const
+{
+    load = _admitted_slots;
+    for(auto& pending : _pending_reports)
+        load[pending->request[1]]++;
+}
+
+bool RawDevice::_slotAdmissible(uint8_t index, const SlotLoad& load,
+        std::size_t total, const SlotLoad& waiting) const
+{
+    auto limit = static_cast<std::size_t>(global_config->slotWindow());
+    if(!limit || load[index] < limit)
+        return true;
+    // Past its share, an index only goes on alone
+    if(total > load[index])
+        return false;
+    for(std::size_t i = 0; i < waiting.size(); i++)
+        if(i != index && waiting[i])
+            return false;
+    return true;
+}
+
+std::deque<RawDevice::WaitingRequest>::iterator RawDevice::_nextWaiting(
+        steady_clock::time_point now, const SlotLoad& load, std::size_t total,
+        const SlotLoad& waiting)
+{
+    auto rank = [now](const WaitingRequest& request) {
+        auto aged = (now - request.since) / LOGID_REQUEST_AGING;
+        return std::max<long long>(0, request.priority - aged);
+    };
+    // How many indices after the last one let through
+    auto turn = [this](uint8_t index) {
+        return (uint8_t)(index - _last_slot - 1);
+    };
+
+    // Ties go to the next index in turn, then to the one that waited longest
+    auto next = _waiting.end();
+    long long next_rank = 0;
+    uint8_t next_turn = 0;
+    for(auto it = _waiting.begin(); it != _waiting.end(); ++it) {
+        if(!_slotAdmissible(it->index, load, total, waiting))
+            continue;
+        auto it_rank = rank(*it);
+        auto it_turn = turn(it->index);
+        if(next == _waiting.end() || it_rank < next_rank ||
+           (it_rank == next_rank && it_turn < next_turn)) {
+            next = it;
+            next_rank = it_rank;
+            next_turn = it_turn;
+        }
+    }
+    return next;
+}
+
+void RawDevice::_admitWaiting()
+{
+    if(!_waiting_count)
+        return;
+
+    std::vector<WaitingRequest> parked;
+    {
+        std::lock_guard<std::mutex> lock(_pending_lock);
+        auto window = static_cast<std::size_t>(
+                global_config->requestWindow());
+        auto now = steady_clock::now();
+        bool woken = false;
+        SlotLoad load{}, waiting{};
+        _slotLoad(load);
+        for(auto& request : _waiting)
+            waiting[request.index]++;
+        std::size_t total = _pending_reports.size() + _admitted;
+        while(!_waiting.empty() && (!window || total < window)) {
+            auto next = _nextWaiting(now, load, total, waiting);
+            if(next == _waiting.end())
+                break;
+            _admitted++;
+            _admitted_slots[next->index]++;
+            load[next->index]++;
+            waiting[next->index]--;
+            total++;
+            _last_slot = next->index;
+            if(next->admitted) {
+                *next->admitted = true;
+                woken = true;
+            } else {
+                parked.push_back(std::move(*next));
+            }
+            _waiting.erase(next);
+            _waiting_count--;
+        }
+        if(woken)
+            _window_turn.notify_all();
+    }
+
+    for(auto& request : parked) {
+        try {
+            _queueRequest(request.report, request.on_response,
+                    request.on_error, true);
+        } catch(std::system_error& e) {
+            // As if the write had failed when the request was made
+            task::spawn(task::Interactive, [on_error=request.on_error, e]()
+                    mutable { on_error(e); });
+        }
+    }
+}
+
+void RawDevice::_releaseRequest(const std::shared_ptr<PendingReport>& pending)
+{
+    std::lock_guard<std::mutex> lock(_pending_lock);
+    if(_request_pool.size() < LOGID_REQUEST_POOL_SIZE)
+        _request_pool.push_back(pending);
+}
+
+void RawDevice::_completeRequest(PendingReport& pending,
+        PendingReport::State state, const std::vector<uint8_t>* response,
+        int error)
+{
+    std::lock_guard<std::mutex> lock(pending.lock);
+    if(response)
+        pending.response.assign(response->begin(), response->end());
+    pending.state = state;
+    pending.error = error;
+    // Notify under the lock, the waiter may return pending to the pool
+    pending.done.notify_all();
+}
+
+void RawDevice::_completeAsync(const std::shared_ptr<PendingReport>& pending,
+        const std::vector<uint8_t>* response, int error)
+{
+    ResponseHandler on_response;
+    ErrorHandler on_error;
+    std::shared_ptr<timer> timeout;
+    {
+        std::lock_guard<std::mutex> lock(_pending_lock);
+        std::swap(on_response, pending->on_response);
+        std::swap(on_error, pending->on_error);
+        std::swap(timeout, pending->timeout);
+    }
+    // Harmless when called from the timeout itself
+    if(timeout)
+        timeout->cancel();
+    _releaseRequest(pending);
+
+    try {
+        if(response) {
+            on_response(*response);
+        } else if(error) {
+            if(error != ECANCELED)
+                _flight->dump(_path, "Request could not be written");
+            std::system_error e(error, std::system_category(),
+                    "_sendReport write failed");
+            on_error(e);
+        } else {
+            _metrics->add(metrics::Timeouts);
+            _flight->dump(_path, "Request timed out");
+            TimeoutError e;
+            on_error(e);
+        }
+    } catch(std::exception& e) {
+        ExceptionHandler::Default(e);
+    }
+}
+
+void RawDevice::_expireAsync(const std::shared_ptr<PendingReport>& pending,
+        uint64_t sequence)
+{
+    std::vector<uint8_t> request;
+    bool expired = false;
+    {
+        std::lock_guard<std::mutex> lock(_pending_lock);
+        if(pending->sequence != sequence)
+            return;
+        auto it = std::find(_pending_reports.begin(),
+                _pending_reports.end(), pending);
+        if(it == _pending_reports.end())
+            return;
+
+        auto now = steady_clock::now();
+        if(now < pending->deadline) {
+            if(_retryRequest(*pending, now))
+                request = pending->request;
+            // Rounded up, an early timeout would only re-arm itself
+            auto wait = duration_cast<milliseconds>(pending->retry - now) +
+                    milliseconds(1);
+            pending->timeout = task::spawnAfter(wait,
+                    [this, pending, sequence]() {
+                _expireAsync(pending, sequence);
+            }, [](std::exception& e) { ExceptionHandler::Default(e); },
+                    task::Interactive);
+        } else {
+            _pending_reports.erase(it);
+            _abandonRequest(*pending, now);
+            expired = true;
+        }
+    }
+
+    if(expired) {
+        _admitWaiting();
+        _completeAsync(pending, nullptr);
+    }
+    else if(!request.empty())
+        _resendRequest(request);
+}
+
+bool RawDevice::_retryRequest(PendingReport& pending,
+        steady_clock::time_point now)
+{
+    if(pending.attempts >= LOGID_RTT_RETRIES) {
+        pending.retry = pending.deadline;
+        return false;
+    }
+
+    pending.attempts++;
+    pending.rtt->backoff();
+    pending.retry = std::min(pending.deadline, now +
+            pending.rtt->timeout(nanoseconds(global_config->ioTimeout())));
+    return true;
+}
+
+void RawDevice::_resendRequest(const std::vector<uint8_t>& request)
+{
+    _metrics->add(metrics::Retries);
+    // Not retried, the next resend is due soon enough
+    int error = _writeReport(request);
+    if(error)
+        LOGID_LOG(DEBUG, "%s: resend failed: %s", _path.c_str(),
+                std::strerror(error));
+}
+
+void RawDevice::_retryWrite(const std::shared_ptr<PendingReport>& pending,
+        uint64_t sequence, int retry)
+{
+    _metrics->add(metrics::Retries);
+    auto delay = backoff::delay(global_config->retrySettings(), retry);
+    task::spawnAfter(delay, [this, pending, sequence, retry]() {
+        std::vector<uint8_t> request;
+        {
+            std::lock_guard<std::mutex> lock(_pending_lock);
+            if(pending->sequence != sequence || std::find(
+                    _pending_reports.begin(), _pending_reports.end(),
+                    pending) == _pending_reports.end())
+                return;
+            request = pending->request;
+        }
+
+        int error = _writeReport(request);
+        if(!error) {
+            // The round trip starts now, not at the failed write
+            std::lock_guard<std::mutex> lock(_pending_lock);
+            if(pending->sequence == sequence)
+                pending->sent = steady_clock::now();
+        } else if(_transientError(error) &&
+                  retry + 1 < global_config->retrySettings().count) {
+            _retryWrite(pending, sequence, retry + 1);
+        } else {
+            _failRequest(pending, sequence, error);
+        }
+    }, [](std::exception& e) { ExceptionHandler::Default(e); },
+            task::Interactive);
+}
+
+void RawDevice::_failRequest(const std::shared_ptr<PendingReport>& pending,
+        uint64_t sequence, int error)
+{
+    bool callback;
+    {
+        std::lock_guard<std::mutex> lock(_pending_lock);
+        if(pending->sequence != sequence)
+            return;
+        auto it = std::find(_pending_reports.begin(),
+                _pending_reports.end(), pending);
+        if(it == _pending_reports.end())
+            return;
+        _pending_reports.erase(it);
+        // Once completed, a synchronous request may be reused at any time
+        callback = (bool)pending->on_response;
+        if(!callback)
+            _completeRequest(*pending, PendingReport::Failed, nullptr, error);
+    }
+
+    _admitWaiting();
+    if(callback)
+        _completeAsync(pending, nullptr, error);
+}
+
+void RawDevice::_requestAnswered(PendingReport& pending,
+        steady_clock::time_point now)
+{
+    // Karn's algorithm: a resent request may be answering any attempt
+    if(pending.attempts == 0) {
+        pending.rtt->sample(now - pending.sent);
+        return;
+    }
+
+    // The other attempts were sent before this answer, they arrive soon
+    _strays.push_back({pending.request, pending.attempts, now +
+            pending.rtt->timeout(nanoseconds(global_config->ioTimeout()))});
+}
+
+bool RawDevice::_isStray(const std::vector<uint8_t>& report,
+        steady_clock::time_point now)
+{
+    bool stray = false;
+    for(auto it = _strays.begin(); it != _strays.end();) {
+        if(it->expiry < now) {
+            it = _strays.erase(it);
+        } else if(!stray && _isResponse(it->request, report)) {
+            stray = true;
+            if(--it->count == 0)
+                it = _strays.erase(it);
+            else
+                ++it;
+        } else {
+            ++it;
+        }
+    }
+    return stray;
+}
+
+logid::rtt_estimator& RawDevice::_rtt(uint8_t index)
+{
+    uint8_t slot = index < _device_stats.size() - 1 ? index :
+            _device_stats.size() - 1;
+    std::lock_guard<std::mutex> lock(_rtt_lock);
+    auto& stats = _device_stats[slot];
+    if(!stats) {
+        uint8_t key = slot == _device_stats.size() - 1 ?
+                uint8_t(hidpp::DefaultDevice) : slot;
+        stats = metrics::device(_path + ":" + std::to_string(key));
+    }
+    return stats->rtt;
+}
+
+void RawDevice::_handleReport(std::vector<uint8_t>& report)
+{
+    std::shared_ptr<PendingReport> response;
+    std::vector<std::shared_ptr<PendingReport>> expired;
+    bool stray = false, freed = false;
+    auto now = steady_clock::now();
+    watchdog::dispatch::cycle cycle(_watchdog && _onIOThread() ?
+            _watchdog.get() : nullptr, now);
+
+    {
+        std::lock_guard<std::mutex> lock(_pending_lock);
+        for(auto it = _pending_reports.begin(); it != _pending_reports.end();) {
+            if(!response && _isResponse((*it)->request, report)) {
+                response = std::move(*it);
+                LOGID_PROBE3(request__match, _fd, report.data(),
+                        duration_cast<nanoseconds>(now -
+                        response->sent).count());
+                timeline::complete("hidpp", "request", response->sent, now,
+                        _path, report[1]);
+                _requestAnswered(*response, now);
+                it = _pending_reports.erase(it);
+                freed = true;
+            } else if((*it)->deadline < now) {
+                // Requests whose futures were abandoned
+                LOGID_PROBE3(request__timeout, _fd, (*it)->request.data(),
+                        (*it)->attempts);
+                timeline::complete("hidpp", "timeout", (*it)->sent, now,
+                        _path, (*it)->request[1]);
+                _abandonRequest(**it, now);
+                if((*it)->on_response)
+                    expired.push_back(std::move(*it));
+                else
+                    _completeRequest(**it, PendingReport::TimedOut);
+                it = _pending_reports.erase(it);
+                freed = true;
+            } else {
+                ++it;
+            }
+        }
+        if(!response && _isStray(report, now))
+            stray = true;
+    }
+    if(freed)
+        _admitWaiting();
+
+    // HID++ 1.0 errors answer probes all the time, only 2.0 errors count
+    if(response && (report[0] == hidpp::ReportType::Short ||
+       report[0] == hidpp::ReportType::Long) && report[2] == 0xff)
+        _flight->dump(_path, "Request failed with an HID++ 2.0 error");
+
+    if(response && response->on_response)
+        _completeAsync(response, &report);
+    else if(response)
+        _completeRequest(*response, PendingReport::Done, &report);
+    else if(stray)
+        _metrics->add(metrics::Duplicates);
+    // Synchronous readers drop events, no one listens for them
+    else if(_continue_listen || _reactor_listening) {
+        LOGID_PROBE3(event__dispatch, _fd, report.data(), report.size());
+        this->_handleEvent(report);
+    }
+
+    for(auto& pending : expired)
+        _completeAsync(pending, nullptr);
+
+    latency::end();
+}
+
+bool RawDevice::_onIOThread() const
+{
+    if(_reactor_listening)
+        return _reactor->onReactorThread();
+
+    return _continue_listen &&
+        _listener_thread.load() == std::this_thread::get_id();
 }
 
 std::vector<uint8_t> RawDevice::_respondToReport
     (const std::vector<uint8_t>& request)
 {
-    _sendReport(request);
-    _continue_respond = true;
+    auto pending = _queueRequest(request);
+    _readResponse(pending);
+    return _waitForResponse(pending);
+}
+
+void RawDevice::_readResponse(const std::shared_ptr<PendingReport>& pending)
+{
+    std::unique_lock<std::mutex> lock(_pending_lock);
+    while(true) {
+        auto it = std::find(_pending_reports.begin(),
+                _pending_reports.end(), pending);
+        // Answered, possibly from a report another reader read
+        if(it == _pending_reports.end())
+            return;
+
+        auto now = steady_clock::now();
+        if(now >= pending->deadline) {
+            _pending_reports.erase(it);
+            _abandonRequest(*pending, now);
+            _completeRequest(*pending, PendingReport::TimedOut);
+            lock.unlock();
+            _admitWaiting();
+            return;
+        }
+
+        if(now >= pending->retry) {
+            if(_retryRequest(*pending, now)) {
+                auto resend = pending->request;
+                lock.unlock();
+                _resendRequest(resend);
+                lock.lock();
+            }
+            continue;
+        }
+
+        auto wake = std::min(pending->retry, pending->deadline);
+        if(_reading) {
+            _reader_turn.wait_until(lock, wake);
+            continue;
+        }
+
+        // Readers take turns, one report at a time
+        _reading = true;
+        lock.unlock();
+        std::vector<uint8_t> report;
+        try {
+            if(!(_onIOThread() && _nextBatched(report)))
+                _readReport(report, MAX_DATA_LENGTH, wake);
+            if(!report.empty())
+                this->_handleReport(report);
+        } catch(TimeoutError& e) {
+            // Retried or timed out above
+        } catch(...) {
+            lock.lock();
+            _reading = false;
+            _reader_turn.notify_all();
+            throw;
+        }
+        lock.lock();
+        _reading = false;
+        _reader_turn.notify_all();
+    }
+}
+
+void RawDevice::_abandonRequest(PendingReport& pending,
+        steady_clock::time_point now)
+{
+    // Any attempt may still be answered, until io_timeout has passed
+    _strays.push_back({pending.request, pending.attempts + 1,
+                       now + global_config->ioTimeout()});
+}
+
+bool RawDevice::_isResponse(const std::vector<uint8_t>& request,
+        const std::vector<uint8_t>& response)
+{
+    if(response.size() < 4)
+        return false;
+
+    // All reports have the device index at byte 2
+    if(response[1] != request[1])
+        return false;
 
-    auto start_point = std::chrono::steady_clock::now();
+    if(hidpp::ReportType::Short == request[0] ||
+        hidpp::ReportType::Long == request[0]) {
+        if(hidpp::ReportType::Short != response[0] &&
+           hidpp::ReportType::Long != response[0])
+            return false;
+
+        /* Errors echo the request's sub ID/feature index and
+         * address/function, leave them to the device to handle. */
+        if(response[2] == 0x8f || response[2] == 0xff)
+            return response.size() >= 5 && response[3] == request[2] &&
+                response[4] == request[3];
+
+        for(int i = 2; i < 4; i++)
+            if(response[i] != request[i])
+                return false;
+
+        return true;
+    } else if(dj::ReportType::Short == request[0] ||
+        dj::ReportType::Long == request[0]) {
+        //Error; leave to device ot handle
+        if(0x7f == response[2])
+            return true;
+        else if(response[2] == request[2])
+            return true;
+    }
 
-    while(_continue_respond) {
-        std::vector<uint8_t> response;
-        auto current_point = std::chrono::steady_clock::now();
-        auto timeout = global_config->ioTimeout() - std::chrono::duration_cast
-                <std::chrono::milliseconds>(current_point - start_point);
-        if(timeout.count() <= 0)
-            throw TimeoutError();
-        _readReport(response, MAX_DATA_LENGTH, timeout);
+    return false;
+}
 
-        if(!_continue_respond)
-            throw TimeoutError();
+void RawDevice::_reactorRead()
+{
+    auto ready = steady_clock::now();
+    int error;
+    bool open = _drainReports(error);
+    _dispatchBatch(ready);
+    if(open)
+        _busyPoll(ready, false);
+    else
+        _reactorClosed(error);
+}
 
-        // All reports have the device index at byte 2
-        if(response[1] != request[1]) {
-            if(_continue_listen)
-                this->_handleEvent(response);
+void RawDevice::_reactorReads(const reactor::read_result* reads,
+        std::size_t count)
+{
+    auto ready = steady_clock::now();
+    for(std::size_t i = 0; i < count; i++) {
+        auto& read = reads[i];
+        if(read.result <= 0) {
+            _dispatchBatch(ready);
+            _reactorClosed(-read.result);
+            return;
+        }
+        if(_filter_reports && !_isHidppReport(read.data, read.result)) {
+            _metrics->add(metrics::Filtered);
             continue;
         }
+        if(_batch.count == _batch.slots.size())
+            _dispatchBatch(ready);
+        // Truncated like a read into the slot would be
+        auto length = std::min<std::size_t>(read.result,
+                LOGID_REPORT_SLOT_SIZE);
+        std::memcpy(_batch.slots[_batch.count].data(), read.data, length);
+        _batch.lengths[_batch.count++] = length;
+    }
+    _dispatchBatch(ready);
+}
 
-        if(hidpp::ReportType::Short == request[0] ||
-            hidpp::ReportType::Long == request[0]) {
-            if(hidpp::ReportType::Short != response[0] &&
-               hidpp::ReportType::Long != response[0]) {
-                if(_continue_listen)
-                    this->_handleEvent(response);
-                continue;
-            }
+void RawDevice::_reactorClosed(int error)
+{
+    // Stop polling a device that has gone away
+    _reactor->remove(_fd);
+    _reactor_listening = false;
+    if(error) {
+        _flight->dump(_path, "Read failed");
+        throw std::system_error(error, std::system_category(),
+                "_reactorRead read failed");
+    }
+}
+
+bool RawDevice::_reactorIO() const
+{
+    return _reactor_listening && _reactor->completesReads() &&
+        _reactor->onReactorThread();
+}
+
+bool RawDevice::_drainReports(int& error)
+{
+    while(_batch.count < _batch.slots.size()) {
+        auto& slot = _batch.slots[_batch.count];
+        ssize_t ret = ::read(_fd, slot.data(), slot.size());
+        if(ret == -1 && errno == EINTR)
+            continue;
+        if(ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if(ret <= 0) {
+            error = ret == -1 ? errno : 0;
+            return false;
+        }
+        // The slot is reused for the next read
+        if(_filter_reports && !_isHidppReport(slot.data(), ret)) {
+            _metrics->add(metrics::Filtered);
+            continue;
+        }
+        _batch.lengths[_batch.count++] = ret;
+    }
+
+    return true;
+}
+
+void RawDevice::_dispatchBatch(steady_clock::time_point ready)
+{
+    _classifyBatch(ready);
+    try {
+        // Handlers reading a response on this thread may take reports too
+        while(_nextBatched(_batch_report)) {
+            latency::begin(_latency, ready);
+            this->_handleReport(_batch_report);
+        }
+    } catch(...) {
+        _batch.count = 0;
+        _batch.current = -1;
+        _batch.taken = 0;
+        throw;
+    }
+}
+
+void RawDevice::setBusyPoll(uint8_t index, microseconds window)
+{
+    std::lock_guard<std::mutex> lock(_busy_poll_lock);
+    if(window.count()) {
+        // Measured here rather than on the I/O thread's first spin
+        busy_poll::wakeupCost();
+        _busy_poll_windows[index] = window;
+    } else {
+        _busy_poll_windows.erase(index);
+    }
+
+    microseconds limit(0);
+    for(auto& entry : _busy_poll_windows)
+        limit = std::max(limit, entry.second);
+    _busy_poll_limit = limit.count();
+}
 
-            // Error; leave to device to handle
-            if(response[2] == 0x8f || response[2] == 0xff)
-                return response;
+void RawDevice::_busyPoll(steady_clock::time_point ready, bool lock_io)
+{
+    microseconds limit(_busy_poll_limit.load(std::memory_order_relaxed));
+    if(limit != _busy_poll.limit())
+        _busy_poll.setLimit(limit);
+    if(!limit.count())
+        return;
+
+    _busy_poll.report(ready);
+    auto window = _busy_poll.window();
+    if(!window.count())
+        return;
+
+    auto start = steady_clock::now();
+    auto deadline = start + window;
+    auto now = start;
+    uint64_t hits = 0;
+    while(now < deadline && (lock_io ? _continue_listen :
+            _reactor_listening)) {
+        int error = 0;
+        bool open;
+        if(lock_io) {
+            std::lock_guard<profiled_mutex> io_lock(_dev_io);
+            open = _drainReports(error);
+        } else {
+            open = _drainReports(error);
+        }
+        now = steady_clock::now();
+        if(_batch.count) {
+            hits++;
+            _busy_poll.report(now);
+            _dispatchBatch(now);
+            now = steady_clock::now();
+            deadline = now + _busy_poll.window();
+        }
+        // The next blocking read sees the failure again and handles it
+        if(!open)
+            break;
+    }
+
+    _metrics->add(metrics::BusyPollNs, duration_cast<nanoseconds>(
+            now - start).count());
+    if(hits) {
+        _metrics->add(metrics::BusyPollHits, hits);
+        _metrics->add(metrics::BusyPollSavedNs,
+                hits * busy_poll::wakeupCost().count());
+    } else {
+        _metrics->add(metrics::BusyPollMisses);
+    }
+}
+
+namespace
+{
+    // Events carry software ID 0, so responses never match
+    uint32_t motionKey(uint8_t index, uint8_t feature_index, uint8_t address)
+    {
+        return (uint32_t)index << 16 | (uint32_t)feature_index << 8 | address;
+    }
+}
 
-            bool others_match = true;
-            for(int i = 2; i < 4; i++)
-                if(response[i] != request[i])
-                    others_match = false;
+void RawDevice::setMotionEvent(uint8_t index, uint8_t feature_index,
+        uint8_t function, bool motion)
+{
+    auto key = motionKey(index, feature_index, (function & 0x0f) << 4);
+    std::lock_guard<std::mutex> lock(_motion_lock);
+    auto current = std::atomic_load(&_motion_events);
+    if(motion == std::binary_search(current->begin(), current->end(), key))
+        return;
+
+    auto keys = std::make_shared<std::vector<uint32_t>>(*current);
+    auto it = std::lower_bound(keys->begin(), keys->end(), key);
+    if(motion)
+        keys->insert(it, key);
+    else
+        keys->erase(it);
+    std::atomic_store(&_motion_events,
+            std::shared_ptr<const std::vector<uint32_t>>(std::move(keys)));
+}
+
+void RawDevice::_classifyBatch(steady_clock::time_point ready)
+{
+    /* Headers are packed first so that the comparisons below run over
+     * plain words, which the compiler vectorizes. At 16 reports a batch
+     * is too small for intrinsics to pay off. Reports too short for a
+     * header or that are not HID++ belong to no device. */
+    std::array<uint32_t, LOGID_REPORT_BATCH_SIZE> headers;
+    std::array<int, LOGID_REPORT_BATCH_SIZE> devices;
+    for(std::size_t i = 0; i < _batch.count; i++) {
+        auto& slot = _batch.slots[i];
+        std::memcpy(&headers[i], slot.data(), sizeof(headers[i]));
+        devices[i] = _batch.lengths[i] >= sizeof(headers[i]) &&
+                _isHidppReport(slot.data(), _batch.lengths[i]) ?
+                slot[hidpp::Offset::DeviceIndex] : -1 - (int)i;
+    }
 
-            if(others_match)
-                return response;
-        } else if(dj::ReportType::Short == request[0] ||
-            dj::ReportType::Long == request[0]) {
-            //Error; leave to device ot handle
-            if(0x7f == response[2])
-                return response;
-            else if(response[2] == request[2])
-                return response;
+    for(std::size_t i = 0; i < _batch.count; i++) {
+        _batch.continued[i] = false;
+        for(std::size_t j = i + 1; j < _batch.count; j++) {
+            if(devices[j] == devices[i]) {
+                _batch.continued[i] = headers[j] == headers[i] &&
+                        _batch.lengths[j] == _batch.lengths[i];
+                break;
+            }
         }
+    }
+
+    auto motion_events = std::atomic_load(&_motion_events);
+    bool any_motion = false;
+    for(std::size_t i = 0; i < _batch.count; i++) {
+        auto& slot = _batch.slots[i];
+        _batch.motion[i] = !motion_events->empty() && devices[i] >= 0 &&
+                std::binary_search(motion_events->begin(),
+                motion_events->end(), motionKey(slot[1], slot[2], slot[3]));
+        any_motion |= _batch.motion[i];
+    }
 
-        if(_continue_listen)
-            this->_handleEvent(response);
+    _batch.ready = ready;
+    _batch.taken = 0;
+    // A full batch means more is waiting in the kernel
+    bool behind = _batch.count == _batch.slots.size() ||
+            (_motion_max_age.count() &&
+             steady_clock::now() - ready > _motion_max_age);
+    if(!any_motion || !behind) {
+        for(std::size_t i = 0; i < _batch.count; i++)
+            _batch.order[i] = i;
+        return;
     }
 
-    return {};
+    /* Events go ahead of motion, except those of a device that already
+     * had motion in the batch, whose order handlers rely on */
+    std::size_t next = 0;
+    std::array<bool, LOGID_REPORT_BATCH_SIZE> deferred{};
+    for(std::size_t i = 0; i < _batch.count; i++) {
+        deferred[i] = _batch.motion[i];
+        for(std::size_t j = 0; j < i && !deferred[i]; j++)
+            deferred[i] = deferred[j] && devices[j] == devices[i];
+        if(!deferred[i])
+            _batch.order[next++] = i;
+    }
+    for(std::size_t i = 0; i < _batch.count; i++)
+        if(deferred[i])
+            _batch.order[next++] = i;
+}
+
+bool RawDevice::_nextBatched(std::vector<uint8_t>& report)
+{
+    while(_batch.taken < _batch.count) {
+        _batch.current = _batch.order[_batch.taken++];
+        auto& slot = _batch.slots[_batch.current];
+        report.assign(slot.begin(),
+                slot.begin() + _batch.lengths[_batch.current]);
+        _traceReport(false, report);
+
+        /* Stale motion is still delivered, dropping it would lose its
+         * delta. Handlers sum it into the event of the same header that
+         * follows and skip the output, which is what falling behind costs.
+         */
+        if(_batch.motion[_batch.current] &&
+           _batch.continued[_batch.current] && _motion_max_age.count() &&
+           steady_clock::now() - _batch.ready > _motion_max_age)
+            _metrics->add(metrics::Shed);
+        return true;
+    }
+
+    _batch.count = 0;
+    _batch.current = -1;
+    _batch.taken = 0;
+    return false;
+}
+
+bool RawDevice::sameReportFollows() const
+{
+    if(!_onIOThread() || _batch.current < 0 ||
+       _batch.current >= (int)_batch.count)
+        return false;
+
+    return _batch.continued[_batch.current];
 }
 
 int RawDevice::_sendReport(const std::vector<uint8_t>& report)
 {
-    std::lock_guard<std::mutex> lock(_dev_io);
-    if(logid::global_loglevel <= LogLevel::RAWREPORT) {
-        printf("[RAWREPORT] %s OUT: ", _path.c_str());
-        for(auto &i : report)
-            printf("%02x ", i);
-        printf("\n");
+    auto& retry = global_config->retrySettings();
+    int error;
+    // Synchronous senders wait for the response anyway, sleep in between
+    for(int i = 0; (error = _writeReport(report)) && _transientError(error) &&
+            i < retry.count; i++) {
+        _metrics->add(metrics::Retries);
+        std::this_thread::sleep_for(backoff::delay(retry, i));
     }
 
+    if(error) {
+        _flight->dump(_path, "Request could not be written");
+        throw std::system_error(error, std::system_category(),
+                "_sendReport write failed");
+    }
+
+    return (int)report.size();
+}
+
+int RawDevice::_writeReport(const std::vector<uint8_t>& report)
+{
+    std::lock_guard<std::mutex> lock(_dev_write);
+    _traceReport(true, report);
+
     assert(supportedReport(report[0], report.size()));
 
-    int ret = ::write(_fd, report.data(), report.size());
-    if(ret == -1) {
-        ///TODO: This seems like a hacky solution
-        // Try again before failing
-        ret = ::write(_fd, report.data(), report.size());
-        if(ret == -1)
-            throw std::system_error(errno, std::system_category(),
-                    "_sendReport write failed");
-    }
+    // Sent along with the reactor's next wait
+    if(_reactorIO() && _reactor->write(_fd, report.data(), report.size()))
+        return 0;
+    if(::write(_fd, report.data(), report.size()) == -1)
+        return errno;
+    return 0;
+}
 
-    return ret;
+bool RawDevice::_transientError(int error)
+{
+    switch(error) {
+    case EINTR:
+    case EAGAIN:
+#if EWOULDBLOCK != EAGAIN
+    case EWOULDBLOCK:
+#endif
+    case EPIPE:
+    case ETIMEDOUT:
+    case ENOBUFS:
+        return true;
+    default:
+        // ENODEV, ENXIO and ESHUTDOWN mean the device is gone
+        return false;
+    }
 }
 
 int RawDevice::_readReport(std::vector<uint8_t> &report,
                            std::size_t maxDataLength)
 {
-    return _readReport(report, maxDataLength, global_config->ioTimeout());
+    return _readReport(report, maxDataLength,
+            steady_clock::time_point::max());
 }
 
 int RawDevice::_readReport(std::vector<uint8_t> &report,
-                           std::size_t maxDataLength, std::chrono::milliseconds timeout)
+                           std::size_t maxDataLength,
+                           steady_clock::time_point deadline)
 {
-    std::lock_guard<std::mutex> lock(_dev_io);
-    int ret;
+    std::lock_guard<profiled_mutex> lock(_dev_io);
+    int ret = 1;
     report.resize(maxDataLength);
 
-    timeval timeout_tv{};
-    timeout_tv.tv_sec = duration_cast<seconds>(global_config->ioTimeout())
-            .count();
-    timeout_tv.tv_usec = duration_cast<microseconds>(
-            global_config->ioTimeout()).count() %
-            duration_cast<microseconds>(seconds(1)).count();
+    // The reactor has reads posted on the fd, they would race with ours
+    bool reactor_read = _reactorIO();
+    if(reactor_read || _pollReport(deadline)) {
+        auto ready = steady_clock::now();
+        if(reactor_read) {
+            ret = _reactor->read(_fd, report.data(), report.size(),
+                    deadline);
+            if(ret == -ETIMEDOUT)
+                throw backend::TimeoutError();
+            ready = steady_clock::now();
+            if(ret < 0) {
+                errno = -ret;
+                ret = -1;
+            }
+        } else {
+            ret = read(_fd, report.data(), report.size());
+        }
+        if(ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            report.clear();
+            return 1;
+        }
+        if(ret == -1)
+            throw std::system_error(errno, std::system_category(),
+                    "_readReport read failed");
+        report.resize(ret);
+        if(_filter_reports && !_isHidppReport(report.data(), ret)) {
+            _metrics->add(metrics::Filtered);
+            report.clear();
+            return 1;
+        }
+        latency::begin(_latency, ready);
+    } else {
+        // Interrupted without a report
+        report.clear();
+    }
+
+    if(0 == ret)
+        throw backend::TimeoutError();
+
+    if(!report.empty())
+        _traceReport(false, report);
+
+    return ret;
+}
 
-    auto timeout_ms = duration_cast<milliseconds>(timeout).count();
+bool RawDevice::_pollReport(steady_clock::time_point deadline)
+{
+    int ret;
+    pollfd fds[2] = {{_fd, POLLIN, 0}, {_pipe[0], POLLIN, 0}};
+    bool bounded = deadline != steady_clock::time_point::max();
 
-    fd_set fds;
+    // The remaining time is recomputed after every signal
     do {
-        FD_ZERO(&fds);
-        FD_SET(_fd, &fds);
-        FD_SET(_pipe[0], &fds);
+        timespec remaining{};
+        if(bounded) {
+            auto left = deadline - steady_clock::now();
+            if(left.count() <= 0)
+                throw backend::TimeoutError();
+            auto secs = duration_cast<seconds>(left);
+            remaining.tv_sec = secs.count();
+            remaining.tv_nsec = duration_cast<nanoseconds>(left - secs)
+                    .count();
+        }
 
-        ret = select(std::max(_fd, _pipe[0]) + 1,
-                     &fds, nullptr, nullptr,
-                     (timeout_ms > 0 ? nullptr : &timeout_tv));
+        ret = ::ppoll(fds, 2, bounded ? &remaining : nullptr, nullptr);
     } while(ret == -1 && errno == EINTR);
 
     if(ret == -1)
         throw std::system_error(errno, std::system_category(),
-                "_readReport select failed");
+                "_readReport poll failed");
 
-    if(FD_ISSET(_fd, &fds)) {
-        ret = read(_fd, report.data(), report.size());
-        if(ret == -1)
-            throw std::system_error(errno, std::system_category(),
-                    "_readReport read failed");
-        report.resize(ret);
-    }
+    if(ret == 0)
+        throw backend::TimeoutError();
 
-    if(FD_ISSET(_pipe[0], &fds)) {
+    if(fds[1].revents) {
         char c;
-        ret = read(_pipe[0], &c, sizeof(char));
-        if(ret == -1)
+        if(-1 == read(_pipe[0], &c, sizeof(char)))
             throw std::system_error(errno, std::system_category(),
                     "_readReport read pipe failed");
     }
 
-    if(0 == ret)
-        throw backend::TimeoutError();
-
-    if(logid::global_loglevel <= LogLevel::RAWREPORT) {
-        printf("[RAWREPORT] %s IN:  ", _path.c_str());
-        for(auto &i : report)
-            printf("%02x ", i);
-        printf("\n");
-    }
-
-    return ret;
+    return fds[0].revents;
 }
 
 void RawDevice::interruptRead(bool wait_for_halt)
 {
+    _metrics->add(metrics::ReadInterrupts);
     char c = 0;
     if(-1 == write(_pipe[1], &c, sizeof(char)))
         throw std::system_error(errno, std::system_category(),
@@ -409,41 +1621,66 @@ void RawDevice::interruptRead(bool wait_for_halt)
 
     // Ensure I/O has halted
     if(wait_for_halt)
-        std::lock_guard<std::mutex> lock(_dev_io);
+        std::lock_guard<profiled_mutex> lock(_dev_io);
 }
 
 void RawDevice::listen()
 {
-    std::lock_guard<std::mutex> lock(_listening);
+    std::lock_guard<profiled_mutex> lock(_listening);
+    _listener_thread = std::this_thread::get_id();
     _continue_listen = true;
     _listen_condition.notify_all();
     while(_continue_listen) {
-        while(!_io_queue.empty()) {
-            auto task = _io_queue.front();
-            (*task)();
-            _io_queue.pop();
+        int error = 0;
+        bool open = true;
+        steady_clock::time_point ready;
+        {
+            std::lock_guard<profiled_mutex> io_lock(_dev_io);
+            if(!_pollReport(steady_clock::time_point::max()))
+                continue;
+            ready = steady_clock::now();
+            open = _drainReports(error);
         }
-        std::vector<uint8_t> report;
-        _readReport(report, MAX_DATA_LENGTH);
-
-        this->_handleEvent(report);
-    }
-
-    // Listener is stopped, handle I/O queue
-    while(!_io_queue.empty()) {
-        auto task = _io_queue.front();
-        (*task)();
-        _io_queue.pop();
+        _dispatchBatch(ready);
+        if(open)
+            _busyPoll(ready, true);
+
+        if(!open && error) {
+            _flight->dump(_path, "Read failed");
+            throw std::system_error(error, std::system_category(),
+                    "listen read failed");
+        }
+        else if(!open)
+            throw backend::TimeoutError();
     }
 
     _continue_listen = false;
+    _listener_thread = std::thread::id();
 }
 
 void RawDevice::listenAsync()
 {
+    if(global_reactors) {
+        if(!_reactor)
+            _reactor = global_reactors->acquire(_path);
+        if(_reactor->completesReads())
+            _reactor->addReads(_fd, [this](const reactor::read_result* reads,
+                    std::size_t count) { _reactorReads(reads, count); });
+        else
+            _reactor->add(_fd, [this]() { _reactorRead(); });
+        _reactor_listening = true;
+        return;
+    }
+
     std::mutex listen_check;
     std::unique_lock<std::mutex> check_lock(listen_check);
-    thread::spawn({[this]() { listen(); }});
+    thread::spawn({[this]() {
+        thread::setName("io:" + _path.substr(_path.rfind('/') + 1), _path);
+        // Requests made by input handlers go first
+        task::setCurrent(task::Interactive);
+        realtime::promote();
+        listen();
+    }});
 
     // Block until RawDevice is listening
     _listen_condition.wait(check_lock, [this](){
@@ -453,6 +1690,12 @@ void RawDevice::listenAsync()
 
 void RawDevice::stopListener()
 {
+    if(_reactor_listening) {
+        _reactor_listening = false;
+        _reactor->remove(_fd);
+        return;
+    }
+
     _continue_listen = false;
     interruptRead();
 }
@@ -460,35 +1703,125 @@ void RawDevice::stopListener()
 void RawDevice::addEventHandler(const std::string& nickname,
         const std::shared_ptr<raw::RawEventHandler>& handler)
 {
-    std::unique_lock<std::mutex> lock(_event_handler_lock);
-    assert(_event_handlers.find(nickname) == _event_handlers.end());
     assert(handler);
-    _event_handlers.emplace(nickname, handler);
+    _updateEventHandlers([&nickname, &handler](EventHandlers& handlers) {
+        assert(handlers.named.find(nickname) == handlers.named.end());
+        handlers.named.emplace(nickname, handler);
+    }, false);
 }
 
 void RawDevice::removeEventHandler(const std::string &nickname)
 {
-    std::unique_lock<std::mutex> lock(_event_handler_lock);
-    _event_handlers.erase(nickname);
+    _updateEventHandlers([&nickname](EventHandlers& handlers) {
+        handlers.named.erase(nickname);
+    }, true);
 }
 
-const std::map<std::string, std::shared_ptr<raw::RawEventHandler>>&
+std::map<std::string, std::shared_ptr<raw::RawEventHandler>>
 RawDevice::eventHandlers()
 {
-    std::unique_lock<std::mutex> lock(_event_handler_lock);
-    return _event_handlers;
+    return std::atomic_load(&_event_handlers)->named;
+}
+
+void RawDevice::addDeviceEventHandler(uint8_t index,
+        const std::function<void(std::vector<uint8_t>&)>& handler)
+{
+    assert(handler);
+    _updateEventHandlers([index, &handler](EventHandlers& handlers) {
+        assert(handlers.devices.find(index) == handlers.devices.end());
+        handlers.devices.emplace(index, handler);
+    }, false);
+}
+
+void RawDevice::removeDeviceEventHandler(uint8_t index)
+{
+    _updateEventHandlers([index](EventHandlers& handlers) {
+        handlers.devices.erase(index);
+    }, true);
+}
+
+bool RawDevice::hasEventHandlers()
+{
+    _metrics->add(metrics::Events);
+    auto handlers = std::atomic_load(&_event_handlers);
+    return !handlers->named.empty() || !handlers->devices.empty();
+}
+
+void RawDevice::_updateEventHandlers(
+        const std::function<void(EventHandlers&)>& update,
+        bool wait_for_readers)
+{
+    {
+        std::lock_guard<profiled_mutex> lock(_event_handler_lock);
+        auto handlers = std::make_shared<EventHandlers>(
+                *std::atomic_load(&_event_handlers));
+        update(*handlers);
+        std::atomic_store(&_event_handlers,
+                std::shared_ptr<const EventHandlers>(std::move(handlers)));
+    }
+
+    /* A removed handler may still be running from the old snapshot,
+     * wait for it to finish unless it is the one removing itself. */
+    if(wait_for_readers && !_onIOThread() && offloaded_device != this)
+        _handler_readers->synchronize();
 }
 
 void RawDevice::_handleEvent(std::vector<uint8_t> &report)
 {
-    std::unique_lock<std::mutex> lock(_event_handler_lock);
-    for(auto& handler : _event_handlers)
+    if(_event_lane && _onIOThread() && _watchdog->stalls() &&
+       (_watchdog->stalled() || (_lane_watchdog &&
+                                 _lane_watchdog->stalled()))) {
+        // Removed handlers are waited for until this ran
+        auto readers = _handler_readers;
+        auto epoch = readers->enter();
+        auto handlers = std::atomic_load(&_event_handlers);
+        auto event = std::make_shared<std::vector<uint8_t>>(report);
+        const void* device = this;
+        _event_lane->post([handlers, event, device, readers, epoch,
+                lane_watchdog=_lane_watchdog]() {
+            watchdog::dispatch::cycle cycle(lane_watchdog.get(),
+                    steady_clock::now());
+            offloaded_device = device;
+            try {
+                _dispatchEvent(*handlers, *event);
+            } catch(...) {
+                offloaded_device = nullptr;
+                readers->leave(epoch);
+                throw;
+            }
+            offloaded_device = nullptr;
+            readers->leave(epoch);
+        });
+        return;
+    }
+
+    read_epoch::guard reading(*_handler_readers);
+    _dispatchEvent(*std::atomic_load(&_event_handlers), report);
+}
+
+void RawDevice::_dispatchEvent(const EventHandlers& handlers,
+        std::vector<uint8_t>& report)
+{
+    alloc::scope scope(alloc::Dispatch);
+    if(report.size() > hidpp::Offset::DeviceIndex &&
+        (report[hidpp::Offset::Type] == hidpp::Report::Type::Short ||
+        report[hidpp::Offset::Type] == hidpp::Report::Type::Long)) {
+        auto device = handlers.devices.find(
+                report[hidpp::Offset::DeviceIndex]);
+        if(device != handlers.devices.end())
+            device->second(report);
+    }
+
+    for(auto& handler : handlers.named)
         if(handler.second->condition(report))
             handler.second->callback(report);
 }
 
 bool RawDevice::isListening()
 {
+    if(_reactor_listening)
+        return true;
+
     bool ret = _listening.try_lock();
 
     if(ret)
@@ -19,41 +19,98 @@
 #ifndef LOGID_BACKEND_RAWDEVICE_H
 #define LOGID_BACKEND_RAWDEVICE_H
 
+#include <array>
 #include <string>
 #include <vector>
 #include <mutex>
 #include <map>
+#include <unordered_map>
 #include <atomic>
+#include <functional>
 #include <future>
 #include <set>
+#include <list>
+#include <deque>
+#include <thread>
+#include <chrono>
 
 #include "defs.h"
-#include "../../util/mutex_queue.h"
+#include "FlightRecorder.h"
+#include "../../util/busy_poll.h"
+#include "../../util/latency.h"
+#include "../../util/metrics.h"
+#include "../../util/profiled_mutex.h"
+#include "../../util/reactor.h"
+#include "../../util/read_epoch.h"
+#include "../../util/task.h"
+#include "../../util/watchdog.h"
+
+// Reports read at once per wakeup, the fd stays readable past that
+#define LOGID_REPORT_BATCH_SIZE 16
+// HID++ long reports, the longest this reads
+#define LOGID_REPORT_SLOT_SIZE 32
+// A request waiting for the window moves up a priority class this often
+#define LOGID_REQUEST_AGING std::chrono::milliseconds(200)
 
 namespace logid {
+    class timer;
+    class strand;
 namespace backend {
 namespace raw
 {
     class RawDevice
     {
     public:
+        typedef std::function<void(const std::vector<uint8_t>&)>
+                ResponseHandler;
+        typedef std::function<void(std::exception&)> ErrorHandler;
+
         static bool supportedReport(uint8_t id, uint8_t length);
 
         explicit RawDevice(std::string path);
+        /* Takes ownership of an fd that already behaves like a hidraw
+         * node, e.g. one end of a SOCK_SEQPACKET socketpair used to
+         * replay or simulate a device. */
+        RawDevice(int fd, std::string path, uint16_t vid, uint16_t pid,
+                std::string name, std::vector<uint8_t> rdesc = {});
         ~RawDevice();
         std::string hidrawPath() const;
 
         std::string name() const;
         uint16_t vendorId() const;
         uint16_t productId() const;
+        // BUS_USB, BUS_BLUETOOTH... 0 for simulated devices
+        uint32_t busType() const;
+        // USB interface number taken from the physical path, -1 if none
+        int interfaceNumber() const;
+        /* Kernel driver bound to the HID device, e.g.
+         * logitech-hidpp-device, empty if unknown. */
+        const std::string& kernelDriver() const;
 
         static std::vector<uint8_t> getReportDescriptor(std::string path);
         static std::vector<uint8_t> getReportDescriptor(int fd);
-        std::vector<uint8_t> reportDescriptor() const;
+        const std::vector<uint8_t>& reportDescriptor() const;
 
         std::vector<uint8_t> sendReport(const std::vector<uint8_t>& report);
+        /* The request completes whether or not the future is waited for,
+         * errors are a TimeoutError or std::system_error. */
+        std::future<std::vector<uint8_t>> sendReportAsync(
+                const std::vector<uint8_t>& report);
+        /* Returns once the request is written, no thread waits for the
+         * response. on_response runs on the I/O thread and must not block,
+         * it may send further async requests. on_error gets a TimeoutError
+         * on a worker once io_timeout has passed. Throws if the request
+         * cannot be written. Without a listener the request is sent
+         * synchronously on a worker instead.
+         */
+        void sendReportAsync(const std::vector<uint8_t>& report,
+                const ResponseHandler& on_response,
+                const ErrorHandler& on_error);
         void sendReportNoResponse(const std::vector<uint8_t>& report);
         void interruptRead(bool wait_for_halt=true);
+        /* Fails every request still waiting for a response with
+         * ECANCELED, so that shutdown does not wait for their timeouts. */
+        void cancelRequests();
 
         void listen();
         void listenAsync();
@@ -63,39 +120,353 @@ namespace raw
         void addEventHandler(const std::string& nickname,
                 const std::shared_ptr<RawEventHandler>& handler);
         void removeEventHandler(const std::string& nickname);
-        const std::map<std::string, std::shared_ptr<RawEventHandler>>&
+        std::map<std::string, std::shared_ptr<RawEventHandler>>
             eventHandlers();
 
+        /* HID++ reports are passed straight to the handler registered for
+         * their device index instead of testing every named handler. */
+        void addDeviceEventHandler(uint8_t index,
+                const std::function<void(std::vector<uint8_t>&)>& handler);
+        void removeDeviceEventHandler(uint8_t index);
+        bool hasEventHandlers();
+
+        /* Whether a later report of the batch being dispatched has the
+         * same header (report ID, device index, feature index and
+         * function) as the current one, with no other report of the same
+         * device index in between. Lets handlers sum the movement of a
+         * device while reports of other devices are interleaved. Always
+         * false off the I/O thread. */
+        bool sameReportFollows() const;
+
+        /* Marks events of a header as motion, such as raw XY or wheel
+         * deltas. When the listener falls behind, other events of the
+         * batch go first, keeping the order of each device. Motion is
+         * never dropped, its handlers sum it into the next event of the
+         * same header while sameReportFollows() and only output the sum.
+         */
+        void setMotionEvent(uint8_t index, uint8_t feature_index,
+                uint8_t function, bool motion);
+
+        /* After a report of any device index, keeps reading without
+         * blocking for up to window, see busy_poll. The node spins for the
+         * longest window any of its device indices asked for, 0 turns it
+         * off for the index. */
+        void setBusyPoll(uint8_t index, std::chrono::microseconds window);
+
+        metrics::counters& stats();
     private:
-        std::mutex _dev_io, _listening;
+        void _init();
+
+        profiled_mutex _dev_io{"RawDevice::_dev_io"};
+        std::mutex _dev_write;
+        profiled_mutex _listening{"RawDevice::_listening"};
         std::string _path;
         int _fd;
         int _pipe[2];
         uint16_t _vid;
         uint16_t _pid;
+        uint32_t _bus = 0;
+        int _interface = -1;
+        std::string _driver;
         std::string _name;
         std::vector<uint8_t> _rdesc;
 
         std::atomic<bool> _continue_listen;
-        std::atomic<bool> _continue_respond;
         std::condition_variable _listen_condition;
+        std::atomic<std::thread::id> _listener_thread;
 
-        std::map<std::string, std::shared_ptr<RawEventHandler>>
-            _event_handlers;
-        std::mutex _event_handler_lock;
+        /* When the I/O reactors are enabled, the fd is owned by the
+         * thread of one reactor shard instead of a listener thread. */
+        std::atomic<bool> _reactor_listening;
+        std::shared_ptr<reactor> _reactor;
+        void _reactorRead();
+        void _reactorClosed(int error);
+        // Reads the reactor made itself if it uses io_uring
+        void _reactorReads(const reactor::read_result* reads,
+                std::size_t count);
+        // Whether the reactor reads and writes for this thread
+        bool _reactorIO() const;
+
+        /* Once the fd is readable, reports are read until it would block
+         * and are then dispatched together. They are read into fixed
+         * slots so that draining does not allocate. Only the I/O thread
+         * touches the batch. */
+        struct ReportBatch
+        {
+            std::array<std::array<uint8_t, LOGID_REPORT_SLOT_SIZE>,
+                    LOGID_REPORT_BATCH_SIZE> slots;
+            std::array<std::size_t, LOGID_REPORT_BATCH_SIZE> lengths;
+            std::size_t count = 0;
+            // The slot being dispatched, -1 outside of a dispatch
+            int current = -1;
+            // Set by _classifyBatch, see sameReportFollows()
+            std::array<bool, LOGID_REPORT_BATCH_SIZE> continued;
+            std::array<bool, LOGID_REPORT_BATCH_SIZE> motion;
+            // Slots in dispatch order, and how many were taken
+            std::array<uint8_t, LOGID_REPORT_BATCH_SIZE> order;
+            std::size_t taken = 0;
+            std::chrono::steady_clock::time_point ready;
+        };
+        ReportBatch _batch;
+        std::vector<uint8_t> _batch_report;
+        /* Reads until the fd would block or the batch is full. False if
+         * the read failed, with errno in error, or 0 at end of file. */
+        bool _drainReports(int& error);
+        void _dispatchBatch(std::chrono::steady_clock::time_point ready);
+        /* Finds the runs of each device once a batch is drained, and the
+         * dispatch order if the listener is behind */
+        void _classifyBatch(std::chrono::steady_clock::time_point ready);
+        // Header keys of motion events, sorted, replaced on every change
+        std::shared_ptr<const std::vector<uint32_t>> _motion_events;
+        std::mutex _motion_lock;
+        std::chrono::milliseconds _motion_max_age;
+        /* Takes the next report of the batch. A response read on the I/O
+         * thread must take reports that were read ahead first. */
+        bool _nextBatched(std::vector<uint8_t>& report);
+
+        /* Reads and dispatches reports until the busy poll window passes
+         * without one. lock_io is set on the listener thread, which holds
+         * _dev_io while reading. */
+        void _busyPoll(std::chrono::steady_clock::time_point ready,
+                bool lock_io);
+        std::mutex _busy_poll_lock;
+        std::map<uint8_t, std::chrono::microseconds> _busy_poll_windows;
+        // The longest window in microseconds, read by the I/O thread
+        std::atomic<int64_t> _busy_poll_limit{0};
+        busy_poll _busy_poll;
+
+        // Null unless latency tracing is enabled
+        std::shared_ptr<latency::stats> _latency;
+        std::shared_ptr<metrics::counters> _metrics;
+
+        /* Counts and logs the report and records it to the binary
+         * capture, if any */
+        void _traceReport(bool out, const std::vector<uint8_t>& report);
+        uint16_t _capture_path;
+        // Dumped when a request times out or fails
+        std::shared_ptr<FlightRecorder> _flight;
+
+        /* Times every dispatch cycle on the I/O thread. Once one stalls,
+         * and if watchdog offload is enabled, events are dispatched on
+         * _event_lane so that responses are still read meanwhile. They
+         * go back to the I/O thread once neither stalled for
+         * LOGID_WATCHDOG_RECOVERY, _lane_watchdog times them meanwhile. */
+        std::shared_ptr<watchdog::dispatch> _watchdog;
+        std::shared_ptr<watchdog::dispatch> _lane_watchdog;
+        std::shared_ptr<strand> _event_lane;
+
+        /* With filter_reports, plain input reports sharing the node are
+         * dropped as they are read, before they are traced or matched. */
+        static bool _isHidppReport(const uint8_t* report, std::size_t length);
+        bool _filter_reports;
+
+        /* While listening, requests are written immediately and every
+         * report read is matched against all outstanding requests, so
+         * several requests may be in flight at once. Requests are pooled
+         * and keep their buffers and wait primitives between uses. */
+        struct PendingReport
+        {
+            enum State
+            {
+                Waiting,
+                Done,
+                TimedOut,
+                Failed      // The request could not be written, see error
+            };
+
+            PendingReport();
+
+            std::vector<uint8_t> request;
+            std::vector<uint8_t> response;
+            /* Gives up at deadline, resends at retry before that. retry and
+             * attempts are only changed under _pending_lock. */
+            std::chrono::steady_clock::time_point sent;
+            std::chrono::steady_clock::time_point retry;
+            std::chrono::steady_clock::time_point deadline;
+            int attempts;
+            rtt_estimator* rtt;
+            int error;
+            std::mutex lock;
+            std::condition_variable done;
+            State state;
+
+            /* Only set for callback requests, guarded by _pending_lock.
+             * sequence tells a late timeout apart from a pooled reuse. */
+            ResponseHandler on_response;
+            ErrorHandler on_error;
+            std::shared_ptr<timer> timeout;
+            uint64_t sequence;
+        };
+        std::mutex _pending_lock;
+        std::vector<std::shared_ptr<PendingReport>> _pending_reports;
+        std::vector<std::shared_ptr<PendingReport>> _request_pool;
+        /* Null if a callback request had to wait for the window, it is
+         * written once let through. admitted is set for those. */
+        std::shared_ptr<PendingReport> _queueRequest(
+                const std::vector<uint8_t>& report,
+                const ResponseHandler& on_response=nullptr,
+                const ErrorHandler& on_error=nullptr, bool admitted=false);
+
+        /* Once request_window requests are in flight, further ones wait
+         * here and are let through by task::current() priority as others
+         * leave _pending_reports. Each LOGID_REQUEST_AGING waited moves a
+         * request up a class, so background work is never starved. Blocked
+         * callers are woken, callback requests are written by whoever
+         * freed the slot. Guarded by _pending_lock.
+         *
+         * The device indices of a receiver share the window. Among
+         * requests of the same class, indices take turns, and an index
+         * holding slot_window requests waits while other indices have
+         * requests in flight or waiting, so that one slow or asleep device
+         * cannot hold the window. */
+        struct WaitingRequest
+        {
+            task::Priority priority;
+            std::chrono::steady_clock::time_point since;
+            uint8_t index;
+            // Set for blocked callers, error is set if they were cancelled
+            bool* admitted;
+            int* error;
+            // Set for callback requests
+            std::vector<uint8_t> report;
+            ResponseHandler on_response;
+            ErrorHandler on_error;
+        };
+        std::deque<WaitingRequest> _waiting;
+        std::atomic<std::size_t> _waiting_count{0};
+        // Let through but not on _pending_reports yet
+        std::size_t _admitted = 0;
+        typedef std::array<uint16_t, 256> SlotLoad;
+        SlotLoad _admitted_slots{};
+        // The index let through last, the others take turns after it
+        uint8_t _last_slot = 0xff;
+        // Requests of each device index in flight or let through
+        void _slotLoad(SlotLoad& load) const;
+        // waiting counts the requests of each index in _waiting
+        bool _slotAdmissible(uint8_t index, const SlotLoad& load,
+                std::size_t total, const SlotLoad& waiting) const;
+        std::condition_variable _window_turn;
+        /* Blocks until the request may be written, or returns false if a
+         * callback request was parked. _pending_lock held. */
+        bool _enterWindow(std::unique_lock<std::mutex>& lock,
+                const std::vector<uint8_t>& report,
+                const ResponseHandler& on_response,
+                const ErrorHandler& on_error);
+        // _waiting.end() if no waiting request is admissible
+        std::deque<WaitingRequest>::iterator _nextWaiting(
+                std::chrono::steady_clock::time_point now,
+                const SlotLoad& load, std::size_t total,
+                const SlotLoad& waiting);
+        // Lets waiting requests through while the window has room
+        void _admitWaiting();
+        std::vector<uint8_t> _waitForResponse(
+                const std::shared_ptr<PendingReport>& pending);
+        /* Schedules another attempt once retry has passed, _pending_lock
+         * held. After the last one, retry is moved to the deadline and
+         * false is returned. */
+        bool _retryRequest(PendingReport& pending,
+                std::chrono::steady_clock::time_point now);
+        // Resends without throwing, a failed resend ends in a timeout
+        void _resendRequest(const std::vector<uint8_t>& request);
+        /* Writes a request again after a transient write error, from the
+         * timer wheel so that no thread sleeps through the backoff. */
+        void _retryWrite(const std::shared_ptr<PendingReport>& pending,
+                uint64_t sequence, int retry);
+        // Takes a request that could not be written off the list
+        void _failRequest(const std::shared_ptr<PendingReport>& pending,
+                uint64_t sequence, int error);
+        /* Late answers to a request that timed out are dropped instead of
+         * passed on as events, _pending_lock held. */
+        void _abandonRequest(PendingReport& pending,
+                std::chrono::steady_clock::time_point now);
+        // Samples the RTT of a request that was answered, _pending_lock held
+        void _requestAnswered(PendingReport& pending,
+                std::chrono::steady_clock::time_point now);
+
+        /* Estimates per device index, shared with the device's metrics.
+         * Indices 0 to 6 have their own, any other index shares the
+         * default index's. */
+        rtt_estimator& _rtt(uint8_t index);
+        std::mutex _rtt_lock;
+        std::array<std::shared_ptr<metrics::device_stats>, 8> _device_stats;
+
+        /* A resent request may be answered more than once. Responses that
+         * arrive after the first are dropped instead of passed on as
+         * events until expiry, guarded by _pending_lock. */
+        struct StrayResponses
+        {
+            std::vector<uint8_t> request;
+            int count;
+            std::chrono::steady_clock::time_point expiry;
+        };
+        std::vector<StrayResponses> _strays;
+        bool _isStray(const std::vector<uint8_t>& report,
+                std::chrono::steady_clock::time_point now);
+        void _releaseRequest(const std::shared_ptr<PendingReport>& pending);
+        static void _completeRequest(PendingReport& pending,
+                PendingReport::State state,
+                const std::vector<uint8_t>* response = nullptr,
+                int error = 0);
+        /* Runs the handlers of a callback request that left the list,
+         * without a response it timed out or failed with error. */
+        void _completeAsync(const std::shared_ptr<PendingReport>& pending,
+                const std::vector<uint8_t>* response, int error = 0);
+        void _expireAsync(const std::shared_ptr<PendingReport>& pending,
+                uint64_t sequence);
+        void _handleReport(std::vector<uint8_t>& report);
+        bool _onIOThread() const;
+
+        /* Handlers are published as an immutable snapshot so that events
+         * are dispatched without a lock. Writers copy the snapshot, modify
+         * it and swap it in under _event_handler_lock. */
+        struct EventHandlers
+        {
+            std::map<std::string, std::shared_ptr<RawEventHandler>> named;
+            std::unordered_map<uint8_t,
+                std::function<void(std::vector<uint8_t>&)>> devices;
+        };
+        std::shared_ptr<const EventHandlers> _event_handlers;
+        profiled_mutex _event_handler_lock{
+            "RawDevice::_event_handler_lock"};
+        /* Dispatches enter before loading the snapshot, shared with
+         * events on _event_lane, which may outlive this */
+        std::shared_ptr<read_epoch> _handler_readers;
+        void _updateEventHandlers(
+                const std::function<void(EventHandlers&)>& update,
+                bool wait_for_readers);
         void _handleEvent(std::vector<uint8_t>& report);
+        static void _dispatchEvent(const EventHandlers& handlers,
+                std::vector<uint8_t>& report);
 
-        /* These will only be used internally and processed with a queue */
+        /* These will only be used internally */
+        // Retries transient errors after a backoff, throws system_error
         int _sendReport(const std::vector<uint8_t>& report);
+        // A single write, returns 0 or errno
+        int _writeReport(const std::vector<uint8_t>& report);
+        /* Errors that may pass, e.g. a full queue or a stalled endpoint,
+         * as opposed to ENODEV once the device is gone. */
+        static bool _transientError(int error);
+        // Blocks until a report is read or the read is interrupted
         int _readReport(std::vector<uint8_t>& report, std::size_t maxDataLength);
+        // Throws TimeoutError if nothing is read before the deadline
         int _readReport(std::vector<uint8_t>& report, std::size_t maxDataLength,
-                std::chrono::milliseconds timeout);
+                std::chrono::steady_clock::time_point deadline);
+        /* Waits until the fd is readable or the read is interrupted, true
+         * in the first case. _dev_io must be held. */
+        bool _pollReport(std::chrono::steady_clock::time_point deadline);
 
+        // Sends a request and reads until it is answered or times out
         std::vector<uint8_t> _respondToReport(const std::vector<uint8_t>&
                 request);
-
-        mutex_queue<std::shared_ptr<std::packaged_task<std::vector<uint8_t>()>>>
-            _io_queue;
+        /* Without a listener, or on the I/O thread, the threads waiting for
+         * a response take turns reading and complete whichever request a
+         * report answers. Returns once pending has left the list. */
+        void _readResponse(const std::shared_ptr<PendingReport>& pending);
+        // Whose turn it is, guarded by _pending_lock
+        bool _reading = false;
+        std::condition_variable _reader_turn;
+        static bool _isResponse(const std::vector<uint8_t>& request,
+                const std::vector<uint8_t>& response);
     };
 }}}
 
@@ -0,0 +1,207 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <condition_variable>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <system_error>
+#include <thread>
+#include "Replay.h"
+#include "RawDevice.h"
+#include "Capture.h"
+#include "../hidpp/Report.h"
+#include "../hidpp/defs.h"
+
+extern "C"
+{
+#include <ctime>
+#include <unistd.h>
+#include <sys/socket.h>
+}
+
+using namespace logid::backend::raw;
+using namespace logid::backend;
+using namespace std::chrono;
+
+namespace
+{
+    nanoseconds cpuTime()
+    {
+        timespec ts{};
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+        return seconds(ts.tv_sec) + nanoseconds(ts.tv_nsec);
+    }
+
+    bool indexedReport(const std::vector<uint8_t>& report)
+    {
+        return report.size() > hidpp::Offset::DeviceIndex &&
+            (report[hidpp::Offset::Type] == hidpp::Report::Type::Short ||
+            report[hidpp::Offset::Type] == hidpp::Report::Type::Long);
+    }
+}
+
+Replay::InvalidCapture::InvalidCapture(const std::string& what) :
+    _what ("Invalid capture: " + what)
+{
+}
+
+const char* Replay::InvalidCapture::what() const noexcept
+{
+    return _what.c_str();
+}
+
+Replay::Replay(const std::string& capture)
+{
+    if(Capture::isCapture(capture)) {
+        try {
+            for(auto& record : Capture::read(capture)) {
+                if(record.direction == Capture::In && !record.data.empty())
+                    _reports.push_back(std::move(record.data));
+            }
+        } catch(Capture::InvalidCapture& e) {
+            throw InvalidCapture(e.what());
+        }
+        if(_reports.empty())
+            throw InvalidCapture(capture + " has no incoming reports");
+        return;
+    }
+
+    std::ifstream file(capture);
+    if(!file)
+        throw InvalidCapture("could not open " + capture);
+
+    // Lines look like "[RAWREPORT] /dev/hidraw0 IN:  10 01 ..."
+    std::string line;
+    while(std::getline(file, line)) {
+        auto tag = line.find("[RAWREPORT]");
+        if(tag == std::string::npos)
+            continue;
+        auto in = line.find(" IN:", tag);
+        if(in == std::string::npos)
+            continue;
+
+        std::istringstream bytes(line.substr(in + 4));
+        std::vector<uint8_t> report;
+        std::string byte;
+        while(bytes >> byte) {
+            char* end;
+            auto value = std::strtoul(byte.c_str(), &end, 16);
+            if(*end || value > 0xff)
+                throw InvalidCapture("bad byte '" + byte + "'");
+            report.push_back(value);
+        }
+
+        if(!report.empty())
+            _reports.push_back(std::move(report));
+    }
+
+    if(_reports.empty())
+        throw InvalidCapture(capture + " has no incoming reports");
+}
+
+std::size_t Replay::size() const
+{
+    return _reports.size();
+}
+
+Replay::Result Replay::run(std::size_t iterations)
+{
+    int sv[2];
+    if(-1 == ::socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv))
+        throw std::system_error(errno, std::system_category(),
+                "Replay socketpair failed");
+
+    auto device = std::make_shared<RawDevice>(sv[0], "replay", 0, 0,
+            "Replay");
+
+    std::mutex handled_lock;
+    std::condition_variable handled_cv;
+    std::size_t handled = 0;
+    const std::size_t total = _reports.size() * iterations;
+    auto count = [&]() {
+        std::lock_guard<std::mutex> lock(handled_lock);
+        if(++handled == total)
+            handled_cv.notify_all();
+    };
+
+    std::set<uint8_t> indices;
+    for(auto& report : _reports)
+        if(indexedReport(report))
+            indices.insert(report[hidpp::Offset::DeviceIndex]);
+
+    // Mirror what hidpp::Device does with every report it receives
+    for(auto index : indices)
+        device->addDeviceEventHandler(index,
+                [&count](std::vector<uint8_t>& report) {
+            try {
+                hidpp::Report r(report);
+                (void)r;
+            } catch(std::exception& e) {
+                // Malformed reports still count as dispatched
+            }
+            count();
+        });
+
+    device->addEventHandler("REPLAY", std::make_shared<RawEventHandler>(
+            RawEventHandler{
+        [](std::vector<uint8_t>& report)->bool {
+            return !indexedReport(report);
+        },
+        [&count](std::vector<uint8_t>& report)->void {
+            (void)report;
+            count();
+        }
+    }));
+
+    device->listenAsync();
+
+    auto start = steady_clock::now();
+    auto cpu_start = cpuTime();
+
+    for(std::size_t i = 0; i < iterations; i++) {
+        for(auto& report : _reports) {
+            if(-1 == ::write(sv[1], report.data(), report.size())) {
+                int err = errno;
+                device->stopListener();
+                ::close(sv[1]);
+                throw std::system_error(err, std::system_category(),
+                        "Replay write failed");
+            }
+        }
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(handled_lock);
+        handled_cv.wait(lock, [&]() { return handled == total; });
+    }
+
+    Result result{};
+    result.reports = total;
+    result.wall_time = steady_clock::now() - start;
+    result.cpu_time = cpuTime() - cpu_start;
+
+    device->stopListener();
+    while(device->isListening())
+        std::this_thread::yield();
+    ::close(sv[1]);
+
+    return result;
+}
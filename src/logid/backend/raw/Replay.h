@@ -0,0 +1,63 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_BACKEND_RAW_REPLAY_H
+#define LOGID_BACKEND_RAW_REPLAY_H
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace logid {
+namespace backend {
+namespace raw
+{
+    /* Replays reports captured at the RAWREPORT log level through the
+     * RawDevice dispatch path, using a socketpair in place of a hidraw
+     * node. Binary captures (see Capture) are also accepted.
+     */
+    class Replay
+    {
+    public:
+        class InvalidCapture : public std::exception
+        {
+        public:
+            explicit InvalidCapture(const std::string& what);
+            const char* what() const noexcept override;
+        private:
+            std::string _what;
+        };
+
+        struct Result
+        {
+            std::size_t reports;
+            std::chrono::nanoseconds wall_time;
+            std::chrono::nanoseconds cpu_time;
+        };
+
+        explicit Replay(const std::string& capture);
+
+        // Number of device -> host reports in the capture
+        std::size_t size() const;
+
+        Result run(std::size_t iterations = 1);
+    private:
+        std::vector<std::vector<uint8_t>> _reports;
+    };
+}}}
+
+#endif //LOGID_BACKEND_RAW_REPLAY_H
@@ -0,0 +1,658 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <system_error>
+#include "SimulatedDevice.h"
+#include "RawDevice.h"
+#include "../hidpp/defs.h"
+#include "../hidpp/Report.h"
+#include "../hidpp10/Error.h"
+#include "../hidpp20/Error.h"
+#include "../hidpp20/feature_defs.h"
+#include "../dj/defs.h"
+
+extern "C"
+{
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/input.h>
+#include <linux/uhid.h>
+}
+
+#define SIMULATED_RECEIVER_PID 0xc52b
+#define SIMULATED_MOUSE_PID 0x4082
+#define SIMULATED_GESTURE_CID 0x00c3
+#define SIMULATED_DEFAULT_DPI 1000
+// How often a uhid responder checks whether it should stop
+#define SIMULATED_UHID_POLL_MS 100
+
+using namespace logid::backend::raw;
+using namespace logid::backend;
+using namespace std::chrono;
+
+namespace
+{
+    // Feature indices of the simulated HID++ 2.0 devices
+    const std::array<uint16_t, 7> features = {
+            hidpp20::FeatureID::ROOT,
+            hidpp20::FeatureID::FEATURE_SET,
+            hidpp20::FeatureID::DEVICE_NAME,
+            hidpp20::FeatureID::ADJUSTABLE_DPI,
+            hidpp20::FeatureID::REPROG_CONTROLS_V4,
+            hidpp20::FeatureID::HIRES_SCROLLING_V2,
+            hidpp20::FeatureID::FW_VERSION
+    };
+    const uint8_t reprog_index = 4;
+
+    enum Register : uint8_t
+    {
+        EnableHidppNotifications = 0x00,
+        ConnectionState = 0x02,
+        PairingInfo = 0xb5
+    };
+
+    // Short and long HID++ collections, as found in hidpp::Report
+    const std::vector<uint8_t> hidpp_rdesc = {
+            0xA1, 0x01, 0x85, 0x10, 0x75, 0x08, 0x95, 0x06, 0x15, 0x00,
+            0x26, 0xFF, 0x00, 0x09, 0x01, 0x81, 0x00, 0x09, 0x01, 0x91,
+            0x00, 0xC0,
+            0xA1, 0x01, 0x85, 0x11, 0x75, 0x08, 0x95, 0x13, 0x15, 0x00,
+            0x26, 0xFF, 0x00, 0x09, 0x02, 0x81, 0x00, 0x09, 0x02, 0x91,
+            0x00, 0xC0
+    };
+
+    // DJ collection, as found in dj::Report
+    const std::vector<uint8_t> dj_rdesc = {
+            0xA1, 0x01, 0x85, 0x20, 0x95, 0x0E, 0x75, 0x08, 0x15, 0x00,
+            0x26, 0xFF, 0x00, 0x09, 0x41, 0x81, 0x00, 0x09, 0x41, 0x91,
+            0x00, 0x85, 0x21, 0x95, 0x1F, 0x09, 0x42, 0x81, 0x00, 0x09,
+            0x42, 0x91, 0x00, 0xC0
+    };
+
+    /* The HID++ collections with vendor usages, which the kernel wants
+     * before it exposes a uhid device */
+    std::vector<uint8_t> uhidRdesc()
+    {
+        const std::size_t short_length = 22;
+        std::vector<uint8_t> rdesc = {0x06, 0x00, 0xFF, 0x09, 0x01};
+        rdesc.insert(rdesc.end(), hidpp_rdesc.begin(),
+                hidpp_rdesc.begin() + short_length);
+        rdesc.insert(rdesc.end(), {0x09, 0x02});
+        rdesc.insert(rdesc.end(), hidpp_rdesc.begin() + short_length,
+                hidpp_rdesc.end());
+        return rdesc;
+    }
+
+    std::vector<uint8_t> shortReport(uint8_t index, uint8_t sub_id,
+            uint8_t address)
+    {
+        std::vector<uint8_t> report(hidpp::Report::HeaderLength +
+                hidpp::ShortParamLength);
+        report[hidpp::Offset::Type] = hidpp::ReportType::Short;
+        report[hidpp::Offset::DeviceIndex] = index;
+        report[hidpp::Offset::SubID] = sub_id;
+        report[hidpp::Offset::Address] = address;
+        return report;
+    }
+
+    std::vector<uint8_t> longReport(uint8_t index, uint8_t sub_id,
+            uint8_t address)
+    {
+        std::vector<uint8_t> report(hidpp::Report::HeaderLength +
+                hidpp::LongParamLength);
+        report[hidpp::Offset::Type] = hidpp::ReportType::Long;
+        report[hidpp::Offset::DeviceIndex] = index;
+        report[hidpp::Offset::SubID] = sub_id;
+        report[hidpp::Offset::Address] = address;
+        return report;
+    }
+}
+
+std::shared_ptr<SimulatedDevice> SimulatedDevice::mouse(
+        const std::string& path, const Config& config)
+{
+    return std::shared_ptr<SimulatedDevice>(
+            new SimulatedDevice(path, false, 1, config));
+}
+
+std::shared_ptr<SimulatedDevice> SimulatedDevice::receiver(
+        const std::string& path, std::size_t paired, const Config& config)
+{
+    return std::shared_ptr<SimulatedDevice>(new SimulatedDevice(path, true,
+            paired > MaxSlots ? MaxSlots : paired, config));
+}
+
+std::shared_ptr<SimulatedDevice> SimulatedDevice::uhid(const Config& config)
+{
+    return std::shared_ptr<SimulatedDevice>(
+            new SimulatedDevice("", false, 1, config, true));
+}
+
+SimulatedDevice::SimulatedDevice(const std::string& path, bool receiver,
+        std::size_t slots, const Config& config, bool uhid) :
+        _config (config), _random (std::random_device()()),
+        _receiver (receiver), _uhid (uhid), _continue_run (true)
+{
+    for(std::size_t i = 0; i < slots; i++)
+        _slots.push_back({SIMULATED_MOUSE_PID, config.name.empty() ?
+            "Simulated Mouse " + std::to_string(i + 1) : config.name,
+            SIMULATED_DEFAULT_DPI, {}, 0});
+
+    if(_uhid) {
+        _createUhid(_slots[0].name);
+        _responder = std::thread([this]() { _run(); });
+        if(_config.event_rate)
+            _events = std::thread([this]() { _generateEvents(); });
+        return;
+    }
+
+    int sv[2];
+    if(-1 == ::socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv))
+        throw std::system_error(errno, std::system_category(),
+                "SimulatedDevice socketpair failed");
+    _peer = sv[1];
+
+    auto rdesc = hidpp_rdesc;
+    if(_receiver)
+        rdesc.insert(rdesc.end(), dj_rdesc.begin(), dj_rdesc.end());
+
+    _raw_device = std::make_shared<RawDevice>(sv[0], path, 0x046d,
+            _receiver ? SIMULATED_RECEIVER_PID : SIMULATED_MOUSE_PID,
+            _receiver ? "Simulated Receiver" : _slots[0].name, rdesc);
+
+    _responder = std::thread([this]() { _run(); });
+    if(_config.event_rate)
+        _events = std::thread([this]() { _generateEvents(); });
+}
+
+SimulatedDevice::~SimulatedDevice()
+{
+    _continue_run = false;
+    // Wakes up the responder's read, uhid responders poll instead
+    if(!_uhid)
+        ::shutdown(_peer, SHUT_RDWR);
+    _responder.join();
+    if(_events.joinable())
+        _events.join();
+
+    if(_uhid) {
+        uhid_event event{};
+        event.type = UHID_DESTROY;
+        (void)::write(_peer, &event, sizeof(event));
+    }
+    ::close(_peer);
+}
+
+void SimulatedDevice::_createUhid(const std::string& name)
+{
+    _peer = ::open("/dev/uhid", O_RDWR | O_CLOEXEC);
+    if(_peer == -1)
+        throw std::system_error(errno, std::system_category(),
+                "SimulatedDevice could not open /dev/uhid");
+
+    auto rdesc = uhidRdesc();
+    uhid_event event{};
+    event.type = UHID_CREATE2;
+    std::strncpy((char*)event.u.create2.name, name.c_str(),
+            sizeof(event.u.create2.name) - 1);
+    event.u.create2.rd_size = rdesc.size();
+    event.u.create2.bus = BUS_USB;
+    event.u.create2.vendor = 0x046d;
+    event.u.create2.product = SIMULATED_MOUSE_PID;
+    std::copy(rdesc.begin(), rdesc.end(), event.u.create2.rd_data);
+
+    if(::write(_peer, &event, sizeof(event)) != sizeof(event)) {
+        int err = errno;
+        ::close(_peer);
+        throw std::system_error(err, std::system_category(),
+                "SimulatedDevice could not create uhid device");
+    }
+}
+
+void SimulatedDevice::pressButton(bool pressed)
+{
+    for(std::size_t i = 0; i < _slots.size(); i++) {
+        uint8_t index = _receiver ? i + 1 :
+            static_cast<uint8_t>(hidpp::DefaultDevice);
+        // Diverted buttons event, the CIDs held down
+        auto report = longReport(index, reprog_index, 0);
+        if(pressed) {
+            report[hidpp::Offset::Parameters] = SIMULATED_GESTURE_CID >> 8;
+            report[hidpp::Offset::Parameters + 1] =
+                    SIMULATED_GESTURE_CID & 0xff;
+        }
+        _send(report);
+    }
+}
+
+void SimulatedDevice::moveRaw(int16_t x, int16_t y)
+{
+    for(std::size_t i = 0; i < _slots.size(); i++) {
+        uint8_t index = _receiver ? i + 1 :
+            static_cast<uint8_t>(hidpp::DefaultDevice);
+        // Diverted raw XY event
+        auto report = longReport(index, reprog_index, 1 << 4);
+        report[hidpp::Offset::Parameters] = x >> 8;
+        report[hidpp::Offset::Parameters + 1] = x & 0xff;
+        report[hidpp::Offset::Parameters + 2] = y >> 8;
+        report[hidpp::Offset::Parameters + 3] = y & 0xff;
+        _send(report);
+    }
+}
+
+std::shared_ptr<RawDevice> SimulatedDevice::rawDevice() const
+{
+    return _raw_device;
+}
+
+void SimulatedDevice::_run()
+{
+    std::vector<uint8_t> buffer;
+    while(_continue_run && _readRequest(buffer)) {
+        if(buffer.empty())
+            continue;
+
+        if(_config.latency.count())
+            std::this_thread::sleep_for(_config.latency);
+        if(_config.drop_rate && _random() % 1000 < _config.drop_rate)
+            continue;
+
+        _handleRequest(buffer);
+    }
+}
+
+bool SimulatedDevice::_readRequest(std::vector<uint8_t>& buffer)
+{
+    buffer.clear();
+    if(!_uhid) {
+        buffer.resize(hidpp::Report::MaxDataLength);
+        auto ret = ::read(_peer, buffer.data(), buffer.size());
+        if(ret == -1 && errno == EINTR) {
+            buffer.clear();
+            return true;
+        }
+        if(ret <= 0)
+            return false;
+        buffer.resize(ret);
+        return true;
+    }
+
+    pollfd fd{_peer, POLLIN, 0};
+    int ret = ::poll(&fd, 1, SIMULATED_UHID_POLL_MS);
+    if(ret == 0 || (ret == -1 && errno == EINTR))
+        return true;
+    if(ret == -1)
+        return false;
+
+    uhid_event event{};
+    if(::read(_peer, &event, sizeof(event)) <= 0)
+        return errno == EINTR;
+    // Writes to the hidraw node, the rest is the kernel opening it
+    if(event.type == UHID_OUTPUT)
+        buffer.assign(event.u.output.data, event.u.output.data +
+                std::min<std::size_t>(event.u.output.size,
+                hidpp::Report::MaxDataLength));
+    return true;
+}
+
+void SimulatedDevice::_generateEvents()
+{
+    auto interval = duration_cast<steady_clock::duration>(
+            duration<double>(1.0 / _config.event_rate));
+    auto next = steady_clock::now();
+
+    while(_continue_run) {
+        next += interval;
+        std::this_thread::sleep_until(next);
+
+        moveRaw(1, -1);
+    }
+}
+
+void SimulatedDevice::_handleRequest(const std::vector<uint8_t>& request)
+{
+    // DJ commands are not simulated
+    if(request.size() <= hidpp::Offset::Parameters ||
+       (request[0] != hidpp::ReportType::Short &&
+        request[0] != hidpp::ReportType::Long))
+        return;
+
+    uint8_t index = request[hidpp::Offset::DeviceIndex];
+    if(!_receiver) {
+        if(index == hidpp::DefaultDevice || index == hidpp::CordedDevice)
+            _handleDevice(_slots[0], request);
+        else
+            _sendError10(request, hidpp10::Error::UnknownDevice);
+    } else if(index == hidpp::DefaultDevice) {
+        _handleReceiver(request);
+    } else if(index >= 1 && index <= _slots.size() && _asleep(index - 1)) {
+        // What receivers answer for a device that is out of reach
+        _sendError10(request, hidpp10::Error::ResourceError);
+    } else if(index >= 1 && index <= _slots.size()) {
+        _handleDevice(_slots[index - 1], request);
+    } else {
+        _sendError10(request, hidpp10::Error::UnknownDevice);
+    }
+}
+
+void SimulatedDevice::_handleReceiver(const std::vector<uint8_t>& request)
+{
+    uint8_t sub_id = request[hidpp::Offset::SubID];
+    uint8_t address = request[hidpp::Offset::Address];
+    std::array<uint8_t, hidpp::LongParamLength> params{};
+    std::copy(request.begin() + hidpp::Offset::Parameters, request.end(),
+            params.begin());
+
+    switch(sub_id) {
+    case 0x80: // Set short register
+        if(address == EnableHidppNotifications) {
+            std::copy(params.begin(), params.begin() + 3,
+                    _notifications.begin());
+            _send(shortReport(hidpp::DefaultDevice, sub_id, address));
+        } else if(address == ConnectionState) {
+            _send(shortReport(hidpp::DefaultDevice, sub_id, address));
+            if(params[0] & 2)
+                _sendConnections();
+        } else {
+            _sendError10(request, hidpp10::Error::InvalidAddress);
+        }
+        return;
+    case 0x81: { // Get short register
+        auto response = shortReport(hidpp::DefaultDevice, sub_id, address);
+        if(address == EnableHidppNotifications) {
+            std::copy(_notifications.begin(), _notifications.end(),
+                    response.begin() + hidpp::Offset::Parameters);
+        } else if(address == ConnectionState) {
+            response[hidpp::Offset::Parameters + 1] = _slots.size();
+        } else {
+            _sendError10(request, hidpp10::Error::InvalidAddress);
+            return;
+        }
+        _send(response);
+        return;
+    }
+    case 0x83: { // Get long register
+        uint8_t index = params[0] & 0x0f;
+        if(address != PairingInfo || index < 1 || index > MaxSlots) {
+            _sendError10(request, hidpp10::Error::InvalidAddress);
+            return;
+        }
+        if(index > _slots.size()) {
+            _sendError10(request, hidpp10::Error::InvalidValue);
+            return;
+        }
+
+        auto& slot = _slots[index - 1];
+        auto response = longReport(hidpp::DefaultDevice, sub_id, address);
+        auto out = response.begin() + hidpp::Offset::Parameters;
+        out[0] = params[0];
+        switch(params[0] & 0xf0) {
+        case 0x20: // Pairing info
+            out[1] = index;
+            out[2] = 8; // Report interval (ms)
+            out[3] = slot.pid >> 8;
+            out[4] = slot.pid & 0xff;
+            out[7] = dj::DeviceType::Mouse;
+            break;
+        case 0x30: // Extended pairing info, serial is only the index
+            out[1] = index;
+            break;
+        case 0x40: { // Device name
+            auto length = std::min<std::size_t>(slot.name.size(),
+                    hidpp::LongParamLength - 2);
+            out[1] = length;
+            std::copy(slot.name.begin(), slot.name.begin() + length,
+                    out + 2);
+            break;
+        }
+        default:
+            _sendError10(request, hidpp10::Error::InvalidValue);
+            return;
+        }
+        _send(response);
+        return;
+    }
+    default:
+        // Includes HID++ 2.0 pings, receivers only speak HID++ 1.0
+        _sendError10(request, hidpp10::Error::InvalidSubID);
+    }
+}
+
+void SimulatedDevice::_handleDevice(Slot& slot,
+        const std::vector<uint8_t>& request)
+{
+    uint8_t feature_index = request[hidpp::Offset::Feature];
+    uint8_t function = request[hidpp::Offset::Function] >> 4;
+    std::array<uint8_t, hidpp::LongParamLength> params{};
+    std::copy(request.begin() + hidpp::Offset::Parameters, request.end(),
+            params.begin());
+
+    if(feature_index >= features.size()) {
+        _sendError20(request, hidpp20::Error::InvalidFeatureIndex);
+        return;
+    }
+
+    auto response = longReport(request[hidpp::Offset::DeviceIndex],
+            feature_index, request[hidpp::Offset::Function]);
+    auto out = response.begin() + hidpp::Offset::Parameters;
+
+    switch(features[feature_index]) {
+    case hidpp20::FeatureID::ROOT:
+        if(function == 0) { // GetFeature
+            uint16_t id = (params[0] << 8) | params[1];
+            auto it = std::find(features.begin(), features.end(), id);
+            out[0] = it == features.end() ? 0 : it - features.begin();
+        } else if(function == 1) { // Ping
+            out[0] = 4;
+            out[1] = 5;
+            out[2] = params[2];
+        } else {
+            _sendError20(request, hidpp20::Error::InvalidFunctionID);
+            return;
+        }
+        break;
+    case hidpp20::FeatureID::FEATURE_SET:
+        if(function == 0) { // GetFeatureCount, excluding root
+            out[0] = features.size() - 1;
+        } else if(function == 1 && params[0] < features.size()) {
+            out[0] = features[params[0]] >> 8;
+            out[1] = features[params[0]] & 0xff;
+        } else {
+            _sendError20(request, hidpp20::Error::InvalidArgument);
+            return;
+        }
+        break;
+    case hidpp20::FeatureID::DEVICE_NAME:
+        if(function == 0) {
+            out[0] = slot.name.size();
+        } else if(function == 1) {
+            for(std::size_t i = 0; i < hidpp::LongParamLength &&
+                    params[0] + i < slot.name.size(); i++)
+                out[i] = slot.name[params[0] + i];
+        } else {
+            _sendError20(request, hidpp20::Error::InvalidFunctionID);
+            return;
+        }
+        break;
+    case hidpp20::FeatureID::ADJUSTABLE_DPI:
+        switch(function) {
+        case 0: // GetSensorCount
+            out[0] = 1;
+            break;
+        case 1: // GetSensorDPIList, 200-8000 in steps of 50
+            out[0] = params[0];
+            out[1] = 0x00; out[2] = 0xc8;
+            out[3] = 0xe0; out[4] = 0x32;
+            out[5] = 0x1f; out[6] = 0x40;
+            break;
+        case 2: // GetSensorDPI
+            out[0] = params[0];
+            out[1] = slot.dpi >> 8;
+            out[2] = slot.dpi & 0xff;
+            out[3] = SIMULATED_DEFAULT_DPI >> 8;
+            out[4] = SIMULATED_DEFAULT_DPI & 0xff;
+            break;
+        case 3: // SetSensorDPI
+            slot.dpi = (params[1] << 8) | params[2];
+            std::copy(params.begin(), params.begin() + 3, out);
+            break;
+        default:
+            _sendError20(request, hidpp20::Error::InvalidFunctionID);
+            return;
+        }
+        break;
+    case hidpp20::FeatureID::REPROG_CONTROLS_V4: {
+        uint16_t cid = (params[0] << 8) | params[1];
+        switch(function) {
+        case 0: // GetControlCount
+            out[0] = 1;
+            break;
+        case 1: // GetControlInfo
+            if(params[0] != 0) {
+                _sendError20(request, hidpp20::Error::InvalidArgument);
+                return;
+            }
+            out[0] = SIMULATED_GESTURE_CID >> 8;
+            out[1] = SIMULATED_GESTURE_CID & 0xff;
+            out[2] = 0x00; out[3] = 0xd7;
+            out[4] = (1 << 0) | (1 << 4) | (1 << 5); // Divertable button
+            out[8] = 1 << 0; // RawXY
+            break;
+        case 2: // GetControlReporting
+            std::copy(params.begin(), params.begin() + 2, out);
+            out[2] = slot.reporting[cid];
+            break;
+        case 3: { // SetControlReporting, apply the changed divert bits
+            auto& flags = slot.reporting[cid];
+            for(int bit = 0; bit < 6; bit += 2)
+                if(params[2] & (1 << (bit + 1)))
+                    flags = (flags & ~(1 << bit)) | (params[2] & (1 << bit));
+            std::copy(params.begin(), params.begin() + 5, out);
+            break;
+        }
+        default:
+            _sendError20(request, hidpp20::Error::InvalidFunctionID);
+            return;
+        }
+        break;
+    }
+    case hidpp20::FeatureID::HIRES_SCROLLING_V2:
+        switch(function) {
+        case 0: // GetCapabilities, 8 steps per ratchet, has a ratchet
+            out[0] = 8;
+            out[1] = 1 << 2;
+            break;
+        case 1: // GetMode
+            out[0] = slot.wheel_mode;
+            break;
+        case 2: // SetMode
+            slot.wheel_mode = params[0];
+            out[0] = params[0];
+            break;
+        case 3: // GetRatchetState, ratcheted
+            out[0] = 1;
+            break;
+        default:
+            _sendError20(request, hidpp20::Error::InvalidFunctionID);
+            return;
+        }
+        break;
+    case hidpp20::FeatureID::FW_VERSION:
+        switch(function) {
+        case 0: // GetEntityCount
+            out[0] = 1;
+            break;
+        case 1: // GetFwInfo, main application RQM 12.01 build 0017
+            if(params[0] != 0) {
+                _sendError20(request, hidpp20::Error::InvalidArgument);
+                return;
+            }
+            out[0] = 0;
+            out[1] = 'R'; out[2] = 'Q'; out[3] = 'M';
+            out[4] = 0x12; out[5] = 0x01;
+            out[6] = 0x00; out[7] = 0x17;
+            break;
+        default:
+            _sendError20(request, hidpp20::Error::InvalidFunctionID);
+            return;
+        }
+        break;
+    default:
+        _sendError20(request, hidpp20::Error::Unsupported);
+        return;
+    }
+
+    _send(response);
+}
+
+void SimulatedDevice::_sendConnections()
+{
+    for(std::size_t i = 0; i < _slots.size(); i++) {
+        // Unifying link, established unless the device sleeps
+        auto report = shortReport(i + 1, 0x41, 0x04);
+        auto params = report.begin() + hidpp::Offset::Parameters;
+        params[0] = dj::DeviceType::Mouse | (_asleep(i) ? 1 << 6 : 0);
+        params[1] = _slots[i].pid & 0xff;
+        params[2] = _slots[i].pid >> 8;
+        _send(report);
+    }
+}
+
+bool SimulatedDevice::_asleep(std::size_t slot) const
+{
+    return _receiver && slot + _config.asleep >= _slots.size();
+}
+
+void SimulatedDevice::_send(const std::vector<uint8_t>& report)
+{
+    std::lock_guard<std::mutex> lock(_write_lock);
+    if(_uhid) {
+        uhid_event event{};
+        event.type = UHID_INPUT2;
+        event.u.input2.size = report.size();
+        std::copy(report.begin(), report.end(), event.u.input2.data);
+        (void)::write(_peer, &event, sizeof(event));
+        return;
+    }
+    // The reader may be gone during teardown, that is not an error
+    (void)::send(_peer, report.data(), report.size(), MSG_NOSIGNAL);
+}
+
+void SimulatedDevice::_sendError10(const std::vector<uint8_t>& request,
+        uint8_t code)
+{
+    auto report = shortReport(request[hidpp::Offset::DeviceIndex],
+            hidpp10::ErrorID, request[hidpp::Offset::SubID]);
+    report[hidpp::Offset::Parameters] = request[hidpp::Offset::Address];
+    report[hidpp::Offset::Parameters + 1] = code;
+    _send(report);
+}
+
+void SimulatedDevice::_sendError20(const std::vector<uint8_t>& request,
+        uint8_t code)
+{
+    auto report = longReport(request[hidpp::Offset::DeviceIndex],
+            hidpp20::ErrorID, request[hidpp::Offset::Feature]);
+    report[hidpp::Offset::Parameters] = request[hidpp::Offset::Function];
+    report[hidpp::Offset::Parameters + 1] = code;
+    _send(report);
+}
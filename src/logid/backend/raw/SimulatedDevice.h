@@ -0,0 +1,125 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_BACKEND_RAW_SIMULATEDDEVICE_H
+#define LOGID_BACKEND_RAW_SIMULATEDDEVICE_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace logid {
+namespace backend {
+namespace raw
+{
+    class RawDevice;
+
+    /* An in-process device on the other end of a socketpair. It answers
+     * enough HID++ 1.0/2.0 to be initialized by logid, either as a corded
+     * HID++ 2.0 mouse or as a receiver with paired mice.
+     */
+    class SimulatedDevice
+    {
+    public:
+        struct Config
+        {
+            // Delay before every response
+            std::chrono::microseconds latency{0};
+            // Diverted raw XY events sent per second by each mouse
+            unsigned int event_rate = 0;
+            // Paired devices, counted from the last slot, whose link is down
+            std::size_t asleep = 0;
+            // Requests per thousand that are never answered
+            unsigned int drop_rate = 0;
+            // Name of every mouse, "Simulated Mouse <n>" if empty
+            std::string name;
+        };
+
+        static std::shared_ptr<SimulatedDevice> mouse(const std::string& path,
+                const Config& config);
+        static std::shared_ptr<SimulatedDevice> receiver(
+                const std::string& path, std::size_t paired,
+                const Config& config);
+        /* A corded mouse created through /dev/uhid, which the kernel
+         * exposes as a hidraw node that is found like a real device.
+         * There is no RawDevice on this side, rawDevice() is null. */
+        static std::shared_ptr<SimulatedDevice> uhid(const Config& config);
+
+        ~SimulatedDevice();
+
+        std::shared_ptr<RawDevice> rawDevice() const;
+
+        // Diverted events of the gesture button on every device
+        void pressButton(bool pressed);
+        void moveRaw(int16_t x, int16_t y);
+
+        static constexpr std::size_t MaxSlots = 6;
+    private:
+        struct Slot
+        {
+            uint16_t pid;
+            std::string name;
+            uint16_t dpi;
+            std::map<uint16_t, uint8_t> reporting;
+            uint8_t wheel_mode;
+        };
+
+        SimulatedDevice(const std::string& path, bool receiver,
+                std::size_t slots, const Config& config, bool uhid = false);
+        void _createUhid(const std::string& name);
+        // False once the responder should stop
+        bool _readRequest(std::vector<uint8_t>& buffer);
+
+        void _run();
+        void _generateEvents();
+
+        void _handleRequest(const std::vector<uint8_t>& request);
+        void _handleReceiver(const std::vector<uint8_t>& request);
+        void _handleDevice(Slot& slot, const std::vector<uint8_t>& request);
+        void _sendConnections();
+        bool _asleep(std::size_t slot) const;
+
+        void _send(const std::vector<uint8_t>& report);
+        void _sendError10(const std::vector<uint8_t>& request, uint8_t code);
+        void _sendError20(const std::vector<uint8_t>& request, uint8_t code);
+
+        Config _config;
+        std::minstd_rand _random;
+        bool _receiver;
+        std::vector<Slot> _slots;
+        std::array<uint8_t, 3> _notifications{};
+
+        bool _uhid;
+        // The socketpair end, or /dev/uhid
+        int _peer;
+        std::mutex _write_lock;
+        std::shared_ptr<RawDevice> _raw_device;
+
+        std::atomic<bool> _continue_run;
+        std::thread _responder;
+        std::thread _events;
+    };
+}}}
+
+#endif //LOGID_BACKEND_RAW_SIMULATEDDEVICE_H
@@ -0,0 +1,118 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <system_error>
+#include <libconfig.h++>
+#include "bench.h"
+#include "../Device.h"
+#include "../InputDevice.h"
+#include "../actions/GestureAction.h"
+#include "../actions/gesture/AxisGesture.h"
+#include "../backend/raw/SimulatedDevice.h"
+
+#define LOGID_BENCH_INPUT_NAME "LogiOps Benchmark Input"
+#define LOGID_BENCH_MOVES 1000000
+
+using namespace logid;
+using namespace logid::actions;
+using namespace logid::backend;
+
+namespace
+{
+    const char* GestureConfig = R"(
+gestures: {
+    gestures: (
+        { direction: "Up"; mode: "NoPress"; },
+        { direction: "Down"; mode: "NoPress"; },
+        { direction: "Left"; mode: "NoPress"; },
+        { direction: "Right"; mode: "NoPress"; }
+    );
+};
+axis: {
+    mode: "Axis";
+    axis: "REL_WHEEL_HI_RES";
+    axis_multiplier: 2.5;
+};
+)";
+
+    // Small moves that keep crossing the origin, like a jittery swipe
+    const int16_t Moves[][2] = {{3, -2}, {-5, 1}, {4, 3}, {-2, -2}};
+
+    void gestureMove(Device* device, libconfig::Setting& setting)
+    {
+        GestureAction action(device, setting);
+        action.press();
+        std::size_t i = 0;
+        bench::run("gesture/move", LOGID_BENCH_MOVES, [&]() {
+            auto& move = Moves[i++ % 4];
+            action.move(move[0], move[1]);
+        }, 0);
+        action.release();
+    }
+
+    void axisMove(Device* device, libconfig::Setting& setting)
+    {
+        const std::string name = "gesture/axis_move";
+        if(!bench::enabled(name))
+            return;
+
+        if(!virtual_input) {
+            bench::skip(name, "no uinput device");
+            return;
+        }
+
+        AxisGesture gesture(device, setting);
+        gesture.press();
+        // Each move is framed the way RemapButton frames a diverted event
+        bench::run(name, LOGID_BENCH_MOVES, [&]() {
+            InputDevice::Frame frame(*virtual_input);
+            gesture.move(7);
+        }, 0);
+        gesture.release();
+    }
+}
+
+void bench::actions()
+{
+    if(!bench::enabled("gesture"))
+        return;
+
+    try {
+        virtual_input = std::make_unique<InputDevice>(LOGID_BENCH_INPUT_NAME,
+                std::set<uint>(),
+                std::set<uint>{InputDevice::toAxisCode("REL_WHEEL_HI_RES")});
+    } catch(std::exception& e) {
+        // AxisGesture is skipped, GestureAction does not write input
+        virtual_input.reset();
+    }
+
+    libconfig::Config config;
+    config.readString(GestureConfig);
+
+    raw::SimulatedDevice::Config sim_config{};
+    auto sim = raw::SimulatedDevice::mouse("bench-gesture", sim_config);
+    try {
+        Device device(sim->rawDevice(), hidpp::DefaultDevice);
+        gestureMove(&device, config.lookup("gestures"));
+        axisMove(&device, config.lookup("axis"));
+    } catch(std::exception& e) {
+        bench::skip("gesture", e.what());
+    }
+
+    virtual_input.reset();
+}
@@ -0,0 +1,174 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <condition_variable>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include "bench.h"
+#include "../backend/hidpp/Report.h"
+#include "../backend/raw/RawDevice.h"
+#include "../backend/raw/SimulatedDevice.h"
+
+extern "C"
+{
+#include <unistd.h>
+#include <sys/socket.h>
+}
+
+#define LOGID_BENCH_REPORTS 1000000
+#define LOGID_BENCH_DESCRIPTORS 100000
+#define LOGID_BENCH_DISPATCHED 200000
+
+using namespace logid;
+using namespace logid::backend;
+using namespace std::chrono;
+
+namespace
+{
+    void reports()
+    {
+        bench::run("report/build_short", LOGID_BENCH_REPORTS, []() {
+            hidpp::Report report(hidpp::Report::Type::Short,
+                    hidpp::DefaultDevice, 0x01, 0x01, 0x01);
+            bench::keep(report);
+        }, 0);
+
+        bench::run("report/build_long", LOGID_BENCH_REPORTS, []() {
+            hidpp::Report report(hidpp::Report::Type::Long,
+                    hidpp::WirelessDevice1, 0x05, 0x02, 0x01);
+            bench::keep(report);
+        }, 0);
+
+        const std::vector<uint8_t> event = {0x11, 0x01, 0x05, 0x00, 0x00,
+                0xc3, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                0x00, 0x00, 0x00, 0x00, 0x00};
+        bench::run("report/parse_long", LOGID_BENCH_REPORTS, [&event]() {
+            hidpp::Report report(event);
+            bench::keep(report);
+        }, 0);
+
+        bench::run("report/raw_long", LOGID_BENCH_REPORTS, [&event]() {
+            hidpp::Report report(event);
+            auto raw = report.rawReport();
+            bench::keep(raw);
+        });
+    }
+
+    void supportedReports()
+    {
+        if(!bench::enabled("supported_reports"))
+            return;
+
+        raw::SimulatedDevice::Config config{};
+        auto mouse = raw::SimulatedDevice::mouse("bench-mouse", config);
+        auto receiver = raw::SimulatedDevice::receiver("bench-receiver", 1,
+                config);
+        const auto& mouse_rdesc = mouse->rawDevice()->reportDescriptor();
+        const auto& receiver_rdesc =
+                receiver->rawDevice()->reportDescriptor();
+
+        bench::run("supported_reports/scan_mouse", LOGID_BENCH_DESCRIPTORS,
+                [&mouse_rdesc]() {
+            bench::keep(hidpp::getSupportedReports(mouse_rdesc));
+        });
+
+        bench::run("supported_reports/scan_receiver",
+                LOGID_BENCH_DESCRIPTORS, [&receiver_rdesc]() {
+            bench::keep(hidpp::getSupportedReports(receiver_rdesc));
+        });
+
+        bench::run("supported_reports/memoized", LOGID_BENCH_DESCRIPTORS,
+                [&receiver_rdesc]() {
+            bench::keep(hidpp::getSupportedReports(0x046d, 0xc52b,
+                    receiver_rdesc));
+        });
+    }
+
+    /* _handleEvent is private, so events are written into a socket the
+     * device listens on the same way Replay does. This includes the read
+     * but not the hidraw driver.
+     */
+    void dispatch()
+    {
+        const std::string name = "raw_device/dispatch";
+        if(!bench::enabled(name))
+            return;
+
+        int sv[2];
+        if(-1 == ::socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv)) {
+            bench::skip(name, std::system_error(errno,
+                    std::system_category()).what());
+            return;
+        }
+
+        auto device = std::make_shared<raw::RawDevice>(sv[0], "bench", 0, 0,
+                "Benchmark");
+
+        std::mutex handled_lock;
+        std::condition_variable handled_cv;
+        std::size_t handled = 0, expected = 0;
+        device->addDeviceEventHandler(hidpp::WirelessDevice1,
+                [&](std::vector<uint8_t>& report) {
+            hidpp::Report r(report);
+            bench::keep(r);
+            std::lock_guard<std::mutex> lock(handled_lock);
+            if(++handled == expected)
+                handled_cv.notify_all();
+        });
+        device->listenAsync();
+
+        const std::vector<uint8_t> event = {0x10, 0x01, 0x05, 0x00, 0x00,
+                0xc3, 0x00};
+        auto send = [&](std::size_t count) {
+            {
+                std::lock_guard<std::mutex> lock(handled_lock);
+                handled = 0;
+                expected = count;
+            }
+            for(std::size_t i = 0; i < count; i++)
+                if(-1 == ::write(sv[1], event.data(), event.size()))
+                    return false;
+            std::unique_lock<std::mutex> lock(handled_lock);
+            handled_cv.wait(lock, [&]() { return handled == expected; });
+            return true;
+        };
+
+        bool sent = send(LOGID_BENCH_DISPATCHED / 10);
+        auto start = steady_clock::now();
+        sent = sent && send(LOGID_BENCH_DISPATCHED);
+        auto elapsed = steady_clock::now() - start;
+
+        device->stopListener();
+        while(device->isListening())
+            std::this_thread::yield();
+        ::close(sv[1]);
+
+        if(sent)
+            bench::report(name, LOGID_BENCH_DISPATCHED, elapsed);
+        else
+            bench::skip(name, "write failed");
+    }
+}
+
+void bench::backend()
+{
+    reports();
+    supportedReports();
+    dispatch();
+}
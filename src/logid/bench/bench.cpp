@@ -0,0 +1,136 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "bench.h"
+#include "../Configuration.h"
+#include "../util/log.h"
+#include "../util/workqueue.h"
+
+using namespace logid;
+
+namespace
+{
+    std::vector<std::string> filters;
+    bool over_budget = false;
+
+    std::string escape(const std::string& str)
+    {
+        std::string ret;
+        for(char c : str) {
+            if(c == '"' || c == '\\')
+                ret += '\\';
+            if(c >= 0x20)
+                ret += c;
+        }
+        return ret;
+    }
+}
+
+void bench::setFilters(std::vector<std::string> names)
+{
+    filters = std::move(names);
+}
+
+bool bench::enabled(const std::string& name)
+{
+    if(filters.empty())
+        return true;
+    for(auto& filter : filters)
+        if(name.compare(0, filter.size(), filter) == 0)
+            return true;
+    return false;
+}
+
+void bench::report(const std::string& name, uint64_t iterations,
+        std::chrono::nanoseconds elapsed,
+        const std::vector<std::pair<std::string, uint64_t>>& extra)
+{
+    double per_op = iterations ? (double)elapsed.count() / iterations : 0;
+    std::printf("{\"name\":\"%s\",\"iterations\":%llu,\"ns_total\":%lld,"
+                "\"ns_per_op\":%.2f", escape(name).c_str(),
+                (unsigned long long)iterations, (long long)elapsed.count(),
+                per_op);
+    for(auto& field : extra)
+        std::printf(",\"%s\":%llu", escape(field.first).c_str(),
+                (unsigned long long)field.second);
+    std::printf("}\n");
+    std::fflush(stdout);
+}
+
+void bench::skip(const std::string& name, const std::string& reason)
+{
+    std::printf("{\"name\":\"%s\",\"skipped\":\"%s\"}\n",
+            escape(name).c_str(), escape(reason).c_str());
+    std::fflush(stdout);
+}
+
+void bench::overBudget(const std::string& name, uint64_t allocations,
+        uint64_t iterations)
+{
+    std::printf("{\"name\":\"%s\",\"over_budget\":true,"
+                "\"allocations\":%llu,\"iterations\":%llu}\n",
+                escape(name).c_str(), (unsigned long long)allocations,
+                (unsigned long long)iterations);
+    std::fflush(stdout);
+    over_budget = true;
+}
+
+bool bench::failed()
+{
+    return over_budget;
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<std::string> names;
+    for(int i = 1; i < argc; i++) {
+        if(!std::strcmp(argv[i], "-h") || !std::strcmp(argv[i], "--help")) {
+            std::printf("Usage: %s [name prefix...]\n"
+                        "Prints one JSON object per benchmark on stdout.\n"
+                        "LOGID_BENCH_STARTUP adds a startup/custom topology,"
+                        " see bench/startup.cpp.\n"
+                        "Exits with failure if a benchmark allocated more "
+                        "than its budget,\nonly checked when built with "
+                        "LOGID_ALLOC_TRACKING.\n",
+                        argv[0]);
+            return EXIT_SUCCESS;
+        }
+        names.emplace_back(argv[i]);
+    }
+    bench::setFilters(std::move(names));
+
+    // Device setup logs at INFO, which would drown out the results
+    global_loglevel = WARN;
+    global_config = std::make_shared<Configuration>();
+    global_workqueue = std::make_shared<workqueue>(
+            global_config->workerCount());
+
+    bench::backend();
+    bench::util();
+    bench::actions();
+    bench::events();
+    bench::startup();
+    bench::config();
+    bench::idle();
+
+    global_workqueue.reset();
+    return bench::failed() ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_BENCH_BENCH_H
+#define LOGID_BENCH_BENCH_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "../util/alloc.h"
+
+namespace logid {
+namespace bench
+{
+    /* Results are printed as one JSON object per line so that runs from
+     * different releases can be compared by a script.
+     */
+    void setFilters(std::vector<std::string> filters);
+    // True if no filters were given or name starts with one of them
+    bool enabled(const std::string& name);
+
+    // extra fields are appended to the object as integers
+    void report(const std::string& name, uint64_t iterations,
+            std::chrono::nanoseconds elapsed,
+            const std::vector<std::pair<std::string, uint64_t>>& extra = {});
+    void skip(const std::string& name, const std::string& reason);
+
+    constexpr uint64_t NoBudget = UINT64_MAX;
+    /* Reports a benchmark that allocated more than its budget allows and
+     * makes the run exit with failure, see failed(). */
+    void overBudget(const std::string& name, uint64_t allocations,
+            uint64_t iterations);
+    bool failed();
+
+    // A field of /proc/self/status in the unit it is listed in, 0 if absent
+    inline uint64_t status(const std::string& field)
+    {
+        std::ifstream file("/proc/self/status");
+        std::string line;
+        while(std::getline(file, line)) {
+            if(line.compare(0, field.size(), field) == 0 &&
+               line.size() > field.size() && line[field.size()] == ':')
+                return std::strtoull(line.c_str() + field.size() + 1,
+                        nullptr, 10);
+        }
+        return 0;
+    }
+
+    // Stops the compiler from discarding a computed value
+    template<typename T>
+    inline void keep(const T& value)
+    {
+        asm volatile("" : : "r"(&value) : "memory");
+    }
+
+    /* Times iterations calls of function after a warmup of a tenth as
+     * many. Work that completes on another thread has to be timed by the
+     * caller and passed to report() instead. Allocation tracking builds
+     * also report the allocations made per iteration on this thread, and
+     * fail the run if they exceed budget.
+     */
+    template<typename Function>
+    void run(const std::string& name, uint64_t iterations, Function function,
+            uint64_t budget=NoBudget)
+    {
+        if(!enabled(name))
+            return;
+
+        for(uint64_t i = 0; i < iterations / 10; i++)
+            function();
+
+        auto allocations = alloc::threadAllocations();
+        auto start = std::chrono::steady_clock::now();
+        for(uint64_t i = 0; i < iterations; i++)
+            function();
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        if(!alloc::enabled()) {
+            report(name, iterations, elapsed);
+            return;
+        }
+        allocations = alloc::threadAllocations() - allocations;
+        report(name, iterations, elapsed, {
+            {"allocations_per_op", iterations ? allocations / iterations : 0}
+        });
+        if(budget != NoBudget && allocations > budget * iterations)
+            overBudget(name, allocations, iterations);
+    }
+
+    void backend();
+    void util();
+    void actions();
+    void events();
+    void startup();
+    void config();
+    void idle();
+}}
+
+#endif //LOGID_BENCH_BENCH_H
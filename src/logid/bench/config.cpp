@@ -0,0 +1,125 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <cstring>
+#include <fstream>
+#include "bench.h"
+#include "../Configuration.h"
+
+extern "C"
+{
+#include <dirent.h>
+#include <unistd.h>
+}
+
+#define LOGID_BENCH_CONFIG_MATCHES 1000000
+
+using namespace logid;
+
+namespace
+{
+    /* Entries are matched by name, PID and serial in turn, like configs
+     * generated for a fleet where some units are told apart by serial. */
+    void writeConfig(const std::string& path, const std::string& cache,
+            std::size_t entries)
+    {
+        std::ofstream file(path);
+        file << "feature_cache: \"" << cache << "\";\ndevices: (\n";
+        for(std::size_t i = 0; i < entries; i++) {
+            file << (i ? ",\n" : "") << "{\n";
+            switch(i % 3) {
+            case 0:
+                file << "    name: \"Device " << i << "\";\n";
+                break;
+            case 1:
+                file << "    pid: " << i << ";\n";
+                break;
+            default:
+                file << "    serial: 0x" << std::hex << 0x80000000 + i
+                     << std::dec << ";\n";
+            }
+            file << "    dpi: " << 400 + i % 3600 << ";\n"
+                    "    smartshift: { on: true; threshold: " << i % 50
+                 << "; };\n"
+                    "    buttons: ({ cid: 0xc3; action: { type: "
+                    "\"Keypress\"; keys: [\"KEY_A\"]; }; });\n}";
+        }
+        file << "\n);\n";
+    }
+
+    void loadAndMatch(std::size_t entries, uint64_t loads)
+    {
+        auto prefix = "config/" + std::to_string(entries);
+        if(!bench::enabled(prefix))
+            return;
+
+        char dir[] = "/tmp/logid-bench.XXXXXX";
+        if(!::mkdtemp(dir)) {
+            bench::skip(prefix, "mkdtemp failed");
+            return;
+        }
+        std::string path = std::string(dir) + "/logid.cfg";
+        writeConfig(path, dir, entries);
+
+        /* After the warmup the input codes come from the cache, as they
+         * would on a restart with an unchanged config. */
+        std::shared_ptr<Configuration> loaded;
+        bench::run(prefix + "/load", loads, [&]() {
+            loaded = std::make_shared<Configuration>(path);
+        });
+
+        uint32_t i = 0;
+        auto no_serial = []() -> uint32_t { return 0; };
+        bench::run(prefix + "/match_pid", LOGID_BENCH_CONFIG_MATCHES, [&]() {
+            uint16_t pid = (i++ % (entries / 3)) * 3 + 1;
+            bench::keep(loaded->getDevice(pid, no_serial, []() {
+                return std::string();
+            }));
+        });
+        bench::run(prefix + "/match_serial", LOGID_BENCH_CONFIG_MATCHES,
+                [&]() {
+            uint32_t serial = 0x80000000 + (i++ % (entries / 3)) * 3 + 2;
+            bench::keep(loaded->getDevice(0xffff,
+                    [serial]() { return serial; },
+                    []() { return std::string(); }));
+        });
+        bench::run(prefix + "/match_name", LOGID_BENCH_CONFIG_MATCHES, [&]() {
+            auto index = (i++ % (entries / 3)) * 3;
+            bench::keep(loaded->getDevice(0xffff, no_serial, [index]() {
+                return "Device " + std::to_string(index);
+            }));
+        });
+
+        loaded.reset();
+        if(DIR* cache = ::opendir(dir)) {
+            while(auto entry = ::readdir(cache)) {
+                if(std::strcmp(entry->d_name, ".") &&
+                   std::strcmp(entry->d_name, ".."))
+                    ::unlink((std::string(dir) + "/" + entry->d_name).c_str());
+            }
+            ::closedir(cache);
+        }
+        ::rmdir(dir);
+    }
+}
+
+void bench::config()
+{
+    loadAndMatch(1000, 50);
+    loadAndMatch(10000, 10);
+}
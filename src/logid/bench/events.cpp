@@ -0,0 +1,166 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include "bench.h"
+#include "../Configuration.h"
+#include "../Device.h"
+#include "../InputDevice.h"
+#include "../features/HiresScroll.h"
+#include "../backend/hidpp20/feature_defs.h"
+#include "../backend/hidpp20/features/HiresScroll.h"
+#include "../backend/hidpp20/features/ReprogControls.h"
+#include "../backend/raw/SimulatedDevice.h"
+
+extern "C"
+{
+#include <unistd.h>
+}
+
+#define LOGID_BENCH_EVENTS_INPUT_NAME "LogiOps Event Benchmark Input"
+#define LOGID_BENCH_EVENTS_DEVICE_NAME "Event Benchmark Mouse"
+#define LOGID_BENCH_EVENTS 200000
+#define LOGID_BENCH_GESTURE_CID 0xc3
+
+using namespace logid;
+using namespace logid::backend;
+
+namespace
+{
+    /* The gesture button sends KEY_A when released without moving and
+     * REL_X while held and moved right, the wheel is diverted to
+     * REL_WHEEL_HI_RES. */
+    const char* config_text = R"(
+devices: ({
+    name: ")" LOGID_BENCH_EVENTS_DEVICE_NAME R"(";
+    buttons: ({
+        cid: 0xc3;
+        action = {
+            type: "Gestures";
+            gestures: (
+                {
+                    direction: "None";
+                    mode: "OnRelease";
+                    action = { type: "Keypress"; keys: ["KEY_A"]; };
+                },
+                {
+                    direction: "Right";
+                    mode: "Axis";
+                    axis: "REL_X";
+                    threshold: 1;
+                }
+            );
+        };
+    });
+    hiresscroll: {
+        hires: true;
+        target: true;
+        up: { mode: "Axis"; axis: "REL_WHEEL_HI_RES"; };
+        down: { mode: "Axis"; axis: "REL_WHEEL_HI_RES"; };
+    };
+});
+)";
+
+    hidpp::Report event(uint8_t feature_index, uint8_t function)
+    {
+        return hidpp::Report(hidpp::Report::Type::Long, hidpp::DefaultDevice,
+                feature_index, function, 0);
+    }
+
+    /* Reports are handed to the device the way its listener does, on this
+     * thread, so every allocation down to the queued uinput frame counts
+     * against the budget of zero. */
+    void handleEvents(Device& device)
+    {
+        auto& hidpp20 = device.hidpp20();
+        auto reprog = hidpp20.featureIndex(
+                hidpp20::FeatureID::REPROG_CONTROLS_V4);
+
+        auto press = event(reprog,
+                hidpp20::ReprogControls::DivertedButtonEvent);
+        press.paramBegin()[0] = LOGID_BENCH_GESTURE_CID >> 8;
+        press.paramBegin()[1] = LOGID_BENCH_GESTURE_CID & 0xff;
+        auto release = event(reprog,
+                hidpp20::ReprogControls::DivertedButtonEvent);
+        bench::run("event/button", LOGID_BENCH_EVENTS, [&]() {
+            hidpp20.handleEvent(press);
+            hidpp20.handleEvent(release);
+        }, 0);
+
+        auto move = event(reprog, hidpp20::ReprogControls::DivertedRawXYEvent);
+        move.paramBegin()[1] = 5;
+        hidpp20.handleEvent(press);
+        bench::run("event/raw_xy", LOGID_BENCH_EVENTS, [&]() {
+            hidpp20.handleEvent(move);
+        }, 0);
+        hidpp20.handleEvent(release);
+
+        if(!bench::enabled("event/wheel"))
+            return;
+        if(!device.getFeature<features::HiresScroll>()) {
+            bench::skip("event/wheel", "hiresscroll was not set up");
+            return;
+        }
+        auto wheel = event(hidpp20.featureIndex(hidpp20::HiresScroll::ID),
+                hidpp20::HiresScroll::WheelMovement);
+        wheel.paramBegin()[0] = 1 << 4;
+        wheel.paramBegin()[2] = 8;
+        bench::run("event/wheel", LOGID_BENCH_EVENTS, [&]() {
+            hidpp20.handleEvent(wheel);
+        }, 0);
+    }
+}
+
+void bench::events()
+{
+    if(!bench::enabled("event"))
+        return;
+
+    char dir[] = "/tmp/logid-bench.XXXXXX";
+    if(!::mkdtemp(dir)) {
+        bench::skip("event", std::string("mkdtemp failed: ") +
+                std::strerror(errno));
+        return;
+    }
+    auto config_path = std::string(dir) + "/logid.cfg";
+    std::ofstream(config_path) << config_text;
+
+    auto default_config = global_config;
+    try {
+        global_config = std::make_shared<Configuration>(config_path);
+        virtual_input = std::make_unique<InputDevice>(
+                LOGID_BENCH_EVENTS_INPUT_NAME, global_config->inputKeys(),
+                global_config->inputAxes());
+
+        raw::SimulatedDevice::Config sim_config{};
+        sim_config.name = LOGID_BENCH_EVENTS_DEVICE_NAME;
+        auto sim = raw::SimulatedDevice::mouse("bench-events", sim_config);
+        Device device(sim->rawDevice(), hidpp::DefaultDevice);
+        handleEvents(device);
+    } catch(std::exception& e) {
+        bench::skip("event", e.what());
+    }
+
+    virtual_input.reset();
+    global_config = default_config;
+    std::remove(config_path.c_str());
+    ::rmdir(dir);
+}
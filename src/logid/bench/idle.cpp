@@ -0,0 +1,135 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <thread>
+#include "bench.h"
+#include "../DeviceManager.h"
+#include "../backend/raw/SimulatedDevice.h"
+#include "../util/log.h"
+#include "../util/metrics.h"
+#include "../util/power.h"
+
+extern "C"
+{
+#include <dirent.h>
+}
+
+#define LOGID_BENCH_IDLE_MICE 4
+#define LOGID_BENCH_IDLE_SETTLE std::chrono::seconds(2)
+#define LOGID_BENCH_IDLE_TIME std::chrono::seconds(5)
+
+using namespace logid;
+using namespace logid::backend;
+using namespace std::chrono;
+
+namespace
+{
+    // Voluntary context switches of each thread name, e.g. "log"
+    std::map<std::string, uint64_t> threadWakeups()
+    {
+        std::map<std::string, uint64_t> wakeups;
+        DIR* dir = ::opendir("/proc/self/task");
+        if(!dir)
+            return wakeups;
+        while(auto entry = ::readdir(dir)) {
+            if(entry->d_name[0] == '.')
+                continue;
+            std::string task = std::string("/proc/self/task/") +
+                    entry->d_name;
+            std::string name, line;
+            std::ifstream comm(task + "/comm");
+            std::ifstream status(task + "/status");
+            if(!std::getline(comm, name))
+                continue;
+            while(std::getline(status, line)) {
+                if(!line.compare(0, 24, "voluntary_ctxt_switches:")) {
+                    wakeups[name] += std::stoull(line.substr(24));
+                    break;
+                }
+            }
+        }
+        ::closedir(dir);
+        return wakeups;
+    }
+
+    /* Counts the wakeups of every thread while configured simulated mice
+     * sit idle, after setup and the first timers had time to settle.
+     * Reported per 1000 s, as idle rates are often below one per second,
+     * in total and per thread name, so a thread that still polls stands
+     * out. Threads that exit meanwhile are only in the total.
+     */
+    void measureIdle(const std::string& name, bool battery_mode)
+    {
+        if(!bench::enabled(name))
+            return;
+
+        raw::SimulatedDevice::Config config{};
+        std::vector<std::shared_ptr<raw::SimulatedDevice>> devices;
+        std::unique_ptr<DeviceManager> manager;
+        try {
+            for(int i = 0; i < LOGID_BENCH_IDLE_MICE; i++)
+                devices.push_back(raw::SimulatedDevice::mouse(
+                        name + "/mouse" + std::to_string(i), config));
+            manager = std::make_unique<DeviceManager>();
+            for(auto& device : devices)
+                manager->addSimulatedDevice(device);
+        } catch(std::exception& e) {
+            bench::skip(name, e.what());
+            return;
+        }
+
+        // The daemon's log flush thread is running by now, here too
+        logFlush();
+        power::apply(battery_mode);
+        std::this_thread::sleep_for(LOGID_BENCH_IDLE_SETTLE);
+
+        auto wakeups = metrics::wakeups();
+        auto threads = threadWakeups();
+        auto start = steady_clock::now();
+        std::this_thread::sleep_for(LOGID_BENCH_IDLE_TIME);
+        auto elapsed = steady_clock::now() - start;
+        // Less the wakeup that ended the sleep above
+        wakeups = std::max<uint64_t>(metrics::wakeups() - wakeups, 1) - 1;
+        auto seconds = duration<double>(elapsed).count();
+        std::vector<std::pair<std::string, uint64_t>> extra = {
+            {"wakeups_per_1000s", (uint64_t)(wakeups * 1000 / seconds)}
+        };
+        for(auto& thread : threadWakeups()) {
+            auto before = threads.find(thread.first);
+            auto count = thread.second - (before == threads.end() ? 0 :
+                    std::min(before->second, thread.second));
+            extra.emplace_back("wakeups_per_1000s/" + thread.first,
+                    (uint64_t)(count * 1000 / seconds));
+        }
+
+        power::apply(false);
+        manager.reset();
+        devices.clear();
+
+        bench::report(name, wakeups, elapsed, extra);
+    }
+}
+
+void bench::idle()
+{
+    measureIdle("idle/wakeups", false);
+    measureIdle("idle/wakeups_battery", true);
+}
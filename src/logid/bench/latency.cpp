@@ -0,0 +1,327 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <thread>
+#include "../Configuration.h"
+#include "../DeviceManager.h"
+#include "../InputDevice.h"
+#include "../backend/raw/SimulatedDevice.h"
+#include "../util/log.h"
+#include "../util/workqueue.h"
+
+extern "C"
+{
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+}
+
+#define LOGID_LATENCY_INPUT_NAME "LogiOps Latency Input"
+#define LOGID_LATENCY_DEVICE_NAME "Latency Mouse"
+// Longest wait for logid to pick up and configure the uhid device
+#define LOGID_LATENCY_SETUP_TIMEOUT std::chrono::seconds(10)
+// Left for diversions to be written once the device is listed
+#define LOGID_LATENCY_SETTLE std::chrono::milliseconds(500)
+// An injected report with no event after this counts as lost
+#define LOGID_LATENCY_EVENT_TIMEOUT_MS 100
+#define LOGID_LATENCY_MOVES_PER_PRESS 16
+#define LOGID_LATENCY_MOVE 20
+
+using namespace logid;
+using namespace logid::backend;
+using namespace std::chrono;
+
+namespace
+{
+    /* The gesture button sends KEY_A when released without moving and
+     * moves REL_X while held and moved to the right. */
+    const char* config_text = R"(
+devices: ({
+    name: ")" LOGID_LATENCY_DEVICE_NAME R"(";
+    buttons: ({
+        cid: 0xc3;
+        action = {
+            type: "Gestures";
+            gestures: (
+                {
+                    direction: "None";
+                    mode: "OnRelease";
+                    action = { type: "Keypress"; keys: ["KEY_A"]; };
+                },
+                {
+                    direction: "Right";
+                    mode: "Axis";
+                    axis: "REL_X";
+                    threshold: 1;
+                }
+            );
+        };
+    });
+});
+)";
+
+    struct samples
+    {
+        std::vector<uint32_t> latency_us;
+        uint64_t lost = 0;
+    };
+
+    uint64_t now()
+    {
+        return duration_cast<microseconds>(
+                steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Opens logid's virtual input node, -1 if there is none
+    int openInput()
+    {
+        DIR* dir = ::opendir("/dev/input");
+        if(!dir)
+            return -1;
+        int found = -1;
+        while(auto entry = ::readdir(dir)) {
+            if(std::strncmp(entry->d_name, "event", 5))
+                continue;
+            auto path = std::string("/dev/input/") + entry->d_name;
+            int fd = ::open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+            if(fd == -1)
+                continue;
+            char name[256] = {};
+            if(::ioctl(fd, EVIOCGNAME(sizeof(name) - 1), name) >= 0 &&
+               !std::strcmp(name, LOGID_LATENCY_INPUT_NAME)) {
+                found = fd;
+                break;
+            }
+            ::close(fd);
+        }
+        ::closedir(dir);
+
+        // Event times then compare with steady_clock
+        int clock = CLOCK_MONOTONIC;
+        if(found != -1)
+            ::ioctl(found, EVIOCSCLOCKID, &clock);
+        return found;
+    }
+
+    /* Waits for an event of type and code, returns the time the kernel
+     * stamped it with in microseconds, or 0 on timeout. */
+    uint64_t waitEvent(int fd, uint16_t type, uint16_t code, int value)
+    {
+        auto deadline = steady_clock::now() +
+                milliseconds(LOGID_LATENCY_EVENT_TIMEOUT_MS);
+        while(true) {
+            input_event event{};
+            auto ret = ::read(fd, &event, sizeof(event));
+            if(ret == sizeof(event)) {
+                if(event.type == type && event.code == code &&
+                   (value < 0 || event.value == value))
+                    return event.time.tv_sec * 1000000ull +
+                            event.time.tv_usec;
+                continue;
+            }
+            if(ret == -1 && errno != EAGAIN && errno != EINTR)
+                return 0;
+
+            auto left = duration_cast<milliseconds>(deadline -
+                    steady_clock::now()).count();
+            if(left <= 0)
+                return 0;
+            pollfd pfd{fd, POLLIN, 0};
+            ::poll(&pfd, 1, left);
+        }
+    }
+
+    void drain(int fd)
+    {
+        input_event event{};
+        while(::read(fd, &event, sizeof(event)) == sizeof(event)) { }
+    }
+
+    void record(samples& result, uint64_t sent, uint64_t received)
+    {
+        if(!received) {
+            result.lost++;
+            return;
+        }
+        result.latency_us.push_back(received > sent ? received - sent : 0);
+    }
+
+    uint32_t percentile(const std::vector<uint32_t>& sorted, double p)
+    {
+        if(sorted.empty())
+            return 0;
+        return sorted[std::min<std::size_t>(sorted.size() - 1,
+                sorted.size() * p)];
+    }
+
+    void print(const char* name, samples& result)
+    {
+        auto& latency = result.latency_us;
+        std::sort(latency.begin(), latency.end());
+        std::printf("{\"name\":\"%s\",\"samples\":%zu,\"lost\":%llu,"
+                    "\"p50_us\":%u,\"p90_us\":%u,\"p99_us\":%u,"
+                    "\"max_us\":%u}\n", name, latency.size(),
+                    (unsigned long long)result.lost,
+                    percentile(latency, 0.5), percentile(latency, 0.9),
+                    percentile(latency, 0.99),
+                    latency.empty() ? 0 : latency.back());
+    }
+
+    void skip(const std::string& reason)
+    {
+        std::printf("{\"name\":\"latency\",\"skipped\":\"%s\"}\n",
+                reason.c_str());
+    }
+
+    bool ready()
+    {
+        for(auto& device : device_manager->devices())
+            if(device->name() == LOGID_LATENCY_DEVICE_NAME &&
+               device->awake())
+                return true;
+        return false;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    long iterations = 1000;
+    if(argc > 1) {
+        char* end = nullptr;
+        iterations = std::strtol(argv[1], &end, 10);
+        if(!std::strcmp(argv[1], "-h") || !std::strcmp(argv[1], "--help") ||
+           *end || iterations <= 0) {
+            std::printf("Usage: %s [iterations]\n"
+                        "Creates a mouse through /dev/uhid that logid picks "
+                        "up from udev, then\ntimes diverted button and raw "
+                        "XY reports until logid's virtual input\nnode sends "
+                        "the remapped event, printing one JSON object per "
+                        "kind.\nNeeds write access to /dev/uhid and read "
+                        "access to /dev/input.\n", argv[0]);
+            return EXIT_SUCCESS;
+        }
+    }
+
+    global_loglevel = WARN;
+
+    char dir[] = "/tmp/logid-latency.XXXXXX";
+    if(!::mkdtemp(dir)) {
+        skip(std::string("mkdtemp failed: ") + std::strerror(errno));
+        return EXIT_FAILURE;
+    }
+    auto config_path = std::string(dir) + "/logid.cfg";
+    std::ofstream(config_path) << config_text;
+
+    std::shared_ptr<raw::SimulatedDevice> mouse;
+    std::thread monitor;
+    int input = -1;
+    bool passed = false;
+    try {
+        global_config = std::make_shared<Configuration>(config_path);
+        global_workqueue = std::make_shared<workqueue>(
+                global_config->workerCount());
+        virtual_input = std::make_unique<InputDevice>(
+                LOGID_LATENCY_INPUT_NAME, global_config->inputKeys(),
+                global_config->inputAxes());
+        device_manager = std::make_unique<DeviceManager>();
+        monitor = std::thread([]() {
+            try {
+                device_manager->run();
+            } catch(std::exception& e) {
+                logPrintf(ERROR, "Device monitor failed: %s", e.what());
+            }
+        });
+
+        raw::SimulatedDevice::Config config;
+        config.name = LOGID_LATENCY_DEVICE_NAME;
+        mouse = raw::SimulatedDevice::uhid(config);
+
+        auto deadline = steady_clock::now() + LOGID_LATENCY_SETUP_TIMEOUT;
+        while(!ready() && steady_clock::now() < deadline)
+            std::this_thread::sleep_for(milliseconds(1));
+        input = openInput();
+        if(!ready()) {
+            skip("the uhid device was not set up in time");
+        } else if(input == -1) {
+            skip("the virtual input node could not be opened");
+        } else {
+            std::this_thread::sleep_for(LOGID_LATENCY_SETTLE);
+            drain(input);
+
+            // Release to KEY_A, the press alone sends nothing
+            samples button;
+            for(long i = 0; i < iterations; i++) {
+                mouse->pressButton(true);
+                mouse->pressButton(false);
+                auto sent = now();
+                record(button, sent, waitEvent(input, EV_KEY, KEY_A, 1));
+                waitEvent(input, EV_KEY, KEY_A, 0);
+            }
+
+            // Raw XY to REL_X while the button is held
+            samples raw_xy;
+            auto presses = (iterations + LOGID_LATENCY_MOVES_PER_PRESS - 1) /
+                    LOGID_LATENCY_MOVES_PER_PRESS;
+            for(long i = 0; i < presses; i++) {
+                mouse->pressButton(true);
+                for(int j = 0; j < LOGID_LATENCY_MOVES_PER_PRESS; j++) {
+                    mouse->moveRaw(LOGID_LATENCY_MOVE, 0);
+                    auto sent = now();
+                    record(raw_xy, sent, waitEvent(input, EV_REL, REL_X,
+                            -1));
+                }
+                mouse->pressButton(false);
+                std::this_thread::sleep_for(milliseconds(
+                        LOGID_LATENCY_EVENT_TIMEOUT_MS / 10));
+                drain(input);
+            }
+
+            print("latency/button", button);
+            print("latency/raw_xy", raw_xy);
+            passed = !button.latency_us.empty() &&
+                    !raw_xy.latency_us.empty();
+        }
+    } catch(std::exception& e) {
+        skip(e.what());
+    }
+
+    if(input != -1)
+        ::close(input);
+    mouse.reset();
+    if(device_manager) {
+        device_manager->stop();
+        if(monitor.joinable())
+            monitor.join();
+        device_manager.reset();
+    }
+    virtual_input.reset();
+    global_workqueue.reset();
+    ::unlink(config_path.c_str());
+    ::rmdir(dir);
+
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,219 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include "bench.h"
+#include "../DeviceManager.h"
+#include "../backend/raw/RawDevice.h"
+#include "../backend/raw/SimulatedDevice.h"
+#include "../util/ExceptionHandler.h"
+#include "../util/metrics.h"
+#include "../util/task.h"
+
+#define LOGID_BENCH_STARTUP_TIMEOUT std::chrono::seconds(30)
+#define LOGID_BENCH_STARTUP_POLL std::chrono::milliseconds(1)
+
+using namespace logid;
+using namespace logid::backend;
+using namespace std::chrono;
+
+namespace
+{
+    struct Topology
+    {
+        std::size_t receivers = 0;
+        std::size_t paired = 0;     // Per receiver
+        std::size_t mice = 0;       // Bluetooth or corded, one node each
+        unsigned int asleep = 0;    // Percent of paired devices
+        microseconds rtt{0};
+    };
+
+    /* The keys of --simulate, except that asleep is a percentage, e.g.
+     * LOGID_BENCH_STARTUP=receivers=4,paired=6,mice=8,asleep=50,latency=500
+     */
+    bool parse(const std::string& spec, Topology& topology)
+    {
+        std::istringstream options(spec);
+        std::string option;
+        while(std::getline(options, option, ',')) {
+            auto separator = option.find('=');
+            if(separator == std::string::npos)
+                return false;
+            char* end = nullptr;
+            auto value = std::strtoul(option.c_str() + separator + 1, &end,
+                    10);
+            if(*end)
+                return false;
+
+            auto key = option.substr(0, separator);
+            if(key == "receivers")
+                topology.receivers = value;
+            else if(key == "paired")
+                topology.paired = value;
+            else if(key == "mice")
+                topology.mice = value;
+            else if(key == "asleep")
+                topology.asleep = std::min<unsigned long>(value, 100);
+            else if(key == "latency")
+                topology.rtt = microseconds(value);
+            else
+                return false;
+        }
+        return true;
+    }
+
+    /* Times the full DeviceManager pipeline from the first node being
+     * handed over until every awake device is configured. Nodes are added
+     * on the workqueue like DeviceMonitor does, so that they are set up in
+     * parallel. Asleep devices only report that their link is down.
+     *
+     * Capabilities and names cached by an earlier topology are reused, as
+     * they would be on a restart of the daemon.
+     */
+    void startup(const std::string& name, const Topology& topology)
+    {
+        if(!bench::enabled(name))
+            return;
+
+        raw::SimulatedDevice::Config config{};
+        config.latency = topology.rtt;
+        auto paired = std::min(topology.paired,
+                raw::SimulatedDevice::MaxSlots);
+        config.asleep = paired * topology.asleep / 100;
+        std::size_t expected = topology.mice +
+                topology.receivers * (paired - config.asleep);
+
+        std::vector<std::shared_ptr<raw::SimulatedDevice>> devices;
+        try {
+            for(std::size_t i = 0; i < topology.receivers; i++)
+                devices.push_back(raw::SimulatedDevice::receiver(
+                        name + "/receiver" + std::to_string(i), paired,
+                        config));
+            for(std::size_t i = 0; i < topology.mice; i++)
+                devices.push_back(raw::SimulatedDevice::mouse(
+                        name + "/mouse" + std::to_string(i), config));
+        } catch(std::exception& e) {
+            bench::skip(name, e.what());
+            return;
+        }
+        // Each simulated device answers on its own thread
+        uint64_t simulator_threads = devices.size();
+
+        // Resets VmHWM, kernels older than 4.0 keep the process peak
+        std::ofstream("/proc/self/clear_refs") << "5";
+
+        std::unique_ptr<DeviceManager> manager;
+        auto start = steady_clock::now();
+        try {
+            manager = std::make_unique<DeviceManager>();
+        } catch(std::exception& e) {
+            bench::skip(name, e.what());
+            return;
+        }
+
+        std::atomic<std::size_t> adding(devices.size());
+        auto* target = manager.get();
+        for(auto& device : devices) {
+            task::spawn(task::Normal, [target, device, &adding]() {
+                target->addSimulatedDevice(device);
+                adding--;
+            }, [&adding](std::exception& e) {
+                ExceptionHandler::Default(e);
+                adding--;
+            });
+        }
+
+        std::size_t ready = 0;
+        uint64_t threads = 0;
+        auto deadline = start + LOGID_BENCH_STARTUP_TIMEOUT;
+        while(steady_clock::now() < deadline) {
+            threads = std::max(threads, bench::status("Threads"));
+            ready = manager->devices().size();
+            if(ready >= expected && !adding)
+                break;
+            std::this_thread::sleep_for(LOGID_BENCH_STARTUP_POLL);
+        }
+        auto elapsed = steady_clock::now() - start;
+
+        uint64_t requests = 0;
+        for(auto& device : devices)
+            requests += metrics::rawDevice(device->rawDevice()->hidrawPath())
+                    ->get(metrics::ReportsOut);
+        uint64_t rss = bench::status("VmHWM");
+
+        // Nodes still being set up hold on to the manager
+        while(adding)
+            std::this_thread::sleep_for(LOGID_BENCH_STARTUP_POLL);
+        manager.reset();
+        devices.clear();
+
+        if(ready < expected) {
+            bench::skip(name, std::to_string(ready) + " of " +
+                    std::to_string(expected) + " devices ready in time");
+            return;
+        }
+
+        bench::report(name, expected, elapsed, {
+            {"devices", expected},
+            {"requests", requests},
+            {"peak_threads", threads > simulator_threads ?
+                    threads - simulator_threads : 0},
+            {"peak_rss_kb", rss}
+        });
+    }
+}
+
+void bench::startup()
+{
+    Topology receiver;
+    receiver.receivers = 1;
+    receiver.paired = raw::SimulatedDevice::MaxSlots;
+    startup("startup/receiver", receiver);
+
+    Topology bluetooth;
+    bluetooth.mice = 8;
+    startup("startup/bluetooth", bluetooth);
+
+    Topology mixed;
+    mixed.receivers = 4;
+    mixed.paired = raw::SimulatedDevice::MaxSlots;
+    mixed.mice = 8;
+    startup("startup/mixed", mixed);
+
+    Topology asleep = mixed;
+    asleep.asleep = 50;
+    startup("startup/mixed_asleep", asleep);
+
+    Topology slow = mixed;
+    slow.rtt = milliseconds(2);
+    startup("startup/mixed_rtt", slow);
+
+    if(const char* spec = std::getenv("LOGID_BENCH_STARTUP")) {
+        Topology custom;
+        if(parse(spec, custom))
+            startup("startup/custom", custom);
+        else
+            bench::skip("startup/custom", std::string("invalid spec ") +
+                    spec);
+    }
+}
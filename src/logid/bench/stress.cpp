@@ -0,0 +1,341 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include "bench.h"
+#include "../Configuration.h"
+#include "../backend/Error.h"
+#include "../backend/hidpp/Report.h"
+#include "../backend/raw/RawDevice.h"
+#include "../backend/raw/SimulatedDevice.h"
+#include "../util/log.h"
+#include "../util/task.h"
+#include "../util/workqueue.h"
+
+#define LOGID_STRESS_DEVICES 8
+#define LOGID_STRESS_REQUESTERS 4
+// Spawned requests in flight at once, on top of the blocking requesters
+#define LOGID_STRESS_SPAWNED 64
+#define LOGID_STRESS_EVENT_RATE 500
+#define LOGID_STRESS_DROP_RATE 5
+#define LOGID_STRESS_DISCONNECT_INTERVAL std::chrono::milliseconds(250)
+#define LOGID_STRESS_REPORT_INTERVAL std::chrono::seconds(10)
+// A canary task queued longer than this counts as a stuck interval
+#define LOGID_STRESS_STUCK std::chrono::seconds(1)
+// Time given to helpers and closed devices to go away before the summary
+#define LOGID_STRESS_SETTLE std::chrono::seconds(5)
+
+using namespace logid;
+using namespace logid::backend;
+using namespace std::chrono;
+
+namespace
+{
+    /* Simulated mice that drop requests, flood diverted events and are
+     * unplugged and replaced at random while requests are in flight. */
+    class devices
+    {
+    public:
+        devices()
+        {
+            _config.event_rate = LOGID_STRESS_EVENT_RATE;
+            _config.drop_rate = LOGID_STRESS_DROP_RATE;
+            for(std::size_t i = 0; i < _slots.size(); i++)
+                _slots[i].device = _connect(i);
+        }
+
+        std::shared_ptr<raw::SimulatedDevice> any(std::minstd_rand& random)
+        {
+            auto& slot = _slots[random() % _slots.size()];
+            std::lock_guard<std::mutex> lock(slot.lock);
+            return slot.device;
+        }
+
+        // The old device goes away once its last request is done with it
+        void disconnect(std::minstd_rand& random)
+        {
+            auto index = random() % _slots.size();
+            // Like hidraw numbers, the path is reused by the next device
+            auto device = _connect(index);
+            auto& slot = _slots[index];
+            std::lock_guard<std::mutex> lock(slot.lock);
+            std::swap(slot.device, device);
+        }
+
+        void clear()
+        {
+            for(auto& slot : _slots) {
+                std::lock_guard<std::mutex> lock(slot.lock);
+                slot.device.reset();
+            }
+        }
+
+        std::atomic<uint64_t> events{0};
+    private:
+        struct slot
+        {
+            std::mutex lock;
+            std::shared_ptr<raw::SimulatedDevice> device;
+        };
+
+        std::shared_ptr<raw::SimulatedDevice> _connect(std::size_t index)
+        {
+            auto device = raw::SimulatedDevice::mouse("stress/mouse" +
+                    std::to_string(index), _config);
+            device->rawDevice()->addDeviceEventHandler(hidpp::DefaultDevice,
+                    [this](std::vector<uint8_t>&) { events++; });
+            device->rawDevice()->listenAsync();
+            return device;
+        }
+
+        raw::SimulatedDevice::Config _config;
+        std::array<slot, LOGID_STRESS_DEVICES> _slots;
+    };
+
+    struct counters
+    {
+        std::atomic<uint64_t> requests{0};
+        std::atomic<uint64_t> timeouts{0};
+        std::atomic<uint64_t> errors{0};
+        std::atomic<uint64_t> tasks{0};
+        std::atomic<uint64_t> disconnects{0};
+        std::atomic<uint64_t> handler_changes{0};
+
+        std::mutex latency_lock;
+        std::vector<uint32_t> latency_us;
+    };
+
+    // Root ping, the simulated mouse echoes the data byte
+    std::vector<uint8_t> ping(uint8_t data)
+    {
+        hidpp::Report report(hidpp::Report::Type::Long, hidpp::DefaultDevice,
+                0x00, 0x01, 0x01);
+        report.paramBegin()[2] = data;
+        return report.rawReport();
+    }
+
+    void request(devices& simulated, counters& stats,
+            std::minstd_rand& random)
+    {
+        auto device = simulated.any(random);
+        auto start = steady_clock::now();
+        try {
+            device->rawDevice()->sendReport(ping(random()));
+            auto us = duration_cast<microseconds>(steady_clock::now() -
+                    start).count();
+            std::lock_guard<std::mutex> lock(stats.latency_lock);
+            stats.latency_us.push_back(us);
+        } catch(TimeoutError& e) {
+            stats.timeouts++;
+        } catch(std::exception& e) {
+            stats.errors++;
+        }
+        stats.requests++;
+    }
+
+    uint32_t percentile(const std::vector<uint32_t>& sorted, double p)
+    {
+        if(sorted.empty())
+            return 0;
+        return sorted[std::min<std::size_t>(sorted.size() - 1,
+                sorted.size() * p)];
+    }
+}
+
+int main(int argc, char** argv)
+{
+    long run_seconds = 60;
+    if(argc > 1) {
+        char* end = nullptr;
+        run_seconds = std::strtol(argv[1], &end, 10);
+        if(!std::strcmp(argv[1], "-h") || !std::strcmp(argv[1], "--help") ||
+           *end || run_seconds <= 0) {
+            std::printf("Usage: %s [seconds]\n"
+                        "Runs requests, spawned tasks, disconnects and "
+                        "handler changes against\nsimulated devices, "
+                        "printing one JSON object per interval on stdout.\n"
+                        "Exits with failure if threads leaked or a worker "
+                        "got stuck.\n", argv[0]);
+            return EXIT_SUCCESS;
+        }
+    }
+
+    // Timeouts and disconnects are expected, only report what is not
+    global_loglevel = ERROR;
+    global_config = std::make_shared<Configuration>();
+    global_workqueue = std::make_shared<workqueue>(
+            global_config->workerCount());
+
+    uint64_t baseline_threads = bench::status("Threads");
+
+    counters stats;
+    std::unique_ptr<devices> simulated;
+    try {
+        simulated = std::make_unique<devices>();
+    } catch(std::exception& e) {
+        std::printf("{\"name\":\"stress\",\"skipped\":\"%s\"}\n", e.what());
+        return EXIT_FAILURE;
+    }
+
+    std::atomic<bool> running(true);
+    std::atomic<int> spawned(0);
+    std::vector<std::thread> threads;
+
+    for(int i = 0; i < LOGID_STRESS_REQUESTERS; i++) {
+        threads.emplace_back([&, i]() {
+            std::minstd_rand random(i + 1);
+            while(running) {
+                request(*simulated, stats, random);
+
+                // Requests that block a worker, as feature setup does
+                if(spawned < LOGID_STRESS_SPAWNED) {
+                    spawned++;
+                    task::spawn(task::Normal, [&, seed = random()]() {
+                        std::minstd_rand task_random(seed);
+                        request(*simulated, stats, task_random);
+                        stats.tasks++;
+                        spawned--;
+                    }, [&](std::exception&) {
+                        stats.errors++;
+                        spawned--;
+                    });
+                }
+            }
+        });
+    }
+
+    threads.emplace_back([&]() {
+        std::minstd_rand random(LOGID_STRESS_REQUESTERS + 1);
+        while(running) {
+            auto device = simulated->any(random);
+            auto raw_device = device->rawDevice();
+            auto handler = std::make_shared<raw::RawEventHandler>();
+            handler->condition = [](std::vector<uint8_t>&) { return false; };
+            handler->callback = [](std::vector<uint8_t>&) { };
+            raw_device->addEventHandler("stress", handler);
+            std::this_thread::yield();
+            raw_device->removeEventHandler("stress");
+            stats.handler_changes++;
+        }
+    });
+
+    threads.emplace_back([&]() {
+        std::minstd_rand random(LOGID_STRESS_REQUESTERS + 2);
+        while(running) {
+            std::this_thread::sleep_for(LOGID_STRESS_DISCONNECT_INTERVAL);
+            try {
+                simulated->disconnect(random);
+                stats.disconnects++;
+            } catch(std::exception& e) {
+                stats.errors++;
+            }
+        }
+    });
+
+    auto start = steady_clock::now();
+    auto end = start + seconds(run_seconds);
+    uint64_t first_rss = 0, last_rss = 0, stuck = 0;
+    uint64_t last_requests = 0, last_events = 0;
+    while(steady_clock::now() < end) {
+        auto interval_start = steady_clock::now();
+        std::this_thread::sleep_until(std::min(end,
+                interval_start + LOGID_STRESS_REPORT_INTERVAL));
+
+        // How long a fresh task waits for a worker
+        auto queued = std::make_shared<std::atomic<int64_t>>(-1);
+        auto canary_start = steady_clock::now();
+        task::spawn(task::Normal, [queued, canary_start]() {
+            *queued = duration_cast<microseconds>(steady_clock::now() -
+                    canary_start).count();
+        });
+        while(*queued < 0 && steady_clock::now() - canary_start <
+                LOGID_STRESS_STUCK)
+            std::this_thread::sleep_for(milliseconds(1));
+        if(*queued < 0)
+            stuck++;
+
+        std::vector<uint32_t> latency;
+        {
+            std::lock_guard<std::mutex> lock(stats.latency_lock);
+            std::swap(latency, stats.latency_us);
+        }
+        std::sort(latency.begin(), latency.end());
+
+        auto now = steady_clock::now();
+        double elapsed = duration<double>(now - interval_start).count();
+        uint64_t requests = stats.requests, events = simulated->events;
+        last_rss = bench::status("VmRSS");
+        if(!first_rss)
+            first_rss = last_rss;
+
+        std::printf("{\"name\":\"stress\",\"seconds\":%lld,"
+                    "\"requests_per_s\":%.0f,\"events_per_s\":%.0f,"
+                    "\"p50_us\":%u,\"p99_us\":%u,\"max_us\":%u,"
+                    "\"timeouts\":%llu,\"errors\":%llu,\"tasks\":%llu,"
+                    "\"disconnects\":%llu,\"handler_changes\":%llu,"
+                    "\"queue_delay_us\":%lld,\"threads\":%llu,"
+                    "\"fallback_threads\":%llu,\"rss_kb\":%llu}\n",
+                    (long long)duration_cast<seconds>(now - start).count(),
+                    (requests - last_requests) / elapsed,
+                    (events - last_events) / elapsed,
+                    percentile(latency, 0.5), percentile(latency, 0.99),
+                    latency.empty() ? 0 : latency.back(),
+                    (unsigned long long)stats.timeouts.load(),
+                    (unsigned long long)stats.errors.load(),
+                    (unsigned long long)stats.tasks.load(),
+                    (unsigned long long)stats.disconnects.load(),
+                    (unsigned long long)stats.handler_changes.load(),
+                    (long long)queued->load(),
+                    (unsigned long long)bench::status("Threads"),
+                    (unsigned long long)global_workqueue->fallbackThreads(),
+                    (unsigned long long)last_rss);
+        std::fflush(stdout);
+        last_requests = requests;
+        last_events = events;
+    }
+
+    running = false;
+    for(auto& thread : threads)
+        thread.join();
+    while(spawned > 0)
+        std::this_thread::sleep_for(milliseconds(1));
+    simulated->clear();
+    simulated.reset();
+    std::this_thread::sleep_for(LOGID_STRESS_SETTLE);
+
+    // Helpers started by blocking() stop once they run out of tasks
+    uint64_t leaked = 0, threads_left = bench::status("Threads");
+    if(threads_left > baseline_threads)
+        leaked = threads_left - baseline_threads;
+    bool passed = !stuck && leaked <= LOGID_WORKQUEUE_MAX_HELPERS;
+
+    std::printf("{\"name\":\"stress/summary\",\"seconds\":%ld,"
+                "\"threads_leaked\":%llu,\"stuck_intervals\":%llu,"
+                "\"rss_growth_kb\":%lld,\"passed\":%s}\n", run_seconds,
+                (unsigned long long)leaked, (unsigned long long)stuck,
+                (long long)last_rss - (long long)first_rss,
+                passed ? "true" : "false");
+
+    global_workqueue.reset();
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
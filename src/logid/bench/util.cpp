@@ -0,0 +1,125 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include "bench.h"
+#include "../util/task.h"
+#include "../util/workqueue.h"
+
+#define LOGID_BENCH_ROUND_TRIPS 20000
+#define LOGID_BENCH_QUEUED 500000
+#define LOGID_BENCH_SPAWNED 100000
+
+using namespace logid;
+using namespace std::chrono;
+
+namespace
+{
+    // Time from spawning a task until the spawner sees that it ran
+    void roundTrip()
+    {
+        std::mutex done_lock;
+        std::condition_variable done_cv;
+        bool done = false;
+
+        bench::run("task/round_trip", LOGID_BENCH_ROUND_TRIPS, [&]() {
+            {
+                std::lock_guard<std::mutex> lock(done_lock);
+                done = false;
+            }
+            task::spawn([&]() {
+                std::lock_guard<std::mutex> lock(done_lock);
+                done = true;
+                done_cv.notify_one();
+            });
+            std::unique_lock<std::mutex> lock(done_lock);
+            done_cv.wait(lock, [&]() { return done; });
+        });
+    }
+
+    // Only the cost of queueing, the tasks run after timing stops
+    void spawn()
+    {
+        const std::string name = "task/spawn";
+        if(!bench::enabled(name))
+            return;
+
+        std::mutex done_lock;
+        std::condition_variable done_cv;
+        std::atomic<std::size_t> remaining;
+
+        auto run = [&](std::size_t count) {
+            remaining = count;
+            auto start = steady_clock::now();
+            for(std::size_t i = 0; i < count; i++) {
+                task::spawn(task::Normal, [&]() {
+                    if(--remaining == 0) {
+                        std::lock_guard<std::mutex> lock(done_lock);
+                        done_cv.notify_one();
+                    }
+                });
+            }
+            auto elapsed = steady_clock::now() - start;
+            std::unique_lock<std::mutex> lock(done_lock);
+            done_cv.wait(lock, [&]() { return remaining == 0; });
+            return elapsed;
+        };
+
+        run(LOGID_BENCH_SPAWNED / 10);
+        bench::report(name, LOGID_BENCH_SPAWNED, run(LOGID_BENCH_SPAWNED));
+    }
+
+    void throughput(const std::string& name, task::Priority priority)
+    {
+        if(!bench::enabled(name))
+            return;
+
+        std::mutex done_lock;
+        std::condition_variable done_cv;
+        std::atomic<std::size_t> remaining;
+
+        auto run = [&](std::size_t count) {
+            remaining = count;
+            auto start = steady_clock::now();
+            for(std::size_t i = 0; i < count; i++) {
+                task::spawn(priority, [&]() {
+                    if(--remaining == 0) {
+                        std::lock_guard<std::mutex> lock(done_lock);
+                        done_cv.notify_one();
+                    }
+                });
+            }
+            std::unique_lock<std::mutex> lock(done_lock);
+            done_cv.wait(lock, [&]() { return remaining == 0; });
+            return steady_clock::now() - start;
+        };
+
+        run(LOGID_BENCH_QUEUED / 10);
+        bench::report(name, LOGID_BENCH_QUEUED, run(LOGID_BENCH_QUEUED));
+    }
+}
+
+void bench::util()
+{
+    roundTrip();
+    spawn();
+    throughput("workqueue/throughput", task::Normal);
+    throughput("workqueue/throughput_interactive", task::Interactive);
+}
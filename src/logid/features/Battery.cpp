@@ -0,0 +1,225 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "Battery.h"
+#include "../Device.h"
+#include "../util/task.h"
+
+using namespace logid::features;
+using namespace logid::backend;
+
+Battery::Battery(Device* dev) : DeviceFeature(dev), _capabilities(),
+    _state(), _broadcasts (false)
+{
+    auto unified = hidpp20::makeFeature<hidpp20::UnifiedBattery>(
+            &dev->hidpp20());
+    if(unified) {
+        _unified = *unified;
+        _capabilities = _unified->getCapabilities();
+        return;
+    }
+    if(unified.failure().kind() != Failure::UnsupportedFeature)
+        unified.failure().raise();
+
+    try {
+        _status = std::make_shared<hidpp20::BatteryStatus>(&dev->hidpp20());
+    } catch(hidpp20::UnsupportedFeature& e) {
+        throw UnsupportedFeature();
+    }
+}
+
+Result<void> Battery::supported(Device* dev)
+{
+    Result<void> unified = dev->hidpp20().tryFeatureIndex(
+            hidpp20::UnifiedBattery::ID);
+    if(unified || unified.failure().kind() != Failure::UnsupportedFeature)
+        return unified;
+    return dev->hidpp20().tryFeatureIndex(hidpp20::BatteryStatus::ID);
+}
+
+Battery::~Battery()
+{
+    if(_unified)
+        _device->hidpp20().removeEventHandler(_unified->featureIndex(),
+                hidpp20::UnifiedBattery::BatteryStatusEvent);
+    else
+        _device->hidpp20().removeEventHandler(_status->featureIndex(),
+                hidpp20::BatteryStatus::BatteryStatusBroadcast);
+
+    std::shared_ptr<timer> poll_timer;
+    {
+        std::lock_guard<std::mutex> lock(_poll_lock);
+        poll_timer = std::move(_poll_timer);
+    }
+    if(poll_timer)
+        poll_timer->cancel();
+}
+
+void Battery::configure()
+{
+    // Read once on startup and wakeup, broadcasts keep it current after
+    _refresh();
+}
+
+void Battery::listen()
+{
+    if(_unified) {
+        _device->hidpp20().addEventHandler(_unified->featureIndex(),
+                hidpp20::UnifiedBattery::BatteryStatusEvent,
+                [this](hidpp::Report& report)->void {
+            _broadcasts = true;
+            _update(_fromUnified(hidpp20::UnifiedBattery::statusEvent(
+                    report)));
+        });
+    } else {
+        _device->hidpp20().addEventHandler(_status->featureIndex(),
+                hidpp20::BatteryStatus::BatteryStatusBroadcast,
+                [this](hidpp::Report& report)->void {
+            _broadcasts = true;
+            _update(_fromStatus(hidpp20::BatteryStatus::batteryStatusEvent(
+                    report)));
+        });
+    }
+
+    std::lock_guard<std::mutex> lock(_poll_lock);
+    if(!_poll_timer && !_broadcasts)
+        _poll_timer = task::spawnEvery(LOGID_BATTERY_POLL_INTERVAL,
+                [this]() { _poll(); },
+                [dev=_device](std::exception& e) {
+            LOGID_LOG(DEBUG, "%s: Error while polling battery: %s",
+                    dev->name().c_str(), e.what());
+        }, task::Background);
+}
+
+void Battery::invalidate()
+{
+    std::lock_guard<std::mutex> lock(_state_lock);
+    _state.valid = false;
+}
+
+Battery::State Battery::state()
+{
+    std::lock_guard<std::mutex> lock(_state_lock);
+    return _state;
+}
+
+void Battery::_poll()
+{
+    if(_broadcasts) {
+        /* Cancelling from the event handler could wait on a poll that is
+         * itself waiting for the event thread, so the timer stops itself.
+         */
+        std::shared_ptr<timer> poll_timer;
+        {
+            std::lock_guard<std::mutex> lock(_poll_lock);
+            poll_timer = std::move(_poll_timer);
+        }
+        if(poll_timer)
+            poll_timer->cancel();
+        return;
+    }
+
+    _refresh();
+}
+
+void Battery::_refresh()
+{
+    if(_unified)
+        _update(_fromUnified(_unified->getStatus()));
+    else
+        _update(_fromStatus(_status->getBatteryLevel()));
+}
+
+void Battery::_update(const State& state)
+{
+    {
+        std::lock_guard<std::mutex> lock(_state_lock);
+        if(_state.valid && _state.level == state.level &&
+           _state.charging == state.charging)
+            return;
+        _state = state;
+    }
+
+    const char* charging = "discharging";
+    if(state.charging == Charging)
+        charging = "charging";
+    else if(state.charging == Full)
+        charging = "full";
+    else if(state.charging == Error)
+        charging = "charging error";
+
+    logPrintf(INFO, "%s: Battery at %d%%, %s", _device->name().c_str(),
+            state.level, charging);
+}
+
+Battery::State Battery::_fromStatus(
+        const hidpp20::BatteryStatus::BatteryLevel& level)
+{
+    State state{};
+    state.valid = true;
+    state.level = level.level;
+    switch(level.status) {
+    case hidpp20::BatteryStatus::Discharging:
+        state.charging = Discharging;
+        break;
+    case hidpp20::BatteryStatus::Recharging:
+    case hidpp20::BatteryStatus::AlmostFull:
+    case hidpp20::BatteryStatus::SlowRecharge:
+        state.charging = Charging;
+        break;
+    case hidpp20::BatteryStatus::Full:
+        state.charging = Full;
+        break;
+    default:
+        state.charging = Error;
+    }
+    return state;
+}
+
+Battery::State Battery::_fromUnified(
+        const hidpp20::UnifiedBattery::Status& status)
+{
+    State state{};
+    state.valid = true;
+    if(_capabilities.flags & hidpp20::UnifiedBattery::StateOfCharge)
+        state.level = status.stateOfCharge;
+    else if(status.level & hidpp20::UnifiedBattery::Full)
+        state.level = 100;
+    else if(status.level & hidpp20::UnifiedBattery::Good)
+        state.level = 50;
+    else if(status.level & hidpp20::UnifiedBattery::Low)
+        state.level = 20;
+    else
+        state.level = 5;
+
+    switch(status.chargingStatus) {
+    case hidpp20::UnifiedBattery::Discharging:
+        state.charging = Discharging;
+        break;
+    case hidpp20::UnifiedBattery::Charging:
+    case hidpp20::UnifiedBattery::SlowCharging:
+        state.charging = Charging;
+        break;
+    case hidpp20::UnifiedBattery::ChargeComplete:
+        state.charging = Full;
+        break;
+    default:
+        state.charging = Error;
+    }
+    return state;
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_FEATURE_BATTERY_H
+#define LOGID_FEATURE_BATTERY_H
+
+#include <atomic>
+#include <mutex>
+#include "DeviceFeature.h"
+#include "../backend/hidpp/Report.h"
+#include "../backend/hidpp20/features/BatteryStatus.h"
+#include "../backend/hidpp20/features/UnifiedBattery.h"
+#include "../util/timer_wheel.h"
+
+// Devices that have not broadcast a battery event yet are polled this often
+#define LOGID_BATTERY_POLL_INTERVAL std::chrono::minutes(5)
+
+namespace logid {
+namespace features
+{
+    /* Battery state from 0x1004 (preferred) or 0x1000. The device's battery
+     * broadcasts keep the cached state current, it is only polled until
+     * the first broadcast shows that the device sends them.
+     */
+    class Battery : public DeviceFeature
+    {
+    public:
+        explicit Battery(Device* dev);
+        static backend::Result<void> supported(Device* dev);
+        ~Battery();
+        virtual void configure();
+        virtual void listen();
+        virtual void invalidate();
+
+        enum ChargeState : uint8_t
+        {
+            Discharging,
+            Charging,
+            Full,
+            Error
+        };
+
+        struct State
+        {
+            bool valid;
+            // Percent, estimated from coarse levels if needed
+            uint8_t level;
+            ChargeState charging;
+        };
+
+        // The last known state, never talks to the device
+        State state();
+    private:
+        void _refresh();
+        void _update(const State& state);
+        void _poll();
+
+        State _fromStatus(
+                const backend::hidpp20::BatteryStatus::BatteryLevel& level);
+        State _fromUnified(
+                const backend::hidpp20::UnifiedBattery::Status& status);
+
+        std::shared_ptr<backend::hidpp20::UnifiedBattery> _unified;
+        std::shared_ptr<backend::hidpp20::BatteryStatus> _status;
+        backend::hidpp20::UnifiedBattery::Capabilities _capabilities;
+
+        std::mutex _state_lock;
+        State _state;
+
+        std::atomic<bool> _broadcasts;
+        std::mutex _poll_lock;
+        std::shared_ptr<timer> _poll_timer;
+    };
+}}
+
+#endif //LOGID_FEATURE_BATTERY_H
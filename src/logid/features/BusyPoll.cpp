@@ -0,0 +1,81 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "BusyPoll.h"
+#include "../Device.h"
+#include "../backend/raw/RawDevice.h"
+#include "../util/busy_poll.h"
+#include "../util/log.h"
+
+using namespace logid::features;
+using namespace std::chrono;
+
+BusyPoll::BusyPoll(Device* device) : DeviceFeature(device),
+    _config (device)
+{
+}
+
+BusyPoll::~BusyPoll()
+{
+    _device->hidpp20().rawDevice()->setBusyPoll(_device->index(),
+            microseconds(0));
+}
+
+void BusyPoll::configure()
+{
+    _device->hidpp20().rawDevice()->setBusyPoll(_device->index(),
+            _config.getWindow());
+}
+
+void BusyPoll::listen()
+{
+}
+
+void BusyPoll::reload()
+{
+    _config = Config(_device);
+    configure();
+}
+
+BusyPoll::Config::Config(Device* dev) : DeviceFeature::Config(dev),
+    _window (0)
+{
+    auto setting = dev->config().getSetting("busy_poll");
+    if(!setting)
+        return;
+    auto& config_root = *setting;
+
+    if(config_root.getType() == libconfig::Setting::TypeBoolean) {
+        if((bool)config_root)
+            _window = LOGID_BUSY_POLL_DEFAULT;
+    } else if(config_root.getType() == libconfig::Setting::TypeInt &&
+              (int)config_root >= 0 &&
+              (int)config_root <= LOGID_BUSY_POLL_MAX.count()) {
+        _window = microseconds((int)config_root);
+    } else {
+        logPrintf(WARN, "Line %d: busy_poll must be a boolean or a window "
+                        "in microseconds between 0 and %d.",
+                        config_root.getSourceLine(),
+                        (int)LOGID_BUSY_POLL_MAX.count());
+    }
+}
+
+microseconds BusyPoll::Config::getWindow() const
+{
+    return _window;
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_FEATURE_BUSYPOLL_H
+#define LOGID_FEATURE_BUSYPOLL_H
+
+#include <chrono>
+#include "DeviceFeature.h"
+
+namespace logid {
+namespace features
+{
+    /* Keeps the I/O thread of the device's node reading for a while after
+     * each report instead of blocking, trading CPU time for the latency of
+     * a wakeup. Not a device feature, only set up if configured. */
+    class BusyPoll : public DeviceFeature
+    {
+    public:
+        explicit BusyPoll(Device* dev);
+        ~BusyPoll();
+        virtual void configure();
+        virtual void listen();
+        virtual void reload();
+
+        class Config : public DeviceFeature::Config
+        {
+        public:
+            explicit Config(Device* dev);
+            // 0 if busy polling is off
+            std::chrono::microseconds getWindow() const;
+        protected:
+            std::chrono::microseconds _window;
+        };
+    private:
+        Config _config;
+    };
+}}
+
+#endif //LOGID_FEATURE_BUSYPOLL_H
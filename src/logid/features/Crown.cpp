@@ -0,0 +1,241 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "Crown.h"
+#include "../Device.h"
+#include "../InputDevice.h"
+#include "../util/arena.h"
+#include "../util/log.h"
+
+using namespace logid::features;
+using namespace logid::backend;
+using namespace logid;
+
+namespace
+{
+    std::shared_ptr<actions::Gesture> makeGesture(Device* dev,
+            libconfig::Setting& config_root, const char* name)
+    {
+        try {
+            auto& g_group = config_root.lookup(name);
+            try {
+                auto g = actions::Gesture::makeGesture(dev, g_group);
+                if(g->wheelCompatibility())
+                    return g;
+                logPrintf(WARN, "Line %d: This gesture cannot be used as a "
+                                "crown action.", g_group.getSourceLine());
+            } catch(actions::InvalidGesture& e) {
+                logPrintf(WARN, "Line %d: Invalid crown action",
+                        g_group.getSourceLine());
+            }
+        } catch(libconfig::SettingNotFoundException& e) { }
+        return nullptr;
+    }
+}
+
+Crown::Crown(Device* dev) : DeviceFeature(dev),
+    _config (std::make_shared<Config>(dev))
+{
+    try {
+        _crown = std::make_shared<hidpp20::Crown>(&dev->hidpp20());
+    } catch(hidpp20::UnsupportedFeature& e) {
+        throw UnsupportedFeature();
+    }
+
+    _prepareActions(*_config);
+    _wheel = _makeCoalescer(*_config);
+}
+
+Result<void> Crown::supported(Device* dev)
+{
+    return dev->hidpp20().tryFeatureIndex(hidpp20::Crown::ID);
+}
+
+std::shared_ptr<coalescer> Crown::_makeCoalescer(const Config& config)
+{
+    return std::make_shared<coalescer>(config.coalesceWindow(),
+            [this](int rotation) {
+        InputDevice::Frame frame(*virtual_input);
+        _rotate(rotation);
+    });
+}
+
+void Crown::_prepareActions(const Config& config)
+{
+    if(config.leftAction())
+        config.leftAction()->press(true);
+    if(config.rightAction())
+        config.rightAction()->press(true);
+}
+
+void Crown::configure()
+{
+    auto config = std::atomic_load(&_config);
+    _crown->setMode(config->divert() ? hidpp20::Crown::Diverted :
+            hidpp20::Crown::Native, config->rotation());
+}
+
+void Crown::listen()
+{
+    _device->hidpp20().addEventHandler(_crown->featureIndex(),
+            hidpp20::Crown::Event, [this](hidpp::Report& report)->void {
+        auto event = hidpp20::Crown::crownEvent(report);
+        // Movement read in one batch is passed on as one rotation
+        _pending_rotation += event.rotation;
+        if(_device->hidpp20().rawDevice()->sameReportFollows())
+            return;
+        int rotation = _pending_rotation;
+        _pending_rotation = 0;
+        if(rotation)
+            std::atomic_load(&_wheel)->add(rotation);
+    }, true);
+}
+
+void Crown::reload()
+{
+    auto config = std::make_shared<Config>(_device);
+    _prepareActions(*config);
+    auto old_config = std::atomic_exchange(&_config, config);
+    auto old_wheel = std::atomic_exchange(&_wheel, _makeCoalescer(*config));
+
+    // Rotation still pending goes out through the old actions first
+    old_wheel->flush([&old_config]() {
+        if(old_config->leftAction())
+            old_config->leftAction()->release();
+        if(old_config->rightAction())
+            old_config->rightAction()->release();
+    });
+
+    configure();
+}
+
+void Crown::_rotate(int rotation)
+{
+    auto config = std::atomic_load(&_config);
+    int8_t direction = rotation > 0 ? 1 : -1;
+    std::shared_ptr<actions::Gesture> scroll_action;
+    std::shared_ptr<actions::Gesture> opposite_scroll;
+
+    if(rotation > 0) {
+        scroll_action = config->rightAction();
+        opposite_scroll = config->leftAction();
+    } else {
+        scroll_action = config->leftAction();
+        opposite_scroll = config->rightAction();
+    }
+
+    if(direction != _last_direction) {
+        if(opposite_scroll)
+            opposite_scroll->release();
+        if(scroll_action)
+            scroll_action->press(true);
+    }
+
+    if(scroll_action)
+        scroll_action->move(direction * rotation);
+
+    _last_direction = direction;
+}
+
+Crown::Config::Config(Device* dev) : DeviceFeature::Config(dev)
+{
+    auto setting = dev->config().getSetting("crown");
+    if(!setting)
+        return; // Crown not configured, use default
+    auto& config_root = *setting;
+    // Actions and gestures made below are laid out together
+    arena::scope actions;
+
+    if(!config_root.isGroup()) {
+        logPrintf(WARN, "Line %d: crown must be a group",
+                  config_root.getSourceLine());
+        return;
+    }
+
+    try {
+        auto& divert = config_root.lookup("divert");
+        if(divert.getType() == libconfig::Setting::TypeBoolean)
+            _divert = divert;
+        else
+            logPrintf(WARN, "Line %d: divert must be a boolean",
+                      divert.getSourceLine());
+    } catch(libconfig::SettingNotFoundException& e) { }
+
+    try {
+        auto& ratchet = config_root.lookup("ratchet");
+        if(ratchet.getType() == libconfig::Setting::TypeBoolean)
+            _rotation = ratchet ? hidpp20::Crown::Ratchet :
+                    hidpp20::Crown::FreeSpin;
+        else
+            logPrintf(WARN, "Line %d: ratchet must be a boolean, ignoring.",
+                      ratchet.getSourceLine());
+    } catch(libconfig::SettingNotFoundException& e) { }
+
+    try {
+        auto& coalesce = config_root.lookup("coalesce");
+        std::chrono::milliseconds window(-1);
+        if(coalesce.getType() == libconfig::Setting::TypeFloat)
+            window = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::duration<double, std::milli>(coalesce));
+        else if(coalesce.isNumber())
+            window = std::chrono::milliseconds((int)coalesce);
+
+        if(window.count() >= 0)
+            _coalesce_window = window;
+        else
+            logPrintf(WARN, "Line %d: coalesce must be a non-negative "
+                            "number, ignoring.", coalesce.getSourceLine());
+    } catch(libconfig::SettingNotFoundException& e) { }
+
+    if(_divert) {
+        _left_action = makeGesture(dev, config_root, "left");
+        _right_action = makeGesture(dev, config_root, "right");
+
+        // Nothing to do with the events, so the crown stays native
+        if(!_left_action && !_right_action) {
+            _divert = false;
+            logPrintf(INFO, "Line %d: no crown action was set, leaving the "
+                            "crown undiverted", config_root.getSourceLine());
+        }
+    }
+}
+
+bool Crown::Config::divert() const
+{
+    return _divert;
+}
+
+hidpp20::Crown::Rotation Crown::Config::rotation() const
+{
+    return _rotation;
+}
+
+std::chrono::milliseconds Crown::Config::coalesceWindow() const
+{
+    return _coalesce_window;
+}
+
+const std::shared_ptr<actions::Gesture>& Crown::Config::leftAction() const
+{
+    return _left_action;
+}
+
+const std::shared_ptr<actions::Gesture>& Crown::Config::rightAction() const
+{
+    return _right_action;
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_FEATURE_CROWN_H
+#define LOGID_FEATURE_CROWN_H
+
+#include "../backend/hidpp20/features/Crown.h"
+#include "DeviceFeature.h"
+#include "../actions/gesture/Gesture.h"
+#include "../util/coalescer.h"
+
+namespace logid {
+namespace features
+{
+    /* Crown rotation goes to wheel gestures like the thumb wheel's. Spins
+     * are summed over the coalesce window, so a fast spin is not a write
+     * per step. */
+    class Crown : public DeviceFeature
+    {
+    public:
+        explicit Crown(Device* dev);
+        static backend::Result<void> supported(Device* dev);
+        virtual void configure();
+        virtual void listen();
+        virtual void reload();
+
+        class Config : public DeviceFeature::Config
+        {
+        public:
+            explicit Config(Device* dev);
+            bool divert() const;
+            backend::hidpp20::Crown::Rotation rotation() const;
+            std::chrono::milliseconds coalesceWindow() const;
+
+            const std::shared_ptr<actions::Gesture>& leftAction() const;
+            const std::shared_ptr<actions::Gesture>& rightAction() const;
+        protected:
+            bool _divert = false;
+            backend::hidpp20::Crown::Rotation _rotation =
+                    backend::hidpp20::Crown::Unchanged;
+            std::chrono::milliseconds _coalesce_window{0};
+
+            std::shared_ptr<actions::Gesture> _left_action;
+            std::shared_ptr<actions::Gesture> _right_action;
+        };
+    private:
+        void _rotate(int rotation);
+        void _prepareActions(const Config& config);
+        std::shared_ptr<coalescer> _makeCoalescer(const Config& config);
+
+        std::shared_ptr<backend::hidpp20::Crown> _crown;
+        int8_t _last_direction = 0;
+        // Swapped atomically on reload, event handlers load it once
+        std::shared_ptr<Config> _config;
+        std::shared_ptr<coalescer> _wheel;
+        // Summed while the same event follows in the batch
+        int _pending_rotation = 0;
+    };
+}}
+
+#endif //LOGID_FEATURE_CROWN_H
@@ -68,23 +68,55 @@ DPI::DPI(Device* device) : DeviceFeature(device), _config (device)
     }
 }
 
+Result<void> DPI::supported(Device* dev)
+{
+    return dev->hidpp20().tryFeatureIndex(hidpp20::AdjustableDPI::ID);
+}
+
 void DPI::configure()
 {
     const uint8_t sensors = _adjustable_dpi->getSensorCount();
-    for(uint8_t i = 0; i < _config.getSensorCount(); i++) {
-        hidpp20::AdjustableDPI::SensorDPIList dpi_list;
+
+    if(_dpi_lists.size() < _config.getSensorCount()) {
+        auto lists = _adjustable_dpi->getSensorDPILists(_dpi_lists.size(),
+                _config.getSensorCount() - _dpi_lists.size());
+        _dpi_lists.insert(_dpi_lists.end(), lists.begin(), lists.end());
+    }
+
+    hidpp20::Transaction set(&_device->hidpp20());
+    std::vector<std::pair<uint8_t, uint16_t>> written;
+    for(uint8_t i = 0; i < _config.getSensorCount() && i < sensors; i++) {
+        auto dpi = _config.getDPI(i);
+        if(dpi) {
+            auto closest = getClosestDPI(_dpi_lists[i], dpi);
+            _adjustable_dpi->setSensorDPI(set, i, closest);
+            written.emplace_back(i, closest);
+        }
+    }
+    set.commit();
+    for(std::size_t i = 0; i < set.size(); i++) {
+        set.response(i);
+        _dpi.set(written[i].first, written[i].second);
+    }
+}
+
+void DPI::reconfigure()
+{
+    const uint8_t sensors = _adjustable_dpi->getSensorCount();
+    for(uint8_t i = 0; i < _config.getSensorCount() && i < sensors; i++) {
+        auto dpi = _config.getDPI(i);
+        if(!dpi)
+            continue;
+
         if(_dpi_lists.size() <= i) {
-            dpi_list = _adjustable_dpi->getSensorDPIList(i);
-            _dpi_lists.push_back(dpi_list);
-        } else {
-            dpi_list = _dpi_lists[i];
+            configure();
+            return;
         }
-        if(i < sensors) {
-            auto dpi = _config.getDPI(i);
-            if(dpi) {
-                _adjustable_dpi->setSensorDPI(i, getClosestDPI(dpi_list,
-                        dpi));
-            }
+
+        auto closest = getClosestDPI(_dpi_lists[i], dpi);
+        if(getDPI(i) != closest) {
+            _adjustable_dpi->setSensorDPI(i, closest);
+            _dpi.set(i, closest);
         }
     }
 }
@@ -93,22 +125,61 @@ void DPI::listen()
 {
 }
 
+void DPI::reload()
+{
+    _config = Config(_device);
+    configure();
+}
+
+void DPI::invalidate()
+{
+    _dpi.invalidate();
+}
+
+DeviceFeature::MirrorState DPI::checkMirror()
+{
+    auto state = NotMirrored;
+    // Actions change sensor 0 even if the config does not set it
+    const uint8_t sensors = std::max<uint8_t>(_config.getSensorCount(), 1);
+    for(uint8_t i = 0; i < sensors; i++) {
+        uint16_t dpi;
+        if(!_dpi.peek(i, dpi))
+            continue;
+        if(_adjustable_dpi->getSensorDPI(i) != dpi)
+            return Lost;
+        state = Survived;
+    }
+    return state;
+}
+
 uint16_t DPI::getDPI(uint8_t sensor)
 {
-    return _adjustable_dpi->getSensorDPI(sensor);
+    return _dpi.get(sensor, [this, sensor]() {
+        return _adjustable_dpi->getSensorDPI(sensor);
+    });
+}
+
+bool DPI::cachedDPI(uint16_t& dpi, uint8_t sensor)
+{
+    return _dpi.peek(sensor, dpi);
 }
 
 void DPI::setDPI(uint16_t dpi, uint8_t sensor)
 {
-    hidpp20::AdjustableDPI::SensorDPIList dpi_list;
-    if(_dpi_lists.size() <= sensor) {
-        dpi_list = _adjustable_dpi->getSensorDPIList(sensor);
-        for(std::size_t i = _dpi_lists.size()-1; i <= sensor; i++) {
-            _dpi_lists.push_back(_adjustable_dpi->getSensorDPIList(i));
+    for(std::size_t i = _dpi_lists.size(); i <= sensor; i++)
+        _dpi_lists.push_back(_adjustable_dpi->getSensorDPIList(i));
+
+    auto closest = getClosestDPI(_dpi_lists[sensor], dpi);
+    // Read-modify-write actions build on a DPI that is still pending
+    _dpi.set(sensor, closest);
+    _dpi_writes.set(sensor, closest, [this, sensor](uint16_t value) {
+        try {
+            _adjustable_dpi->setSensorDPI(sensor, value);
+        } catch(...) {
+            _dpi.invalidate();
+            throw;
         }
-    }
-    dpi_list = _dpi_lists[sensor];
-    _adjustable_dpi->setSensorDPI(sensor, getClosestDPI(dpi_list, dpi));
+    });
 }
 
 /* Some devices have multiple sensors, but an older config format
@@ -117,20 +188,20 @@ void DPI::setDPI(uint16_t dpi, uint8_t sensor)
  */
 DPI::Config::Config(Device *dev) : DeviceFeature::Config(dev)
 {
-    try {
-        auto& config_root = dev->config().getSetting("dpi");
-        if(config_root.isNumber()) {
-            int dpi = config_root;
-            _dpis.push_back(dpi);
-        } else if(config_root.isArray()) {
-            for(int i = 0; i < config_root.getLength(); i++)
-                _dpis.push_back((int)config_root[i]);
-        } else {
-            logPrintf(WARN, "Line %d: dpi is improperly formatted",
-                    config_root.getSourceLine());
-        }
-    } catch(libconfig::SettingNotFoundException& e) {
-        // DPI not configured, use default
+    auto setting = dev->config().getSetting("dpi");
+    if(!setting)
+        return; // DPI not configured, use default
+    auto& config_root = *setting;
+
+    if(config_root.isNumber()) {
+        int dpi = config_root;
+        _dpis.push_back(dpi);
+    } else if(config_root.isArray()) {
+        for(int i = 0; i < config_root.getLength(); i++)
+            _dpis.push_back((int)config_root[i]);
+    } else {
+        logPrintf(WARN, "Line %d: dpi is improperly formatted",
+                config_root.getSourceLine());
     }
 }
 
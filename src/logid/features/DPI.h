@@ -20,6 +20,8 @@
 
 #include "../backend/hidpp20/features/AdjustableDPI.h"
 #include "DeviceFeature.h"
+#include "../util/state_mirror.h"
+#include "../util/write_combiner.h"
 
 namespace logid {
 namespace features
@@ -28,11 +30,18 @@ namespace features
     {
     public:
         explicit DPI(Device* dev);
+        static backend::Result<void> supported(Device* dev);
         virtual void configure();
+        virtual void reconfigure();
         virtual void listen();
+        virtual void reload();
+        virtual void invalidate();
+        virtual MirrorState checkMirror();
 
         uint16_t getDPI(uint8_t sensor=0);
         void setDPI(uint16_t dpi, uint8_t sensor=0);
+        // The mirrored DPI, false if it is not known without a request
+        bool cachedDPI(uint16_t& dpi, uint8_t sensor=0);
 
         class Config : public DeviceFeature::Config
         {
@@ -47,6 +56,10 @@ namespace features
         Config _config;
         std::shared_ptr<backend::hidpp20::AdjustableDPI> _adjustable_dpi;
         std::vector<backend::hidpp20::AdjustableDPI::SensorDPIList> _dpi_lists;
+        // Current DPI of each sensor, set before it is written
+        state_mirror<uint16_t> _dpi;
+        // Presses faster than the round trip only write the last DPI
+        write_combiner<uint16_t> _dpi_writes;
     };
  }}
 
@@ -20,6 +20,7 @@
 #define LOGID_FEATURES_DEVICEFEATURE_H
 
 #include <string>
+#include "../backend/Result.h"
 
 namespace logid {
     class Device;
@@ -41,8 +42,50 @@ namespace features
         explicit DeviceFeature(Device* dev) : _device (dev)
         {
         }
+        /* Device checks this before making a feature so that missing ones
+         * do not throw UnsupportedFeature. Features hide it. */
+        static backend::Result<void> supported(Device*)
+        {
+            return {};
+        }
         virtual void configure() = 0;
+        /* Called when the device wakes up, features that can read their
+         * state back only write what the device lost. */
+        virtual void reconfigure()
+        {
+            configure();
+        }
         virtual void listen() = 0;
+        /* Called when a config reload changed this feature's settings.
+         * Features rebuild their Config from the device's new settings and
+         * apply it. Features without settings have nothing to reload. */
+        virtual void reload()
+        {
+        }
+        /* Called after the device was reset or woke up, features drop any
+         * device state they mirror since it may no longer be accurate. */
+        virtual void invalidate()
+        {
+        }
+        /* Called on awake devices when battery mode starts or ends, see
+         * power.h. Features with settings for it apply them. */
+        virtual void powerChanged()
+        {
+        }
+
+        enum MirrorState
+        {
+            NotMirrored,    // Nothing mirrored to compare against
+            Survived,
+            Lost
+        };
+        /* Compares the mirrored state with the device without dropping it.
+         * After a system resume, tells a device that kept its state from
+         * one that lost power. */
+        virtual MirrorState checkMirror()
+        {
+            return NotMirrored;
+        }
         class Config
         {
         public:
@@ -56,6 +99,69 @@ namespace features
     protected:
         Device* _device;
     };
+
+    class DPI;
+    class SmartShift;
+    class HiresScroll;
+    class RemapButton;
+    class DeviceStatus;
+    class ThumbWheel;
+    class Battery;
+    class ReportRate;
+    class Lighting;
+    class GKeys;
+    class Crown;
+    class Touchpad;
+    class BusyPoll;
+
+    // Where Device keeps each feature, in the order they are set up
+    enum FeatureSlot
+    {
+        DPISlot,
+        SmartShiftSlot,
+        HiresScrollSlot,
+        RemapButtonSlot,
+        DeviceStatusSlot,
+        ThumbWheelSlot,
+        BatterySlot,
+        ReportRateSlot,
+        LightingSlot,
+        GKeysSlot,
+        CrownSlot,
+        TouchpadSlot,
+        BusyPollSlot,
+        FeatureSlotCount
+    };
+
+    /* Resolves a feature type to its slot at compile time, types without
+     * a specialization are not features. name is used in logs and as the
+     * key of writes deferred while the device is asleep. */
+    template<typename T>
+    struct feature_slot;
+
+#define LOGID_FEATURE_SLOT(type, feature_name) \
+    template<> \
+    struct feature_slot<type> \
+    { \
+        static constexpr FeatureSlot slot() { return type##Slot; } \
+        static constexpr const char* name() { return feature_name; } \
+    }
+
+    LOGID_FEATURE_SLOT(DPI, "dpi");
+    LOGID_FEATURE_SLOT(SmartShift, "smartshift");
+    LOGID_FEATURE_SLOT(HiresScroll, "hiresscroll");
+    LOGID_FEATURE_SLOT(RemapButton, "remapbutton");
+    LOGID_FEATURE_SLOT(DeviceStatus, "devicestatus");
+    LOGID_FEATURE_SLOT(ThumbWheel, "thumbwheel");
+    LOGID_FEATURE_SLOT(Battery, "battery");
+    LOGID_FEATURE_SLOT(ReportRate, "reportrate");
+    LOGID_FEATURE_SLOT(Lighting, "lighting");
+    LOGID_FEATURE_SLOT(GKeys, "gkeys");
+    LOGID_FEATURE_SLOT(Crown, "crown");
+    LOGID_FEATURE_SLOT(Touchpad, "touchpad");
+    LOGID_FEATURE_SLOT(BusyPoll, "busypoll");
+
+#undef LOGID_FEATURE_SLOT
 }}
 
 #endif //LOGID_FEATURES_DEVICEFEATURE_H
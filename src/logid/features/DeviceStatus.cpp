@@ -18,8 +18,6 @@
 #include "DeviceStatus.h"
 #include "../util/task.h"
 
-#define EVENTHANDLER_NAME "devicestatus"
-
 using namespace logid::features;
 using namespace logid::backend;
 
@@ -41,6 +39,16 @@ DeviceStatus::DeviceStatus(logid::Device *dev) : DeviceFeature(dev)
     }
 }
 
+Result<void> DeviceStatus::supported(Device* dev)
+{
+    if(dev->hidpp20().deviceIndex() >= hidpp::WirelessDevice1 &&
+       dev->hidpp20().deviceIndex() <= hidpp::WirelessDevice6)
+        return Failure(Failure::UnsupportedFeature,
+                hidpp20::WirelessDeviceStatus::ID);
+
+    return dev->hidpp20().tryFeatureIndex(hidpp20::WirelessDeviceStatus::ID);
+}
+
 void DeviceStatus::configure()
 {
     // Do nothing
@@ -48,23 +56,13 @@ void DeviceStatus::configure()
 
 void DeviceStatus::listen()
 {
-    if(_device->hidpp20().eventHandlers().find(EVENTHANDLER_NAME) ==
-       _device->hidpp20().eventHandlers().end()) {
-        auto handler = std::make_shared<hidpp::EventHandler>();
-        handler->condition = [index=_wireless_device_status->featureIndex()](
-                const hidpp::Report& report)->bool {
-            return report.feature() == index && report.function() ==
-                hidpp20::WirelessDeviceStatus::StatusBroadcast;
-        };
-
-        handler->callback = [dev=this->_device](
-                const hidpp::Report& report)->void {
-            auto event = hidpp20::WirelessDeviceStatus::statusBroadcastEvent(
-                    report);
-            if(event.reconfNeeded)
-                task::spawn([dev](){ dev->wakeup(); });
-        };
-
-        _device->hidpp20().addEventHandler(EVENTHANDLER_NAME, handler);
-    }
+    _device->hidpp20().addEventHandler(
+            _wireless_device_status->featureIndex(),
+            hidpp20::WirelessDeviceStatus::StatusBroadcast,
+            [dev=this->_device](hidpp::Report& report)->void {
+        auto event = hidpp20::WirelessDeviceStatus::statusBroadcastEvent(
+                report);
+        if(event.reconfNeeded)
+            task::spawn(task::Interactive, [dev](){ dev->wakeup(); });
+    });
 }
\ No newline at end of file
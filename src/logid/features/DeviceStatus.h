@@ -30,6 +30,7 @@ namespace features
     {
     public:
         explicit DeviceStatus(Device* dev);
+        static backend::Result<void> supported(Device* dev);
         virtual void configure();
         virtual void listen();
     private:
@@ -0,0 +1,193 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <cstdlib>
+#include "GKeys.h"
+#include "../Device.h"
+#include "../InputDevice.h"
+#include "../util/arena.h"
+#include "../util/log.h"
+
+using namespace logid::features;
+using namespace logid::backend;
+using namespace logid::actions;
+
+constexpr int GKeys::MKeyOffset;
+constexpr int GKeys::KeyCount;
+
+GKeys::GKeys(Device* dev) : DeviceFeature(dev),
+    _config (std::make_shared<Config>(dev)), _pressed_keys (0)
+{
+    try {
+        _g_key = std::make_shared<hidpp20::GKey>(&dev->hidpp20());
+    } catch(hidpp20::UnsupportedFeature& e) {
+        throw UnsupportedFeature();
+    }
+
+    auto m_key = hidpp20::makeFeature<hidpp20::MKey>(&dev->hidpp20());
+    if(m_key)
+        _m_key = *m_key;
+}
+
+GKeys::~GKeys()
+{
+    _device->hidpp20().removeEventHandler(_g_key->featureIndex(),
+            hidpp20::GKey::KeyEvent);
+    if(_m_key)
+        _device->hidpp20().removeEventHandler(_m_key->featureIndex(),
+                hidpp20::MKey::KeyEvent);
+}
+
+Result<void> GKeys::supported(Device* dev)
+{
+    return dev->hidpp20().tryFeatureIndex(hidpp20::GKey::ID);
+}
+
+void GKeys::configure()
+{
+    auto config = std::atomic_load(&_config);
+    _g_key->setSoftwareControl(config->divertsGKeys());
+}
+
+void GKeys::listen()
+{
+    _device->hidpp20().addEventHandler(_g_key->featureIndex(),
+            hidpp20::GKey::KeyEvent, [this](hidpp::Report& report)->void {
+        _keyEvent(hidpp20::GKey::keyEvent(report),
+                (1ull << MKeyOffset) - 1);
+    });
+
+    if(_m_key) {
+        _device->hidpp20().addEventHandler(_m_key->featureIndex(),
+                hidpp20::MKey::KeyEvent, [this](hidpp::Report& report)->void {
+            _keyEvent((uint64_t)hidpp20::MKey::keyEvent(report) << MKeyOffset,
+                    ((1ull << hidpp20::MKey::MaxKeys) - 1) << MKeyOffset);
+        });
+    }
+}
+
+void GKeys::reload()
+{
+    auto config = std::make_shared<Config>(_device);
+    {
+        // Release keys held down through the old actions
+        std::lock_guard<profiled_mutex> lock(_key_lock);
+        auto old_config = std::atomic_load(&_config);
+        uint64_t held = _pressed_keys.exchange(0);
+        InputDevice::Frame frame(*virtual_input);
+        for(; held; held &= held - 1) {
+            auto& action = old_config->action(__builtin_ctzll(held));
+            if(action)
+                action->release();
+        }
+        std::atomic_store(&_config, config);
+    }
+    configure();
+}
+
+void GKeys::_keyEvent(uint64_t held, uint64_t mask)
+{
+    std::lock_guard<profiled_mutex> lock(_key_lock);
+    auto config = std::atomic_load(&_config);
+    InputDevice::Frame frame(*virtual_input);
+
+    const uint64_t old_state = _pressed_keys.load(std::memory_order_relaxed);
+    const uint64_t new_state = (old_state & ~mask) | (held & mask);
+    const uint64_t changed = old_state ^ new_state;
+
+    for(uint64_t added = changed & new_state; added; added &= added - 1) {
+        auto& action = config->action(__builtin_ctzll(added));
+        if(action)
+            action->press();
+    }
+    for(uint64_t removed = changed & old_state; removed;
+            removed &= removed - 1) {
+        auto& action = config->action(__builtin_ctzll(removed));
+        if(action)
+            action->release();
+    }
+
+    _pressed_keys.store(new_state, std::memory_order_release);
+}
+
+GKeys::Config::Config(Device* dev) : DeviceFeature::Config(dev)
+{
+    auto setting = dev->config().getSetting("gkeys");
+    if(!setting)
+        return; // G keys not configured, leave them to the device
+    auto& config_root = *setting;
+    // Actions and gestures made below are laid out together
+    arena::scope actions;
+
+    if(!config_root.isList()) {
+        logPrintf(WARN, "Line %d: gkeys must be a list.",
+                config_root.getSourceLine());
+        return;
+    }
+
+    for(int i = 0; i < config_root.getLength(); i++) {
+        auto& key = config_root[i];
+        std::string name;
+        if(!key.isGroup() || !key.lookupValue("key", name) ||
+           name.size() < 2) {
+            logPrintf(WARN, "Line %d: G key needs a key such as \"G1\" or "
+                            "\"M1\", ignoring.", key.getSourceLine());
+            continue;
+        }
+
+        char* end = nullptr;
+        long number = std::strtol(name.c_str() + 1, &end, 10);
+        int index = -1;
+        if(*end || number < 1)
+            index = -1;
+        else if((name[0] == 'G' || name[0] == 'g') &&
+                number <= hidpp20::GKey::MaxKeys)
+            index = number - 1;
+        else if((name[0] == 'M' || name[0] == 'm') &&
+                number <= hidpp20::MKey::MaxKeys)
+            index = MKeyOffset + number - 1;
+        if(index < 0) {
+            logPrintf(WARN, "Line %d: %s is not a G or M key, ignoring.",
+                    key.getSourceLine(), name.c_str());
+            continue;
+        }
+
+        try {
+            _actions[index] = Action::makeAction(_device,
+                    key.lookup("action"));
+            if(index < MKeyOffset)
+                _diverts_g_keys = true;
+        } catch(libconfig::SettingNotFoundException& e) {
+            logPrintf(WARN, "Line %d: action is required, ignoring.",
+                    key.getSourceLine());
+        } catch(InvalidAction& e) {
+            logPrintf(WARN, "Line %d: %s is not a valid action, ignoring.",
+                    key["action"].getSourceLine(), e.what());
+        }
+    }
+}
+
+const std::shared_ptr<Action>& GKeys::Config::action(int key) const
+{
+    return _actions[key];
+}
+
+bool GKeys::Config::divertsGKeys() const
+{
+    return _diverts_g_keys;
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_FEATURE_GKEYS_H
+#define LOGID_FEATURE_GKEYS_H
+
+#include <array>
+#include <atomic>
+#include "../backend/hidpp20/features/GKey.h"
+#include "../backend/hidpp20/features/MKey.h"
+#include "DeviceFeature.h"
+#include "../actions/Action.h"
+#include "../util/profiled_mutex.h"
+
+namespace logid {
+namespace features
+{
+    /* Macro keys of gaming keyboards, diverted to actions. Key events are
+     * handled on the I/O thread, the actions of one report are sent as a
+     * single input frame. */
+    class GKeys : public DeviceFeature
+    {
+    public:
+        // G keys are numbered from 0, M keys from MKeyOffset
+        static constexpr int MKeyOffset = backend::hidpp20::GKey::MaxKeys;
+        static constexpr int KeyCount = MKeyOffset +
+                backend::hidpp20::MKey::MaxKeys;
+
+        explicit GKeys(Device* dev);
+        ~GKeys();
+        static backend::Result<void> supported(Device* dev);
+        virtual void configure();
+        virtual void listen();
+        virtual void reload();
+
+        class Config : public DeviceFeature::Config
+        {
+        public:
+            explicit Config(Device* dev);
+            // Null for keys that are left to the device
+            const std::shared_ptr<actions::Action>& action(int key) const;
+            bool divertsGKeys() const;
+        private:
+            std::array<std::shared_ptr<actions::Action>, KeyCount> _actions;
+            bool _diverts_g_keys = false;
+        };
+    private:
+        // Keys in mask are held if they are set in held
+        void _keyEvent(uint64_t held, uint64_t mask);
+
+        // Swapped atomically on reload, event handlers load it once
+        std::shared_ptr<Config> _config;
+        std::shared_ptr<backend::hidpp20::GKey> _g_key;
+        // Null if the device has no M keys
+        std::shared_ptr<backend::hidpp20::MKey> _m_key;
+        std::atomic<uint64_t> _pressed_keys;
+        profiled_mutex _key_lock{"GKeys::_key_lock"};
+    };
+}}
+
+#endif //LOGID_FEATURE_GKEYS_H
@@ -20,13 +20,13 @@
 #include "../InputDevice.h"
 #include "../actions/gesture/Gesture.h"
 #include "../actions/gesture/AxisGesture.h"
+#include "../util/arena.h"
 
 using namespace logid::features;
 using namespace logid::backend;
 
-#define MOVE_EVENTHANDLER_NAME "HIRES_SCROLL"
-
-HiresScroll::HiresScroll(Device *dev) : DeviceFeature(dev), _config(dev)
+HiresScroll::HiresScroll(Device *dev) : DeviceFeature(dev),
+    _config (std::make_shared<Config>(dev))
 {
     try {
         _hires_scroll = std::make_shared<hidpp20::HiresScroll>(&dev->hidpp20());
@@ -34,207 +34,312 @@ HiresScroll::HiresScroll(Device *dev) : DeviceFeature(dev), _config(dev)
         throw UnsupportedFeature();
     }
 
-    if(_config.upAction()) {
+    // Paired devices are children of the receiver's HID device
+    auto& driver = dev->hidpp20().rawDevice()->kernelDriver();
+    _kernel_driver = driver == "logitech-hidpp-device" ||
+            driver == "logitech-djreceiver";
+    if(_kernel_driver && (_config->getMask() & ~_config->getMode() &
+            hidpp20::HiresScroll::Mode::HiRes))
+        logPrintf(INFO, "%s: hires is off in the config but the kernel "
+                        "driver may turn it back on.", dev->name().c_str());
+
+    _prepareActions(*_config);
+    _wheel = _makeCoalescer(_config);
+}
+
+Result<void> HiresScroll::supported(Device* dev)
+{
+    return dev->hidpp20().tryFeatureIndex(hidpp20::HiresScroll::ID);
+}
+
+std::shared_ptr<logid::coalescer> HiresScroll::_makeCoalescer(
+        const std::shared_ptr<Config>& config)
+{
+    // The session lives with the actions it arms, a reload starts anew
+    return std::make_shared<coalescer>(config->coalesceWindow(),
+            [config, session=scroll_session(config->idleTimeout())]
+            (int delta) mutable {
+        InputDevice::Frame frame(*virtual_input);
+        _scroll(*config, session, delta);
+    });
+}
+
+void HiresScroll::_prepareActions(const Config& config)
+{
+    int multiplier = 1;
+    if(config.upAction() || config.downAction())
+        multiplier = _hires_scroll->getCapabilities().multiplier;
+
+    if(config.upAction()) {
         try {
             auto up_axis = std::dynamic_pointer_cast<actions::AxisGesture>(
-                    _config.upAction());
+                    config.upAction());
             if(up_axis)
-                up_axis->setHiresMultiplier(
-                        _hires_scroll->getCapabilities().multiplier);
+                up_axis->setHiresMultiplier(multiplier);
         } catch(std::bad_cast& e) { }
 
-        _config.upAction()->press(true);
+        config.upAction()->press(true);
     }
 
-    if(_config.downAction()) {
+    if(config.downAction()) {
         try {
             auto down_axis = std::dynamic_pointer_cast<actions::AxisGesture>(
-                    _config.downAction());
+                    config.downAction());
             if(down_axis)
-                down_axis->setHiresMultiplier(
-                        _hires_scroll->getCapabilities().multiplier);
+                down_axis->setHiresMultiplier(multiplier);
         } catch(std::bad_cast& e) { }
 
-        _config.downAction()->press(true);
+        config.downAction()->press(true);
     }
-
-    _last_scroll = std::chrono::system_clock::now();
 }
 
 HiresScroll::~HiresScroll()
 {
-    _device->hidpp20().removeEventHandler(MOVE_EVENTHANDLER_NAME);
+    _device->hidpp20().removeEventHandler(_hires_scroll->featureIndex(),
+            hidpp20::HiresScroll::WheelMovement);
 }
 
 void HiresScroll::configure()
 {
-    auto mode = _hires_scroll->getMode();
-    mode &= ~_config.getMask();
-    mode |= (_config.getMode() & _config.getMask());
-    _hires_scroll->setMode(mode);
+    auto config = std::atomic_load(&_config);
+    uint8_t mask = config->getMask();
+    if(config->getMode() & hidpp20::HiresScroll::Mode::HiRes) {
+        if(_kernel_driver && !_kernel_hires)
+            _kernel_hires = getMode() & hidpp20::HiresScroll::Mode::HiRes;
+        // Left to the kernel, which sets it again on every connect
+        if(_kernel_hires)
+            mask &= ~hidpp20::HiresScroll::Mode::HiRes;
+    }
+    if(!mask)
+        return;
+
+    auto mode = getMode();
+    uint8_t wanted = (mode & ~mask) | (config->getMode() & mask);
+    if(wanted != mode)
+        setMode(wanted);
+}
+
+void HiresScroll::invalidate()
+{
+    _mode.invalidate();
+}
+
+DeviceFeature::MirrorState HiresScroll::checkMirror()
+{
+    uint8_t mode;
+    if(!_mode.peek(mode))
+        return NotMirrored;
+    return _hires_scroll->getMode() == mode ? Survived : Lost;
 }
 
 void HiresScroll::listen()
 {
-    if(_device->hidpp20().eventHandlers().find(MOVE_EVENTHANDLER_NAME) ==
-       _device->hidpp20().eventHandlers().end()) {
-        auto handler = std::make_shared<hidpp::EventHandler>();
-        handler->condition = [index=_hires_scroll->featureIndex()]
-                (hidpp::Report& report)->bool {
-            return (report.feature() == index) && (report.function() ==
-                hidpp20::HiresScroll::WheelMovement);
-        };
-
-        handler->callback = [this](hidpp::Report& report)->void {
-            this->_handleScroll(_hires_scroll->wheelMovementEvent(report));
-        };
-
-        _device->hidpp20().addEventHandler(MOVE_EVENTHANDLER_NAME, handler);
-    }
+    _device->hidpp20().addEventHandler(_hires_scroll->featureIndex(),
+            hidpp20::HiresScroll::WheelMovement,
+            [this](hidpp::Report& report)->void {
+        this->_handleScroll(_hires_scroll->wheelMovementEvent(report));
+    }, true);
+}
+
+void HiresScroll::reload()
+{
+    auto config = std::make_shared<Config>(_device);
+    _prepareActions(*config);
+    auto old_config = std::atomic_exchange(&_config, config);
+    auto old_wheel = std::atomic_exchange(&_wheel, _makeCoalescer(config));
+
+    // Movement still pending goes out through the old actions first
+    old_wheel->flush([&old_config]() {
+        if(old_config->upAction())
+            old_config->upAction()->release();
+        if(old_config->downAction())
+            old_config->downAction()->release();
+    });
+
+    configure();
 }
 
 uint8_t HiresScroll::getMode()
 {
-    return _hires_scroll->getMode();
+    return _mode.get([this]() { return _hires_scroll->getMode(); });
+}
+
+bool HiresScroll::cachedMode(uint8_t& mode)
+{
+    return _mode.peek(mode);
 }
 
 void HiresScroll::setMode(uint8_t mode)
 {
     _hires_scroll->setMode(mode);
+    _mode.set(mode);
+}
+
+void HiresScroll::toggleMode(uint8_t mask)
+{
+    std::lock_guard<std::mutex> lock(_toggle_lock);
+    uint8_t mode = getMode() ^ mask;
+    _hires_scroll->setModeNoResponse(mode);
+    _mode.set(mode);
 }
 
 void HiresScroll::_handleScroll(hidpp20::HiresScroll::WheelStatus event)
 {
-    auto now = std::chrono::system_clock::now();
-    if(std::chrono::duration_cast<std::chrono::seconds>(
-            now - _last_scroll).count() >= 1) {
-        if(_config.upAction()) {
-            _config.upAction()->release();
-            _config.upAction()->press(true);
-        }
-        if(_config.downAction()) {
-            _config.downAction()->release();
-            _config.downAction()->press(true);
-        }
+    // Movement read in one batch is passed on as one delta
+    _pending_delta += event.deltaV;
+    if(_device->hidpp20().rawDevice()->sameReportFollows())
+        return;
+    int delta = _pending_delta;
+    _pending_delta = 0;
+    if(delta)
+        std::atomic_load(&_wheel)->add(delta);
+}
 
-        _last_direction = 0;
-    }
+void HiresScroll::_scroll(const Config& config, scroll_session& session,
+        int delta)
+{
+    if(delta == 0)
+        return;
 
-    if(event.deltaV > 0) {
-        if(_last_direction == -1) {
-            if(_config.downAction()){
-                _config.downAction()->release();
-                _config.downAction()->press(true);
-            }
+    int8_t direction = delta > 0 ? 1 : -1;
+    int8_t rearm = session.step(direction);
+    if(rearm) {
+        auto& action = rearm > 0 ? config.upAction() : config.downAction();
+        if(action) {
+            action->release();
+            action->press(true);
         }
-        if(_config.upAction())
-            _config.upAction()->move(event.deltaV);
-        _last_direction = 1;
-    } else if(event.deltaV < 0) {
-        if(_last_direction == 1) {
-            if(_config.upAction()){
-                _config.upAction()->release();
-                _config.upAction()->press(true);
-            }
-        }
-        if(_config.downAction())
-            _config.downAction()->move(-event.deltaV);
-        _last_direction = -1;
     }
 
-    _last_scroll = now;
+    auto& action = direction > 0 ? config.upAction() : config.downAction();
+    if(action)
+        action->move(direction * delta);
 }
 
 HiresScroll::Config::Config(Device *dev) : DeviceFeature::Config(dev)
 {
+    auto setting = dev->config().getSetting("hiresscroll");
+    if(!setting)
+        return; // HiresScroll not configured, use default
+    auto& config_root = *setting;
+    // Actions and gestures made below are laid out together
+    arena::scope actions;
+
+    if(!config_root.isGroup()) {
+        logPrintf(WARN, "Line %d: hiresscroll must be a group",
+                  config_root.getSourceLine());
+        return;
+    }
+    _mode = 0;
+    _mask = 0;
     try {
-        auto& config_root = dev->config().getSetting("hiresscroll");
-        if(!config_root.isGroup()) {
-            logPrintf(WARN, "Line %d: hiresscroll must be a group",
-                      config_root.getSourceLine());
-            return;
+        auto& hires = config_root.lookup("hires");
+        if(hires.getType() == libconfig::Setting::TypeBoolean) {
+            _mask |= hidpp20::HiresScroll::Mode::HiRes;
+            if(hires)
+                _mode |= hidpp20::HiresScroll::Mode::HiRes;
+        } else {
+            logPrintf(WARN, "Line %d: hires must be a boolean",
+                hires.getSourceLine());
         }
-        _mode = 0;
-        _mask = 0;
-        try {
-            auto& hires = config_root.lookup("hires");
-            if(hires.getType() == libconfig::Setting::TypeBoolean) {
-                _mask |= hidpp20::HiresScroll::Mode::HiRes;
-                if(hires)
-                    _mode |= hidpp20::HiresScroll::Mode::HiRes;
-            } else {
-                logPrintf(WARN, "Line %d: hires must be a boolean",
-                    hires.getSourceLine());
-            }
-        } catch(libconfig::SettingNotFoundException& e) { }
+    } catch(libconfig::SettingNotFoundException& e) { }
 
-        try {
-            auto& invert = config_root.lookup("invert");
-            if(invert.getType() == libconfig::Setting::TypeBoolean) {
-                _mask |= hidpp20::HiresScroll::Mode::Inverted;
-                if(invert)
-                    _mode |= hidpp20::HiresScroll::Mode::Inverted;
-            } else {
-                logPrintf(WARN, "Line %d: invert must be a boolean, ignoring.",
-                          invert.getSourceLine());
-            }
-        } catch(libconfig::SettingNotFoundException& e) { }
+    try {
+        auto& invert = config_root.lookup("invert");
+        if(invert.getType() == libconfig::Setting::TypeBoolean) {
+            _mask |= hidpp20::HiresScroll::Mode::Inverted;
+            if(invert)
+                _mode |= hidpp20::HiresScroll::Mode::Inverted;
+        } else {
+            logPrintf(WARN, "Line %d: invert must be a boolean, ignoring.",
+                      invert.getSourceLine());
+        }
+    } catch(libconfig::SettingNotFoundException& e) { }
 
-        try {
-            auto& target = config_root.lookup("target");
-            if(target.getType() == libconfig::Setting::TypeBoolean) {
-                _mask |= hidpp20::HiresScroll::Mode::Target;
-                if(target)
-                    _mode |= hidpp20::HiresScroll::Mode::Target;
-            } else {
-                logPrintf(WARN, "Line %d: target must be a boolean, ignoring.",
-                          target.getSourceLine());
-            }
-        } catch(libconfig::SettingNotFoundException& e) { }
+    try {
+        auto& target = config_root.lookup("target");
+        if(target.getType() == libconfig::Setting::TypeBoolean) {
+            _mask |= hidpp20::HiresScroll::Mode::Target;
+            if(target)
+                _mode |= hidpp20::HiresScroll::Mode::Target;
+        } else {
+            logPrintf(WARN, "Line %d: target must be a boolean, ignoring.",
+                      target.getSourceLine());
+        }
+    } catch(libconfig::SettingNotFoundException& e) { }
+
+    try {
+        auto& coalesce = config_root.lookup("coalesce");
+        std::chrono::milliseconds window(-1);
+        if(coalesce.getType() == libconfig::Setting::TypeFloat)
+            window = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::duration<double, std::milli>(coalesce));
+        else if(coalesce.isNumber())
+            window = std::chrono::milliseconds((int)coalesce);
 
-        if(_mode & hidpp20::HiresScroll::Mode::Target) {
+        if(window.count() >= 0)
+            _coalesce_window = window;
+        else
+            logPrintf(WARN, "Line %d: coalesce must be a non-negative "
+                            "number, ignoring.", coalesce.getSourceLine());
+    } catch(libconfig::SettingNotFoundException& e) { }
+
+    try {
+        auto& idle = config_root.lookup("idle_timeout");
+        if(idle.isNumber() && (int)idle >= 0)
+            _idle_timeout = std::chrono::milliseconds((int)idle);
+        else
+            logPrintf(WARN, "Line %d: idle_timeout must be a non-negative "
+                            "number, ignoring.", idle.getSourceLine());
+    } catch(libconfig::SettingNotFoundException& e) { }
+
+    if(_mode & hidpp20::HiresScroll::Mode::Target) {
+        try {
+            auto& up = config_root.lookup("up");
             try {
-                auto& up = config_root.lookup("up");
-                try {
-                    auto g = actions::Gesture::makeGesture(dev, up);
-                    if(g->wheelCompatibility()) {
-                        _up_action = g;
-                    } else {
-                        logPrintf(WARN, "Line %d: This gesture cannot be used"
-                                        " as a scroll action.",
-                                        up.getSourceLine());
-                    }
-                } catch(actions::InvalidGesture& e) {
-                    logPrintf(WARN, "Line %d: Invalid scroll action",
-                            up.getSourceLine());
+                auto g = actions::Gesture::makeGesture(dev, up);
+                if(g->wheelCompatibility()) {
+                    _up_action = g;
+                } else {
+                    logPrintf(WARN, "Line %d: This gesture cannot be used"
+                                    " as a scroll action.",
+                                    up.getSourceLine());
                 }
-            } catch(libconfig::SettingNotFoundException&) {
-                logPrintf(WARN, "Line %d: target is true but no up action was"
-                                " set", config_root.getSourceLine());
+            } catch(actions::InvalidGesture& e) {
+                logPrintf(WARN, "Line %d: Invalid scroll action",
+                        up.getSourceLine());
             }
+        } catch(libconfig::SettingNotFoundException&) {
+            logPrintf(WARN, "Line %d: target is true but no up action was"
+                            " set", config_root.getSourceLine());
+        }
 
+        try {
+            auto& down = config_root.lookup("down");
             try {
-                auto& down = config_root.lookup("down");
-                try {
-                    auto g = actions::Gesture::makeGesture(dev, down);
-                    if(g->wheelCompatibility()) {
-                        _down_action = g;
-                    } else {
-                        logPrintf(WARN, "Line %d: This gesture cannot be used"
-                                        " as a scroll action.",
-                                  down.getSourceLine());
-                    }
-                } catch(actions::InvalidGesture& e) {
-                    logPrintf(WARN, "Line %d: Invalid scroll action",
+                auto g = actions::Gesture::makeGesture(dev, down);
+                if(g->wheelCompatibility()) {
+                    _down_action = g;
+                } else {
+                    logPrintf(WARN, "Line %d: This gesture cannot be used"
+                                    " as a scroll action.",
                               down.getSourceLine());
                 }
-            } catch(libconfig::SettingNotFoundException&) {
-                logPrintf(WARN, "Line %d: target is true but no down action was"
-                                " set", config_root.getSourceLine());
+            } catch(actions::InvalidGesture& e) {
+                logPrintf(WARN, "Line %d: Invalid scroll action",
+                          down.getSourceLine());
             }
+        } catch(libconfig::SettingNotFoundException&) {
+            logPrintf(WARN, "Line %d: target is true but no down action was"
+                            " set", config_root.getSourceLine());
+        }
+
+        // Nothing to do with the events, so the wheel scrolls natively
+        if(!_up_action && !_down_action) {
+            _mode &= ~hidpp20::HiresScroll::Mode::Target;
+            logPrintf(INFO, "Line %d: no scroll action was set, leaving the "
+                            "wheel undiverted", config_root.getSourceLine());
         }
-    } catch(libconfig::SettingNotFoundException& e) {
-        // HiresScroll not configured, use default
     }
 }
 
@@ -248,6 +353,16 @@ uint8_t HiresScroll::Config::getMask() const
     return _mask;
 }
 
+std::chrono::milliseconds HiresScroll::Config::coalesceWindow() const
+{
+    return _coalesce_window;
+}
+
+std::chrono::milliseconds HiresScroll::Config::idleTimeout() const
+{
+    return _idle_timeout;
+}
+
 const std::shared_ptr<logid::actions::Gesture>&
         HiresScroll::Config::upAction() const
 {
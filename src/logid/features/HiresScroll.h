@@ -21,6 +21,9 @@
 #include "../backend/hidpp20/features/HiresScroll.h"
 #include "DeviceFeature.h"
 #include "../actions/gesture/Gesture.h"
+#include "../util/coalescer.h"
+#include "../util/scroll_session.h"
+#include "../util/state_mirror.h"
 
 namespace logid {
 namespace features
@@ -29,12 +32,20 @@ namespace features
     {
     public:
         explicit HiresScroll(Device* dev);
+        static backend::Result<void> supported(Device* dev);
         ~HiresScroll();
         virtual void configure();
         virtual void listen();
+        virtual void reload();
+        virtual void invalidate();
+        virtual MirrorState checkMirror();
 
         uint8_t getMode();
         void setMode(uint8_t mode);
+        // Flips the bits in mask with a single write
+        void toggleMode(uint8_t mask);
+        // The mirrored mode, false if it is not known without a request
+        bool cachedMode(uint8_t& mode);
 
         class Config : public DeviceFeature::Config
         {
@@ -42,22 +53,42 @@ namespace features
             explicit Config(Device* dev);
             uint8_t getMode() const;
             uint8_t getMask() const;
+            // Wheel movement within this window is sent as one event
+            std::chrono::milliseconds coalesceWindow() const;
+            // Actions are re-armed after the wheel was idle this long
+            std::chrono::milliseconds idleTimeout() const;
 
             const std::shared_ptr<actions::Gesture>& upAction() const;
             const std::shared_ptr<actions::Gesture>& downAction() const;
         protected:
             uint8_t _mode;
             uint8_t _mask;
+            std::chrono::milliseconds _coalesce_window{0};
+            std::chrono::milliseconds _idle_timeout{1000};
 
             std::shared_ptr<actions::Gesture> _up_action;
             std::shared_ptr<actions::Gesture> _down_action;
         };
     private:
         void _handleScroll(backend::hidpp20::HiresScroll::WheelStatus event);
+        static void _scroll(const Config& config, scroll_session& session,
+                int delta);
+        void _prepareActions(const Config& config);
+        std::shared_ptr<coalescer> _makeCoalescer(
+                const std::shared_ptr<Config>& config);
         std::shared_ptr<backend::hidpp20::HiresScroll> _hires_scroll;
-        std::chrono::time_point<std::chrono::system_clock> _last_scroll;
-        int16_t _last_direction = 0;
-        Config _config;
+        state_mirror<uint8_t> _mode;
+        /* hid-logitech-hidpp is bound to the device, recent kernels turn
+         * hi-res mode on whenever it connects. Only trusted once the mode
+         * was seen set. */
+        bool _kernel_driver;
+        bool _kernel_hires = false;
+        std::mutex _toggle_lock;
+        // Swapped atomically on reload, event handlers load it once
+        std::shared_ptr<Config> _config;
+        std::shared_ptr<coalescer> _wheel;
+        // Summed while the same event follows in the batch
+        int _pending_delta = 0;
     };
 }}
 
@@ -0,0 +1,218 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include "Lighting.h"
+#include "../Device.h"
+#include "../util/log.h"
+#include "../util/task.h"
+
+using namespace logid::features;
+using namespace logid::backend;
+using namespace std::chrono;
+
+Lighting::Lighting(Device* device) : DeviceFeature(device),
+    _config (device), _interval (_config.frameInterval()), _scheduled (false)
+{
+    try {
+        _lighting = std::make_shared<hidpp20::PerKeyLighting>(
+                &device->hidpp20());
+    } catch (hidpp20::UnsupportedFeature& e) {
+        throw UnsupportedFeature();
+    }
+}
+
+Lighting::~Lighting()
+{
+    std::shared_ptr<timer> frame_timer;
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        frame_timer = std::move(_frame_timer);
+    }
+    // Waits for a frame being written
+    if(frame_timer)
+        frame_timer->cancel();
+}
+
+Result<void> Lighting::supported(Device* dev)
+{
+    return dev->hidpp20().tryFeatureIndex(hidpp20::PerKeyLighting::ID);
+}
+
+void Lighting::configure()
+{
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        _interval = _config.frameInterval();
+        for(auto& zone : _config.frame())
+            _wanted[zone.first] = zone.second;
+    }
+    _flush();
+}
+
+void Lighting::listen()
+{
+}
+
+void Lighting::reload()
+{
+    _config = Config(_device);
+    configure();
+}
+
+void Lighting::invalidate()
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    _shown.clear();
+}
+
+void Lighting::setFrame(const Frame& frame)
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    for(auto& zone : frame)
+        _wanted[zone.first] = zone.second;
+    if(_scheduled)
+        return;
+
+    _scheduled = true;
+    auto now = steady_clock::now();
+    auto due = _last_frame + _interval;
+    auto delay = due > now ? duration_cast<milliseconds>(due - now) :
+            milliseconds(0);
+    _frame_timer = task::spawnAfter(delay, [this]() { _flush(); },
+            [path=_device->path(), index=_device->index()](
+                    std::exception& e) {
+        logPrintf(WARN, "%s:%d: Could not set lighting: %s", path.c_str(),
+                index, e.what());
+    });
+}
+
+void Lighting::_flush()
+{
+    std::lock_guard<std::mutex> flush_lock(_flush_lock);
+    Frame changed;
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        _scheduled = false;
+        _last_frame = steady_clock::now();
+        for(auto& zone : _wanted) {
+            auto shown = _shown.find(zone.first);
+            if(shown == _shown.end() || shown->second != zone.second)
+                changed.insert(zone);
+        }
+    }
+    if(changed.empty())
+        return;
+
+    std::map<Color, std::vector<uint8_t>> by_color;
+    for(auto& zone : changed)
+        by_color[zone.second].push_back(zone.first);
+
+    /* A color shared by enough zones to fill an individual report goes
+     * in single value reports, what is left is packed four to a report */
+    hidpp20::Transaction transaction(&_device->hidpp20());
+    std::vector<std::pair<uint8_t, Color>> individual;
+    for(auto& group : by_color) {
+        auto& zones = group.second;
+        std::size_t i = 0;
+        while(zones.size() - i >= hidpp20::PerKeyLighting::IndividualZones) {
+            auto count = std::min(zones.size() - i,
+                    hidpp20::PerKeyLighting::SingleValueZones);
+            _lighting->setZonesSingleValue(transaction, group.first,
+                    std::vector<uint8_t>(zones.begin() + i,
+                            zones.begin() + i + count));
+            i += count;
+        }
+        for(; i < zones.size(); i++) {
+            individual.emplace_back(zones[i], group.first);
+            if(individual.size() == hidpp20::PerKeyLighting::IndividualZones) {
+                _lighting->setIndividualZones(transaction, individual);
+                individual.clear();
+            }
+        }
+    }
+    if(!individual.empty())
+        _lighting->setIndividualZones(transaction, individual);
+    _lighting->frameEnd(transaction);
+    transaction.commit();
+
+    // The whole frame is sent again if any part of it failed
+    for(std::size_t i = 0; i < transaction.size(); i++)
+        transaction.response(i);
+
+    std::lock_guard<std::mutex> lock(_lock);
+    for(auto& zone : changed)
+        _shown[zone.first] = zone.second;
+}
+
+Lighting::Config::Config(Device* dev) : DeviceFeature::Config(dev),
+    _interval (1000 / LOGID_LIGHTING_DEFAULT_FPS)
+{
+    auto setting = dev->config().getSetting("lighting");
+    if(!setting)
+        return; // Lighting not configured, leave it as it is
+    auto& config_root = *setting;
+
+    if(!config_root.isGroup()) {
+        logPrintf(WARN, "Line %d: lighting must be a group",
+                config_root.getSourceLine());
+        return;
+    }
+
+    try {
+        auto& fps = config_root.lookup("fps");
+        if(fps.getType() == libconfig::Setting::TypeInt &&
+           (int)fps > 0 && (int)fps <= 1000)
+            _interval = milliseconds(1000 / (int)fps);
+        else
+            logPrintf(WARN, "Line %d: fps must be between 1 and 1000, "
+                            "ignoring.", fps.getSourceLine());
+    } catch(libconfig::SettingNotFoundException& e) { }
+
+    try {
+        auto& keys = config_root.lookup("keys");
+        if(!keys.isList()) {
+            logPrintf(WARN, "Line %d: keys must be a list, ignoring.",
+                    keys.getSourceLine());
+            return;
+        }
+        for(int i = 0; i < keys.getLength(); i++) {
+            auto& key = keys[i];
+            int zone, color;
+            if(!key.isGroup() || !key.lookupValue("zone", zone) ||
+               !key.lookupValue("color", color) || zone < 0 ||
+               zone > UINT8_MAX || color < 0 || color > 0xffffff) {
+                logPrintf(WARN, "Line %d: keys need a zone and a 0xRRGGBB "
+                                "color, skipping.", key.getSourceLine());
+                continue;
+            }
+            _frame[zone] = {(uint8_t)(color >> 16), (uint8_t)(color >> 8),
+                    (uint8_t)color};
+        }
+    } catch(libconfig::SettingNotFoundException& e) { }
+}
+
+const Lighting::Frame& Lighting::Config::frame() const
+{
+    return _frame;
+}
+
+milliseconds Lighting::Config::frameInterval() const
+{
+    return _interval;
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_FEATURE_LIGHTING_H
+#define LOGID_FEATURE_LIGHTING_H
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include "../backend/hidpp20/features/PerKeyLighting.h"
+#include "DeviceFeature.h"
+#include "../util/timer_wheel.h"
+
+#define LOGID_LIGHTING_DEFAULT_FPS 30
+
+namespace logid {
+namespace features
+{
+    /* Per-key colors, set from the config and by setFrame(). Only zones
+     * that differ from what the device shows are written, packed into
+     * as few reports as possible and pipelined in one transaction. */
+    class Lighting : public DeviceFeature
+    {
+    public:
+        typedef backend::hidpp20::PerKeyLighting::Color Color;
+        // Colors by zone
+        typedef std::map<uint8_t, Color> Frame;
+
+        explicit Lighting(Device* dev);
+        ~Lighting();
+        static backend::Result<void> supported(Device* dev);
+        virtual void configure();
+        virtual void listen();
+        virtual void reload();
+        virtual void invalidate();
+
+        /* Zones in frame change color, the others keep theirs. Frames
+         * are sent at most at the configured rate, those that come in
+         * between are merged. Never waits for the device. */
+        void setFrame(const Frame& frame);
+
+        class Config : public DeviceFeature::Config
+        {
+        public:
+            explicit Config(Device* dev);
+            const Frame& frame() const;
+            std::chrono::milliseconds frameInterval() const;
+        protected:
+            Frame _frame;
+            std::chrono::milliseconds _interval;
+        };
+    private:
+        // Writes the zones that changed and ends the frame
+        void _flush();
+
+        Config _config;
+        std::shared_ptr<backend::hidpp20::PerKeyLighting> _lighting;
+
+        std::mutex _lock;
+        Frame _wanted;
+        // What the device shows, as far as we know
+        Frame _shown;
+        std::chrono::milliseconds _interval;
+        std::chrono::steady_clock::time_point _last_frame;
+        bool _scheduled;
+        std::shared_ptr<timer> _frame_timer;
+        // Frames are written one at a time
+        std::mutex _flush_lock;
+    };
+}}
+
+#endif //LOGID_FEATURE_LIGHTING_H
@@ -15,10 +15,18 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  *
  */
+#include <algorithm>
+#include <iterator>
 #include <sstream>
+#include <linux/input-event-codes.h>
 #include "../Device.h"
 #include "RemapButton.h"
+#include "../InputDevice.h"
+#include "../actions/GestureAction.h"
+#include "../actions/KeypressAction.h"
 #include "../backend/hidpp20/Error.h"
+#include "../util/arena.h"
+#include "../util/probes.h"
 
 using namespace logid::features;
 using namespace logid::backend;
@@ -27,9 +35,92 @@ using namespace logid::actions;
 #define HIDPP20_REPROG_REBIND (hidpp20::ReprogControls::ChangeTemporaryDivert \
 | hidpp20::ReprogControls::ChangeRawXYDivert)
 
-#define EVENTHANDLER_NAME "REMAP_BUTTON"
+namespace
+{
+    typedef hidpp20::PersistentRemappableAction Persistent;
+
+    // Keyboard page usages from 0x04 on, as in the kernel's hid_keyboard
+    const uint16_t keyboard_usages[] = {
+        KEY_A, KEY_B, KEY_C, KEY_D, KEY_E, KEY_F, KEY_G, KEY_H, KEY_I, KEY_J,
+        KEY_K, KEY_L, KEY_M, KEY_N, KEY_O, KEY_P, KEY_Q, KEY_R, KEY_S, KEY_T,
+        KEY_U, KEY_V, KEY_W, KEY_X, KEY_Y, KEY_Z,
+        KEY_1, KEY_2, KEY_3, KEY_4, KEY_5, KEY_6, KEY_7, KEY_8, KEY_9, KEY_0,
+        KEY_ENTER, KEY_ESC, KEY_BACKSPACE, KEY_TAB, KEY_SPACE, KEY_MINUS,
+        KEY_EQUAL, KEY_LEFTBRACE, KEY_RIGHTBRACE, KEY_BACKSLASH, KEY_RESERVED,
+        KEY_SEMICOLON, KEY_APOSTROPHE, KEY_GRAVE, KEY_COMMA, KEY_DOT,
+        KEY_SLASH, KEY_CAPSLOCK,
+        KEY_F1, KEY_F2, KEY_F3, KEY_F4, KEY_F5, KEY_F6, KEY_F7, KEY_F8,
+        KEY_F9, KEY_F10, KEY_F11, KEY_F12,
+        KEY_SYSRQ, KEY_SCROLLLOCK, KEY_PAUSE, KEY_INSERT, KEY_HOME,
+        KEY_PAGEUP, KEY_DELETE, KEY_END, KEY_PAGEDOWN, KEY_RIGHT, KEY_LEFT,
+        KEY_DOWN, KEY_UP, KEY_NUMLOCK, KEY_KPSLASH, KEY_KPASTERISK,
+        KEY_KPMINUS, KEY_KPPLUS, KEY_KPENTER, KEY_KP1, KEY_KP2, KEY_KP3,
+        KEY_KP4, KEY_KP5, KEY_KP6, KEY_KP7, KEY_KP8, KEY_KP9, KEY_KP0,
+        KEY_KPDOT, KEY_102ND, KEY_COMPOSE
+    };
+    const uint16_t keyboard_usage_base = 0x04;
+
+    // Bit n of the modifier mask
+    const uint16_t modifier_keys[] = {
+        KEY_LEFTCTRL, KEY_LEFTSHIFT, KEY_LEFTALT, KEY_LEFTMETA,
+        KEY_RIGHTCTRL, KEY_RIGHTSHIFT, KEY_RIGHTALT, KEY_RIGHTMETA
+    };
+
+    const struct {
+        uint16_t key;
+        uint16_t usage;
+    } consumer_usages[] = {
+        {KEY_MUTE, 0xe2}, {KEY_VOLUMEUP, 0xe9}, {KEY_VOLUMEDOWN, 0xea},
+        {KEY_PLAYPAUSE, 0xcd}, {KEY_NEXTSONG, 0xb5},
+        {KEY_PREVIOUSSONG, 0xb6}, {KEY_STOPCD, 0xb7}
+    };
+
+    // Only a single key, optionally with modifiers, can be sent by the device
+    bool persistentMapping(const std::shared_ptr<Action>& action,
+            Persistent::Mapping& mapping)
+    {
+        auto keypress = std::dynamic_pointer_cast<KeypressAction>(action);
+        if(!keypress)
+            return false;
+
+        mapping = {Persistent::Empty, 0, 0};
+        for(auto key : keypress->keys()) {
+            auto modifier = std::find(std::begin(modifier_keys),
+                    std::end(modifier_keys), key);
+            if(modifier != std::end(modifier_keys)) {
+                mapping.modifiers |= 1 << (modifier - std::begin(modifier_keys));
+                continue;
+            }
+            if(mapping.type != Persistent::Empty || key == KEY_RESERVED)
+                return false;
+
+            auto usage = std::find(std::begin(keyboard_usages),
+                    std::end(keyboard_usages), key);
+            if(usage != std::end(keyboard_usages)) {
+                mapping.type = Persistent::Key;
+                mapping.value = keyboard_usage_base +
+                        (usage - std::begin(keyboard_usages));
+                continue;
+            }
+            for(auto& consumer : consumer_usages) {
+                if(consumer.key == key) {
+                    mapping.type = Persistent::Consumer;
+                    mapping.value = consumer.usage;
+                }
+            }
+            if(mapping.type != Persistent::Consumer)
+                return false;
+        }
+
+        // Consumer usages take no modifiers
+        return mapping.type == Persistent::Key ||
+            (mapping.type == Persistent::Consumer && !mapping.modifiers);
+    }
+}
 
-RemapButton::RemapButton(Device *dev): DeviceFeature(dev), _config (dev)
+RemapButton::RemapButton(Device *dev): DeviceFeature(dev),
+    _config (std::make_shared<Config>(dev)), _pressed_buttons (0),
+    _pending_x (0), _pending_y (0)
 {
     try {
         _reprog_controls = hidpp20::ReprogControls::autoVersion(
@@ -40,35 +131,88 @@ RemapButton::RemapButton(Device *dev): DeviceFeature(dev), _config (dev)
 
     _reprog_controls->initCidMap();
 
-    if(global_loglevel <= DEBUG) {
+    auto persistent = hidpp20::makeFeature<hidpp20::PersistentRemappableAction>(
+            &dev->hidpp20());
+    if(persistent)
+        _persistent = *persistent;
+
+    if(logEnabled(DEBUG)) {
         #define FLAG(x) control.second.flags & hidpp20::ReprogControls::x ? \
             "YES" : ""
         #define ADDITIONAL_FLAG(x) control.second.additionalFlags & \
             hidpp20::ReprogControls::x ? "YES" : ""
 
         // Print CIDs, originally by zv0n
-        logPrintf(DEBUG,  "%s:%d remappable buttons:",
+        LOGID_LOG(DEBUG,  "%s:%d remappable buttons:",
                 dev->hidpp20().devicePath().c_str(),
                 dev->hidpp20().deviceIndex());
-        logPrintf(DEBUG, "CID  | reprog? | fn key? | mouse key? | "
+        LOGID_LOG(DEBUG, "CID  | reprog? | fn key? | mouse key? | "
                          "gesture support?");
         for(const auto & control : _reprog_controls->getControls())
-                logPrintf(DEBUG, "0x%02x | %-7s | %-7s | %-10s | %s",
+                LOGID_LOG(DEBUG, "0x%02x | %-7s | %-7s | %-10s | %s",
                         control.first, FLAG(TemporaryDivertable), FLAG(FKey),
                         FLAG(MouseButton), ADDITIONAL_FLAG(RawXY));
         #undef FLAG
     }
 }
 
+Result<void> RemapButton::supported(Device* dev)
+{
+    // Any version of ReprogControls will do
+    const uint16_t versions[] = {hidpp20::ReprogControlsV4::ID,
+            hidpp20::ReprogControlsV3::ID, hidpp20::ReprogControlsV2_2::ID,
+            hidpp20::ReprogControlsV2::ID, hidpp20::ReprogControls::ID};
+    Result<void> result;
+    for(auto id : versions) {
+        result = dev->hidpp20().tryFeatureIndex(id);
+        if(result || result.failure().kind() != Failure::UnsupportedFeature)
+            break;
+    }
+    return result;
+}
+
 RemapButton::~RemapButton()
 {
-    _device->hidpp20().removeEventHandler(EVENTHANDLER_NAME);
+    auto index = _reprog_controls->featureIndex();
+    _device->hidpp20().removeEventHandler(index,
+            hidpp20::ReprogControls::DivertedButtonEvent);
+    _device->hidpp20().removeEventHandler(index,
+            hidpp20::ReprogControls::DivertedRawXYEvent);
 }
 
 void RemapButton::configure()
+{
+    _configure(true);
+}
+
+void RemapButton::_configure(bool mappings)
 {
     ///TODO: DJ reporting trickery if cannot be remapped
-    for(const auto& i : _config.buttons()) {
+    auto config = std::atomic_load(&_config);
+
+    if(mappings && _persistent) {
+        hidpp20::Transaction map(&_device->hidpp20());
+        for(const auto& i : config->persistent())
+            _persistent->setMapping(map, i.first, i.second);
+        map.commit();
+
+        _onboard.clear();
+        std::size_t request = 0;
+        for(const auto& i : config->persistent()) {
+            try {
+                map.response(request++);
+                _onboard.insert(i.first);
+            } catch(hidpp20::Error& e) {
+                // The button is diverted instead
+                logPrintf(WARN, "%s: Cannot remap CID 0x%02x on the device: "
+                                "%s", _device->name().c_str(), i.first,
+                                e.what());
+            }
+        }
+    }
+
+    hidpp20::Transaction set(&_device->hidpp20());
+    for(const auto& i : config->buttons()) {
         hidpp20::ReprogControls::ControlInfo info{};
         try {
             info = _reprog_controls->getControlIdInfo(i.first);
@@ -81,7 +225,8 @@ void RemapButton::configure()
             throw e;
         }
 
-        if((i.second->reprogFlags() & hidpp20::ReprogControls::RawXYDiverted) &&
+        auto flags = _reprogFlags(i.first, i.second);
+        if((flags & hidpp20::ReprogControls::RawXYDiverted) &&
                 (!_reprog_controls->supportsRawXY() || !(info.additionalFlags &
                 hidpp20::ReprogControls::RawXY)))
             logPrintf(WARN, "%s: Cannot divert raw XY movements for CID "
@@ -90,81 +235,261 @@ void RemapButton::configure()
         hidpp20::ReprogControls::ControlInfo report{};
         report.controlID = i.first;
         report.flags = HIDPP20_REPROG_REBIND;
-        report.flags |= i.second->reprogFlags();
-        _reprog_controls->setControlReporting(i.first, report);
+        report.flags |= flags;
+        _reprog_controls->setControlReporting(set, i.first, report);
+    }
+
+    set.commit();
+    for(std::size_t i = 0; i < set.size(); i++)
+        set.response(i);
+}
+
+void RemapButton::reconfigure()
+{
+    // Only v4 reports the real reporting flags, older versions emulate it
+    auto v4 = std::dynamic_pointer_cast<hidpp20::ReprogControlsV4>(
+            _reprog_controls);
+    if(!v4) {
+        _configure(false);
+        return;
+    }
+
+    auto config = std::atomic_load(&_config);
+    const auto& buttons = config->buttons();
+    hidpp20::Transaction reporting(&_device->hidpp20());
+    for(const auto& i : buttons)
+        v4->getControlReporting(reporting, i.first);
+    reporting.commit();
+
+    const uint8_t mask = hidpp20::ReprogControls::TemporaryDiverted |
+            hidpp20::ReprogControls::RawXYDiverted;
+    hidpp20::Transaction set(&_device->hidpp20());
+    std::size_t request = 0;
+    for(const auto& i : buttons) {
+        hidpp20::ReprogControls::ControlInfo current{};
+        try {
+            current = v4->controlReporting(reporting.response(request++));
+        } catch(hidpp20::Error& e) {
+            if(e.code() == hidpp20::Error::InvalidArgument)
+                continue;
+            throw e;
+        }
+
+        auto flags = _reprogFlags(i.first, i.second);
+        if((current.flags & mask) == (flags & mask))
+            continue;
+
+        hidpp20::ReprogControls::ControlInfo report{};
+        report.controlID = i.first;
+        report.flags = HIDPP20_REPROG_REBIND;
+        report.flags |= flags;
+        v4->setControlReporting(set, i.first, report);
     }
+
+    set.commit();
+    for(std::size_t i = 0; i < set.size(); i++)
+        set.response(i);
 }
 
 void RemapButton::listen()
 {
-    if(_device->hidpp20().eventHandlers().find(EVENTHANDLER_NAME) ==
-       _device->hidpp20().eventHandlers().end()) {
-        auto handler = std::make_shared<hidpp::EventHandler>();
-        handler->condition = [index=_reprog_controls->featureIndex()]
-                                      (hidpp::Report& report)->bool {
-            return (report.feature() == index) && ((report.function() ==
-                hidpp20::ReprogControls::DivertedButtonEvent) || (report
-                .function() == hidpp20::ReprogControls::DivertedRawXYEvent));
-        };
-
-        handler->callback = [this](hidpp::Report& report)->void {
-            if(report.function() ==
-                hidpp20::ReprogControls::DivertedButtonEvent)
-                this->_buttonEvent(_reprog_controls->divertedButtonEvent(
-                        report));
-            else { // RawXY
-                auto divertedXY = _reprog_controls->divertedRawXYEvent(report);
-                for(const auto& button : this->_config.buttons())
-                    if(button.second->pressed())
-                        button.second->move(divertedXY.x, divertedXY.y);
-            }
-        };
+    auto index = _reprog_controls->featureIndex();
+
+    _device->hidpp20().addEventHandler(index,
+            hidpp20::ReprogControls::DivertedButtonEvent,
+            [this](hidpp::Report& report)->void {
+        InputDevice::Frame frame(*virtual_input);
+        // Movement held back by gesture_rate happened before the release
+        if(_pending_x || _pending_y)
+            this->_move(std::atomic_load(&this->_config));
+        this->_buttonEvent(_reprog_controls->divertedButtonEvent(report));
+    });
+
+    _device->hidpp20().addEventHandler(index,
+            hidpp20::ReprogControls::DivertedRawXYEvent,
+            [this](hidpp::Report& report)->void {
+        auto divertedXY = _reprog_controls->divertedRawXYEvent(report);
+        // Movement read in one batch is passed on as one move
+        _pending_x += divertedXY.x;
+        _pending_y += divertedXY.y;
+        if(_device->hidpp20().rawDevice()->sameReportFollows())
+            return;
+
+        auto config = std::atomic_load(&this->_config);
+        auto interval = config->moveInterval();
+        if(interval.count()) {
+            auto now = std::chrono::steady_clock::now();
+            if(now - _last_move < interval)
+                return;
+            _last_move = now;
+        }
 
-        _device->hidpp20().addEventHandler(EVENTHANDLER_NAME, handler);
+        InputDevice::Frame frame(*virtual_input);
+        this->_move(config);
+    }, true);
+}
+
+void RemapButton::reload()
+{
+    auto config = std::make_shared<Config>(_device);
+    std::shared_ptr<Config> old_config;
+
+    {
+        // Release buttons held down through the old actions
+        std::lock_guard<profiled_mutex> lock(_button_lock);
+        old_config = std::atomic_load(&_config);
+        uint64_t held = _pressed_buttons.exchange(0);
+        while(held) {
+            old_config->action(__builtin_ctzll(held))->release();
+            held &= held - 1;
+        }
+        std::atomic_store(&_config, config);
+    }
+
+    // Give buttons that are no longer remapped back to the device
+    hidpp20::Transaction restore(&_device->hidpp20());
+    for(const auto& i : old_config->buttons()) {
+        if(config->buttons().count(i.first))
+            continue;
+        hidpp20::ReprogControls::ControlInfo report{};
+        report.controlID = i.first;
+        report.flags = HIDPP20_REPROG_REBIND;
+        _reprog_controls->setControlReporting(restore, i.first, report);
+    }
+    // Mappings outlive logid, so dropped ones are reset explicitly
+    for(auto cid : _onboard) {
+        if(!config->persistent().count(cid))
+            _persistent->resetMapping(restore, cid);
+    }
+    restore.commit();
+    for(std::size_t i = 0; i < restore.size(); i++)
+        restore.response(i);
+
+    configure();
+}
+
+uint8_t RemapButton::_reprogFlags(uint8_t cid,
+        const std::shared_ptr<Action>& action) const
+{
+    // Mapped buttons are left to the device
+    return _onboard.count(cid) ? 0 : action->reprogFlags();
+}
+
+void RemapButton::_move(const std::shared_ptr<Config>& config)
+{
+    auto x = (int16_t)std::max(INT16_MIN, std::min(INT16_MAX, _pending_x));
+    auto y = (int16_t)std::max(INT16_MIN, std::min(INT16_MAX, _pending_y));
+    _pending_x = 0;
+    _pending_y = 0;
+
+    // Only held buttons that take raw XY need to see the movement
+    uint64_t held = _pressed_buttons.load(std::memory_order_acquire) &
+            config->rawXYMask();
+    while(held) {
+        auto action = config->rawXYAction(__builtin_ctzll(held));
+        held &= held - 1;
+        if(action && action->pressed())
+            action->move(x, y);
     }
 }
 
-void RemapButton::_buttonEvent(const std::set<uint16_t>& new_state)
+void RemapButton::_buttonEvent(
+        const hidpp20::ReprogControls::DivertedButtons& event)
 {
     // Ensure I/O doesn't occur while updating button state
-    std::lock_guard<std::mutex> lock(_button_lock);
+    std::lock_guard<profiled_mutex> lock(_button_lock);
+    auto config = std::atomic_load(&_config);
+
+    uint64_t new_state = 0;
+    for(std::size_t i = 0; i < event.count; i++) {
+        int index = config->index(event.cids[i]);
+        if(index != -1)
+            new_state |= 1ull << index;
+    }
+
+    const uint64_t old_state = _pressed_buttons.load(
+            std::memory_order_relaxed);
+    const uint64_t changed = old_state ^ new_state;
 
     // Press all added buttons
-    for(const auto& i : new_state) {
-        auto old_i = _pressed_buttons.find(i);
-        if(old_i != _pressed_buttons.end()) {
-            _pressed_buttons.erase(old_i);
-        } else {
-            auto action = _config.buttons().find(i);
-            if(action != _config.buttons().end())
-                action->second->press();
-        }
+    for(uint64_t added = changed & new_state; added; added &= added - 1) {
+        LOGID_PROBE2(action__press, _device->index(), __builtin_ctzll(added));
+        config->action(__builtin_ctzll(added))->press();
     }
 
     // Release all removed buttons
-    for(auto& i : _pressed_buttons) {
-        auto action = _config.buttons().find(i);
-        if(action != _config.buttons().end())
-            action->second->release();
+    for(uint64_t removed = changed & old_state; removed;
+            removed &= removed - 1) {
+        LOGID_PROBE2(action__release, _device->index(),
+                __builtin_ctzll(removed));
+        config->action(__builtin_ctzll(removed))->release();
     }
 
-    _pressed_buttons = new_state;
+    _pressed_buttons.store(new_state, std::memory_order_release);
 }
 
 RemapButton::Config::Config(Device *dev) : DeviceFeature::Config(dev)
 {
-    try {
-        auto& config_root = dev->config().getSetting("buttons");
-        if(!config_root.isList()) {
-            logPrintf(WARN, "Line %d: buttons must be a list.",
-                    config_root.getSourceLine());
-            return;
+    auto setting = dev->config().getSetting("buttons");
+    if(!setting)
+        return; // buttons not configured, use default
+    auto& config_root = *setting;
+    // Actions and gestures made below are laid out together
+    arena::scope actions;
+
+    if(!config_root.isList()) {
+        logPrintf(WARN, "Line %d: buttons must be a list.",
+                config_root.getSourceLine());
+        return;
+    }
+    int button_count = config_root.getLength();
+    for(int i = 0; i < button_count; i++)
+        _parseButton(config_root[i]);
+
+    bool persistent = false;
+    auto persistent_setting = dev->config().getSetting("persistent_remap");
+    if(persistent_setting) {
+        if(persistent_setting->getType() == libconfig::Setting::TypeBoolean)
+            persistent = *persistent_setting;
+        else
+            logPrintf(WARN, "Line %d: persistent_remap must be a boolean.",
+                    persistent_setting->getSourceLine());
+    }
+
+    /* Caps how often gestures see movement while a device streams raw
+     * XY, e.g. gesture_rate: 250; Movement in between is summed, not
+     * dropped. */
+    auto rate = dev->config().getSetting("gesture_rate");
+    if(rate) {
+        if(rate->getType() == libconfig::Setting::TypeInt && (int)*rate > 0)
+            _move_interval = std::chrono::duration_cast<
+                    std::chrono::steady_clock::duration>(
+                    std::chrono::seconds(1)) / (int)*rate;
+        else
+            logPrintf(WARN, "Line %d: gesture_rate must be a positive "
+                            "integer.", rate->getSourceLine());
+    }
+
+    for(auto& button : _buttons) {
+        if(_cids.size() == 64) {
+            logPrintf(WARN, "Only 64 buttons can be remapped, ignoring CID "
+                            "0x%02x.", button.first);
+            continue;
         }
-        int button_count = config_root.getLength();
-        for(int i = 0; i < button_count; i++)
-            _parseButton(config_root[i]);
-    } catch(libconfig::SettingNotFoundException& e) {
-        // buttons not configured, use default
+        GestureAction* raw_xy = nullptr;
+        if(button.second->reprogFlags() &
+           hidpp20::ReprogControls::RawXYDiverted) {
+            _raw_xy_mask |= 1ull << _cids.size();
+            // Resolved once here instead of on every movement report
+            raw_xy = dynamic_cast<GestureAction*>(button.second.get());
+        }
+        _raw_xy_actions.push_back(raw_xy);
+        _cids.push_back(button.first);
+        _actions.push_back(button.second);
+
+        Persistent::Mapping mapping{};
+        if(persistent && persistentMapping(button.second, mapping))
+            _persistent.emplace(button.first, mapping);
     }
 }
 
@@ -206,4 +531,39 @@ void RemapButton::Config::_parseButton(libconfig::Setting &setting)
 const std::map<uint8_t, std::shared_ptr<Action>>& RemapButton::Config::buttons()
 {
     return _buttons;
+}
+
+int RemapButton::Config::index(uint16_t cid) const
+{
+    // _buttons is keyed by the low byte of the CID
+    auto it = std::lower_bound(_cids.begin(), _cids.end(), (uint8_t)cid);
+    if(it == _cids.end() || *it != (uint8_t)cid)
+        return -1;
+    return (int)(it - _cids.begin());
+}
+
+const std::shared_ptr<Action>& RemapButton::Config::action(int index) const
+{
+    return _actions[index];
+}
+
+uint64_t RemapButton::Config::rawXYMask() const
+{
+    return _raw_xy_mask;
+}
+
+GestureAction* RemapButton::Config::rawXYAction(int index) const
+{
+    return _raw_xy_actions[index];
+}
+
+std::chrono::steady_clock::duration RemapButton::Config::moveInterval() const
+{
+    return _move_interval;
+}
+
+const std::map<uint8_t, Persistent::Mapping>&
+    RemapButton::Config::persistent() const
+{
+    return _persistent;
 }
\ No newline at end of file
@@ -18,20 +18,32 @@
 #ifndef LOGID_FEATURE_REMAPBUTTON_H
 #define LOGID_FEATURE_REMAPBUTTON_H
 
+#include <atomic>
+#include <chrono>
+#include <set>
+#include "../backend/hidpp20/features/PersistentRemappableAction.h"
 #include "../backend/hidpp20/features/ReprogControls.h"
 #include "DeviceFeature.h"
 #include "../actions/Action.h"
+#include "../util/profiled_mutex.h"
 
 namespace logid {
+namespace actions
+{
+    class GestureAction;
+}
 namespace features
 {
     class RemapButton : public DeviceFeature
     {
     public:
         explicit RemapButton(Device* dev);
+        static backend::Result<void> supported(Device* dev);
         ~RemapButton();
         virtual void configure();
+        virtual void reconfigure();
         virtual void listen();
+        virtual void reload();
 
         class Config : public DeviceFeature::Config
         {
@@ -39,16 +51,62 @@ namespace features
             explicit Config(Device* dev);
             const std::map<uint8_t, std::shared_ptr<actions::Action>>&
                 buttons();
+
+            /* Buttons are also numbered in CID order so that the set of
+             * held buttons fits in a bitmap. Returns -1 if cid is not
+             * remapped. */
+            int index(uint16_t cid) const;
+            const std::shared_ptr<actions::Action>& action(int index) const;
+            // Buttons whose action takes raw XY movement
+            uint64_t rawXYMask() const;
+            /* The action of a button in rawXYMask(), called without going
+             * through the vtable. Null for other buttons. */
+            actions::GestureAction* rawXYAction(int index) const;
+            /* Shortest time between moves passed on to raw XY actions, 0
+             * unless gesture_rate is set */
+            std::chrono::steady_clock::duration moveInterval() const;
+            /* Simple keypresses that the device can send by itself, empty
+             * unless persistent_remap is set. */
+            const std::map<uint8_t,
+                backend::hidpp20::PersistentRemappableAction::Mapping>&
+                persistent() const;
         protected:
             void _parseButton(libconfig::Setting& setting);
             std::map<uint8_t, std::shared_ptr<actions::Action>> _buttons;
+        private:
+            std::vector<uint8_t> _cids;
+            std::vector<std::shared_ptr<actions::Action>> _actions;
+            uint64_t _raw_xy_mask = 0;
+            std::vector<actions::GestureAction*> _raw_xy_actions;
+            std::chrono::steady_clock::duration _move_interval{0};
+            std::map<uint8_t,
+                backend::hidpp20::PersistentRemappableAction::Mapping>
+                _persistent;
         };
     private:
-        void _buttonEvent(const std::set<uint16_t>& new_state);
-        Config _config;
+        // Mappings stay on the device, they are only sent if mappings is set
+        void _configure(bool mappings);
+        uint8_t _reprogFlags(uint8_t cid,
+                const std::shared_ptr<actions::Action>& action) const;
+        void _buttonEvent(
+                const backend::hidpp20::ReprogControls::DivertedButtons&
+                event);
+        // Passes the pending raw XY on to the held buttons
+        void _move(const std::shared_ptr<Config>& config);
+        // Swapped atomically on reload, event handlers load it once
+        std::shared_ptr<Config> _config;
         std::shared_ptr<backend::hidpp20::ReprogControls> _reprog_controls;
-        std::set<uint16_t> _pressed_buttons;
-        std::mutex _button_lock;
+        std::shared_ptr<backend::hidpp20::PersistentRemappableAction>
+            _persistent;
+        // CIDs mapped on the device rather than diverted
+        std::set<uint8_t> _onboard;
+        // Bit n is set while button n of _config is held
+        std::atomic<uint64_t> _pressed_buttons;
+        profiled_mutex _button_lock{"RemapButton::_button_lock"};
+        /* Raw XY of reports read together or held back by gesture_rate,
+         * only touched on the I/O thread */
+        int _pending_x, _pending_y;
+        std::chrono::steady_clock::time_point _last_move;
     };
 }}
 
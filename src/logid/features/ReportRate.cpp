@@ -0,0 +1,195 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <cstdlib>
+#include "ReportRate.h"
+#include "../Device.h"
+#include "../util/log.h"
+#include "../util/power.h"
+
+using namespace logid::features;
+using namespace logid::backend;
+
+ReportRate::ReportRate(Device* device) : DeviceFeature(device),
+    _config (device)
+{
+    try {
+        _report_rate = std::make_shared<hidpp20::ReportRate>(
+                &device->hidpp20());
+    } catch (hidpp20::UnsupportedFeature& e) {
+        throw UnsupportedFeature();
+    }
+}
+
+Result<void> ReportRate::supported(Device* dev)
+{
+    return dev->hidpp20().tryFeatureIndex(hidpp20::ReportRate::ID);
+}
+
+void ReportRate::configure()
+{
+    if(!_config.getRate())
+        return;
+    auto interval = _interval(_config.getRate());
+    _report_rate->setReportRate(interval);
+    _current.set(interval);
+}
+
+void ReportRate::reconfigure()
+{
+    if(!_config.getRate())
+        return;
+    auto interval = _interval(_config.getRate());
+    auto current = _current.get([this]() {
+        return _report_rate->getReportRate();
+    });
+    if(current != interval) {
+        _report_rate->setReportRate(interval);
+        _current.set(interval);
+    }
+}
+
+void ReportRate::listen()
+{
+}
+
+void ReportRate::reload()
+{
+    _config = Config(_device);
+    reconfigure();
+}
+
+void ReportRate::powerChanged()
+{
+    reconfigure();
+}
+
+void ReportRate::invalidate()
+{
+    _current.invalidate();
+}
+
+DeviceFeature::MirrorState ReportRate::checkMirror()
+{
+    uint8_t mirrored;
+    if(!_current.peek(mirrored))
+        return NotMirrored;
+    if(_report_rate->getReportRate() != mirrored)
+        return Lost;
+    return Survived;
+}
+
+uint16_t ReportRate::getRate()
+{
+    auto interval = _current.get([this]() {
+        return _report_rate->getReportRate();
+    });
+    return interval ? 1000 / interval : 0;
+}
+
+void ReportRate::setRate(uint16_t rate)
+{
+    auto interval = _interval(rate);
+    _report_rate->setReportRate(interval);
+    _current.set(interval);
+}
+
+bool ReportRate::cachedRate(uint16_t& rate)
+{
+    uint8_t interval;
+    if(!_current.peek(interval) || !interval)
+        return false;
+    rate = 1000 / interval;
+    return true;
+}
+
+uint8_t ReportRate::_interval(uint16_t rate)
+{
+    // Capabilities are cached, this only asks the device once per model
+    auto list = _report_rate->getReportRateList();
+    int wanted = (1000 + rate / 2) / rate;
+    uint8_t closest = 0;
+    for(int i = 0; i < 8; i++) {
+        if(!(list & (1 << i)))
+            continue;
+        if(!closest || std::abs(i + 1 - wanted) < std::abs(closest - wanted))
+            closest = i + 1;
+    }
+
+    if(closest && closest != wanted)
+        LOGID_LOG(DEBUG, "%s:%d: %d Hz is not supported, using %d Hz.",
+                _device->hidpp20().devicePath().c_str(), _device->index(),
+                rate, 1000 / closest);
+    // A device that lists nothing gets the interval it asked for
+    return closest ? closest : (uint8_t)std::max(1, std::min(wanted, 255));
+}
+
+namespace
+{
+    bool validRate(const libconfig::Setting& setting)
+    {
+        return setting.getType() == libconfig::Setting::TypeInt &&
+               (int)setting > 0 && (int)setting <= 1000;
+    }
+}
+
+ReportRate::Config::Config(Device* dev) : DeviceFeature::Config(dev),
+    _rate (0), _battery_rate (0)
+{
+    auto setting = dev->config().getSetting("report_rate");
+    if(!setting)
+        return; // Report rate not configured, leave it as it is
+    auto& config_root = *setting;
+
+    // Either a rate, or e.g. report_rate: { rate: 1000; battery: 125; };
+    if(config_root.isGroup()) {
+        if(config_root.exists("rate")) {
+            if(validRate(config_root["rate"]))
+                _rate = (int)config_root["rate"];
+            else
+                logPrintf(WARN, "Line %d: rate must be a rate in Hz between "
+                                "1 and 1000.",
+                                config_root["rate"].getSourceLine());
+        }
+        if(config_root.exists("battery")) {
+            if(validRate(config_root["battery"]))
+                _battery_rate = (int)config_root["battery"];
+            else
+                logPrintf(WARN, "Line %d: battery must be a rate in Hz "
+                                "between 1 and 1000.",
+                                config_root["battery"].getSourceLine());
+        }
+        if(_battery_rate && !_rate) {
+            logPrintf(WARN, "Line %d: battery needs a rate to go back to, "
+                            "ignoring.", config_root.getSourceLine());
+            _battery_rate = 0;
+        }
+    } else if(validRate(config_root)) {
+        _rate = (int)config_root;
+    } else {
+        logPrintf(WARN, "Line %d: report_rate must be a rate in Hz "
+                        "between 1 and 1000.", config_root.getSourceLine());
+    }
+}
+
+uint16_t ReportRate::Config::getRate()
+{
+    if(_battery_rate && power::saving())
+        return _battery_rate;
+    return _rate;
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_FEATURE_REPORTRATE_H
+#define LOGID_FEATURE_REPORTRATE_H
+
+#include "../backend/hidpp20/features/ReportRate.h"
+#include "DeviceFeature.h"
+#include "../util/state_mirror.h"
+
+namespace logid {
+namespace features
+{
+    // Rates are in reports per second, the device takes intervals in ms
+    class ReportRate : public DeviceFeature
+    {
+    public:
+        explicit ReportRate(Device* dev);
+        static backend::Result<void> supported(Device* dev);
+        virtual void configure();
+        virtual void reconfigure();
+        virtual void listen();
+        virtual void reload();
+        virtual void invalidate();
+        virtual void powerChanged();
+        virtual MirrorState checkMirror();
+
+        uint16_t getRate();
+        // Sets the closest supported rate
+        void setRate(uint16_t rate);
+        // The mirrored rate, false if it is not known without a request
+        bool cachedRate(uint16_t& rate);
+
+        class Config : public DeviceFeature::Config
+        {
+        public:
+            explicit Config(Device* dev);
+            // 0 if the rate is not configured, follows battery mode
+            uint16_t getRate();
+        protected:
+            uint16_t _rate;
+            // 0 if the rate stays the same in battery mode
+            uint16_t _battery_rate;
+        };
+    private:
+        // Closest supported interval in ms
+        uint8_t _interval(uint16_t rate);
+
+        Config _config;
+        std::shared_ptr<backend::hidpp20::ReportRate> _report_rate;
+        // Current report interval in ms
+        state_mirror<uint8_t> _current;
+    };
+}}
+
+#endif //LOGID_FEATURE_REPORTRATE_H
@@ -32,47 +32,134 @@ SmartShift::SmartShift(Device* device) : DeviceFeature(device), _config
     }
 }
 
+Result<void> SmartShift::supported(Device* dev)
+{
+    return dev->hidpp20().tryFeatureIndex(hidpp20::SmartShift::ID);
+}
+
 void SmartShift::configure()
 {
-    _smartshift->setStatus(_config.getSettings());
+    setStatus(_config.getSettings());
+}
+
+void SmartShift::reconfigure()
+{
+    auto settings = _config.getSettings();
+    auto current = getStatus();
+
+    if((settings.setActive && settings.active != current.active) ||
+       (settings.setAutoDisengage &&
+        settings.autoDisengage != current.autoDisengage) ||
+       (settings.setDefaultAutoDisengage &&
+        settings.defaultAutoDisengage != current.defaultAutoDisengage))
+        setStatus(settings);
 }
 
 void SmartShift::listen()
 {
 }
 
+void SmartShift::reload()
+{
+    _config = Config(_device);
+    configure();
+}
+
+void SmartShift::invalidate()
+{
+    _status.invalidate();
+}
+
+DeviceFeature::MirrorState SmartShift::checkMirror()
+{
+    hidpp20::SmartShift::SmartshiftStatus mirrored{};
+    if(!_status.peek(mirrored))
+        return NotMirrored;
+    auto current = _smartshift->getStatus();
+    if(current.active != mirrored.active ||
+       current.autoDisengage != mirrored.autoDisengage)
+        return Lost;
+    return Survived;
+}
+
 hidpp20::SmartShift::SmartshiftStatus SmartShift::getStatus()
 {
-    return _smartshift->getStatus();
+    return _status.get([this]() { return _smartshift->getStatus(); });
+}
+
+bool SmartShift::cachedStatus(hidpp20::SmartShift::SmartshiftStatus& status)
+{
+    return _status.peek(status);
 }
 
 void SmartShift::setStatus(backend::hidpp20::SmartShift::SmartshiftStatus
     status)
 {
-    _smartshift->setStatus(status);
+    typedef hidpp20::SmartShift::SmartshiftStatus Status;
+    _status_writes.set(false, status, [this](const Status& value) {
+        _smartshift->setStatus(value);
+        _updateStatus(value);
+    }, [](Status& pending, const Status& newer) {
+        if(newer.setActive) {
+            pending.setActive = true;
+            pending.active = newer.active;
+        }
+        if(newer.setAutoDisengage) {
+            pending.setAutoDisengage = true;
+            pending.autoDisengage = newer.autoDisengage;
+        }
+        if(newer.setDefaultAutoDisengage) {
+            pending.setDefaultAutoDisengage = true;
+            pending.defaultAutoDisengage = newer.defaultAutoDisengage;
+        }
+    });
+}
+
+void SmartShift::toggleActive()
+{
+    std::lock_guard<std::mutex> lock(_toggle_lock);
+    hidpp20::SmartShift::SmartshiftStatus status{};
+    status.setActive = true;
+    status.active = !getStatus().active;
+    _smartshift->setStatusNoResponse(status);
+    _updateStatus(status);
+}
+
+// Only the fields that were written are known to have changed
+void SmartShift::_updateStatus(
+        const hidpp20::SmartShift::SmartshiftStatus& status)
+{
+    _status.update([&status](hidpp20::SmartShift::SmartshiftStatus& current) {
+        if(status.setActive)
+            current.active = status.active;
+        if(status.setAutoDisengage)
+            current.autoDisengage = status.autoDisengage;
+        if(status.setDefaultAutoDisengage)
+            current.defaultAutoDisengage = status.defaultAutoDisengage;
+    });
 }
 
 SmartShift::Config::Config(Device *dev) : DeviceFeature::Config(dev), _status()
 {
-    try {
-        auto& config_root = dev->config().getSetting("smartshift");
-        if(!config_root.isGroup()) {
-            logPrintf(WARN, "Line %d: smartshift must be an object",
-                    config_root.getSourceLine());
-            return;
-        }
-        _status.setActive = config_root.lookupValue("on", _status.active);
-        int tmp;
-        _status.setAutoDisengage = config_root.lookupValue("threshold", tmp);
-        if(_status.setAutoDisengage)
-            _status.autoDisengage = tmp;
-        _status.setDefaultAutoDisengage = config_root.lookupValue
-                ("default_threshold", tmp);
-        if(_status.setDefaultAutoDisengage)
-            _status.defaultAutoDisengage = tmp;
-    } catch(libconfig::SettingNotFoundException& e) {
-        // SmartShift not configured, use default
+    auto setting = dev->config().getSetting("smartshift");
+    if(!setting)
+        return; // SmartShift not configured, use default
+    auto& config_root = *setting;
+
+    if(!config_root.isGroup()) {
+        logPrintf(WARN, "Line %d: smartshift must be an object",
+                config_root.getSourceLine());
+        return;
     }
+    _status.setActive = config_root.lookupValue("on", _status.active);
+    int tmp;
+    _status.setAutoDisengage = config_root.lookupValue("threshold", tmp);
+    if(_status.setAutoDisengage)
+        _status.autoDisengage = tmp;
+    _status.setDefaultAutoDisengage = config_root.lookupValue
+            ("default_threshold", tmp);
+    if(_status.setDefaultAutoDisengage)
+        _status.defaultAutoDisengage = tmp;
 }
 
 hidpp20::SmartShift::SmartshiftStatus SmartShift::Config::getSettings()
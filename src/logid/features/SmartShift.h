@@ -20,6 +20,8 @@
 
 #include "../backend/hidpp20/features/SmartShift.h"
 #include "DeviceFeature.h"
+#include "../util/state_mirror.h"
+#include "../util/write_combiner.h"
 
 namespace logid {
 namespace features
@@ -28,11 +30,21 @@ namespace features
     {
     public:
         explicit SmartShift(Device* dev);
+        static backend::Result<void> supported(Device* dev);
         virtual void configure();
+        virtual void reconfigure();
         virtual void listen();
+        virtual void reload();
+        virtual void invalidate();
+        virtual MirrorState checkMirror();
 
         backend::hidpp20::SmartShift::SmartshiftStatus getStatus();
         void setStatus(backend::hidpp20::SmartShift::SmartshiftStatus status);
+        // Flips the active state with a single write
+        void toggleActive();
+        // The mirrored status, false if it is not known without a request
+        bool cachedStatus(
+                backend::hidpp20::SmartShift::SmartshiftStatus& status);
 
         class Config : public DeviceFeature::Config
         {
@@ -44,7 +56,15 @@ namespace features
         };
     private:
         Config _config;
+        void _updateStatus(
+                const backend::hidpp20::SmartShift::SmartshiftStatus& status);
+
         std::shared_ptr<backend::hidpp20::SmartShift> _smartshift;
+        state_mirror<backend::hidpp20::SmartShift::SmartshiftStatus> _status;
+        std::mutex _toggle_lock;
+        // Fields of writes that pile up are merged into one write
+        write_combiner<backend::hidpp20::SmartShift::SmartshiftStatus, bool>
+            _status_writes;
     };
 }}
 
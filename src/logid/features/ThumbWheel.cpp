@@ -18,7 +18,9 @@
 
 #include "ThumbWheel.h"
 #include "../Device.h"
+#include "../InputDevice.h"
 #include "../actions/gesture/AxisGesture.h"
+#include "../util/arena.h"
 
 using namespace logid::features;
 using namespace logid::backend;
@@ -27,10 +29,8 @@ using namespace logid;
 #define FLAG_STR(b) (_wheel_info.capabilities & _thumb_wheel->b ? "YES" : \
     "NO")
 
-#define SCROLL_EVENTHANDLER_NAME "THUMB_WHEEL"
-
 ThumbWheel::ThumbWheel(Device *dev) : DeviceFeature(dev), _wheel_info(),
-    _config(dev)
+    _config (std::make_shared<Config>(dev))
 {
     try {
         _thumb_wheel = std::make_shared<hidpp20::ThumbWheel>(&dev->hidpp20());
@@ -40,65 +40,110 @@ ThumbWheel::ThumbWheel(Device *dev) : DeviceFeature(dev), _wheel_info(),
 
     _wheel_info = _thumb_wheel->getInfo();
 
-    logPrintf(DEBUG,"Thumb wheel detected (0x2150), capabilities:");
-    logPrintf(DEBUG, "timestamp | touch | proximity | single tap");
-    logPrintf(DEBUG, "%-9s | %-5s | %-9s | %-10s", FLAG_STR(Timestamp),
+    LOGID_LOG(DEBUG,"Thumb wheel detected (0x2150), capabilities:");
+    LOGID_LOG(DEBUG, "timestamp | touch | proximity | single tap");
+    LOGID_LOG(DEBUG, "%-9s | %-5s | %-9s | %-10s", FLAG_STR(Timestamp),
               FLAG_STR(Touch), FLAG_STR(Proxy), FLAG_STR(SingleTap));
-    logPrintf(DEBUG, "Thumb wheel resolution: native (%d), diverted (%d)",
+    LOGID_LOG(DEBUG, "Thumb wheel resolution: native (%d), diverted (%d)",
               _wheel_info.nativeRes, _wheel_info.divertedRes);
 
-    if(_config.leftAction()) {
+    _prepareActions(*_config);
+    _wheel = _makeCoalescer(*_config);
+}
+
+Result<void> ThumbWheel::supported(Device* dev)
+{
+    return dev->hidpp20().tryFeatureIndex(hidpp20::ThumbWheel::ID);
+}
+
+std::shared_ptr<coalescer> ThumbWheel::_makeCoalescer(const Config& config)
+{
+    return std::make_shared<coalescer>(config.coalesceWindow(),
+            [this](int rotation) {
+        InputDevice::Frame frame(*virtual_input);
+        _rotate(rotation);
+    });
+}
+
+void ThumbWheel::_prepareActions(const Config& config)
+{
+    if(config.leftAction()) {
         try {
             auto left_axis = std::dynamic_pointer_cast<actions::AxisGesture>(
-                    _config.leftAction());
+                    config.leftAction());
             // TODO: How do hires multipliers work on 0x2150 thumbwheels?
             if(left_axis)
                 left_axis->setHiresMultiplier(_wheel_info.divertedRes);
         } catch(std::bad_cast& e) { }
 
-        _config.leftAction()->press(true);
+        config.leftAction()->press(true);
     }
 
-    if(_config.rightAction()) {
+    if(config.rightAction()) {
         try {
             auto right_axis = std::dynamic_pointer_cast<actions::AxisGesture>(
-                    _config.rightAction());
+                    config.rightAction());
             if(right_axis)
                 right_axis->setHiresMultiplier(_wheel_info.divertedRes);
         } catch(std::bad_cast& e) { }
 
-        _config.rightAction()->press(true);
+        config.rightAction()->press(true);
     }
 }
 
 void ThumbWheel::configure()
 {
-    _thumb_wheel->setStatus(_config.divert(), _config.invert());
+    auto config = std::atomic_load(&_config);
+    _thumb_wheel->setStatus(config->divert(), config->invert());
+}
+
+void ThumbWheel::reconfigure()
+{
+    auto config = std::atomic_load(&_config);
+    auto status = _thumb_wheel->getStatus();
+    if(status.diverted != config->divert() ||
+       status.inverted != config->invert())
+        configure();
 }
 
 void ThumbWheel::listen()
 {
-    if(_device->hidpp20().eventHandlers().find(SCROLL_EVENTHANDLER_NAME) ==
-       _device->hidpp20().eventHandlers().end()) {
-        auto handler = std::make_shared<hidpp::EventHandler>();
-        handler->condition = [index=_thumb_wheel->featureIndex()]
-                (hidpp::Report& report)->bool {
-            return (report.feature() == index) && (report.function() ==
-                hidpp20::ThumbWheel::Event);
-        };
-
-        handler->callback = [this](hidpp::Report& report)->void {
-            this->_handleEvent(_thumb_wheel->thumbwheelEvent(report));
-        };
-
-        _device->hidpp20().addEventHandler(SCROLL_EVENTHANDLER_NAME, handler);
-    }
+    _device->hidpp20().addEventHandler(_thumb_wheel->featureIndex(),
+            hidpp20::ThumbWheel::Event,
+            [this](hidpp::Report& report)->void {
+        InputDevice::Frame frame(*virtual_input);
+        this->_handleEvent(_thumb_wheel->thumbwheelEvent(report));
+    });
+}
+
+void ThumbWheel::reload()
+{
+    auto config = std::make_shared<Config>(_device);
+    _prepareActions(*config);
+    auto old_config = std::atomic_exchange(&_config, config);
+    auto old_wheel = std::atomic_exchange(&_wheel, _makeCoalescer(*config));
+
+    // Rotation still pending goes out through the old actions first
+    old_wheel->flush([&old_config]() {
+        if(old_config->leftAction())
+            old_config->leftAction()->release();
+        if(old_config->rightAction())
+            old_config->rightAction()->release();
+    });
+    if(_last_proxy && old_config->proxyAction())
+        old_config->proxyAction()->release();
+    if(_last_touch && old_config->touchAction())
+        old_config->touchAction()->release();
+
+    configure();
 }
 
 void ThumbWheel::_handleEvent(hidpp20::ThumbWheel::ThumbwheelEvent event)
 {
+    auto config = std::atomic_load(&_config);
+
     if(event.flags & hidpp20::ThumbWheel::SingleTap) {
-        auto action = _config.tapAction();
+        auto action = config->tapAction();
         if(action) {
             action->press();
             action->release();
@@ -107,7 +152,7 @@ void ThumbWheel::_handleEvent(hidpp20::ThumbWheel::ThumbwheelEvent event)
 
     if((bool)(event.flags & hidpp20::ThumbWheel::Proxy) != _last_proxy) {
         _last_proxy = !_last_proxy;
-        auto action = _config.proxyAction();
+        auto action = config->proxyAction();
         if(action) {
             if(_last_proxy)
                 action->press();
@@ -118,7 +163,7 @@ void ThumbWheel::_handleEvent(hidpp20::ThumbWheel::ThumbwheelEvent event)
 
     if((bool)(event.flags & hidpp20::ThumbWheel::Touch) != _last_touch) {
         _last_touch = !_last_touch;
-        auto action = _config.touchAction();
+        auto action = config->touchAction();
         if(action) {
             if(_last_proxy)
                 action->press();
@@ -131,95 +176,131 @@ void ThumbWheel::_handleEvent(hidpp20::ThumbWheel::ThumbwheelEvent event)
         // Make right positive unless inverted
         event.rotation *= _wheel_info.defaultDirection;
 
+        auto wheel = std::atomic_load(&_wheel);
         if(event.rotationStatus == hidpp20::ThumbWheel::Start) {
-            if(_config.rightAction())
-               _config.rightAction()->press(true);
-            if(_config.leftAction())
-                _config.leftAction()->press(true);
-            _last_direction = 0;
+            wheel->flush([this, &config]() {
+                if(config->rightAction())
+                    config->rightAction()->press(true);
+                if(config->leftAction())
+                    config->leftAction()->press(true);
+                _last_direction = 0;
+            });
         }
 
-        if(event.rotation) {
-            int8_t direction = event.rotation > 0 ? 1 : -1;
-            std::shared_ptr<actions::Gesture> scroll_action;
-            std::shared_ptr<actions::Gesture> opposite_scroll;
-
-            if(event.rotation > 0) {
-                scroll_action = _config.rightAction();
-                opposite_scroll = _config.leftAction();
-            } else {
-                scroll_action = _config.leftAction();
-                opposite_scroll = _config.rightAction();
-            }
-
-            if(direction != _last_direction) {
-                if(opposite_scroll)
-                    opposite_scroll->release();
-                if(scroll_action) {
-                    scroll_action->press(true);
-                    scroll_action->move(direction * event.rotation);
-                }
-            }
-
-            _last_direction = direction;
-        }
+        wheel->add(event.rotation);
 
         if(event.rotationStatus == hidpp20::ThumbWheel::Stop) {
-            if(_config.rightAction())
-                _config.rightAction()->release();
-            if(_config.leftAction())
-                _config.leftAction()->release();
+            wheel->flush([&config]() {
+                if(config->rightAction())
+                    config->rightAction()->release();
+                if(config->leftAction())
+                    config->leftAction()->release();
+            });
         }
     }
 }
 
+void ThumbWheel::_rotate(int rotation)
+{
+    auto config = std::atomic_load(&_config);
+    int8_t direction = rotation > 0 ? 1 : -1;
+    std::shared_ptr<actions::Gesture> scroll_action;
+    std::shared_ptr<actions::Gesture> opposite_scroll;
+
+    if(rotation > 0) {
+        scroll_action = config->rightAction();
+        opposite_scroll = config->leftAction();
+    } else {
+        scroll_action = config->leftAction();
+        opposite_scroll = config->rightAction();
+    }
+
+    if(direction != _last_direction) {
+        if(opposite_scroll)
+            opposite_scroll->release();
+        if(scroll_action)
+            scroll_action->press(true);
+    }
+
+    if(scroll_action)
+        scroll_action->move(direction * rotation);
+
+    _last_direction = direction;
+}
+
 ThumbWheel::Config::Config(Device* dev) : DeviceFeature::Config(dev)
 {
+    auto setting = dev->config().getSetting("thumbwheel");
+    if(!setting)
+        return; // ThumbWheel not configured, use default
+    auto& config_root = *setting;
+    // Actions and gestures made below are laid out together
+    arena::scope actions;
+
+    if(!config_root.isGroup()) {
+        logPrintf(WARN, "Line %d: thumbwheel must be a group",
+                  config_root.getSourceLine());
+        return;
+    }
+
     try {
-        auto& config_root = dev->config().getSetting("thumbwheel");
-        if(!config_root.isGroup()) {
-            logPrintf(WARN, "Line %d: thumbwheel must be a group",
-                      config_root.getSourceLine());
-            return;
+        auto& divert = config_root.lookup("divert");
+        if(divert.getType() == libconfig::Setting::TypeBoolean) {
+            _divert = divert;
+        } else {
+            logPrintf(WARN, "Line %d: divert must be a boolean",
+                      divert.getSourceLine());
         }
+    } catch(libconfig::SettingNotFoundException& e) { }
 
-        try {
-            auto& divert = config_root.lookup("divert");
-            if(divert.getType() == libconfig::Setting::TypeBoolean) {
-                _divert = divert;
-            } else {
-                logPrintf(WARN, "Line %d: divert must be a boolean",
-                          divert.getSourceLine());
-            }
-        } catch(libconfig::SettingNotFoundException& e) { }
-
-        try {
-            auto& invert = config_root.lookup("invert");
-            if(invert.getType() == libconfig::Setting::TypeBoolean) {
-                _invert = invert;
-            } else {
-                logPrintf(WARN, "Line %d: invert must be a boolean, ignoring.",
-                          invert.getSourceLine());
-            }
-        } catch(libconfig::SettingNotFoundException& e) { }
-
-        if(_divert) {
-            _left_action = _genGesture(dev, config_root, "left");
-            if(!_left_action)
-                logPrintf(WARN, "Line %d: divert is true but no left action "
-                                "was set", config_root.getSourceLine());
-
-            _right_action = _genGesture(dev, config_root, "right");
-            if(!_right_action)
-                logPrintf(WARN, "Line %d: divert is true but no right action "
-                                "was set", config_root.getSourceLine());
+    try {
+        auto& invert = config_root.lookup("invert");
+        if(invert.getType() == libconfig::Setting::TypeBoolean) {
+            _invert = invert;
+        } else {
+            logPrintf(WARN, "Line %d: invert must be a boolean, ignoring.",
+                      invert.getSourceLine());
         }
+    } catch(libconfig::SettingNotFoundException& e) { }
 
-        _proxy_action = _genAction(dev, config_root, "proxy");
-        _tap_action = _genAction(dev, config_root, "tap");
-        _touch_action = _genAction(dev, config_root, "touch");
-    } catch(libconfig::SettingNotFoundException& e) {
-        // ThumbWheel not configured, use default
+    try {
+        auto& coalesce = config_root.lookup("coalesce");
+        std::chrono::milliseconds window(-1);
+        if(coalesce.getType() == libconfig::Setting::TypeFloat)
+            window = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::duration<double, std::milli>(coalesce));
+        else if(coalesce.isNumber())
+            window = std::chrono::milliseconds((int)coalesce);
+
+        if(window.count() >= 0)
+            _coalesce_window = window;
+        else
+            logPrintf(WARN, "Line %d: coalesce must be a non-negative "
+                            "number, ignoring.", coalesce.getSourceLine());
+    } catch(libconfig::SettingNotFoundException& e) { }
+
+    if(_divert) {
+        _left_action = _genGesture(dev, config_root, "left");
+        if(!_left_action)
+            logPrintf(WARN, "Line %d: divert is true but no left action "
+                            "was set", config_root.getSourceLine());
+
+        _right_action = _genGesture(dev, config_root, "right");
+        if(!_right_action)
+            logPrintf(WARN, "Line %d: divert is true but no right action "
+                            "was set", config_root.getSourceLine());
+    }
+
+    _proxy_action = _genAction(dev, config_root, "proxy");
+    _tap_action = _genAction(dev, config_root, "tap");
+    _touch_action = _genAction(dev, config_root, "touch");
+
+    // Nothing to do with the events, so the wheel scrolls natively
+    if(_divert && !_left_action && !_right_action && !_proxy_action &&
+       !_tap_action && !_touch_action) {
+        _divert = false;
+        logPrintf(INFO, "Line %d: no thumb wheel action was set, leaving "
+                        "the wheel undiverted", config_root.getSourceLine());
     }
 }
 
@@ -274,6 +355,11 @@ bool ThumbWheel::Config::invert() const
     return _invert;
 }
 
+std::chrono::milliseconds ThumbWheel::Config::coalesceWindow() const
+{
+    return _coalesce_window;
+}
+
 const std::shared_ptr<actions::Gesture>& ThumbWheel::Config::leftAction() const
 {
     return _left_action;
@@ -21,6 +21,7 @@
 #include "../backend/hidpp20/features/ThumbWheel.h"
 #include "DeviceFeature.h"
 #include "../actions/gesture/Gesture.h"
+#include "../util/coalescer.h"
 
 namespace logid {
 namespace features
@@ -29,8 +30,11 @@ namespace features
     {
     public:
         explicit ThumbWheel(Device* dev);
+        static backend::Result<void> supported(Device* dev);
         virtual void configure();
+        virtual void reconfigure();
         virtual void listen();
+        virtual void reload();
 
         class Config : public DeviceFeature::Config
         {
@@ -38,6 +42,8 @@ namespace features
             explicit Config(Device* dev);
             bool divert() const;
             bool invert() const;
+            // Rotation within this window is sent as one event
+            std::chrono::milliseconds coalesceWindow() const;
 
             const std::shared_ptr<actions::Gesture>& leftAction() const;
             const std::shared_ptr<actions::Gesture>& rightAction() const;
@@ -47,6 +53,7 @@ namespace features
         protected:
             bool _divert = false;
             bool _invert = false;
+            std::chrono::milliseconds _coalesce_window{0};
 
             static std::shared_ptr<actions::Gesture> _genGesture(Device* dev,
                     libconfig::Setting& setting, const std::string& name);
@@ -61,13 +68,18 @@ namespace features
         };
     private:
         void _handleEvent(backend::hidpp20::ThumbWheel::ThumbwheelEvent event);
+        void _rotate(int rotation);
+        void _prepareActions(const Config& config);
+        std::shared_ptr<coalescer> _makeCoalescer(const Config& config);
 
         std::shared_ptr<backend::hidpp20::ThumbWheel> _thumb_wheel;
         backend::hidpp20::ThumbWheel::ThumbwheelInfo _wheel_info;
         int8_t _last_direction = 0;
         bool _last_proxy = false;
         bool _last_touch = false;
-        Config _config;
+        // Swapped atomically on reload, event handlers load it once
+        std::shared_ptr<Config> _config;
+        std::shared_ptr<coalescer> _wheel;
     };
 }}
 
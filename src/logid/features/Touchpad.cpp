@@ -0,0 +1,435 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <system_error>
+#include "Touchpad.h"
+#include "../Device.h"
+#include "../backend/raw/RawDevice.h"
+#include "../util/arena.h"
+#include "../util/log.h"
+
+extern "C"
+{
+#include <unistd.h>
+}
+
+using namespace logid::features;
+using namespace logid::backend;
+using namespace logid::actions;
+using namespace logid;
+
+constexpr std::size_t Touchpad::MaxContacts;
+constexpr std::size_t Touchpad::MaxFrameEvents;
+
+namespace
+{
+    const char* swipe_names[Touchpad::SwipeCount] = {
+        "up", "down", "left", "right"
+    };
+
+    // BTN_TOOL_* for the number of fingers, 0 for none
+    uint16_t toolKey(std::size_t count)
+    {
+        switch(count) {
+        case 0:
+            return 0;
+        case 1:
+            return BTN_TOOL_FINGER;
+        case 2:
+            return BTN_TOOL_DOUBLETAP;
+        case 3:
+            return BTN_TOOL_TRIPLETAP;
+        case 4:
+            return BTN_TOOL_QUADTAP;
+        default:
+            return BTN_TOOL_QUINTTAP;
+        }
+    }
+}
+
+Touchpad::Touchpad(Device* dev) : DeviceFeature(dev),
+    _config (std::make_shared<Config>(dev)), _uinput (nullptr)
+{
+    // The kernel's wtp driver already turns the contacts into a touchpad
+    auto& driver = dev->hidpp20().rawDevice()->kernelDriver();
+    if(driver == "logitech-hidpp-device" || driver == "logitech-djreceiver") {
+        if(_config->enabled())
+            logPrintf(INFO, "%s: the kernel driver handles the touchpad, "
+                            "ignoring touchpad settings.",
+                            dev->name().c_str());
+        throw UnsupportedFeature();
+    }
+
+    try {
+        _raw_xy = std::make_shared<hidpp20::TouchpadRawXY>(
+                &dev->hidpp20());
+    } catch(hidpp20::UnsupportedFeature& e) {
+        throw UnsupportedFeature();
+    }
+
+    _tracking_ids.fill(-1);
+}
+
+Touchpad::~Touchpad()
+{
+    _device->hidpp20().removeEventHandler(_raw_xy->featureIndex(),
+            hidpp20::TouchpadRawXY::RawXYEvent);
+    if(auto uinput = _uinput.load()) {
+        libevdev_uinput_destroy(uinput);
+        libevdev_free(_evdev);
+    }
+}
+
+Result<void> Touchpad::supported(Device* dev)
+{
+    return dev->hidpp20().tryFeatureIndex(hidpp20::TouchpadRawXY::ID);
+}
+
+void Touchpad::configure()
+{
+    auto config = std::atomic_load(&_config);
+    if(config->enabled()) {
+        if(!_uinput)
+            _createOutput();
+        _raw_xy->setRawReportState(true);
+        _raw_enabled = true;
+    } else if(_raw_enabled) {
+        // Back to the device's own pointer movement
+        _raw_xy->setRawReportState(false);
+        _raw_enabled = false;
+    }
+}
+
+void Touchpad::listen()
+{
+    _device->hidpp20().addEventHandler(_raw_xy->featureIndex(),
+            hidpp20::TouchpadRawXY::RawXYEvent,
+            [this](hidpp::Report& report)->void {
+        _rawEvent(report);
+    });
+}
+
+void Touchpad::reload()
+{
+    std::atomic_store(&_config, std::make_shared<Config>(_device));
+    configure();
+}
+
+void Touchpad::_createOutput()
+{
+    _info = _raw_xy->getRawInfo();
+
+    _evdev = libevdev_new();
+    libevdev_set_name(_evdev, (_device->name() + " Touchpad").c_str());
+    libevdev_enable_property(_evdev, INPUT_PROP_POINTER);
+    libevdev_enable_property(_evdev, INPUT_PROP_BUTTONPAD);
+
+    libevdev_enable_event_type(_evdev, EV_KEY);
+    for(auto key : {BTN_LEFT, BTN_TOUCH, BTN_TOOL_FINGER,
+                    BTN_TOOL_DOUBLETAP, BTN_TOOL_TRIPLETAP, BTN_TOOL_QUADTAP,
+                    BTN_TOOL_QUINTTAP})
+        libevdev_enable_event_code(_evdev, EV_KEY, key, nullptr);
+
+    input_absinfo x{}, y{}, info{};
+    x.maximum = _info.xSize;
+    x.resolution = _info.resolution;
+    y.maximum = _info.ySize;
+    y.resolution = _info.resolution;
+    libevdev_enable_event_type(_evdev, EV_ABS);
+    libevdev_enable_event_code(_evdev, EV_ABS, ABS_X, &x);
+    libevdev_enable_event_code(_evdev, EV_ABS, ABS_Y, &y);
+    libevdev_enable_event_code(_evdev, EV_ABS, ABS_MT_POSITION_X, &x);
+    libevdev_enable_event_code(_evdev, EV_ABS, ABS_MT_POSITION_Y, &y);
+    info.maximum = MaxContacts - 1;
+    libevdev_enable_event_code(_evdev, EV_ABS, ABS_MT_SLOT, &info);
+    info.maximum = 0xffff;
+    libevdev_enable_event_code(_evdev, EV_ABS, ABS_MT_TRACKING_ID, &info);
+    info.maximum = _info.zRange ? _info.zRange : 0xff;
+    libevdev_enable_event_code(_evdev, EV_ABS, ABS_MT_PRESSURE, &info);
+    info.maximum = _info.areaRange ? _info.areaRange : 0xff;
+    libevdev_enable_event_code(_evdev, EV_ABS, ABS_MT_TOUCH_MAJOR, &info);
+
+    libevdev_uinput* uinput = nullptr;
+    int err = libevdev_uinput_create_from_device(_evdev,
+            LIBEVDEV_UINPUT_OPEN_MANAGED, &uinput);
+    if(err != 0) {
+        libevdev_free(_evdev);
+        _evdev = nullptr;
+        throw std::system_error(-err, std::generic_category());
+    }
+    _uinput = uinput;
+}
+
+void Touchpad::_rawEvent(hidpp::Report& report)
+{
+    auto event = hidpp20::TouchpadRawXY::rawXYEvent(report);
+    if(!_uinput)
+        return;
+
+    if(!event.spurious) {
+        for(auto& finger : event.fingers) {
+            if(!finger.id || finger.contactType || !finger.touching ||
+               _frame.count == MaxContacts)
+                continue;
+            auto i = _frame.count++;
+            _frame.id[i] = finger.id;
+            _frame.x[i] = finger.x;
+            _frame.y[i] = finger.y;
+            _frame.pressure[i] = finger.z;
+            _frame.area[i] = finger.area;
+        }
+        _frame.button = event.button;
+    }
+
+    if(event.endOfFrame) {
+        _frameDone();
+        _frame.count = 0;
+    }
+
+    // Frames in the same batch go out in one write
+    if(!_device->hidpp20().rawDevice()->sameReportFollows() ||
+       _events.size() - _event_count < MaxFrameEvents)
+        _flush();
+}
+
+void Touchpad::_frameDone()
+{
+    auto config = std::atomic_load(&_config);
+    if(!_recognize(*config))
+        _emitFrame();
+}
+
+bool Touchpad::_recognize(const Config& config)
+{
+    uint32_t x = 0, y = 0;
+    for(std::size_t i = 0; i < _frame.count; i++) {
+        x += _frame.x[i];
+        y += _frame.y[i];
+    }
+    if(_frame.count) {
+        x /= _frame.count;
+        y /= _frame.count;
+    }
+
+    if(!_swiping) {
+        if(!config.swipeFingers() || _frame.count < config.swipeFingers())
+            return false;
+        _swiping = true;
+        _swipe_start_x = x;
+        _swipe_start_y = y;
+        _swipe_last_x = x;
+        _swipe_last_y = y;
+
+        // Lift what was shown, the swipe owns the fingers now
+        touch_frame held = _frame;
+        _frame.count = 0;
+        _frame.button = false;
+        _emitFrame();
+        _frame = held;
+        return true;
+    }
+
+    // Fingers can lift one at a time, the swipe ends with the last one
+    if(_frame.count) {
+        _swipe_last_x = x;
+        _swipe_last_y = y;
+        return true;
+    }
+    _swiping = false;
+
+    int32_t dx = (int32_t)_swipe_last_x - (int32_t)_swipe_start_x;
+    int32_t dy = (int32_t)_swipe_last_y - (int32_t)_swipe_start_y;
+    int32_t threshold = config.swipeThreshold() *
+            std::max<uint16_t>(_info.resolution, 1);
+    Swipe swipe;
+    if(std::abs(dx) >= std::abs(dy) && std::abs(dx) >= threshold)
+        swipe = dx > 0 ? SwipeRight : SwipeLeft;
+    else if(std::abs(dy) > std::abs(dx) && std::abs(dy) >= threshold)
+        swipe = dy > 0 ? SwipeDown : SwipeUp;
+    else
+        return true;
+
+    if(auto& action = config.swipeAction(swipe)) {
+        action->press();
+        action->release();
+    }
+    return true;
+}
+
+void Touchpad::_emitFrame()
+{
+    std::array<bool, MaxContacts> present{};
+    for(std::size_t i = 0; i < _frame.count; i++) {
+        auto slot = _frame.id[i] % MaxContacts;
+        present[slot] = true;
+        _emit(EV_ABS, ABS_MT_SLOT, slot);
+        if(_tracking_ids[slot] < 0) {
+            _tracking_ids[slot] = _next_tracking_id;
+            _next_tracking_id = (_next_tracking_id + 1) & 0xffff;
+            _emit(EV_ABS, ABS_MT_TRACKING_ID, _tracking_ids[slot]);
+        }
+        _emit(EV_ABS, ABS_MT_POSITION_X, _frame.x[i]);
+        _emit(EV_ABS, ABS_MT_POSITION_Y, _frame.y[i]);
+        _emit(EV_ABS, ABS_MT_PRESSURE, _frame.pressure[i]);
+        _emit(EV_ABS, ABS_MT_TOUCH_MAJOR, _frame.area[i]);
+    }
+
+    for(std::size_t slot = 0; slot < MaxContacts; slot++) {
+        if(present[slot] || _tracking_ids[slot] < 0)
+            continue;
+        _tracking_ids[slot] = -1;
+        _emit(EV_ABS, ABS_MT_SLOT, slot);
+        _emit(EV_ABS, ABS_MT_TRACKING_ID, -1);
+    }
+
+    if(_frame.count) {
+        _emit(EV_ABS, ABS_X, _frame.x[0]);
+        _emit(EV_ABS, ABS_Y, _frame.y[0]);
+    }
+
+    if(_frame.count != _shown_count) {
+        if(!_frame.count != !_shown_count)
+            _emit(EV_KEY, BTN_TOUCH, _frame.count != 0);
+        if(auto key = toolKey(_shown_count))
+            _emit(EV_KEY, key, 0);
+        if(auto key = toolKey(_frame.count))
+            _emit(EV_KEY, key, 1);
+        _shown_count = _frame.count;
+    }
+
+    if(_frame.button != _shown_button) {
+        _emit(EV_KEY, BTN_LEFT, _frame.button);
+        _shown_button = _frame.button;
+    }
+
+    _emit(EV_SYN, SYN_REPORT, 0);
+}
+
+void Touchpad::_emit(uint16_t type, uint16_t code, int32_t value)
+{
+    auto& event = _events[_event_count++];
+    event.type = type;
+    event.code = code;
+    event.value = value;
+}
+
+void Touchpad::_flush()
+{
+    if(!_event_count)
+        return;
+    auto size = _event_count * sizeof(input_event);
+    _event_count = 0;
+    // uinput takes whole events, a short write only happens on errors
+    if(::write(libevdev_uinput_get_fd(_uinput), _events.data(), size) < 0)
+        logPrintf(WARN, "%s: writing touchpad frames failed: %s",
+                _device->name().c_str(), std::strerror(errno));
+}
+
+Touchpad::Config::Config(Device* dev) : DeviceFeature::Config(dev)
+{
+    auto setting = dev->config().getSetting("touchpad");
+    if(!setting)
+        return; // Touchpad not configured, leave the device as it is
+    auto& config_root = *setting;
+    // Actions made below are laid out together
+    arena::scope actions;
+
+    if(!config_root.isGroup()) {
+        logPrintf(WARN, "Line %d: touchpad must be a group",
+                  config_root.getSourceLine());
+        return;
+    }
+    _enabled = true;
+
+    try {
+        auto& swipe = config_root.lookup("swipe");
+        if(!swipe.isGroup()) {
+            logPrintf(WARN, "Line %d: swipe must be a group, ignoring.",
+                      swipe.getSourceLine());
+            _swipe_fingers = 0;
+            return;
+        }
+
+        try {
+            auto& fingers = swipe.lookup("fingers");
+            int count = fingers.isNumber() ? (int)fingers : -1;
+            if(count >= 2 && count <= 5)
+                _swipe_fingers = count;
+            else
+                logPrintf(WARN, "Line %d: fingers must be 2 to 5, ignoring.",
+                          fingers.getSourceLine());
+        } catch(libconfig::SettingNotFoundException& e) { }
+
+        try {
+            auto& threshold = swipe.lookup("threshold");
+            int mm = threshold.isNumber() ? (int)threshold : -1;
+            if(mm > 0 && mm <= 0xffff)
+                _swipe_threshold = mm;
+            else
+                logPrintf(WARN, "Line %d: threshold must be a positive "
+                                "number of millimetres, ignoring.",
+                          threshold.getSourceLine());
+        } catch(libconfig::SettingNotFoundException& e) { }
+
+        bool any = false;
+        for(int i = 0; i < SwipeCount; i++) {
+            try {
+                auto& action = swipe.lookup(swipe_names[i]);
+                try {
+                    _swipes[i] = Action::makeAction(dev, action);
+                    any = true;
+                } catch(InvalidAction& e) {
+                    logPrintf(WARN, "Line %d: %s is not a valid action, "
+                                    "ignoring.", action.getSourceLine(),
+                                    e.what());
+                }
+            } catch(libconfig::SettingNotFoundException& e) { }
+        }
+
+        // Without actions every contact goes to the touchpad
+        if(!any)
+            _swipe_fingers = 0;
+    } catch(libconfig::SettingNotFoundException& e) {
+        _swipe_fingers = 0;
+    }
+}
+
+bool Touchpad::Config::enabled() const
+{
+    return _enabled;
+}
+
+uint8_t Touchpad::Config::swipeFingers() const
+{
+    return _swipe_fingers;
+}
+
+uint16_t Touchpad::Config::swipeThreshold() const
+{
+    return _swipe_threshold;
+}
+
+const std::shared_ptr<Action>& Touchpad::Config::swipeAction(Swipe swipe)
+    const
+{
+    return _swipes[swipe];
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_FEATURE_TOUCHPAD_H
+#define LOGID_FEATURE_TOUCHPAD_H
+
+#include <array>
+#include <atomic>
+#include "../backend/hidpp20/features/TouchpadRawXY.h"
+#include "DeviceFeature.h"
+#include "../actions/Action.h"
+
+extern "C"
+{
+#include <libevdev/libevdev.h>
+#include <libevdev/libevdev-uinput.h>
+}
+
+// Contact IDs are 4 bits and 0 means no contact
+#define LOGID_TOUCHPAD_MAX_CONTACTS 16
+// Frames read in one batch that are written to uinput together
+#define LOGID_TOUCHPAD_BATCH_FRAMES 8
+#define LOGID_TOUCHPAD_SWIPE_FINGERS 3
+// Millimetres the fingers travel before a swipe fires
+#define LOGID_TOUCHPAD_SWIPE_THRESHOLD 15
+
+namespace logid {
+namespace features
+{
+    /* Touch surfaces that only send raw contacts, such as the T650, when
+     * the kernel's wtp driver does not handle them. Contacts are gathered
+     * into a frame, swipes are recognized on it and the rest goes out as
+     * a multitouch frame on a uinput touchpad of its own. Frames read in
+     * one batch go out in one write.
+     */
+    class Touchpad : public DeviceFeature
+    {
+    public:
+        explicit Touchpad(Device* dev);
+        ~Touchpad();
+        static backend::Result<void> supported(Device* dev);
+        virtual void configure();
+        virtual void listen();
+        virtual void reload();
+
+        enum Swipe
+        {
+            SwipeUp,
+            SwipeDown,
+            SwipeLeft,
+            SwipeRight,
+            SwipeCount
+        };
+
+        class Config : public DeviceFeature::Config
+        {
+        public:
+            explicit Config(Device* dev);
+            bool enabled() const;
+            uint8_t swipeFingers() const;
+            // Millimetres
+            uint16_t swipeThreshold() const;
+            const std::shared_ptr<actions::Action>& swipeAction(Swipe swipe)
+                const;
+        protected:
+            bool _enabled = false;
+            uint8_t _swipe_fingers = LOGID_TOUCHPAD_SWIPE_FINGERS;
+            uint16_t _swipe_threshold = LOGID_TOUCHPAD_SWIPE_THRESHOLD;
+            std::array<std::shared_ptr<actions::Action>, SwipeCount> _swipes;
+        };
+    private:
+        static constexpr std::size_t MaxContacts =
+                LOGID_TOUCHPAD_MAX_CONTACTS;
+        // Every slot lifted and set, plus the keys, axes and sync
+        static constexpr std::size_t MaxFrameEvents = MaxContacts * 7 + 16;
+
+        // One frame of contacts, kept by field so nothing is allocated
+        struct touch_frame
+        {
+            std::size_t count = 0;
+            bool button = false;
+            std::array<uint8_t, MaxContacts> id{};
+            std::array<uint16_t, MaxContacts> x{};
+            std::array<uint16_t, MaxContacts> y{};
+            std::array<uint8_t, MaxContacts> pressure{};
+            std::array<uint8_t, MaxContacts> area{};
+        };
+
+        void _rawEvent(backend::hidpp::Report& report);
+        void _frameDone();
+        // True while a swipe holds the contacts back
+        bool _recognize(const Config& config);
+        void _emitFrame();
+        void _emit(uint16_t type, uint16_t code, int32_t value);
+        void _flush();
+        void _createOutput();
+
+        std::shared_ptr<backend::hidpp20::TouchpadRawXY> _raw_xy;
+        backend::hidpp20::TouchpadRawXY::RawInfo _info{};
+        std::shared_ptr<Config> _config;
+        bool _raw_enabled = false;
+
+        // Only touched from the event handler
+        touch_frame _frame;
+        std::array<int32_t, MaxContacts> _tracking_ids;
+        int32_t _next_tracking_id = 0;
+        std::size_t _shown_count = 0;
+        bool _shown_button = false;
+        bool _swiping = false;
+        uint32_t _swipe_start_x = 0, _swipe_start_y = 0;
+        uint32_t _swipe_last_x = 0, _swipe_last_y = 0;
+        std::array<input_event, MaxFrameEvents * LOGID_TOUCHPAD_BATCH_FRAMES>
+            _events;
+        std::size_t _event_count = 0;
+
+        libevdev* _evdev = nullptr;
+        std::atomic<libevdev_uinput*> _uinput;
+    };
+}}
+
+#endif //LOGID_FEATURE_TOUCHPAD_H
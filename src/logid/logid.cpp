@@ -17,18 +17,46 @@
  */
 
 #include <algorithm>
+#include <csignal>
 #include <cstdio>
 #include <cstdlib>
+#include <future>
+#include <map>
 #include <mutex>
+#include <sstream>
+#include <system_error>
+#include <pthread.h>
+#include <unistd.h>
 
 #include "util/log.h"
 #include "DeviceManager.h"
+#include "ControlSocket.h"
+#include "StatusPage.h"
 #include "logid.h"
 #include "InputDevice.h"
+#include "Benchmark.h"
+#include "Plan.h"
 #include "util/workqueue.h"
+#include "util/reactor.h"
+#include "util/latency.h"
+#include "util/power.h"
+#include "util/realtime.h"
+#include "util/spawner.h"
+#include "util/suspend.h"
+#include "util/metrics.h"
+#include "util/timeline.h"
+#include "util/watchdog.h"
+#include "util/thread.h"
+#include "util/profiled_mutex.h"
+#include "backend/raw/Replay.h"
+#include "backend/raw/Capture.h"
+#include "backend/hidpp/Report.h"
+#include "backend/hidpp20/feature_defs.h"
 
 #define LOGID_VIRTUAL_INPUT_NAME "LogiOps Virtual Input"
 #define DEFAULT_CONFIG_FILE "/etc/logid.cfg"
+#define LOGID_REPLAY_MIN_REPORTS 100000
+#define LOGID_CAPTURE_SIZE (16 << 20)
 
 #ifndef LOGIOPS_VERSION
 #define LOGIOPS_VERSION "null"
@@ -40,14 +68,16 @@ using namespace logid;
 struct CmdlineOptions
 {
     std::string config_file = DEFAULT_CONFIG_FILE;
+    std::string replay_file;
+    std::string simulate;
+    std::string plan;
+    std::string capture_file;
+    std::string decode_file;
+    std::string trace_file;
+    std::string bench_path;
+    backend::hidpp::DeviceIndex bench_index = backend::hidpp::DefaultDevice;
 };
 
-LogLevel logid::global_loglevel = INFO;
-std::shared_ptr<Configuration> logid::global_config;
-std::unique_ptr<DeviceManager> logid::device_manager;
-std::unique_ptr<InputDevice> logid::virtual_input;
-std::shared_ptr<workqueue> logid::global_workqueue;
-
 bool logid::kill_logid = false;
 std::mutex logid::device_manager_reload;
 
@@ -57,23 +87,108 @@ enum class Option
     Verbose,
     Config,
     Help,
-    Version
+    Version,
+    Replay,
+    Simulate,
+    Capture,
+    Decode,
+    Trace,
+    Bench,
+    Plan
 };
 
-/*
+static std::string config_file = DEFAULT_CONFIG_FILE;
+
 void logid::reload()
 {
-    log_printf(INFO, "Reloading logid...");
-    finder_reloading.lock();
-    finder->stop();
-    Configuration* old_config = global_config;
-    global_config = new Configuration(config_file.c_str());
-    delete(old_config);
-    delete(finder);
-    finder = new DeviceMonitor();
-    finder_reloading.unlock();
+    logPrintf(INFO, "Reloading %s", config_file.c_str());
+
+    std::shared_ptr<Configuration> config;
+    try {
+        config = std::make_shared<Configuration>(config_file);
+    } catch(std::exception& e) {
+        logPrintf(WARN, "Could not reload config, keeping the old one: %s",
+                e.what());
+        return;
+    }
+
+    global_config->reloadDevices(*config);
+    if(virtual_input) {
+        try {
+            virtual_input->enable(global_config->inputKeys(),
+                    global_config->inputAxes());
+        } catch(std::system_error& e) {
+            logPrintf(WARN, "Could not add virtual input codes: %s",
+                    e.what());
+        }
+    }
+    if(device_manager)
+        device_manager->reload();
+}
+
+/* Devices are not torn down, the process exits once held keys are
+ * released and the snapshot is written. Requests in flight are cancelled
+ * so that nothing waiting on them holds up the snapshot. */
+static void shutdown()
+{
+    auto deadline = global_config->shutdownTimeout();
+    thread::spawn([deadline]() {
+        thread::setName("shutdown");
+        std::this_thread::sleep_for(deadline);
+        logPrintf(WARN, "Shutdown took more than %ld ms, exiting anyway",
+                (long)deadline.count());
+        _exit(EXIT_SUCCESS);
+    });
+
+    if(device_manager)
+        device_manager->cancelRequests();
+    if(virtual_input) {
+        virtual_input->releaseKeys();
+        virtual_input->stop();
+    }
+
+    if(device_manager && !global_config->snapshot().empty())
+        device_manager->saveSnapshot(global_config->snapshot());
+    timeline::stop();
+    // Threads are still running, skip static destructors
+    _exit(EXIT_SUCCESS);
+}
+
+static void blockSignals()
+{
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGHUP);
+    sigaddset(&set, SIGTERM);
+    sigaddset(&set, SIGINT);
+    int err = pthread_sigmask(SIG_BLOCK, &set, nullptr);
+    if(err)
+        throw std::system_error(err, std::system_category(),
+                "pthread_sigmask failed");
+}
+
+static void watchSignals()
+{
+    thread::spawn([]() {
+        thread::setName("signals");
+        sigset_t set;
+        sigemptyset(&set);
+        sigaddset(&set, SIGHUP);
+        sigaddset(&set, SIGTERM);
+        sigaddset(&set, SIGINT);
+        while(true) {
+            int sig;
+            if(sigwait(&set, &sig) != 0)
+                continue;
+            if(sig == SIGHUP)
+                reload();
+            else
+                shutdown();
+        }
+    }, [](std::exception& e) {
+        logPrintf(WARN, "Signal handling stopped: %s", e.what());
+    });
 }
- */
 
 void readCliOptions(const int argc, char** argv, CmdlineOptions& options)
 {
@@ -89,6 +204,13 @@ void readCliOptions(const int argc, char** argv, CmdlineOptions& options)
                 if (op_str == "--config") option = Option::Config;
                 if (op_str == "--help") option = Option::Help;
                 if (op_str == "--version") option = Option::Version;
+                if (op_str == "--replay") option = Option::Replay;
+                if (op_str == "--simulate") option = Option::Simulate;
+                if (op_str == "--capture") option = Option::Capture;
+                if (op_str == "--decode") option = Option::Decode;
+                if (op_str == "--trace") option = Option::Trace;
+                if (op_str == "--bench") option = Option::Bench;
+                if (op_str == "--plan") option = Option::Plan;
                 break;
             }
             case 'v': // Verbosity
@@ -138,6 +260,73 @@ void readCliOptions(const int argc, char** argv, CmdlineOptions& options)
                 options.config_file = argv[i];
                 break;
             }
+            case Option::Replay: {
+                if (++i >= argc) {
+                    logPrintf(ERROR, "Capture file is not specified.");
+                    exit(EXIT_FAILURE);
+                }
+                options.replay_file = argv[i];
+                break;
+            }
+            case Option::Plan: {
+                if (++i >= argc) {
+                    logPrintf(ERROR, "Simulated devices are not specified.");
+                    exit(EXIT_FAILURE);
+                }
+                options.plan = argv[i];
+                break;
+            }
+            case Option::Simulate: {
+                if (++i >= argc) {
+                    logPrintf(ERROR, "Simulated devices are not specified.");
+                    exit(EXIT_FAILURE);
+                }
+                options.simulate = argv[i];
+                break;
+            }
+            case Option::Capture: {
+                if (++i >= argc) {
+                    logPrintf(ERROR, "Capture file is not specified.");
+                    exit(EXIT_FAILURE);
+                }
+                options.capture_file = argv[i];
+                break;
+            }
+            case Option::Decode: {
+                if (++i >= argc) {
+                    logPrintf(ERROR, "Capture file is not specified.");
+                    exit(EXIT_FAILURE);
+                }
+                options.decode_file = argv[i];
+                break;
+            }
+            case Option::Trace: {
+                if (++i >= argc) {
+                    logPrintf(ERROR, "Trace file is not specified.");
+                    exit(EXIT_FAILURE);
+                }
+                options.trace_file = argv[i];
+                break;
+            }
+            case Option::Bench: {
+                if (++i >= argc) {
+                    logPrintf(ERROR, "Device path is not specified.");
+                    exit(EXIT_FAILURE);
+                }
+                options.bench_path = argv[i];
+                // The device index is optional
+                if (i + 1 < argc && argv[i + 1][0] != '-') {
+                    char* end = nullptr;
+                    auto index = std::strtoul(argv[++i], &end, 0);
+                    if (*end || index > 0xff) {
+                        logPrintf(ERROR, "Invalid device index %s.", argv[i]);
+                        exit(EXIT_FAILURE);
+                    }
+                    options.bench_index =
+                            (backend::hidpp::DeviceIndex)index;
+                }
+                break;
+            }
             case Option::Help:
                 printf(R"(logid version %s
 Usage: %s [options]
@@ -145,7 +334,24 @@ Possible options are:
     -v,--verbose [level]       Set log level to debug/info/warn/error (leave blank for debug)
     -V,--version               Print version number
     -c,--config [file path]    Change config file from default at %s
+    --replay [capture file]    Benchmark dispatch of a RAWREPORT capture and exit
+    --capture [file]           Record all raw reports to a binary capture file
+    --decode [capture file]    Print a binary capture and exit
+    --trace [file]             Record a timeline of daemon activity as Chrome
+                               trace JSON, for ui.perfetto.dev
+    --bench [hidraw] [index]   Measure request round trips of a device and
+                               exit, index defaults to 0xff
+    --simulate [spec]          Add simulated devices, spec is a comma separated
+                               list of mice=N, receivers=N, paired=N and
+                               asleep=N (per receiver), latency=us,
+                               rate=events/s and drop=N (per thousand
+                               requests). name=<name> names the mice
+    --plan [spec]              Print the requests startup and a wakeup send
+                               to the simulated devices of spec, with rtt=us
+                               for the time estimates, and exit
     -h,--help                  Print this message.
+
+Send SIGHUP to reload device settings from the config file.
 )", LOGIOPS_VERSION, argv[0], DEFAULT_CONFIG_FILE);
                 exit(EXIT_SUCCESS);
             case Option::Version:
@@ -156,6 +362,210 @@ Possible options are:
             }
         }
     }
+
+    if(global_loglevel < LOGID_MIN_LOGLEVEL)
+        logPrintf(WARN, "This build leaves out %s messages.",
+                levelPrefix(global_loglevel));
+}
+
+int bench(const std::string& path, backend::hidpp::DeviceIndex index)
+{
+    using namespace std::chrono;
+    auto us = [](nanoseconds time) {
+        return duration_cast<duration<double, std::micro>>(time).count();
+    };
+
+    try {
+        Benchmark benchmark(path, index);
+        printf("%-14s %5s %9s %9s %9s %9s %9s %9s\n", "request", "conc",
+               "req/s", "p50 us", "p90 us", "p99 us", "max us", "timeout%");
+        for(auto request : {Benchmark::Ping, Benchmark::FeatureCount,
+                Benchmark::FeatureTable}) {
+            for(std::size_t concurrency = 1;
+                    concurrency <= LOGID_BENCH_MAX_CONCURRENCY;
+                    concurrency *= 2) {
+                auto result = benchmark.run(request, concurrency,
+                        LOGID_BENCH_REQUESTS);
+                auto wall = duration_cast<duration<double>>(
+                        result.wall_time).count();
+                printf("%-14s %5zu %9.0f %9.0f %9.0f %9.0f %9.0f %9.2f\n",
+                       Benchmark::requestName(request), concurrency,
+                       result.requests / wall,
+                       us(result.percentile(50)), us(result.percentile(90)),
+                       us(result.percentile(99)), us(result.percentile(100)),
+                       100.0 * result.timeouts / result.requests);
+                if(result.errors)
+                    logPrintf(WARN, "%zu requests failed with an error.",
+                            result.errors);
+            }
+        }
+    } catch(std::exception& e) {
+        logPrintf(ERROR, "Benchmark failed: %s", e.what());
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int replay(const std::string& capture)
+{
+    try {
+        backend::raw::Replay replay(capture);
+        auto iterations = std::max<std::size_t>(1,
+                LOGID_REPLAY_MIN_REPORTS / replay.size());
+        auto result = replay.run(iterations);
+
+        using namespace std::chrono;
+        auto wall = duration_cast<duration<double>>(result.wall_time);
+        printf("Replayed %zu reports (%zu x %zu) in %.3f s\n",
+               result.reports, iterations, replay.size(), wall.count());
+        printf("%.0f reports/s, %.0f ns CPU/report\n",
+               result.reports / wall.count(),
+               (double)result.cpu_time.count() / result.reports);
+    } catch(std::exception& e) {
+        logPrintf(ERROR, "Replay failed: %s", e.what());
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+std::size_t logid::simulate(const std::string& spec)
+{
+    backend::raw::SimulatedDevice::Config config{};
+    std::size_t mice = 0, receivers = 0;
+    std::size_t paired = backend::raw::SimulatedDevice::MaxSlots;
+
+    std::istringstream options(spec);
+    std::string option;
+    while(std::getline(options, option, ',')) {
+        auto separator = option.find('=');
+        if(separator != std::string::npos &&
+           option.compare(0, separator, "name") == 0) {
+            config.name = option.substr(separator + 1);
+            continue;
+        }
+        char* end = nullptr;
+        unsigned long value = 0;
+        if(separator != std::string::npos)
+            value = std::strtoul(option.c_str() + separator + 1, &end, 10);
+        if(!end || *end) {
+            logPrintf(WARN, "Invalid simulate option %s, ignoring.",
+                    option.c_str());
+            continue;
+        }
+
+        auto key = option.substr(0, separator);
+        if(key == "mice")
+            mice = value;
+        else if(key == "receivers")
+            receivers = value;
+        else if(key == "paired")
+            paired = value;
+        else if(key == "asleep")
+            config.asleep = value;
+        else if(key == "latency")
+            config.latency = std::chrono::microseconds(value);
+        else if(key == "rate")
+            config.event_rate = value;
+        else if(key == "drop")
+            config.drop_rate = value;
+        else
+            logPrintf(WARN, "Unknown simulate option %s, ignoring.",
+                    key.c_str());
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    for(std::size_t i = 0; i < receivers; i++)
+        device_manager->addSimulatedDevice(
+                backend::raw::SimulatedDevice::receiver(
+                        "simulated/receiver" + std::to_string(i), paired,
+                        config));
+    for(std::size_t i = 0; i < mice; i++)
+        device_manager->addSimulatedDevice(
+                backend::raw::SimulatedDevice::mouse(
+                        "simulated/mouse" + std::to_string(i), config));
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start);
+    logPrintf(INFO, "Added %zu simulated mice and %zu receivers in %lld ms",
+            mice, receivers, (long long)elapsed.count());
+
+    paired = std::min(paired, backend::raw::SimulatedDevice::MaxSlots);
+    return mice + receivers * (paired - std::min(config.asleep, paired));
+}
+
+int decode(const std::string& capture)
+{
+    using backend::raw::Capture;
+    namespace hidpp = backend::hidpp;
+
+    std::vector<Capture::Record> records;
+    try {
+        records = Capture::read(capture);
+    } catch(Capture::InvalidCapture& e) {
+        logPrintf(ERROR, "Decode failed: %s", e.what());
+        return EXIT_FAILURE;
+    }
+
+    /* Feature indices are learned from Root.GetFeature exchanges, keyed by
+     * path and device index. Requests are matched to responses by their
+     * function and software ID. */
+    typedef std::pair<std::string, uint8_t> DeviceKey;
+    std::map<DeviceKey, std::map<uint8_t, uint16_t>> features;
+    std::map<std::pair<DeviceKey, uint8_t>, uint16_t> pending;
+
+    uint64_t start = records.empty() ? 0 : records.front().timestamp;
+    for(auto& record : records) {
+        auto& data = record.data;
+        printf("%12.6f %s %s", (double)(record.timestamp - start)/1e9,
+               record.path.c_str(),
+               record.direction == Capture::Out ? "OUT:" : "IN: ");
+        for(auto byte : data)
+            printf(" %02x", byte);
+
+        bool hidpp_report = data.size() > hidpp::Offset::Parameters + 1 &&
+                (data[0] == hidpp::Report::Type::Short ||
+                 data[0] == hidpp::Report::Type::Long);
+        if(hidpp_report) {
+            DeviceKey device(record.path, data[hidpp::Offset::DeviceIndex]);
+            uint8_t index = data[hidpp::Offset::Feature];
+            uint8_t function = data[hidpp::Offset::Function];
+            auto p = &data[hidpp::Offset::Parameters];
+
+            if(index == 0 && (function >> 4) == 0) {
+                auto key = std::make_pair(device, function);
+                if(record.direction == Capture::Out) {
+                    pending[key] = (p[0] << 8) | p[1];
+                } else {
+                    auto it = pending.find(key);
+                    if(it != pending.end()) {
+                        if(p[0] != 0)
+                            features[device][p[0]] = it->second;
+                        pending.erase(it);
+                    }
+                }
+            }
+
+            const char* name = nullptr;
+            if(index == 0) {
+                name = "ROOT";
+            } else {
+                auto device_features = features.find(device);
+                if(device_features != features.end()) {
+                    auto it = device_features->second.find(index);
+                    if(it != device_features->second.end())
+                        name = backend::hidpp20::FeatureID::name(it->second);
+                }
+            }
+            if(name)
+                printf("  [%s fn %d]", name, function >> 4);
+        }
+        printf("\n");
+    }
+
+    return EXIT_SUCCESS;
 }
 
 int main(int argc, char** argv)
@@ -163,27 +573,152 @@ int main(int argc, char** argv)
     CmdlineOptions options{};
     readCliOptions(argc, argv, options);
 
+    if(!options.decode_file.empty())
+        return decode(options.decode_file);
+
+    using namespace std::chrono;
+    auto start = steady_clock::now();
+    auto since = [](steady_clock::time_point from) {
+        return (long)duration_cast<milliseconds>(
+                steady_clock::now() - from).count();
+    };
+
     // Read config
+    config_file = options.config_file;
     try {
         global_config = std::make_shared<Configuration>(options.config_file);
     }
     catch (std::exception &e) {
         global_config = std::make_shared<Configuration>();
     }
+    auto config_time = since(start);
+
+    // Forked before the workqueue, devices and signal threads exist
+    spawner::start();
+
+    // Reloaded with SIGHUP, dumped with SIGUSR1, snapshotted on SIGTERM
+    // and SIGINT. All must be blocked before threads start
+    blockSignals();
+    if(global_config->latencyTracing())
+        latency::enable();
+    if(global_config->lockProfiling())
+        profiled_mutex::enable();
+    if(global_config->realtimeEnabled())
+        realtime::enable(global_config->realtimeSettings());
+    suspend::listen();
+    watchSignals();
+
     global_workqueue = std::make_shared<workqueue>(
-            global_config->workerCount());
+            global_config->workerScaling());
+    watchdog::configure(global_config->watchdogThreshold());
+    if(global_config->batteryMode())
+        power::enable(global_config->powerSettings(), [](bool) {
+            if(device_manager)
+                device_manager->powerChanged();
+        });
+
+    if(global_config->reactorEnabled())
+        global_reactors = std::make_shared<reactor_pool>(
+                global_config->reactorShards(),
+                global_config->reactorEvents(),
+                global_config->reactorCpus(),
+                global_config->reactorUring());
+
+    if(!options.plan.empty()) {
+        try {
+            Plan plan(options.plan);
+            plan.run();
+            plan.print();
+        } catch(std::exception& e) {
+            logPrintf(ERROR, "Plan failed: %s", e.what());
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+
+    if(!options.capture_file.empty()) {
+        try {
+            backend::raw::global_capture =
+                    std::make_shared<backend::raw::Capture>(
+                            options.capture_file, LOGID_CAPTURE_SIZE);
+        } catch(backend::raw::Capture::InvalidCapture& e) {
+            logPrintf(ERROR, "Could not open capture: %s", e.what());
+            return EXIT_FAILURE;
+        }
+    }
+
+    if(!options.trace_file.empty()) {
+        try {
+            timeline::start(options.trace_file);
+        } catch(std::system_error& e) {
+            logPrintf(ERROR, "Could not open trace: %s", e.what());
+            return EXIT_FAILURE;
+        }
+    }
+
+    if(!options.replay_file.empty())
+        return replay(options.replay_file);
+    if(!options.bench_path.empty())
+        return bench(options.bench_path, options.bench_index);
+
+    /* Creating the uinput device takes a while and only events need it,
+     * the rest of the setup goes on meanwhile. Probes wait for it. */
+    auto input_start = steady_clock::now();
+    auto input_ready = std::async(std::launch::async, [&]() {
+        virtual_input = std::make_unique<InputDevice>(LOGID_VIRTUAL_INPUT_NAME,
+                global_config->inputKeys(), global_config->inputAxes());
+        return since(input_start);
+    });
+
+    auto setup_start = steady_clock::now();
+    device_manager = std::make_unique<DeviceManager>();
+    if(!global_config->snapshot().empty())
+        device_manager->restore(global_config->snapshot());
+
+    if(!global_config->metricsFile().empty())
+        metrics::exportTextfile(global_config->metricsFile());
 
-    //Create a virtual input device
+    std::unique_ptr<ControlSocket> control_socket;
+    if(!global_config->controlSocket().empty()) {
+        try {
+            control_socket = std::make_unique<ControlSocket>(
+                    global_config->controlSocket());
+        } catch(std::system_error& e) {
+            logPrintf(WARN, "Could not open control socket %s: %s",
+                    global_config->controlSocket().c_str(), e.what());
+        }
+    }
+
+    std::unique_ptr<StatusPage> status_page;
+    if(!global_config->statusPage().empty()) {
+        try {
+            status_page = std::make_unique<StatusPage>(
+                    global_config->statusPage());
+        } catch(std::system_error& e) {
+            logPrintf(WARN, "Could not create status page %s: %s",
+                    global_config->statusPage().c_str(), e.what());
+        }
+    }
+
+    auto setup_time = since(setup_start);
+
+    long input_time;
     try {
-        virtual_input = std::make_unique<InputDevice>(LOGID_VIRTUAL_INPUT_NAME);
+        input_time = input_ready.get();
     } catch(std::system_error& e) {
         logPrintf(ERROR, "Could not create input device: %s", e.what());
         return EXIT_FAILURE;
     }
 
+    logPrintf(INFO, "Started in %ld ms: config %ld ms, setup %ld ms, "
+                    "input device %ld ms alongside setup", since(start),
+                    config_time, setup_time, input_time);
+
     // Scan devices, create listeners, handlers, etc.
-    device_manager = std::make_unique<DeviceManager>();
+    if(!options.simulate.empty())
+        simulate(options.simulate);
 
+    thread::setName("monitor");
     while(!kill_logid) {
         device_manager_reload.lock();
         device_manager_reload.unlock();
@@ -19,11 +19,19 @@
 #ifndef LOGID_LOGID_H
 #define LOGID_LOGID_H
 
+#include <cstddef>
 #include <mutex>
+#include <string>
 
 namespace logid
 {
-    // void reload();
+    /* Re-reads the config file and applies changed device settings.
+     * Global options (workers, io_timeout, etc.) need a restart. */
+    void reload();
+
+    /* Adds the simulated devices of a --simulate spec to device_manager,
+     * returns the number of devices that will be set up. */
+    std::size_t simulate(const std::string& spec);
 
     extern bool kill_logid;
     extern std::mutex device_manager_reload;
@@ -0,0 +1,86 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include "accel_curve.h"
+
+using namespace logid;
+using namespace std::chrono;
+
+accel_curve::accel_curve() : _shift (31), _flat (true)
+{
+    _table.fill(1 << LOGID_ACCEL_FRACTION_BITS);
+}
+
+accel_curve::accel_curve(const std::vector<std::pair<double, double>>& points)
+    : accel_curve()
+{
+    if(points.empty())
+        return;
+
+    // The last point falls in the last entry, past it the gain stays
+    double top = std::max(points.back().first, 1.0);
+    _shift = 0;
+    while((top / (1u << _shift)) >= _table.size() - 1 && _shift < 31)
+        _shift++;
+
+    _flat = true;
+    auto point = points.begin();
+    for(std::size_t i = 0; i < _table.size(); i++) {
+        // Entries stand for the middle of their range of speeds
+        double speed = (i + 0.5) * (1u << _shift);
+        while(point != points.end() && point->first <= speed)
+            ++point;
+
+        double gain;
+        if(point == points.begin()) {
+            gain = point->second;
+        } else if(point == points.end()) {
+            gain = points.back().second;
+        } else {
+            auto& low = *(point - 1);
+            auto& high = *point;
+            double span = high.first - low.first;
+            gain = span > 0 ? low.second + (high.second - low.second) *
+                    (speed - low.first) / span : high.second;
+        }
+
+        gain = std::min(std::max(gain, 0.0), (double)LOGID_ACCEL_MAX_GAIN);
+        _table[i] = std::min<long>(std::lround(std::ldexp(gain,
+                LOGID_ACCEL_FRACTION_BITS)), UINT16_MAX);
+        if(_table[i] != 1 << LOGID_ACCEL_FRACTION_BITS)
+            _flat = false;
+    }
+}
+
+bool accel_curve::flat() const
+{
+    return _flat;
+}
+
+uint32_t accel_curve::speed(int32_t delta, steady_clock::duration interval)
+{
+    auto clamped = std::min<steady_clock::duration>(std::max<
+            steady_clock::duration>(interval, LOGID_ACCEL_MIN_INTERVAL),
+            LOGID_ACCEL_MAX_INTERVAL);
+    uint64_t units = delta < 0 ? -(int64_t)delta : delta;
+    return std::min<uint64_t>(units * duration_cast<nanoseconds>(
+            seconds(1)).count() / duration_cast<nanoseconds>(clamped).count(),
+            UINT32_MAX);
+}
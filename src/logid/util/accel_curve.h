@@ -0,0 +1,71 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_ACCEL_CURVE_H
+#define LOGID_ACCEL_CURVE_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Fractional bits of a gain, the scaled delta of an event must fit 32 bits
+#define LOGID_ACCEL_FRACTION_BITS 8
+#define LOGID_ACCEL_TABLE_SIZE 256
+#define LOGID_ACCEL_MAX_GAIN 64
+/* Report intervals are clamped to this range, the first event after a
+ * pause counts as slow and events read together do not count as instant */
+#define LOGID_ACCEL_MIN_INTERVAL std::chrono::milliseconds(1)
+#define LOGID_ACCEL_MAX_INTERVAL std::chrono::milliseconds(100)
+
+namespace logid
+{
+    /* Maps the speed of an axis, in units per second, to a gain. The curve
+     * is given by points that are joined by straight lines, speeds past
+     * either end keep the gain of that end. It is sampled into a table of
+     * fixed-point gains when made, so a lookup is a shift and an index.
+     */
+    class accel_curve
+    {
+    public:
+        // Gain 1 at every speed
+        accel_curve();
+        // points are (speed, gain), sorted by speed
+        explicit accel_curve(
+                const std::vector<std::pair<double, double>>& points);
+
+        bool flat() const;
+        // With LOGID_ACCEL_FRACTION_BITS fractional bits
+        uint32_t gain(uint32_t speed) const
+        {
+            auto index = speed >> _shift;
+            return _table[index < _table.size() ? index : _table.size() - 1];
+        }
+
+        // Speed of delta units moved over interval, clamped as above
+        static uint32_t speed(int32_t delta,
+                std::chrono::steady_clock::duration interval);
+    private:
+        std::array<uint16_t, LOGID_ACCEL_TABLE_SIZE> _table;
+        unsigned _shift;
+        bool _flat;
+    };
+}
+
+#endif //LOGID_ACCEL_CURVE_H
@@ -0,0 +1,203 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "alloc.h"
+
+#ifdef LOGID_ALLOC_TRACKING
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#endif
+
+using namespace logid;
+
+const char* alloc::tagName(Tag tag)
+{
+    switch(tag) {
+    case Untagged:
+        return "untagged";
+    case Device:
+        return "device";
+    case Feature:
+        return "feature";
+    case Dispatch:
+        return "dispatch";
+    case Task:
+        return "task";
+    case Logging:
+        return "logging";
+    default:
+        return "unknown";
+    }
+}
+
+#ifndef LOGID_ALLOC_TRACKING
+
+alloc::stats alloc::get(Tag)
+{
+    return stats{};
+}
+
+uint64_t alloc::threadAllocations()
+{
+    return 0;
+}
+
+#else
+
+namespace
+{
+    struct counters
+    {
+        std::atomic<uint64_t> allocations;
+        std::atomic<uint64_t> bytes_live;
+        std::atomic<uint64_t> bytes_peak;
+    };
+
+    // Zero-initialized before anything can allocate
+    std::array<counters, alloc::TagCount> tags;
+    thread_local alloc::Tag current_tag;
+    thread_local uint64_t thread_allocations;
+
+    /* Each block starts with its size and tag so that a free is charged
+     * to the tag that allocated it. The header keeps the alignment new
+     * guarantees. */
+    struct alignas(alignof(std::max_align_t)) header
+    {
+        std::size_t size;
+        alloc::Tag tag;
+    };
+
+    void* allocate(std::size_t size)
+    {
+        auto block = static_cast<header*>(std::malloc(sizeof(header) + size));
+        if(!block)
+            return nullptr;
+        block->size = size;
+        block->tag = current_tag;
+        thread_allocations++;
+
+        auto& tag = tags[block->tag];
+        tag.allocations.fetch_add(1, std::memory_order_relaxed);
+        auto live = tag.bytes_live.fetch_add(size,
+                std::memory_order_relaxed) + size;
+        auto peak = tag.bytes_peak.load(std::memory_order_relaxed);
+        while(live > peak && !tag.bytes_peak.compare_exchange_weak(peak, live,
+                std::memory_order_relaxed)) { }
+        return block + 1;
+    }
+
+    void* allocateOrThrow(std::size_t size)
+    {
+        void* p;
+        while(!(p = allocate(size))) {
+            auto handler = std::get_new_handler();
+            if(!handler)
+                throw std::bad_alloc();
+            handler();
+        }
+        return p;
+    }
+
+    void release(void* p)
+    {
+        if(!p)
+            return;
+        auto block = static_cast<header*>(p) - 1;
+        tags[block->tag].bytes_live.fetch_sub(block->size,
+                std::memory_order_relaxed);
+        std::free(block);
+    }
+}
+
+alloc::stats alloc::get(Tag tag)
+{
+    auto& counters = tags[tag];
+    return {counters.allocations.load(std::memory_order_relaxed),
+            counters.bytes_live.load(std::memory_order_relaxed),
+            counters.bytes_peak.load(std::memory_order_relaxed)};
+}
+
+uint64_t alloc::threadAllocations()
+{
+    return thread_allocations;
+}
+
+alloc::scope::scope(Tag tag) : _previous (current_tag)
+{
+    current_tag = tag;
+}
+
+alloc::scope::~scope()
+{
+    current_tag = _previous;
+}
+
+void* operator new(std::size_t size)
+{
+    return allocateOrThrow(size);
+}
+
+void* operator new[](std::size_t size)
+{
+    return allocateOrThrow(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    return allocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    return allocate(size);
+}
+
+void operator delete(void* p) noexcept
+{
+    release(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    release(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    release(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept
+{
+    release(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+    release(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept
+{
+    release(p);
+}
+
+#endif
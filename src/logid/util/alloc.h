@@ -0,0 +1,91 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_ALLOC_H
+#define LOGID_ALLOC_H
+
+#include <cstdint>
+
+namespace logid
+{
+    /* Allocation accounting, only built with -DLOGID_ALLOC_TRACKING=ON.
+     * That build replaces the global operator new and delete and charges
+     * every allocation, and its free, to the subsystem tag of the thread
+     * that made it. Tags are set by scopes on the paths below, everything
+     * else is Untagged. Otherwise scopes compile to nothing and all stats
+     * read as zero.
+     */
+    class alloc
+    {
+    public:
+        enum Tag : uint8_t
+        {
+            Untagged,
+            Device,     // Setting up and waking up devices
+            Feature,    // Making and configuring features
+            Dispatch,   // Event handlers, down to the input device
+            Task,       // Queueing tasks and timers
+            Logging,
+            TagCount
+        };
+
+        struct stats
+        {
+            uint64_t allocations;
+            uint64_t bytes_live;
+            uint64_t bytes_peak;
+        };
+
+        static const char* tagName(Tag tag);
+
+        static constexpr bool enabled()
+        {
+#ifdef LOGID_ALLOC_TRACKING
+            return true;
+#else
+            return false;
+#endif
+        }
+
+        static stats get(Tag tag);
+        /* Allocations made by the calling thread so far, under any tag.
+         * Lets a benchmark hold a path to an allocation budget. */
+        static uint64_t threadAllocations();
+
+        // Tags the calling thread's allocations until destroyed
+        class scope
+        {
+        public:
+#ifdef LOGID_ALLOC_TRACKING
+            explicit scope(Tag tag);
+            ~scope();
+#else
+            explicit scope(Tag) { }
+#endif
+
+            scope(const scope&) = delete;
+            scope& operator=(const scope&) = delete;
+#ifdef LOGID_ALLOC_TRACKING
+        private:
+            Tag _previous;
+#endif
+        };
+    };
+}
+
+#endif //LOGID_ALLOC_H
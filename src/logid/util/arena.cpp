@@ -0,0 +1,87 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <cstdint>
+#include "arena.h"
+
+using namespace logid;
+
+namespace
+{
+    thread_local arena::scope* current_scope = nullptr;
+}
+
+arena::arena(std::size_t chunk_size) : _chunk_size (chunk_size),
+    _next (nullptr), _left (0), _size (0)
+{
+}
+
+void* arena::allocate(std::size_t size, std::size_t alignment)
+{
+    std::size_t padding = (alignment - reinterpret_cast<std::uintptr_t>(
+            _next) % alignment) % alignment;
+    if(!_next || padding + size > _left) {
+        // Large objects get a chunk of their own, the current one is kept
+        if(size + alignment > _chunk_size) {
+            _chunks.emplace_back(new char[size + alignment]);
+            auto base = _chunks.back().get();
+            _size += size;
+            return base + (alignment - reinterpret_cast<std::uintptr_t>(
+                    base) % alignment) % alignment;
+        }
+        _chunks.emplace_back(new char[_chunk_size]);
+        _next = _chunks.back().get();
+        _left = _chunk_size;
+        padding = (alignment - reinterpret_cast<std::uintptr_t>(
+                _next) % alignment) % alignment;
+    }
+
+    auto object = _next + padding;
+    _next += padding + size;
+    _left -= padding + size;
+    _size += size;
+    return object;
+}
+
+std::size_t arena::size() const
+{
+    return _size;
+}
+
+arena::scope::scope() : _arena (std::make_shared<arena>()),
+    _outer (current_scope)
+{
+    current_scope = this;
+}
+
+arena::scope::~scope()
+{
+    current_scope = _outer;
+}
+
+const std::shared_ptr<arena>& arena::scope::get() const
+{
+    return _arena;
+}
+
+std::shared_ptr<arena> arena::_current()
+{
+    if(!current_scope)
+        return nullptr;
+    return current_scope->get();
+}
@@ -0,0 +1,128 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_ARENA_H
+#define LOGID_ARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Objects of a config are usually well below this
+#define LOGID_ARENA_CHUNK_SIZE 4096
+
+namespace logid
+{
+    /* Bump allocator for object graphs that are built at once and freed
+     * together, e.g. a device's actions and gestures. Objects are laid out
+     * one after the other in the order they are made, and nothing is freed
+     * until the last object of the arena is gone.
+     *
+     * Objects are made in the arena of the innermost scope on the current
+     * thread, or on the heap outside of any scope. An arena must only be
+     * allocated from by the thread that has it in scope.
+     */
+    class arena
+    {
+    public:
+        explicit arena(std::size_t chunk_size=LOGID_ARENA_CHUNK_SIZE);
+        arena(const arena&) = delete;
+        arena& operator=(const arena&) = delete;
+
+        void* allocate(std::size_t size, std::size_t alignment);
+        // Bytes handed out so far
+        std::size_t size() const;
+
+        template<typename T>
+        class allocator
+        {
+        public:
+            typedef T value_type;
+
+            explicit allocator(std::shared_ptr<arena> owner) :
+                _arena (std::move(owner))
+            {
+            }
+            template<typename U>
+            allocator(const allocator<U>& other) : _arena (other._arena)
+            {
+            }
+
+            T* allocate(std::size_t n)
+            {
+                return static_cast<T*>(_arena->allocate(n * sizeof(T),
+                        alignof(T)));
+            }
+            // Freed with the arena
+            void deallocate(T*, std::size_t)
+            {
+            }
+
+            template<typename U>
+            bool operator==(const allocator<U>& other) const
+            {
+                return _arena == other._arena;
+            }
+            template<typename U>
+            bool operator!=(const allocator<U>& other) const
+            {
+                return _arena != other._arena;
+            }
+        private:
+            template<typename U>
+            friend class allocator;
+            // Every object keeps the arena alive
+            std::shared_ptr<arena> _arena;
+        };
+
+        class scope
+        {
+        public:
+            scope();
+            ~scope();
+            scope(const scope&) = delete;
+            scope& operator=(const scope&) = delete;
+
+            const std::shared_ptr<arena>& get() const;
+        private:
+            std::shared_ptr<arena> _arena;
+            scope* _outer;
+        };
+
+        template<typename T, typename... Args>
+        static std::shared_ptr<T> make(Args&&... args)
+        {
+            auto owner = _current();
+            if(!owner)
+                return std::make_shared<T>(std::forward<Args>(args)...);
+            return std::allocate_shared<T>(allocator<T>(owner),
+                    std::forward<Args>(args)...);
+        }
+    private:
+        static std::shared_ptr<arena> _current();
+
+        std::size_t _chunk_size;
+        std::vector<std::unique_ptr<char[]>> _chunks;
+        char* _next;
+        std::size_t _left;
+        std::size_t _size;
+    };
+}
+
+#endif //LOGID_ARENA_H
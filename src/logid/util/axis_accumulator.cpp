@@ -0,0 +1,118 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <cmath>
+#include <stdexcept>
+#include "axis_accumulator.h"
+
+using namespace logid;
+
+namespace
+{
+    int64_t gcd(int64_t a, int64_t b)
+    {
+        a = a < 0 ? -a : a;
+        b = b < 0 ? -b : b;
+        while(b) {
+            int64_t t = a % b;
+            a = b;
+            b = t;
+        }
+        return a;
+    }
+}
+
+axis_accumulator::axis_accumulator(Rounding rounding) :
+    axis_accumulator(1, 1, rounding)
+{
+}
+
+axis_accumulator::axis_accumulator(int64_t numerator, int64_t denominator,
+                                   Rounding rounding) :
+    _rounding (rounding), _numerator (1), _denominator (1), _remainder (0)
+{
+    setRatio(numerator, denominator);
+}
+
+void axis_accumulator::setMultiplier(double multiplier, int64_t divisor)
+{
+    setRatio(std::llround(std::ldexp(multiplier, LOGID_AXIS_FRACTION_BITS)),
+             divisor << LOGID_AXIS_FRACTION_BITS);
+}
+
+void axis_accumulator::setRatio(int64_t numerator, int64_t denominator)
+{
+    if(denominator == 0)
+        throw std::invalid_argument("axis_accumulator: zero denominator");
+    if(denominator < 0) {
+        numerator = -numerator;
+        denominator = -denominator;
+    }
+
+    int64_t divisor = gcd(numerator, denominator);
+    if(divisor > 1) {
+        numerator /= divisor;
+        denominator /= divisor;
+    }
+
+    // Keep the carried fraction the same size in the new sub-units
+    if(denominator != _denominator)
+        _remainder = _remainder * denominator / _denominator;
+
+    _numerator = numerator;
+    _denominator = denominator;
+}
+
+int32_t axis_accumulator::feed(int32_t delta)
+{
+    _remainder += delta * _numerator;
+
+    int64_t units;
+    switch(_rounding) {
+    case Floor:
+        units = _remainder / _denominator;
+        if(_remainder % _denominator < 0)
+            units--;
+        break;
+    case Nearest:
+        units = (_remainder + (_remainder < 0 ? -_denominator : _denominator)
+                / 2) / _denominator;
+        break;
+    default:
+        units = _remainder / _denominator;
+        break;
+    }
+
+    _remainder -= units * _denominator;
+    return (int32_t)units;
+}
+
+void axis_accumulator::reset()
+{
+    _remainder = 0;
+}
+
+int64_t axis_accumulator::numerator() const
+{
+    return _numerator;
+}
+
+int64_t axis_accumulator::denominator() const
+{
+    return _denominator;
+}
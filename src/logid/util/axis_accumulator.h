@@ -0,0 +1,63 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_AXIS_ACCUMULATOR_H
+#define LOGID_AXIS_ACCUMULATOR_H
+
+#include <cstdint>
+
+// Fractional bits kept when converting a floating point multiplier
+#define LOGID_AXIS_FRACTION_BITS 16
+
+namespace logid
+{
+    /* Scales axis movement by a rational multiplier and hands out whole
+     * units, carrying the fraction that did not make a unit as an integer
+     * number of sub-units so nothing is lost between events.
+     */
+    class axis_accumulator
+    {
+    public:
+        enum Rounding
+        {
+            TowardZero, // Emit a unit once a whole one has built up
+            Floor,      // Track floor(position), also emits negative units
+            Nearest     // Emit a unit once half of one has built up
+        };
+
+        explicit axis_accumulator(Rounding rounding=TowardZero);
+        axis_accumulator(int64_t numerator, int64_t denominator,
+                         Rounding rounding=TowardZero);
+
+        // multiplier/divisor, multiplier kept to LOGID_AXIS_FRACTION_BITS
+        void setMultiplier(double multiplier, int64_t divisor=1);
+        void setRatio(int64_t numerator, int64_t denominator);
+
+        int32_t feed(int32_t delta);
+        void reset();
+
+        int64_t numerator() const;
+        int64_t denominator() const;
+    private:
+        Rounding _rounding;
+        int64_t _numerator;
+        int64_t _denominator;
+        int64_t _remainder;
+    };
+}
+
+#endif //LOGID_AXIS_ACCUMULATOR_H
@@ -0,0 +1,39 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <random>
+#include "backoff.h"
+
+using namespace logid;
+using namespace std::chrono;
+
+milliseconds backoff::delay(const settings& config, int retry)
+{
+    thread_local std::minstd_rand generator(std::random_device{}());
+
+    // Stop doubling before the shift overflows, max_delay is reached anyway
+    auto full = config.delay * (1 << std::min(retry, 16));
+    full = std::min(full, config.max_delay);
+    if(full.count() <= 1)
+        return full;
+
+    std::uniform_int_distribution<milliseconds::rep> jitter(0,
+            full.count() / 2);
+    return full - milliseconds(jitter(generator));
+}
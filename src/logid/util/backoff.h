@@ -0,0 +1,54 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_BACKOFF_H
+#define LOGID_BACKOFF_H
+
+#include <chrono>
+
+#define LOGID_DEFAULT_RETRY_COUNT 3
+#define LOGID_DEFAULT_RETRY_DELAY std::chrono::milliseconds(10)
+#define LOGID_DEFAULT_RETRY_MAX_DELAY std::chrono::milliseconds(250)
+
+namespace logid
+{
+    /* Delays between attempts at something that failed for a transient
+     * reason, e.g. a full radio queue or a busy device. Every retry waits
+     * about twice as long as the one before, randomised so that devices
+     * that failed together do not retry together.
+     */
+    class backoff
+    {
+    public:
+        struct settings
+        {
+            // Retries after the first attempt, 0 disables retrying
+            int count = LOGID_DEFAULT_RETRY_COUNT;
+            std::chrono::milliseconds delay = LOGID_DEFAULT_RETRY_DELAY;
+            std::chrono::milliseconds max_delay =
+                    LOGID_DEFAULT_RETRY_MAX_DELAY;
+        };
+
+        /* Between half and all of delay * 2^retry, at most max_delay.
+         * retry counts from 0. */
+        static std::chrono::milliseconds delay(const settings& config,
+                int retry);
+    };
+}
+
+#endif //LOGID_BACKOFF_H
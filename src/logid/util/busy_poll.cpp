@@ -0,0 +1,125 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <array>
+#include <thread>
+#include "busy_poll.h"
+#include "power.h"
+
+extern "C"
+{
+#include <poll.h>
+#include <unistd.h>
+}
+
+// Pipe round trips timed to find the wakeup cost, the median is kept
+#define LOGID_WAKEUP_SAMPLES 31
+
+using namespace logid;
+using namespace std::chrono;
+
+namespace
+{
+    nanoseconds measureWakeup()
+    {
+        int ping[2], pong[2];
+        if(::pipe(ping))
+            return nanoseconds(0);
+        if(::pipe(pong)) {
+            ::close(ping[0]);
+            ::close(ping[1]);
+            return nanoseconds(0);
+        }
+
+        // The waiter answers with the time it was woken at
+        std::thread waiter([&ping, &pong]() {
+            struct pollfd fd = {ping[0], POLLIN, 0};
+            char byte;
+            while(::poll(&fd, 1, -1) > 0 && ::read(ping[0], &byte, 1) == 1) {
+                auto woken = steady_clock::now();
+                if(::write(pong[1], &woken, sizeof(woken)) != sizeof(woken))
+                    break;
+            }
+        });
+
+        std::array<nanoseconds, LOGID_WAKEUP_SAMPLES> samples{};
+        std::size_t count = 0;
+        for(auto& sample : samples) {
+            // Gives the waiter time to block again
+            std::this_thread::sleep_for(microseconds(200));
+            char byte = 0;
+            auto sent = steady_clock::now();
+            steady_clock::time_point woken;
+            if(::write(ping[1], &byte, 1) != 1 ||
+               ::read(pong[0], &woken, sizeof(woken)) != sizeof(woken))
+                break;
+            sample = woken - sent;
+            count++;
+        }
+
+        // Closing the write end ends the waiter
+        ::close(ping[1]);
+        waiter.join();
+        ::close(ping[0]);
+        ::close(pong[0]);
+        ::close(pong[1]);
+
+        if(!count)
+            return nanoseconds(0);
+        std::sort(samples.begin(), samples.begin() + count);
+        return samples[count / 2];
+    }
+}
+
+void busy_poll::setLimit(microseconds limit)
+{
+    _limit = std::min(limit, microseconds(LOGID_BUSY_POLL_MAX));
+}
+
+microseconds busy_poll::limit() const
+{
+    return _limit;
+}
+
+void busy_poll::report(steady_clock::time_point now)
+{
+    if(_last != steady_clock::time_point()) {
+        auto interval = now - _last;
+        // Gaps while the device rests would keep the window shut too long
+        interval = std::min<nanoseconds>(interval, _limit * 4);
+        _interval = _interval.count() ? (_interval * 7 + interval) / 8 :
+                duration_cast<nanoseconds>(interval);
+    }
+    _last = now;
+}
+
+nanoseconds busy_poll::window() const
+{
+    if(!_limit.count() || !_interval.count() || _interval > _limit ||
+       power::saving() || power::onBattery())
+        return nanoseconds(0);
+    // Covers a report that is somewhat late
+    return std::min<nanoseconds>(_interval * 3 / 2, _limit);
+}
+
+nanoseconds busy_poll::wakeupCost()
+{
+    static const nanoseconds cost = measureWakeup();
+    return cost;
+}
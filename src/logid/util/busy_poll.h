@@ -0,0 +1,62 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_BUSY_POLL_H
+#define LOGID_BUSY_POLL_H
+
+#include <chrono>
+
+// Window used when busy_poll is set to true
+#define LOGID_BUSY_POLL_DEFAULT std::chrono::microseconds(250)
+/* The I/O thread may be shared by several devices, a longer window would
+ * hold back their reports. */
+#define LOGID_BUSY_POLL_MAX std::chrono::microseconds(2000)
+
+namespace logid
+{
+    /* Decides how long an I/O thread keeps reading a node without blocking
+     * once a report came in. The window follows the report interval, so
+     * that it covers the next report of a device moving at its full rate
+     * and is not spent on devices that report seldom. It is closed while
+     * the system runs on battery, see power::onBattery(). Only the I/O
+     * thread uses an instance.
+     */
+    class busy_poll
+    {
+    public:
+        // 0 disables busy polling
+        void setLimit(std::chrono::microseconds limit);
+        std::chrono::microseconds limit() const;
+
+        // Called on every report read, spun for or not
+        void report(std::chrono::steady_clock::time_point now);
+        // 0 if the I/O thread should block right away
+        std::chrono::nanoseconds window() const;
+
+        /* What a blocking wait costs from a write to the waiter running,
+         * measured once. Every report a spin read is credited with it. */
+        static std::chrono::nanoseconds wakeupCost();
+    private:
+        std::chrono::microseconds _limit{0};
+        std::chrono::steady_clock::time_point _last;
+        // Moving average of the time between reports
+        std::chrono::nanoseconds _interval{0};
+    };
+}
+
+#endif //LOGID_BUSY_POLL_H
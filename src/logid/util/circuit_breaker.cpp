@@ -0,0 +1,129 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "circuit_breaker.h"
+#include "backoff.h"
+
+using namespace logid;
+using namespace std::chrono;
+
+std::atomic<int> circuit_breaker::_failing(0);
+
+circuit_breaker::circuit_breaker() : _failures (0), _probing (false),
+    _rejected (0)
+{
+}
+
+circuit_breaker::State circuit_breaker::state() const
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    if(_failures >= LOGID_BREAKER_THRESHOLD)
+        return Open;
+    return _failures ? Degraded : Healthy;
+}
+
+int circuit_breaker::failures() const
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    return _failures;
+}
+
+uint64_t circuit_breaker::rejected() const
+{
+    return _rejected.load(std::memory_order_relaxed);
+}
+
+int circuit_breaker::failing()
+{
+    return _failing.load(std::memory_order_relaxed);
+}
+
+bool circuit_breaker::_begin(bool& failing)
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    failing = false;
+    if(!_failures)
+        return true;
+
+    bool open = _failures >= LOGID_BREAKER_THRESHOLD;
+    if(open && (_probing || steady_clock::now() < _next_probe)) {
+        _rejected.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    // Healthy devices must not wait behind ones that time out
+    int running = _failing.load(std::memory_order_relaxed);
+    do {
+        if(running >= LOGID_BREAKER_CONCURRENT) {
+            _rejected.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+    } while(!_failing.compare_exchange_weak(running, running + 1));
+
+    failing = true;
+    _probing = open;
+    return true;
+}
+
+void circuit_breaker::_end(bool failing, bool success)
+{
+    if(failing)
+        _failing.fetch_sub(1, std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(_lock);
+    if(failing)
+        _probing = false;
+    if(success) {
+        _failures = 0;
+        return;
+    }
+
+    _failures++;
+    if(_failures >= LOGID_BREAKER_THRESHOLD) {
+        backoff::settings probes;
+        probes.delay = LOGID_BREAKER_PROBE_DELAY;
+        probes.max_delay = LOGID_BREAKER_MAX_PROBE_DELAY;
+        _next_probe = steady_clock::now() + backoff::delay(probes,
+                _failures - LOGID_BREAKER_THRESHOLD);
+    }
+}
+
+circuit_breaker::attempt::attempt(circuit_breaker& breaker) :
+    _breaker (breaker), _failing (false), _done (false)
+{
+    _allowed = _breaker._begin(_failing);
+}
+
+circuit_breaker::attempt::~attempt()
+{
+    if(_allowed && !_done)
+        _breaker._end(_failing, false);
+}
+
+circuit_breaker::attempt::operator bool() const
+{
+    return _allowed;
+}
+
+void circuit_breaker::attempt::succeeded()
+{
+    if(!_allowed || _done)
+        return;
+    _done = true;
+    _breaker._end(_failing, true);
+}
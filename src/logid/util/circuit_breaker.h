@@ -0,0 +1,96 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_CIRCUIT_BREAKER_H
+#define LOGID_CIRCUIT_BREAKER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+// Consecutive failures before a device is only probed on a backoff
+#define LOGID_BREAKER_THRESHOLD 3
+#define LOGID_BREAKER_PROBE_DELAY std::chrono::milliseconds(1000)
+#define LOGID_BREAKER_MAX_PROBE_DELAY std::chrono::milliseconds(300000)
+// Operations on unhealthy devices that may run at once, over all devices
+#define LOGID_BREAKER_CONCURRENT 2
+
+namespace logid
+{
+    /* Health of one device, as seen by the operations that time out on it
+     * (initializing, waking up). A device that keeps failing is probed
+     * less and less often instead of holding a worker for the whole IO
+     * timeout every time it sends a stray report. One success makes it
+     * healthy again.
+     */
+    class circuit_breaker
+    {
+    public:
+        enum State
+        {
+            Healthy,
+            Degraded,   // Failed recently, runs if a failing slot is free
+            Open        // Only one probe once the probe delay passed
+        };
+
+        circuit_breaker();
+
+        /* One operation on the device. Operations that are not allowed
+         * must not run, allowed ones count as failed unless succeeded()
+         * is called before they go out of scope.
+         */
+        class attempt
+        {
+        public:
+            explicit attempt(circuit_breaker& breaker);
+            ~attempt();
+            attempt(const attempt&) = delete;
+            attempt& operator=(const attempt&) = delete;
+
+            explicit operator bool() const;
+            void succeeded();
+        private:
+            circuit_breaker& _breaker;
+            bool _allowed;
+            // Whether it holds one of the LOGID_BREAKER_CONCURRENT slots
+            bool _failing;
+            bool _done;
+        };
+
+        State state() const;
+        int failures() const;
+        uint64_t rejected() const;
+
+        // Operations on unhealthy devices running right now
+        static int failing();
+    private:
+        bool _begin(bool& failing);
+        void _end(bool failing, bool success);
+
+        mutable std::mutex _lock;
+        int _failures;
+        bool _probing;
+        std::chrono::steady_clock::time_point _next_probe;
+        std::atomic<uint64_t> _rejected;
+
+        static std::atomic<int> _failing;
+    };
+}
+
+#endif //LOGID_CIRCUIT_BREAKER_H
@@ -0,0 +1,109 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "coalescer.h"
+#include "log.h"
+
+using namespace logid;
+
+coalescer::coalescer(std::chrono::milliseconds window,
+        const std::function<void(int)>& emit) : _window (window),
+        _emit (emit), _pending (0), _open (false), _stopped (false)
+{
+}
+
+coalescer::~coalescer()
+{
+    std::shared_ptr<timer> t;
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        _stopped = true;
+        t = std::move(_timer);
+    }
+    if(t)
+        t->cancel();
+}
+
+void coalescer::add(int delta)
+{
+    if(!delta)
+        return;
+
+    std::lock_guard<std::mutex> lock(_lock);
+    if(!_window.count()) {
+        _emit(delta);
+        return;
+    }
+
+    if(_pending && ((_pending < 0) != (delta < 0))) {
+        _emit(_pending);
+        _pending = 0;
+    }
+
+    if(_open) {
+        _pending += delta;
+    } else {
+        _emit(delta);
+        _openWindow();
+    }
+}
+
+void coalescer::flush(const std::function<void()>& then)
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    if(_pending) {
+        _emit(_pending);
+        _pending = 0;
+    }
+    if(then)
+        then();
+}
+
+/* One periodic timer serves every window of a burst, so a steady scroll
+ * does not allocate a timer per window. */
+void coalescer::_openWindow()
+{
+    if(_stopped)
+        return;
+
+    _open = true;
+    if(_timer)
+        return;
+    _timer = task::spawnEvery(_window, [this]() { _closeWindow(); },
+            [](std::exception& e) {
+        logPrintf(WARN, "Error while coalescing wheel events: %s", e.what());
+    }, task::Interactive);
+}
+
+void coalescer::_closeWindow()
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    // Keep the window going while the burst lasts
+    if(_pending && !_stopped) {
+        int pending = _pending;
+        _pending = 0;
+        _emit(pending);
+        return;
+    }
+
+    _open = false;
+    if(_timer) {
+        _timer->cancel();
+        _timer.reset();
+    }
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_COALESCER_H
+#define LOGID_COALESCER_H
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include "timer_wheel.h"
+
+namespace logid
+{
+    /* Merges bursts of deltas into one per window. The first delta of a
+     * burst is passed on straight away and opens a window, deltas that
+     * arrive while it is open are summed and passed on when it closes.
+     * A delta in the other direction passes on the pending sum first, so
+     * direction changes are never merged away.
+     *
+     * emit is called with the coalescer's lock held, either on the thread
+     * that added the delta or on a worker once the window closes.
+     */
+    class coalescer
+    {
+    public:
+        // A window of zero passes every delta on as it comes
+        coalescer(std::chrono::milliseconds window,
+                const std::function<void(int)>& emit);
+        ~coalescer();
+
+        void add(int delta);
+        /* Passes on the pending sum now, e.g. when the wheel stops. then is
+         * run afterwards under the same lock, so it is ordered against
+         * every emit. */
+        void flush(const std::function<void()>& then=nullptr);
+    private:
+        void _openWindow();
+        void _closeWindow();
+
+        const std::chrono::milliseconds _window;
+        const std::function<void(int)> _emit;
+
+        std::mutex _lock;
+        int _pending;
+        bool _open;
+        bool _stopped;
+        std::shared_ptr<timer> _timer;
+    };
+}
+
+#endif //LOGID_COALESCER_H
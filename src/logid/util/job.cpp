@@ -0,0 +1,154 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <mutex>
+#include "job.h"
+#include "ExceptionHandler.h"
+
+using namespace logid;
+
+struct job::depot
+{
+    std::mutex lock;
+    node* head = nullptr;
+    std::size_t count = 0;
+};
+
+struct job::cache
+{
+    node* head = nullptr;
+    std::size_t count = 0;
+
+    // Nodes of an exiting thread go to the depot
+    ~cache()
+    {
+        if(!head)
+            return;
+
+        auto& shared = _depot();
+        std::lock_guard<std::mutex> lock(shared.lock);
+        while(head) {
+            auto n = head;
+            head = n->next;
+            if(shared.count < LOGID_JOB_DEPOT_SIZE) {
+                n->next = shared.head;
+                shared.head = n;
+                shared.count++;
+            } else {
+                delete n;
+            }
+        }
+    }
+};
+
+thread_local job::cache job::_cache;
+
+job::job(job&& other) noexcept : _node (other._node)
+{
+    other._node = nullptr;
+}
+
+job& job::operator=(job&& other) noexcept
+{
+    if(this != &other) {
+        _reset();
+        _node = other._node;
+        other._node = nullptr;
+    }
+    return *this;
+}
+
+job::~job()
+{
+    _reset();
+}
+
+void job::run()
+{
+    try {
+        _node->invoke(&_node->storage);
+    } catch(std::exception& e) {
+        ExceptionHandler::Default(e);
+    }
+}
+
+void job::_reset() noexcept
+{
+    if(_node) {
+        _node->destroy(&_node->storage);
+        _release(_node);
+        _node = nullptr;
+    }
+}
+
+job::depot& job::_depot()
+{
+    // Never destroyed, thread caches may hand nodes back after exit
+    static auto ret = new depot;
+    return *ret;
+}
+
+job::node* job::_allocate()
+{
+    auto& local = _cache;
+    if(!local.head) {
+        auto& shared = _depot();
+        std::lock_guard<std::mutex> lock(shared.lock);
+        for(std::size_t i = 0; i < LOGID_JOB_BATCH && shared.head; i++) {
+            auto n = shared.head;
+            shared.head = n->next;
+            shared.count--;
+            n->next = local.head;
+            local.head = n;
+            local.count++;
+        }
+    }
+
+    if(!local.head)
+        return new node;
+
+    auto n = local.head;
+    local.head = n->next;
+    local.count--;
+    return n;
+}
+
+void job::_release(node* n) noexcept
+{
+    auto& local = _cache;
+    n->next = local.head;
+    local.head = n;
+    local.count++;
+    if(local.count <= LOGID_JOB_CACHE_SIZE)
+        return;
+
+    auto& shared = _depot();
+    std::lock_guard<std::mutex> lock(shared.lock);
+    for(std::size_t i = 0; i < LOGID_JOB_BATCH; i++) {
+        n = local.head;
+        local.head = n->next;
+        local.count--;
+        if(shared.count < LOGID_JOB_DEPOT_SIZE) {
+            n->next = shared.head;
+            shared.head = n;
+            shared.count++;
+        } else {
+            delete n;
+        }
+    }
+}
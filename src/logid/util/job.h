@@ -0,0 +1,132 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_JOB_H
+#define LOGID_JOB_H
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Callables up to this size are stored in the node itself
+#define LOGID_JOB_INLINE_SIZE 64
+// Free nodes kept by each thread before some are handed to the depot
+#define LOGID_JOB_CACHE_SIZE 64
+// Nodes moved between a thread's cache and the depot at once
+#define LOGID_JOB_BATCH 32
+// Free nodes kept by the depot, further ones are deleted
+#define LOGID_JOB_DEPOT_SIZE 4096
+
+namespace logid
+{
+    /* A function that is run once and never waited for. Unlike a task it
+     * has no future, status or condition variable, and small callables
+     * live inside a node that is reused rather than allocated.
+     *
+     * Nodes are cached per thread. Jobs are usually made on one thread and
+     * freed on another, so caches exchange batches through a shared depot.
+     */
+    class job
+    {
+    public:
+        job() noexcept : _node (nullptr)
+        {
+        }
+
+        template<typename Function, typename = typename std::enable_if<
+                !std::is_same<typename std::decay<Function>::type,
+                job>::value>::type>
+        explicit job(Function&& function) : _node (_allocate())
+        {
+            typedef typename std::decay<Function>::type callable;
+            try {
+                _emplace<callable>(std::forward<Function>(function),
+                        std::integral_constant<bool,
+                        sizeof(callable) <= LOGID_JOB_INLINE_SIZE &&
+                        alignof(callable) <= alignof(std::max_align_t)>());
+            } catch(...) {
+                _release(_node);
+                throw;
+            }
+        }
+
+        job(job&& other) noexcept;
+        job& operator=(job&& other) noexcept;
+        job(const job&) = delete;
+        job& operator=(const job&) = delete;
+        ~job();
+
+        // Exceptions are passed to ExceptionHandler::Default
+        void run();
+
+        explicit operator bool() const noexcept
+        {
+            return _node != nullptr;
+        }
+
+    private:
+        struct node
+        {
+            typename std::aligned_storage<LOGID_JOB_INLINE_SIZE,
+                    alignof(std::max_align_t)>::type storage;
+            void (*invoke)(void*);
+            void (*destroy)(void*);
+            node* next;
+        };
+
+        struct cache;
+        struct depot;
+
+        template<typename callable, typename Function>
+        void _emplace(Function&& function, std::true_type)
+        {
+            new (&_node->storage) callable(std::forward<Function>(function));
+            _node->invoke = [](void* storage) {
+                (*static_cast<callable*>(storage))();
+            };
+            _node->destroy = [](void* storage) {
+                static_cast<callable*>(storage)->~callable();
+            };
+        }
+
+        template<typename callable, typename Function>
+        void _emplace(Function&& function, std::false_type)
+        {
+            auto heap = new callable(std::forward<Function>(function));
+            new (&_node->storage) callable*(heap);
+            _node->invoke = [](void* storage) {
+                (**static_cast<callable**>(storage))();
+            };
+            _node->destroy = [](void* storage) {
+                delete *static_cast<callable**>(storage);
+            };
+        }
+
+        void _reset() noexcept;
+
+        static node* _allocate();
+        static void _release(node* n) noexcept;
+        static depot& _depot();
+
+        static thread_local cache _cache;
+
+        node* _node;
+    };
+}
+
+#endif //LOGID_JOB_H
@@ -0,0 +1,219 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <csignal>
+#include <cstring>
+#include <sstream>
+#include <system_error>
+#include "latency.h"
+#include "thread.h"
+#include "log.h"
+#include "workqueue.h"
+
+extern "C"
+{
+#include <pthread.h>
+}
+
+using namespace logid;
+using namespace std::chrono;
+
+std::atomic<bool> latency::_enabled(false);
+std::mutex latency::_devices_lock;
+std::map<std::string, std::shared_ptr<latency::stats>> latency::_devices;
+
+namespace
+{
+    struct Trace
+    {
+        std::shared_ptr<latency::stats> device;
+        steady_clock::time_point last;
+        int stage = latency::StageCount;
+    };
+
+    thread_local Trace current_trace;
+}
+
+const char* latency::stageName(Stage stage)
+{
+    switch(stage) {
+    case Read:
+        return "read";
+    case Dispatch:
+        return "dispatch";
+    case Action:
+        return "action";
+    case Write:
+        return "write";
+    default:
+        return "unknown";
+    }
+}
+
+latency::histogram::histogram() : _count (0), _total_ns (0), _max_ns (0)
+{
+    for(auto& bucket : _buckets)
+        bucket = 0;
+}
+
+void latency::histogram::record(nanoseconds duration)
+{
+    auto ns = static_cast<uint64_t>(duration.count() > 0 ?
+            duration.count() : 0);
+    std::size_t bucket = 0;
+    for(uint64_t us = ns / 1000; us && bucket < BucketCount - 1; us >>= 1)
+        bucket++;
+
+    _buckets[bucket]++;
+    _count++;
+    _total_ns += ns;
+
+    auto max = _max_ns.load();
+    while(ns > max && !_max_ns.compare_exchange_weak(max, ns));
+}
+
+uint64_t latency::histogram::bucket(std::size_t i) const
+{
+    return _buckets[i];
+}
+
+uint64_t latency::histogram::totalNs() const
+{
+    return _total_ns;
+}
+
+std::string latency::histogram::summary() const
+{
+    std::stringstream s;
+    uint64_t count = _count;
+    if(!count)
+        return "no samples";
+
+    // Percentiles are reported as the upper bound of their bucket
+    auto percentile = [this, count](double p)->uint64_t {
+        uint64_t seen = 0;
+        for(std::size_t i = 0; i < BucketCount; i++) {
+            seen += _buckets[i];
+            if(seen >= count * p)
+                return 1ull << i;
+        }
+        return 1ull << (BucketCount - 1);
+    };
+
+    s << count << " samples, mean " << (_total_ns / count) / 1000 <<
+        " us, p50 <" << percentile(0.5) << " us, p99 <" <<
+        percentile(0.99) << " us, max " << _max_ns / 1000 << " us";
+    return s.str();
+}
+
+void latency::enable()
+{
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    int err = pthread_sigmask(SIG_BLOCK, &set, nullptr);
+    if(err)
+        throw std::system_error(err, std::system_category(),
+                "pthread_sigmask failed");
+
+    thread::spawn([set]() {
+        thread::setName("latency");
+        while(true) {
+            int sig;
+            if(sigwait(&set, &sig) == 0 && sig == SIGUSR1)
+                dump();
+        }
+    }, [](std::exception& e) {
+        logPrintf(WARN, "Latency tracing stopped: %s", e.what());
+    });
+
+    _enabled = true;
+}
+
+bool latency::enabled()
+{
+    return _enabled;
+}
+
+std::shared_ptr<latency::stats> latency::device(const std::string& name)
+{
+    if(!_enabled)
+        return nullptr;
+
+    std::lock_guard<std::mutex> lock(_devices_lock);
+    auto& device = _devices[name];
+    if(!device)
+        device = std::make_shared<stats>();
+    return device;
+}
+
+std::map<std::string, std::shared_ptr<latency::stats>> latency::devices()
+{
+    std::lock_guard<std::mutex> lock(_devices_lock);
+    return _devices;
+}
+
+void latency::begin(const std::shared_ptr<stats>& device,
+        steady_clock::time_point start)
+{
+    if(!device)
+        return;
+
+    current_trace.device = device;
+    current_trace.last = start;
+    current_trace.stage = Read - 1;
+    mark(Read);
+}
+
+void latency::mark(Stage stage)
+{
+    // Only the first time a stage is reached is recorded
+    if(!current_trace.device || stage <= current_trace.stage)
+        return;
+
+    auto now = steady_clock::now();
+    current_trace.device->stages[stage].record(now - current_trace.last);
+    current_trace.last = now;
+    current_trace.stage = stage;
+
+    if(stage == Write)
+        end();
+}
+
+void latency::end()
+{
+    current_trace.device.reset();
+}
+
+void latency::dump()
+{
+    if(global_workqueue)
+        logPrintf(INFO, "Queued tasks: %zu interactive, %zu normal, "
+                        "%zu background",
+                global_workqueue->depth(task::Interactive),
+                global_workqueue->depth(task::Normal),
+                global_workqueue->depth(task::Background));
+
+    std::lock_guard<std::mutex> lock(_devices_lock);
+    for(auto& device : _devices) {
+        logPrintf(INFO, "Latency for %s:", device.first.c_str());
+        for(int i = 0; i < StageCount; i++)
+            logPrintf(INFO, "  %-8s: %s", stageName(static_cast<Stage>(i)),
+                    device.second->stages[i].summary().c_str());
+    }
+}
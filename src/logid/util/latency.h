@@ -0,0 +1,97 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_LATENCY_H
+#define LOGID_LATENCY_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace logid
+{
+    /* Optional per-device latency tracing. A trace is started when a
+     * report is read and carried on the thread that handles it, each
+     * stage records the time since the previous one.
+     */
+    class latency
+    {
+    public:
+        enum Stage
+        {
+            Read,       // Device readable -> report read
+            Dispatch,   // Report read -> feature handler
+            Action,     // Feature handler -> first input event
+            Write,      // First input event -> frame queued for output
+            StageCount
+        };
+
+        class histogram
+        {
+        public:
+            // Powers of two in microseconds, the last bucket is overflow
+            static constexpr std::size_t BucketCount = 22;
+
+            histogram();
+            void record(std::chrono::nanoseconds duration);
+            std::string summary() const;
+
+            // Bucket i counts durations below 2^i us, the last is overflow
+            uint64_t bucket(std::size_t i) const;
+            uint64_t totalNs() const;
+        private:
+            std::array<std::atomic<uint64_t>, BucketCount> _buckets;
+            std::atomic<uint64_t> _count;
+            std::atomic<uint64_t> _total_ns;
+            std::atomic<uint64_t> _max_ns;
+        };
+
+        struct stats
+        {
+            std::array<histogram, StageCount> stages;
+        };
+
+        /* Must be called before any other thread is started, SIGUSR1 is
+         * blocked and handled by a dedicated thread that dumps the
+         * histograms and the workqueue depths.
+         */
+        static void enable();
+        static bool enabled();
+
+        static std::shared_ptr<stats> device(const std::string& name);
+        // Empty unless latency tracing is enabled
+        static std::map<std::string, std::shared_ptr<stats>> devices();
+        static const char* stageName(Stage stage);
+
+        static void begin(const std::shared_ptr<stats>& device,
+                std::chrono::steady_clock::time_point start);
+        static void mark(Stage stage);
+        static void end();
+
+        static void dump();
+    private:
+        static std::atomic<bool> _enabled;
+        static std::mutex _devices_lock;
+        static std::map<std::string, std::shared_ptr<stats>> _devices;
+    };
+}
+
+#endif //LOGID_LATENCY_H
@@ -17,28 +17,295 @@
  */
 
 #include <cstdio>
+#include <cstdlib>
 #include <string>
 #include <cstdarg>
+#include <cstring>
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include <stdexcept>
+#include <thread>
 #include "log.h"
+#include "alloc.h"
+#include "thread.h"
+
+#define LOGID_LOG_RECORDS 1024
+#define LOGID_LOG_RECORD_SIZE 512
 
 using namespace logid;
 
+LogLevel logid::global_loglevel = INFO;
+
+namespace
+{
+    struct LogRecord
+    {
+        std::atomic<std::size_t> sequence;
+        LogLevel level;
+        std::size_t length;
+        char text[LOGID_LOG_RECORD_SIZE];
+    };
+
+    /* Messages are formatted by the caller into a bounded MPSC ring and
+     * written out by a single flush thread, so logging never blocks on
+     * stdout. Producers reserve a slot with a CAS on _tail, the slot's
+     * sequence number tells the consumer when it has been filled.
+     */
+    class AsyncLogger
+    {
+    public:
+        AsyncLogger() : _head (0), _tail (0), _dropped (0), _sleeping (false),
+            _run (true)
+        {
+            for(std::size_t i = 0; i < _records.size(); i++)
+                _records[i].sequence = i;
+
+            // Lines prefixed with <priority> are understood by journald
+            _journal = std::getenv("JOURNAL_STREAM") != nullptr;
+
+            _thread = std::thread([this]() { _flushLoop(); });
+            std::atexit([]() { instance().stop(); });
+        }
+
+        static AsyncLogger& instance()
+        {
+            // Never destroyed, threads may log during static destruction
+            static auto logger = new AsyncLogger();
+            return *logger;
+        }
+
+        char* reserve(LogLevel level, LogRecord*& record)
+        {
+            auto pos = _tail.load(std::memory_order_relaxed);
+            while(true) {
+                record = &_records[pos % _records.size()];
+                auto seq = record->sequence.load(std::memory_order_acquire);
+                auto diff = (intptr_t)seq - (intptr_t)pos;
+                if(diff == 0) {
+                    if(_tail.compare_exchange_weak(pos, pos + 1,
+                            std::memory_order_relaxed))
+                        break;
+                } else if(diff < 0) {
+                    // Only trace output is dropped when the ring is full
+                    if(level <= DEBUG && _run) {
+                        _dropped++;
+                        return nullptr;
+                    }
+                    // Once stopped, producers drain the ring themselves
+                    if(_run)
+                        std::this_thread::yield();
+                    else
+                        flush();
+                    pos = _tail.load(std::memory_order_relaxed);
+                } else {
+                    pos = _tail.load(std::memory_order_relaxed);
+                }
+            }
+
+            record->level = level;
+            record->length = 0;
+            return record->text;
+        }
+
+        void commit(LogRecord* record, std::size_t length)
+        {
+            record->length = std::min<std::size_t>(length,
+                    sizeof(record->text));
+            // Reserved slots hold their position, one more marks them filled
+            record->sequence.store(record->sequence.load(
+                    std::memory_order_relaxed) + 1, std::memory_order_release);
+
+            /* Pairs with the fences of the flush thread, before its last
+             * drain and before it sleeps: either it sees this record, or
+             * this sees _run unset and writes it out here, or sees
+             * _sleeping and wakes it. */
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if(!_run.load(std::memory_order_relaxed)) {
+                flush();
+                return;
+            }
+
+            if(_sleeping.exchange(false)) {
+                std::lock_guard<std::mutex> lock(_wake_lock);
+                _wake_cv.notify_one();
+            }
+        }
+
+        void flush()
+        {
+            std::lock_guard<std::mutex> lock(_flush_lock);
+            _drain();
+        }
+
+        void stop()
+        {
+            _run = false;
+            {
+                std::lock_guard<std::mutex> lock(_wake_lock);
+                _wake_cv.notify_one();
+            }
+            if(_thread.joinable())
+                _thread.join();
+        }
+    private:
+        void _flushLoop()
+        {
+            logid::thread::setName("log");
+            while(_run) {
+                {
+                    std::lock_guard<std::mutex> lock(_flush_lock);
+                    if(_drain())
+                        continue;
+                }
+
+                std::unique_lock<std::mutex> lock(_wake_lock);
+                _sleeping = true;
+                /* Re-check after announcing that we sleep. Pairs with the
+                 * fence in commit: either this sees the record or the
+                 * producer sees _sleeping and wakes us, so no timeout is
+                 * needed to pick up a missed one. */
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if(_pending() || !_run) {
+                    _sleeping = false;
+                    continue;
+                }
+                _wake_cv.wait(lock);
+                _sleeping = false;
+            }
+
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            flush();
+        }
+
+        bool _pending()
+        {
+            auto& record = _records[_head % _records.size()];
+            return record.sequence.load(std::memory_order_acquire) ==
+                _head + 1;
+        }
+
+        // Writes every filled record in order, returns false if none were
+        bool _drain()
+        {
+            bool wrote = false;
+            while(_pending()) {
+                auto& record = _records[_head % _records.size()];
+                _write(record.level, record.text, record.length);
+                record.sequence.store(_head + _records.size(),
+                        std::memory_order_release);
+                _head++;
+                wrote = true;
+            }
+
+            auto dropped = _dropped.exchange(0);
+            if(dropped) {
+                char text[64];
+                int length = snprintf(text, sizeof(text),
+                        "%zu log messages were dropped", dropped);
+                _write(WARN, text, length);
+            }
+
+            if(wrote || dropped) {
+                fflush(stdout);
+                fflush(stderr);
+            }
+
+            return wrote;
+        }
+
+        void _write(LogLevel level, const char* text, std::size_t length)
+        {
+            FILE* stream = stdout;
+            if(level == ERROR || level == WARN)
+                stream = stderr;
+
+            if(_journal)
+                fprintf(stream, "<%d>", _priority(level));
+            fprintf(stream, "[%s] ", levelPrefix(level));
+            fwrite(text, 1, length, stream);
+            fputc('\n', stream);
+        }
+
+        static int _priority(LogLevel level)
+        {
+            switch(level) {
+            case ERROR:
+                return 3;
+            case WARN:
+                return 4;
+            case INFO:
+                return 6;
+            default:
+                return 7;
+            }
+        }
+
+        std::array<LogRecord, LOGID_LOG_RECORDS> _records;
+        std::size_t _head;
+        std::atomic<std::size_t> _tail;
+        std::atomic<std::size_t> _dropped;
+
+        std::mutex _wake_lock;
+        std::condition_variable _wake_cv;
+        std::atomic<bool> _sleeping;
+        std::atomic<bool> _run;
+        std::mutex _flush_lock;
+        bool _journal;
+        std::thread _thread;
+    };
+}
+
 void logid::logPrintf(LogLevel level, const char* format, ...)
 {
     if(global_loglevel > level) return;
+    alloc::scope scope(alloc::Logging);
+
+    auto& logger = AsyncLogger::instance();
+    LogRecord* record;
+    char* text = logger.reserve(level, record);
+    if(!text)
+        return;
 
     va_list vargs;
     va_start(vargs, format);
+    int length = vsnprintf(text, LOGID_LOG_RECORD_SIZE, format, vargs);
+    va_end(vargs);
 
-    FILE* stream = stdout;
-    if(level == ERROR || level == WARN)
-        stream = stderr;
+    logger.commit(record, length < 0 ? 0 : length);
+}
+
+void logid::logReport(const std::string& path, const char* direction,
+        const uint8_t* data, std::size_t length)
+{
+    if(global_loglevel > RAWREPORT) return;
 
-    fprintf(stream, "[%s] ", levelPrefix(level));
-    vfprintf(stream, format, vargs);
-    fprintf(stream, "\n");
+    static const char hex[] = "0123456789abcdef";
+    auto& logger = AsyncLogger::instance();
+    LogRecord* record;
+    char* text = logger.reserve(RAWREPORT, record);
+    if(!text)
+        return;
+
+    int written = snprintf(text, LOGID_LOG_RECORD_SIZE, "%s %s ",
+            path.c_str(), direction);
+    std::size_t pos = std::min<std::size_t>(std::max(written, 0),
+            LOGID_LOG_RECORD_SIZE);
+    for(std::size_t i = 0; i < length && pos + 3 <= LOGID_LOG_RECORD_SIZE;
+            i++) {
+        text[pos++] = hex[data[i] >> 4];
+        text[pos++] = hex[data[i] & 0xf];
+        text[pos++] = ' ';
+    }
+
+    logger.commit(record, pos);
+}
+
+void logid::logFlush()
+{
+    AsyncLogger::instance().flush();
 }
 
 const char* logid::levelPrefix(LogLevel level)
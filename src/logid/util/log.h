@@ -19,6 +19,21 @@
 #define LOGID_LOG_H
 
 #include <string>
+#include <cstdint>
+
+/* Messages logged with LOGID_LOG below this level are compiled out, along
+ * with their arguments, e.g. -DLOGID_MIN_LOGLEVEL=INFO for release builds.
+ */
+#ifndef LOGID_MIN_LOGLEVEL
+#define LOGID_MIN_LOGLEVEL RAWREPORT
+#endif
+
+// Arguments are only evaluated if the message will be logged
+#define LOGID_LOG(level, ...) \
+    do { \
+        if(::logid::logEnabled(level)) \
+            ::logid::logPrintf(level, __VA_ARGS__); \
+    } while(0)
 
 namespace logid
 {
@@ -33,7 +48,18 @@ namespace logid
 
     extern LogLevel global_loglevel;
 
+    // Constant false for levels under LOGID_MIN_LOGLEVEL
+    inline bool logEnabled(LogLevel level)
+    {
+        return level >= LOGID_MIN_LOGLEVEL && global_loglevel <= level;
+    }
+
+    /* Messages are queued and written by a separate thread, logFlush()
+     * writes out everything queued so far. */
     void logPrintf(LogLevel level, const char *format, ...);
+    void logReport(const std::string& path, const char* direction,
+            const uint8_t* data, std::size_t length);
+    void logFlush();
     const char *levelPrefix(LogLevel level);
     LogLevel toLogLevel(std::string s);
 }
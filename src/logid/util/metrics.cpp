@@ -0,0 +1,548 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include "metrics.h"
+#include "alloc.h"
+#include "latency.h"
+#include "log.h"
+#include "power.h"
+#include "profiled_mutex.h"
+#include "task.h"
+#include "thread.h"
+#include "timer_wheel.h"
+#include "workqueue.h"
+#include "../Configuration.h"
+
+extern "C"
+{
+#include <dirent.h>
+#include <sys/resource.h>
+#include <unistd.h>
+}
+
+using namespace logid;
+using namespace std::chrono;
+
+std::mutex metrics::_lock;
+std::map<std::string, std::weak_ptr<metrics::counters>> metrics::_raw_devices;
+std::map<std::string, std::weak_ptr<metrics::device_stats>> metrics::_devices;
+std::shared_ptr<timer> metrics::_textfile_timer;
+
+namespace
+{
+    const char* counterName(int counter)
+    {
+        switch(counter) {
+        case metrics::ReportsIn:
+            return "reports_in";
+        case metrics::ReportsOut:
+            return "reports_out";
+        case metrics::Events:
+            return "events";
+        case metrics::Requests:
+            return "requests";
+        case metrics::Timeouts:
+            return "timeouts";
+        case metrics::Retries:
+            return "retries";
+        case metrics::Duplicates:
+            return "duplicates";
+        case metrics::ReadInterrupts:
+            return "read_interrupts";
+        case metrics::Stalls:
+            return "stalls";
+        case metrics::Filtered:
+            return "filtered";
+        case metrics::Deferred:
+            return "deferred";
+        case metrics::Shed:
+            return "shed_motion";
+        case metrics::Offloaded:
+            return "offloaded_handlers";
+        case metrics::BusyPollNs:
+            return "busy_poll_ns";
+        case metrics::BusyPollHits:
+            return "busy_poll_hits";
+        case metrics::BusyPollMisses:
+            return "busy_poll_misses";
+        case metrics::BusyPollSavedNs:
+            return "busy_poll_saved_ns";
+        default:
+            return "unknown";
+        }
+    }
+
+    const char* priorityName(int priority)
+    {
+        switch(priority) {
+        case task::Interactive:
+            return "interactive";
+        case task::Normal:
+            return "normal";
+        case task::Background:
+            return "background";
+        default:
+            return "unknown";
+        }
+    }
+
+    // Label values may only escape backslashes, quotes and newlines
+    std::string label(const std::string& value)
+    {
+        std::string escaped;
+        for(auto c : value) {
+            if(c == '\\' || c == '"')
+                escaped += '\\';
+            if(c == '\n')
+                escaped += "\\n";
+            else
+                escaped += c;
+        }
+        return escaped;
+    }
+
+    struct thread_usage
+    {
+        std::string labels;
+        double cpu_seconds = 0;
+        uint64_t voluntary = 0;
+        uint64_t involuntary = 0;
+    };
+
+    /* Every thread of the process, named by thread::setName() or by the
+     * kernel comm otherwise. A thread that exits between reading its
+     * files is skipped. */
+    std::vector<thread_usage> threadUsage()
+    {
+        std::vector<thread_usage> usage;
+        DIR* dir = ::opendir("/proc/self/task");
+        if(!dir)
+            return usage;
+
+        auto names = thread::names();
+        static const double ticks = ::sysconf(_SC_CLK_TCK);
+        while(auto entry = ::readdir(dir)) {
+            if(entry->d_name[0] == '.')
+                continue;
+            auto tid = static_cast<pid_t>(std::atoi(entry->d_name));
+            auto task = std::string("/proc/self/task/") + entry->d_name;
+
+            // comm may hold spaces and parentheses, fields follow the last
+            std::ifstream stat_file(task + "/stat");
+            std::string stat;
+            if(!std::getline(stat_file, stat))
+                continue;
+            auto comm_end = stat.rfind(')');
+            auto comm_start = stat.find('(');
+            if(comm_end == std::string::npos ||
+               comm_start == std::string::npos)
+                continue;
+            std::istringstream fields(stat.substr(comm_end + 2));
+            std::string field;
+            // utime and stime are fields 14 and 15, state is field 3
+            for(int i = 3; i < 14; i++)
+                fields >> field;
+            unsigned long long utime = 0, stime = 0;
+            if(!(fields >> utime >> stime))
+                continue;
+
+            thread_usage thread;
+            thread.cpu_seconds = (utime + stime) / ticks;
+            std::ifstream status(task + "/status");
+            std::string line;
+            while(std::getline(status, line)) {
+                if(!line.compare(0, 24, "voluntary_ctxt_switches:"))
+                    thread.voluntary = std::strtoull(line.c_str() + 24,
+                            nullptr, 10);
+                else if(!line.compare(0, 27, "nonvoluntary_ctxt_switches:"))
+                    thread.involuntary = std::strtoull(line.c_str() + 27,
+                            nullptr, 10);
+            }
+
+            auto name = names.find(tid);
+            std::string device;
+            std::string thread_name = stat.substr(comm_start + 1,
+                    comm_end - comm_start - 1);
+            // IDs are reused, the name only holds while the comm matches
+            if(name != names.end() && (tid == ::getpid() ||
+               name->second.name.compare(0, 15, thread_name) == 0)) {
+                thread_name = name->second.name;
+                device = name->second.device;
+            }
+            thread.labels = "thread=\"" + label(thread_name) + "\",tid=\"" +
+                    entry->d_name + "\",device=\"" + label(device) + "\"";
+            usage.push_back(std::move(thread));
+        }
+        ::closedir(dir);
+        return usage;
+    }
+
+    void writeDuration(std::ostream& s, const char* name,
+            const std::map<std::string, std::shared_ptr<
+                    metrics::device_stats>>& devices,
+            metrics::duration metrics::device_stats::* member)
+    {
+        s << "# TYPE logid_device_" << name << "_seconds summary\n";
+        for(auto& device : devices) {
+            auto& d = (*device.second).*member;
+            auto l = "{device=\"" + label(device.first) + "\"}";
+            s << "logid_device_" << name << "_seconds_sum" << l << " " <<
+                (double)d.totalNs() / 1e9 << "\n";
+            s << "logid_device_" << name << "_seconds_count" << l << " " <<
+                d.count() << "\n";
+        }
+        s << "# TYPE logid_device_" << name << "_last_seconds gauge\n";
+        for(auto& device : devices) {
+            auto& d = (*device.second).*member;
+            s << "logid_device_" << name << "_last_seconds{device=\"" <<
+                label(device.first) << "\"} " << (double)d.lastNs() / 1e9 <<
+                "\n";
+        }
+    }
+}
+
+metrics::counters::counters()
+{
+    for(auto& value : _values)
+        value = 0;
+}
+
+void metrics::counters::add(Counter counter, uint64_t n)
+{
+    _values[counter].fetch_add(n, std::memory_order_relaxed);
+}
+
+uint64_t metrics::counters::get(Counter counter) const
+{
+    return _values[counter].load(std::memory_order_relaxed);
+}
+
+metrics::duration::duration() : _count (0), _total_ns (0), _last_ns (0)
+{
+}
+
+void metrics::duration::record(nanoseconds time)
+{
+    auto ns = static_cast<uint64_t>(time.count() > 0 ? time.count() : 0);
+    _last_ns = ns;
+    _total_ns += ns;
+    _count++;
+}
+
+uint64_t metrics::duration::count() const
+{
+    return _count;
+}
+
+uint64_t metrics::duration::totalNs() const
+{
+    return _total_ns;
+}
+
+uint64_t metrics::duration::lastNs() const
+{
+    return _last_ns;
+}
+
+std::shared_ptr<metrics::counters> metrics::rawDevice(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    auto& entry = _raw_devices[path];
+    auto stats = entry.lock();
+    if(!stats) {
+        stats = std::make_shared<counters>();
+        entry = stats;
+    }
+    return stats;
+}
+
+std::shared_ptr<metrics::device_stats> metrics::device(
+        const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    auto& entry = _devices[name];
+    auto stats = entry.lock();
+    if(!stats) {
+        stats = std::make_shared<device_stats>();
+        entry = stats;
+    }
+    return stats;
+}
+
+std::string metrics::prometheus()
+{
+    std::map<std::string, std::shared_ptr<counters>> raw_devices;
+    std::map<std::string, std::shared_ptr<device_stats>> devices;
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        for(auto it = _raw_devices.begin(); it != _raw_devices.end();) {
+            auto stats = it->second.lock();
+            if(stats) {
+                raw_devices.emplace(it->first, stats);
+                ++it;
+            } else {
+                it = _raw_devices.erase(it);
+            }
+        }
+        for(auto it = _devices.begin(); it != _devices.end();) {
+            auto stats = it->second.lock();
+            if(stats) {
+                devices.emplace(it->first, stats);
+                ++it;
+            } else {
+                it = _devices.erase(it);
+            }
+        }
+    }
+
+    std::ostringstream s;
+    for(int i = 0; i < CounterCount; i++) {
+        s << "# TYPE logid_raw_" << counterName(i) << "_total counter\n";
+        for(auto& device : raw_devices)
+            s << "logid_raw_" << counterName(i) << "_total{device=\"" <<
+                label(device.first) << "\"} " <<
+                device.second->get(static_cast<Counter>(i)) << "\n";
+    }
+
+    writeDuration(s, "wakeup", devices, &device_stats::wakeup);
+    writeDuration(s, "configure", devices, &device_stats::configure);
+
+    s << "# TYPE logid_device_rtt_seconds gauge\n";
+    for(auto& device : devices)
+        s << "logid_device_rtt_seconds{device=\"" << label(device.first) <<
+            "\"} " << (double)device.second->rtt.smoothed().count() / 1e9 <<
+            "\n";
+    s << "# TYPE logid_device_rtt_variance_seconds gauge\n";
+    for(auto& device : devices)
+        s << "logid_device_rtt_variance_seconds{device=\"" <<
+            label(device.first) << "\"} " <<
+            (double)device.second->rtt.variance().count() / 1e9 << "\n";
+    auto io_timeout = global_config ? global_config->ioTimeout() :
+            LOGID_DEFAULT_IO_TIMEOUT;
+    s << "# TYPE logid_device_request_timeout_seconds gauge\n";
+    for(auto& device : devices)
+        s << "logid_device_request_timeout_seconds{device=\"" <<
+            label(device.first) << "\"} " << (double)device.second->rtt
+            .timeout(io_timeout).count() / 1e9 << "\n";
+
+    // Host side stages, the RTT above is the radio and firmware part
+    auto stages = latency::devices();
+    if(!stages.empty())
+        s << "# TYPE logid_input_latency_seconds histogram\n";
+    for(auto& device : stages) {
+        for(std::size_t i = 0; i < latency::StageCount; i++) {
+            auto& h = device.second->stages[i];
+            auto l = "device=\"" + label(device.first) + "\",stage=\"" +
+                latency::stageName(static_cast<latency::Stage>(i)) + "\"";
+            uint64_t total = 0;
+            for(std::size_t b = 0; b < latency::histogram::BucketCount - 1;
+                    b++) {
+                total += h.bucket(b);
+                s << "logid_input_latency_seconds_bucket{" << l << ",le=\"" <<
+                    (double)(1ull << b) / 1e6 << "\"} " << total << "\n";
+            }
+            // Summed rather than count() so buckets never decrease
+            total += h.bucket(latency::histogram::BucketCount - 1);
+            s << "logid_input_latency_seconds_bucket{" << l <<
+                ",le=\"+Inf\"} " << total << "\n";
+            s << "logid_input_latency_seconds_sum{" << l << "} " <<
+                (double)h.totalNs() / 1e9 << "\n";
+            s << "logid_input_latency_seconds_count{" << l << "} " <<
+                total << "\n";
+        }
+    }
+
+    auto locks = profiled_mutex::locks();
+    if(!locks.empty()) {
+        s << "# TYPE logid_lock_contended_total counter\n";
+        for(auto& lock : locks)
+            s << "logid_lock_contended_total{lock=\"" << lock.first <<
+                "\"} " << lock.second->contended.load(
+                        std::memory_order_relaxed) << "\n";
+        s << "# TYPE logid_lock_wait_seconds histogram\n";
+    }
+    for(auto& lock : locks) {
+        auto& h = lock.second->wait;
+        auto l = "lock=\"" + lock.first + "\"";
+        uint64_t total = 0;
+        for(std::size_t b = 0; b < latency::histogram::BucketCount - 1; b++) {
+            total += h.bucket(b);
+            s << "logid_lock_wait_seconds_bucket{" << l << ",le=\"" <<
+                (double)(1ull << b) / 1e6 << "\"} " << total << "\n";
+        }
+        total += h.bucket(latency::histogram::BucketCount - 1);
+        s << "logid_lock_wait_seconds_bucket{" << l << ",le=\"+Inf\"} " <<
+            total << "\n";
+        s << "logid_lock_wait_seconds_sum{" << l << "} " <<
+            (double)h.totalNs() / 1e9 << "\n";
+        s << "logid_lock_wait_seconds_count{" << l << "} " << total << "\n";
+    }
+
+    s << "# TYPE logid_device_health gauge\n";
+    for(auto& device : devices)
+        s << "logid_device_health{device=\"" << label(device.first) <<
+            "\"} " << device.second->health.state() << "\n";
+    s << "# TYPE logid_device_consecutive_failures gauge\n";
+    for(auto& device : devices)
+        s << "logid_device_consecutive_failures{device=\"" <<
+            label(device.first) << "\"} " << device.second->health.failures()
+            << "\n";
+    s << "# TYPE logid_device_rejected_operations_total counter\n";
+    for(auto& device : devices)
+        s << "logid_device_rejected_operations_total{device=\"" <<
+            label(device.first) << "\"} " <<
+            device.second->health.rejected() << "\n";
+    s << "# TYPE logid_failing_operations gauge\n";
+    s << "logid_failing_operations " << circuit_breaker::failing() << "\n";
+
+    // Threads that serve a single device carry its hidraw path
+    auto threads = threadUsage();
+    s << "# TYPE logid_thread_cpu_seconds_total counter\n";
+    for(auto& thread : threads)
+        s << "logid_thread_cpu_seconds_total{" << thread.labels << "} " <<
+            thread.cpu_seconds << "\n";
+    s << "# TYPE logid_thread_context_switches_total counter\n";
+    for(auto& thread : threads) {
+        s << "logid_thread_context_switches_total{" << thread.labels <<
+            ",kind=\"voluntary\"} " << thread.voluntary << "\n";
+        s << "logid_thread_context_switches_total{" << thread.labels <<
+            ",kind=\"involuntary\"} " << thread.involuntary << "\n";
+    }
+
+    /* The rate is averaged since the previous export, so that a textfile
+     * export or an idle scraper gives the idle wakeup rate by itself. */
+    static std::mutex wakeups_lock;
+    static steady_clock::time_point last_export;
+    static uint64_t last_wakeups = 0;
+    auto wakeup_count = wakeups();
+    double wakeup_rate = 0;
+    {
+        std::lock_guard<std::mutex> lock(wakeups_lock);
+        auto now = steady_clock::now();
+        if(last_export != steady_clock::time_point() && now > last_export)
+            wakeup_rate = (wakeup_count - last_wakeups) /
+                    std::chrono::duration<double>(now - last_export).count();
+        last_export = now;
+        last_wakeups = wakeup_count;
+    }
+    s << "# TYPE logid_wakeups_total counter\n";
+    s << "logid_wakeups_total " << wakeup_count << "\n";
+    s << "# TYPE logid_wakeups_per_second gauge\n";
+    s << "logid_wakeups_per_second " << wakeup_rate << "\n";
+    s << "# TYPE logid_battery_mode gauge\n";
+    s << "logid_battery_mode " << (power::saving() ? 1 : 0) << "\n";
+
+    if(alloc::enabled()) {
+        s << "# TYPE logid_allocations_total counter\n";
+        for(int i = 0; i < alloc::TagCount; i++)
+            s << "logid_allocations_total{subsystem=\"" << alloc::tagName(
+                    static_cast<alloc::Tag>(i)) << "\"} " << alloc::get(
+                    static_cast<alloc::Tag>(i)).allocations << "\n";
+        s << "# TYPE logid_allocated_bytes gauge\n";
+        for(int i = 0; i < alloc::TagCount; i++)
+            s << "logid_allocated_bytes{subsystem=\"" << alloc::tagName(
+                    static_cast<alloc::Tag>(i)) << "\"} " << alloc::get(
+                    static_cast<alloc::Tag>(i)).bytes_live << "\n";
+        s << "# TYPE logid_allocated_bytes_peak gauge\n";
+        for(int i = 0; i < alloc::TagCount; i++)
+            s << "logid_allocated_bytes_peak{subsystem=\"" << alloc::tagName(
+                    static_cast<alloc::Tag>(i)) << "\"} " << alloc::get(
+                    static_cast<alloc::Tag>(i)).bytes_peak << "\n";
+    }
+
+    if(global_workqueue) {
+        s << "# TYPE logid_workqueue_depth gauge\n";
+        for(int i = 0; i < task::PriorityCount; i++)
+            s << "logid_workqueue_depth{priority=\"" << priorityName(i) <<
+                "\"} " << global_workqueue->depth(
+                        static_cast<task::Priority>(i)) << "\n";
+        s << "# TYPE logid_workqueue_workers gauge\n";
+        s << "logid_workqueue_workers " << global_workqueue->threadCount() <<
+            "\n";
+        s << "# TYPE logid_workqueue_workers_started_total counter\n";
+        s << "logid_workqueue_workers_started_total " <<
+            global_workqueue->workersStarted() << "\n";
+        s << "# TYPE logid_workqueue_workers_retired_total counter\n";
+        s << "logid_workqueue_workers_retired_total " <<
+            global_workqueue->workersRetired() << "\n";
+        s << "# TYPE logid_workqueue_busy_workers gauge\n";
+        s << "logid_workqueue_busy_workers " <<
+            global_workqueue->busyWorkers() << "\n";
+        s << "# TYPE logid_workqueue_fallback_threads_total counter\n";
+        s << "logid_workqueue_fallback_threads_total " <<
+            global_workqueue->fallbackThreads() << "\n";
+        s << "# TYPE logid_workqueue_helpers_refused_total counter\n";
+        s << "logid_workqueue_helpers_refused_total " <<
+            global_workqueue->helpersRefused() << "\n";
+        s << "# TYPE logid_workqueue_throttled_total counter\n";
+        s << "logid_workqueue_throttled_total " <<
+            global_workqueue->throttled() << "\n";
+        s << "# TYPE logid_workqueue_overflows_total counter\n";
+        s << "logid_workqueue_overflows_total " <<
+            global_workqueue->overflows() << "\n";
+    }
+
+    return s.str();
+}
+
+uint64_t metrics::wakeups()
+{
+    struct rusage usage = {};
+    if(::getrusage(RUSAGE_SELF, &usage))
+        return 0;
+    return usage.ru_nvcsw;
+}
+
+void metrics::exportTextfile(const std::string& path)
+{
+    _textfile_timer = task::spawnEvery(
+            duration_cast<milliseconds>(LOGID_METRICS_INTERVAL),
+            [path]() { _writeTextfile(path); },
+            [path](std::exception& e) {
+        logPrintf(WARN, "Could not write metrics to %s: %s", path.c_str(),
+                e.what());
+    }, task::Background);
+}
+
+void metrics::_writeTextfile(const std::string& path)
+{
+    auto text = prometheus();
+    auto temporary = path + ".tmp";
+
+    FILE* file = std::fopen(temporary.c_str(), "w");
+    if(!file)
+        throw std::system_error(errno, std::system_category(),
+                "metrics textfile open failed");
+    bool written = std::fwrite(text.data(), 1, text.size(), file) ==
+            text.size();
+    if(std::fclose(file) != 0 || !written) {
+        int err = errno;
+        std::remove(temporary.c_str());
+        throw std::system_error(err, std::system_category(),
+                "metrics textfile write failed");
+    }
+
+    if(std::rename(temporary.c_str(), path.c_str()) != 0)
+        throw std::system_error(errno, std::system_category(),
+                "metrics textfile rename failed");
+}
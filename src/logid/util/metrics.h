@@ -0,0 +1,127 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_METRICS_H
+#define LOGID_METRICS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "circuit_breaker.h"
+#include "rtt_estimator.h"
+
+// How often the metrics textfile is rewritten
+#define LOGID_METRICS_INTERVAL std::chrono::seconds(15)
+
+namespace logid
+{
+    class timer;
+
+    /* Counters and gauges in the Prometheus text format, served by the
+     * control socket and optionally written to a textfile for the node
+     * exporter. Unlike latency tracing these are plain relaxed atomics and
+     * always on. Stats are owned by what they describe, a device that is
+     * gone drops out of the next export.
+     */
+    class metrics
+    {
+    public:
+        enum Counter
+        {
+            ReportsIn,
+            ReportsOut,
+            Events,         // Reports that were not a response
+            Requests,
+            Timeouts,
+            Retries,
+            Duplicates,     // Late answers to resent requests
+            ReadInterrupts,
+            Stalls,         // Dispatch cycles the watchdog caught
+            Filtered,       // Non-HID++ reports dropped on read
+            Deferred,       // Requests that waited for the request window
+            Shed,           // Stale motion events merged under backlog
+            Offloaded,      // Devices whose handlers moved off the listener
+            BusyPollNs,     // Time spent reading without blocking
+            BusyPollHits,   // Batches a busy poll read
+            BusyPollMisses, // Busy polls that ended without a report
+            BusyPollSavedNs, // Estimated wakeup latency the hits avoided
+            CounterCount
+        };
+
+        class counters
+        {
+        public:
+            counters();
+            void add(Counter counter, uint64_t n=1);
+            uint64_t get(Counter counter) const;
+        private:
+            std::array<std::atomic<uint64_t>, CounterCount> _values;
+        };
+
+        class duration
+        {
+        public:
+            duration();
+            void record(std::chrono::nanoseconds time);
+            uint64_t count() const;
+            uint64_t totalNs() const;
+            uint64_t lastNs() const;
+        private:
+            std::atomic<uint64_t> _count;
+            std::atomic<uint64_t> _total_ns;
+            std::atomic<uint64_t> _last_ns;
+        };
+
+        struct device_stats
+        {
+            duration wakeup;
+            duration configure;
+            // Shared with the raw device, which times its requests with it
+            rtt_estimator rtt;
+            // Kept across reconnects of the device
+            circuit_breaker health;
+        };
+
+        // Keyed by hidraw path
+        static std::shared_ptr<counters> rawDevice(const std::string& path);
+        // Keyed by path:index
+        static std::shared_ptr<device_stats> device(const std::string& name);
+
+        static std::string prometheus();
+
+        /* Times a thread of logid went to sleep and had to be woken, i.e.
+         * voluntary context switches, those of exited threads included. */
+        static uint64_t wakeups();
+
+        /* Rewrites path every LOGID_METRICS_INTERVAL through a temporary
+         * file, so that readers never see a partial export. */
+        static void exportTextfile(const std::string& path);
+    private:
+        static void _writeTextfile(const std::string& path);
+
+        static std::mutex _lock;
+        static std::map<std::string, std::weak_ptr<counters>> _raw_devices;
+        static std::map<std::string, std::weak_ptr<device_stats>> _devices;
+        static std::shared_ptr<timer> _textfile_timer;
+    };
+}
+
+#endif //LOGID_METRICS_H
@@ -0,0 +1,115 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_MPSC_QUEUE_H
+#define LOGID_MPSC_QUEUE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+namespace logid
+{
+    /* Bounded lock-free queue for any number of producers and a single
+     * consumer. Each cell carries a sequence number that tells producers
+     * when it is free and the consumer when it has been filled.
+     */
+    template<typename data>
+    class mpsc_queue
+    {
+    public:
+        // Capacity is rounded up to a power of two
+        explicit mpsc_queue(std::size_t capacity) : _head (0), _tail (0)
+        {
+            _capacity = 1;
+            while(_capacity < capacity)
+                _capacity <<= 1;
+            _cells = std::make_unique<cell[]>(_capacity);
+            for(std::size_t i = 0; i < _capacity; i++)
+                _cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        // Returns false if the queue is full
+        bool push(data&& value)
+        {
+            auto pos = _tail.load(std::memory_order_relaxed);
+            while(true) {
+                cell& c = _cells[pos & (_capacity - 1)];
+                auto seq = c.sequence.load(std::memory_order_acquire);
+                auto diff = (intptr_t)seq - (intptr_t)pos;
+                if(diff == 0) {
+                    if(_tail.compare_exchange_weak(pos, pos + 1,
+                            std::memory_order_relaxed)) {
+                        c.value = std::move(value);
+                        c.sequence.store(pos + 1, std::memory_order_release);
+                        return true;
+                    }
+                } else if(diff < 0) {
+                    return false;
+                } else {
+                    pos = _tail.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // Consumer only
+        bool pop(data& value)
+        {
+            cell& c = _cells[_head & (_capacity - 1)];
+            if(c.sequence.load(std::memory_order_acquire) != _head + 1)
+                return false;
+            value = std::move(c.value);
+            c.value = data();
+            c.sequence.store(_head + _capacity, std::memory_order_release);
+            _head++;
+            return true;
+        }
+
+        // Consumer only, passes every queued value to f in order
+        template<typename function>
+        std::size_t drain(function f)
+        {
+            std::size_t count = 0;
+            data value;
+            while(pop(value)) {
+                f(std::move(value));
+                count++;
+            }
+            return count;
+        }
+
+        // Consumer only
+        bool empty() const
+        {
+            return _cells[_head & (_capacity - 1)].sequence.load(
+                    std::memory_order_acquire) != _head + 1;
+        }
+    private:
+        struct cell
+        {
+            std::atomic<std::size_t> sequence;
+            data value;
+        };
+
+        std::unique_ptr<cell[]> _cells;
+        std::size_t _capacity;
+        std::size_t _head;
+        alignas(64) std::atomic<std::size_t> _tail;
+    };
+}
+
+#endif //LOGID_MPSC_QUEUE_H
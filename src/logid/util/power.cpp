@@ -0,0 +1,159 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <fstream>
+#include <mutex>
+#include <string>
+#include "power.h"
+#include "log.h"
+#include "task.h"
+#include "workqueue.h"
+
+extern "C"
+{
+#include <dirent.h>
+#include <sys/prctl.h>
+}
+
+#define LOGID_POWER_SUPPLY_DIR "/sys/class/power_supply"
+
+using namespace logid;
+using namespace std::chrono;
+
+std::atomic<bool> power::_saving(false);
+power::settings power::_settings;
+std::function<void(bool)> power::_changed;
+std::shared_ptr<timer> power::_timer;
+
+namespace
+{
+    std::string readAttribute(const std::string& supply, const char* name)
+    {
+        std::ifstream file(std::string(LOGID_POWER_SUPPLY_DIR "/") + supply +
+                "/" + name);
+        std::string value;
+        std::getline(file, value);
+        return value;
+    }
+
+    bool readOnBattery()
+    {
+        DIR* dir = ::opendir(LOGID_POWER_SUPPLY_DIR);
+        if(!dir)
+            return false;
+        bool battery = false, external = false;
+        while(auto entry = ::readdir(dir)) {
+            std::string supply = entry->d_name;
+            if(supply[0] == '.')
+                continue;
+            // Mice and keyboards report their own batteries here
+            if(readAttribute(supply, "scope") == "Device")
+                continue;
+            auto type = readAttribute(supply, "type");
+            if(type == "Battery")
+                battery = true;
+            else if((type == "Mains" || type.compare(0, 3, "USB") == 0) &&
+                    readAttribute(supply, "online") == "1")
+                external = true;
+        }
+        ::closedir(dir);
+        return battery && !external;
+    }
+}
+
+void power::enable(const settings& config,
+        const std::function<void(bool)>& changed)
+{
+    _settings = config;
+    _changed = changed;
+    _check();
+    _timer = task::spawnEvery(duration_cast<milliseconds>(
+            LOGID_POWER_CHECK_INTERVAL), _check,
+            [](std::exception& e) {
+        LOGID_LOG(DEBUG, "Error while checking the power supply: %s",
+                e.what());
+    }, task::Background);
+}
+
+bool power::saving()
+{
+    return _saving.load(std::memory_order_relaxed);
+}
+
+void power::apply(bool saving)
+{
+    if(_saving.exchange(saving) == saving)
+        return;
+
+    logPrintf(INFO, saving ? "On battery, entering battery mode." :
+            "On external power, leaving battery mode.");
+    _setSlack(saving ? nanoseconds(_settings.timer_slack) : nanoseconds(0));
+    if(global_workqueue)
+        global_workqueue->alignTimers(saving ? _settings.tick :
+                milliseconds(0));
+    if(_changed)
+        _changed(saving);
+}
+
+bool power::onBattery()
+{
+    static std::mutex lock;
+    static steady_clock::time_point checked;
+    static bool on_battery = false;
+
+    std::lock_guard<std::mutex> guard(lock);
+    auto now = steady_clock::now();
+    if(checked == steady_clock::time_point() ||
+       now - checked > LOGID_POWER_CHECK_INTERVAL) {
+        on_battery = readOnBattery();
+        checked = now;
+    }
+    return on_battery;
+}
+
+void power::_check()
+{
+    apply(onBattery());
+}
+
+void power::_setSlack(nanoseconds slack)
+{
+    // New threads inherit the slack of the thread that starts them
+    ::prctl(PR_SET_TIMERSLACK, (unsigned long)slack.count(), 0, 0, 0);
+
+    DIR* dir = ::opendir("/proc/self/task");
+    if(!dir)
+        return;
+    int failed = 0;
+    while(auto entry = ::readdir(dir)) {
+        if(entry->d_name[0] == '.')
+            continue;
+        // The file is only listed per process, but /proc/<tid> works too
+        std::ofstream file(std::string("/proc/") + entry->d_name +
+                "/timerslack_ns");
+        file << slack.count();
+        file.flush();
+        if(!file)
+            failed++;
+    }
+    ::closedir(dir);
+    // Kernels before 4.6 lack the file, some need CAP_SYS_NICE for it
+    if(failed)
+        LOGID_LOG(DEBUG, "Could not set the timer slack of %d threads.",
+                failed);
+}
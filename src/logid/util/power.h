@@ -0,0 +1,78 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_POWER_H
+#define LOGID_POWER_H
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+
+// How long a power supply reading is trusted, and how often it is checked
+#define LOGID_POWER_CHECK_INTERVAL std::chrono::seconds(5)
+// Timer slack of logid's threads in battery mode
+#define LOGID_DEFAULT_TIMER_SLACK std::chrono::microseconds(5000)
+// Background timers fire on multiples of this in battery mode
+#define LOGID_DEFAULT_TIMER_TICK std::chrono::milliseconds(1000)
+
+namespace logid
+{
+    class timer;
+
+    /* Optional battery mode for laptops, which trades timer precision for
+     * fewer CPU wakeups while the system runs on battery. Every thread
+     * gets timer slack, Background timers are moved onto shared ticks and
+     * devices may lower their report rate, see features::ReportRate.
+     * Busy polling stops on battery whether or not the mode is enabled.
+     */
+    class power
+    {
+    public:
+        struct settings
+        {
+            std::chrono::microseconds timer_slack = LOGID_DEFAULT_TIMER_SLACK;
+            std::chrono::milliseconds tick = LOGID_DEFAULT_TIMER_TICK;
+        };
+
+        /* Checks the power supply every LOGID_POWER_CHECK_INTERVAL on the
+         * workqueue and switches battery mode with it. changed is called
+         * on a worker after every switch. */
+        static void enable(const settings& config,
+                const std::function<void(bool)>& changed);
+        // True while battery mode is in effect
+        static bool saving();
+        // Switches battery mode regardless of the power supply
+        static void apply(bool saving);
+
+        /* True if no mains or USB supply is online while a system battery
+         * is present. Batteries of HID devices do not count. */
+        static bool onBattery();
+    private:
+        static void _check();
+        // 0 restores the default slack
+        static void _setSlack(std::chrono::nanoseconds slack);
+
+        static std::atomic<bool> _saving;
+        static settings _settings;
+        static std::function<void(bool)> _changed;
+        static std::shared_ptr<timer> _timer;
+    };
+}
+
+#endif //LOGID_POWER_H
@@ -0,0 +1,41 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_PROBES_H
+#define LOGID_PROBES_H
+
+/* USDT probes in the "logid" provider, list them with
+ * `bpftrace -l 'usdt:/usr/bin/logid:*'`. A disabled probe is a single
+ * nop, building without <sys/sdt.h> (or with LOGID_NO_PROBES) removes
+ * them entirely. Arguments are taken as they are, keep them cheap.
+ */
+#ifdef LOGID_HAVE_SDT
+#include <sys/sdt.h>
+
+#define LOGID_PROBE1(name, a) DTRACE_PROBE1(logid, name, a)
+#define LOGID_PROBE2(name, a, b) DTRACE_PROBE2(logid, name, a, b)
+#define LOGID_PROBE3(name, a, b, c) DTRACE_PROBE3(logid, name, a, b, c)
+#define LOGID_PROBE4(name, a, b, c, d) DTRACE_PROBE4(logid, name, a, b, c, d)
+#else
+#define LOGID_PROBE1(name, a) do { } while(0)
+#define LOGID_PROBE2(name, a, b) do { } while(0)
+#define LOGID_PROBE3(name, a, b, c) do { } while(0)
+#define LOGID_PROBE4(name, a, b, c, d) do { } while(0)
+#endif
+
+#endif //LOGID_PROBES_H
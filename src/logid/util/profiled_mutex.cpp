@@ -0,0 +1,67 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "profiled_mutex.h"
+#include "timeline.h"
+
+using namespace logid;
+using namespace std::chrono;
+
+std::atomic<bool> profiled_mutex::_enabled(false);
+std::mutex profiled_mutex::_locks_lock;
+std::map<std::string, std::shared_ptr<profiled_mutex::stats>>
+    profiled_mutex::_locks;
+
+profiled_mutex::profiled_mutex(const char* name) : _name (name)
+{
+    std::lock_guard<std::mutex> lock(_locks_lock);
+    auto& entry = _locks[name];
+    if(!entry)
+        entry = std::make_shared<stats>();
+    _stats = entry;
+}
+
+void profiled_mutex::_lockContended()
+{
+    if(!enabled()) {
+        _mutex.lock();
+        return;
+    }
+
+    auto start = steady_clock::now();
+    _mutex.lock();
+    auto end = steady_clock::now();
+    _stats->contended.fetch_add(1, std::memory_order_relaxed);
+    _stats->wait.record(end - start);
+    if(timeline::enabled())
+        timeline::complete("lock", _name, start, end);
+}
+
+void profiled_mutex::enable()
+{
+    _enabled = true;
+}
+
+std::map<std::string, std::shared_ptr<profiled_mutex::stats>>
+        profiled_mutex::locks()
+{
+    if(!enabled())
+        return {};
+    std::lock_guard<std::mutex> lock(_locks_lock);
+    return _locks;
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_PROFILED_MUTEX_H
+#define LOGID_PROFILED_MUTEX_H
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "latency.h"
+
+namespace logid
+{
+    /* A std::mutex that counts how often lock() found it held and how long
+     * it then waited, while lock profiling is on. The uncontended path is
+     * a try_lock either way. Mutexes that share a name, e.g. the _dev_io
+     * of every device, share their stats. Works with lock_guard and
+     * unique_lock, condition variables need condition_variable_any.
+     */
+    class profiled_mutex
+    {
+    public:
+        struct stats
+        {
+            std::atomic<uint64_t> contended{0};
+            latency::histogram wait;
+        };
+
+        // name must outlive the mutex, it is also the trace span name
+        explicit profiled_mutex(const char* name);
+
+        profiled_mutex(const profiled_mutex&) = delete;
+        profiled_mutex& operator=(const profiled_mutex&) = delete;
+
+        void lock()
+        {
+            if(!_mutex.try_lock())
+                _lockContended();
+        }
+
+        bool try_lock()
+        {
+            return _mutex.try_lock();
+        }
+
+        void unlock()
+        {
+            _mutex.unlock();
+        }
+
+        // Must be called before the profiled locks are contended
+        static void enable();
+        static bool enabled()
+        {
+            return _enabled.load(std::memory_order_relaxed);
+        }
+
+        // Empty unless lock profiling is enabled
+        static std::map<std::string, std::shared_ptr<stats>> locks();
+    private:
+        void _lockContended();
+
+        std::mutex _mutex;
+        const char* _name;
+        std::shared_ptr<stats> _stats;
+
+        static std::atomic<bool> _enabled;
+        static std::mutex _locks_lock;
+        static std::map<std::string, std::shared_ptr<stats>> _locks;
+    };
+}
+
+#endif //LOGID_PROFILED_MUTEX_H
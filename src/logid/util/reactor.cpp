@@ -0,0 +1,532 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <system_error>
+#include <vector>
+#include "reactor.h"
+#include "log.h"
+#include "realtime.h"
+#include "task.h"
+
+extern "C"
+{
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+}
+
+using namespace logid;
+
+std::shared_ptr<reactor_pool> logid::global_reactors;
+
+reactor::reactor(std::size_t max_events, int cpu, bool use_uring) :
+    _epoll_fd (-1), _max_events (max_events), _cpu (cpu),
+    _continue_run (false)
+{
+    if(!_max_events)
+        _max_events = 1;
+
+    if(use_uring) {
+        try {
+            _ring = std::make_unique<uring>(LOGID_URING_ENTRIES,
+                    LOGID_URING_BUFFERS, LOGID_URING_SLOT_SIZE);
+            // The completion queue is twice the submission queue
+            _completions.reserve(LOGID_URING_ENTRIES * 2);
+            _reads.reserve(LOGID_URING_ENTRIES * 2);
+            _writes.resize(LOGID_URING_WRITES);
+            for(uint16_t i = 0; i < LOGID_URING_WRITES; i++)
+                _free_writes.push_back(i);
+        } catch(std::system_error& e) {
+            logPrintf(INFO, "reactor: io_uring is not available, using "
+                            "epoll: %s", e.what());
+        }
+    }
+
+    if(-1 == ::pipe(_pipe))
+        throw std::system_error(errno, std::system_category(),
+                "reactor pipe open failed");
+
+    if(!_ring) {
+        _epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+        if(_epoll_fd == -1) {
+            int err = errno;
+            ::close(_pipe[0]);
+            ::close(_pipe[1]);
+            throw std::system_error(err, std::system_category(),
+                    "reactor epoll_create1 failed");
+        }
+
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = _pipe[0];
+        if(-1 == ::epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _pipe[0], &event)) {
+            int err = errno;
+            ::close(_epoll_fd);
+            ::close(_pipe[0]);
+            ::close(_pipe[1]);
+            throw std::system_error(err, std::system_category(),
+                    "reactor epoll_ctl failed");
+        }
+    }
+
+    _thread = std::make_unique<thread>([this](){ _run(); },
+            [this](std::exception& e){ _exception_handler(e); });
+    _continue_run = true;
+    _thread->run();
+}
+
+reactor::~reactor()
+{
+    stop();
+    _thread->wait();
+
+    if(_epoll_fd != -1)
+        ::close(_epoll_fd);
+    ::close(_pipe[0]);
+    ::close(_pipe[1]);
+}
+
+void reactor::add(int fd, const std::function<void()>& callback)
+{
+    std::lock_guard<std::mutex> lock(_handler_lock);
+    auto it = _handlers.find(fd);
+    if(it != _handlers.end()) {
+        it->second = std::make_shared<std::function<void()>>(callback);
+        return;
+    }
+
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if(-1 == ::epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &event))
+        throw std::system_error(errno, std::system_category(),
+                "reactor epoll_ctl add failed");
+
+    _handlers.emplace(fd, std::make_shared<std::function<void()>>(callback));
+}
+
+void reactor::addReads(int fd, const ReadCallback& callback)
+{
+    {
+        std::lock_guard<std::mutex> lock(_handler_lock);
+        auto id = _reader_ids.find(fd);
+        if(id != _reader_ids.end()) {
+            _readers[id->second].callback =
+                    std::make_shared<ReadCallback>(callback);
+            return;
+        }
+
+        uint64_t reader_id = _next_reader++;
+        auto& entry = _readers[reader_id];
+        entry.fd = fd;
+        entry.callback = std::make_shared<ReadCallback>(callback);
+        _reader_ids.emplace(fd, reader_id);
+    }
+
+    // Reads are posted by the reactor thread
+    if(!onReactorThread())
+        _wake();
+}
+
+void reactor::remove(int fd)
+{
+    {
+        std::lock_guard<std::mutex> lock(_handler_lock);
+        auto id = _reader_ids.find(fd);
+        if(id != _reader_ids.end()) {
+            // Posted reads hold the file, the fd may be closed meanwhile
+            _cancelled.push_back(id->second);
+            _readers.erase(id->second);
+            _reader_ids.erase(id);
+        } else {
+            auto it = _handlers.find(fd);
+            if(it == _handlers.end())
+                return;
+            _handlers.erase(it);
+            // The fd may already be closed, ignore errors here.
+            ::epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        }
+    }
+    if(_ring && !onReactorThread())
+        _wake();
+
+    /* Wait for any callback that may still reference the removed fd,
+     * unless we are being called from within that callback. */
+    if(!onReactorThread())
+        std::lock_guard<std::mutex> lock(_dispatch_lock);
+}
+
+void reactor::stop()
+{
+    if(!_continue_run)
+        return;
+    _continue_run = false;
+    _wake();
+}
+
+void reactor::_wake()
+{
+    char c = 0;
+    if(-1 == ::write(_pipe[1], &c, sizeof(char)))
+        logPrintf(WARN, "reactor: failed to interrupt epoll loop: %s",
+                strerror(errno));
+}
+
+bool reactor::completesReads() const
+{
+    return (bool)_ring;
+}
+
+std::size_t reactor::fdCount()
+{
+    std::lock_guard<std::mutex> lock(_handler_lock);
+    return _handlers.size();
+}
+
+bool reactor::onReactorThread() const
+{
+    return std::this_thread::get_id() == _thread_id.load();
+}
+
+void reactor::_run()
+{
+    _thread_id = std::this_thread::get_id();
+    thread::setName(_cpu >= 0 ? "reactor" + std::to_string(_cpu) :
+            "reactor");
+    task::setCurrent(task::Interactive);
+    realtime::promote();
+    if(_cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(_cpu, &cpus);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t),
+                &cpus);
+        if(err)
+            logPrintf(WARN, "reactor: could not pin to CPU %d: %s", _cpu,
+                    strerror(err));
+    }
+    if(_ring) {
+        _runUring();
+        return;
+    }
+    std::vector<epoll_event> events(_max_events);
+
+    while(_continue_run) {
+        int ready = ::epoll_wait(_epoll_fd, events.data(), events.size(), -1);
+        if(ready == -1) {
+            if(errno == EINTR)
+                continue;
+            throw std::system_error(errno, std::system_category(),
+                    "reactor epoll_wait failed");
+        }
+
+        std::lock_guard<std::mutex> dispatch(_dispatch_lock);
+        for(int i = 0; i < ready; i++) {
+            int fd = events[i].data.fd;
+            if(fd == _pipe[0]) {
+                char c;
+                if(-1 == ::read(_pipe[0], &c, sizeof(char)))
+                    throw std::system_error(errno, std::system_category(),
+                            "reactor read pipe failed");
+                continue;
+            }
+
+            std::shared_ptr<std::function<void()>> callback;
+            {
+                std::lock_guard<std::mutex> lock(_handler_lock);
+                auto it = _handlers.find(fd);
+                if(it == _handlers.end())
+                    continue;
+                callback = it->second;
+            }
+
+            try {
+                (*callback)();
+            } catch(std::exception& e) {
+                logPrintf(WARN, "Error while handling I/O on fd %d: %s",
+                        fd, e.what());
+            }
+        }
+    }
+}
+
+void reactor::_runUring()
+{
+    _ring->read(_pipe[0], &_wake_byte, 1, WakeCompletion);
+    while(_continue_run) {
+        _postReads();
+        _ring->enter(1);
+
+        std::lock_guard<std::mutex> dispatch(_dispatch_lock);
+        _reap();
+        _dispatchCompletions();
+    }
+}
+
+void reactor::_postReads()
+{
+    std::lock_guard<std::mutex> lock(_handler_lock);
+    for(auto id : _cancelled)
+        _ring->cancel(id << 2 | ReadCompletion, IgnoredCompletion);
+    _cancelled.clear();
+
+    for(auto& entry : _readers) {
+        auto& reader = entry.second;
+        for(; !reader.failed && reader.posted < LOGID_URING_READS;
+                reader.posted++)
+            _ring->read(reader.fd, entry.first << 2 | ReadCompletion);
+    }
+}
+
+void reactor::_reap()
+{
+    std::array<uring::completion, 64> batch;
+    std::size_t count;
+    do {
+        count = _ring->reap(batch.data(), batch.size());
+        _completions.insert(_completions.end(), batch.begin(),
+                batch.begin() + count);
+    } while(count == batch.size());
+}
+
+void reactor::_dispatchCompletions()
+{
+    while(_next_completion < _completions.size()) {
+        auto first = _completions[_next_completion];
+        auto kind = first.user_data & 3;
+        if(kind == WakeCompletion) {
+            if(first.result < 0 && first.result != -EINTR)
+                throw std::system_error(-first.result,
+                        std::system_category(), "reactor read pipe failed");
+            _ring->read(_pipe[0], &_wake_byte, 1, WakeCompletion);
+            _next_completion++;
+            continue;
+        } else if(kind == WriteCompletion) {
+            if(first.result < 0)
+                logPrintf(DEBUG, "reactor: queued write failed: %s",
+                        strerror(-first.result));
+            _free_writes.push_back(first.user_data >> 2);
+            _next_completion++;
+            continue;
+        } else if(kind == IgnoredCompletion) {
+            _next_completion++;
+            continue;
+        }
+
+        // Reads of an fd that completed one after the other go together
+        std::size_t begin = _next_completion, end = begin;
+        _reads.clear();
+        bool failed = false;
+        for(; end < _completions.size() &&
+                _completions[end].user_data == first.user_data; end++) {
+            auto& read = _completions[end];
+            // Cancelled or out of buffers, the latter is posted again
+            if(read.result == -ECANCELED || read.result == -ENOBUFS)
+                continue;
+            if(read.result <= 0)
+                failed = true;
+            _reads.push_back({_ring->buffer(read), read.result});
+        }
+        _next_completion = end;
+
+        std::shared_ptr<ReadCallback> callback;
+        int fd = -1;
+        {
+            std::lock_guard<std::mutex> lock(_handler_lock);
+            auto it = _readers.find(first.user_data >> 2);
+            if(it != _readers.end()) {
+                fd = it->second.fd;
+                it->second.posted -= std::min<unsigned>(end - begin,
+                        it->second.posted);
+                it->second.failed |= failed;
+                callback = it->second.callback;
+            }
+        }
+
+        if(callback && !_reads.empty()) {
+            try {
+                (*callback)(_reads.data(), _reads.size());
+            } catch(std::exception& e) {
+                logPrintf(WARN, "Error while handling I/O on fd %d: %s",
+                        fd, e.what());
+            }
+        }
+
+        // Buffers are only handed back once the callback is done with them
+        for(std::size_t i = begin; i < end; i++)
+            if(_completions[i].user_data != IgnoredCompletion)
+                _ring->recycle(_completions[i]);
+    }
+
+    _completions.clear();
+    _next_completion = 0;
+}
+
+int reactor::read(int fd, uint8_t* data, std::size_t size,
+        std::chrono::steady_clock::time_point deadline)
+{
+    uint64_t user_data;
+    {
+        std::lock_guard<std::mutex> lock(_handler_lock);
+        auto id = _reader_ids.find(fd);
+        if(!_ring || id == _reader_ids.end())
+            return -EBADF;
+        user_data = id->second << 2 | ReadCompletion;
+    }
+
+    for(;;) {
+        for(auto i = _next_completion; i < _completions.size(); i++) {
+            auto& read = _completions[i];
+            if(read.user_data != user_data || read.result == -ECANCELED ||
+               read.result == -ENOBUFS)
+                continue;
+
+            int result = read.result;
+            if(result > 0)
+                std::memcpy(data, _ring->buffer(read),
+                        std::min<std::size_t>(result, size));
+            _ring->recycle(read);
+            read.user_data = IgnoredCompletion;
+
+            std::lock_guard<std::mutex> lock(_handler_lock);
+            auto it = _readers.find(user_data >> 2);
+            if(it != _readers.end()) {
+                it->second.posted -= std::min(1u, it->second.posted);
+                it->second.failed |= result <= 0;
+            }
+            return result;
+        }
+
+        timespec timeout{};
+        bool bounded = deadline !=
+                std::chrono::steady_clock::time_point::max();
+        if(bounded) {
+            auto left = deadline - std::chrono::steady_clock::now();
+            if(left.count() <= 0)
+                return -ETIMEDOUT;
+            auto secs = std::chrono::duration_cast<std::chrono::seconds>(
+                    left);
+            timeout.tv_sec = secs.count();
+            timeout.tv_nsec = std::chrono::duration_cast<
+                    std::chrono::nanoseconds>(left - secs).count();
+        }
+
+        _postReads();
+        _ring->enter(1, bounded ? &timeout : nullptr);
+        _reap();
+    }
+}
+
+bool reactor::write(int fd, const uint8_t* data, std::size_t size)
+{
+    if(!_ring || !onReactorThread() || size > LOGID_URING_SLOT_SIZE ||
+       _free_writes.empty())
+        return false;
+
+    auto slot = _free_writes.back();
+    _free_writes.pop_back();
+    std::memcpy(_writes[slot].data(), data, size);
+    _ring->write(fd, _writes[slot].data(), size,
+            (uint64_t)slot << 2 | WriteCompletion);
+    return true;
+}
+
+void reactor::_exception_handler(std::exception& e)
+{
+    logPrintf(WARN, "Exception caught on reactor thread, restarting: %s",
+            e.what());
+    // This action destroys the logid::thread, std::thread should detach safely.
+    _thread = std::make_unique<thread>([this](){ _run(); },
+            [this](std::exception& e) { _exception_handler(e); });
+    _thread->run();
+}
+
+reactor_pool::reactor_pool(std::size_t shards, std::size_t max_events,
+        const std::vector<int>& cpus, bool use_uring)
+{
+    if(!shards)
+        shards = 1;
+
+    for(std::size_t i = 0; i < shards; i++) {
+        int cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
+        _shards.push_back(std::make_shared<reactor>(max_events, cpu,
+                use_uring));
+        for(std::size_t point = 0; point < LOGID_REACTOR_RING_POINTS;
+                point++)
+            _ring.emplace(_hash(std::to_string(i) + "/" +
+                    std::to_string(point)), i);
+    }
+    _load.resize(shards);
+}
+
+std::shared_ptr<reactor> reactor_pool::acquire(const std::string& key)
+{
+    std::lock_guard<std::mutex> lock(_owner_lock);
+    auto owner = _owners.find(key);
+    if(owner != _owners.end())
+        return _shards[owner->second];
+
+    std::size_t total = 1;
+    for(auto load : _load)
+        total += load;
+    auto bound = (std::size_t)std::ceil(LOGID_REACTOR_LOAD_FACTOR * total /
+            _shards.size());
+
+    // The bound leaves room on at least one shard, the walk ends there
+    auto point = _ring.lower_bound(_hash(key));
+    for(std::size_t i = 0; i < _ring.size(); i++, point++) {
+        if(point == _ring.end())
+            point = _ring.begin();
+        if(_load[point->second] < bound)
+            break;
+    }
+    if(point == _ring.end())
+        point = _ring.begin();
+
+    _load[point->second]++;
+    _owners.emplace(key, point->second);
+    return _shards[point->second];
+}
+
+void reactor_pool::release(const std::string& key)
+{
+    std::lock_guard<std::mutex> lock(_owner_lock);
+    auto owner = _owners.find(key);
+    if(owner == _owners.end())
+        return;
+    _load[owner->second]--;
+    _owners.erase(owner);
+}
+
+std::size_t reactor_pool::size() const
+{
+    return _shards.size();
+}
+
+// FNV-1a, stable across runs unlike std::hash
+uint64_t reactor_pool::_hash(const std::string& key)
+{
+    uint64_t hash = 0xcbf29ce484222325;
+    for(unsigned char c : key) {
+        hash ^= c;
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
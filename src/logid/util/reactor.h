@@ -0,0 +1,194 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_REACTOR_H
+#define LOGID_REACTOR_H
+
+#include <map>
+#include <mutex>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <functional>
+#include "thread.h"
+#include "uring.h"
+
+// Points each shard has on the hash ring of a reactor_pool
+#define LOGID_REACTOR_RING_POINTS 64
+// A shard takes no new fds past this factor of the average load
+#define LOGID_REACTOR_LOAD_FACTOR 1.25
+// Submission queue entries of an io_uring reactor
+#define LOGID_URING_ENTRIES 256
+// Reads each fd keeps posted with io_uring
+#define LOGID_URING_READS 4
+// Read buffers shared by the fds of an io_uring reactor, a power of 2
+#define LOGID_URING_BUFFERS 256
+// Longest read or queued write with io_uring
+#define LOGID_URING_SLOT_SIZE 64
+// Writes that may be queued at once
+#define LOGID_URING_WRITES 32
+
+namespace logid
+{
+    /* A single epoll loop that owns a set of file descriptors and runs
+     * a callback on the reactor thread whenever one becomes readable.
+     *
+     * With io_uring, the reactor reads instead: every fd keeps
+     * LOGID_URING_READS reads posted that take their buffer from a ring
+     * shared by the reactor, and completions are collected in batches
+     * with one system call that also submits the reads posted again and
+     * any queued writes. Kernels without buffer rings fall back to epoll.
+     */
+    class reactor
+    {
+    public:
+        // One read of an fd, data is only valid during the callback
+        struct read_result
+        {
+            const uint8_t* data;
+            // Bytes read, 0 at end of file or -errno
+            int result;
+        };
+        typedef std::function<void(const read_result*, std::size_t)>
+            ReadCallback;
+
+        /* cpu pins the reactor thread, -1 keeps the real-time CPU set.
+         * use_uring asks for io_uring, see completesReads(). */
+        explicit reactor(std::size_t max_events, int cpu=-1,
+                bool use_uring=false);
+        ~reactor();
+
+        void add(int fd, const std::function<void()>& callback);
+        /* Only if completesReads(). The callback gets the reads of fd that
+         * completed in order, reads stop after one that failed. */
+        void addReads(int fd, const ReadCallback& callback);
+        void remove(int fd);
+
+        // Whether io_uring is in use, so fds are read by the reactor
+        bool completesReads() const;
+        /* For reads on the reactor thread while a callback runs. Takes the
+         * next read of fd that was not handed out yet, or waits for one
+         * until deadline. Returns what read_result would hold, -ETIMEDOUT
+         * if none came in time. */
+        int read(int fd, uint8_t* data, std::size_t size,
+                std::chrono::steady_clock::time_point deadline);
+        /* Queues a write that is submitted with the next wait. False if
+         * the caller must write itself, e.g. off the reactor thread. A
+         * failed write is only logged. */
+        bool write(int fd, const uint8_t* data, std::size_t size);
+
+        void stop();
+
+        std::size_t fdCount();
+        bool onReactorThread() const;
+    private:
+        void _run();
+        void _exception_handler(std::exception& e);
+
+        // What a completion is for, in the low bits of its user_data
+        enum CompletionKind
+        {
+            ReadCompletion,
+            WriteCompletion,
+            WakeCompletion,
+            IgnoredCompletion   // Cancels, and reads handed out by read()
+        };
+        void _runUring();
+        // Posts missing reads and the cancels of removed fds
+        void _postReads();
+        void _reap();
+        void _dispatchCompletions();
+        /* The reactor thread is woken through the pipe, as it may wait in
+         * io_uring while fds are added or removed. */
+        void _wake();
+
+        std::unique_ptr<uring> _ring;
+        struct reader
+        {
+            int fd;
+            std::shared_ptr<ReadCallback> callback;
+            unsigned posted = 0;
+            // Set once a read failed, nothing is posted after that
+            bool failed = false;
+        };
+        // Guarded by _handler_lock, keyed by an id so fds may be reused
+        std::map<uint64_t, reader> _readers;
+        std::map<int, uint64_t> _reader_ids;
+        std::vector<uint64_t> _cancelled;
+        uint64_t _next_reader = 1;
+        // Only touched by the reactor thread
+        std::vector<uring::completion> _completions;
+        std::size_t _next_completion = 0;
+        std::vector<read_result> _reads;
+        std::vector<std::array<uint8_t, LOGID_URING_SLOT_SIZE>> _writes;
+        std::vector<uint16_t> _free_writes;
+        uint8_t _wake_byte;
+
+        int _epoll_fd;
+        int _pipe[2];
+        std::size_t _max_events;
+        int _cpu;
+
+        std::unique_ptr<thread> _thread;
+        std::atomic<bool> _continue_run;
+        std::atomic<std::thread::id> _thread_id;
+
+        std::mutex _handler_lock;
+        std::map<int, std::shared_ptr<std::function<void()>>> _handlers;
+        // Held while a batch of callbacks is dispatched
+        std::mutex _dispatch_lock;
+    };
+
+    /* Several reactors, each owning the fds of a subset of devices.
+     * Keys, e.g. hidraw paths, are placed on a hash ring so that a
+     * device coming or going never moves another one. A shard that
+     * already holds more than its share passes new keys on to the next
+     * shard of the ring, so shards even out again as devices are
+     * plugged in.
+     */
+    class reactor_pool
+    {
+    public:
+        /* Shard i is pinned to cpus[i % cpus.size()], shards are not
+         * pinned if cpus is empty. */
+        reactor_pool(std::size_t shards, std::size_t max_events,
+                const std::vector<int>& cpus, bool use_uring=false);
+
+        // The shard owning key, assigned on its first acquire
+        std::shared_ptr<reactor> acquire(const std::string& key);
+        // Forgets key, its next acquire may pick another shard
+        void release(const std::string& key);
+
+        std::size_t size() const;
+    private:
+        static uint64_t _hash(const std::string& key);
+
+        std::vector<std::shared_ptr<reactor>> _shards;
+        // Hash to shard, LOGID_REACTOR_RING_POINTS per shard
+        std::map<uint64_t, std::size_t> _ring;
+
+        std::mutex _owner_lock;
+        std::map<std::string, std::size_t> _owners;
+        std::vector<std::size_t> _load;
+    };
+
+    extern std::shared_ptr<reactor_pool> global_reactors;
+}
+
+#endif //LOGID_REACTOR_H
@@ -0,0 +1,93 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_READ_EPOCH_H
+#define LOGID_READ_EPOCH_H
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+namespace logid
+{
+    /* Tells a writer that swapped in a new snapshot when the readers of
+     * the old one are done, without spinning. Readers enter before they
+     * load the snapshot and are counted under one of two epochs, each
+     * synchronize() moves new readers to the other one and sleeps until
+     * the previous epoch is empty. The last reader to leave wakes it.
+     *
+     * Readers that start after the swap never hold a writer up for long,
+     * they only share its epoch with a later writer's.
+     */
+    class read_epoch
+    {
+    public:
+        // Returns the epoch to pass to leave()
+        unsigned enter()
+        {
+            unsigned epoch = _epoch.load() & 1;
+            _readers[epoch].fetch_add(1);
+            return epoch;
+        }
+
+        void leave(unsigned epoch)
+        {
+            // Pairs with the waiter count in synchronize()
+            if(_readers[epoch].fetch_sub(1) == 1 && _waiters.load() > 0) {
+                std::lock_guard<std::mutex> lock(_lock);
+                _left.notify_all();
+            }
+        }
+
+        // Call after publishing, must not be called while inside
+        void synchronize()
+        {
+            unsigned epoch = _epoch.fetch_add(1) & 1;
+            _waiters.fetch_add(1);
+            {
+                std::unique_lock<std::mutex> lock(_lock);
+                _left.wait(lock, [this, epoch]() {
+                    return _readers[epoch].load() == 0;
+                });
+            }
+            _waiters.fetch_sub(1);
+        }
+
+        class guard
+        {
+        public:
+            explicit guard(read_epoch& epochs) : _epochs (epochs),
+                _epoch (epochs.enter()) { }
+            ~guard() { _epochs.leave(_epoch); }
+
+            guard(const guard&) = delete;
+            guard& operator=(const guard&) = delete;
+        private:
+            read_epoch& _epochs;
+            const unsigned _epoch;
+        };
+    private:
+        std::atomic<unsigned> _epoch{0};
+        std::array<std::atomic<int>, 2> _readers{};
+        std::atomic<int> _waiters{0};
+        std::mutex _lock;
+        std::condition_variable _left;
+    };
+}
+
+#endif //LOGID_READ_EPOCH_H
@@ -0,0 +1,169 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <cerrno>
+#include <cstring>
+#include "realtime.h"
+#include "log.h"
+
+extern "C"
+{
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+}
+
+using namespace logid;
+
+std::atomic<bool> realtime::_enabled(false);
+realtime::settings realtime::_settings;
+
+namespace
+{
+    cpu_set_t pinned_cpus;
+    // The CPUs logid was started with, demoted threads go back to them
+    cpu_set_t default_cpus;
+    std::atomic<bool> promote_warned(false);
+
+    int schedPolicy(realtime::Policy policy)
+    {
+        switch(policy) {
+        case realtime::FIFO:
+            return SCHED_FIFO;
+        case realtime::RoundRobin:
+            return SCHED_RR;
+        default:
+            return SCHED_OTHER;
+        }
+    }
+
+    // Root may exceed the rlimits, this does not look at capabilities
+    bool limited(int resource, rlim_t& limit)
+    {
+        rlimit rl {};
+        if(geteuid() == 0 || getrlimit(resource, &rl) == -1 ||
+           rl.rlim_cur == RLIM_INFINITY)
+            return false;
+        limit = rl.rlim_cur;
+        return true;
+    }
+}
+
+void realtime::enable(const settings& config)
+{
+    _settings = config;
+
+    if(_settings.policy != Other) {
+        int policy = schedPolicy(_settings.policy);
+        int min = sched_get_priority_min(policy);
+        int max = sched_get_priority_max(policy);
+        if(_settings.priority < min || _settings.priority > max) {
+            logPrintf(WARN, "Real-time priority must be between %d and %d, "
+                            "using %d.", min, max, LOGID_DEFAULT_RT_PRIORITY);
+            _settings.priority = LOGID_DEFAULT_RT_PRIORITY;
+        }
+
+        rlim_t limit;
+        if(limited(RLIMIT_RTPRIO, limit)) {
+            if(limit == 0) {
+                logPrintf(WARN, "RLIMIT_RTPRIO is 0, real-time scheduling "
+                                "is disabled.");
+                _settings.policy = Other;
+            } else if((rlim_t)_settings.priority > limit) {
+                logPrintf(WARN, "Real-time priority %d exceeds RLIMIT_RTPRIO,"
+                                " using %d.", _settings.priority, (int)limit);
+                _settings.priority = (int)limit;
+            }
+        }
+    }
+
+    CPU_ZERO(&pinned_cpus);
+    for(auto cpu : _settings.cpus) {
+        if(cpu >= 0 && cpu < CPU_SETSIZE)
+            CPU_SET(cpu, &pinned_cpus);
+        else
+            logPrintf(WARN, "Ignoring invalid CPU %d.", cpu);
+    }
+    if(sched_getaffinity(0, sizeof(cpu_set_t), &default_cpus) == -1)
+        CPU_ZERO(&default_cpus);
+
+    if(_settings.lock_memory) {
+        /* With a finite RLIMIT_MEMLOCK, locking future mappings would make
+         * allocations fail once the limit is reached. */
+        int flags = MCL_CURRENT | MCL_FUTURE;
+        rlim_t limit;
+        if(limited(RLIMIT_MEMLOCK, limit)) {
+            logPrintf(WARN, "RLIMIT_MEMLOCK is %lu bytes, only memory mapped"
+                            " at startup is locked.", (unsigned long)limit);
+            flags = MCL_CURRENT;
+        }
+        if(mlockall(flags) == -1)
+            logPrintf(WARN, "mlockall failed: %s", strerror(errno));
+    }
+
+    _enabled = true;
+}
+
+bool realtime::enabled()
+{
+    return _enabled;
+}
+
+void realtime::promote()
+{
+    if(!_enabled)
+        return;
+
+    int err = 0;
+    if(_settings.policy != Other) {
+        sched_param param {};
+        param.sched_priority = _settings.priority;
+        err = pthread_setschedparam(pthread_self(),
+                schedPolicy(_settings.policy), &param);
+        if(err && !promote_warned.exchange(true))
+            logPrintf(WARN, "Could not set real-time scheduling: %s",
+                    strerror(err));
+    }
+
+    if(CPU_COUNT(&pinned_cpus)) {
+        err = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t),
+                &pinned_cpus);
+        if(err && !promote_warned.exchange(true))
+            logPrintf(WARN, "Could not set CPU affinity: %s", strerror(err));
+    }
+}
+
+void realtime::demote()
+{
+    if(!_enabled)
+        return;
+
+    int policy;
+    sched_param param {};
+    if(pthread_getschedparam(pthread_self(), &policy, &param) == 0 &&
+       policy != SCHED_OTHER) {
+        param.sched_priority = 0;
+        pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+    }
+
+    if(CPU_COUNT(&pinned_cpus) && CPU_COUNT(&default_cpus))
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t),
+                &default_cpus);
+}
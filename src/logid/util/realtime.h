@@ -0,0 +1,69 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_REALTIME_H
+#define LOGID_REALTIME_H
+
+#include <atomic>
+#include <vector>
+
+#define LOGID_DEFAULT_RT_PRIORITY 10
+
+namespace logid
+{
+    /* Optional real-time mode for the threads on the input path, i.e.
+     * the reactor, the device listeners and the uinput output thread.
+     * Other threads, including the worker pool, keep normal scheduling.
+     */
+    class realtime
+    {
+    public:
+        enum Policy
+        {
+            Other,  // Only pins threads and locks memory
+            FIFO,
+            RoundRobin
+        };
+
+        struct settings
+        {
+            Policy policy = FIFO;
+            int priority = LOGID_DEFAULT_RT_PRIORITY;
+            // CPUs the input threads are pinned to, empty for any CPU
+            std::vector<int> cpus;
+            bool lock_memory = false;
+        };
+
+        /* Must be called before any other thread is started. Checks the
+         * priority against RLIMIT_RTPRIO and locks memory if asked.
+         */
+        static void enable(const settings& config);
+        static bool enabled();
+
+        // Applies the policy and CPU set to the calling thread
+        static void promote();
+        /* Threads inherit scheduling from their creator, so new threads
+         * go back to normal scheduling unless they promote themselves.
+         */
+        static void demote();
+    private:
+        static std::atomic<bool> _enabled;
+        static settings _settings;
+    };
+}
+
+#endif //LOGID_REALTIME_H
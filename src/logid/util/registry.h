@@ -0,0 +1,108 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_REGISTRY_H
+#define LOGID_REGISTRY_H
+
+#include <array>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define LOGID_REGISTRY_STRIPES 16
+
+namespace logid
+{
+    /* Objects keyed by string, e.g. hidraw path. Keys are spread over
+     * stripes that each have their own lock, so that setting up and
+     * tearing down different keys never wait on each other. Values are
+     * only looked up and swapped under the lock, never built under it.
+     */
+    template<typename T>
+    class registry
+    {
+    public:
+        // Returns false and keeps the present value if key is taken
+        bool insert(const std::string& key, std::shared_ptr<T> value)
+        {
+            auto& s = _stripe(key);
+            std::lock_guard<std::mutex> lock(s.lock);
+            return s.values.emplace(key, std::move(value)).second;
+        }
+
+        // Null if there is no value for key
+        std::shared_ptr<T> get(const std::string& key)
+        {
+            auto& s = _stripe(key);
+            std::lock_guard<std::mutex> lock(s.lock);
+            auto it = s.values.find(key);
+            return it == s.values.end() ? nullptr : it->second;
+        }
+
+        // Sets key whether or not it was taken
+        void assign(const std::string& key, std::shared_ptr<T> value)
+        {
+            auto& s = _stripe(key);
+            std::lock_guard<std::mutex> lock(s.lock);
+            s.values[key] = std::move(value);
+        }
+
+        // Removes key and returns its value, null if there was none
+        std::shared_ptr<T> take(const std::string& key)
+        {
+            auto& s = _stripe(key);
+            std::lock_guard<std::mutex> lock(s.lock);
+            auto it = s.values.find(key);
+            if(it == s.values.end())
+                return nullptr;
+            auto value = std::move(it->second);
+            s.values.erase(it);
+            return value;
+        }
+
+        /* Every entry, each stripe is copied under its own lock so the
+         * result may mix before and after a concurrent change. */
+        std::vector<std::pair<std::string, std::shared_ptr<T>>> entries()
+        {
+            std::vector<std::pair<std::string, std::shared_ptr<T>>> all;
+            for(auto& s : _stripes) {
+                std::lock_guard<std::mutex> lock(s.lock);
+                all.insert(all.end(), s.values.begin(), s.values.end());
+            }
+            return all;
+        }
+    private:
+        struct stripe
+        {
+            std::mutex lock;
+            std::map<std::string, std::shared_ptr<T>> values;
+        };
+
+        stripe& _stripe(const std::string& key)
+        {
+            return _stripes[std::hash<std::string>()(key) %
+                    LOGID_REGISTRY_STRIPES];
+        }
+
+        std::array<stripe, LOGID_REGISTRY_STRIPES> _stripes;
+    };
+}
+
+#endif //LOGID_REGISTRY_H
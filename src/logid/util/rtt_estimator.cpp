@@ -0,0 +1,88 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include "rtt_estimator.h"
+
+// Timeouts stop doubling after this many in a row
+#define LOGID_RTT_MAX_BACKOFF 6
+
+using namespace logid;
+using namespace std::chrono;
+
+rtt_estimator::rtt_estimator() : _sampled (false), _srtt (0), _rttvar (0),
+    _backoff (0)
+{
+}
+
+void rtt_estimator::sample(nanoseconds rtt)
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    if(!_sampled) {
+        _srtt = rtt;
+        _rttvar = rtt / 2;
+        _sampled = true;
+    } else {
+        auto error = _srtt > rtt ? _srtt - rtt : rtt - _srtt;
+        _rttvar = (_rttvar * 3 + error) / 4;
+        _srtt = (_srtt * 7 + rtt) / 8;
+    }
+    _backoff = 0;
+}
+
+void rtt_estimator::backoff()
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    if(_backoff < LOGID_RTT_MAX_BACKOFF)
+        _backoff++;
+}
+
+nanoseconds rtt_estimator::timeout(nanoseconds max) const
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    return _timeout(max);
+}
+
+nanoseconds rtt_estimator::budget(nanoseconds max) const
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    // Every retry waits twice as long as the one before
+    auto timeout = _timeout(max);
+    return std::min(max, timeout * ((1 << (LOGID_RTT_RETRIES + 1)) - 1));
+}
+
+nanoseconds rtt_estimator::smoothed() const
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    return _srtt;
+}
+
+nanoseconds rtt_estimator::variance() const
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    return _rttvar;
+}
+
+nanoseconds rtt_estimator::_timeout(nanoseconds max) const
+{
+    if(!_sampled)
+        return max;
+    nanoseconds timeout = std::max<nanoseconds>(LOGID_RTT_MIN_TIMEOUT,
+            _srtt + _rttvar * 4) * (1 << _backoff);
+    return std::min(max, timeout);
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_RTT_ESTIMATOR_H
+#define LOGID_RTT_ESTIMATOR_H
+
+#include <chrono>
+#include <mutex>
+
+// Floor on the retry timeout, a few scheduler ticks above a fast link
+#define LOGID_RTT_MIN_TIMEOUT std::chrono::milliseconds(20)
+// Resends before a request times out
+#define LOGID_RTT_RETRIES 2
+
+namespace logid
+{
+    /* Round-trip time estimate of one device, as TCP does it (RFC 6298).
+     * The retry timeout is the smoothed RTT plus four times its mean
+     * deviation, doubled for every timeout until the next sample.
+     */
+    class rtt_estimator
+    {
+    public:
+        rtt_estimator();
+
+        // Resent requests must not be sampled, the response is ambiguous
+        void sample(std::chrono::nanoseconds rtt);
+        void backoff();
+
+        // How long to wait before resending, max until the first sample
+        std::chrono::nanoseconds timeout(std::chrono::nanoseconds max) const;
+        /* How long a request may take including its retries, at most max.
+         * Without samples it is only sent once. */
+        std::chrono::nanoseconds budget(std::chrono::nanoseconds max) const;
+
+        // Zero until the first sample
+        std::chrono::nanoseconds smoothed() const;
+        std::chrono::nanoseconds variance() const;
+    private:
+        std::chrono::nanoseconds _timeout(std::chrono::nanoseconds max) const;
+
+        mutable std::mutex _lock;
+        bool _sampled;
+        std::chrono::nanoseconds _srtt;
+        std::chrono::nanoseconds _rttvar;
+        int _backoff;
+    };
+}
+
+#endif //LOGID_RTT_ESTIMATOR_H
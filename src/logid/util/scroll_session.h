@@ -0,0 +1,80 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_SCROLL_SESSION_H
+#define LOGID_SCROLL_SESSION_H
+
+#include <chrono>
+#include <cstdint>
+
+namespace logid
+{
+    /* Tracks which way a wheel is scrolling so that only the action that
+     * was actually moved gets re-armed. A session ends when the wheel
+     * reverses or has been idle for the timeout (0 never times out).
+     *
+     * Not thread safe, callers serialise steps.
+     */
+    class scroll_session
+    {
+    public:
+        typedef std::chrono::steady_clock clock;
+
+        explicit scroll_session(std::chrono::milliseconds idle_timeout =
+                std::chrono::milliseconds(0)) : _idle_timeout (idle_timeout)
+        {
+        }
+
+        /* Moves the session in direction (1 or -1) and returns the
+         * direction whose action must be re-armed first, or 0.
+         */
+        int8_t step(int8_t direction, clock::time_point now)
+        {
+            int8_t rearm = 0;
+            if(_direction != 0 && (direction != _direction ||
+                    (_idle_timeout.count() > 0 &&
+                     now - _last >= _idle_timeout)))
+                rearm = _direction;
+
+            _direction = direction;
+            _last = now;
+            return rearm;
+        }
+
+        int8_t step(int8_t direction)
+        {
+            return step(direction, clock::now());
+        }
+
+        // Forgets the session, e.g. after the actions were re-armed
+        void end()
+        {
+            _direction = 0;
+        }
+
+        int8_t direction() const
+        {
+            return _direction;
+        }
+    private:
+        std::chrono::milliseconds _idle_timeout;
+        clock::time_point _last;
+        int8_t _direction = 0;
+    };
+}
+
+#endif //LOGID_SCROLL_SESSION_H
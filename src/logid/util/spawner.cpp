@@ -0,0 +1,164 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include "spawner.h"
+#include "log.h"
+
+extern "C"
+{
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/socket.h>
+}
+
+extern char** environ;
+
+using namespace logid;
+
+std::atomic<int> spawner::_fd(-1);
+pid_t spawner::_helper = -1;
+
+void spawner::start()
+{
+    if(_fd >= 0)
+        return;
+
+    // Datagrams keep each command line in one piece
+    int fds[2];
+    if(::socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds)) {
+        logPrintf(WARN, "Could not start the command helper: %s",
+                strerror(errno));
+        return;
+    }
+
+    pid_t pid = ::fork();
+    if(pid < 0) {
+        logPrintf(WARN, "Could not start the command helper: %s",
+                strerror(errno));
+        ::close(fds[0]);
+        ::close(fds[1]);
+        return;
+    }
+    if(pid == 0) {
+        ::close(fds[0]);
+        _serve(fds[1]);
+    }
+
+    ::close(fds[1]);
+    _helper = pid;
+    _fd = fds[0];
+    LOGID_LOG(DEBUG, "Command helper started as pid %d", (int)pid);
+}
+
+bool spawner::running()
+{
+    return _fd >= 0;
+}
+
+std::string spawner::message(const std::vector<std::string>& argv)
+{
+    std::string message;
+    if(argv.empty() || argv.size() > LOGID_SPAWNER_ARGS)
+        return message;
+    for(auto& arg : argv) {
+        message += arg;
+        message += '\0';
+    }
+    if(message.size() >= LOGID_SPAWNER_MESSAGE)
+        message.clear();
+    return message;
+}
+
+bool spawner::run(const std::string& message)
+{
+    int fd = _fd;
+    if(fd < 0 || message.empty())
+        return false;
+
+    if(::send(fd, message.data(), message.size(),
+              MSG_NOSIGNAL | MSG_DONTWAIT) < 0) {
+        logPrintf(WARN, "Could not run %s: %s", message.c_str(),
+                strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void spawner::_serve(int fd)
+{
+    /* Other threads may have held allocator locks when logid forked, so
+     * nothing here allocates. Commands are reaped by the kernel, and
+     * signals sent to the terminal's process group are left to logid,
+     * which closes the socket when it exits. */
+    ::signal(SIGCHLD, SIG_IGN);
+    ::signal(SIGINT, SIG_IGN);
+    ::signal(SIGQUIT, SIG_IGN);
+    ::signal(SIGHUP, SIG_IGN);
+    ::signal(SIGUSR1, SIG_IGN);
+    sigset_t none;
+    sigemptyset(&none);
+    ::sigprocmask(SIG_SETMASK, &none, nullptr);
+
+    // Commands start with default signal handling in their own group
+    sigset_t all;
+    sigfillset(&all);
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigdefault(&attr, &all);
+    posix_spawnattr_setsigmask(&attr, &none);
+    posix_spawnattr_setpgroup(&attr, 0);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF |
+            POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETPGROUP);
+
+    char buffer[LOGID_SPAWNER_MESSAGE];
+    char* argv[LOGID_SPAWNER_ARGS + 1];
+    while(true) {
+        ssize_t length = ::recv(fd, buffer, sizeof(buffer) - 1, 0);
+        if(length < 0 && errno == EINTR)
+            continue;
+        if(length <= 0)
+            ::_exit(0);
+        buffer[length] = '\0';
+
+        std::size_t argc = 0;
+        for(char* arg = buffer; arg < buffer + length &&
+                argc < LOGID_SPAWNER_ARGS; arg += std::strlen(arg) + 1)
+            argv[argc++] = arg;
+        argv[argc] = nullptr;
+        if(!argc)
+            continue;
+
+        pid_t pid;
+        int error = ::posix_spawnp(&pid, argv[0], nullptr, &attr, argv,
+                environ);
+        if(error) {
+            char line[256];
+            int size = std::snprintf(line, sizeof(line),
+                    "[WARN] Could not run %s: %s\n", argv[0],
+                    std::strerror(error));
+            if(size > 0)
+                (void)!::write(STDERR_FILENO, line,
+                        std::min<std::size_t>(size, sizeof(line) - 1));
+        }
+    }
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_SPAWNER_H
+#define LOGID_SPAWNER_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+// Largest command line, arguments included, the helper takes
+#define LOGID_SPAWNER_MESSAGE 4096
+#define LOGID_SPAWNER_ARGS 64
+
+extern "C"
+{
+#include <sys/types.h>
+}
+
+namespace logid
+{
+    /* Runs commands from a helper process forked while logid is still
+     * small, so that no thread of the daemon ever forks. Commands are
+     * sent over a socket and started with posix_spawn, with the
+     * environment logid was started with. Nothing waits for them.
+     */
+    class spawner
+    {
+    public:
+        // Must be called before the workqueue and devices are set up
+        static void start();
+        static bool running();
+
+        // Packs argv the way run() sends it, empty if it is too long
+        static std::string message(const std::vector<std::string>& argv);
+        // Never blocks, false if the helper could not be reached
+        static bool run(const std::string& message);
+    private:
+        [[noreturn]] static void _serve(int fd);
+
+        static std::atomic<int> _fd;
+        static pid_t _helper;
+    };
+}
+
+#endif //LOGID_SPAWNER_H
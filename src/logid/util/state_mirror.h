@@ -0,0 +1,123 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_STATE_MIRROR_H
+#define LOGID_STATE_MIRROR_H
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+
+namespace logid
+{
+    /* Local copy of state that lives on a device, e.g. a feature's mode.
+     * Our own writes keep it current so that read-modify-write actions
+     * only need the write. Anything that may have changed the device
+     * behind our back (a wakeup, a reset) must invalidate it.
+     *
+     * Values are fetched without holding the lock, a value written while
+     * a fetch was in flight wins over the fetched one.
+     */
+    template<typename value, typename key=uint8_t>
+    class state_mirror
+    {
+    public:
+        template<typename function>
+        value get(const key& k, function fetch)
+        {
+            uint64_t generation;
+            {
+                std::lock_guard<std::mutex> lock(_lock);
+                auto it = _values.find(k);
+                if(it != _values.end())
+                    return it->second;
+                generation = _generation;
+            }
+
+            value v = fetch();
+
+            std::lock_guard<std::mutex> lock(_lock);
+            if(_generation == generation)
+                _values[k] = v;
+            return v;
+        }
+
+        template<typename function>
+        value get(function fetch)
+        {
+            return get(key(), fetch);
+        }
+
+        // Never fetches, false if nothing is mirrored for k
+        bool peek(const key& k, value& v)
+        {
+            std::lock_guard<std::mutex> lock(_lock);
+            auto it = _values.find(k);
+            if(it == _values.end())
+                return false;
+            v = it->second;
+            return true;
+        }
+
+        bool peek(value& v)
+        {
+            return peek(key(), v);
+        }
+
+        void set(const key& k, const value& v)
+        {
+            std::lock_guard<std::mutex> lock(_lock);
+            _values[k] = v;
+            _generation++;
+        }
+
+        void set(const value& v)
+        {
+            set(key(), v);
+        }
+
+        // Applies f to the mirrored value if there is one
+        template<typename function>
+        void update(const key& k, function f)
+        {
+            std::lock_guard<std::mutex> lock(_lock);
+            auto it = _values.find(k);
+            if(it != _values.end())
+                f(it->second);
+            _generation++;
+        }
+
+        template<typename function>
+        void update(function f)
+        {
+            update(key(), f);
+        }
+
+        void invalidate()
+        {
+            std::lock_guard<std::mutex> lock(_lock);
+            _values.clear();
+            _generation++;
+        }
+    private:
+        std::mutex _lock;
+        std::map<key, value> _values;
+        uint64_t _generation = 0;
+    };
+}
+
+#endif //LOGID_STATE_MIRROR_H
@@ -0,0 +1,79 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "strand.h"
+
+using namespace logid;
+
+strand::strand(task::Priority priority) : _priority (priority),
+    _running (false)
+{
+}
+
+void strand::post(const std::function<void()>& function,
+        const std::function<void(std::exception&)>& exception_handler)
+{
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        _queue.emplace_back(function, exception_handler);
+        if(_running)
+            return;
+        _running = true;
+    }
+
+    _schedule();
+}
+
+std::size_t strand::pending()
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    return _queue.size();
+}
+
+void strand::_schedule()
+{
+    // The task keeps the strand alive until it is drained
+    auto self = shared_from_this();
+    task::spawn(_priority, [self]() { self->_run(); });
+}
+
+void strand::_run()
+{
+    for(int i = 0; i < LOGID_STRAND_BATCH; i++) {
+        std::pair<std::function<void()>,
+                std::function<void(std::exception&)>> next;
+        {
+            std::lock_guard<std::mutex> lock(_lock);
+            if(_queue.empty()) {
+                _running = false;
+                return;
+            }
+            next = std::move(_queue.front());
+            _queue.pop_front();
+        }
+
+        try {
+            next.first();
+        } catch(std::exception& e) {
+            next.second(e);
+        }
+    }
+
+    // Let other tasks have this worker, the strand stays marked running
+    _schedule();
+}
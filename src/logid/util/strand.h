@@ -0,0 +1,59 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_STRAND_H
+#define LOGID_STRAND_H
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include "task.h"
+
+// Functions run before the strand yields its worker
+#define LOGID_STRAND_BATCH 16
+
+namespace logid
+{
+    /* Runs posted functions in order, one at a time, on whichever worker
+     * is free. A strand only occupies a worker while it has work queued.
+     */
+    class strand : public std::enable_shared_from_this<strand>
+    {
+    public:
+        explicit strand(task::Priority priority=task::Normal);
+
+        void post(const std::function<void()>& function,
+                  const std::function<void(std::exception&)>&
+                  exception_handler={[](std::exception& e)
+                                     {ExceptionHandler::Default(e);}});
+
+        std::size_t pending();
+    private:
+        void _schedule();
+        void _run();
+
+        const task::Priority _priority;
+
+        std::mutex _lock;
+        std::deque<std::pair<std::function<void()>,
+                std::function<void(std::exception&)>>> _queue;
+        bool _running;
+    };
+}
+
+#endif //LOGID_STRAND_H
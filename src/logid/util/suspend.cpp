@@ -0,0 +1,141 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <cerrno>
+#include <cstring>
+#include "suspend.h"
+#include "thread.h"
+#include "log.h"
+
+extern "C"
+{
+#include <time.h>
+#ifdef LOGID_HAVE_SDBUS
+#include <systemd/sd-bus.h>
+#endif
+}
+
+using namespace logid;
+
+std::atomic<bool> suspend::_sleeping(false);
+std::atomic<int64_t> suspend::_resumed_at(0);
+std::atomic<int64_t> suspend::_suspended(suspend::_suspendedTime());
+
+namespace
+{
+    int64_t steadyNow()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    int64_t clockNs(clockid_t clock)
+    {
+        struct timespec ts{};
+        clock_gettime(clock, &ts);
+        return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+
+#ifdef LOGID_HAVE_SDBUS
+    const char* sleep_match = "type='signal',"
+                              "sender='org.freedesktop.login1',"
+                              "path='/org/freedesktop/login1',"
+                              "interface='org.freedesktop.login1.Manager',"
+                              "member='PrepareForSleep'";
+
+    int onPrepareForSleep(sd_bus_message* message, void*, sd_bus_error*)
+    {
+        int sleeping = 0;
+        if(sd_bus_message_read(message, "b", &sleeping) >= 0)
+            suspend::prepareForSleep(sleeping);
+        return 0;
+    }
+#endif
+}
+
+void suspend::listen()
+{
+#ifdef LOGID_HAVE_SDBUS
+    sd_bus* bus = nullptr;
+    int ret = sd_bus_open_system(&bus);
+    if(ret >= 0)
+        ret = sd_bus_add_match(bus, nullptr, sleep_match, onPrepareForSleep,
+                nullptr);
+    if(ret < 0) {
+        logPrintf(WARN, "Could not subscribe to logind, resumes are detected "
+                        "from the clock instead: %s", strerror(-ret));
+        sd_bus_unref(bus);
+        return;
+    }
+
+    thread::spawn([bus]() {
+        thread::setName("suspend");
+        while(true) {
+            int r = sd_bus_process(bus, nullptr);
+            if(r > 0)
+                continue;
+            if(r == 0)
+                r = sd_bus_wait(bus, UINT64_MAX);
+            if(r < 0 && r != -EINTR) {
+                logPrintf(WARN, "Lost the logind connection: %s",
+                        strerror(-r));
+                break;
+            }
+        }
+        sd_bus_unref(bus);
+    });
+#endif
+}
+
+bool suspend::resuming()
+{
+    if(_sleeping)
+        return true;
+
+    auto now = steadyNow();
+    auto suspended = _suspendedTime();
+    auto last = _suspended.load();
+    if(suspended - last > std::chrono::duration_cast<std::chrono::nanoseconds>(
+            LOGID_SUSPEND_THRESHOLD).count() &&
+       _suspended.compare_exchange_strong(last, suspended))
+        _resumed_at = now;
+
+    auto resumed_at = _resumed_at.load();
+    return resumed_at && now - resumed_at <
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+                LOGID_RESUME_WINDOW).count();
+}
+
+void suspend::prepareForSleep(bool sleeping)
+{
+    if(sleeping) {
+        logPrintf(INFO, "System is going to sleep.");
+        _sleeping = true;
+        return;
+    }
+
+    logPrintf(INFO, "System resumed.");
+    _suspended = _suspendedTime();
+    _resumed_at = steadyNow();
+    _sleeping = false;
+}
+
+int64_t suspend::_suspendedTime()
+{
+    return clockNs(CLOCK_BOOTTIME) - clockNs(CLOCK_MONOTONIC);
+}
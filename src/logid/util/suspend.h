@@ -0,0 +1,61 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_SUSPEND_H
+#define LOGID_SUSPEND_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// How long reconnecting devices are treated as part of a resume
+#define LOGID_RESUME_WINDOW std::chrono::seconds(10)
+// Smallest gap between CLOCK_BOOTTIME and CLOCK_MONOTONIC seen as a suspend
+#define LOGID_SUSPEND_THRESHOLD std::chrono::seconds(1)
+
+namespace logid
+{
+    /* Tracks system suspend so that devices reconnecting after a resume
+     * are woken up in order instead of all at once. With sd-bus, logind's
+     * PrepareForSleep signal tells when the system sleeps and resumes.
+     * Without it, a resume is noticed from CLOCK_BOOTTIME having run
+     * ahead of CLOCK_MONOTONIC, which stops while suspended.
+     */
+    class suspend
+    {
+    public:
+        // Subscribes to logind if available, call once on startup
+        static void listen();
+
+        // True while the system sleeps and for LOGID_RESUME_WINDOW after
+        static bool resuming();
+
+        // Called with the argument of logind's PrepareForSleep signal
+        static void prepareForSleep(bool sleeping);
+    private:
+        static int64_t _suspendedTime();
+
+        static std::atomic<bool> _sleeping;
+        // Steady clock time of the last resume in ns, 0 if none
+        static std::atomic<int64_t> _resumed_at;
+        // Time spent suspended as of the last check
+        static std::atomic<int64_t> _suspended;
+    };
+}
+
+#endif //LOGID_SUSPEND_H
@@ -16,20 +16,26 @@
  *
  */
 #include "task.h"
+#include "alloc.h"
 #include "workqueue.h"
 
 using namespace logid;
 
+namespace
+{
+    thread_local task::Priority current_priority = task::Normal;
+}
+
 task::task(const std::function<void()>& function,
-     const std::function<void(std::exception&)>& exception_handler) :
-     _function (std::make_shared<std::function<void()>>(function)),
-     _exception_handler (std::make_shared<std::function<void(std::exception&)>>
-             (exception_handler)), _status (Waiting),
+     const std::function<void(std::exception&)>& exception_handler,
+     Priority priority) :
+     _function (function), _exception_handler (exception_handler),
+     _priority (priority), _status (Waiting),
      _task_pkg ([this](){
          try {
-             (*_function)();
+             _function();
          } catch(std::exception& e) {
-             (*_exception_handler)(e);
+             _exception_handler(e);
          }
      }), _future (_task_pkg.get_future())
 {
@@ -49,8 +55,26 @@ task::Status task::getStatus()
     return _status;
 }
 
+task::Priority task::priority() const
+{
+    return _priority;
+}
+
+task::Priority task::current()
+{
+    return current_priority;
+}
+
+void task::setCurrent(Priority priority)
+{
+    current_priority = priority;
+}
+
 void task::wait()
 {
+    if(_status == Waiting && global_workqueue)
+        global_workqueue->blocking();
+
     if(_future.valid())
         _future.wait();
     else {
@@ -62,6 +86,9 @@ void task::wait()
 
 void task::waitStart()
 {
+    if(_status == Waiting && global_workqueue)
+        global_workqueue->blocking();
+
     std::mutex wait_start;
     std::unique_lock<std::mutex> lock(wait_start);
     _status_cv.wait(lock, [this](){ return _status != Waiting; });
@@ -72,9 +99,28 @@ std::future_status task::waitFor(std::chrono::milliseconds ms)
     return _future.wait_for(ms);
 }
 
-void task::spawn(const std::function<void ()>& function,
-        const std::function<void (std::exception &)>& exception_handler)
+void task::_spawn(job&& function, Priority priority)
+{
+    alloc::scope scope(alloc::Task);
+    global_workqueue->queue(std::move(function), priority);
+}
+
+std::shared_ptr<timer> task::spawnAfter(std::chrono::milliseconds delay,
+        const std::function<void()>& function,
+        const std::function<void(std::exception&)>& exception_handler,
+        Priority priority)
 {
-    auto t = std::make_shared<task>(function, exception_handler);
-    global_workqueue->queue(t);
-}
\ No newline at end of file
+    alloc::scope scope(alloc::Task);
+    return global_workqueue->schedule(delay, std::chrono::milliseconds(0),
+            function, exception_handler, priority);
+}
+
+std::shared_ptr<timer> task::spawnEvery(std::chrono::milliseconds period,
+        const std::function<void()>& function,
+        const std::function<void(std::exception&)>& exception_handler,
+        Priority priority)
+{
+    alloc::scope scope(alloc::Task);
+    return global_workqueue->schedule(period, period, function,
+            exception_handler, priority);
+}
@@ -22,9 +22,12 @@
 #include <memory>
 #include <future>
 #include "ExceptionHandler.h"
+#include "job.h"
 
 namespace logid
 {
+    class timer;
+
     class task
     {
     public:
@@ -35,30 +38,99 @@ namespace logid
             Completed
         };
 
+        /* Workers always run queued Interactive tasks first. Background
+         * tasks still get a share of the workers while Normal tasks are
+         * queued, see LOGID_WORKER_BACKGROUND_SHARE.
+         */
+        enum Priority
+        {
+            Interactive,
+            Normal,
+            Background,
+            PriorityCount
+        };
+
         explicit task(const std::function<void()>& function,
                         const std::function<void(std::exception&)>&
                         exception_handler={[](std::exception& e)
-                                           {ExceptionHandler::Default(e);}});
+                                           {ExceptionHandler::Default(e);}},
+                        Priority priority=Normal);
 
         Status getStatus();
+        Priority priority() const;
+
+        /* Priority of the task the calling thread runs, Normal outside of
+         * the workqueue unless set. Requests to devices go by it. */
+        static Priority current();
+        static void setCurrent(Priority priority);
 
         void run(); // Runs synchronously
         void wait();
         void waitStart();
         std::future_status waitFor(std::chrono::milliseconds ms);
 
-        /* This function spawns a new task into the least used worker queue
-         * and forgets about it.
+        /* Queues function on a worker and forgets about it. It is run as a
+         * job, so nothing is allocated for small functions and there's
+         * nothing to wait on. Use a task to wait for the result.
+         */
+        template<typename Function>
+        static void spawn(Function&& function)
+        {
+            spawn(Normal, std::forward<Function>(function));
+        }
+
+        template<typename Function, typename Handler>
+        static void spawn(Function&& function, Handler&& exception_handler)
+        {
+            spawn(Normal, std::forward<Function>(function),
+                    std::forward<Handler>(exception_handler));
+        }
+
+        template<typename Function>
+        static void spawn(Priority priority, Function&& function)
+        {
+            _spawn(job(std::forward<Function>(function)), priority);
+        }
+
+        template<typename Function, typename Handler>
+        static void spawn(Priority priority, Function&& function,
+                Handler&& exception_handler)
+        {
+            _spawn(job([function=std::forward<Function>(function),
+                    handler=std::forward<Handler>(exception_handler)]()
+                    mutable {
+                try {
+                    function();
+                } catch(std::exception& e) {
+                    handler(e);
+                }
+            }), priority);
+        }
+
+        /* Spawns a task once delay has passed, or every period until the
+         * returned timer is cancelled. Neither blocks a worker meanwhile.
          */
-        static void spawn(const std::function<void()>& function,
-                          const std::function<void(std::exception&)>&
-                          exception_handler={[](std::exception& e)
-                                             {ExceptionHandler::Default(e);}});
+        static std::shared_ptr<timer> spawnAfter(
+                std::chrono::milliseconds delay,
+                const std::function<void()>& function,
+                const std::function<void(std::exception&)>&
+                exception_handler={[](std::exception& e)
+                                   {ExceptionHandler::Default(e);}},
+                Priority priority=Normal);
+        static std::shared_ptr<timer> spawnEvery(
+                std::chrono::milliseconds period,
+                const std::function<void()>& function,
+                const std::function<void(std::exception&)>&
+                exception_handler={[](std::exception& e)
+                                   {ExceptionHandler::Default(e);}},
+                Priority priority=Normal);
 
     private:
-        std::shared_ptr<std::function<void()>> _function;
-        std::shared_ptr<std::function<void(std::exception&)>>
-                _exception_handler;
+        static void _spawn(job&& function, Priority priority);
+
+        std::function<void()> _function;
+        std::function<void(std::exception&)> _exception_handler;
+        const Priority _priority;
         std::atomic<Status> _status;
         std::condition_variable _status_cv;
         std::packaged_task<void()> _task_pkg;
@@ -15,51 +15,103 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  *
  */
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <system_error>
 #include "thread.h"
+#include "realtime.h"
+
+extern "C"
+{
+#include <sys/syscall.h>
+#include <unistd.h>
+}
 
 using namespace logid;
 
+namespace
+{
+    std::mutex names_lock;
+    std::map<pid_t, thread::info> named;
+}
+
 thread::thread(const std::function<void()>& function,
-        const std::function<void(std::exception&)>& exception_handler)
+        const std::function<void(std::exception&)>& exception_handler,
+        std::size_t stack_size)
         : _function (std::make_shared<std::function<void()>>(function)),
         _exception_handler (std::make_shared<std::function<void
-        (std::exception&)>> (exception_handler))
+        (std::exception&)>> (exception_handler)), _stack_size (stack_size)
 {
 }
 
 thread::~thread()
 {
-    if(_thread)
-        if(_thread->joinable())
-            _thread->detach();
+    if(_joinable)
+        pthread_detach(_native);
+}
+
+bool thread::_start(const std::function<void()>& function,
+        std::size_t stack_size, pthread_t& native)
+{
+    pthread_attr_t attr;
+    if(pthread_attr_init(&attr))
+        return false;
+    if(stack_size)
+        pthread_attr_setstacksize(&attr, stack_size);
+
+    auto start = new std::function<void()>(function);
+    int ret = pthread_create(&native, &attr, [](void* arg) -> void* {
+        std::unique_ptr<std::function<void()>> f(
+                static_cast<std::function<void()>*>(arg));
+        (*f)();
+        return nullptr;
+    }, start);
+    pthread_attr_destroy(&attr);
+    if(ret) {
+        delete start;
+        errno = ret;
+        return false;
+    }
+    return true;
 }
 
 void thread::spawn(const std::function<void()>& function,
-        const std::function<void(std::exception&)>& exception_handler)
+        const std::function<void(std::exception&)>& exception_handler,
+        std::size_t stack_size)
 {
-    std::thread([function, exception_handler](){
+    pthread_t native;
+    if(!_start([function, exception_handler](){
+        realtime::demote();
         thread t(function, exception_handler);
         t.runSync();
-    }).detach();
+    }, stack_size, native))
+        throw std::system_error(errno, std::generic_category(),
+                "pthread_create");
+    pthread_detach(native);
 }
 
 void thread::run()
 {
-    _thread = std::make_shared<std::thread>(
-            [f=this->_function,eh=this->_exception_handler]() {
+    if(!_start([f=this->_function,eh=this->_exception_handler]() {
+        realtime::demote();
         try {
             (*f)();
         } catch (std::exception& e) {
             (*eh)(e);
         }
-    });
+    }, _stack_size, _native))
+        throw std::system_error(errno, std::generic_category(),
+                "pthread_create");
+    _joinable = true;
 }
 
 void thread::wait()
 {
-    if(_thread)
-        if(_thread->joinable())
-            _thread->join();
+    if(_joinable) {
+        pthread_join(_native, nullptr);
+        _joinable = false;
+    }
 }
 
 void thread::runSync()
@@ -69,4 +121,28 @@ void thread::runSync()
     } catch(std::exception& e) {
         (*_exception_handler)(e);
     }
-}
\ No newline at end of file
+}
+
+void thread::setName(const std::string& name, const std::string& device)
+{
+    auto tid = static_cast<pid_t>(::syscall(SYS_gettid));
+    if(tid != ::getpid())
+        pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+
+    std::lock_guard<std::mutex> lock(names_lock);
+    named[tid] = {name, device};
+}
+
+std::map<pid_t, thread::info> thread::names()
+{
+    std::lock_guard<std::mutex> lock(names_lock);
+    // Thread IDs are reused, drop those that exited
+    for(auto it = named.begin(); it != named.end();) {
+        auto task = "/proc/self/task/" + std::to_string(it->first);
+        if(::access(task.c_str(), F_OK))
+            it = named.erase(it);
+        else
+            ++it;
+    }
+    return named;
+}
@@ -18,20 +18,30 @@
 #ifndef LOGID_THREAD_H
 #define LOGID_THREAD_H
 
+#include <cstddef>
 #include <functional>
+#include <map>
 #include <memory>
+#include <string>
 #include <thread>
+#include <pthread.h>
 #include "ExceptionHandler.h"
 
+// Stack of threads that only run tasks, well above what a task needs
+#define LOGID_TASK_STACK_SIZE (256 * 1024)
+
 namespace logid
 {
     class thread
     {
     public:
+        /* stack_size is in bytes, 0 keeps the system default (usually
+         * 8 MiB of address space). */
         explicit thread(const std::function<void()>& function,
                 const std::function<void(std::exception&)>&
                 exception_handler={[](std::exception& e)
-                                   {ExceptionHandler::Default(e);}});
+                                   {ExceptionHandler::Default(e);}},
+                std::size_t stack_size=0);
 
         ~thread();
 
@@ -41,16 +51,39 @@ namespace logid
         static void spawn(const std::function<void()>& function,
                 const std::function<void(std::exception&)>&
                 exception_handler={[](std::exception& e)
-                                   {ExceptionHandler::Default(e);}});
+                                   {ExceptionHandler::Default(e);}},
+                std::size_t stack_size=0);
 
         void run();
         void wait();
         void runSync();
+
+        struct info
+        {
+            std::string name;
+            std::string device;
+        };
+
+        /* Names the calling thread for top -H and the per thread metrics,
+         * the kernel only keeps the first 15 characters. device is the
+         * hidraw path the thread serves, if it serves a single one. The
+         * main thread keeps the process name so that ps and pkill still
+         * find logid. */
+        static void setName(const std::string& name,
+                const std::string& device=std::string());
+        // Named threads that are still alive, by kernel thread ID
+        static std::map<pid_t, info> names();
     private:
+        // Starts function on a new thread, false if it could not start
+        static bool _start(const std::function<void()>& function,
+                std::size_t stack_size, pthread_t& native);
+
         std::shared_ptr<std::function<void()>> _function;
         std::shared_ptr<std::function<void(std::exception&)>>
             _exception_handler;
-        std::shared_ptr<std::thread> _thread = nullptr;
+        std::size_t _stack_size;
+        pthread_t _native;
+        bool _joinable = false;
     };
 }
 
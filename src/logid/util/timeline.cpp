@@ -0,0 +1,176 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <cerrno>
+#include <system_error>
+#include "timeline.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+using namespace logid;
+
+std::atomic<bool> timeline::_enabled (false);
+std::mutex timeline::_lock;
+FILE* timeline::_file = nullptr;
+bool timeline::_first = true;
+
+namespace
+{
+    long threadId()
+    {
+        thread_local long tid = syscall(SYS_gettid);
+        return tid;
+    }
+
+    double microseconds(timeline::time_point time)
+    {
+        return std::chrono::duration<double, std::micro>(
+                time.time_since_epoch()).count();
+    }
+
+    void writeString(FILE* file, const std::string& string)
+    {
+        fputc('"', file);
+        for(auto c : string) {
+            if(c == '"' || c == '\\')
+                fputc('\\', file);
+            if((unsigned char)c < 0x20)
+                fprintf(file, "\\u%04x", c);
+            else
+                fputc(c, file);
+        }
+        fputc('"', file);
+    }
+}
+
+timeline::span::span(const char* category, const char* name,
+        const std::string& device, int index) : _category (category),
+        _name (name), _index (index), _active (enabled())
+{
+    if(_active) {
+        _device = device;
+        _begin = std::chrono::steady_clock::now();
+    }
+}
+
+timeline::span::~span()
+{
+    if(_active)
+        complete(_category, _name, _begin, std::chrono::steady_clock::now(),
+                _device, _index);
+}
+
+void timeline::start(const std::string& file)
+{
+    FILE* opened = fopen(file.c_str(), "w");
+    if(!opened)
+        throw std::system_error(errno, std::system_category(),
+                "timeline fopen failed");
+    _start(opened);
+}
+
+std::string timeline::startIn(const std::string& dir)
+{
+    auto now = std::chrono::system_clock::now().time_since_epoch();
+    auto stem = dir + "/trace-" + std::to_string(
+            std::chrono::duration_cast<std::chrono::seconds>(now).count());
+
+    if(-1 == ::mkdir(dir.c_str(), 0700) && errno != EEXIST)
+        throw std::system_error(errno, std::system_category(),
+                "timeline mkdir failed");
+
+    // Neither an existing file nor a symlink planted in dir is followed
+    int fd = -1;
+    std::string path;
+    for(int i = 0; fd == -1 && i < 16; i++) {
+        path = stem + (i ? "-" + std::to_string(i) : "") + ".json";
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW |
+                O_CLOEXEC, 0600);
+        if(fd == -1 && errno != EEXIST)
+            break;
+    }
+    if(fd == -1)
+        throw std::system_error(errno, std::system_category(),
+                "timeline open failed");
+
+    FILE* opened = fdopen(fd, "w");
+    if(!opened) {
+        int err = errno;
+        ::close(fd);
+        throw std::system_error(err, std::system_category(),
+                "timeline fdopen failed");
+    }
+    _start(opened);
+    return path;
+}
+
+void timeline::_start(FILE* opened)
+{
+    fputs("[", opened);
+    std::lock_guard<std::mutex> lock(_lock);
+    if(_file) {
+        fputs("\n]\n", _file);
+        fclose(_file);
+    }
+    _file = opened;
+    _first = true;
+    _enabled = true;
+}
+
+void timeline::stop()
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    _enabled = false;
+    if(!_file)
+        return;
+    fputs("\n]\n", _file);
+    fclose(_file);
+    _file = nullptr;
+}
+
+void timeline::complete(const char* category, const char* name,
+        time_point begin, time_point end, const std::string& device,
+        int index)
+{
+    if(!enabled())
+        return;
+
+    auto tid = threadId();
+    auto ts = microseconds(begin);
+    auto dur = end > begin ? microseconds(end) - ts : 0.0;
+
+    std::lock_guard<std::mutex> lock(_lock);
+    // stop() may have closed the file since enabled() was checked
+    if(!_file)
+        return;
+
+    fprintf(_file, "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+            "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%ld,\"args\":{",
+            _first ? "" : ",", name, category, ts, dur, (int)getpid(), tid);
+    _first = false;
+    if(!device.empty()) {
+        fputs("\"device\":", _file);
+        writeString(_file, device);
+    }
+    if(index >= 0)
+        fprintf(_file, "%s\"index\":%d", device.empty() ? "" : ",", index);
+    fputs("}}", _file);
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_TIMELINE_H
+#define LOGID_TIMELINE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <string>
+
+namespace logid
+{
+    /* Timeline of daemon activity in the Chrome trace event format, open
+     * it in ui.perfetto.dev or chrome://tracing. Each span is written as
+     * a complete event when it ends. The array is only closed by stop(),
+     * both viewers accept a file cut short by a crash.
+     *
+     * Unlike latency tracing this covers everything the daemon does, not
+     * just input. It is meant for finding where hotplug and resume storms
+     * serialize, and costs a relaxed load while no timeline is recorded.
+     */
+    class timeline
+    {
+    public:
+        typedef std::chrono::steady_clock::time_point time_point;
+
+        class span
+        {
+        public:
+            /* name and category must outlive the span, device is copied
+             * only while a timeline is being recorded. index is the device
+             * index, or the priority of workqueue spans. */
+            span(const char* category, const char* name,
+                    const std::string& device=std::string(), int index=-1);
+            ~span();
+
+            span(const span&) = delete;
+            span& operator=(const span&) = delete;
+        private:
+            const char* _category;
+            const char* _name;
+            std::string _device;
+            int _index;
+            bool _active;
+            time_point _begin;
+        };
+
+        // Throws std::system_error if file cannot be created
+        static void start(const std::string& file);
+        /* Records into a new file in dir, never one that already exists,
+         * and returns its path. Throws std::system_error on failure. */
+        static std::string startIn(const std::string& dir);
+        static void stop();
+
+        static bool enabled()
+        {
+            return _enabled.load(std::memory_order_relaxed);
+        }
+
+        static void complete(const char* category, const char* name,
+                time_point begin, time_point end,
+                const std::string& device=std::string(), int index=-1);
+    private:
+        static void _start(FILE* opened);
+
+        static std::atomic<bool> _enabled;
+        static std::mutex _lock;
+        static FILE* _file;
+        static bool _first;
+    };
+}
+
+#endif //LOGID_TIMELINE_H
@@ -0,0 +1,274 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <cassert>
+#include "timer_wheel.h"
+#include "workqueue.h"
+#include "log.h"
+
+using namespace logid;
+using namespace std::chrono;
+
+constexpr std::size_t timer_wheel::SlotBits;
+constexpr std::size_t timer_wheel::Slots;
+constexpr std::size_t timer_wheel::Levels;
+
+namespace
+{
+    // The timer whose function is running on this thread, if any
+    thread_local timer* current_timer = nullptr;
+
+    constexpr uint64_t levelRange(std::size_t level)
+    {
+        return uint64_t(1) << (timer_wheel::SlotBits * (level + 1));
+    }
+}
+
+timer::timer(const std::function<void()>& function,
+        const std::function<void(std::exception&)>& exception_handler,
+        task::Priority priority, uint64_t period) : _function (function),
+        _exception_handler (exception_handler), _priority (priority),
+        _expires (0), _period (period), _cancelled (false), _queued (false)
+{
+}
+
+void timer::cancel()
+{
+    _cancelled = true;
+    if(current_timer != this) {
+        // Waits for a run in progress
+        std::lock_guard<std::mutex> lock(_run_lock);
+    }
+}
+
+bool timer::cancelled() const
+{
+    return _cancelled;
+}
+
+void timer::_run()
+{
+    {
+        std::lock_guard<std::mutex> lock(_run_lock);
+        if(!_cancelled) {
+            auto previous = current_timer;
+            current_timer = this;
+            try {
+                _function();
+            } catch(std::exception& e) {
+                _exception_handler(e);
+            }
+            current_timer = previous;
+        }
+    }
+    _queued = false;
+}
+
+timer_wheel::timer_wheel(workqueue* queue) : _queue (queue),
+    _start (steady_clock::now()), _continue_run (true), _now (0), _count (0),
+    _alignment (0), _thread (std::make_unique<thread>([this](){ _run(); },
+            [this](std::exception& e){ _exception_handler(e); }))
+{
+    assert(_queue != nullptr);
+    _thread->run();
+}
+
+timer_wheel::~timer_wheel()
+{
+    stop();
+    _thread->wait();
+}
+
+std::shared_ptr<timer> timer_wheel::add(milliseconds delay,
+        milliseconds period, const std::function<void()>& function,
+        const std::function<void(std::exception&)>& exception_handler,
+        task::Priority priority)
+{
+    // Rounded up so that timers never fire early
+    auto due = steady_clock::now() + delay - _start;
+    auto expires = static_cast<uint64_t>(
+            (duration_cast<nanoseconds>(due).count() + 999999) / 1000000);
+
+    std::shared_ptr<timer> t(new timer(function, exception_handler, priority,
+            period.count() > 0 ? period.count() : 0));
+
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        // An idle wheel may be far behind, there is nothing to cascade
+        if(!_count)
+            _now = std::max(_now, _ticks(steady_clock::now()));
+        t->_expires = _align(std::max(expires, _now + 1), delay.count(),
+                priority);
+        _insert(t);
+        _count++;
+    }
+    _wake_cv.notify_one();
+
+    return t;
+}
+
+void timer_wheel::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        _continue_run = false;
+    }
+    _wake_cv.notify_all();
+}
+
+void timer_wheel::setAlignment(milliseconds tick)
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    _alignment = tick.count() > 0 ? tick.count() : 0;
+}
+
+std::size_t timer_wheel::size()
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    return _count;
+}
+
+void timer_wheel::_run()
+{
+    thread::setName("timers");
+    std::unique_lock<std::mutex> lock(_lock);
+    while(_continue_run) {
+        std::vector<std::shared_ptr<timer>> expired;
+        auto target = _ticks(steady_clock::now());
+        if(!_count)
+            _now = std::max(_now, target);
+        while(_now < target && _count) {
+            _now++;
+            _advance(expired);
+        }
+
+        if(!expired.empty()) {
+            lock.unlock();
+            for(auto& t : expired)
+                _fire(t);
+            lock.lock();
+            continue;
+        }
+
+        if(!_count)
+            _wake_cv.wait(lock);
+        else
+            _wake_cv.wait_until(lock, _start + milliseconds(_nextTick()));
+    }
+}
+
+void timer_wheel::_exception_handler(std::exception& e)
+{
+    logPrintf(WARN, "Exception caught on timer thread, restarting: %s",
+            e.what());
+    _thread = std::make_unique<thread>([this](){ _run(); },
+            [this](std::exception& e) { _exception_handler(e); });
+    _thread->run();
+}
+
+uint64_t timer_wheel::_align(uint64_t expires, uint64_t delay,
+        task::Priority priority) const
+{
+    // Shorter delays are short on purpose
+    if(!_alignment || priority != task::Background || delay < _alignment)
+        return expires;
+    // Relative to _start, which is the same for every timer
+    return (expires + _alignment - 1) / _alignment * _alignment;
+}
+
+void timer_wheel::_insert(const std::shared_ptr<timer>& t)
+{
+    auto expires = t->_expires;
+    // Only 0 while cascading into the slot that is processed next
+    auto delta = expires > _now ? expires - _now : 0;
+
+    std::size_t level = 0;
+    while(level < Levels - 1 && delta >= levelRange(level))
+        level++;
+    // Too far out, parked at the end of the last level and re-cascaded
+    if(delta >= levelRange(level))
+        expires = _now + levelRange(level) - 1;
+
+    auto slot = (expires >> (SlotBits * level)) & (Slots - 1);
+    _wheel[level][slot].push_back(t);
+}
+
+void timer_wheel::_advance(std::vector<std::shared_ptr<timer>>& expired)
+{
+    // Each level is cascaded once all the levels below wrapped
+    for(std::size_t level = 1; level < Levels; level++) {
+        if(_now & ((uint64_t(1) << (SlotBits * level)) - 1))
+            break;
+
+        auto slot = (_now >> (SlotBits * level)) & (Slots - 1);
+        auto timers = std::move(_wheel[level][slot]);
+        _wheel[level][slot].clear();
+        for(auto& t : timers)
+            _insert(t);
+    }
+
+    auto timers = std::move(_wheel[0][_now & (Slots - 1)]);
+    _wheel[0][_now & (Slots - 1)].clear();
+    for(auto& t : timers) {
+        if(t->_cancelled) {
+            _count--;
+            continue;
+        }
+
+        expired.push_back(t);
+        if(t->_period) {
+            t->_expires = _align(_now + t->_period, t->_period,
+                    t->_priority);
+            _insert(t);
+        } else {
+            _count--;
+        }
+    }
+}
+
+uint64_t timer_wheel::_nextTick() const
+{
+    // Level 0 slots are due, other levels are due once they cascade
+    uint64_t next = UINT64_MAX;
+    for(std::size_t level = 0; level < Levels; level++) {
+        auto shift = SlotBits * level;
+        auto base = _now >> shift;
+        for(uint64_t i = 1; i <= Slots; i++) {
+            if(!_wheel[level][(base + i) & (Slots - 1)].empty()) {
+                next = std::min(next, (base + i) << shift);
+                break;
+            }
+        }
+    }
+
+    return next;
+}
+
+void timer_wheel::_fire(const std::shared_ptr<timer>& t)
+{
+    if(t->_cancelled || t->_queued.exchange(true))
+        return;
+
+    _queue->queue(job([t](){ t->_run(); }), t->_priority);
+}
+
+uint64_t timer_wheel::_ticks(steady_clock::time_point time) const
+{
+    return duration_cast<milliseconds>(time - _start).count();
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_TIMER_WHEEL_H
+#define LOGID_TIMER_WHEEL_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include "task.h"
+#include "thread.h"
+
+namespace logid
+{
+    class workqueue;
+
+    /* A delayed or periodic function. It runs as a task on the workqueue
+     * once it is due, a periodic timer is skipped while its previous run
+     * is still queued or running.
+     */
+    class timer
+    {
+    public:
+        /* No run starts after this returns, a run in progress is waited
+         * for unless cancel() is called from it.
+         */
+        void cancel();
+        bool cancelled() const;
+    private:
+        friend class timer_wheel;
+
+        timer(const std::function<void()>& function,
+                const std::function<void(std::exception&)>& exception_handler,
+                task::Priority priority, uint64_t period);
+
+        void _run();
+
+        std::function<void()> _function;
+        std::function<void(std::exception&)> _exception_handler;
+        const task::Priority _priority;
+
+        // In ticks, only used by the wheel under its lock
+        uint64_t _expires;
+        const uint64_t _period;
+
+        std::atomic<bool> _cancelled;
+        std::atomic<bool> _queued;
+        std::mutex _run_lock;
+    };
+
+    /* Hierarchical timer wheel with a 1 ms tick. Level 0 holds timers due
+     * within 64 ticks, each further level covers 64 times the range of the
+     * one below and is cascaded down when the lower level wraps. Its
+     * thread only wakes up when a slot is due or needs to be cascaded.
+     */
+    class timer_wheel
+    {
+    public:
+        static constexpr std::size_t SlotBits = 6;
+        static constexpr std::size_t Slots = 1 << SlotBits;
+        static constexpr std::size_t Levels = 4;
+
+        explicit timer_wheel(workqueue* queue);
+        ~timer_wheel();
+
+        // A period of zero makes a one-shot timer
+        std::shared_ptr<timer> add(std::chrono::milliseconds delay,
+                std::chrono::milliseconds period,
+                const std::function<void()>& function,
+                const std::function<void(std::exception&)>& exception_handler,
+                task::Priority priority);
+
+        void stop();
+
+        /* Background timers at least tick apart are made due on multiples
+         * of tick, so that they wake the system together. 0 turns it off,
+         * timers already waiting keep their time until they are re-armed.
+         */
+        void setAlignment(std::chrono::milliseconds tick);
+
+        std::size_t size();
+    private:
+        void _run();
+        void _exception_handler(std::exception& e);
+
+        // _lock must be held for all of these
+        uint64_t _align(uint64_t expires, uint64_t delay,
+                task::Priority priority) const;
+        void _insert(const std::shared_ptr<timer>& t);
+        void _advance(std::vector<std::shared_ptr<timer>>& expired);
+        uint64_t _nextTick() const;
+
+        void _fire(const std::shared_ptr<timer>& t);
+
+        uint64_t _ticks(std::chrono::steady_clock::time_point time) const;
+
+        workqueue* _queue;
+        const std::chrono::steady_clock::time_point _start;
+
+        std::mutex _lock;
+        std::condition_variable _wake_cv;
+        bool _continue_run;
+        // The last tick that was processed
+        uint64_t _now;
+        std::size_t _count;
+        // In ticks, 0 if timers are not aligned
+        uint64_t _alignment;
+        std::array<std::array<std::vector<std::shared_ptr<timer>>, Slots>,
+                Levels> _wheel;
+
+        std::unique_ptr<thread> _thread;
+    };
+}
+
+#endif //LOGID_TIMER_WHEEL_H
@@ -0,0 +1,365 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+#include "uring.h"
+
+#ifdef LOGID_HAVE_IO_URING
+extern "C"
+{
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+}
+#endif
+
+// Reads take their buffers from this group
+#define LOGID_URING_BUFFER_GROUP 0
+
+using namespace logid;
+
+#ifdef LOGID_HAVE_IO_URING
+
+namespace
+{
+    int setup(unsigned entries, io_uring_params& params)
+    {
+        return (int)::syscall(__NR_io_uring_setup, entries, &params);
+    }
+
+    int enterRing(int fd, unsigned submit, unsigned wait, unsigned flags,
+            void* arg, std::size_t arg_size)
+    {
+        return (int)::syscall(__NR_io_uring_enter, fd, submit, wait, flags,
+                arg, arg_size);
+    }
+
+    int registerRing(int fd, unsigned opcode, void* arg, unsigned count)
+    {
+        return (int)::syscall(__NR_io_uring_register, fd, opcode, arg,
+                count);
+    }
+
+    void* map(std::size_t size, int fd, off_t offset)
+    {
+        void* ptr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, fd, offset);
+        return ptr == MAP_FAILED ? nullptr : ptr;
+    }
+}
+
+uring::uring(unsigned entries, unsigned buffers, std::size_t buffer_size) :
+    _sq_ring (nullptr), _sq_ring_size (0), _cq_ring (nullptr),
+    _cq_ring_size (0), _sqes (nullptr), _sqes_size (0), _queued (0),
+    _buffer_ring (nullptr), _buffer_ring_size (0), _buffers (nullptr),
+    _buffer_count (buffers), _buffer_size (buffer_size)
+{
+    // The buffer ring indexes by mask
+    if(!_buffer_count || (_buffer_count & (_buffer_count - 1)) ||
+       _buffer_count > 32768)
+        throw std::system_error(EINVAL, std::system_category(),
+                "uring buffer count must be a power of 2");
+
+    io_uring_params params{};
+    _fd = setup(entries, params);
+    if(_fd == -1)
+        throw std::system_error(errno, std::system_category(),
+                "io_uring_setup failed");
+
+    // Timed waits need EXT_ARG (5.11), it also implies everything older
+    if(!(params.features & IORING_FEAT_EXT_ARG) ||
+       !(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        ::close(_fd);
+        throw std::system_error(ENOTSUP, std::system_category(),
+                "io_uring lacks timed waits");
+    }
+
+    _sq_entries = params.sq_entries;
+    _cq_entries = params.cq_entries;
+    _sq_ring_size = std::max<std::size_t>(
+            params.sq_off.array + params.sq_entries * sizeof(unsigned),
+            params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+    _sq_ring = map(_sq_ring_size, _fd, IORING_OFF_SQ_RING);
+    // One mapping holds both rings
+    _cq_ring = _sq_ring;
+    _sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    if(_sq_ring)
+        _sqes = static_cast<io_uring_sqe*>(map(_sqes_size, _fd,
+                IORING_OFF_SQES));
+    if(!_sq_ring || !_sqes) {
+        int err = errno;
+        _release();
+        throw std::system_error(err, std::system_category(),
+                "io_uring mmap failed");
+    }
+
+    auto sq = static_cast<uint8_t*>(_sq_ring);
+    _sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    _sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    _sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    _sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    auto cq = static_cast<uint8_t*>(_cq_ring);
+    _cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    _cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    _cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    _cqes = cq + params.cq_off.cqes;
+
+    // The ring and its buffers, page aligned as the kernel wants
+    _buffer_ring_size = _buffer_count * sizeof(io_uring_buf) +
+            _buffer_count * _buffer_size;
+    void* memory = ::mmap(nullptr, _buffer_ring_size,
+            PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(memory == MAP_FAILED) {
+        int err = errno;
+        _release();
+        throw std::system_error(err, std::system_category(),
+                "io_uring buffer mmap failed");
+    }
+    _buffer_ring = static_cast<io_uring_buf_ring*>(memory);
+    _buffers = static_cast<uint8_t*>(memory) +
+            _buffer_count * sizeof(io_uring_buf);
+
+    io_uring_buf_reg reg{};
+    reg.ring_addr = reinterpret_cast<uint64_t>(_buffer_ring);
+    reg.ring_entries = _buffer_count;
+    reg.bgid = LOGID_URING_BUFFER_GROUP;
+    if(registerRing(_fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+        int err = errno;
+        _release();
+        throw std::system_error(err, std::system_category(),
+                "io_uring buffer ring registration failed");
+    }
+
+    for(unsigned i = 0; i < _buffer_count; i++) {
+        completion read{0, 0, IORING_CQE_F_BUFFER |
+                (i << IORING_CQE_BUFFER_SHIFT)};
+        recycle(read);
+    }
+}
+
+uring::~uring()
+{
+    _release();
+}
+
+void uring::_release()
+{
+    // Closing the ring drops the buffer ring registration with it
+    if(_fd != -1)
+        ::close(_fd);
+    _fd = -1;
+    if(_buffer_ring)
+        ::munmap(_buffer_ring, _buffer_ring_size);
+    if(_sqes)
+        ::munmap(_sqes, _sqes_size);
+    if(_sq_ring)
+        ::munmap(_sq_ring, _sq_ring_size);
+    _buffer_ring = nullptr;
+    _sqes = nullptr;
+    _sq_ring = nullptr;
+}
+
+io_uring_sqe& uring::_sqe(uint64_t user_data)
+{
+    unsigned tail = *_sq_tail + _queued;
+    if(tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE) >= _sq_entries) {
+        enter(0);
+        tail = *_sq_tail + _queued;
+    }
+
+    unsigned index = tail & _sq_mask;
+    auto& entry = _sqes[index];
+    std::memset(&entry, 0, sizeof(entry));
+    entry.user_data = user_data;
+    _sq_array[index] = index;
+    _queued++;
+    return entry;
+}
+
+void uring::read(int fd, uint64_t user_data)
+{
+    auto& entry = _sqe(user_data);
+    entry.opcode = IORING_OP_READ;
+    entry.fd = fd;
+    entry.len = _buffer_size;
+    // hidraw nodes have no position
+    entry.off = (uint64_t)-1;
+    entry.flags = IOSQE_BUFFER_SELECT;
+    entry.buf_group = LOGID_URING_BUFFER_GROUP;
+}
+
+void uring::read(int fd, void* data, std::size_t size, uint64_t user_data)
+{
+    auto& entry = _sqe(user_data);
+    entry.opcode = IORING_OP_READ;
+    entry.fd = fd;
+    entry.addr = reinterpret_cast<uint64_t>(data);
+    entry.len = size;
+    entry.off = (uint64_t)-1;
+}
+
+void uring::write(int fd, const void* data, std::size_t size,
+        uint64_t user_data)
+{
+    auto& entry = _sqe(user_data);
+    entry.opcode = IORING_OP_WRITE;
+    entry.fd = fd;
+    entry.addr = reinterpret_cast<uint64_t>(data);
+    entry.len = size;
+    entry.off = (uint64_t)-1;
+}
+
+void uring::cancel(uint64_t target, uint64_t user_data)
+{
+    auto& entry = _sqe(user_data);
+    entry.opcode = IORING_OP_ASYNC_CANCEL;
+    entry.addr = target;
+    entry.cancel_flags = IORING_ASYNC_CANCEL_ALL;
+}
+
+bool uring::enter(unsigned wait, const timespec* timeout)
+{
+    // Everything queued is submitted at once
+    __atomic_store_n(_sq_tail, *_sq_tail + _queued, __ATOMIC_RELEASE);
+    unsigned submit = _queued;
+    _queued = 0;
+
+    unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+    __kernel_timespec ts{};
+    io_uring_getevents_arg arg{};
+    if(timeout) {
+        ts.tv_sec = timeout->tv_sec;
+        ts.tv_nsec = timeout->tv_nsec;
+        arg.ts = reinterpret_cast<uint64_t>(&ts);
+        flags |= IORING_ENTER_EXT_ARG;
+    }
+
+    int ret;
+    do {
+        ret = enterRing(_fd, submit, wait, flags, timeout ? &arg : nullptr,
+                timeout ? sizeof(arg) : 0);
+        if(ret > 0)
+            submit -= std::min<unsigned>(ret, submit);
+    } while(ret == -1 && errno == EINTR && submit);
+
+    if(ret == -1 && errno != EINTR && errno != ETIME && errno != EBUSY &&
+       errno != EAGAIN)
+        throw std::system_error(errno, std::system_category(),
+                "io_uring_enter failed");
+
+    return !wait || __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE) != *_cq_head;
+}
+
+std::size_t uring::reap(completion* completions, std::size_t max)
+{
+    unsigned head = *_cq_head;
+    unsigned tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+    std::size_t count = 0;
+    auto cqes = static_cast<io_uring_cqe*>(_cqes);
+    for(; head != tail && count < max; head++, count++) {
+        auto& cqe = cqes[head & _cq_mask];
+        completions[count] = {cqe.user_data, cqe.res, cqe.flags};
+    }
+    __atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+    return count;
+}
+
+const uint8_t* uring::buffer(const completion& read) const
+{
+    if(!(read.flags & IORING_CQE_F_BUFFER))
+        return nullptr;
+    return _buffers + (read.flags >> IORING_CQE_BUFFER_SHIFT) * _buffer_size;
+}
+
+void uring::recycle(const completion& read)
+{
+    if(!(read.flags & IORING_CQE_F_BUFFER))
+        return;
+    uint16_t id = read.flags >> IORING_CQE_BUFFER_SHIFT;
+    uint16_t tail = _buffer_ring->tail;
+    /* The first entry shares its last field with the tail, leave it be.
+     * bufs is not used, in C++ it is placed after an empty struct. */
+    auto& entry = reinterpret_cast<io_uring_buf*>(_buffer_ring)[
+            tail & (_buffer_count - 1)];
+    entry.addr = reinterpret_cast<uint64_t>(_buffers + id * _buffer_size);
+    entry.len = _buffer_size;
+    entry.bid = id;
+    __atomic_store_n(&_buffer_ring->tail, (uint16_t)(tail + 1),
+            __ATOMIC_RELEASE);
+}
+
+#else
+
+uring::uring(unsigned, unsigned, std::size_t) : _fd (-1)
+{
+    throw std::system_error(ENOSYS, std::system_category(),
+            "built without io_uring");
+}
+
+uring::~uring() = default;
+
+void uring::_release()
+{
+}
+
+io_uring_sqe& uring::_sqe(uint64_t)
+{
+    throw std::system_error(ENOSYS, std::system_category(),
+            "built without io_uring");
+}
+
+void uring::read(int, uint64_t)
+{
+}
+
+void uring::read(int, void*, std::size_t, uint64_t)
+{
+}
+
+void uring::write(int, const void*, std::size_t, uint64_t)
+{
+}
+
+void uring::cancel(uint64_t, uint64_t)
+{
+}
+
+bool uring::enter(unsigned, const timespec*)
+{
+    return false;
+}
+
+std::size_t uring::reap(completion*, std::size_t)
+{
+    return 0;
+}
+
+const uint8_t* uring::buffer(const completion&) const
+{
+    return nullptr;
+}
+
+void uring::recycle(const completion&)
+{
+}
+
+#endif
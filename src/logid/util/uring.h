@@ -0,0 +1,109 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_URING_H
+#define LOGID_URING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+
+struct io_uring_sqe;
+struct io_uring_buf_ring;
+
+namespace logid
+{
+    /* A minimal io_uring, set up with raw system calls so that no library
+     * is needed. Reads may take their buffer from a ring of equally sized
+     * buffers registered with the kernel. Not thread-safe, a ring belongs
+     * to the thread that submits to it.
+     *
+     * Needs a 5.19 kernel for buffer rings, the constructor throws a
+     * std::system_error on older kernels or if io_uring is disabled.
+     */
+    class uring
+    {
+    public:
+        struct completion
+        {
+            uint64_t user_data;
+            int32_t result;
+            uint32_t flags;
+        };
+
+        uring(unsigned entries, unsigned buffers, std::size_t buffer_size);
+        ~uring();
+        uring(const uring&) = delete;
+        uring& operator=(const uring&) = delete;
+
+        // A read into a buffer of the ring, see buffer()
+        void read(int fd, uint64_t user_data);
+        void read(int fd, void* data, std::size_t size, uint64_t user_data);
+        void write(int fd, const void* data, std::size_t size,
+                uint64_t user_data);
+        // Cancels every request with target as its user_data
+        void cancel(uint64_t target, uint64_t user_data);
+
+        /* Submits what is queued and waits for wait completions, or until
+         * timeout if set. Returns false on a timeout. */
+        bool enter(unsigned wait, const timespec* timeout=nullptr);
+        /* Copies up to max completions, oldest first. The buffer of a
+         * read stays taken until it is recycled. */
+        std::size_t reap(completion* completions, std::size_t max);
+
+        // The buffer a completed read used, null if it used none
+        const uint8_t* buffer(const completion& read) const;
+        void recycle(const completion& read);
+    private:
+        /* Zeroed, with user_data set. Submits what is queued first if the
+         * queue is full. */
+        io_uring_sqe& _sqe(uint64_t user_data);
+
+        int _fd;
+        unsigned _sq_entries;
+        unsigned _cq_entries;
+
+        void* _sq_ring;
+        std::size_t _sq_ring_size;
+        void* _cq_ring;
+        std::size_t _cq_ring_size;
+        io_uring_sqe* _sqes;
+        std::size_t _sqes_size;
+
+        unsigned* _sq_head;
+        unsigned* _sq_tail;
+        unsigned _sq_mask;
+        unsigned* _sq_array;
+        unsigned* _cq_head;
+        unsigned* _cq_tail;
+        unsigned _cq_mask;
+        void* _cqes;
+        // Queued since the last submission
+        unsigned _queued;
+
+        io_uring_buf_ring* _buffer_ring;
+        std::size_t _buffer_ring_size;
+        uint8_t* _buffers;
+        unsigned _buffer_count;
+        std::size_t _buffer_size;
+
+        void _release();
+    };
+}
+
+#endif //LOGID_URING_H
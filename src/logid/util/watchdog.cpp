@@ -0,0 +1,145 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include "watchdog.h"
+#include "task.h"
+#include "workqueue.h"
+#include "log.h"
+
+using namespace logid;
+using namespace std::chrono;
+
+std::mutex watchdog::_lock;
+std::vector<std::weak_ptr<watchdog::dispatch>> watchdog::_watched;
+std::shared_ptr<timer> watchdog::_timer;
+std::atomic<bool> watchdog::_armed (false);
+milliseconds watchdog::_threshold = LOGID_DEFAULT_WATCHDOG_THRESHOLD;
+
+watchdog::dispatch::dispatch(StallHandler on_stall) :
+    _on_stall (std::move(on_stall)), _started (0), _reported (0),
+    _stalls (0), _last_stall (0)
+{
+}
+
+watchdog::dispatch::cycle::cycle(dispatch* dispatch,
+        steady_clock::time_point start) : _dispatch (dispatch),
+        _outer (dispatch &&
+                dispatch->_started.load(std::memory_order_relaxed) == 0)
+{
+    if(!_outer)
+        return;
+    _dispatch->_started.store(duration_cast<nanoseconds>(
+            start.time_since_epoch()).count(), std::memory_order_relaxed);
+
+    // Pairs with _check, which clears _armed before it looks at _started
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(!_armed.load(std::memory_order_relaxed))
+        watchdog::_arm();
+}
+
+watchdog::dispatch::cycle::~cycle()
+{
+    if(_outer)
+        _dispatch->_started.store(0, std::memory_order_relaxed);
+}
+
+uint64_t watchdog::dispatch::stalls() const
+{
+    return _stalls.load(std::memory_order_relaxed);
+}
+
+bool watchdog::dispatch::stalled() const
+{
+    auto last = _last_stall.load(std::memory_order_relaxed);
+    return last && steady_clock::now().time_since_epoch() -
+            nanoseconds(last) < LOGID_WATCHDOG_RECOVERY;
+}
+
+std::shared_ptr<watchdog::dispatch> watchdog::watch(StallHandler on_stall)
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    // Nothing could run the checks
+    if(_threshold.count() <= 0 || !global_workqueue)
+        return nullptr;
+
+    auto watched = std::make_shared<dispatch>(std::move(on_stall));
+    _watched.erase(std::remove_if(_watched.begin(), _watched.end(),
+            [](const std::weak_ptr<dispatch>& d) { return d.expired(); }),
+            _watched.end());
+    _watched.push_back(watched);
+    return watched;
+}
+
+void watchdog::_arm()
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    if(_armed.load(std::memory_order_relaxed) || _threshold.count() <= 0)
+        return;
+    _armed.store(true, std::memory_order_relaxed);
+    _timer = task::spawnAfter(LOGID_WATCHDOG_INTERVAL, _check,
+            [](std::exception& e) {
+        _armed = false;
+        logPrintf(WARN, "Watchdog check failed: %s", e.what());
+    }, task::Interactive);
+}
+
+void watchdog::configure(milliseconds threshold)
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    _threshold = threshold;
+}
+
+void watchdog::_check()
+{
+    // A cycle starting from here on arms the next check itself
+    _armed.store(false, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    std::vector<std::pair<std::shared_ptr<dispatch>, nanoseconds>> stalled;
+    bool running = false;
+    auto now = duration_cast<nanoseconds>(
+            steady_clock::now().time_since_epoch()).count();
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        auto threshold = duration_cast<nanoseconds>(_threshold).count();
+        for(auto& weak : _watched) {
+            auto watched = weak.lock();
+            if(!watched)
+                continue;
+            auto started = watched->_started.load(std::memory_order_relaxed);
+            running |= started != 0;
+            // Every cycle is reported once, however long it runs
+            if(started == 0 || started == watched->_reported ||
+               now - started < threshold)
+                continue;
+            watched->_reported = started;
+            watched->_stalls++;
+            watched->_last_stall.store(now, std::memory_order_relaxed);
+            stalled.emplace_back(std::move(watched),
+                    nanoseconds(now - started));
+        }
+    }
+
+    // Keeps checking while a cycle runs, however long
+    if(running)
+        _arm();
+
+    for(auto& stall : stalled)
+        stall.first->_on_stall(stall.second);
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_WATCHDOG_H
+#define LOGID_WATCHDOG_H
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Dispatch cycles that run longer are stalls
+#define LOGID_DEFAULT_WATCHDOG_THRESHOLD std::chrono::milliseconds(250)
+// How often running dispatch cycles are checked
+#define LOGID_WATCHDOG_INTERVAL std::chrono::milliseconds(100)
+// Dispatch that has not stalled for this long is healthy again
+#define LOGID_WATCHDOG_RECOVERY std::chrono::seconds(10)
+
+namespace logid
+{
+    class timer;
+
+    /* Notices dispatch cycles that run for too long, e.g. an event handler
+     * blocked on a lock held by a thread waiting for a response. Threads
+     * that dispatch reports timestamp each cycle, a check on a worker
+     * reports every cycle that passes the threshold, once. The check is
+     * only armed while a cycle runs, an idle daemon is never woken by it.
+     */
+    class watchdog
+    {
+    public:
+        typedef std::function<void(std::chrono::nanoseconds)> StallHandler;
+
+        class dispatch
+        {
+        public:
+            explicit dispatch(StallHandler on_stall);
+
+            /* Only one thread may run cycles, a cycle started within
+             * another is part of the outer one. */
+            class cycle
+            {
+            public:
+                // Does nothing if dispatch is null, so it can live on the stack
+                cycle(dispatch* dispatch,
+                        std::chrono::steady_clock::time_point start);
+                ~cycle();
+                cycle(const cycle&) = delete;
+                cycle& operator=(const cycle&) = delete;
+            private:
+                dispatch* _dispatch;
+                bool _outer;
+            };
+
+            uint64_t stalls() const;
+            // A cycle stalled within LOGID_WATCHDOG_RECOVERY
+            bool stalled() const;
+        private:
+            friend class watchdog;
+            StallHandler _on_stall;
+            // Nanoseconds since the steady clock's epoch, 0 while idle
+            std::atomic<int64_t> _started;
+            int64_t _reported;
+            std::atomic<uint64_t> _stalls;
+            // When the last stall was caught, 0 if never
+            std::atomic<int64_t> _last_stall;
+        };
+
+        /* Null if the watchdog is disabled. on_stall is run on a worker
+         * while the cycle is still running, with its duration so far. */
+        static std::shared_ptr<dispatch> watch(StallHandler on_stall);
+        // Cycles longer than threshold are stalls, 0 disables the watchdog
+        static void configure(std::chrono::milliseconds threshold);
+    private:
+        // Schedules a check unless one is pending
+        static void _arm();
+        static void _check();
+
+        static std::mutex _lock;
+        static std::vector<std::weak_ptr<dispatch>> _watched;
+        static std::shared_ptr<timer> _timer;
+        // A check is pending, cleared by the check before it looks
+        static std::atomic<bool> _armed;
+        static std::chrono::milliseconds _threshold;
+    };
+}
+
+#endif //LOGID_WATCHDOG_H
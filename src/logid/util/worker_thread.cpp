@@ -15,65 +15,153 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  *
  */
-#include <vector>
 #include "worker_thread.h"
 #include "log.h"
 #include "workqueue.h"
 
 using namespace logid;
 
+namespace
+{
+    thread_local worker_thread* current_worker = nullptr;
+}
+
 worker_thread::worker_thread(workqueue* parent, std::size_t worker_number) :
-_parent (parent), _worker_number (worker_number), _continue_run (false),
+_parent (parent), _worker_number (worker_number), _continue_run (true),
 _thread (std::make_unique<thread> ([this](){
-    _run(); }, [this](std::exception& e){ _exception_handler(e); }))
+    _run(); }, [this](std::exception& e){ _exception_handler(e); },
+    LOGID_TASK_STACK_SIZE)),
+_normal_streak (0), _inbox (LOGID_WORKER_INBOX_SIZE)
 {
-    _thread->run();
 }
 
 worker_thread::~worker_thread()
 {
     _continue_run = false;
-    _queue_cv.notify_all();
+    _parent->stop();
     // Block until task is complete
-    std::unique_lock<std::mutex> lock(_busy);
+    _thread->wait();
+
+    std::lock_guard<profiled_mutex> lock(_deque_lock);
+    _drainInbox();
+    for(auto& lane : _lanes) {
+        for(auto& j : lane) {
+            auto orphan = std::make_shared<job>(std::move(j.first));
+            thread::spawn([orphan](){ orphan->run(); },
+                    ExceptionHandler::Default, LOGID_TASK_STACK_SIZE);
+        }
+    }
+}
+
+worker_thread* worker_thread::current()
+{
+    return current_worker;
+}
 
-    while(!_queue.empty()) {
-        _parent->queue(_queue.front());
-        _queue.pop();
+void worker_thread::_push(job&& j, task::Priority priority,
+        time_point queued)
+{
+    if(current_worker != this) {
+        queued_job item{std::move(j), priority, queued};
+        if(_inbox.push(std::move(item)))
+            return;
+        j = std::move(item.j);
     }
+
+    // Our own tasks, or the inbox is full
+    std::lock_guard<profiled_mutex> lock(_deque_lock);
+    _drainInbox();
+    _lanes[priority].emplace_back(std::move(j), queued);
 }
 
-void worker_thread::queue(std::shared_ptr<task> t)
+void worker_thread::_drainInbox()
 {
-    _queue.push(t);
-    _queue_cv.notify_all();
+    _inbox.drain([this](queued_job&& item) {
+        _lanes[item.priority].emplace_back(std::move(item.j), item.queued);
+    });
 }
 
-bool worker_thread::busy()
+job worker_thread::_pop()
 {
-    bool not_busy = _busy.try_lock();
+    std::lock_guard<profiled_mutex> lock(_deque_lock);
+    _drainInbox();
 
-    if(not_busy)
-        _busy.unlock();
+    auto& normal = _lanes[task::Normal];
+    auto& background = _lanes[task::Background];
+    task::Priority lane;
+    if(!_lanes[task::Interactive].empty())
+        lane = task::Interactive;
+    else if(!normal.empty() && (background.empty() ||
+            _normal_streak < LOGID_WORKER_BACKGROUND_SHARE))
+        lane = task::Normal;
+    else if(!background.empty())
+        lane = task::Background;
+    else
+        return job();
 
-    return !not_busy;
+    if(lane == task::Normal && !background.empty())
+        _normal_streak++;
+    else if(lane != task::Interactive)
+        _normal_streak = 0;
+
+    auto j = std::move(_lanes[lane].back());
+    _lanes[lane].pop_back();
+    _parent->_taken(lane, j.second);
+    return std::move(j.first);
+}
+
+job worker_thread::_pop(task::Priority lane)
+{
+    std::lock_guard<profiled_mutex> lock(_deque_lock);
+    _drainInbox();
+    if(_lanes[lane].empty())
+        return job();
+
+    auto j = std::move(_lanes[lane].back());
+    _lanes[lane].pop_back();
+    _parent->_taken(lane, j.second);
+    return std::move(j.first);
+}
+
+job worker_thread::_steal(task::Priority lane)
+{
+    std::lock_guard<profiled_mutex> lock(_deque_lock);
+    _drainInbox();
+    if(_lanes[lane].empty())
+        return job();
+
+    auto j = std::move(_lanes[lane].front());
+    _lanes[lane].pop_front();
+    _parent->_taken(lane, j.second);
+    return std::move(j.first);
 }
 
 void worker_thread::_run()
 {
-    std::unique_lock<std::mutex> lock(_run_lock);
-    _continue_run = true;
+    current_worker = this;
+    thread::setName("worker" + std::to_string(_worker_number));
     while(_continue_run) {
-        _parent->busyUpdate();
-        _queue_cv.wait(lock, [this]{ return !_queue.empty() ||
-            !_continue_run; });
-        if(!_continue_run)
-            return;
-        std::unique_lock<std::mutex> busy_lock(_busy);
-        while(!_queue.empty()) {
-            _queue.front()->run();
-            _queue.pop();
+        // Interactive tasks queued anywhere go before any of our own
+        job j;
+        if(_parent->depth(task::Interactive)) {
+            j = _pop(task::Interactive);
+            if(!j)
+                j = _parent->_steal(_worker_number, task::Interactive);
+        }
+        if(!j)
+            j = _pop();
+        if(!j)
+            j = _parent->_steal(_worker_number);
+        if(j) {
+            // Another worker takes the backlog if this task waited long
+            _parent->_scale();
+            j.run();
+            continue;
         }
+
+        // Also returns false once this worker lingered idle long enough
+        if(!_parent->_waitForTask(_worker_number))
+            return;
     }
 }
 
@@ -83,6 +171,7 @@ void worker_thread::_exception_handler(std::exception &e)
             _worker_number, e.what());
     // This action destroys the logid::thread, std::thread should detach safely.
     _thread = std::make_unique<thread>([this](){ _run(); },
-            [this](std::exception& e) { _exception_handler(e); });
+            [this](std::exception& e) { _exception_handler(e); },
+            LOGID_TASK_STACK_SIZE);
     _thread->run();
-}
\ No newline at end of file
+}
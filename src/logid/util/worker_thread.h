@@ -18,9 +18,20 @@
 #ifndef LOGID_WORKER_THREAD_H
 #define LOGID_WORKER_THREAD_H
 
-#include "mutex_queue.h"
+#include <array>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <utility>
 #include "task.h"
 #include "thread.h"
+#include "mpsc_queue.h"
+#include "profiled_mutex.h"
+
+#define LOGID_WORKER_INBOX_SIZE 256
+// Background tasks run at least once per this many Normal tasks
+#define LOGID_WORKER_BACKGROUND_SHARE 8
 
 namespace logid
 {
@@ -32,24 +43,49 @@ namespace logid
         worker_thread(workqueue* parent, std::size_t worker_number);
         ~worker_thread();
 
-        void queue(std::shared_ptr<task> t);
-
-        bool busy();
+        // The worker running on this thread, if any
+        static worker_thread* current();
     private:
+        friend class workqueue;
+
+        // Left at epoch unless the workqueue autoscales
+        typedef std::chrono::steady_clock::time_point time_point;
+        struct queued_job
+        {
+            job j;
+            task::Priority priority;
+            time_point queued;
+        };
+
         void _run();
         void _exception_handler(std::exception& e);
 
+        /* The owner pushes and pops at the back, thieves take the front.
+         * _pop() picks the lane, _steal() only takes from the given one.
+         */
+        void _push(job&& j, task::Priority priority, time_point queued);
+        job _pop();
+        job _pop(task::Priority lane);
+        job _steal(task::Priority lane);
+        // Moves the inbox onto the deque, _deque_lock must be held
+        void _drainInbox();
+
         workqueue* _parent;
         std::size_t _worker_number;
 
-        std::mutex _run_lock;
         std::atomic<bool> _continue_run;
-        std::condition_variable _queue_cv;
 
         std::unique_ptr<thread> _thread;
-        std::mutex _busy;
 
-        mutex_queue<std::shared_ptr<task>> _queue;
+        profiled_mutex _deque_lock{"worker_thread::_deque_lock"};
+        std::array<std::deque<std::pair<job, time_point>>,
+                task::PriorityCount> _lanes;
+        // Normal tasks popped in a row while Background ones were waiting
+        std::size_t _normal_streak;
+
+        /* Other threads queue tasks here without taking _deque_lock. Its
+         * consumer is whoever holds _deque_lock and sorts it into lanes. */
+        mpsc_queue<queued_job> _inbox;
     };
 }
 
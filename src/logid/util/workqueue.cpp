@@ -15,117 +15,387 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  *
  */
+#include <algorithm>
 #include <cassert>
+#include <system_error>
 #include "workqueue.h"
 #include "log.h"
+#include "timeline.h"
 
 using namespace logid;
 
-workqueue::workqueue(std::size_t thread_count) : _manager_thread (
-        std::make_unique<thread>(
-                [this](){ _run(); }
-                , [this](std::exception& e){ _exception_handler(e); }
-        )), _continue_run (false), _worker_count (thread_count)
+std::shared_ptr<workqueue> logid::global_workqueue;
+
+namespace
 {
-    _workers.reserve(_worker_count);
-    for(std::size_t i = 0; i < _worker_count; i++)
+    // Set on threads started by workqueue::blocking()
+    thread_local bool helper_thread = false;
+
+    workqueue::scaling fixed(std::size_t thread_count)
+    {
+        workqueue::scaling settings;
+        settings.min = thread_count;
+        settings.max = thread_count;
+        return settings;
+    }
+
+    workqueue::scaling checked(workqueue::scaling settings)
+    {
+        // Without workers every task would get a thread of its own
+        if(!settings.min) {
+            logPrintf(WARN, "At least one worker is needed, starting one.");
+            settings.min = 1;
+        }
+        settings.max = std::max(settings.max, settings.min);
+        return settings;
+    }
+}
+
+workqueue::workqueue(std::size_t thread_count) :
+    workqueue(fixed(thread_count))
+{
+}
+
+workqueue::workqueue(const scaling& settings) : _continue_run (true),
+    _pending (0), _idle (0), _next_worker (0), _helpers (0),
+    _fallback_threads (0), _helpers_refused (0), _full_waiters (0),
+    _throttled (0), _overflows (0), _scaling (checked(settings)),
+    _active (_scaling.min), _wants_worker (false), _workers_started (0),
+    _workers_retired (0)
+{
+    for(auto& depth : _depth)
+        depth = 0;
+
+    _workers.reserve(_scaling.max);
+    for(std::size_t i = 0; i < _scaling.max; i++)
         _workers.push_back(std::make_unique<worker_thread>(this, i));
-    _manager_thread->run();
+
+    // Workers steal from each other, only start once all of them exist
+    for(std::size_t i = 0; i < _scaling.min; i++)
+        _workers[i]->_thread->run();
+
+    _timers = std::make_unique<timer_wheel>(this);
 }
 
 workqueue::~workqueue()
 {
     stop();
+    // Nothing may be queued by timers from here on
+    _timers.reset();
+    // A worker being started is running once this is taken, no more start
+    { std::lock_guard<std::mutex> lock(_grow_lock); }
 
-    while(_workers.empty())
-        _workers.pop_back();
+    // Workers and helpers may still be stealing, let them finish first
+    for(auto& worker : _workers)
+        worker->_thread->wait();
+    {
+        std::unique_lock<std::mutex> lock(_wake_lock);
+        _wake_cv.wait(lock, [this]{ return _helpers == 0; });
+    }
 
-    // Queue should have been empty before, but just confirm here.
-    while(!_queue.empty()) {
-        thread::spawn([t=_queue.front()](){ t->run(); });
-        _queue.pop();
+    // Queues should have been empty before, but just confirm here.
+    job j;
+    while((j = _steal(0))) {
+        auto orphan = std::make_shared<job>(std::move(j));
+        thread::spawn([orphan](){ orphan->run(); });
     }
+
+    while(!_workers.empty())
+        _workers.pop_back();
 }
 
 void workqueue::queue(std::shared_ptr<task> t)
 {
     assert(t != nullptr);
-    _queue.push(t);
-    _queue_cv.notify_all();
+    auto priority = t->priority();
+    queue(job([t](){ t->run(); }), priority);
+}
+
+void workqueue::queue(job&& j, task::Priority priority)
+{
+    assert(j);
+
+    if(timeline::enabled()) {
+        j = job([inner=std::move(j), priority,
+                queued=std::chrono::steady_clock::now()]() mutable {
+            timeline::complete("workqueue", "wait", queued,
+                    std::chrono::steady_clock::now(), std::string(), priority);
+            timeline::span span("workqueue", "run", std::string(), priority);
+            inner.run();
+        });
+    }
+
+    // Only while shutting down
+    if(_workers.empty()) {
+        LOGID_LOG(DEBUG, "No workers were found, running task in"
+                         " a new thread.");
+        _fallback_threads++;
+        auto orphan = std::make_shared<job>(std::move(j));
+        thread::spawn([orphan](){ orphan->run(); },
+                ExceptionHandler::Default, LOGID_TASK_STACK_SIZE);
+        return;
+    }
+
+    // Tasks queued by a worker stay on that worker
+    auto worker = worker_thread::current();
+    if(!worker || worker->_parent != this) {
+        if(_pending >= LOGID_WORKQUEUE_MAX_PENDING && !helper_thread)
+            _waitForRoom();
+        worker = _workers[_next_worker++ % _active].get();
+    }
+    // Only autoscaling looks at how long tasks wait
+    auto queued = _scaling.max > _scaling.min ?
+            std::chrono::steady_clock::now() :
+            std::chrono::steady_clock::time_point();
+    worker->_push(std::move(j), priority, queued);
+
+    /* Waiters count themselves idle under _wake_lock before checking
+     * _pending, so the lock is only needed when someone is waiting. */
+    _depth[priority]++;
+    _pending++;
+    if(_idle > 0) {
+        { std::lock_guard<std::mutex> lock(_wake_lock); }
+        _wake_cv.notify_one();
+    }
 }
 
-void workqueue::busyUpdate()
+std::shared_ptr<timer> workqueue::schedule(std::chrono::milliseconds delay,
+        std::chrono::milliseconds period, const std::function<void()>& function,
+        const std::function<void(std::exception&)>& exception_handler,
+        task::Priority priority)
 {
-    _busy_cv.notify_all();
+    return _timers->add(delay, period, function, exception_handler,
+            priority);
+}
+
+void workqueue::alignTimers(std::chrono::milliseconds tick)
+{
+    _timers->setAlignment(tick);
+}
+
+void workqueue::blocking()
+{
+    auto worker = worker_thread::current();
+    if((!worker || worker->_parent != this) && !helper_thread)
+        return;
+
+    if(_idle > 0 || _pending <= 0)
+        return;
+
+    // A new worker does what a helper would, and stays for the next ones
+    if(_grow(true))
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(_wake_lock);
+        if(_helpers >= LOGID_WORKQUEUE_MAX_HELPERS) {
+            _helpers_refused++;
+            return;
+        }
+        _helpers++;
+    }
+    LOGID_LOG(DEBUG, "All workers were busy, running queued tasks in a new "
+                     "thread.");
+    _fallback_threads++;
+    try {
+        thread::spawn([this]() {
+            helper_thread = true;
+            thread::setName("helper");
+            job j;
+            while(_continue_run && (j = _steal(0)))
+                j.run();
+
+            std::lock_guard<std::mutex> lock(_wake_lock);
+            _helpers--;
+            _wake_cv.notify_all();
+        }, ExceptionHandler::Default, LOGID_TASK_STACK_SIZE);
+    } catch(std::system_error& e) {
+        logPrintf(WARN, "Could not start a helper thread: %s", e.what());
+        std::lock_guard<std::mutex> lock(_wake_lock);
+        _helpers--;
+        _wake_cv.notify_all();
+    }
 }
 
 void workqueue::stop()
 {
-    _continue_run = false;
-    std::unique_lock<std::mutex> lock(_run_lock);
+    {
+        std::lock_guard<std::mutex> lock(_wake_lock);
+        _continue_run = false;
+    }
+    _wake_cv.notify_all();
+    _room_cv.notify_all();
 }
 
 std::size_t workqueue::threadCount() const
 {
-    return _workers.size();
-}
-
-void workqueue::_run()
-{
-    using namespace std::chrono_literals;
-
-    std::unique_lock<std::mutex> lock(_run_lock);
-    _continue_run = true;
-    while(_continue_run) {
-        _queue_cv.wait(lock, [this]{ return !(_queue.empty()); });
-        while(!_queue.empty()) {
-            if(_workers.empty()) {
-                if(_worker_count)
-                    logPrintf(DEBUG, "No workers were found, running task in"
-                                 " a new thread.");
-                thread::spawn([t=_queue.front()](){ t->run(); });
-                _queue.pop();
-                continue;
-            }
-
-            auto worker = _workers.begin();
-            for(; worker != _workers.end(); worker++) {
-                if(!(*worker)->busy())
-                    break;
-            }
-            if(worker != _workers.end())
-                (*worker)->queue(_queue.front());
-            else {
-                _busy_cv.wait_for(lock, 500ms, [this, &worker]{
-                    for(worker = _workers.begin(); worker != _workers.end();
-                        worker++) {
-                        if (!(*worker)->busy()) {
-                            return true;
-                        }
-                    }
-                    return false;
-                });
-
-                if(worker != _workers.end())
-                    (*worker)->queue(_queue.front());
-                else{
-                    // Workers busy, launch in new thread
-                    logPrintf(DEBUG, "All workers were busy for 500ms, "
-                                     "running task in new thread.");
-                    thread::spawn([t = _queue.front()]() { t->run(); });
-                }
-            }
-            _queue.pop();
+    return _active;
+}
+
+std::size_t workqueue::depth(task::Priority priority) const
+{
+    // Briefly negative while a task is taken before it is counted
+    long depth = _depth[priority];
+    return depth > 0 ? depth : 0;
+}
+
+std::size_t workqueue::busyWorkers() const
+{
+    std::size_t idle = _idle, active = _active;
+    return idle < active ? active - idle : 0;
+}
+
+uint64_t workqueue::fallbackThreads() const
+{
+    return _fallback_threads;
+}
+
+uint64_t workqueue::helpersRefused() const
+{
+    return _helpers_refused;
+}
+
+uint64_t workqueue::throttled() const
+{
+    return _throttled;
+}
+
+uint64_t workqueue::overflows() const
+{
+    return _overflows;
+}
+
+uint64_t workqueue::workersStarted() const
+{
+    return _workers_started;
+}
+
+uint64_t workqueue::workersRetired() const
+{
+    return _workers_retired;
+}
+
+job workqueue::_steal(std::size_t thief)
+{
+    for(int lane = 0; lane < task::PriorityCount; lane++) {
+        auto j = _steal(thief, static_cast<task::Priority>(lane));
+        if(j)
+            return j;
+    }
+
+    return job();
+}
+
+job workqueue::_steal(std::size_t thief, task::Priority lane)
+{
+    for(std::size_t i = 1; i <= _workers.size(); i++) {
+        auto j = _workers[(thief + i) % _workers.size()]->_steal(lane);
+        if(j)
+            return j;
+    }
+
+    return job();
+}
+
+void workqueue::_taken(task::Priority lane,
+        std::chrono::steady_clock::time_point queued)
+{
+    // The thread that took the job runs it next
+    task::setCurrent(lane);
+    _depth[lane]--;
+    _pending--;
+    // Same as _idle, waiters count themselves before checking _pending
+    if(_full_waiters > 0 && _pending < LOGID_WORKQUEUE_MAX_PENDING) {
+        { std::lock_guard<std::mutex> lock(_wake_lock); }
+        _room_cv.notify_all();
+    }
+
+    /* Called with a deque locked, the worker is started by _scale()
+     * before the task runs. Only a backlog that is left needs one. */
+    if(_active < _scaling.max && _pending > 0 &&
+       std::chrono::steady_clock::now() - queued > _scaling.wait)
+        _wants_worker.store(true, std::memory_order_relaxed);
+}
+
+void workqueue::_scale()
+{
+    if(_wants_worker.load(std::memory_order_relaxed) &&
+       _wants_worker.exchange(false))
+        _grow(false);
+}
+
+bool workqueue::_grow(bool at_once)
+{
+    std::lock_guard<std::mutex> grow_lock(_grow_lock);
+    std::size_t index;
+    {
+        std::lock_guard<std::mutex> lock(_wake_lock);
+        auto now = std::chrono::steady_clock::now();
+        if(!_continue_run || _active >= _scaling.max ||
+           (!at_once && now - _last_grow < _scaling.wait))
+            return false;
+        _last_grow = now;
+        // Counted first so that the worker below cannot retire meanwhile
+        index = _active++;
+    }
+
+    // The worker that ran here before has retired, but may not have exited
+    auto& worker = _workers[index];
+    worker->_thread->wait();
+    try {
+        worker->_thread->run();
+    } catch(std::system_error& e) {
+        logPrintf(WARN, "Could not start a worker: %s", e.what());
+        std::lock_guard<std::mutex> lock(_wake_lock);
+        _active--;
+        return false;
+    }
+    _workers_started++;
+    LOGID_LOG(DEBUG, "Tasks waited too long, started worker %zu.", index);
+    return true;
+}
+
+bool workqueue::_waitForTask(std::size_t worker)
+{
+    std::unique_lock<std::mutex> lock(_wake_lock);
+    _idle++;
+    auto deadline = std::chrono::steady_clock::now() + _scaling.linger;
+    bool retire = false;
+    while(_pending <= 0 && _continue_run) {
+        // Only the last running worker retires, see _active
+        bool lingered = std::chrono::steady_clock::now() >= deadline;
+        if(lingered && worker >= _scaling.min && worker + 1 == _active) {
+            retire = true;
+            break;
         }
+        if(worker < _scaling.min || lingered)
+            _wake_cv.wait(lock);
+        else
+            _wake_cv.wait_until(lock, deadline);
+    }
+    _idle--;
+
+    if(retire) {
+        _active--;
+        _workers_retired++;
+        // The worker below may have lingered long enough as well
+        _wake_cv.notify_all();
+        return false;
     }
+    return _continue_run;
 }
 
-void workqueue::_exception_handler(std::exception &e)
+void workqueue::_waitForRoom()
 {
-    logPrintf(WARN, "Exception caught on workqueue manager thread, "
-                    "restarting: %s" , e.what());
-    // This action destroys the logid::thread, std::thread should detach safely.
-    _manager_thread = std::make_unique<thread>([this](){ _run(); },
-            [this](std::exception& e) { _exception_handler(e); });
-    _manager_thread->run();
-}
\ No newline at end of file
+    _throttled++;
+    std::unique_lock<std::mutex> lock(_wake_lock);
+    _full_waiters++;
+    bool room = _room_cv.wait_for(lock, LOGID_WORKQUEUE_FULL_WAIT, [this]{
+        return _pending < LOGID_WORKQUEUE_MAX_PENDING || !_continue_run;
+    });
+    _full_waiters--;
+
+    // Tasks are never dropped, a producer that waited queues anyway
+    if(!room)
+        _overflows++;
+}
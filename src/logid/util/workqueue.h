@@ -18,38 +18,145 @@
 #ifndef LOGID_WORKQUEUE_H
 #define LOGID_WORKQUEUE_H
 
+#include <array>
+#include <vector>
+#include <condition_variable>
 #include "worker_thread.h"
+#include "timer_wheel.h"
 #include "thread.h"
 
+// Threads blocking() may start on top of the workers
+#define LOGID_WORKQUEUE_MAX_HELPERS 4
+// Queued tasks above which producers outside the workqueue are held back
+#define LOGID_WORKQUEUE_MAX_PENDING 4096
+// Longest a producer is held back before its task is queued anyway
+#define LOGID_WORKQUEUE_FULL_WAIT std::chrono::milliseconds(100)
+// Queue wait after which an autoscaled pool starts another worker
+#define LOGID_WORKQUEUE_SCALE_WAIT std::chrono::milliseconds(5)
+// Idle time after which a worker above the minimum exits
+#define LOGID_WORKQUEUE_LINGER std::chrono::seconds(30)
+
 namespace logid
 {
+    /* Tasks are queued straight onto a worker's deque, one per priority.
+     * Workers run their own tasks newest first and steal the oldest tasks
+     * of other workers when they run out. Interactive tasks queued on any
+     * worker are run before everything else.
+     *
+     * Between min and max workers run. Another is started when a task
+     * waited in the queue longer than scaling::wait, at most once per
+     * wait, or at once when a worker is about to block and none is idle.
+     * The last worker above min exits once it has been idle for
+     * scaling::linger, so the running ones are always the first.
+     *
+     * There are never more than max workers and
+     * LOGID_WORKQUEUE_MAX_HELPERS helpers. Once the queues are full,
+     * threads other than workers wait for room before queueing, so that
+     * readers fall behind the kernel instead of growing the queues.
+     * Workers are never held back since they are the ones making room.
+     */
     class workqueue
     {
     public:
+        struct scaling
+        {
+            std::size_t min = 1;
+            std::size_t max = 1;
+            std::chrono::milliseconds wait = LOGID_WORKQUEUE_SCALE_WAIT;
+            std::chrono::milliseconds linger = LOGID_WORKQUEUE_LINGER;
+        };
+
+        // A fixed pool of thread_count workers
         explicit workqueue(std::size_t thread_count);
+        explicit workqueue(const scaling& settings);
         ~workqueue();
 
         void queue(std::shared_ptr<task> t);
+        void queue(job&& j, task::Priority priority);
+
+        // Queues function after delay, and then every period if non-zero
+        std::shared_ptr<timer> schedule(std::chrono::milliseconds delay,
+                std::chrono::milliseconds period,
+                const std::function<void()>& function,
+                const std::function<void(std::exception&)>& exception_handler,
+                task::Priority priority);
+
+        // See timer_wheel::setAlignment
+        void alignTimers(std::chrono::milliseconds tick);
 
-        void busyUpdate();
+        /* Called on a worker that is about to block on another task. If no
+         * worker is idle, another worker is started if below max, and
+         * otherwise queued tasks are run on a new thread so that they
+         * cannot deadlock behind blocked workers. Nothing is started while
+         * LOGID_WORKQUEUE_MAX_HELPERS helpers run, the existing ones keep
+         * running queued tasks until there are none.
+         */
+        void blocking();
 
         void stop();
 
+        // Workers running now
         std::size_t threadCount() const;
+
+        // Number of queued tasks with the given priority
+        std::size_t depth(task::Priority priority) const;
+        // Workers that are not waiting for a task
+        std::size_t busyWorkers() const;
+        // Threads started because no worker could take a task
+        uint64_t fallbackThreads() const;
+        // Helpers not started because LOGID_WORKQUEUE_MAX_HELPERS run
+        uint64_t helpersRefused() const;
+        // Tasks whose producer waited for room, and gave up waiting
+        uint64_t throttled() const;
+        uint64_t overflows() const;
+        // Workers started above min, and those that exited again
+        uint64_t workersStarted() const;
+        uint64_t workersRetired() const;
     private:
-        void _run();
+        friend class worker_thread;
 
-        void _exception_handler(std::exception& e);
-        std::unique_ptr<thread> _manager_thread;
+        // Steals the highest priority task from any other worker
+        job _steal(std::size_t thief);
+        job _steal(std::size_t thief, task::Priority lane);
+        void _taken(task::Priority lane,
+                std::chrono::steady_clock::time_point queued);
+        // Starts a worker if _taken() found tasks waiting too long
+        void _scale();
+        /* Starts the next worker if below max, unless one was started
+         * within scaling::wait and at_once is false. */
+        bool _grow(bool at_once);
+        // False if the worker should exit
+        bool _waitForTask(std::size_t worker);
+        void _waitForRoom();
 
-        mutex_queue<std::shared_ptr<task>> _queue;
-        std::condition_variable _queue_cv;
-        std::condition_variable _busy_cv;
-        std::mutex _run_lock;
         std::atomic<bool> _continue_run;
+        std::mutex _wake_lock;
+        std::condition_variable _wake_cv;
+        std::atomic<long> _pending;
+        std::array<std::atomic<long>, task::PriorityCount> _depth;
+        std::atomic<std::size_t> _idle;
+        std::atomic<std::size_t> _next_worker;
+        std::size_t _helpers;
+        std::atomic<uint64_t> _fallback_threads;
+        std::atomic<uint64_t> _helpers_refused;
+
+        std::condition_variable _room_cv;
+        std::atomic<std::size_t> _full_waiters;
+        std::atomic<uint64_t> _throttled;
+        std::atomic<uint64_t> _overflows;
 
+        // All max workers exist, the first _active run
         std::vector<std::unique_ptr<worker_thread>> _workers;
-        std::size_t _worker_count;
+        const scaling _scaling;
+        std::atomic<std::size_t> _active;
+        std::atomic<bool> _wants_worker;
+        // Serializes starting workers, and stopping them in ~workqueue()
+        std::mutex _grow_lock;
+        std::chrono::steady_clock::time_point _last_grow;
+        std::atomic<uint64_t> _workers_started;
+        std::atomic<uint64_t> _workers_retired;
+
+        std::unique_ptr<timer_wheel> _timers;
     };
 
     extern std::shared_ptr<workqueue> global_workqueue;
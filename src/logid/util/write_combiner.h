@@ -0,0 +1,105 @@
+/*
+ * Copyright 2019-2020 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_WRITE_COMBINER_H
+#define LOGID_WRITE_COMBINER_H
+
+#include <cstdint>
+#include <exception>
+#include <map>
+#include <mutex>
+
+namespace logid
+{
+    /* Last-writer-wins writes of a setting that lives on a device, e.g.
+     * a sensor's DPI. At most one write per key is on the wire and one
+     * value is pending: a newer value replaces the pending one. The
+     * caller that found the key idle writes until nothing is pending,
+     * any other caller returns at once.
+     *
+     * The writing caller gets the first error of its writes once it is
+     * done, a value that was superseded or written for someone else
+     * never reports one.
+     */
+    template<typename value, typename key=uint8_t>
+    class write_combiner
+    {
+    public:
+        template<typename function>
+        void set(const key& k, const value& v, function write)
+        {
+            set(k, v, write, [](value& pending, const value& newer) {
+                pending = newer;
+            });
+        }
+
+        // merge folds a newer value into the pending one
+        template<typename function, typename merger>
+        void set(const key& k, const value& v, function write, merger merge)
+        {
+            {
+                std::lock_guard<std::mutex> lock(_lock);
+                auto& slot = _slots[k];
+                if(slot.writing) {
+                    if(slot.pending)
+                        merge(slot.latest, v);
+                    else
+                        slot.latest = v;
+                    slot.pending = true;
+                    return;
+                }
+                slot.writing = true;
+            }
+
+            value next = v;
+            std::exception_ptr error;
+            while(true) {
+                try {
+                    write(next);
+                } catch(...) {
+                    if(!error)
+                        error = std::current_exception();
+                }
+
+                std::lock_guard<std::mutex> lock(_lock);
+                auto& slot = _slots[k];
+                if(!slot.pending) {
+                    slot.writing = false;
+                    break;
+                }
+                next = slot.latest;
+                slot.pending = false;
+            }
+
+            if(error)
+                std::rethrow_exception(error);
+        }
+    private:
+        struct slot
+        {
+            bool writing = false;
+            bool pending = false;
+            value latest{};
+        };
+
+        std::mutex _lock;
+        std::map<key, slot> _slots;
+    };
+}
+
+#endif //LOGID_WRITE_COMBINER_H